@@ -25,8 +25,58 @@
 #include "pch.h"
 #include "Trace.h"
 #include "AX25Adapter.h"
+#include "Driver.h"
 #include "AX25Adapter.tmh"
 
+// DEFAULT_MAC_ADDRESS is used by reference (ToWire), so it needs a definition
+constexpr AX25Address AX25Adapter::DEFAULT_MAC_ADDRESS;
+
+/** Reported for OID_GEN_VENDOR_ID: the adapter has no IEEE-assigned vendor code */
+static constexpr ULONG VENDOR_ID = 0x00FFFFFF;
+
+/** Reported for OID_GEN_VENDOR_DESCRIPTION */
+static constexpr char VENDOR_DESCRIPTION[] = "KG7UDH Virtual AX.25 Adapter";
+
+/** The NDIS_STATISTICS_INFO counters kept by AdapterStatistics */
+static constexpr ULONG SUPPORTED_STATISTICS =
+    NDIS_STATISTICS_DIRECTED_FRAMES_RCV_SUPPORTED |
+    NDIS_STATISTICS_MULTICAST_FRAMES_RCV_SUPPORTED |
+    NDIS_STATISTICS_BROADCAST_FRAMES_RCV_SUPPORTED |
+    NDIS_STATISTICS_BYTES_RCV_SUPPORTED |
+    NDIS_STATISTICS_RCV_DISCARDS_SUPPORTED |
+    NDIS_STATISTICS_RCV_ERROR_SUPPORTED |
+    NDIS_STATISTICS_DIRECTED_FRAMES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_MULTICAST_FRAMES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_BROADCAST_FRAMES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_BYTES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_XMIT_ERROR_SUPPORTED |
+    NDIS_STATISTICS_XMIT_DISCARDS_SUPPORTED |
+    NDIS_STATISTICS_DIRECTED_BYTES_RCV_SUPPORTED |
+    NDIS_STATISTICS_MULTICAST_BYTES_RCV_SUPPORTED |
+    NDIS_STATISTICS_BROADCAST_BYTES_RCV_SUPPORTED |
+    NDIS_STATISTICS_DIRECTED_BYTES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_MULTICAST_BYTES_XMIT_SUPPORTED |
+    NDIS_STATISTICS_BROADCAST_BYTES_XMIT_SUPPORTED;
+
+/**
+ * How far ahead of the air, in milliseconds, frames are handed to the radio under channel access: long enough
+ * for the connector to pass an ordinary frame on before the one being sent is finished. Anything beyond that
+ * waits in the transmit classes, where a frame of higher priority can still overtake it.
+ */
+static constexpr ULONG64 TRANSMIT_LOOKAHEAD_MILLISECONDS = 500;
+
+/**
+ * Gets the time given to the data links. The unbiased interrupt time does not advance while the system sleeps,
+ * so a link's timers do not all expire at once on resume.
+ * @returns the time since boot, in milliseconds
+ */
+NON_PAGEABLE_FUNCTION
+static inline ULONG64 dataLinkTime() noexcept
+{
+    // The interrupt time counts in units of 100ns
+    return KeQueryUnbiasedInterruptTime() / 10000;
+}
+
 /**
  * Initializes a new AX25Adapter object to default parameters and state
  * @param driverHandle the NDIS driver handle with which to allocate
@@ -36,69 +86,52 @@ _IRQL_requires_(PASSIVE_LEVEL)
 NON_PAGEABLE_FUNCTION
 AX25Adapter::AX25Adapter(_In_ NDIS_HANDLE driverHandle) noexcept
     :state(Initializing)
+    ,activeCalls(0)
+    ,transmitFramesGathered(0)
+    ,transmitFramesFlattened(0)
     ,currentVlan(0)
-    ,currentPacketFilterMode(0)
-    ,joinedMulticastGroups{0}
+    ,receiveFilter(joinedMulticastGroups)
+    ,receiveModeration(RECEIVE_BUFFER_COUNT)
+    ,receiveBacklog(nullptr)
+    ,receiveBacklogTail(nullptr)
+    ,receiveIndicateActive(0)
+    ,pausePending(0)
+    ,transmitDrainActive(0)
+    ,connector(nullptr)
+    ,channelAccessEnabled(false)
+    ,channelAccess(static_cast<ULONG>(KeQueryUnbiasedInterruptTime()) ^ static_cast<ULONG>(reinterpret_cast<ULONG_PTR>(this)))
+    ,carrierDetected(0)
+    ,connectedMode(false)
+    ,mtuSize(DEFAULT_MTU_SIZE_BYTES)
+    ,headerCompressionMode(HeaderCompressionTable::Disabled)
+    ,payloadCompressionMode(PayloadCompressor::Disabled)
+    ,nextPayloadCompressionPeer(0)
+    ,dataLinkTimerDeadline(MAXULONG64)
+    ,dataLinkTransmitPending(0)
     ,driverHandle(driverHandle)
 {
     initializeRegistrationAttributes();
     initializeGeneralAttributes();
 
-    NDIS_OID const oidList[] = {
-        OID_GEN_HARDWARE_STATUS,
-        OID_GEN_TRANSMIT_BUFFER_SPACE,
-        OID_GEN_RECEIVE_BUFFER_SPACE,
-        OID_GEN_TRANSMIT_BLOCK_SIZE,
-        OID_GEN_RECEIVE_BLOCK_SIZE,
-        OID_GEN_VENDOR_ID,
-        OID_GEN_VENDOR_DESCRIPTION,
-        OID_GEN_VENDOR_DRIVER_VERSION,
-        OID_GEN_CURRENT_PACKET_FILTER,
-        OID_GEN_CURRENT_LOOKAHEAD,
-        OID_GEN_DRIVER_VERSION,
-        OID_GEN_MAXIMUM_TOTAL_SIZE,
-        OID_GEN_XMIT_OK,
-        OID_GEN_RCV_OK,
-        OID_GEN_STATISTICS,
-        OID_GEN_TRANSMIT_QUEUE_LENGTH,       // Optional
-        OID_GEN_LINK_PARAMETERS,
-        OID_GEN_INTERRUPT_MODERATION,
-        OID_GEN_MEDIA_SUPPORTED,
-        OID_GEN_MEDIA_IN_USE,
-        OID_GEN_MAXIMUM_SEND_PACKETS,
-        OID_GEN_XMIT_ERROR,
-        OID_GEN_RCV_ERROR,
-        OID_GEN_RCV_NO_BUFFER,
-        OID_802_3_PERMANENT_ADDRESS,
-        OID_802_3_CURRENT_ADDRESS,
-        OID_802_3_MULTICAST_LIST,
-        OID_802_3_MAXIMUM_LIST_SIZE,
-        OID_802_3_RCV_ERROR_ALIGNMENT,
-        OID_802_3_XMIT_ONE_COLLISION,
-        OID_802_3_XMIT_MORE_COLLISIONS,
-        OID_802_3_XMIT_DEFERRED,             // Optional
-        OID_802_3_XMIT_MAX_COLLISIONS,       // Optional
-        OID_802_3_RCV_OVERRUN,               // Optional
-        OID_802_3_XMIT_UNDERRUN,             // Optional
-        OID_802_3_XMIT_HEARTBEAT_FAILURE,    // Optional
-        OID_802_3_XMIT_TIMES_CRS_LOST,       // Optional
-        OID_802_3_XMIT_LATE_COLLISIONS,      // Optional
-        OID_PNP_CAPABILITIES,                // Optional
-        OID_RECEIVE_FILTER_ALLOCATE_QUEUE,
-        OID_RECEIVE_FILTER_QUEUE_ALLOCATION_COMPLETE,
-        OID_RECEIVE_FILTER_FREE_QUEUE,
-        OID_RECEIVE_FILTER_CLEAR_FILTER,
-        OID_RECEIVE_FILTER_SET_FILTER,
-    };
-
-    static_assert(sizeof(oidList) == OID_LIST_LENGTH * sizeof(NDIS_OID), "OID_LIST_LENGTH needs to be set properly");
-    RtlCopyMemory(supportedOids, oidList, sizeof(oidList));
-
-    // Want to leave these two the same size to simplify communication with NDIS
-    static_assert(sizeof(inboundBuffer) == sizeof(outboundBuffer), "inbound and outbound buffers must be same size");
-
-    // Initialize the receive DPC
+    headerTranslator.SetLocalAddress(DEFAULT_MAC_ADDRESS);
+    BYTE ethernetAddress[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+    HeaderTranslator::AddressToEthernet(DEFAULT_MAC_ADDRESS, ethernetAddress);
+    receiveFilter.SetLocalAddress(ethernetAddress);
+
+    RtlZeroMemory(&receiveBatchStatistics, sizeof(receiveBatchStatistics));
+    receiveBatchStatistics.BatchLimit = DEFAULT_RECEIVE_BATCH_SIZE;
+    (void)receiveModeration.SetParameters(DEFAULT_RECEIVE_COALESCE_FRAMES, DEFAULT_RECEIVE_COALESCE_MICROSECONDS);
+
+    // Initialize the receive and transmit DPCs
     KeInitializeDpc(&receiveDpc, &receiveDpcCallback, this);
+    KeInitializeDpc(&transmitDpc, &transmitDpcCallback, this);
+    KeInitializeTimer(&receiveModerationTimer);
+    KeInitializeTimer(&channelAccessTimer);
+
+    KeInitializeSpinLock(&dataLinkLock);
+    KeInitializeDpc(&dataLinkTimerDpc, &dataLinkTimerDpcCallback, this);
+    KeInitializeTimer(&dataLinkTimer);
+    KeInitializeEvent(&callsDrained, NotificationEvent, FALSE);
 
     state = Paused;
 }
@@ -187,7 +220,8 @@ void AX25Adapter::operator delete(_In_opt_ void* pointer)
 }
 
 /**
- * Calls to NDIS to indicate this miniport adapter's attributes
+ * Calls to NDIS to indicate this miniport adapter's registration attributes. The general attributes follow
+ * in SetGeneralAttributes(), once the configuration has been read.
  * @returns NDIS_STATUS_SUCCESS if attribute setting was successful, or an error code otherwise
  */
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -212,7 +246,29 @@ NDIS_STATUS AX25Adapter::SetMiniportAttributes()
         TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Failed to set miniport adapter registration attributes: %!STATUS!", status);
         return status;
     }
-    status = NdisMSetMiniportAttributes(driverHandle, generalAttributes);
+
+    return status;
+}
+
+/**
+ * Calls to NDIS to indicate this miniport adapter's general attributes, with the MTU chosen by ReadConfiguration()
+ * @returns NDIS_STATUS_SUCCESS if attribute setting was successful, or an error code otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::SetGeneralAttributes()
+{
+    ASSERT(driverHandle != nullptr);
+    if (driverHandle == nullptr)
+    {
+        TraceEvents(TRACE_LEVEL_CRITICAL, TRACE_ADAPTER, "Cannot set miniport attributes: driver handle is nullptr");
+        return STATUS_INVALID_ADDRESS;
+    }
+
+    generalAttributes->MtuSize = mtuSize;
+    generalAttributes->LookaheadSize = mtuSize;
+    NDIS_STATUS status = NdisMSetMiniportAttributes(driverHandle, generalAttributes);
     if (NDIS_STATUS_SUCCESS != status)
     {
         // Report the error
@@ -220,7 +276,6 @@ NDIS_STATUS AX25Adapter::SetMiniportAttributes()
         return status;
     }
 
-
     return status;
 }
 
@@ -246,7 +301,7 @@ void AX25Adapter::initializeGeneralAttributes() noexcept
     generalAttributes->XmitLinkSpeed = DEFAULT_XMIT_BITS_PER_SECOND;
     generalAttributes->MaxRcvLinkSpeed = MAX_RCV_BITS_PER_SECOND;
     generalAttributes->RcvLinkSpeed = DEFAULT_RCV_BITS_PER_SECOND;
-    generalAttributes->LookaheadSize = sizeof(inboundBuffer);
+    generalAttributes->LookaheadSize = DEFAULT_MTU_SIZE_BYTES;
 
     generalAttributes->MediaConnectState = MediaConnectStateDisconnected;   // Start disconnected
     generalAttributes->MediaDuplexState = MediaDuplexStateHalf;             // A radio link is (almost) always half-duplex
@@ -256,20 +311,17 @@ void AX25Adapter::initializeGeneralAttributes() noexcept
         NDIS_MAC_OPTION_NO_LOOPBACK |
         NDIS_MAC_OPTION_8021P_PRIORITY |                            // required to be specified
         NDIS_MAC_OPTION_8021Q_VLAN;
-    generalAttributes->SupportedPacketFilters =
-        NDIS_PACKET_TYPE_DIRECTED |
-        NDIS_PACKET_TYPE_MULTICAST |
-        NDIS_PACKET_TYPE_ALL_MULTICAST |
-        NDIS_PACKET_TYPE_BROADCAST |
-        NDIS_PACKET_TYPE_PROMISCUOUS;
+    generalAttributes->SupportedPacketFilters = ReceiveFilter::SUPPORTED_PACKET_FILTERS;
 
     generalAttributes->MaxMulticastListSize = MAX_MULTICAST_GROUPS;
 
     // Copy in the mac address
+    // The stack sees the synthetic Ethernet address of our callsign; HeaderTranslator converts at the edge
+    generalAttributes->MacAddressLength = HeaderTranslator::ETHERNET_ADDRESS_LENGTH;
     RtlZeroMemory(generalAttributes->CurrentMacAddress, sizeof(generalAttributes->CurrentMacAddress));
-    memcpy(generalAttributes->CurrentMacAddress, &DEFAULT_MAC_ADDRESS, sizeof(DEFAULT_MAC_ADDRESS));
+    HeaderTranslator::AddressToEthernet(DEFAULT_MAC_ADDRESS, generalAttributes->CurrentMacAddress);
     RtlZeroMemory(generalAttributes->PermanentMacAddress, sizeof(generalAttributes->PermanentMacAddress));
-    memcpy(generalAttributes->PermanentMacAddress, &DEFAULT_MAC_ADDRESS, sizeof(DEFAULT_MAC_ADDRESS));
+    HeaderTranslator::AddressToEthernet(DEFAULT_MAC_ADDRESS, generalAttributes->PermanentMacAddress);
     
     generalAttributes->RecvScaleCapabilities = nullptr;                     // No support for receive-side scaling
 
@@ -284,31 +336,13 @@ void AX25Adapter::initializeGeneralAttributes() noexcept
                                                                  // indicate whether or not we're bound to a KISS/AGWPE port.
 
     // Required to support all statistics
-    generalAttributes->SupportedStatistics =
-        NDIS_STATISTICS_DIRECTED_FRAMES_RCV_SUPPORTED |
-        NDIS_STATISTICS_MULTICAST_FRAMES_RCV_SUPPORTED |
-        NDIS_STATISTICS_BROADCAST_FRAMES_RCV_SUPPORTED |
-        NDIS_STATISTICS_BYTES_RCV_SUPPORTED |
-        NDIS_STATISTICS_RCV_DISCARDS_SUPPORTED |
-        NDIS_STATISTICS_RCV_ERROR_SUPPORTED |
-        NDIS_STATISTICS_DIRECTED_FRAMES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_MULTICAST_FRAMES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_BROADCAST_FRAMES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_BYTES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_XMIT_ERROR_SUPPORTED |
-        NDIS_STATISTICS_XMIT_DISCARDS_SUPPORTED |
-        NDIS_STATISTICS_DIRECTED_BYTES_RCV_SUPPORTED |
-        NDIS_STATISTICS_MULTICAST_BYTES_RCV_SUPPORTED |
-        NDIS_STATISTICS_BROADCAST_BYTES_RCV_SUPPORTED |
-        NDIS_STATISTICS_DIRECTED_BYTES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_MULTICAST_BYTES_XMIT_SUPPORTED |
-        NDIS_STATISTICS_BROADCAST_BYTES_XMIT_SUPPORTED;
+    generalAttributes->SupportedStatistics = SUPPORTED_STATISTICS;
 
     generalAttributes->SupportedPauseFunctions = NdisPauseFunctionsUnsupported;
     generalAttributes->DataBackFillSize = 0;
     generalAttributes->ContextBackFillSize = 0;
-    generalAttributes->SupportedOidList = supportedOids;                          
-    generalAttributes->SupportedOidListLength = sizeof(supportedOids);
+    generalAttributes->SupportedOidList = const_cast<NDIS_OID*>(SUPPORTED_OIDS);     // NDIS does not write to the list
+    generalAttributes->SupportedOidListLength = sizeof(SUPPORTED_OIDS);
     generalAttributes->AutoNegotiationFlags =                                   // Pretend like we have always auto-negotiated all parameters
         NDIS_LINK_STATE_XMIT_LINK_SPEED_AUTO_NEGOTIATED                   |               // since the link will always be the same
         NDIS_LINK_STATE_RCV_LINK_SPEED_AUTO_NEGOTIATED |
@@ -372,26 +406,158 @@ void AX25Adapter::receiveDpcCallback(_In_ KDPC* dpc,
                                      _In_opt_ void* systemArgument1,
                                      _In_opt_ void* systemArgument2)
 {
-    // Normally I would call ExRaiseStatus(STATUS_NOT_IMPLEMENTED) here, but that is illegal
-    // at DISPATCH_LEVEL, so we're just going to issue a bugcheck instead.
     UNREFERENCED_PARAMETER(dpc);
-    UNREFERENCED_PARAMETER(adapterContext);
     UNREFERENCED_PARAMETER(systemArgument1);
     UNREFERENCED_PARAMETER(systemArgument2);
-    KeBugCheckEx(KMODE_EXCEPTION_NOT_HANDLED,
-                 static_cast<ULONG_PTR>(STATUS_NOT_IMPLEMENTED),
-                 reinterpret_cast<ULONG_PTR>(__FUNCTION__),
-                 NULL, NULL);
+
+    if (adapterContext == nullptr)
+    {
+        TraceEvents(TRACE_LEVEL_CRITICAL, TRACE_ADAPTER, "Cannot indicate received frames: DPC context is nullptr");
+        return;
+    }
+
+    static_cast<AX25Adapter*>(adapterContext)->indicateReceiveQueue();
+}
+
+/**
+ * Indicates the oldest received frames to NDIS as a single chain of at most receiveBatchStatistics.BatchLimit
+ * frames. Anything beyond that is left in the backlog and the receive DPC is queued again, so that a burst
+ * of traffic is spread over several DPCs rather than monopolizing this processor. If another processor is
+ * already indicating, this function returns immediately and leaves the work to that processor.
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::indicateReceiveQueue() noexcept
+{
+    if (InterlockedCompareExchange(&receiveIndicateActive, 1, 0) != 0)
+    {
+        return;
+    }
+
+    // Frames which arrive from here on start a new coalescing run, so none of them can be left without
+    // a timer or DPC to pick them up
+    receiveModeration.DpcStarted();
+
+    // Move everything received since the last run behind the backlog. Each queued frame is a single
+    // NET_BUFFER_LIST, so this only relinks them into NDIS chain order.
+    NET_BUFFER_LIST* next = nullptr;
+    for (NET_BUFFER_LIST* current = receiveQueue.DequeueAll(); current != nullptr; current = next)
+    {
+        next = NetBufferListChainLink::Link(*current);
+        NET_BUFFER_LIST_NEXT_NBL(current) = nullptr;
+        if (receiveBacklog == nullptr)
+        {
+            receiveBacklog = current;
+        }
+        else
+        {
+            NET_BUFFER_LIST_NEXT_NBL(receiveBacklogTail) = current;
+        }
+        receiveBacklogTail = current;
+    }
+
+    if (receiveBacklog != nullptr)
+    {
+        if (state != Running)
+        {
+            // Frames must not be indicated once a pause has begun, so the whole backlog goes back to the pool
+            NET_BUFFER_LIST* discarded = receiveBacklog;
+            receiveBacklog = nullptr;
+            receiveBacklogTail = nullptr;
+
+            ULONG count = 0;
+            for (NET_BUFFER_LIST* current = discarded; current != nullptr; current = NET_BUFFER_LIST_NEXT_NBL(current))
+            {
+                count++;
+            }
+            statistics.CountReceiveDiscards(count);
+            returnReceiveBuffers(*discarded);
+        }
+        else
+        {
+            // Detach up to one batch from the front of the backlog
+            NET_BUFFER_LIST* batch = receiveBacklog;
+            NET_BUFFER_LIST* last = batch;
+            ULONG count = 1;
+            while (count < receiveBatchStatistics.BatchLimit && NET_BUFFER_LIST_NEXT_NBL(last) != nullptr)
+            {
+                last = NET_BUFFER_LIST_NEXT_NBL(last);
+                count++;
+            }
+
+            receiveBacklog = NET_BUFFER_LIST_NEXT_NBL(last);
+            NET_BUFFER_LIST_NEXT_NBL(last) = nullptr;
+            if (receiveBacklog == nullptr)
+            {
+                receiveBacklogTail = nullptr;
+            }
+            else
+            {
+                receiveBatchStatistics.DeferredBatches++;
+            }
+
+            receiveModeration.FramesIndicated(count);
+            indicateReceiveBatch(*batch, count);
+        }
+    }
+
+    // Anything left over, or queued after our dequeue by a producer whose DPC found us busy, needs another run
+    InterlockedExchange(&receiveIndicateActive, 0);
+    if (receiveBacklog != nullptr || !receiveQueue.IsEmpty())
+    {
+        KeInsertQueueDpc(&receiveDpc, nullptr, nullptr);
+    }
+}
+
+/**
+ * Indicates a single chain of received frames to NDIS and records its size in the batch histogram
+ * @param batch the head of a chain of NET_BUFFER_LIST objects taken from receivePool
+ * @param count the number of NET_BUFFER_LIST objects in the chain
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::indicateReceiveBatch(_In_ NET_BUFFER_LIST& batch, _In_ ULONG count) noexcept
+{
+    ULONG bucket = 0;
+    _BitScanReverse(&bucket, count);
+    receiveBatchStatistics.Batches[bucket < RECEIVE_BATCH_HISTOGRAM_BUCKETS ? bucket : RECEIVE_BATCH_HISTOGRAM_BUCKETS - 1]++;
+
+    // Count the frames before NDIS owns them. Each buffer starts with the Ethernet header ReceiveFrame wrote.
+    for (NET_BUFFER_LIST* current = &batch; current != nullptr; current = NET_BUFFER_LIST_NEXT_NBL(current))
+    {
+        statistics.CountReceived(ReceiveBufferPool::GetData(*current), NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(current)));
+    }
+
+    // Once the pool is running low, have NDIS copy the frames so the buffers come straight back
+    // rather than sitting in a protocol's queue while the radio keeps receiving
+    bool lowResources = receivePool.IsLow();
+    NdisMIndicateReceiveNetBufferLists(driverHandle, &batch, NDIS_DEFAULT_PORT_NUMBER, count,
+                                       NDIS_RECEIVE_FLAGS_DISPATCH_LEVEL | (lowResources ? NDIS_RECEIVE_FLAGS_RESOURCES : 0));
+    if (lowResources)
+    {
+        returnReceiveBuffers(batch);
+    }
 }
 
 /**
  * Destroys and deallocates this object. After calling this function, the object is no longer valid and
  * points to invalid memory.
  */
-_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_(PASSIVE_LEVEL)
 NON_PAGEABLE_FUNCTION
 void AX25Adapter::Destroy() noexcept
 {
+    // Pause() leaves no timer set, but a timer which expired after the adapter was freed would run its DPC
+    // on freed memory, so make sure of it
+    KeCancelTimer(&receiveModerationTimer);
+    KeCancelTimer(&channelAccessTimer);
+    KeCancelTimer(&dataLinkTimer);
+    KeFlushQueuedDpcs();
+
+    receivePool.Free();     // NDIS has returned every receive buffer by the time the adapter is halted
+    statistics.Free();
+    dataLinks.Free();
+    headerCompression.Free();
     this->~AX25Adapter();   // doesn't currently do anything interesting, but called for completeness/futureproofing
     delete this;            // calls to AX25Adapter::operator delete
 }
@@ -421,11 +587,99 @@ _Must_inspect_result_
 PAGEABLE_FUNCTION
 NDIS_STATUS AX25Adapter::Pause() noexcept
 {
-    // TODO: Complete active transmissions
+    // New sends are rejected from this point on. Anything already queued is still transmitted by the
+    // transmit DPC, so wait for any queued DPCs to finish before declaring the adapter paused.
+    KeClearEvent(&callsDrained);
+    state = Pausing;
+
+    // A send or receive which found the adapter running just before this may still be queueing its frames.
+    // The last of them to leave sets callsDrained, so that everything they queued is seen by the DPCs flushed below.
+    KeMemoryBarrier();
+    if (activeCalls != 0)
+    {
+        (void)KeWaitForSingleObject(&callsDrained, Executive, KernelMode, FALSE, nullptr);
+    }
+
+    // A DPC which was already running may set a timer again before it sees the state, or give up the transmit
+    // queue to a drain which was about to defer to the channel, so the timers are cancelled and the DPCs flushed
+    // until no timer was found set and nothing is left waiting to be sent
+    bool timerWasSet;
+    do
+    {
+        // Frames waiting for the coalescing timer must not wait for it: the DPC returns them to the pool
+        timerWasSet = KeCancelTimer(&receiveModerationTimer) != FALSE;
+        if (!receiveQueue.IsEmpty())
+        {
+            KeInsertQueueDpc(&receiveDpc, nullptr, nullptr);
+        }
+
+        // Frames held back for the channel go out at once, as the drain no longer waits for it while pausing
+        timerWasSet |= KeCancelTimer(&channelAccessTimer) != FALSE;
+        if (!transmitQueue.IsEmpty() || !transmitScheduler.IsEmpty())
+        {
+            KeInsertQueueDpc(&transmitDpc, nullptr, nullptr);
+        }
+
+        // Connected-mode links are left as they are, without sending DISC, and their timers resume on restart
+        timerWasSet |= KeCancelTimer(&dataLinkTimer) != FALSE;
+        KeFlushQueuedDpcs();
+    } while (timerWasSet || !transmitQueue.IsEmpty() || !transmitScheduler.IsEmpty());
+    dataLinkTimerDeadline = MAXULONG64;
+
+    // Datagrams only partly received hold receive buffers, which the pause cannot complete without
+    discardSegments();
+
+    // Received frames still held by protocols must be returned before the pause is complete. If they
+    // have not all come back yet, ReturnNetBufferLists completes the pause when the last one does.
+    InterlockedExchange(&pausePending, 1);
+    return tryCompletePause() ? NDIS_STATUS_SUCCESS : NDIS_STATUS_PENDING;
+}
+
+/**
+ * Completes a pending pause if every receive buffer has been returned. Exactly one caller completes
+ * each pause, regardless of how many processors race to do so.
+ * @returns true if this call moved the adapter to the Paused state
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::tryCompletePause() noexcept
+{
+    if (pausePending == 0 || !receivePool.IsFull() || InterlockedExchange(&pausePending, 0) == 0)
+    {
+        return false;
+    }
+
     state = Paused;
-    return NDIS_STATUS_SUCCESS;
+    return true;
+}
+
+/**
+ * Ends a call counted in activeCalls. The last call to leave while the adapter is Pausing wakes Pause().
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::leaveCall() noexcept
+{
+    // The decrement is a full barrier, so either this sees Pausing or Pause() sees the count it left
+    if (InterlockedDecrement(&activeCalls) == 0 && state == Pausing)
+    {
+        KeSetEvent(&callsDrained, IO_NO_INCREMENT, FALSE);
+    }
 }
 
+/**
+ * Drops the datagrams reassembler has only partly received, returning their buffers to receivePool
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::discardSegments() noexcept
+{
+    KIRQL irql;
+    KeAcquireSpinLock(&dataLinkLock, &irql);
+    reassembler.Discard(*this);
+    KeReleaseSpinLock(&dataLinkLock, irql);
+}
 
 /**
  * Restarts this adapter, shifting it back into the running state. After this function is called,
@@ -439,9 +693,132 @@ NDIS_STATUS AX25Adapter::Restart(const NDIS_MINIPORT_RESTART_PARAMETERS& restart
     UNREFERENCED_PARAMETER(restartParameters);
     // TODO: Connect to connector as appropriate
     state = Running;
+    if (connectedMode)
+    {
+        // Catches up on any link timers which expired while paused, and sets the timer for the rest
+        KeInsertQueueDpc(&dataLinkTimerDpc, nullptr, nullptr);
+    }
     return NDIS_STATUS_SUCCESS;
 }
 
+/**
+ * Checks, at compile time, that SUPPORTED_OIDS is in strictly ascending order (so that it can be searched
+ * with a binary search) and that OID_DISPATCH_TABLE lines up with it
+ * @param index the first entry to check
+ * @returns true if the entries from index onwards are consistent
+ */
+constexpr bool AX25Adapter::oidTablesAreConsistent(_In_ size_t index) noexcept
+{
+    return index == OID_LIST_LENGTH ||
+           ((index == 0 || SUPPORTED_OIDS[index - 1] < SUPPORTED_OIDS[index]) &&
+            OID_DISPATCH_TABLE[index].oid == SUPPORTED_OIDS[index] &&
+            oidTablesAreConsistent(index + 1));
+}
+
+constexpr NDIS_OID AX25Adapter::SUPPORTED_OIDS[OID_LIST_LENGTH] = {
+    OID_GEN_HARDWARE_STATUS,
+    OID_GEN_MEDIA_SUPPORTED,
+    OID_GEN_MEDIA_IN_USE,
+    OID_GEN_TRANSMIT_BUFFER_SPACE,
+    OID_GEN_RECEIVE_BUFFER_SPACE,
+    OID_GEN_TRANSMIT_BLOCK_SIZE,
+    OID_GEN_RECEIVE_BLOCK_SIZE,
+    OID_GEN_VENDOR_ID,
+    OID_GEN_VENDOR_DESCRIPTION,
+    OID_GEN_CURRENT_PACKET_FILTER,
+    OID_GEN_CURRENT_LOOKAHEAD,
+    OID_GEN_DRIVER_VERSION,
+    OID_GEN_MAXIMUM_TOTAL_SIZE,
+    OID_GEN_MAXIMUM_SEND_PACKETS,
+    OID_GEN_VENDOR_DRIVER_VERSION,
+    OID_GEN_LINK_PARAMETERS,
+    OID_GEN_INTERRUPT_MODERATION,
+    OID_RECEIVE_FILTER_ALLOCATE_QUEUE,
+    OID_RECEIVE_FILTER_FREE_QUEUE,
+    OID_RECEIVE_FILTER_SET_FILTER,
+    OID_RECEIVE_FILTER_CLEAR_FILTER,
+    OID_RECEIVE_FILTER_QUEUE_ALLOCATION_COMPLETE,
+    OID_GEN_XMIT_OK,
+    OID_GEN_RCV_OK,
+    OID_GEN_XMIT_ERROR,
+    OID_GEN_RCV_ERROR,
+    OID_GEN_RCV_NO_BUFFER,
+    OID_GEN_STATISTICS,
+    OID_GEN_TRANSMIT_QUEUE_LENGTH,       // Optional
+    OID_802_3_PERMANENT_ADDRESS,
+    OID_802_3_CURRENT_ADDRESS,
+    OID_802_3_MULTICAST_LIST,
+    OID_802_3_MAXIMUM_LIST_SIZE,
+    OID_802_3_RCV_ERROR_ALIGNMENT,
+    OID_802_3_XMIT_ONE_COLLISION,
+    OID_802_3_XMIT_MORE_COLLISIONS,
+    OID_802_3_XMIT_DEFERRED,             // Optional
+    OID_802_3_XMIT_MAX_COLLISIONS,       // Optional
+    OID_802_3_RCV_OVERRUN,               // Optional
+    OID_802_3_XMIT_UNDERRUN,             // Optional
+    OID_802_3_XMIT_HEARTBEAT_FAILURE,    // Optional
+    OID_802_3_XMIT_TIMES_CRS_LOST,       // Optional
+    OID_802_3_XMIT_LATE_COLLISIONS,      // Optional
+    OID_PNP_CAPABILITIES,                // Optional
+    OID_AX25_RECEIVE_BATCH_HISTOGRAM,
+    OID_AX25_HEADER_CACHE_STATISTICS,
+    OID_AX25_RECEIVE_MODERATION,
+    OID_AX25_HEADER_COMPRESSION_STATISTICS,
+    OID_AX25_TRANSMIT_CLASS_STATISTICS,
+};
+
+constexpr AX25Adapter::OidDispatchEntry AX25Adapter::OID_DISPATCH_TABLE[OID_LIST_LENGTH] = {
+    { OID_GEN_HARDWARE_STATUS,              &AX25Adapter::queryConstant<NdisHardwareStatusReady>,   nullptr },
+    { OID_GEN_MEDIA_SUPPORTED,              &AX25Adapter::queryConstant<NdisMedium802_3>,           nullptr },
+    { OID_GEN_MEDIA_IN_USE,                 &AX25Adapter::queryConstant<NdisMedium802_3>,           nullptr },
+    { OID_GEN_TRANSMIT_BUFFER_SPACE,        &AX25Adapter::queryConstant<sizeof(outboundBuffer)>,    nullptr },
+    { OID_GEN_RECEIVE_BUFFER_SPACE,         &AX25Adapter::queryConstant<RECEIVE_BUFFER_COUNT * RECEIVE_BUFFER_SIZE>, nullptr },
+    { OID_GEN_TRANSMIT_BLOCK_SIZE,          &AX25Adapter::queryConstant<RECEIVE_BUFFER_SIZE>,       nullptr },
+    { OID_GEN_RECEIVE_BLOCK_SIZE,           &AX25Adapter::queryConstant<RECEIVE_BUFFER_SIZE>,       nullptr },
+    { OID_GEN_VENDOR_ID,                    &AX25Adapter::queryConstant<VENDOR_ID>,                 nullptr },
+    { OID_GEN_VENDOR_DESCRIPTION,           &AX25Adapter::queryVendorDescription,                   nullptr },
+    { OID_GEN_CURRENT_PACKET_FILTER,        &AX25Adapter::queryPacketFilter,                        &AX25Adapter::setPacketFilter },
+    { OID_GEN_CURRENT_LOOKAHEAD,            &AX25Adapter::queryLookahead,                           &AX25Adapter::setLookahead },
+    { OID_GEN_DRIVER_VERSION,               &AX25Adapter::queryDriverVersion,                       nullptr },
+    { OID_GEN_MAXIMUM_TOTAL_SIZE,           &AX25Adapter::queryMaximumTotalSize,                    nullptr },
+    { OID_GEN_MAXIMUM_SEND_PACKETS,         &AX25Adapter::queryConstant<1>,                         nullptr },
+    { OID_GEN_VENDOR_DRIVER_VERSION,        &AX25Adapter::queryConstant<(DRIVER_MAJOR_VERSION << 16) | DRIVER_MINOR_VERSION>, nullptr },
+    { OID_GEN_LINK_PARAMETERS,              nullptr,                                                nullptr },
+    { OID_GEN_INTERRUPT_MODERATION,         &AX25Adapter::queryInterruptModeration,                 &AX25Adapter::setInterruptModeration },
+    { OID_RECEIVE_FILTER_ALLOCATE_QUEUE,    nullptr,                                                nullptr },
+    { OID_RECEIVE_FILTER_FREE_QUEUE,        nullptr,                                                nullptr },
+    { OID_RECEIVE_FILTER_SET_FILTER,        nullptr,                                                nullptr },
+    { OID_RECEIVE_FILTER_CLEAR_FILTER,      nullptr,                                                nullptr },
+    { OID_RECEIVE_FILTER_QUEUE_ALLOCATION_COMPLETE, nullptr,                                        nullptr },
+    { OID_GEN_XMIT_OK,                      &AX25Adapter::queryTransmitOk,                          nullptr },
+    { OID_GEN_RCV_OK,                       &AX25Adapter::queryReceiveOk,                           nullptr },
+    { OID_GEN_XMIT_ERROR,                   &AX25Adapter::queryTransmitErrors,                      nullptr },
+    { OID_GEN_RCV_ERROR,                    &AX25Adapter::queryReceiveErrors,                       nullptr },
+    { OID_GEN_RCV_NO_BUFFER,                &AX25Adapter::queryReceiveNoBuffer,                     nullptr },
+    { OID_GEN_STATISTICS,                   &AX25Adapter::queryStatistics,                          nullptr },
+    { OID_GEN_TRANSMIT_QUEUE_LENGTH,        nullptr,                                                nullptr },
+    { OID_802_3_PERMANENT_ADDRESS,          &AX25Adapter::queryPermanentAddress,                    nullptr },
+    { OID_802_3_CURRENT_ADDRESS,            &AX25Adapter::queryCurrentAddress,                      nullptr },
+    { OID_802_3_MULTICAST_LIST,             &AX25Adapter::queryMulticastList,                       &AX25Adapter::setMulticastList },
+    { OID_802_3_MAXIMUM_LIST_SIZE,          &AX25Adapter::queryConstant<MAX_MULTICAST_GROUPS>,      nullptr },
+    { OID_802_3_RCV_ERROR_ALIGNMENT,        &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_ONE_COLLISION,         &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_MORE_COLLISIONS,       &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_DEFERRED,              &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_MAX_COLLISIONS,        &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_RCV_OVERRUN,                &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_UNDERRUN,              &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_HEARTBEAT_FAILURE,     &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_TIMES_CRS_LOST,        &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_802_3_XMIT_LATE_COLLISIONS,       &AX25Adapter::queryZeroCounter,                         nullptr },
+    { OID_PNP_CAPABILITIES,                 nullptr,                                                nullptr },
+    { OID_AX25_RECEIVE_BATCH_HISTOGRAM,     &AX25Adapter::queryReceiveBatchHistogram,               nullptr },
+    { OID_AX25_HEADER_CACHE_STATISTICS,     &AX25Adapter::queryHeaderCacheStatistics,               nullptr },
+    { OID_AX25_RECEIVE_MODERATION,          &AX25Adapter::queryReceiveModeration,                   &AX25Adapter::setReceiveModeration },
+    { OID_AX25_HEADER_COMPRESSION_STATISTICS, &AX25Adapter::queryHeaderCompressionStatistics,       nullptr },
+    { OID_AX25_TRANSMIT_CLASS_STATISTICS,   &AX25Adapter::queryTransmitClassStatistics,             nullptr },
+};
+
 /**
  * Handles an OID request to query or set information for this adapter. The OID request
  * specifies the behavior expected.
@@ -468,54 +845,2032 @@ NDIS_STATUS AX25Adapter::HandleOidRequest(_In_ NDIS_OID_REQUEST& oidRequest) noe
         return NDIS_STATUS_NOT_ACCEPTED;
     }
 
-    // TODO: Handle OID requests
-    UNREFERENCED_PARAMETER(oidRequest);
-    return STATUS_NOT_IMPLEMENTED;
+    const bool isQuery = oidRequest.RequestType == NdisRequestQueryInformation ||
+                         oidRequest.RequestType == NdisRequestQueryStatistics;
+    if (!isQuery && oidRequest.RequestType != NdisRequestSetInformation)
+    {
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    const NDIS_OID oid = isQuery ? oidRequest.DATA.QUERY_INFORMATION.Oid : oidRequest.DATA.SET_INFORMATION.Oid;
+    const OidDispatchEntry* entry = findOidHandlers(oid);
+    if (entry == nullptr)
+    {
+        return NDIS_STATUS_INVALID_OID;
+    }
+
+    const OidHandler handler = isQuery ? entry->query : entry->set;
+    if (handler == nullptr)
+    {
+        TraceEvents(TRACE_LEVEL_VERBOSE, TRACE_ADAPTER, "OID 0x%08x is not supported for this request type", oid);
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    return (this->*handler)(oidRequest);
 }
 
 /**
- * Sends the given network data along this adapter. This adapter must be in the running state or the request
- * will be rejected. This function may return before the data has been transmitted. After completion 
- * (whether success or failure), NdisMSendNetBufferListsComplete will be called. Until NdisMSendNetBufferListsComplete
- * is called, this adapter owns the netBufferList object provided. After NdisMSendNetBufferListsComplete is called,
- * ownership is released and the memory is treated as inaccessible. Note that a call to NdisMSendNetBufferListsComplete
- * does not necessarily mean the data has been transmitted, but rather that it has at least been queued for transmission
- * and the buffer is no longer needed.
- * @param netBufferList a linked list of NET_BUFFER_LIST objects indicating the data to be transmitted, in order
- * @param sendFlags the flags associted with this send operation. If NDIS_SEND_FLAGS_CHECK_FOR_LOOPBACK is set, then
- * this function will check to see if the data should loop back. If NDIS_SEND_FLAGS_DISPATCH_LEVEL is set, then the current
- * IRQL is DISPATCH_LEVEL.
+ * Finds the handlers for an OID with a binary search of SUPPORTED_OIDS
+ * @param oid the OID of a request
+ * @returns the handlers for the OID, or nullptr if the OID is not supported
  */
-_When_(sendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL, _IRQL_requires_(DISPATCH_LEVEL))
-_When_(!(sendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL), _IRQL_requires_max_(APC_LEVEL))
-_IRQL_requires_same_
+_Must_inspect_result_
 NON_PAGEABLE_FUNCTION
-void AX25Adapter::SendNetBufferLists(
-    _In_ NET_BUFFER_LIST& netBufferList, 
-    _In_ ULONG sendFlags) noexcept
+const AX25Adapter::OidDispatchEntry* AX25Adapter::findOidHandlers(_In_ NDIS_OID oid) noexcept
 {
-   // TODO: Enqueue the data 
-    UNREFERENCED_PARAMETER(netBufferList);
-    UNREFERENCED_PARAMETER(sendFlags);
+    static_assert(oidTablesAreConsistent(0), "SUPPORTED_OIDS must be sorted and match OID_DISPATCH_TABLE");
+
+    size_t low = 0;
+    size_t high = OID_LIST_LENGTH;
+    while (low < high)
+    {
+        const size_t middle = (low + high) / 2;
+        if (SUPPORTED_OIDS[middle] < oid)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return (low < OID_LIST_LENGTH && SUPPORTED_OIDS[low] == oid) ? &OID_DISPATCH_TABLE[low] : nullptr;
 }
 
 /**
- * Returns the specified NET_BUFFER_LIST objects to being owned by this object so that they
- * can be reused in future receive operations.
- * @param netBufferLists a linked list of NET_BUFFER_LIST objects that are to be returned to ownership
- * by this object
- * @param returnFlags a flag field with bit NDIS_RETURN_FLAGS_DISPATCH_LEVEL set if the current IRQL
- * is DISPATCH_LEVEL.
+ * Completes a query for a statistics counter. As with all NDIS counters, the value is returned as a
+ * 64-bit integer if the buffer has room, and truncated to 32 bits otherwise.
+ * @param oidRequest the query request to complete
+ * @param value the current value of the counter
+ * @returns NDIS_STATUS_SUCCESS if the value was written, or NDIS_STATUS_BUFFER_TOO_SHORT if the buffer
+ * cannot hold even a 32-bit value
  */
-_When_(returnFlags & NDIS_RETURN_FLAGS_DISPATCH_LEVEL, _IRQL_requires_(DISPATCH_LEVEL))
-_When_(!(returnFlags & NDIS_RETURN_FLAGS_DISPATCH_LEVEL), _IRQL_requires_max_(APC_LEVEL))
-_IRQL_requires_same_
-NON_PAGEABLE_FUNCTION
-void ReturnNetBufferLists(
-    _In_ NET_BUFFER_LIST& netBufferLists,
-    _In_ ULONG returnFlags) noexcept
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryCounter(_Inout_ NDIS_OID_REQUEST& oidRequest, _In_ ULONG64 value) noexcept
 {
-    // TODO: Return the net buffer lists
-    UNREFERENCED_PARAMETER(netBufferLists);
-    UNREFERENCED_PARAMETER(returnFlags);
+    auto& query = oidRequest.DATA.QUERY_INFORMATION;
+    if (query.InformationBufferLength >= sizeof(ULONG64))
+    {
+        *static_cast<ULONG64*>(query.InformationBuffer) = value;
+        query.BytesWritten = sizeof(ULONG64);
+    }
+    else if (query.InformationBufferLength >= sizeof(ULONG))
+    {
+        *static_cast<ULONG*>(query.InformationBuffer) = static_cast<ULONG>(value);
+        query.BytesWritten = sizeof(ULONG);
+    }
+    else
+    {
+        query.BytesNeeded = sizeof(ULONG64);
+        return NDIS_STATUS_BUFFER_TOO_SHORT;
+    }
+
+    query.BytesNeeded = query.BytesWritten;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query by copying a fixed block of data into the request's buffer
+ * @param oidRequest the query request to complete
+ * @param data the data to return
+ * @param length the number of bytes of data
+ * @returns NDIS_STATUS_SUCCESS if the data was written, or NDIS_STATUS_BUFFER_TOO_SHORT if the buffer
+ * cannot hold all of it
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryBuffer(
+    _Inout_ NDIS_OID_REQUEST& oidRequest,
+    _In_reads_bytes_(length) const void* data,
+    _In_ ULONG length) noexcept
+{
+    auto& query = oidRequest.DATA.QUERY_INFORMATION;
+    query.BytesNeeded = length;
+    if (query.InformationBufferLength < length)
+    {
+        return NDIS_STATUS_BUFFER_TOO_SHORT;
+    }
+
+    RtlCopyMemory(query.InformationBuffer, data, length);
+    query.BytesWritten = length;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for an OID whose value never changes
+ * @tparam value the value of the OID
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+template<ULONG value>
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryConstant(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    const ULONG result = value;
+    return queryBuffer(oidRequest, &result, sizeof(result));
+}
+
+/**
+ * Completes a query for an Ethernet error counter. None of these errors can happen on this adapter.
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryZeroCounter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    return queryCounter(oidRequest, 0);
+}
+
+/**
+ * Completes a query for OID_GEN_VENDOR_DESCRIPTION
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryVendorDescription(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    return queryBuffer(oidRequest, VENDOR_DESCRIPTION, sizeof(VENDOR_DESCRIPTION));
+}
+
+/**
+ * Completes a query for OID_GEN_DRIVER_VERSION, the NDIS version the driver uses
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryDriverVersion(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    const USHORT version = (NDIS_MINIPORT_MAJOR_VERSION << 8) | NDIS_MINIPORT_MINOR_VERSION;
+    return queryBuffer(oidRequest, &version, sizeof(version));
+}
+
+/**
+ * Completes a query for OID_GEN_CURRENT_PACKET_FILTER
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryPacketFilter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    const ULONG packetFilter = receiveFilter.GetPacketFilter();
+    return queryBuffer(oidRequest, &packetFilter, sizeof(packetFilter));
+}
+
+/**
+ * Completes a set of OID_GEN_CURRENT_PACKET_FILTER
+ * @param oidRequest the set request to complete
+ * @returns NDIS_STATUS_SUCCESS if the filter was changed, NDIS_STATUS_INVALID_LENGTH if the buffer is too
+ * small, or NDIS_STATUS_NOT_SUPPORTED if the filter includes a packet type this adapter does not support
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::setPacketFilter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& set = oidRequest.DATA.SET_INFORMATION;
+    if (set.InformationBufferLength < sizeof(ULONG))
+    {
+        set.BytesNeeded = sizeof(ULONG);
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    if (!receiveFilter.SetPacketFilter(*static_cast<const ULONG*>(set.InformationBuffer)))
+    {
+        return NDIS_STATUS_NOT_SUPPORTED;
+    }
+
+    set.BytesRead = sizeof(ULONG);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for OID_GEN_CURRENT_LOOKAHEAD, which is always the MTU
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryLookahead(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    return queryBuffer(oidRequest, &mtuSize, sizeof(mtuSize));
+}
+
+/**
+ * Completes a set of OID_GEN_CURRENT_LOOKAHEAD. Received frames are always indicated whole, so any lookahead
+ * up to the MTU is already satisfied.
+ * @param oidRequest the set request to complete
+ * @returns NDIS_STATUS_SUCCESS if the lookahead is at most the MTU, or an error status otherwise
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::setLookahead(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& set = oidRequest.DATA.SET_INFORMATION;
+    if (set.InformationBufferLength < sizeof(ULONG))
+    {
+        set.BytesNeeded = sizeof(ULONG);
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    if (*static_cast<const ULONG*>(set.InformationBuffer) > mtuSize)
+    {
+        return NDIS_STATUS_INVALID_DATA;
+    }
+
+    set.BytesRead = sizeof(ULONG);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for OID_GEN_MAXIMUM_TOTAL_SIZE, the MTU with the Ethernet header
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryMaximumTotalSize(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    const ULONG maximumTotalSize = mtuSize + ETHERNET_HEADER_LENGTH;
+    return queryBuffer(oidRequest, &maximumTotalSize, sizeof(maximumTotalSize));
+}
+
+/**
+ * Completes a query for OID_GEN_RCV_NO_BUFFER, the number of frames dropped because the receive pool was empty
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryReceiveNoBuffer(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    return queryCounter(oidRequest, static_cast<ULONG64>(receivePool.GetExhaustedCount()));
+}
+
+/**
+ * Completes a query for OID_802_3_PERMANENT_ADDRESS
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryPermanentAddress(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    BYTE ethernetAddress[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+    HeaderTranslator::AddressToEthernet(DEFAULT_MAC_ADDRESS, ethernetAddress);
+    return queryBuffer(oidRequest, ethernetAddress, sizeof(ethernetAddress));
+}
+
+/**
+ * Completes a query for OID_802_3_CURRENT_ADDRESS
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryCurrentAddress(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    BYTE ethernetAddress[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+    HeaderTranslator::AddressToEthernet(headerTranslator.GetLocalAddress(), ethernetAddress);
+    return queryBuffer(oidRequest, ethernetAddress, sizeof(ethernetAddress));
+}
+
+/**
+ * Completes a query for OID_802_3_MULTICAST_LIST
+ * @param oidRequest the query request to complete
+ * @returns NDIS_STATUS_SUCCESS if the list was written, or NDIS_STATUS_BUFFER_TOO_SHORT if the buffer
+ * cannot hold all of it
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryMulticastList(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& query = oidRequest.DATA.QUERY_INFORMATION;
+    query.BytesNeeded = joinedMulticastGroups.GetAddresses(static_cast<BYTE*>(query.InformationBuffer), query.InformationBufferLength);
+    if (query.InformationBufferLength < query.BytesNeeded)
+    {
+        return NDIS_STATUS_BUFFER_TOO_SHORT;
+    }
+
+    query.BytesWritten = query.BytesNeeded;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a set of OID_802_3_MULTICAST_LIST, replacing the joined groups
+ * @param oidRequest the set request to complete
+ * @returns NDIS_STATUS_SUCCESS if the list was replaced, NDIS_STATUS_INVALID_LENGTH if the buffer does not
+ * hold a whole number of addresses, NDIS_STATUS_MULTICAST_FULL if there are too many addresses, or
+ * NDIS_STATUS_INVALID_DATA if one of the addresses is not a group address
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::setMulticastList(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& set = oidRequest.DATA.SET_INFORMATION;
+    if (set.InformationBufferLength % MulticastFilter::ADDRESS_LENGTH != 0)
+    {
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    const ULONG count = set.InformationBufferLength / MulticastFilter::ADDRESS_LENGTH;
+    if (count > MAX_MULTICAST_GROUPS)
+    {
+        return NDIS_STATUS_MULTICAST_FULL;
+    }
+
+    if (!joinedMulticastGroups.SetAddresses(static_cast<const BYTE*>(set.InformationBuffer), count))
+    {
+        return NDIS_STATUS_INVALID_DATA;
+    }
+
+    set.BytesRead = set.InformationBufferLength;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for OID_AX25_RECEIVE_BATCH_HISTOGRAM
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryReceiveBatchHistogram(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    // The histogram is only written by the receive DPC, so a torn read only means a slightly stale bucket
+    return queryBuffer(oidRequest, &receiveBatchStatistics, sizeof(receiveBatchStatistics));
+}
+
+/**
+ * Completes a query for OID_AX25_HEADER_CACHE_STATISTICS
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryHeaderCacheStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AX25_HEADER_CACHE_STATISTICS cacheStatistics;
+    headerTranslator.GetStatistics(cacheStatistics);
+    return queryBuffer(oidRequest, &cacheStatistics, sizeof(cacheStatistics));
+}
+
+/**
+ * Completes a query for OID_GEN_XMIT_OK, the number of frames sent without error
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryTransmitOk(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AdapterStatistics::Counters totals;
+    statistics.GetTotals(totals);
+    return queryCounter(oidRequest, totals.transmitted.GetFrames());
+}
+
+/**
+ * Completes a query for OID_GEN_RCV_OK, the number of frames indicated to NDIS
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryReceiveOk(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AdapterStatistics::Counters totals;
+    statistics.GetTotals(totals);
+    return queryCounter(oidRequest, totals.received.GetFrames());
+}
+
+/**
+ * Completes a query for OID_GEN_XMIT_ERROR
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryTransmitErrors(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AdapterStatistics::Counters totals;
+    statistics.GetTotals(totals);
+    return queryCounter(oidRequest, totals.transmitted.errors);
+}
+
+/**
+ * Completes a query for OID_GEN_RCV_ERROR
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryReceiveErrors(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AdapterStatistics::Counters totals;
+    statistics.GetTotals(totals);
+    return queryCounter(oidRequest, totals.received.errors);
+}
+
+/**
+ * Completes a query for OID_GEN_STATISTICS by summing every processor's counters into an NDIS_STATISTICS_INFO
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AdapterStatistics::Counters totals;
+    statistics.GetTotals(totals);
+    const AdapterStatistics::DirectionCounters& in = totals.received;
+    const AdapterStatistics::DirectionCounters& out = totals.transmitted;
+
+    NDIS_STATISTICS_INFO info;
+    RtlZeroMemory(&info, sizeof(info));
+    info.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+    info.Header.Revision = NDIS_STATISTICS_INFO_REVISION_1;
+    info.Header.Size = NDIS_SIZEOF_STATISTICS_INFO_REVISION_1;
+    info.SupportedStatistics = SUPPORTED_STATISTICS;
+
+    info.ifInDiscards = in.discards;
+    info.ifInErrors = in.errors;
+    info.ifHCInOctets = in.directedBytes + in.multicastBytes + in.broadcastBytes;
+    info.ifHCInUcastPkts = in.directedFrames;
+    info.ifHCInMulticastPkts = in.multicastFrames;
+    info.ifHCInBroadcastPkts = in.broadcastFrames;
+    info.ifHCInUcastOctets = in.directedBytes;
+    info.ifHCInMulticastOctets = in.multicastBytes;
+    info.ifHCInBroadcastOctets = in.broadcastBytes;
+
+    info.ifOutDiscards = out.discards;
+    info.ifOutErrors = out.errors;
+    info.ifHCOutOctets = out.directedBytes + out.multicastBytes + out.broadcastBytes;
+    info.ifHCOutUcastPkts = out.directedFrames;
+    info.ifHCOutMulticastPkts = out.multicastFrames;
+    info.ifHCOutBroadcastPkts = out.broadcastFrames;
+    info.ifHCOutUcastOctets = out.directedBytes;
+    info.ifHCOutMulticastOctets = out.multicastBytes;
+    info.ifHCOutBroadcastOctets = out.broadcastBytes;
+
+    return queryBuffer(oidRequest, &info, sizeof(info));
+}
+
+/**
+ * Completes a query for OID_GEN_INTERRUPT_MODERATION. Receive coalescing stands in for interrupt moderation,
+ * since a virtual adapter has no interrupts.
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryInterruptModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    NDIS_INTERRUPT_MODERATION_PARAMETERS parameters;
+    RtlZeroMemory(&parameters, sizeof(parameters));
+    parameters.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+    parameters.Header.Revision = NDIS_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+    parameters.Header.Size = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+    parameters.InterruptModeration = receiveModeration.IsEnabled() ? NdisInterruptModerationEnabled : NdisInterruptModerationDisabled;
+    return queryBuffer(oidRequest, &parameters, NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1);
+}
+
+/**
+ * Completes a set of OID_GEN_INTERRUPT_MODERATION, which turns receive coalescing on or off. The change
+ * takes effect immediately, without a reset.
+ * @param oidRequest the set request to complete
+ * @returns NDIS_STATUS_SUCCESS if coalescing was turned on or off, or an error status otherwise
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::setInterruptModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& set = oidRequest.DATA.SET_INFORMATION;
+    if (set.InformationBufferLength < NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1)
+    {
+        set.BytesNeeded = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    const auto& parameters = *static_cast<const NDIS_INTERRUPT_MODERATION_PARAMETERS*>(set.InformationBuffer);
+    if (parameters.Header.Type != NDIS_OBJECT_TYPE_DEFAULT ||
+        parameters.Header.Revision < NDIS_INTERRUPT_MODERATION_PARAMETERS_REVISION_1 ||
+        parameters.Header.Size < NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1)
+    {
+        return NDIS_STATUS_INVALID_PARAMETER;
+    }
+
+    switch (parameters.InterruptModeration)
+    {
+    case NdisInterruptModerationEnabled:
+        receiveModeration.SetEnabled(true);
+        break;
+
+    case NdisInterruptModerationDisabled:
+        receiveModeration.SetEnabled(false);
+        break;
+
+    default:
+        return NDIS_STATUS_INVALID_DATA;
+    }
+
+    set.BytesRead = NDIS_SIZEOF_INTERRUPT_MODERATION_PARAMETERS_REVISION_1;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for OID_AX25_RECEIVE_MODERATION
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryReceiveModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AX25_RECEIVE_MODERATION moderation;
+    receiveModeration.GetStatistics(moderation);
+    return queryBuffer(oidRequest, &moderation, sizeof(moderation));
+}
+
+/**
+ * Completes a set of OID_AX25_RECEIVE_MODERATION, which changes the frame threshold and timeout of receive
+ * coalescing. A run of frames already waiting for the timer keeps its old timeout.
+ * @param oidRequest the set request to complete
+ * @returns NDIS_STATUS_SUCCESS if the parameters were changed, NDIS_STATUS_INVALID_LENGTH if the buffer is
+ * too small, or NDIS_STATUS_INVALID_DATA if either parameter is out of range
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::setReceiveModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    auto& set = oidRequest.DATA.SET_INFORMATION;
+    if (set.InformationBufferLength < sizeof(AX25_RECEIVE_MODERATION))
+    {
+        set.BytesNeeded = sizeof(AX25_RECEIVE_MODERATION);
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    const auto& moderation = *static_cast<const AX25_RECEIVE_MODERATION*>(set.InformationBuffer);
+    if (!receiveModeration.SetParameters(moderation.FrameThreshold, moderation.TimeoutMicroseconds))
+    {
+        return NDIS_STATUS_INVALID_DATA;
+    }
+
+    set.BytesRead = sizeof(AX25_RECEIVE_MODERATION);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Completes a query for OID_AX25_HEADER_COMPRESSION_STATISTICS. The counters are read without dataLinkLock, so
+ * one may be a datagram behind another.
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryHeaderCompressionStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AX25_HEADER_COMPRESSION_STATISTICS compressionStatistics;
+    headerCompression.GetStatistics(compressionStatistics);
+    return queryBuffer(oidRequest, &compressionStatistics, sizeof(compressionStatistics));
+}
+
+/**
+ * Completes a query for OID_AX25_TRANSMIT_CLASS_STATISTICS. The queues are read while the transmit drain may be
+ * using them, so a frame leaving one may be counted in both its Depth and its Frames.
+ * @param oidRequest the query request to complete
+ * @returns the status of the query
+ */
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queryTransmitClassStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept
+{
+    AX25_TRANSMIT_CLASS_STATISTICS classStatistics;
+    transmitScheduler.GetStatistics(classStatistics);
+    return queryBuffer(oidRequest, &classStatistics, sizeof(classStatistics));
+}
+
+/**
+ * Sends the given network data along this adapter. This adapter must be in the running state or the request
+ * will be rejected. This function may return before the data has been transmitted. After completion 
+ * (whether success or failure), NdisMSendNetBufferListsComplete will be called. Until NdisMSendNetBufferListsComplete
+ * is called, this adapter owns the netBufferList object provided. After NdisMSendNetBufferListsComplete is called,
+ * ownership is released and the memory is treated as inaccessible. Note that a call to NdisMSendNetBufferListsComplete
+ * does not necessarily mean the data has been transmitted, but rather that it has at least been queued for transmission
+ * and the buffer is no longer needed.
+ * @param netBufferList a linked list of NET_BUFFER_LIST objects indicating the data to be transmitted, in order
+ * @param sendFlags the flags associted with this send operation. If NDIS_SEND_FLAGS_CHECK_FOR_LOOPBACK is set, then
+ * this function will check to see if the data should loop back. If NDIS_SEND_FLAGS_DISPATCH_LEVEL is set, then the current
+ * IRQL is DISPATCH_LEVEL.
+ */
+_When_(sendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL, _IRQL_requires_(DISPATCH_LEVEL))
+_When_(!(sendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL), _IRQL_requires_max_(APC_LEVEL))
+_IRQL_requires_same_
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::SendNetBufferLists(
+    _In_ NET_BUFFER_LIST& netBufferList, 
+    _In_ ULONG sendFlags) noexcept
+{
+    // Don't accept new data unless we're running. The call is counted before the state is checked, so that
+    // Pause() cannot flush the transmit DPC while this chain is still on its way into the queue.
+    InterlockedIncrement(&activeCalls);
+    if (state != Running)
+    {
+        leaveCall();
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Rejecting send: adapter is not running");
+        ULONG count = 0;
+        for (NET_BUFFER_LIST* current = &netBufferList; current != nullptr; current = NET_BUFFER_LIST_NEXT_NBL(current))
+        {
+            count++;
+        }
+        statistics.CountTransmitDiscardsAtAnyIrql(count);
+        markNetBufferListWithFailure(&netBufferList, NDIS_STATUS_PAUSED);
+        NdisMSendNetBufferListsComplete(driverHandle, &netBufferList,
+                                        (sendFlags & NDIS_SEND_FLAGS_DISPATCH_LEVEL) ? NDIS_SEND_COMPLETE_FLAGS_DISPATCH_LEVEL : 0);
+        return;
+    }
+
+    // Hand the whole chain off to the drain context. Only the producer which finds the queue empty needs to
+    // queue the DPC - anyone else is covered by the drain that producer scheduled.
+    if (transmitQueue.Enqueue(netBufferList))
+    {
+        KeInsertQueueDpc(&transmitDpc, nullptr, nullptr);
+    }
+    leaveCall();
+}
+
+/**
+ * Callback DPC for transmission. Queued whenever SendNetBufferLists finds the transmit queue empty.
+ * @param dpc the KDPC object representing this DPC
+ * @param adapterContext the AX25Adapter associated with this DPC
+ */
+_Use_decl_annotations_
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::transmitDpcCallback(_In_ KDPC* dpc,
+                                      _In_opt_ void* adapterContext,
+                                      _In_opt_ void* systemArgument1,
+                                      _In_opt_ void* systemArgument2)
+{
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(systemArgument1);
+    UNREFERENCED_PARAMETER(systemArgument2);
+
+    if (adapterContext == nullptr)
+    {
+        TraceEvents(TRACE_LEVEL_CRITICAL, TRACE_ADAPTER, "Cannot drain transmit queue: DPC context is nullptr");
+        return;
+    }
+
+    static_cast<AX25Adapter*>(adapterContext)->drainTransmitQueue();
+}
+
+/**
+ * Transmits the frames in the transmit queue. Each NET_BUFFER_LIST is first put in the queue of its transmit
+ * class, and they go out in the order transmitScheduler chooses, after any frames owed by connected-mode links.
+ * If another processor is already draining the queue, this function returns immediately and leaves the work to
+ * that processor. If channel access holds the transmitter back, or the radio has enough to send for now, the
+ * rest waits until channelAccessTimer or a carrier dropping queues the DPC again.
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::drainTransmitQueue() noexcept
+{
+    while (InterlockedCompareExchange(&transmitDrainActive, 1, 0) == 0)
+    {
+        scheduleTransmitQueue();
+
+        // Sent NET_BUFFER_LISTs are completed together, in the order they went out
+        NET_BUFFER_LIST* completed = nullptr;
+        NET_BUFFER_LIST** completedTail = &completed;
+        ULONG64 nextAttempt = 0;
+        bool deferred = false;
+        while (!transmitScheduler.IsEmpty() || dataLinkTransmitPending != 0)
+        {
+            if (!acquireChannel(nextAttempt))
+            {
+                deferred = true;
+                break;
+            }
+
+            // Frames owed by links are mostly acknowledgements, which hold up the peers until they are sent.
+            // This also sends the datagrams queued on links by the frame before.
+            if (InterlockedExchange(&dataLinkTransmitPending, 0) != 0)
+            {
+                transmitDataLinks();
+                continue;
+            }
+
+            NET_BUFFER_LIST* netBufferList = transmitScheduler.Dequeue(dataLinkTime());
+            transmitScheduled(*netBufferList);
+            *completedTail = netBufferList;
+            completedTail = &NET_BUFFER_LIST_NEXT_NBL(netBufferList);
+
+            // Anything sent since is classified before the next frame is chosen, so that it can overtake the rest
+            scheduleTransmitQueue();
+        }
+
+        if (completed != nullptr)
+        {
+            NdisMSendNetBufferListsComplete(driverHandle, completed, NDIS_SEND_COMPLETE_FLAGS_DISPATCH_LEVEL);
+        }
+
+        if (deferred)
+        {
+            // The timer, or the carrier dropping, may queue the DPC again before ownership is released, and that
+            // DPC gives up. Try again here if the next attempt is already due, or if a pause has begun since the
+            // channel was found busy: the pause cancels the timer, and its DPC may have given up too.
+            InterlockedExchange(&transmitDrainActive, 0);
+            if (state == Running && (carrierDetected != 0 || (nextAttempt != MAXULONG64 && dataLinkTime() < nextAttempt)))
+            {
+                break;
+            }
+            continue;
+        }
+
+        // A producer may have enqueued after our last dequeue but before we released ownership, and its DPC
+        // may have already given up. Check once more so those frames are not stranded.
+        InterlockedExchange(&transmitDrainActive, 0);
+        if (transmitQueue.IsEmpty() && dataLinkTransmitPending == 0)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Moves every chain in the transmit queue into transmitScheduler, one NET_BUFFER_LIST at a time
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::scheduleTransmitQueue() noexcept
+{
+    const ULONG64 now = dataLinkTime();
+    NET_BUFFER_LIST* chain = transmitQueue.DequeueAll();
+    while (chain != nullptr)
+    {
+        NET_BUFFER_LIST* nextChain = NetBufferListChainLink::Link(*chain);
+        NET_BUFFER_LIST* current = chain;
+        while (current != nullptr)
+        {
+            NET_BUFFER_LIST* next = NET_BUFFER_LIST_NEXT_NBL(current);
+            transmitScheduler.Enqueue(*current, classifyNetBufferList(*current), now);
+            current = next;
+        }
+        chain = nextChain;
+    }
+}
+
+/**
+ * Chooses the transmit class of a NET_BUFFER_LIST from the 802.1p priority the protocol gave it. ARP is treated
+ * as network control whatever its priority, since every datagram to an unresolved address waits for it.
+ * @param netBufferList the NET_BUFFER_LIST
+ * @returns its transmit class
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+TransmitClass AX25Adapter::classifyNetBufferList(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+{
+    NDIS_NET_BUFFER_LIST_8021Q_INFO priorityInfo;
+    priorityInfo.Value = NET_BUFFER_LIST_INFO(&netBufferList, Ieee8021QNetBufferListInfo);
+    const TransmitClass transmitClass = transmitClassOfPriority(priorityInfo.TagHeader.UserPriority);
+    if (transmitClass == TransmitClassControl)
+    {
+        return transmitClass;
+    }
+
+    BYTE ethernetStorage[ETHERNET_HEADER_LENGTH];
+    NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(&netBufferList);
+    const BYTE* ethernetHeader = (netBuffer == nullptr) ? nullptr :
+        static_cast<const BYTE*>(NdisGetDataBuffer(netBuffer, ETHERNET_HEADER_LENGTH, ethernetStorage, 1, 0));
+    if (ethernetHeader != nullptr &&
+        ((ethernetHeader[12] << 8) | ethernetHeader[13]) == HeaderTranslator::ETHERTYPE_ARP)
+    {
+        return TransmitClassControl;
+    }
+
+    return transmitClass;
+}
+
+/**
+ * Decides whether the transmit drain may send now, which it always may unless channelAccessEnabled is set.
+ * Otherwise the transmitter is keyed according to channelAccess, and a frame is only handed over once the frames
+ * before it are within TRANSMIT_LOOKAHEAD_MILLISECONDS of being off the air. If it cannot send yet,
+ * channelAccessTimer is set for the next attempt; an attempt held back by a carrier is made again by
+ * IndicateCarrier() instead. Frames are never held back while the adapter is pausing, so that the pause is not
+ * kept waiting for the channel.
+ * @param nextAttempt receives the time at which the drain should try again, or MAXULONG64 if it waits for the
+ * carrier to drop; only set if frames may not be sent
+ * @returns true if frames may be sent
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::acquireChannel(_Out_ ULONG64& nextAttempt) noexcept
+{
+    nextAttempt = 0;
+    if (!channelAccessEnabled || state != Running)
+    {
+        return true;
+    }
+
+    const ULONG64 now = dataLinkTime();
+    if (channelAccess.TryStartBurst(now, carrierDetected != 0))
+    {
+        // A frame handed over any earlier would only wait in the radio, where nothing can overtake it
+        const ULONG64 dataEnd = channelAccess.GetDataEnd();
+        if (dataEnd <= now + TRANSMIT_LOOKAHEAD_MILLISECONDS)
+        {
+            return true;
+        }
+        nextAttempt = dataEnd - TRANSMIT_LOOKAHEAD_MILLISECONDS;
+    }
+    else
+    {
+        nextAttempt = channelAccess.GetNextAttempt();
+    }
+
+    if (nextAttempt != MAXULONG64)
+    {
+        // A negative due time is relative, in units of 100ns
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -static_cast<LONGLONG>((nextAttempt > now) ? nextAttempt - now : 0) * 10000;
+        KeSetTimer(&channelAccessTimer, dueTime, &transmitDpc);
+    }
+    return false;
+}
+
+/**
+ * Hands a frame to the connector, counting its airtime towards the current burst if channelAccessEnabled is set.
+ * Only called from the transmit drain.
+ * @param frame the frame to transmit, as for Connector::TransmitFrame()
+ * @returns the status returned by the connector
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::transmitToConnector(_In_ const FrameGatherList& frame) noexcept
+{
+    const NDIS_STATUS status = connector->TransmitFrame(frame);
+    if (status == NDIS_STATUS_SUCCESS && channelAccessEnabled)
+    {
+        channelAccess.FrameSent(dataLinkTime(), frame.GetTotalLength());
+    }
+    return status;
+}
+
+/**
+ * Records whether the radio hears another station on the channel. The connector calls this whenever its data
+ * carrier detect changes, for channel access to go by; it has no effect unless channelAccessEnabled is set.
+ * @param detected true if a carrier is detected
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::IndicateCarrier(_In_ bool detected) noexcept
+{
+    const LONG previous = InterlockedExchange(&carrierDetected, detected ? 1 : 0);
+
+    // Frames held back by the carrier are tried again as soon as it drops
+    if (previous != 0 && !detected && channelAccessEnabled &&
+        (!transmitQueue.IsEmpty() || !transmitScheduler.IsEmpty() || dataLinkTransmitPending != 0))
+    {
+        KeInsertQueueDpc(&transmitDpc, nullptr, nullptr);
+    }
+}
+
+/**
+ * Transmits a NET_BUFFER_LIST taken from transmitScheduler and sets its completion status. The caller completes it.
+ * @param netBufferList the NET_BUFFER_LIST, as originally passed to SendNetBufferLists
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::transmitScheduled(_Inout_ NET_BUFFER_LIST& netBufferList) noexcept
+{
+    // Frames which were queued before a pause are still sent; anything found after that is failed
+    const NDIS_STATUS status = (state == Running || state == Pausing) ? transmitNetBufferList(netBufferList) : NDIS_STATUS_PAUSED;
+    NET_BUFFER_LIST_STATUS(&netBufferList) = status;
+    if (status == NDIS_STATUS_PAUSED || status == NDIS_STATUS_MEDIA_DISCONNECTED)
+    {
+        statistics.CountTransmitDiscards(1);
+    }
+    else if (status != NDIS_STATUS_SUCCESS)
+    {
+        statistics.CountTransmitError();
+    }
+}
+
+/**
+ * Transmits every NET_BUFFER in the specified NET_BUFFER_LIST to the connector. Each NET_BUFFER is one frame.
+ * @param netBufferList the NET_BUFFER_LIST to transmit
+ * @returns NDIS_STATUS_SUCCESS if every frame was accepted by the connector, or an error code otherwise
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::transmitNetBufferList(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+{
+    if (connector == nullptr)
+    {
+        // Not bound to a radio - nowhere to send this
+        return NDIS_STATUS_MEDIA_DISCONNECTED;
+    }
+
+    const bool appendFrameCheckSequence = connector->UsesFrameCheckSequence();
+    FrameGatherList frame;
+    for (NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(&netBufferList); netBuffer != nullptr; netBuffer = NET_BUFFER_NEXT_NB(netBuffer))
+    {
+        // Swap the Ethernet header for the AX.25 one
+        BYTE ethernetStorage[ETHERNET_HEADER_LENGTH];
+        const BYTE* ethernetHeader = static_cast<const BYTE*>(NdisGetDataBuffer(netBuffer, ETHERNET_HEADER_LENGTH, ethernetStorage, 1, 0));
+        if (ethernetHeader == nullptr)
+        {
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+
+        const ULONG headerLength = headerTranslator.ToAX25(ethernetHeader, transmitHeader);
+        if (headerLength == 0)
+        {
+            return NDIS_STATUS_INVALID_PACKET;
+        }
+
+        // Unicast IPv4 goes over the link to the destination, which sends it when the window allows
+        if (connectedMode && (ethernetHeader[0] & 0x01) == 0 && transmitHeader[headerLength - 1] == HeaderTranslator::PID_IPV4)
+        {
+            NDIS_STATUS status = sendOnDataLink(*netBuffer, headerLength);
+            if (status != NDIS_STATUS_SUCCESS)
+            {
+                return status;
+            }
+
+            statistics.CountTransmitted(ethernetHeader, NET_BUFFER_DATA_LENGTH(netBuffer));
+            continue;
+        }
+
+        // Only datagrams on a link are segmented, so the MTU of connected mode does not reach UI frames
+        if (NET_BUFFER_DATA_LENGTH(netBuffer) - ETHERNET_HEADER_LENGTH > DEFAULT_MTU_SIZE_BYTES)
+        {
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+
+        // Describe the rest of the frame in place
+        NDIS_STATUS status = FrameEncoder::Encode(*netBuffer, ETHERNET_HEADER_LENGTH, transmitHeader, headerLength, nullptr, 0, frame);
+        if (status == NDIS_STATUS_SUCCESS && appendFrameCheckSequence &&
+            !FrameEncoder::AppendFrameCheckSequence(frame, transmitFrameCheckSequence))
+        {
+            status = NDIS_STATUS_BUFFER_OVERFLOW;
+        }
+
+        if (status == NDIS_STATUS_BUFFER_OVERFLOW ||
+            (status == NDIS_STATUS_SUCCESS && frame.GetFragmentCount() > 1 && connector->RequiresContiguousFrames()))
+        {
+            status = flattenFrame(*netBuffer, status, transmitHeader, headerLength, appendFrameCheckSequence, frame);
+        }
+        else if (status == NDIS_STATUS_SUCCESS)
+        {
+            transmitFramesGathered++;
+        }
+
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Failed to encode frame for transmission: %!STATUS!", status);
+            return status;
+        }
+
+        status = transmitToConnector(frame);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            return status;
+        }
+
+        statistics.CountTransmitted(ethernetHeader, NET_BUFFER_DATA_LENGTH(netBuffer));
+    }
+
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Queues the datagram in the specified NET_BUFFER on the connected-mode link to its destination, opening the
+ * link if there is none, and segmenting it if it is longer than the link's N1. A TCP/IP header is compressed
+ * first if headerCompression calls for it, and then the whole datagram if payloadCompressionMode calls for it and that
+ * makes it shorter. The datagram is copied, so the NET_BUFFER may be completed as soon as this returns.
+ * @param netBuffer the NET_BUFFER holding the Ethernet frame
+ * @param headerLength the length of the AX.25 header in transmitHeader, built for the frame by ToAX25()
+ * @returns NDIS_STATUS_SUCCESS if the datagram was queued
+ * @returns NDIS_STATUS_INVALID_LENGTH if the datagram is larger than the MTU, or takes more segments than the
+ * N1 settled with the peer allows
+ * @returns NDIS_STATUS_INVALID_PACKET if the AX.25 header has no valid address field
+ * @returns NDIS_STATUS_RESOURCES if every link is in use or the link's queue has no room for every segment
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::sendOnDataLink(_In_ NET_BUFFER& netBuffer, _In_ ULONG headerLength) noexcept
+{
+    AX25AddressField path;
+    if (path.Parse(transmitHeader, headerLength) == 0)
+    {
+        return NDIS_STATUS_INVALID_PACKET;
+    }
+
+    const ULONG ethernetLength = NET_BUFFER_DATA_LENGTH(&netBuffer);
+    const ULONG datagramLength = ethernetLength - ETHERNET_HEADER_LENGTH;
+    if (datagramLength > mtuSize)
+    {
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    // outboundBuffer is free: the link copies the datagram before anything is flattened for transmission
+    static_assert(sizeof(outboundBuffer) >= ETHERNET_HEADER_LENGTH + SEGMENTED_MTU_SIZE_BYTES, "outboundBuffer cannot hold a datagram");
+    const BYTE* ethernetFrame = static_cast<const BYTE*>(NdisGetDataBuffer(&netBuffer, ethernetLength, outboundBuffer, 1, 0));
+    if (ethernetFrame == nullptr)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    KeAcquireSpinLockAtDpcLevel(&dataLinkLock);
+    DataLink* link = dataLinks.Open(path);
+    const ULONG maxInformationLength = (link != nullptr) ? link->GetMaxInformationLength() : 0;
+    BYTE pid = HeaderTranslator::PID_IPV4;
+    ULONG offset = 0;
+    const ULONG frameCount = Segmenter::GetFrameCount(datagramLength, maxInformationLength);
+    const bool sendable = link != nullptr && frameCount != 0 && frameCount <= link->GetQueueSpace();
+    if (sendable && headerCompression.IsAllocated())
+    {
+        // The header is compressed in place, so the datagram must be in outboundBuffer rather than the sender's
+        // memory. It is only compressed once it is sure to be queued, as the compressor takes it as sent.
+        if (ethernetFrame != outboundBuffer)
+        {
+            RtlCopyMemory(outboundBuffer, ethernetFrame, ethernetLength);
+            ethernetFrame = outboundBuffer;
+        }
+        pid = headerCompression.Compress(path.Source, path.Destination, outboundBuffer + ETHERNET_HEADER_LENGTH,
+                                         datagramLength, offset);
+    }
+
+    // Compression only ever shortens the datagram, so it still fits the segments counted for it
+    const BYTE* datagram = ethernetFrame + ETHERNET_HEADER_LENGTH + offset;
+    ULONG length = datagramLength - offset;
+    if (sendable && compressesPayloadTo(path.Destination))
+    {
+        const ULONG compressedLength = payloadCompressor.Compress(pid, datagram, length, payloadBuffer, sizeof(payloadBuffer));
+        if (compressedLength != 0)
+        {
+            pid = PayloadCompressor::PID_COMPRESSED;
+            datagram = payloadBuffer;
+            length = compressedLength;
+        }
+    }
+
+    const bool queued = link != nullptr && Segmenter::Send(*link, pid, datagram, length);
+    KeReleaseSpinLockFromDpcLevel(&dataLinkLock);
+    if (!queued && link != nullptr && frameCount == 0)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping datagram: %u bytes takes too many segments at the peer's N1 of %u",
+                    datagramLength, maxInformationLength);
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    if (!queued)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping datagram: no room on the connected-mode link");
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    InterlockedExchange(&dataLinkTransmitPending, 1);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Replaces the specified frame with a single fragment in outboundBuffer. This is the slow path, used only when
+ * the connector cannot accept a gather list or the frame has too many fragments to describe with one.
+ * @param netBuffer the NET_BUFFER from which the frame was encoded
+ * @param encodeStatus the result of encoding the frame. If this is NDIS_STATUS_BUFFER_OVERFLOW, frame is
+ * incomplete and the data is taken from netBuffer instead.
+ * @param header the AX.25 header which replaces the Ethernet header of netBuffer
+ * @param headerLength the number of bytes in header, which is always more than ETHERNET_HEADER_LENGTH
+ * @param appendFrameCheckSequence true if the connector needs the FCS. If encodeStatus is
+ * NDIS_STATUS_SUCCESS, frame already ends with it; otherwise it is computed over the flattened frame.
+ * @param frame the frame to flatten, which on success is replaced by a single fragment
+ * @returns NDIS_STATUS_SUCCESS if the frame was flattened, or an error code otherwise
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::flattenFrame(
+    _In_ NET_BUFFER& netBuffer,
+    _In_ NDIS_STATUS encodeStatus,
+    _In_reads_bytes_(headerLength) const BYTE* header,
+    _In_ ULONG headerLength,
+    _In_ bool appendFrameCheckSequence,
+    _Inout_ FrameGatherList& frame) noexcept
+{
+    ULONG length;
+    const BYTE* data;
+    if (encodeStatus == NDIS_STATUS_BUFFER_OVERFLOW)
+    {
+        const ULONG ethernetLength = NET_BUFFER_DATA_LENGTH(&netBuffer);
+        length = ethernetLength - ETHERNET_HEADER_LENGTH + headerLength;
+        if (length + (appendFrameCheckSequence ? Crc16::FCS_LENGTH : 0) > sizeof(outboundBuffer))
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping oversized frame of %d bytes", static_cast<int>(length));
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+
+        // Fetch the Ethernet frame so that, if NDIS has to copy it, the payload lands where it belongs
+        // after the longer AX.25 header. If NDIS returns the frame in place, the payload is copied instead.
+        BYTE* storage = outboundBuffer + headerLength - ETHERNET_HEADER_LENGTH;
+        const BYTE* ethernetFrame = static_cast<const BYTE*>(NdisGetDataBuffer(&netBuffer, ethernetLength, storage, 1, 0));
+        if (ethernetFrame == nullptr)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        RtlMoveMemory(outboundBuffer + headerLength, ethernetFrame + ETHERNET_HEADER_LENGTH, ethernetLength - ETHERNET_HEADER_LENGTH);
+        RtlCopyMemory(outboundBuffer, header, headerLength);
+        if (appendFrameCheckSequence)
+        {
+            Crc16::Write(Crc16::Compute(outboundBuffer, length), outboundBuffer + length);
+            length += Crc16::FCS_LENGTH;
+        }
+        data = outboundBuffer;
+    }
+    else
+    {
+        length = frame.CopyTo(outboundBuffer, sizeof(outboundBuffer));
+        if (length == 0)
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping oversized frame of %d bytes", static_cast<int>(frame.GetTotalLength()));
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+        data = outboundBuffer;
+    }
+
+    frame.Reset();
+    if (!frame.Append(data, length))
+    {
+        return NDIS_STATUS_FAILURE;
+    }
+
+    transmitFramesFlattened++;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Binds this adapter to the specified connector, or unbinds it if nullptr is given. The adapter must be
+ * paused, so that no transmission is in progress while the connector changes.
+ * @param newConnector the connector to transmit frames to, or nullptr to detach the current connector
+ * @returns NDIS_STATUS_SUCCESS if the connector was attached, or NDIS_STATUS_INVALID_DEVICE_REQUEST if the
+ * adapter is not paused
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::AttachConnector(_In_opt_ Connector* newConnector) noexcept
+{
+    if (state != Paused)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Cannot attach connector: adapter is not paused");
+        return NDIS_STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    connector = newConnector;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Reads this adapter's configurable parameters from the registry (the advanced properties declared in
+ * VirtualAx25.inf). Parameters which are missing or out of range keep their defaults, so failing to
+ * read the configuration is not fatal.
+ * @returns NDIS_STATUS_SUCCESS if the configuration was read, or the error from NdisOpenConfigurationEx
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::ReadConfiguration() noexcept
+{
+    NDIS_CONFIGURATION_OBJECT configurationObject;
+    configurationObject.Header.Type = NDIS_OBJECT_TYPE_CONFIGURATION_OBJECT;
+    configurationObject.Header.Revision = NDIS_CONFIGURATION_OBJECT_REVISION_1;
+    configurationObject.Header.Size = NDIS_SIZEOF_CONFIGURATION_OBJECT_REVISION_1;
+    configurationObject.NdisHandle = driverHandle;
+    configurationObject.Flags = 0;
+
+    NDIS_HANDLE configuration = nullptr;
+    NDIS_STATUS status = NdisOpenConfigurationEx(&configurationObject, &configuration);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Using default configuration: NdisOpenConfigurationEx failed with %!STATUS!", status);
+        return status;
+    }
+
+    NDIS_STRING receiveBatchSizeKeyword = NDIS_STRING_CONST("ReceiveBatchSize");
+    receiveBatchStatistics.BatchLimit = readIntegerParameter(configuration, receiveBatchSizeKeyword,
+                                                             DEFAULT_RECEIVE_BATCH_SIZE, 1, MAX_RECEIVE_BATCH_SIZE);
+
+    NDIS_STRING coalesceFramesKeyword = NDIS_STRING_CONST("ReceiveCoalesceFrames");
+    NDIS_STRING coalesceMicrosecondsKeyword = NDIS_STRING_CONST("ReceiveCoalesceMicroseconds");
+    NDIS_STRING interruptModerationKeyword = NDIS_STRING_CONST("*InterruptModeration");
+    const ULONG coalesceFrames = readIntegerParameter(configuration, coalesceFramesKeyword, DEFAULT_RECEIVE_COALESCE_FRAMES,
+                                                      ReceiveModeration::MIN_FRAME_THRESHOLD, RECEIVE_BUFFER_COUNT);
+    const ULONG coalesceMicroseconds = readIntegerParameter(configuration, coalesceMicrosecondsKeyword, DEFAULT_RECEIVE_COALESCE_MICROSECONDS,
+                                                            ReceiveModeration::MIN_TIMEOUT_MICROSECONDS,
+                                                            ReceiveModeration::MAX_TIMEOUT_MICROSECONDS);
+    (void)receiveModeration.SetParameters(coalesceFrames, coalesceMicroseconds);
+    receiveModeration.SetEnabled(readIntegerParameter(configuration, interruptModerationKeyword, 0, 0, 1) != 0);
+
+    NDIS_STRING connectedModeKeyword = NDIS_STRING_CONST("ConnectedMode");
+    connectedMode = readIntegerParameter(configuration, connectedModeKeyword, 0, 0, 1) != 0;
+
+    // Links deliver segments whole and in order, so connected mode can carry datagrams longer than N1
+    mtuSize = connectedMode ? SEGMENTED_MTU_SIZE_BYTES : DEFAULT_MTU_SIZE_BYTES;
+
+    NDIS_STRING headerCompressionKeyword = NDIS_STRING_CONST("HeaderCompression");
+    headerCompressionMode = static_cast<HeaderCompressionTable::Mode>(readIntegerParameter(
+        configuration, headerCompressionKeyword, HeaderCompressionTable::Disabled, HeaderCompressionTable::Disabled,
+        HeaderCompressionTable::Enabled));
+
+    NDIS_STRING payloadCompressionKeyword = NDIS_STRING_CONST("PayloadCompression");
+    payloadCompressionMode = static_cast<PayloadCompressor::Mode>(readIntegerParameter(
+        configuration, payloadCompressionKeyword, PayloadCompressor::Disabled, PayloadCompressor::Disabled,
+        PayloadCompressor::Enabled));
+
+    NDIS_STRING channelAccessKeyword = NDIS_STRING_CONST("ChannelAccess");
+    NDIS_STRING persistenceKeyword = NDIS_STRING_CONST("Persistence");
+    NDIS_STRING slotTimeKeyword = NDIS_STRING_CONST("SlotTime");
+    NDIS_STRING txDelayKeyword = NDIS_STRING_CONST("TxDelay");
+    NDIS_STRING txTailKeyword = NDIS_STRING_CONST("TxTail");
+    channelAccessEnabled = readIntegerParameter(configuration, channelAccessKeyword, 0, 0, 1) != 0;
+    ChannelAccessParameters accessParameters = ChannelAccess::DEFAULT_PARAMETERS;
+    accessParameters.Persistence = readIntegerParameter(configuration, persistenceKeyword, accessParameters.Persistence,
+                                                        0, ChannelAccess::MAX_PERSISTENCE);
+    accessParameters.SlotMilliseconds = readIntegerParameter(configuration, slotTimeKeyword, accessParameters.SlotMilliseconds,
+                                                             0, ChannelAccess::MAX_MILLISECONDS);
+    accessParameters.TxDelayMilliseconds = readIntegerParameter(configuration, txDelayKeyword, accessParameters.TxDelayMilliseconds,
+                                                                0, ChannelAccess::MAX_MILLISECONDS);
+    accessParameters.TxTailMilliseconds = readIntegerParameter(configuration, txTailKeyword, accessParameters.TxTailMilliseconds,
+                                                               0, ChannelAccess::MAX_MILLISECONDS);
+    accessParameters.BitsPerSecond = DEFAULT_XMIT_BITS_PER_SECOND;
+    (void)channelAccess.SetParameters(accessParameters);
+
+    NdisCloseConfiguration(configuration);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Reads a single integer parameter from an open configuration handle
+ * @param configuration the handle returned by NdisOpenConfigurationEx
+ * @param keyword the name of the parameter
+ * @param defaultValue the value to use if the parameter is missing or out of range
+ * @param minimum the smallest acceptable value
+ * @param maximum the largest acceptable value
+ * @returns the value of the parameter, or defaultValue
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGEABLE_FUNCTION
+ULONG AX25Adapter::readIntegerParameter(
+    _In_ NDIS_HANDLE configuration,
+    _In_ NDIS_STRING& keyword,
+    _In_ ULONG defaultValue,
+    _In_ ULONG minimum,
+    _In_ ULONG maximum) noexcept
+{
+    NDIS_STATUS status;
+    PNDIS_CONFIGURATION_PARAMETER parameter = nullptr;
+    NdisReadConfiguration(&status, &parameter, configuration, &keyword, NdisParameterInteger);
+    if (status != NDIS_STATUS_SUCCESS || parameter == nullptr)
+    {
+        return defaultValue;
+    }
+
+    ULONG value = parameter->ParameterData.IntegerData;
+    if (value < minimum || value > maximum)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Ignoring %wZ: %u is outside the range %u to %u", &keyword, value, minimum, maximum);
+        return defaultValue;
+    }
+
+    return value;
+}
+
+/**
+ * Allocates the buffers used to indicate received frames. This must be called once, before the adapter
+ * is first restarted.
+ * @returns NDIS_STATUS_SUCCESS if the buffers were allocated, or NDIS_STATUS_RESOURCES otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::AllocateReceiveBuffers() noexcept
+{
+    NDIS_STATUS status = receivePool.Allocate(driverHandle, RECEIVE_BUFFER_COUNT, RECEIVE_BUFFER_SIZE);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Failed to allocate receive buffers: %!STATUS!", status);
+    }
+
+    return status;
+}
+
+/**
+ * Allocates the per-processor statistics counters. This must be called once, before the adapter is first
+ * restarted.
+ * @returns NDIS_STATUS_SUCCESS if the counters were allocated, or NDIS_STATUS_RESOURCES otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::AllocateStatistics() noexcept
+{
+    NDIS_STATUS status = statistics.Allocate(driverHandle);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Failed to allocate statistics counters: %!STATUS!", status);
+    }
+
+    return status;
+}
+
+/**
+ * Allocates the connected-mode links, if the ConnectedMode keyword enabled them, along with the header
+ * compression state if the HeaderCompression keyword enabled it. This must be called once, after
+ * ReadConfiguration() and before the adapter is first restarted.
+ * @returns NDIS_STATUS_SUCCESS if the links were allocated or are not needed, or NDIS_STATUS_RESOURCES otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::AllocateDataLinks() noexcept
+{
+    if (!connectedMode)
+    {
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    NDIS_STATUS status = dataLinks.Allocate(driverHandle, DATA_LINK_COUNT);
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Failed to allocate connected-mode links: %!STATUS!", status);
+        return status;
+    }
+
+    // Each peer is offered the full MTU, extended sequence numbers and selective reject with XID; peers which
+    // do not answer it are run as AX.25 2.0 stations
+    DataLinkParameters linkParameters = DataLink::DEFAULT_PARAMETERS;
+    linkParameters.WindowSize = DataLink::MAX_WINDOW_SIZE;
+    linkParameters.Modulus = DataLink::EXTENDED_MODULUS;
+    linkParameters.SelectiveReject = true;
+    linkParameters.Negotiate = true;
+    dataLinks.SetLinkParameters(linkParameters);
+
+    // Compression state is kept for as many peers as there are links
+    if (headerCompressionMode != HeaderCompressionTable::Disabled)
+    {
+        status = headerCompression.Allocate(driverHandle, DATA_LINK_COUNT, headerCompressionMode);
+        if (status != NDIS_STATUS_SUCCESS)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, TRACE_ADAPTER, "Failed to allocate header compression state: %!STATUS!", status);
+        }
+    }
+    return status;
+}
+
+/**
+ * Accepts an AX.25 frame received from the radio. The AX.25 header is replaced by an Ethernet header as the
+ * frame is copied into a receive buffer, and the frame is indicated to NDIS from the receive DPC, so the
+ * caller's memory may be reused as soon as this function returns. The connector must not call this function
+ * from more than one processor at a time, nor from within Connector::TransmitFrame().
+ *
+ * In connected mode, frames other than UI frames which are addressed to this station are handed to the link
+ * with their source, and reach NDIS from there once they are in sequence.
+ * @param frame the received frame, followed by its FCS if the connector's UsesFrameCheckSequence() returns true
+ * @param length the number of bytes in frame
+ * @returns NDIS_STATUS_SUCCESS if the frame was queued for indication
+ * @returns NDIS_STATUS_PAUSED if the adapter is not running
+ * @returns NDIS_STATUS_INVALID_DATA if the frame's FCS is wrong
+ * @returns NDIS_STATUS_INVALID_PACKET if the frame has no Ethernet equivalent (see HeaderTranslator::ToEthernet)
+ * @returns NDIS_STATUS_NOT_ACCEPTED if the frame does not pass the packet filter set by NDIS
+ * @returns NDIS_STATUS_INVALID_LENGTH if the frame is larger than a receive buffer
+ * @returns NDIS_STATUS_RESOURCES if no receive buffer or connected-mode link was available and the frame was dropped
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::ReceiveFrame(
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length) noexcept
+{
+    // Counted before the state is checked, so that Pause() cannot flush the receive DPC and the link timer
+    // while this frame is still on its way into a queue
+    InterlockedIncrement(&activeCalls);
+    const NDIS_STATUS status = (state == Running) ? acceptReceivedFrame(frame, length) : NDIS_STATUS_PAUSED;
+    leaveCall();
+    return status;
+}
+
+/**
+ * Carries out ReceiveFrame() once the adapter is known to be running
+ * @param frame the received frame, as for ReceiveFrame()
+ * @param length the number of bytes in frame
+ * @returns the status to return from ReceiveFrame()
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::acceptReceivedFrame(
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length) noexcept
+{
+    if (connector != nullptr && connector->UsesFrameCheckSequence())
+    {
+        if (!Crc16::IsValid(frame, length))
+        {
+            statistics.CountReceiveError();
+            return NDIS_STATUS_INVALID_DATA;
+        }
+        length -= Crc16::FCS_LENGTH;
+    }
+
+    if (connectedMode)
+    {
+        // Only frames which have passed every repeater are for this station
+        AX25AddressField addresses;
+        const ULONG fieldLength = addresses.Parse(frame, length);
+        if (fieldLength != 0 && fieldLength < length &&
+            (frame[fieldLength] & ~HeaderTranslator::CONTROL_POLL_FINAL) != HeaderTranslator::CONTROL_UI &&
+            addresses.Destination == headerTranslator.GetLocalAddress() &&
+            addresses.GetNextRepeater() == addresses.RepeaterCount)
+        {
+            return receiveDataLinkFrame(addresses, frame + fieldLength, length - fieldLength);
+        }
+    }
+
+    BYTE ethernetHeader[ETHERNET_HEADER_LENGTH];
+    const ULONG headerLength = headerTranslator.ToEthernet(frame, length, ethernetHeader);
+    if (headerLength == 0)
+    {
+        statistics.CountReceiveError();
+        return NDIS_STATUS_INVALID_PACKET;
+    }
+
+    if (!receiveFilter.Accept(ethernetHeader))
+    {
+        return NDIS_STATUS_NOT_ACCEPTED;
+    }
+
+    return queueReceivedFrame(ethernetHeader, frame + headerLength, length - headerLength);
+}
+
+/**
+ * Copies a received frame into a receive buffer and queues it for indication to NDIS, scheduling the receive
+ * DPC as receiveModeration decides. Only ReceiveFrame() and the links it hands frames to call this, so the
+ * receive pool keeps a single consumer.
+ * @param ethernetHeader the Ethernet header to indicate the frame with
+ * @param payload the frame after its header
+ * @param payloadLength the number of bytes in payload
+ * @returns NDIS_STATUS_SUCCESS if the frame was queued for indication
+ * @returns NDIS_STATUS_INVALID_LENGTH if the frame is larger than the MTU
+ * @returns NDIS_STATUS_RESOURCES if no receive buffer was available and the frame was dropped
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::queueReceivedFrame(
+    _In_reads_bytes_(ETHERNET_HEADER_LENGTH) const BYTE* ethernetHeader,
+    _In_reads_bytes_(payloadLength) const BYTE* payload,
+    _In_ ULONG payloadLength) noexcept
+{
+    if (payloadLength > mtuSize)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping received frame: %u bytes is larger than the MTU", payloadLength);
+        statistics.CountReceiveError();
+        return NDIS_STATUS_INVALID_LENGTH;
+    }
+
+    NET_BUFFER_LIST* netBufferList = receivePool.Take();
+    if (netBufferList == nullptr)
+    {
+        // Every buffer is still held by NDIS. The pool counts this for OID_GEN_RCV_NO_BUFFER.
+        statistics.CountReceiveDiscards(1);
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    BYTE* data = ReceiveBufferPool::GetData(*netBufferList);
+    RtlCopyMemory(data, ethernetHeader, ETHERNET_HEADER_LENGTH);
+    RtlCopyMemory(data + ETHERNET_HEADER_LENGTH, payload, payloadLength);
+    NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(netBufferList)) = ETHERNET_HEADER_LENGTH + payloadLength;
+    queueReceiveBuffer(*netBufferList);
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Queues a filled receive buffer for indication to NDIS, scheduling the receive DPC as receiveModeration decides
+ * @param netBufferList a buffer taken from receivePool, whose data length has been set
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::queueReceiveBuffer(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+{
+    const bool queueWasEmpty = receiveQueue.Enqueue(netBufferList);
+    switch (receiveModeration.FrameQueued(queueWasEmpty))
+    {
+    case ReceiveModeration::IndicateNow:
+        KeCancelTimer(&receiveModerationTimer);
+        KeInsertQueueDpc(&receiveDpc, nullptr, nullptr);
+        break;
+
+    case ReceiveModeration::ArmTimer:
+    {
+        // A negative due time is relative, in units of 100ns
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -static_cast<LONGLONG>(receiveModeration.GetTimeoutMicroseconds()) * 10;
+        KeSetTimer(&receiveModerationTimer, dueTime, &receiveDpc);
+        break;
+    }
+
+    case ReceiveModeration::Wait:
+        break;
+    }
+}
+
+/**
+ * Hands a frame received from the radio to the connected-mode link with its source. A link is opened for a
+ * peer which has none, so that it can answer: a SABM connects it, and anything else is answered with DM.
+ * @param addresses the address field of the frame
+ * @param frame the rest of the frame, starting with the control field
+ * @param length the number of bytes in frame, which is at least 1
+ * @returns NDIS_STATUS_SUCCESS if a link took the frame, or NDIS_STATUS_RESOURCES if every link is in use
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+NDIS_STATUS AX25Adapter::receiveDataLinkFrame(
+    _In_ const AX25AddressField& addresses,
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length) noexcept
+{
+    // Frames to the peer retrace the repeaters its frame came through, in reverse
+    AX25AddressField path;
+    path.Destination = addresses.Source;
+    path.Source = addresses.Destination;
+    path.RepeaterCount = addresses.RepeaterCount;
+    for (ULONG i = 0; i < addresses.RepeaterCount; i++)
+    {
+        path.Repeaters[i] = addresses.Repeaters[addresses.RepeaterCount - 1 - i];
+    }
+
+    const ULONG64 now = dataLinkTime();
+    bool transmit = false;
+    KeAcquireSpinLockAtDpcLevel(&dataLinkLock);
+    DataLink* link = dataLinks.Open(path);
+    if (link != nullptr)
+    {
+        link->ReceiveFrame(addresses, frame, length, now, *this);
+        transmit = link->HasFramesToTransmit();
+        scheduleDataLinkTimer(now);
+    }
+    KeReleaseSpinLockFromDpcLevel(&dataLinkLock);
+
+    if (link == nullptr)
+    {
+        statistics.CountReceiveDiscards(1);
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    if (transmit)
+    {
+        requestDataLinkTransmit();
+    }
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Indicates the information of an I frame received in sequence on a connected-mode link, as an Ethernet frame
+ * from the peer to this station, or hands it to reassembler if it is a segment. Compressed datagrams, and
+ * TCP/IP datagrams sent with header compression, are restored first. Called with dataLinkLock held.
+ * @param link the link which received the frame
+ * @param pid the protocol identifier of the frame
+ * @param information the information field
+ * @param length the number of bytes in information
+ * @returns false if no receive buffer was available, so that the link leaves the frame unacknowledged and the
+ * peer sends it again once NDIS has returned some; true otherwise, including when the frame is dropped
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::DataLinkReceive(
+    _In_ const DataLink& link,
+    _In_ BYTE pid,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length) noexcept
+{
+    if (pid == Segmenter::PID_SEGMENT)
+    {
+        return reassembler.Receive(link.GetLocal(), link.GetPeer(), information, length, dataLinkTime(), *this);
+    }
+
+    if (pid == HeaderCompressor::PID_COMPRESSED_TCP || pid == HeaderCompressor::PID_UNCOMPRESSED_TCP ||
+        pid == PayloadCompressor::PID_COMPRESSED)
+    {
+        // The datagram is restored in the receive buffer, so it is copied there first
+        if (length > mtuSize)
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, TRACE_ADAPTER, "Dropping received frame: %u bytes is larger than the MTU", length);
+            statistics.CountReceiveError();
+            return true;
+        }
+
+        NET_BUFFER_LIST* netBufferList = receivePool.Take();
+        if (netBufferList == nullptr)
+        {
+            statistics.CountReceiveDiscards(1);
+            return false;
+        }
+
+        RtlCopyMemory(ReceiveBufferPool::GetData(*netBufferList) + ETHERNET_HEADER_LENGTH, information, length);
+        indicateDataLinkDatagram(link.GetLocal(), link.GetPeer(), pid, *netBufferList, length);
+        return true;
+    }
+
+    BYTE ethernetHeader[ETHERNET_HEADER_LENGTH];
+    if (!writeDataLinkEthernetHeader(link.GetLocal(), link.GetPeer(), pid, ethernetHeader))
+    {
+        statistics.CountReceiveError();
+        return true;
+    }
+
+    if (!receiveFilter.Accept(ethernetHeader))
+    {
+        return true;
+    }
+
+    return queueReceivedFrame(ethernetHeader, information, length) != NDIS_STATUS_RESOURCES;
+}
+
+/**
+ * Builds the Ethernet header with which a datagram received over a connected-mode link is indicated
+ * @param local the station the datagram was sent to
+ * @param peer the station which sent it
+ * @param pid the protocol identifier of the datagram
+ * @param ethernetHeader receives the header
+ * @returns true if the header was built, or false if the PID or an address has no Ethernet equivalent
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::writeDataLinkEthernetHeader(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _In_ BYTE pid,
+    _Out_writes_bytes_(ETHERNET_HEADER_LENGTH) BYTE* ethernetHeader) noexcept
+{
+    const USHORT etherType = (pid == HeaderTranslator::PID_IPV4) ? HeaderTranslator::ETHERTYPE_IPV4 :
+                             (pid == HeaderTranslator::PID_ARP) ? HeaderTranslator::ETHERTYPE_ARP :
+                             0;
+
+    if (etherType == 0 ||
+        !HeaderTranslator::AddressToEthernet(local, ethernetHeader) ||
+        !HeaderTranslator::AddressToEthernet(peer, ethernetHeader + HeaderTranslator::ETHERNET_ADDRESS_LENGTH))
+    {
+        return false;
+    }
+    ethernetHeader[2 * HeaderTranslator::ETHERNET_ADDRESS_LENGTH] = static_cast<BYTE>(etherType >> 8);
+    ethernetHeader[2 * HeaderTranslator::ETHERNET_ADDRESS_LENGTH + 1] = static_cast<BYTE>(etherType);
+    return true;
+}
+
+/**
+ * Lends reassembler a receive buffer to join a datagram up in, after the space for its Ethernet header. Called
+ * from the receive path with dataLinkLock held, so the receive pool keeps a single consumer.
+ * @param data receives the space for the datagram
+ * @param capacity receives the number of bytes at data, which is the MTU
+ * @returns the buffer, or nullptr if the pool is empty
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+NET_BUFFER_LIST* AX25Adapter::TakeSegmentBuffer(_Outptr_ BYTE** data, _Out_ ULONG* capacity) noexcept
+{
+    *data = nullptr;
+    *capacity = 0;
+    NET_BUFFER_LIST* netBufferList = receivePool.Take();
+    if (netBufferList == nullptr)
+    {
+        // The pool counts this for OID_GEN_RCV_NO_BUFFER
+        statistics.CountReceiveDiscards(1);
+        return nullptr;
+    }
+
+    *data = ReceiveBufferPool::GetData(*netBufferList) + ETHERNET_HEADER_LENGTH;
+    *capacity = mtuSize;
+    return netBufferList;
+}
+
+/**
+ * Takes back a receive buffer whose datagram reassembler dropped
+ * @param buffer the buffer, taken by TakeSegmentBuffer()
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::ReturnSegmentBuffer(_In_ NET_BUFFER_LIST& buffer) noexcept
+{
+    receivePool.Return(buffer);
+}
+
+/**
+ * Indicates a datagram joined up by reassembler. Called with dataLinkLock held.
+ * @param local the station the segments were sent to
+ * @param peer the station which sent them
+ * @param pid the protocol identifier of the datagram
+ * @param buffer the receive buffer holding the datagram, after the space for its Ethernet header
+ * @param length the number of bytes in the datagram
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::SegmentsReassembled(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _In_ BYTE pid,
+    _In_ NET_BUFFER_LIST& buffer,
+    _In_ ULONG length) noexcept
+{
+    indicateDataLinkDatagram(local, peer, pid, buffer, length);
+}
+
+/**
+ * Determines whether datagrams to a peer are compressed. Called with dataLinkLock held.
+ * @param peer the station the datagram is sent to
+ * @returns true if payloadCompressionMode is PayloadCompressor::Enabled, or is PayloadCompressor::Automatic and
+ * the peer has been heard sending compressed datagrams
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::compressesPayloadTo(_In_ const AX25Address& peer) const noexcept
+{
+    if (payloadCompressionMode != PayloadCompressor::Automatic)
+    {
+        return payloadCompressionMode == PayloadCompressor::Enabled;
+    }
+
+    for (ULONG i = 0; i < DATA_LINK_COUNT; i++)
+    {
+        if (payloadCompressionPeers[i] == peer)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Records that a peer sent a compressed datagram, so that in PayloadCompressor::Automatic mode datagrams to it
+ * are compressed from now on. Called with dataLinkLock held.
+ * @param peer the station which sent the datagram
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::notePayloadCompressionPeer(_In_ const AX25Address& peer) noexcept
+{
+    if (payloadCompressionMode != PayloadCompressor::Automatic || compressesPayloadTo(peer))
+    {
+        return;
+    }
+
+    payloadCompressionPeers[nextPayloadCompressionPeer] = peer;
+    nextPayloadCompressionPeer = (nextPayloadCompressionPeer + 1) % DATA_LINK_COUNT;
+}
+
+/**
+ * Indicates a datagram received over a connected-mode link, as an Ethernet frame from the peer to this
+ * station, decompressing it and then restoring its TCP/IP header first if they were compressed. Called with
+ * dataLinkLock held.
+ * @param local the station the datagram was sent to
+ * @param peer the station which sent it
+ * @param pid the protocol identifier of the datagram
+ * @param buffer the receive buffer holding the datagram, after the space for its Ethernet header. It holds
+ * up to mtuSize bytes there, and is returned to receivePool if the datagram is dropped.
+ * @param length the number of bytes in the datagram
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::indicateDataLinkDatagram(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _In_ BYTE pid,
+    _In_ NET_BUFFER_LIST& buffer,
+    _In_ ULONG length) noexcept
+{
+    BYTE* ethernetHeader = ReceiveBufferPool::GetData(buffer);
+    if (pid == PayloadCompressor::PID_COMPRESSED)
+    {
+        // Compressed datagrams are always accepted, whatever payloadCompressionMode is
+        RtlCopyMemory(payloadBuffer, ethernetHeader + ETHERNET_HEADER_LENGTH, length);
+        length = PayloadCompressor::Decompress(payloadBuffer, length, pid, ethernetHeader + ETHERNET_HEADER_LENGTH, mtuSize);
+        if (length == 0)
+        {
+            statistics.CountReceiveError();
+            receivePool.Return(buffer);
+            return;
+        }
+        notePayloadCompressionPeer(peer);
+    }
+
+    if (pid == HeaderCompressor::PID_COMPRESSED_TCP || pid == HeaderCompressor::PID_UNCOMPRESSED_TCP)
+    {
+        // Without compression state, the datagram is dropped as one with an unknown PID would be
+        length = headerCompression.IsAllocated() ?
+            headerCompression.Decompress(local, peer, pid, ethernetHeader + ETHERNET_HEADER_LENGTH, length, mtuSize) : 0;
+        pid = HeaderTranslator::PID_IPV4;
+        if (length == 0)
+        {
+            statistics.CountReceiveError();
+            receivePool.Return(buffer);
+            return;
+        }
+    }
+
+    if (!writeDataLinkEthernetHeader(local, peer, pid, ethernetHeader))
+    {
+        statistics.CountReceiveError();
+        receivePool.Return(buffer);
+        return;
+    }
+
+    if (!receiveFilter.Accept(ethernetHeader))
+    {
+        receivePool.Return(buffer);
+        return;
+    }
+
+    NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(&buffer)) = ETHERNET_HEADER_LENGTH + length;
+    queueReceiveBuffer(buffer);
+}
+
+/**
+ * Sends a frame produced by a connected-mode link to the connector. Called from the transmit drain, with
+ * dataLinkLock held, so outboundBuffer and transmitFrameCheckSequence are free to use.
+ * @param frame the frame, starting with the address field and without FCS
+ * @returns true if the connector accepted the frame
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+bool AX25Adapter::DataLinkTransmit(_In_ const FrameGatherList& frame) noexcept
+{
+    if (connector == nullptr)
+    {
+        return false;
+    }
+
+    FrameGatherList encoded = frame;
+    if (connector->UsesFrameCheckSequence() && !FrameEncoder::AppendFrameCheckSequence(encoded, transmitFrameCheckSequence))
+    {
+        return false;
+    }
+
+    if (encoded.GetFragmentCount() > 1 && connector->RequiresContiguousFrames())
+    {
+        const ULONG length = encoded.CopyTo(outboundBuffer, sizeof(outboundBuffer));
+        encoded.Reset();
+        if (length == 0 || !encoded.Append(outboundBuffer, length))
+        {
+            return false;
+        }
+        transmitFramesFlattened++;
+    }
+    else
+    {
+        transmitFramesGathered++;
+    }
+
+    return transmitToConnector(encoded) == NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Sends whatever each connected-mode link has due. Only called from the transmit drain, which keeps frames
+ * from the links and from SendNetBufferLists in a single context.
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::transmitDataLinks() noexcept
+{
+    const ULONG64 now = dataLinkTime();
+    KeAcquireSpinLockAtDpcLevel(&dataLinkLock);
+    for (ULONG i = 0; i < dataLinks.GetCount(); i++)
+    {
+        dataLinks[i].Transmit(*this, now);
+    }
+    scheduleDataLinkTimer(now);
+    KeReleaseSpinLockFromDpcLevel(&dataLinkLock);
+}
+
+/**
+ * Has the transmit drain call transmitDataLinks(), queueing the transmit DPC to run it
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::requestDataLinkTransmit() noexcept
+{
+    InterlockedExchange(&dataLinkTransmitPending, 1);
+    KeInsertQueueDpc(&transmitDpc, nullptr, nullptr);
+}
+
+/**
+ * Sets dataLinkTimer for the earliest timeout of any link or reassembly, unless it is already set to expire sooner.
+ * A timer which expires early does no harm, as the links and reassembler only act on timeouts which have passed. Called with
+ * dataLinkLock held.
+ * @param now the current time, in milliseconds
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::scheduleDataLinkTimer(_In_ ULONG64 now) noexcept
+{
+    ULONG64 deadline = MAXULONG64;
+    for (ULONG i = 0; i < dataLinks.GetCount(); i++)
+    {
+        const ULONG64 timeout = dataLinks[i].GetNextTimeout();
+        deadline = (timeout < deadline) ? timeout : deadline;
+    }
+    const ULONG64 reassemblyTimeout = reassembler.GetNextTimeout();
+    deadline = (reassemblyTimeout < deadline) ? reassemblyTimeout : deadline;
+
+    if (deadline < dataLinkTimerDeadline && state == Running)
+    {
+        dataLinkTimerDeadline = deadline;
+
+        // A negative due time is relative, in units of 100ns
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -static_cast<LONGLONG>((deadline > now) ? deadline - now : 0) * 10000;
+        KeSetTimer(&dataLinkTimer, dueTime, &dataLinkTimerDpc);
+    }
+}
+
+/**
+ * Callback DPC for the data link timer, queued when the earliest timeout of a link is due
+ * @param dpc the KDPC object representing this DPC
+ * @param adapterContext the AX25Adapter associated with this DPC
+ */
+_Use_decl_annotations_
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::dataLinkTimerDpcCallback(_In_ KDPC* dpc,
+                                           _In_opt_ void* adapterContext,
+                                           _In_opt_ void* systemArgument1,
+                                           _In_opt_ void* systemArgument2)
+{
+    UNREFERENCED_PARAMETER(dpc);
+    UNREFERENCED_PARAMETER(systemArgument1);
+    UNREFERENCED_PARAMETER(systemArgument2);
+
+    if (adapterContext == nullptr)
+    {
+        TraceEvents(TRACE_LEVEL_CRITICAL, TRACE_ADAPTER, "Cannot run data link timers: DPC context is nullptr");
+        return;
+    }
+
+    static_cast<AX25Adapter*>(adapterContext)->runDataLinkTimers();
+}
+
+/**
+ * Handles the expiry of link timers and of partly received datagrams, and has the transmit drain send whatever
+ * frames they made due
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::runDataLinkTimers() noexcept
+{
+    if (state != Running)
+    {
+        return;
+    }
+
+    const ULONG64 now = dataLinkTime();
+    bool transmit = false;
+    KeAcquireSpinLockAtDpcLevel(&dataLinkLock);
+    dataLinkTimerDeadline = MAXULONG64;
+    for (ULONG i = 0; i < dataLinks.GetCount(); i++)
+    {
+        dataLinks[i].OnTimer(now);
+        transmit |= dataLinks[i].HasFramesToTransmit();
+    }
+    reassembler.Expire(now, *this);
+    scheduleDataLinkTimer(now);
+    KeReleaseSpinLockFromDpcLevel(&dataLinkLock);
+
+    if (transmit)
+    {
+        requestDataLinkTransmit();
+    }
+}
+
+/**
+ * Returns the specified NET_BUFFER_LIST objects to being owned by this object so that they
+ * can be reused in future receive operations.
+ * @param netBufferLists a linked list of NET_BUFFER_LIST objects that are to be returned to ownership
+ * by this object
+ * @param returnFlags a flag field with bit NDIS_RETURN_FLAGS_DISPATCH_LEVEL set if the current IRQL
+ * is DISPATCH_LEVEL.
+ */
+_When_(returnFlags & NDIS_RETURN_FLAGS_DISPATCH_LEVEL, _IRQL_requires_(DISPATCH_LEVEL))
+_When_(!(returnFlags & NDIS_RETURN_FLAGS_DISPATCH_LEVEL), _IRQL_requires_max_(APC_LEVEL))
+_IRQL_requires_same_
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::ReturnNetBufferLists(
+    _In_ NET_BUFFER_LIST& netBufferLists,
+    _In_ ULONG returnFlags) noexcept
+{
+    UNREFERENCED_PARAMETER(returnFlags);
+    returnReceiveBuffers(netBufferLists);
+}
+
+/**
+ * Puts received frames back into the receive pool, completing a pending pause if they were the last
+ * buffers outstanding
+ * @param chain the head of a chain of NET_BUFFER_LIST objects taken from receivePool
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void AX25Adapter::returnReceiveBuffers(_In_ NET_BUFFER_LIST& chain) noexcept
+{
+    receivePool.Return(chain);
+
+    if (tryCompletePause())
+    {
+        NdisMPauseComplete(driverHandle);
+    }
 }
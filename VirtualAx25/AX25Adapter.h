@@ -24,6 +24,25 @@
 
 #pragma once
 #include "Utility.h"
+#include "Public.h"
+#include "Connector.h"
+#include "FrameEncoder.h"
+#include "InterlockedChainQueue.h"
+#include "NetBufferListUtility.h"
+#include "ReceiveBufferPool.h"
+#include "AX25Address.h"
+#include "HeaderTranslator.h"
+#include "MulticastFilter.h"
+#include "ReceiveFilter.h"
+#include "AdapterStatistics.h"
+#include "ReceiveModeration.h"
+#include "Crc16.h"
+#include "DataLink.h"
+#include "Segmenter.h"
+#include "HeaderCompressor.h"
+#include "PayloadCompressor.h"
+#include "ChannelAccess.h"
+#include "TransmitScheduler.h"
 
 /**
  * Represents a single AX.25 adapter. In scenarios where multiple AX.25 adapters have been
@@ -31,11 +50,26 @@
  * each individual adapter will have its own AX25Adapter object. The Miniport object will call
  * into the appropriate AX25Adapter object as needed.
  */
-class AX25Adapter
+class AX25Adapter : private DataLinkClient, private SegmentReassemblerClient
 {
     // Some friendships defined to assist with unit testing without interfering with the class operation
     friend class AX25AdapterFixture_DeleteNullptr_Test;
     friend class AX25AdapterFixture_ValidDeallocation_Test;
+    friend class AX25AdapterFixture_ReceiveIndicationsAreBatched_Test;
+    friend class AX25AdapterFixture;
+    friend class AX25AdapterFixture_SendsAreRejectedUnlessRunning_Test;
+    friend class AX25AdapterFixture_ReceivesAreRejectedUnlessRunning_Test;
+    friend class AX25AdapterFixture_OnlyJoinedMulticastGroupsAreReceived_Test;
+    friend class AX25AdapterFixture_LongMulticastListsAreJoined_Test;
+    friend class AX25AdapterFixture_OidTablesAreSortedAndMatch_Test;
+    friend class AX25AdapterFixture_OidRequestsAreDispatched_Test;
+    friend class AX25AdapterFixture_DataLinkFramesAreAnswered_Test;
+    friend class AX25AdapterFixture_DatagramsAreSentOnDataLinks_Test;
+    friend class AX25AdapterFixture_RestartRunsDataLinkTimers_Test;
+    friend class AX25AdapterFixture_UnsegmentedFramesKeepTheDefaultMtu_Test;
+    friend class AX25AdapterFixture_PayloadIsCompressedOnceThePeerCompresses_Test;
+    friend class AX25AdapterFixture_TransmitClassesFollowPriority_Test;
+    friend class AX25AdapterFixture_TransmitClassStatisticsAreReported_Test;
 public:
     _IRQL_requires_max_(DISPATCH_LEVEL)
     _Must_inspect_result_
@@ -55,7 +89,12 @@ public:
     PAGEABLE_FUNCTION
     NDIS_STATUS SetMiniportAttributes();
 
-    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS SetGeneralAttributes();
+
+    _IRQL_requires_(PASSIVE_LEVEL)
     NON_PAGEABLE_FUNCTION
     virtual void Destroy() noexcept;
 
@@ -89,6 +128,42 @@ public:
     void ReturnNetBufferLists(
         _In_ NET_BUFFER_LIST& netBufferLists,
         _In_ ULONG returnFlags) noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS AttachConnector(_In_opt_ Connector* newConnector) noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS ReadConfiguration() noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS AllocateReceiveBuffers() noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS AllocateStatistics() noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS AllocateDataLinks() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS ReceiveFrame(
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void IndicateCarrier(_In_ bool detected) noexcept;
 private:
     /**
      * Represents the current state of this adapter 
@@ -104,6 +179,16 @@ private:
         Shutdown        //<! Not used, because this object is deallocated while the driver is shut down
     } state; //<! current state of the adapter
 
+    /**
+     * Number of calls which have found the adapter Running and have not yet queued their work. Pause() waits
+     * for it to drop to zero after leaving the Running state, so that nothing accepted before the pause is
+     * still on its way into a queue when the queues are flushed.
+     */
+    volatile LONG activeCalls;
+
+    /** Set by the last call counted in activeCalls to leave while the adapter is Pausing, which Pause() waits for */
+    KEVENT callsDrained;
+
     /**
      * The tag to use when allocating an AX25Adapter object in the non-pageable pool. In memory
      * this should appear as "axAX", little-endian.
@@ -111,6 +196,7 @@ private:
     static constexpr ULONG AX25_ADAPTER_TAG = AX25_CREATE_TAG("axAX");
 
     static constexpr ULONG DEFAULT_MTU_SIZE_BYTES = 512;        //<! Default MTU for an AX.25 link
+    static constexpr ULONG SEGMENTED_MTU_SIZE_BYTES = 1500;     //<! MTU in connected mode, where longer datagrams are segmented
     static constexpr ULONG DEFAULT_XMIT_BITS_PER_SECOND = 1200; //<! Default transmit speed for an AX.25 link on VHF
     static constexpr ULONG MAX_XMIT_BITS_PER_SECOND = 9600;     //<! Maximum transmit speed for an AX.25 link on VHF
 
@@ -118,28 +204,42 @@ private:
     static constexpr ULONG DEFAULT_RCV_BITS_PER_SECOND = DEFAULT_XMIT_BITS_PER_SECOND;  //<! Default receive speed for an AX.25 link on VHF
     static constexpr ULONG MAX_RCV_BITS_PER_SECOND = MAX_XMIT_BITS_PER_SECOND;          //<! Maximum receive speed for an AX.25 link on VHF
 
-    static constexpr size_t MAX_MULTICAST_GROUPS = 16;          //<! Maximum number of multicast groups supported simultaneously
-    static constexpr size_t MAC_ADDRESS_LENGTH_BITS = 8 * 7;    //<! Number of bits in an AX.25 address
+    static constexpr ULONG ETHERNET_HEADER_LENGTH = HeaderTranslator::ETHERNET_HEADER_LENGTH;  //<! Size of the header on frames exchanged with NDIS
+    static constexpr ULONG RECEIVE_BUFFER_SIZE = SEGMENTED_MTU_SIZE_BYTES + ETHERNET_HEADER_LENGTH;  //<! Size of each receive buffer
+    static constexpr ULONG RECEIVE_BUFFER_COUNT = 64;                                   //<! Number of preallocated receive buffers
+    static constexpr ULONG DEFAULT_RECEIVE_BATCH_SIZE = 16;                             //<! Default for the ReceiveBatchSize keyword
+    static constexpr ULONG MAX_RECEIVE_BATCH_SIZE = RECEIVE_BUFFER_COUNT;               //<! Largest accepted ReceiveBatchSize
+    static constexpr ULONG RECEIVE_BATCH_HISTOGRAM_BUCKETS = AX25_RECEIVE_BATCH_HISTOGRAM_BUCKETS; //<! Buckets in the batch histogram
+    static constexpr ULONG DEFAULT_RECEIVE_COALESCE_FRAMES = 8;                         //<! Default for the ReceiveCoalesceFrames keyword
+    static constexpr ULONG DEFAULT_RECEIVE_COALESCE_MICROSECONDS = 500;                 //<! Default for the ReceiveCoalesceMicroseconds keyword
+    static constexpr ULONG DATA_LINK_COUNT = 8;                                         //<! Peers which may be connected at once
+
+    static constexpr size_t MAX_MULTICAST_GROUPS = MulticastFilter::MAX_ADDRESSES;    //<! Maximum number of multicast groups supported simultaneously
 
     /** The default MAC address used to allocate to this adapter */
-    static constexpr unsigned long long DEFAULT_MAC_ADDRESS =   // Set default address to KG7UDH-0 for now
-        (static_cast<unsigned long long>('K') << 0 ) |
-        (static_cast<unsigned long long>('G') << 8 ) |
-        (static_cast<unsigned long long>('7') << 16) |
-        (static_cast<unsigned long long>('U') << 24) |
-        (static_cast<unsigned long long>('D') << 32) | 
-        (static_cast<unsigned long long>('H') << 40) |
-                                       (0ULL  << 48);
+    static constexpr AX25Address DEFAULT_MAC_ADDRESS = AX25Address("KG7UDH", 0);      // Set default address to KG7UDH-0 for now
 
     /**
-     * Buffer for storing inbound data (received from the radio)
+     * Buffer for storing outbound data (to send to the radio). Frames are normally handed to the connector
+     * as a gather list over the NET_BUFFER's own memory; this buffer is only used when the connector requires
+     * contiguous frames or a frame is too fragmented to describe with a FrameGatherList.
      */
-    BYTE inboundBuffer[DEFAULT_MTU_SIZE_BYTES];
+    BYTE outboundBuffer[HeaderTranslator::MAX_AX25_HEADER_LENGTH + SEGMENTED_MTU_SIZE_BYTES + Crc16::FCS_LENGTH];
 
-    /**
-     * Buffer for storing outbound data (to send to the radio)
-     */
-    BYTE outboundBuffer[DEFAULT_MTU_SIZE_BYTES];
+    /** AX.25 header of the frame being transmitted. Only used by the processor draining the transmit queue. */
+    BYTE transmitHeader[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+
+    /** FCS of the frame being transmitted, for connectors which use one. Only used by the processor draining the transmit queue. */
+    BYTE transmitFrameCheckSequence[Crc16::FCS_LENGTH];
+
+    /** Converts Ethernet headers from NDIS to AX.25 headers for the radio, and back */
+    HeaderTranslator headerTranslator;
+
+    /** Number of frames handed to the connector without copying their payload */
+    ULONG64 transmitFramesGathered;
+
+    /** Number of frames which had to be copied into outboundBuffer before transmission */
+    ULONG64 transmitFramesFlattened;
 
    
 
@@ -152,30 +252,41 @@ private:
     int currentVlan;
 
     /**
-     * The current packet filtering mode of this adapter. At startup, this is set to 0 (no
-     * packets are processed). NDIS will reconfigure the filter mode depending on what is
-     * needed from the adapter. 
-     * @seealso https://msdn.microsoft.com/en-us/library/windows/hardware/ff569575(v=vs.85).aspx
+     * Multicast groups that have been joined on this adapter, as Ethernet addresses. At startup, no
+     * groups are joined. NDIS replaces the list through OID_802_3_MULTICAST_LIST.
      */
-    ULONG currentPacketFilterMode;
+    MulticastFilter joinedMulticastGroups;
 
     /**
-     * Multicast groups that have been joined on this adapter, as MAC addresses. An address of
-     * 0 indicates an unused slot. At startup, this list is initialized to all zeroes. Note that
-     * AX.25 MAC addresses are 56 bits long (6 callsign characters and an SSID) so a 64-bit
-     * integer must be used here.
+     * The current packet filtering mode of this adapter. At startup, the filter is 0 (no
+     * packets are processed). NDIS will reconfigure the filter mode depending on what is
+     * needed from the adapter through OID_GEN_CURRENT_PACKET_FILTER.
+     * @seealso https://msdn.microsoft.com/en-us/library/windows/hardware/ff569575(v=vs.85).aspx
      */
-    UINT64 joinedMulticastGroups[MAX_MULTICAST_GROUPS];
-    static_assert(sizeof(UINT64) * 8 >= MAC_ADDRESS_LENGTH_BITS, "joinedMulticastGroups is not large enough to store an AX.25 MAC Address");
+    ReceiveFilter receiveFilter;
+
+    /** Completes one direction (query or set) of an OID request */
+    typedef NDIS_STATUS (AX25Adapter::*OidHandler)(_Inout_ NDIS_OID_REQUEST& oidRequest);
 
-    /** The number of supported OIDs in the supportedOids field */
-    static constexpr size_t OID_LIST_LENGTH = 44;
+    /** The handlers for a single OID */
+    struct OidDispatchEntry
+    {
+        NDIS_OID oid;           //<! The OID handled, which must match the same entry of SUPPORTED_OIDS
+        OidHandler query;       //<! Handles queries of the OID, or nullptr if it cannot be queried yet
+        OidHandler set;         //<! Handles sets of the OID, or nullptr if it cannot be set
+    };
+
+    /** The number of supported OIDs in SUPPORTED_OIDS */
+    static constexpr size_t OID_LIST_LENGTH = 49;
 
     /**
-     * The OIDs that this AX25 Adapter supports. This is not unique to a given adapter; all adapters
-     * will support the same OIDs. However, it is allocated as part of the AX25Adapter to keep it in non-pageable memory.
+     * The OIDs that this AX25 Adapter supports, in ascending order, as reported to NDIS. This is not unique
+     * to a given adapter; all adapters support the same OIDs, so there is one read-only copy in the driver image.
      */
-    NDIS_OID supportedOids[OID_LIST_LENGTH];
+    static const NDIS_OID SUPPORTED_OIDS[OID_LIST_LENGTH];
+
+    /** The handlers for each entry of SUPPORTED_OIDS, in the same order */
+    static const OidDispatchEntry OID_DISPATCH_TABLE[OID_LIST_LENGTH];
 
     /**
      * Representation of an entity stored in an NDIS_MINIPORT_ADAPTER_ATTRIBUTES object.
@@ -219,6 +330,117 @@ private:
     PAGEABLE_FUNCTION
     void initializeRegistrationAttributes() noexcept;
 
+    static constexpr bool oidTablesAreConsistent(_In_ size_t index) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static const OidDispatchEntry* findOidHandlers(_In_ NDIS_OID oid) noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    static NDIS_STATUS queryCounter(_Inout_ NDIS_OID_REQUEST& oidRequest, _In_ ULONG64 value) noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    static NDIS_STATUS queryBuffer(
+        _Inout_ NDIS_OID_REQUEST& oidRequest,
+        _In_reads_bytes_(length) const void* data,
+        _In_ ULONG length) noexcept;
+
+    // OID handlers, dispatched through OID_DISPATCH_TABLE
+    template<ULONG value>
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryConstant(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryZeroCounter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryVendorDescription(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryDriverVersion(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryPacketFilter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS setPacketFilter(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryLookahead(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS setLookahead(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryMaximumTotalSize(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryReceiveNoBuffer(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryPermanentAddress(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryCurrentAddress(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryMulticastList(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS setMulticastList(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryReceiveBatchHistogram(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryHeaderCacheStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryTransmitOk(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryReceiveOk(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryTransmitErrors(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryReceiveErrors(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryInterruptModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS setInterruptModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryReceiveModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS setReceiveModeration(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryHeaderCompressionStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    PAGEABLE_FUNCTION
+    NDIS_STATUS queryTransmitClassStatistics(_Inout_ NDIS_OID_REQUEST& oidRequest) noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    PAGEABLE_FUNCTION
+    static ULONG readIntegerParameter(
+        _In_ NDIS_HANDLE configuration,
+        _In_ NDIS_STRING& keyword,
+        _In_ ULONG defaultValue,
+        _In_ ULONG minimum,
+        _In_ ULONG maximum) noexcept;
+
     /**
      * DPC structure which represents the receive action DPC. When a new packet comes in, this DPC
      * will be used as a callback for processing the received information.
@@ -228,6 +450,350 @@ private:
     NON_PAGEABLE_FUNCTION 
     static KDEFERRED_ROUTINE receiveDpcCallback;
 
+    /**
+     * Timer which queues receiveDpc when coalesced frames have waited long enough. Armed by ReceiveFrame
+     * for the first frame of each run, as decided by receiveModeration.
+     */
+    KTIMER receiveModerationTimer;
+
+    /**
+     * Decides when a received frame schedules receiveDpc, according to OID_GEN_INTERRUPT_MODERATION and
+     * OID_AX25_RECEIVE_MODERATION, and counts the frames indicated per DPC
+     */
+    ReceiveModeration receiveModeration;
+
+    /**
+     * Preallocated buffers for frames received from the radio. ReceiveFrame takes buffers from the pool and
+     * ReturnNetBufferLists puts them back once NDIS is finished with them.
+     */
+    ReceiveBufferPool receivePool;
+
+    /**
+     * Frame, byte, error and discard counts for both directions, kept per processor and summed for
+     * OID_GEN_STATISTICS and the other general statistics OIDs
+     */
+    AdapterStatistics statistics;
+
+    /**
+     * Received frames which have been copied into pool buffers and are waiting for the receive DPC to
+     * indicate them to NDIS
+     */
+    InterlockedChainQueue<NET_BUFFER_LIST, NetBufferListChainLink> receiveQueue;
+
+    /**
+     * Frames taken from receiveQueue which did not fit in the last indication, oldest first and linked by
+     * NET_BUFFER_LIST_NEXT_NBL. Only touched by the processor which owns receiveIndicateActive.
+     */
+    NET_BUFFER_LIST* receiveBacklog;
+    NET_BUFFER_LIST* receiveBacklogTail;    //<! Last frame in receiveBacklog, or nullptr if it is empty
+
+    /**
+     * The configured batch limit and a histogram of how many frames each indication carried. Only written
+     * by the processor which owns receiveIndicateActive; reported through OID_AX25_RECEIVE_BATCH_HISTOGRAM.
+     */
+    AX25_RECEIVE_BATCH_HISTOGRAM receiveBatchStatistics;
+
+    /**
+     * Set to 1 while a processor is indicating the receive queue, for the same reason as transmitDrainActive.
+     * This also makes the receive path the single consumer that receivePool requires.
+     */
+    volatile LONG receiveIndicateActive;
+
+    /**
+     * Set to 1 while Pause() is waiting for NDIS to return receive buffers. Whichever of Pause() and
+     * ReturnNetBufferLists() clears it is responsible for completing the pause.
+     */
+    volatile LONG pausePending;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void indicateReceiveQueue() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void indicateReceiveBatch(_In_ NET_BUFFER_LIST& batch, _In_ ULONG count) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void returnReceiveBuffers(_In_ NET_BUFFER_LIST& chain) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool tryCompletePause() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void leaveCall() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void discardSegments() noexcept;
+
+    /**
+     * Chains of NET_BUFFER_LIST objects which have been accepted by SendNetBufferLists and are
+     * waiting to be transmitted. Any number of processors may enqueue concurrently; only the
+     * transmit DPC dequeues.
+     */
+    InterlockedChainQueue<NET_BUFFER_LIST, NetBufferListChainLink> transmitQueue;
+
+    /**
+     * DPC structure which represents the transmit drain DPC. It is queued whenever a send finds the
+     * transmit queue empty, and serializes all queued frames out to the connector.
+     */
+    KDPC transmitDpc;
+
+    /**
+     * Set to 1 while a processor is draining the transmit queue. The same DPC may run on more than one
+     * processor at once, so this ensures that frames reach the connector from a single context
+     * (and therefore in order, and with exclusive use of outboundBuffer).
+     */
+    volatile LONG transmitDrainActive;
+
+    /**
+     * The connector to which frames are transmitted, or nullptr if this adapter is not currently bound
+     * to a radio.
+     */
+    Connector* connector;
+
+    /**
+     * True if the adapter decides when to key the transmitter, set by the ChannelAccess keyword. Otherwise
+     * frames go to the connector as soon as they are sent, for a TNC which does its own channel access.
+     */
+    bool channelAccessEnabled;
+
+    /** Decides when the transmit drain may start a burst. Only used by the processor draining the transmit queue. */
+    ChannelAccess channelAccess;
+
+    /** Set to 1 while the connector reports a carrier on the channel, through IndicateCarrier() */
+    volatile LONG carrierDetected;
+
+    /**
+     * Timer which queues transmitDpc when channelAccess next allows a burst to be tried, or when the radio is
+     * ready for another frame
+     */
+    KTIMER channelAccessTimer;
+
+    /**
+     * Frames taken from the transmit queue which are waiting to be sent, in the queue of their transmit class.
+     * Only used by the processor draining the transmit queue.
+     */
+    TransmitScheduler<NET_BUFFER_LIST, NetBufferListTransmitLink> transmitScheduler;
+
+    NON_PAGEABLE_FUNCTION
+    static KDEFERRED_ROUTINE transmitDpcCallback;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void drainTransmitQueue() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void scheduleTransmitQueue() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    TransmitClass classifyNetBufferList(_In_ NET_BUFFER_LIST& netBufferList) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool acquireChannel(_Out_ ULONG64& nextAttempt) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS transmitToConnector(_In_ const FrameGatherList& frame) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void transmitScheduled(_Inout_ NET_BUFFER_LIST& netBufferList) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS transmitNetBufferList(_In_ NET_BUFFER_LIST& netBufferList) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS sendOnDataLink(_In_ NET_BUFFER& netBuffer, _In_ ULONG headerLength) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS flattenFrame(
+        _In_ NET_BUFFER& netBuffer,
+        _In_ NDIS_STATUS encodeStatus,
+        _In_reads_bytes_(headerLength) const BYTE* header,
+        _In_ ULONG headerLength,
+        _In_ bool appendFrameCheckSequence,
+        _Inout_ FrameGatherList& frame) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS acceptReceivedFrame(
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS queueReceivedFrame(
+        _In_reads_bytes_(ETHERNET_HEADER_LENGTH) const BYTE* ethernetHeader,
+        _In_reads_bytes_(payloadLength) const BYTE* payload,
+        _In_ ULONG payloadLength) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void queueReceiveBuffer(_In_ NET_BUFFER_LIST& netBufferList) noexcept;
+
+    /**
+     * True if unicast IPv4 datagrams are carried over AX.25 connected mode, set by the ConnectedMode keyword.
+     * Broadcasts, multicasts and ARP always go as UI frames.
+     */
+    bool connectedMode;
+
+    /** MTU advertised to NDIS: SEGMENTED_MTU_SIZE_BYTES in connected mode, or DEFAULT_MTU_SIZE_BYTES otherwise */
+    ULONG mtuSize;
+
+    /** A connected-mode link for each peer, allocated by AllocateDataLinks() if connectedMode is set */
+    DataLinkTable dataLinks;
+
+    /** Joins up the segments of datagrams received over the links, in buffers taken from receivePool */
+    SegmentReassembler reassembler;
+
+    /** When TCP/IP headers are compressed on the links, set by the HeaderCompression keyword */
+    HeaderCompressionTable::Mode headerCompressionMode;
+
+    /** The TCP/IP header compression state shared with each peer, allocated by AllocateDataLinks() if enabled */
+    HeaderCompressionTable headerCompression;
+
+    /** When datagrams are compressed on the links, set by the PayloadCompression keyword */
+    PayloadCompressor::Mode payloadCompressionMode;
+
+    /** Compresses the datagrams sent on the links, as payloadCompressionMode calls for. Used with dataLinkLock held. */
+    PayloadCompressor payloadCompressor;
+
+    /**
+     * Peers heard sending compressed datagrams, to which datagrams are compressed in PayloadCompressor::Automatic
+     * mode. The one recorded first gives way to a new one. Used with dataLinkLock held.
+     */
+    AX25Address payloadCompressionPeers[DATA_LINK_COUNT];
+
+    /** The entry of payloadCompressionPeers to be replaced next */
+    ULONG nextPayloadCompressionPeer;
+
+    /**
+     * Holds a datagram compressed for sending, or the information field of one received compressed while it is
+     * restored into a receive buffer. Used with dataLinkLock held.
+     */
+    BYTE payloadBuffer[SEGMENTED_MTU_SIZE_BYTES];
+
+    /**
+     * Serializes dataLinks and dataLinkTimerDeadline between the transmit drain, ReceiveFrame() and the data link
+     * timer. Links only send frames from the transmit drain, so the connector is never called from the others.
+     */
+    KSPIN_LOCK dataLinkLock;
+
+    /** Timer which queues dataLinkTimerDpc when the earliest T1 or T3 of any link expires */
+    KTIMER dataLinkTimer;
+
+    /** DPC structure which runs the timers of the data links */
+    KDPC dataLinkTimerDpc;
+
+    /** Time, in milliseconds, for which dataLinkTimer is set, or MAXULONG64 if it is not */
+    ULONG64 dataLinkTimerDeadline;
+
+    /** Set to 1 when a link may have frames to send, so the transmit drain calls each link's Transmit() */
+    volatile LONG dataLinkTransmitPending;
+
+    NON_PAGEABLE_FUNCTION
+    static KDEFERRED_ROUTINE dataLinkTimerDpcCallback;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void runDataLinkTimers() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void scheduleDataLinkTimer(_In_ ULONG64 now) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void transmitDataLinks() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void requestDataLinkTransmit() noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    NDIS_STATUS receiveDataLinkFrame(
+        _In_ const AX25AddressField& addresses,
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool writeDataLinkEthernetHeader(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_ BYTE pid,
+        _Out_writes_bytes_(ETHERNET_HEADER_LENGTH) BYTE* ethernetHeader) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool compressesPayloadTo(_In_ const AX25Address& peer) const noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void notePayloadCompressionPeer(_In_ const AX25Address& peer) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void indicateDataLinkDatagram(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_ BYTE pid,
+        _In_ NET_BUFFER_LIST& buffer,
+        _In_ ULONG length) noexcept;
+
+    // DataLinkClient
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    bool DataLinkTransmit(_In_ const FrameGatherList& frame) noexcept override;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    bool DataLinkReceive(
+        _In_ const DataLink& link,
+        _In_ BYTE pid,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length) noexcept override;
+
+    // SegmentReassemblerClient
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    NET_BUFFER_LIST* TakeSegmentBuffer(_Outptr_ BYTE** data, _Out_ ULONG* capacity) noexcept override;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void ReturnSegmentBuffer(_In_ NET_BUFFER_LIST& buffer) noexcept override;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void SegmentsReassembled(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_ BYTE pid,
+        _In_ NET_BUFFER_LIST& buffer,
+        _In_ ULONG length) noexcept override;
 
     /**
      * The NDIS driver handle assigned to this driver, which was supplied during allocation
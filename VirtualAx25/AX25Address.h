@@ -0,0 +1,345 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AX25Address.h
+ * Definition of the AX25Address and AX25AddressField classes, which encode and decode AX.25 addresses
+ * in their on-air form.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * A single AX.25 address (callsign and SSID) held in its on-air form.
+ *
+ * On the air, an address is 7 bytes: six callsign characters, each ASCII shifted left one bit and padded
+ * with spaces, followed by an SSID byte laid out as CRRSSSSE (C = command/response bit, or has-been-repeated
+ * bit for a repeater; RR = reserved, normally 1; SSSS = SSID; E = set on the last address in the header).
+ * The address is kept packed in a 64-bit integer with the first wire byte in the low 8 bits, so loading
+ * or storing it is a single copy and comparing two addresses is a single integer comparison. The text
+ * form is only ever produced for diagnostics.
+ *
+ * Because every callsign byte on the wire is even, an address used as a MAC address is always unicast.
+ */
+class AX25Address
+{
+public:
+    static constexpr ULONG CALLSIGN_LENGTH = 6;         //<! Number of characters in a callsign, including padding
+    static constexpr ULONG WIRE_LENGTH = 7;             //<! Number of bytes in an encoded address
+    static constexpr BYTE MAX_SSID = 15;                //<! Largest secondary station identifier
+
+    static constexpr BYTE EXTENSION_BIT = 0x01;         //<! SSID byte bit marking the last address of a header
+    static constexpr BYTE SSID_MASK = 0x1E;             //<! SSID byte bits holding the SSID
+    static constexpr BYTE RESERVED_BITS = 0x60;         //<! SSID byte bits reserved by the protocol; normally set
+    static constexpr BYTE CONTROL_BIT = 0x80;           //<! SSID byte C bit (source/destination) or H bit (repeater)
+
+    /** Longest text produced by FormatCallsign: callsign, '-', two digit SSID and terminator */
+    static constexpr ULONG MAX_TEXT_LENGTH = CALLSIGN_LENGTH + 4;
+
+    /**
+     * Creates an empty address, which compares equal only to other empty addresses
+     */
+    NON_PAGEABLE_FUNCTION
+    constexpr AX25Address() noexcept
+        :packed(0)
+    {
+    }
+
+    /**
+     * Encodes an address at compile time
+     * @param callsign the callsign, in upper case, of at most 6 characters
+     * @param ssid the secondary station identifier, from 0 to 15
+     */
+    template <size_t length>
+    NON_PAGEABLE_FUNCTION
+    constexpr AX25Address(_In_ const char (&callsign)[length], _In_ BYTE ssid) noexcept
+        :packed(packCallsign(callsign, 0, false) | (static_cast<ULONG64>(makeSsidByte(ssid)) << SSID_SHIFT))
+    {
+        static_assert(length <= CALLSIGN_LENGTH + 1, "AX.25 callsigns are at most 6 characters long");
+    }
+
+    /**
+     * Loads an address from its on-air form
+     * @param wire the WIRE_LENGTH bytes of the encoded address
+     * @returns the address, including its control, reserved and extension bits
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline AX25Address FromWire(_In_reads_bytes_(WIRE_LENGTH) const BYTE* wire) noexcept
+    {
+        ULONG64 value = 0;
+        RtlCopyMemory(&value, wire, WIRE_LENGTH);
+        return AX25Address(value);
+    }
+
+    /**
+     * Stores this address in its on-air form
+     * @param wire receives the WIRE_LENGTH bytes of the encoded address
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void ToWire(_Out_writes_bytes_(WIRE_LENGTH) BYTE* wire) const noexcept
+    {
+        RtlCopyMemory(wire, &packed, WIRE_LENGTH);
+    }
+
+    /** @returns all 7 wire bytes of this address, the first in the low 8 bits */
+    NON_PAGEABLE_FUNCTION
+    constexpr ULONG64 GetPacked() const noexcept { return packed; }
+
+    /** @returns the callsign and SSID, without the control, reserved and extension bits, as one integer */
+    NON_PAGEABLE_FUNCTION
+    constexpr ULONG64 GetKey() const noexcept { return packed & KEY_MASK; }
+
+    /**
+     * Gets one character of the callsign
+     * @param index the position of the character, less than CALLSIGN_LENGTH
+     * @returns the character, which is a space if the callsign is shorter than index + 1 characters
+     */
+    NON_PAGEABLE_FUNCTION
+    constexpr char GetCharacter(_In_ ULONG index) const noexcept
+    {
+        return static_cast<char>((packed >> (8 * index + 1)) & 0x7F);
+    }
+
+    /** @returns the secondary station identifier */
+    NON_PAGEABLE_FUNCTION
+    constexpr BYTE GetSsid() const noexcept { return static_cast<BYTE>((getSsidByte() & SSID_MASK) >> 1); }
+
+    /** @returns the C bit of a source or destination address, or the H bit of a repeater address */
+    NON_PAGEABLE_FUNCTION
+    constexpr bool GetControlBit() const noexcept { return (getSsidByte() & CONTROL_BIT) != 0; }
+
+    /** @returns true if this is the last address of a header */
+    NON_PAGEABLE_FUNCTION
+    constexpr bool IsLast() const noexcept { return (getSsidByte() & EXTENSION_BIT) != 0; }
+
+    /**
+     * Checks that every callsign byte could have come from a shifted ASCII character. This is a single test
+     * of all six bytes at once.
+     * @returns true if none of the callsign bytes has its low bit set
+     */
+    NON_PAGEABLE_FUNCTION
+    constexpr bool IsWellFormed() const noexcept { return (packed & CALLSIGN_LOW_BITS) == 0; }
+
+    /** @returns a copy of this address with the C or H bit set as specified */
+    NON_PAGEABLE_FUNCTION
+    constexpr AX25Address WithControlBit(_In_ bool set) const noexcept
+    {
+        return AX25Address(withSsidBit(CONTROL_BIT, set));
+    }
+
+    /** @returns a copy of this address with the extension bit set as specified */
+    NON_PAGEABLE_FUNCTION
+    constexpr AX25Address WithLast(_In_ bool last) const noexcept
+    {
+        return AX25Address(withSsidBit(EXTENSION_BIT, last));
+    }
+
+    /** Addresses are equal if their callsigns and SSIDs match; the other SSID byte bits are ignored */
+    NON_PAGEABLE_FUNCTION
+    constexpr bool operator==(_In_ const AX25Address& other) const noexcept { return GetKey() == other.GetKey(); }
+
+    NON_PAGEABLE_FUNCTION
+    constexpr bool operator!=(_In_ const AX25Address& other) const noexcept { return GetKey() != other.GetKey(); }
+
+    /**
+     * Produces the text form of this address, such as "KG7UDH-7", for diagnostics. The SSID is omitted
+     * when it is 0. This is never needed to handle a frame.
+     * @param text receives the null-terminated text
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void FormatCallsign(_Out_writes_z_(MAX_TEXT_LENGTH) char (&text)[MAX_TEXT_LENGTH]) const noexcept
+    {
+        ULONG length = 0;
+        for (ULONG i = 0; i < CALLSIGN_LENGTH; i++)
+        {
+            char character = GetCharacter(i);
+            if (character != ' ')
+            {
+                text[length++] = character;
+            }
+        }
+
+        const BYTE ssid = GetSsid();
+        if (ssid != 0)
+        {
+            text[length++] = '-';
+            if (ssid >= 10)
+            {
+                text[length++] = '1';
+            }
+            text[length++] = static_cast<char>('0' + ssid % 10);
+        }
+        text[length] = '\0';
+    }
+
+private:
+    static constexpr ULONG SSID_SHIFT = 8 * CALLSIGN_LENGTH;                    //<! Position of the SSID byte in packed
+    static constexpr ULONG64 KEY_MASK = 0x0000FFFFFFFFFFFFULL | (static_cast<ULONG64>(SSID_MASK) << SSID_SHIFT); //<! Bits compared by operator==
+    static constexpr ULONG64 CALLSIGN_LOW_BITS = 0x0000010101010101ULL;         //<! Low bit of every callsign byte
+
+    ULONG64 packed;     //<! The wire bytes of the address; the first is in the low 8 bits and the top byte is 0
+
+    /** Wraps an already-packed address */
+    NON_PAGEABLE_FUNCTION
+    explicit constexpr AX25Address(_In_ ULONG64 value) noexcept
+        :packed(value)
+    {
+    }
+
+    /** @returns the SSID byte of this address */
+    NON_PAGEABLE_FUNCTION
+    constexpr BYTE getSsidByte() const noexcept { return static_cast<BYTE>(packed >> SSID_SHIFT); }
+
+    /** @returns packed with the specified SSID byte bit set or cleared */
+    NON_PAGEABLE_FUNCTION
+    constexpr ULONG64 withSsidBit(_In_ BYTE bit, _In_ bool set) const noexcept
+    {
+        return set ? (packed | (static_cast<ULONG64>(bit) << SSID_SHIFT))
+                   : (packed & ~(static_cast<ULONG64>(bit) << SSID_SHIFT));
+    }
+
+    /** @returns the SSID byte for the specified SSID, with the reserved bits set */
+    NON_PAGEABLE_FUNCTION
+    static constexpr BYTE makeSsidByte(_In_ BYTE ssid) noexcept
+    {
+        return static_cast<BYTE>(RESERVED_BITS | ((ssid << 1) & SSID_MASK));
+    }
+
+    /**
+     * Packs the characters of a callsign from the specified position onwards, padding with spaces
+     * @param callsign the null-terminated callsign
+     * @param index the position of the first character to pack
+     * @param ended true if the terminator has already been passed
+     */
+    NON_PAGEABLE_FUNCTION
+    static constexpr ULONG64 packCallsign(_In_z_ const char* callsign, _In_ ULONG index, _In_ bool ended) noexcept
+    {
+        return (index == CALLSIGN_LENGTH) ? 0 :
+            (static_cast<ULONG64>(static_cast<BYTE>((ended || callsign[index] == '\0') ? ' ' : callsign[index]) << 1) << (8 * index)) |
+            packCallsign(callsign, index + 1, ended || callsign[index] == '\0');
+    }
+};
+
+/**
+ * The address field at the start of every AX.25 frame: destination, source, and up to eight repeaters
+ * (the digipeater path), the last of which has its extension bit set.
+ */
+class AX25AddressField
+{
+public:
+    static constexpr ULONG MAX_REPEATERS = 8;                                                   //<! Longest digipeater path
+    static constexpr ULONG MIN_LENGTH = 2 * AX25Address::WIRE_LENGTH;                           //<! Field with no repeaters
+    static constexpr ULONG MAX_LENGTH = (2 + MAX_REPEATERS) * AX25Address::WIRE_LENGTH;         //<! Field with every repeater
+
+    AX25Address Destination;                    //<! Station the frame is addressed to; the C bit is its command bit
+    AX25Address Source;                         //<! Station which sent the frame; the C bit is its response bit
+    AX25Address Repeaters[MAX_REPEATERS];       //<! Digipeater path, in order; the H bit marks those already passed
+    ULONG RepeaterCount;                        //<! Number of entries of Repeaters in use
+
+    /**
+     * Creates an empty field
+     */
+    NON_PAGEABLE_FUNCTION
+    inline AX25AddressField() noexcept
+        :RepeaterCount(0)
+    {
+    }
+
+    /**
+     * Decodes the address field at the start of a frame. Rather than stepping through the field one
+     * address at a time, the extension bits of every address position are gathered into a mask, whose
+     * lowest set bit gives the length of the field directly.
+     * @param frame the frame, starting with the address field
+     * @param length the number of bytes in frame
+     * @returns the length of the address field in bytes, or 0 if the frame does not start with a valid one
+     */
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    inline ULONG Parse(_In_reads_bytes_(length) const BYTE* frame, _In_ ULONG length) noexcept
+    {
+        const ULONG positions = ((length < MAX_LENGTH) ? length : MAX_LENGTH) / AX25Address::WIRE_LENGTH;
+        ULONG extensionBits = 0;
+        for (ULONG i = 0; i < positions; i++)
+        {
+            extensionBits |= static_cast<ULONG>(frame[i * AX25Address::WIRE_LENGTH + AX25Address::WIRE_LENGTH - 1] & AX25Address::EXTENSION_BIT) << i;
+        }
+
+        // The destination can never be the last address
+        ULONG last;
+        if (!_BitScanForward(&last, extensionBits) || last == 0)
+        {
+            return 0;
+        }
+
+        Destination = AX25Address::FromWire(frame);
+        Source = AX25Address::FromWire(frame + AX25Address::WIRE_LENGTH);
+        RepeaterCount = last - 1;
+        for (ULONG i = 0; i < RepeaterCount; i++)
+        {
+            Repeaters[i] = AX25Address::FromWire(frame + (2 + i) * AX25Address::WIRE_LENGTH);
+        }
+        return (last + 1) * AX25Address::WIRE_LENGTH;
+    }
+
+    /** @returns the length of this field when encoded, in bytes */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetLength() const noexcept { return (2 + RepeaterCount) * AX25Address::WIRE_LENGTH; }
+
+    /**
+     * Encodes this field, setting the extension bit on the last address and clearing it on the others
+     * @param frame receives the encoded field
+     * @param size the size of frame, in bytes
+     * @returns the number of bytes written, which is GetLength(), or 0 if frame is too small
+     */
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    inline ULONG Write(_Out_writes_bytes_(size) BYTE* frame, _In_ ULONG size) const noexcept
+    {
+        const ULONG length = GetLength();
+        if (RepeaterCount > MAX_REPEATERS || length > size)
+        {
+            return 0;
+        }
+
+        Destination.WithLast(false).ToWire(frame);
+        Source.WithLast(RepeaterCount == 0).ToWire(frame + AX25Address::WIRE_LENGTH);
+        for (ULONG i = 0; i < RepeaterCount; i++)
+        {
+            Repeaters[i].WithLast(i + 1 == RepeaterCount).ToWire(frame + (2 + i) * AX25Address::WIRE_LENGTH);
+        }
+        return length;
+    }
+
+    /**
+     * Finds the repeater which should handle the frame next: the first one whose H bit is not yet set
+     * @returns the index of that repeater, or RepeaterCount if the frame has passed every repeater
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetNextRepeater() const noexcept
+    {
+        ULONG pending = 0;
+        for (ULONG i = 0; i < RepeaterCount; i++)
+        {
+            pending |= static_cast<ULONG>(!Repeaters[i].GetControlBit()) << i;
+        }
+
+        ULONG next;
+        return _BitScanForward(&next, pending) ? next : RepeaterCount;
+    }
+};
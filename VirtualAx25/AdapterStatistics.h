@@ -0,0 +1,297 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AdapterStatistics.h
+ * Definition of the AdapterStatistics class, which keeps the frame and byte counters reported through
+ * OID_GEN_STATISTICS in one block per processor
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "MulticastFilter.h"
+
+/**
+ * The interface statistics of an adapter: frames and bytes sent and received, split into directed, multicast
+ * and broadcast traffic, plus errors and discards.
+ *
+ * Every processor has its own block of counters, padded out to whole cache lines. The send and receive paths
+ * run at DISPATCH_LEVEL, where nothing else on the same processor can interrupt them to update the same block,
+ * so each update is a plain increment of a line no other processor writes: there is no interlocked operation
+ * and no cache line bouncing between processors. The blocks are only summed when the statistics are queried,
+ * which happens rarely.
+ *
+ * A query can run while the counters are being updated, so the totals may be a frame or two behind. On 32-bit
+ * processors a counter can also be read halfway through being incremented.
+ */
+class AdapterStatistics
+{
+public:
+    /** Counters for one direction of traffic */
+    struct DirectionCounters
+    {
+        ULONG64 directedFrames;     //<! Frames to an individual address
+        ULONG64 directedBytes;      //<! Bytes, including the Ethernet header, in directedFrames
+        ULONG64 multicastFrames;    //<! Frames to a multicast group
+        ULONG64 multicastBytes;     //<! Bytes, including the Ethernet header, in multicastFrames
+        ULONG64 broadcastFrames;    //<! Frames to the broadcast address
+        ULONG64 broadcastBytes;     //<! Bytes, including the Ethernet header, in broadcastFrames
+        ULONG64 errors;             //<! Frames which failed because they were malformed or could not be sent
+        ULONG64 discards;           //<! Frames which were dropped for lack of resources or because the adapter paused
+
+        /** @returns the number of frames sent or received successfully */
+        NON_PAGEABLE_FUNCTION
+        inline ULONG64 GetFrames() const noexcept { return directedFrames + multicastFrames + broadcastFrames; }
+    };
+
+    /** Counters for both directions of traffic */
+    struct Counters
+    {
+        DirectionCounters received;     //<! Frames received from the radio and indicated to NDIS
+        DirectionCounters transmitted;  //<! Frames sent by NDIS to the radio
+    };
+
+    /**
+     * Initializes an empty set of statistics. Nothing may be counted until Allocate() is called.
+     */
+    NON_PAGEABLE_FUNCTION
+    inline AdapterStatistics() noexcept
+        :ndisHandle(nullptr)
+        ,allocation(nullptr)
+        ,processors(nullptr)
+        ,processorCount(0)
+        ,sharedTransmitDiscards(0)
+    {
+    }
+
+    /**
+     * Allocates a zeroed block of counters for every processor that can ever be present in the system
+     * @param handle the NDIS handle with which to allocate the blocks
+     * @returns NDIS_STATUS_SUCCESS if the blocks were allocated, or NDIS_STATUS_RESOURCES otherwise
+     */
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    inline NDIS_STATUS Allocate(_In_ NDIS_HANDLE handle) noexcept
+    {
+        ASSERT(allocation == nullptr);
+        const ULONG count = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+        if (count == 0)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        // Pool memory is only guaranteed to be aligned to 16 bytes, so leave room to align the blocks by hand
+        const ULONG64 size = static_cast<ULONG64>(count) * sizeof(ProcessorCounters) + CACHE_LINE_SIZE - 1;
+        if (size > MAXUINT)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        allocation = NdisAllocateMemoryWithTagPriority(handle, static_cast<UINT>(size), STATISTICS_TAG, NormalPoolPriority);
+        if (allocation == nullptr)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        RtlZeroMemory(allocation, static_cast<size_t>(size));
+        ndisHandle = handle;
+        processors = reinterpret_cast<ProcessorCounters*>(
+            (reinterpret_cast<ULONG_PTR>(allocation) + CACHE_LINE_SIZE - 1) & ~static_cast<ULONG_PTR>(CACHE_LINE_SIZE - 1));
+        processorCount = count;
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    /**
+     * Releases the counter blocks. Nothing may be counted afterwards.
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void Free() noexcept
+    {
+        if (allocation != nullptr)
+        {
+            NdisFreeMemoryWithTagPriority(ndisHandle, allocation, STATISTICS_TAG);
+            allocation = nullptr;
+            processors = nullptr;
+            processorCount = 0;
+        }
+    }
+
+    /**
+     * Counts a frame received from the radio and indicated to NDIS
+     * @param destination the destination address from the frame's Ethernet header
+     * @param bytes the length of the frame, including the Ethernet header
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountReceived(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination, _In_ ULONG bytes) noexcept
+    {
+        countFrame(current().received, destination, bytes);
+    }
+
+    /**
+     * Counts a frame sent to the radio
+     * @param destination the destination address from the frame's Ethernet header
+     * @param bytes the length of the frame, including the Ethernet header
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountTransmitted(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination, _In_ ULONG bytes) noexcept
+    {
+        countFrame(current().transmitted, destination, bytes);
+    }
+
+    /** Counts a received frame which was malformed */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountReceiveError() noexcept { current().received.errors++; }
+
+    /**
+     * Counts received frames which were dropped
+     * @param frames the number of frames dropped
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountReceiveDiscards(_In_ ULONG frames) noexcept { current().received.discards += frames; }
+
+    /** Counts a frame which could not be sent */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountTransmitError() noexcept { current().transmitted.errors++; }
+
+    /**
+     * Counts frames which were failed without being sent
+     * @param frames the number of frames failed
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountTransmitDiscards(_In_ ULONG frames) noexcept { current().transmitted.discards += frames; }
+
+    /**
+     * Counts frames which were failed without being sent, from a caller which may be below DISPATCH_LEVEL
+     * and so could move to another processor partway through an update. This uses a single shared counter,
+     * so it is only for paths which are not taken while the adapter is passing traffic.
+     * @param frames the number of frames failed
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void CountTransmitDiscardsAtAnyIrql(_In_ ULONG frames) noexcept
+    {
+        InterlockedExchangeAdd64(&sharedTransmitDiscards, frames);
+    }
+
+    /**
+     * Sums the counters of every processor
+     * @param totals receives the totals
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void GetTotals(_Out_ Counters& totals) const noexcept
+    {
+        RtlZeroMemory(&totals, sizeof(totals));
+        for (ULONG i = 0; i < processorCount; i++)
+        {
+            addDirection(totals.received, processors[i].counters.received);
+            addDirection(totals.transmitted, processors[i].counters.transmitted);
+        }
+
+        totals.transmitted.discards += static_cast<ULONG64>(sharedTransmitDiscards);
+    }
+
+    /** The size of a cache line, to which every processor's block is padded */
+    static constexpr ULONG CACHE_LINE_SIZE = 64;
+
+private:
+    /** Tag for the counter blocks. In memory this should appear as "axST", little-endian. */
+    static constexpr ULONG STATISTICS_TAG = AX25_CREATE_TAG("axST");
+
+    /** One processor's counters, padded so that no two processors ever share a cache line */
+    struct alignas(CACHE_LINE_SIZE) ProcessorCounters
+    {
+        Counters counters;
+    };
+    static_assert(sizeof(ProcessorCounters) % CACHE_LINE_SIZE == 0, "processor blocks must fill whole cache lines");
+
+    NDIS_HANDLE ndisHandle;                 //<! Handle with which the blocks were allocated
+    void* allocation;                       //<! Memory holding the blocks, before alignment
+    ProcessorCounters* processors;          //<! One block per processor, indexed by processor number
+    ULONG processorCount;                   //<! Number of blocks in processors
+    volatile LONG64 sharedTransmitDiscards; //<! Discards counted by CountTransmitDiscardsAtAnyIrql
+
+    /** @returns the counters of the current processor */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline Counters& current() noexcept
+    {
+        const ULONG processor = KeGetCurrentProcessorNumberEx(nullptr);
+        ASSERT(processor < processorCount);
+        return processors[processor].counters;
+    }
+
+    /**
+     * Counts one frame in the class of its destination address
+     * @param counters the counters for the direction of the frame
+     * @param destination the destination address of the frame
+     * @param bytes the length of the frame
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline void countFrame(
+        _Inout_ DirectionCounters& counters,
+        _In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination,
+        _In_ ULONG bytes) noexcept
+    {
+        if (!MulticastFilter::IsGroupAddress(destination))
+        {
+            counters.directedFrames++;
+            counters.directedBytes += bytes;
+        }
+        else if (MulticastFilter::IsBroadcastAddress(destination))
+        {
+            counters.broadcastFrames++;
+            counters.broadcastBytes += bytes;
+        }
+        else
+        {
+            counters.multicastFrames++;
+            counters.multicastBytes += bytes;
+        }
+    }
+
+    /**
+     * Adds one processor's counters for a direction to a running total
+     * @param total the running total
+     * @param counters the counters to add
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline void addDirection(_Inout_ DirectionCounters& total, _In_ const DirectionCounters& counters) noexcept
+    {
+        total.directedFrames += counters.directedFrames;
+        total.directedBytes += counters.directedBytes;
+        total.multicastFrames += counters.multicastFrames;
+        total.multicastBytes += counters.multicastBytes;
+        total.broadcastFrames += counters.broadcastFrames;
+        total.broadcastBytes += counters.broadcastBytes;
+        total.errors += counters.errors;
+        total.discards += counters.discards;
+    }
+
+    // Not copyable - the statistics own their blocks
+    AdapterStatistics(const AdapterStatistics&) = delete;
+    AdapterStatistics& operator=(const AdapterStatistics&) = delete;
+};
@@ -0,0 +1,259 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AfskDemodulator.cpp
+ * Implementation of the AfskDemodulator class, a software Bell 202 demodulator with SSE2 correlators.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "AfskDemodulator.h"
+
+#if defined(_M_X64) || (defined(_M_IX86) && !defined(_KERNEL_MODE))
+// The 64-bit kernel preserves the XMM registers for drivers; the 32-bit kernel does not
+#include <emmintrin.h>
+#define AFSK_SSE2
+#endif
+
+/** Steps in a full circle of the sine table */
+static constexpr ULONG SINE_STEPS = 1024;
+
+/** Fixed point scale of the correlator coefficients. Larger would let a full scale window overflow 32 bits. */
+static constexpr ULONG COEFFICIENT_SHIFT = 10;
+
+/**
+ * Computes a sine with its Taylor series, which is accurate to better than 1e-7 over a quarter circle
+ * @param x the angle, from 0 to pi/2
+ * @returns sin(x)
+ */
+static constexpr double taylorSine(_In_ double x) noexcept
+{
+    return x * (1 - x * x / 6 * (1 - x * x / 20 * (1 - x * x / 42 * (1 - x * x / 72 * (1 - x * x / 110)))));
+}
+
+/**
+ * Computes one entry of the quarter wave sine table
+ * @param index the angle, in steps of a full circle / SINE_STEPS, from 0 to SINE_STEPS / 4
+ * @returns the sine in Q15
+ */
+static constexpr SHORT quarterSineEntry(_In_ ULONG index) noexcept
+{
+    return static_cast<SHORT>(taylorSine(index * 3.14159265358979323846 * 2 / SINE_STEPS) * 32767 + 0.5);
+}
+
+#define AFSK_ROW(row) \
+    quarterSineEntry(row + 0x0), quarterSineEntry(row + 0x1), quarterSineEntry(row + 0x2), quarterSineEntry(row + 0x3), \
+    quarterSineEntry(row + 0x4), quarterSineEntry(row + 0x5), quarterSineEntry(row + 0x6), quarterSineEntry(row + 0x7), \
+    quarterSineEntry(row + 0x8), quarterSineEntry(row + 0x9), quarterSineEntry(row + 0xA), quarterSineEntry(row + 0xB), \
+    quarterSineEntry(row + 0xC), quarterSineEntry(row + 0xD), quarterSineEntry(row + 0xE), quarterSineEntry(row + 0xF)
+
+/** A quarter of a sine wave, generated at compile time, with both ends included */
+static constexpr SHORT QUARTER_SINE[SINE_STEPS / 4 + 1] =
+{
+    AFSK_ROW(0x00), AFSK_ROW(0x10), AFSK_ROW(0x20), AFSK_ROW(0x30), AFSK_ROW(0x40), AFSK_ROW(0x50), AFSK_ROW(0x60), AFSK_ROW(0x70),
+    AFSK_ROW(0x80), AFSK_ROW(0x90), AFSK_ROW(0xA0), AFSK_ROW(0xB0), AFSK_ROW(0xC0), AFSK_ROW(0xD0), AFSK_ROW(0xE0), AFSK_ROW(0xF0),
+    quarterSineEntry(SINE_STEPS / 4)
+};
+
+#undef AFSK_ROW
+
+static_assert(QUARTER_SINE[0] == 0 && QUARTER_SINE[SINE_STEPS / 4] == 32767 && QUARTER_SINE[SINE_STEPS / 8] == 23170,
+              "the sine table must run from 0 to 1 and pass through 1/sqrt(2) at 45 degrees");
+
+/**
+ * Looks up a sine in the quarter wave table
+ * @param angle the angle, in steps of a full circle / SINE_STEPS
+ * @returns the sine in Q15
+ */
+NON_PAGEABLE_FUNCTION
+static LONG sine(_In_ ULONG angle) noexcept
+{
+    constexpr ULONG QUARTER = SINE_STEPS / 4;
+    const ULONG index = angle % QUARTER;
+    switch ((angle / QUARTER) % 4)
+    {
+    case 0: return QUARTER_SINE[index];
+    case 1: return QUARTER_SINE[QUARTER - index];
+    case 2: return -QUARTER_SINE[index];
+    default: return -QUARTER_SINE[QUARTER - index];
+    }
+}
+
+/**
+ * Initializes a new demodulator for the highest supported sample rate
+ */
+NON_PAGEABLE_FUNCTION
+AfskDemodulator::AfskDemodulator() noexcept
+    :sampleRate(0)
+{
+    const bool valid = SetSampleRate(MAX_SAMPLE_RATE);
+    ASSERT(valid);
+    UNREFERENCED_PARAMETER(valid);
+}
+
+/**
+ * Sets the sample rate of the audio to be demodulated, and resets the demodulator
+ * @param newSampleRate the number of samples per second, from MIN_SAMPLE_RATE to MAX_SAMPLE_RATE
+ * @returns true if the sample rate was set, or false if it is out of range
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool AfskDemodulator::SetSampleRate(_In_ ULONG newSampleRate) noexcept
+{
+    if (newSampleRate < MIN_SAMPLE_RATE || newSampleRate > MAX_SAMPLE_RATE)
+    {
+        return false;
+    }
+
+    sampleRate = newSampleRate;
+    const ULONG bitSamples = (sampleRate + BAUD_RATE / 2) / BAUD_RATE;
+    window = (bitSamples + 7) & ~7UL;
+    phaseStep = static_cast<ULONG>((1ULL << 32) * BAUD_RATE / sampleRate);
+
+    // The newest bitSamples samples are at the end of the window; anything older is ignored
+    RtlZeroMemory(coefficients, sizeof(coefficients));
+    const ULONG first = window - bitSamples;
+    for (ULONG i = 0; i < bitSamples; i++)
+    {
+        const ULONG markAngle = static_cast<ULONG>((2ULL * i * MARK_FREQUENCY * SINE_STEPS + sampleRate) / (2ULL * sampleRate));
+        const ULONG spaceAngle = static_cast<ULONG>((2ULL * i * SPACE_FREQUENCY * SINE_STEPS + sampleRate) / (2ULL * sampleRate));
+        coefficients[MarkCosine][first + i] = static_cast<SHORT>(sine(markAngle + SINE_STEPS / 4) >> (15 - COEFFICIENT_SHIFT));
+        coefficients[MarkSine][first + i] = static_cast<SHORT>(sine(markAngle) >> (15 - COEFFICIENT_SHIFT));
+        coefficients[SpaceCosine][first + i] = static_cast<SHORT>(sine(spaceAngle + SINE_STEPS / 4) >> (15 - COEFFICIENT_SHIFT));
+        coefficients[SpaceSine][first + i] = static_cast<SHORT>(sine(spaceAngle) >> (15 - COEFFICIENT_SHIFT));
+    }
+
+    Reset();
+    return true;
+}
+
+/**
+ * Forgets all received audio and the recovered clock, as if the channel had just been opened
+ */
+NON_PAGEABLE_FUNCTION
+void AfskDemodulator::Reset() noexcept
+{
+    RtlZeroMemory(history, sizeof(history));
+    position = 0;
+    phase = 0;
+    level = 0;
+    pendingBits = 0;
+    pendingCount = 0;
+}
+
+/**
+ * Demodulates a block of audio. Bits are held over until a whole byte has been recovered, so the output
+ * of successive calls forms one continuous bit stream.
+ * @param samples the audio, as signed 16-bit mono samples at the sample rate set by SetSampleRate()
+ * @param sampleCount the number of samples
+ * @param output receives the line level of each recovered bit, least significant bit first
+ * @param outputLength the number of bytes available in output, which should be at least
+ * GetMaximumOutputLength(sampleCount); any bits beyond that are lost
+ * @returns the number of bytes written to output
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+ULONG AfskDemodulator::Demodulate(
+    _In_reads_(sampleCount) const SHORT* samples,
+    _In_ ULONG sampleCount,
+    _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+    _In_ ULONG outputLength) noexcept
+{
+    ULONG written = 0;
+    for (ULONG i = 0; i < sampleCount; i++)
+    {
+        history[position] = samples[i];
+        history[position + window] = samples[i];
+        position = (position + 1 == window) ? 0 : position + 1;
+        const ULONG sampleLevel = discriminate(history + position) > 0 ? 1 : 0;
+
+        // Sample the line once per bit, when the clock phase wraps
+        const LONG previousPhase = phase;
+        phase = static_cast<LONG>(static_cast<ULONG>(phase) + phaseStep);
+        if (previousPhase >= 0 && phase < 0)
+        {
+            pendingBits |= sampleLevel << pendingCount;
+            if (++pendingCount == 8)
+            {
+                if (written < outputLength)
+                {
+                    output[written++] = static_cast<BYTE>(pendingBits);
+                }
+                pendingBits = 0;
+                pendingCount = 0;
+            }
+        }
+
+        // The level changed somewhere since the previous sample; taking it as halfway, the phase there should
+        // have been 0. Measuring the error at this sample instead would pull the clock half a sample late,
+        // which at the lowest sample rates is enough to lose bits from a fast sender.
+        if (sampleLevel != level)
+        {
+            level = sampleLevel;
+            const LONG error = phase - static_cast<LONG>(phaseStep / 2);
+            phase -= error / 4;
+        }
+    }
+
+    return written;
+}
+
+/**
+ * Compares the energy of the two tones over the latest bit period
+ * @param samples the latest window of samples, oldest first
+ * @returns a positive value if the mark tone is stronger, or zero or negative if the space tone is
+ */
+NON_PAGEABLE_FUNCTION
+LONG64 AfskDemodulator::discriminate(_In_reads_(window) const SHORT* samples) const noexcept
+{
+    LONG sums[REFERENCE_COUNT];
+#ifdef AFSK_SSE2
+    __m128i markCosine = _mm_setzero_si128();
+    __m128i markSine = _mm_setzero_si128();
+    __m128i spaceCosine = _mm_setzero_si128();
+    __m128i spaceSine = _mm_setzero_si128();
+    for (ULONG i = 0; i < window; i += 8)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+        markCosine = _mm_add_epi32(markCosine, _mm_madd_epi16(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients[MarkCosine] + i))));
+        markSine = _mm_add_epi32(markSine, _mm_madd_epi16(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients[MarkSine] + i))));
+        spaceCosine = _mm_add_epi32(spaceCosine, _mm_madd_epi16(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients[SpaceCosine] + i))));
+        spaceSine = _mm_add_epi32(spaceSine, _mm_madd_epi16(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(coefficients[SpaceSine] + i))));
+    }
+
+    // Transpose and add so that each lane holds the total of one accumulator
+    const __m128i mark = _mm_add_epi32(_mm_unpacklo_epi32(markCosine, markSine), _mm_unpackhi_epi32(markCosine, markSine));
+    const __m128i space = _mm_add_epi32(_mm_unpacklo_epi32(spaceCosine, spaceSine), _mm_unpackhi_epi32(spaceCosine, spaceSine));
+    const __m128i totals = _mm_add_epi32(_mm_unpacklo_epi64(mark, space), _mm_unpackhi_epi64(mark, space));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), totals);
+#else
+    for (ULONG reference = 0; reference < REFERENCE_COUNT; reference++)
+    {
+        LONG sum = 0;
+        for (ULONG i = 0; i < window; i++)
+        {
+            sum += static_cast<LONG>(samples[i]) * coefficients[reference][i];
+        }
+        sums[reference] = sum;
+    }
+#endif
+
+    const LONG64 markEnergy = static_cast<LONG64>(sums[MarkCosine]) * sums[MarkCosine] + static_cast<LONG64>(sums[MarkSine]) * sums[MarkSine];
+    const LONG64 spaceEnergy = static_cast<LONG64>(sums[SpaceCosine]) * sums[SpaceCosine] + static_cast<LONG64>(sums[SpaceSine]) * sums[SpaceSine];
+    return markEnergy - spaceEnergy;
+}
@@ -0,0 +1,119 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AfskDemodulator.h
+ * Definition of the AfskDemodulator class, a software Bell 202 (1200 baud AFSK) demodulator which turns
+ * PCM audio into the line levels read by HdlcDecoder.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * Demodulates Bell 202 AFSK, the 1200 baud modulation used on VHF AX.25 channels, so that the adapter can
+ * work from a soundcard instead of a TNC.
+ *
+ * Every sample is compared against one bit period of reference tones: the window of recent samples is
+ * correlated with a cosine and a sine at the mark (1200 Hz) and space (2200 Hz) frequencies, and whichever
+ * tone has more energy sets the line level. The four correlations use 16-bit fixed point coefficients, so
+ * SSE2 computes them eight samples at a time with PMADDWD. A phase-locked loop runs at the baud rate and
+ * samples the line level once per bit; each change of level pulls the loop's phase towards the middle
+ * between two samples, so the receiver follows the sender's clock.
+ *
+ * The output is one line level per bit (1 for mark), packed least significant bit first, which is the
+ * NRZI-coded input HdlcDecoder expects. A demodulator holds the state of one channel and is not thread safe.
+ */
+class AfskDemodulator
+{
+public:
+    static constexpr ULONG BAUD_RATE = 1200;            //<! Bits per second
+    static constexpr ULONG MARK_FREQUENCY = 1200;       //<! Tone for a 1 on the line, in Hz
+    static constexpr ULONG SPACE_FREQUENCY = 2200;      //<! Tone for a 0 on the line, in Hz
+    static constexpr ULONG MIN_SAMPLE_RATE = 8000;      //<! Lowest sample rate accepted
+    static constexpr ULONG MAX_SAMPLE_RATE = 48000;     //<! Highest sample rate accepted
+
+    NON_PAGEABLE_FUNCTION
+    AfskDemodulator() noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool SetSampleRate(_In_ ULONG newSampleRate) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    /** @returns the sample rate set by SetSampleRate() */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetSampleRate() const noexcept { return sampleRate; }
+
+    /**
+     * Computes the output space needed by Demodulate(). Each change of level can move the next bit at most
+     * half a bit period closer, so no more than two bits come out per bit period of input.
+     * @param sampleCount the number of samples to be demodulated
+     * @returns the most bytes Demodulate() can write for that many samples
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetMaximumOutputLength(_In_ ULONG sampleCount) const noexcept
+    {
+        return static_cast<ULONG>((2ULL * sampleCount * BAUD_RATE / sampleRate + 2 + 7) / 8);
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    ULONG Demodulate(
+        _In_reads_(sampleCount) const SHORT* samples,
+        _In_ ULONG sampleCount,
+        _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+        _In_ ULONG outputLength) noexcept;
+
+private:
+    /** Longest correlation window, rounded up to a whole number of vectors */
+    static constexpr ULONG MAX_WINDOW = (MAX_SAMPLE_RATE / BAUD_RATE + 7) & ~7UL;
+
+    /** The reference tones, in the order the correlations are computed */
+    enum Reference
+    {
+        MarkCosine,
+        MarkSine,
+        SpaceCosine,
+        SpaceSine,
+        REFERENCE_COUNT
+    };
+
+    ULONG sampleRate;           //<! Samples per second
+    ULONG window;               //<! Correlation window, in samples, rounded up to a multiple of 8
+    ULONG position;             //<! Where the next sample goes in history
+    ULONG phaseStep;            //<! Clock phase advance per sample; 2^32 is one bit period
+    LONG phase;                 //<! Clock phase; a bit is sampled when this wraps from positive to negative
+    ULONG level;                //<! Line level from the most recent sample
+    ULONG pendingBits;          //<! Sampled bits not yet written out, least significant first
+    ULONG pendingCount;         //<! Number of bits in pendingBits
+
+    /**
+     * The most recent samples, each stored twice (at position and position + window) so that the latest
+     * window is always contiguous
+     */
+    SHORT history[2 * MAX_WINDOW];
+
+    /** Reference tones for one window. Coefficients for samples older than one bit period are zero. */
+    SHORT coefficients[REFERENCE_COUNT][MAX_WINDOW];
+
+    NON_PAGEABLE_FUNCTION
+    LONG64 discriminate(_In_reads_(window) const SHORT* samples) const noexcept;
+};
@@ -0,0 +1,154 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ChannelAccess.cpp
+ * Implementation of the ChannelAccess class.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "ChannelAccess.h"
+
+const ChannelAccessParameters ChannelAccess::DEFAULT_PARAMETERS = {
+    63,         // P
+    100,        // SLOTTIME
+    300,        // TXDELAY
+    20,         // TXTAIL
+    1200        // Bell 202 AFSK
+};
+
+/**
+ * Initializes the scheduler with the channel clear, the transmitter unkeyed and DEFAULT_PARAMETERS
+ * @param seed the seed of the random bytes drawn. Stations sharing a channel must not share a seed, or they
+ * would draw the same bytes and collide every time.
+ */
+NON_PAGEABLE_FUNCTION
+ChannelAccess::ChannelAccess(_In_ ULONG seed) noexcept
+    :parameters(DEFAULT_PARAMETERS)
+    ,dataEnd(0)
+    ,keyedUntil(0)
+    ,nextAttempt(0)
+    ,randomState((seed != 0) ? seed : 1)    // xorshift never leaves 0
+{
+    RtlZeroMemory(&counters, sizeof(counters));
+}
+
+/**
+ * Replaces the parameters. A burst in progress keeps the TXTAIL it started with.
+ * @param newParameters the parameters
+ * @returns true if the parameters were changed, or false if any is out of range
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool ChannelAccess::SetParameters(_In_ const ChannelAccessParameters& newParameters) noexcept
+{
+    if (newParameters.Persistence > MAX_PERSISTENCE ||
+        newParameters.SlotMilliseconds > MAX_MILLISECONDS ||
+        newParameters.TxDelayMilliseconds > MAX_MILLISECONDS ||
+        newParameters.TxTailMilliseconds > MAX_MILLISECONDS ||
+        newParameters.BitsPerSecond == 0)
+    {
+        return false;
+    }
+
+    parameters = newParameters;
+    return true;
+}
+
+/**
+ * Decides whether frames may be sent now. Unless the transmitter is still keyed, a successful call keys it,
+ * starting a burst which lasts until TXTAIL after the last frame given to FrameSent().
+ * @param now the current time, in milliseconds
+ * @param carrierDetected true if the radio hears another station transmitting
+ * @returns true if frames may be sent, or false if the caller must try again at GetNextAttempt()
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool ChannelAccess::TryStartBurst(_In_ ULONG64 now, _In_ bool carrierDetected) noexcept
+{
+    if (now < keyedUntil)
+    {
+        return true;
+    }
+
+    if (carrierDetected)
+    {
+        if (nextAttempt != MAXULONG64)
+        {
+            counters.Deferrals++;
+            nextAttempt = MAXULONG64;
+        }
+        return false;
+    }
+
+    // The channel has just cleared, so the draw is made straight away
+    if (nextAttempt == MAXULONG64)
+    {
+        nextAttempt = now;
+    }
+
+    if (now < nextAttempt)
+    {
+        return false;
+    }
+
+    if (nextRandom() > parameters.Persistence)
+    {
+        counters.Backoffs++;
+        nextAttempt = now + parameters.SlotMilliseconds;
+        return false;
+    }
+
+    counters.Bursts++;
+    dataEnd = now + parameters.TxDelayMilliseconds;
+    keyedUntil = dataEnd + parameters.TxTailMilliseconds;
+    nextAttempt = now;
+    return true;
+}
+
+/**
+ * Records a frame sent in the current burst, which holds the transmitter keyed for as long as it takes on the
+ * air and TXTAIL after that
+ * @param now the current time, in milliseconds
+ * @param length the number of bytes in the frame, without flags or FCS
+ */
+NON_PAGEABLE_FUNCTION
+void ChannelAccess::FrameSent(_In_ ULONG64 now, _In_ ULONG length) noexcept
+{
+    const ULONG64 bits = static_cast<ULONG64>(length + FRAME_OVERHEAD_BYTES) * 8;
+    const ULONG64 airtime = (bits * 1000 + parameters.BitsPerSecond - 1) / parameters.BitsPerSecond;
+
+    // A frame sent during TXTAIL starts as soon as it is sent, rather than after the frames before it
+    dataEnd = ((dataEnd > now) ? dataEnd : now) + airtime;
+    keyedUntil = dataEnd + parameters.TxTailMilliseconds;
+    counters.Frames++;
+}
+
+/**
+ * Draws the next random byte, from a 32-bit xorshift generator. Its low bits are weak, so the byte is taken from
+ * the top.
+ * @returns a random byte
+ */
+NON_PAGEABLE_FUNCTION
+BYTE ChannelAccess::nextRandom() noexcept
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return static_cast<BYTE>(randomState >> 24);
+}
@@ -0,0 +1,122 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ChannelAccess.h
+ * Definition of the ChannelAccess class, which decides when the adapter may key up the transmitter on a shared
+ * half-duplex channel using p-persistent CSMA
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * The parameters of channel access, named as in the KISS protocol
+ */
+struct ChannelAccessParameters
+{
+    ULONG Persistence;              //<! P: a clear channel is taken if a random byte is no more than this
+    ULONG SlotMilliseconds;         //<! SLOTTIME: time to wait after the random byte came out above P
+    ULONG TxDelayMilliseconds;      //<! TXDELAY: time from keying the transmitter to the start of the first frame
+    ULONG TxTailMilliseconds;       //<! TXTAIL: time the transmitter is held keyed after the end of the last frame
+    ULONG BitsPerSecond;            //<! Rate at which frames are sent on the air
+};
+
+/**
+ * p-persistent CSMA, as a KISS TNC does it. When there is something to send and no carrier is detected, a
+ * random byte is drawn: if it is no more than Persistence, the transmitter is keyed; otherwise nothing is
+ * tried again for SlotMilliseconds. While a carrier is detected nothing is drawn at all, and the first attempt
+ * after it drops draws straight away. Stations which all heard the same transmission end therefore spread
+ * their own over several slots, rather than all keying up at once and colliding.
+ *
+ * A burst starts with TxDelayMilliseconds of keyed carrier and ends TxTailMilliseconds after its last frame.
+ * Frames sent before then join the burst without another draw or delay, so the whole transmit queue goes out
+ * in one transmission. A half-duplex radio hears nothing while it is keyed, so the carrier is ignored
+ * during a burst.
+ *
+ * Time is given to every call in milliseconds from any fixed origin, and the random bytes come from a
+ * generator seeded by the owner, which keeps the scheduler deterministic under test. A ChannelAccess is not
+ * thread safe.
+ */
+class ChannelAccess
+{
+public:
+    static constexpr ULONG MAX_PERSISTENCE = MAXUCHAR;      //<! Persistence which takes every clear slot
+    static constexpr ULONG MAX_MILLISECONDS = 2550;         //<! Longest slot, delay or tail, as KISS can set
+    static constexpr ULONG FRAME_OVERHEAD_BYTES = 3;        //<! Opening flag and FCS sent on the air with each frame
+
+    /** Parameters used until SetParameters() is called: P = 63, SLOTTIME 100ms, TXDELAY 300ms, TXTAIL 20ms at 1200 bps */
+    static const ChannelAccessParameters DEFAULT_PARAMETERS;
+
+    /** Counts of what happened to the attempts to transmit */
+    struct Counters
+    {
+        ULONG64 Bursts;     //<! Times the transmitter was keyed
+        ULONG64 Frames;     //<! Frames sent, in bursts
+        ULONG64 Deferrals;  //<! Times a burst was held back until a carrier dropped
+        ULONG64 Backoffs;   //<! Times a burst was held back for a slot by the persistence draw
+    };
+
+    NON_PAGEABLE_FUNCTION
+    explicit ChannelAccess(_In_ ULONG seed) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool SetParameters(_In_ const ChannelAccessParameters& newParameters) noexcept;
+
+    /** @returns the parameters in use */
+    NON_PAGEABLE_FUNCTION
+    inline const ChannelAccessParameters& GetParameters() const noexcept { return parameters; }
+
+    /** @returns the counts of what happened to the attempts to transmit */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool TryStartBurst(_In_ ULONG64 now, _In_ bool carrierDetected) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void FrameSent(_In_ ULONG64 now, _In_ ULONG length) noexcept;
+
+    /**
+     * @returns the time from which TryStartBurst() may succeed, or MAXULONG64 if it is waiting for a carrier to
+     * drop
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetNextAttempt() const noexcept { return nextAttempt; }
+
+    /** @returns the time at which the transmitter is unkeyed, which is in the past if it is not keyed */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetKeyedUntil() const noexcept { return keyedUntil; }
+
+    /** @returns the time at which the last frame sent is off the air, which is in the past if it already is */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetDataEnd() const noexcept { return dataEnd; }
+
+private:
+    NON_PAGEABLE_FUNCTION
+    BYTE nextRandom() noexcept;
+
+    ChannelAccessParameters parameters;     //<! The parameters in use
+    ULONG64 dataEnd;                        //<! When the last frame of the current or last burst ends
+    ULONG64 keyedUntil;                     //<! When the current or last burst ends, TXTAIL after dataEnd
+    ULONG64 nextAttempt;                    //<! See GetNextAttempt()
+    ULONG randomState;                      //<! State of the xorshift generator which draws the random bytes
+    Counters counters;                      //<! Counts of what happened to the attempts to transmit
+};
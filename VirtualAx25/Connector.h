@@ -0,0 +1,74 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Connector.h
+ * Definition of the Connector interface, which represents the path between an AX25Adapter and
+ * the radio (for example, a KISS or AGWPE port).
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "FrameGatherList.h"
+
+/**
+ * Represents the radio side of an AX25Adapter. The adapter hands fully-formed AX.25 frames to
+ * its connector for transmission. A connector is bound to at most one adapter at a time, and
+ * the adapter guarantees that calls into the connector are serialized: only one transmit
+ * operation is ever in progress for a given connector. A connector which can tell when another
+ * station is transmitting reports its carrier detect through AX25Adapter::IndicateCarrier(), so
+ * that the adapter can hold frames back while the channel is busy.
+ */
+class Connector
+{
+public:
+    /**
+     * Transmits a single AX.25 frame. Frames are described as a list of fragments which together make
+     * up the frame; the fragments are only valid for the duration of the call, so the connector must copy
+     * them if it needs the data afterwards.
+     * @param frame the fragments of the frame to transmit, in order. If RequiresContiguousFrames()
+     * returns true, this list contains exactly one fragment.
+     * @returns NDIS_STATUS_SUCCESS if the frame was accepted for transmission, or an error code otherwise
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    virtual NDIS_STATUS TransmitFrame(_In_ const FrameGatherList& frame) noexcept = 0;
+
+    /**
+     * Indicates whether this connector can only accept frames in a single contiguous buffer. If so, the
+     * adapter copies each frame into its own buffer before calling TransmitFrame.
+     * @returns true if every frame must be made up of exactly one fragment
+     */
+    NON_PAGEABLE_FUNCTION
+    virtual bool RequiresContiguousFrames() const noexcept = 0;
+
+    /**
+     * Indicates whether frames on this connector carry an AX.25 frame check sequence. A KISS TNC adds the FCS
+     * when it sends and strips it after checking it when it receives, so it returns false; a connector which
+     * modulates frames itself returns true, and the adapter then appends the FCS to every frame it transmits
+     * and checks and removes it from every frame it receives.
+     * @returns true if the adapter must generate and validate the FCS
+     */
+    NON_PAGEABLE_FUNCTION
+    virtual bool UsesFrameCheckSequence() const noexcept = 0;
+
+protected:
+    // Connectors are never destroyed through this interface
+    ~Connector() = default;
+};
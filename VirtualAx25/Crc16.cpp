@@ -0,0 +1,283 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Crc16.cpp
+ * Implementation of the Crc16 class, including the slice-by-8 table and PCLMULQDQ folding versions of
+ * the CRC update.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "Crc16.h"
+
+#if defined(_M_X64) || (defined(_M_IX86) && !defined(_KERNEL_MODE))
+// The 64-bit kernel preserves the XMM registers for drivers; the 32-bit kernel does not, and a save
+// would cost more than folding saves on a frame of AX.25 size
+#include <intrin.h>
+#include <immintrin.h>
+#define CRC16_CARRYLESS_MULTIPLY
+#endif
+
+/** The generator polynomial, bit-reversed to match the least significant bit first register */
+static constexpr USHORT REFLECTED_POLYNOMIAL = 0x8408;
+
+/** The generator polynomial without its x^16 term, most significant bit first, for the folding constants */
+static constexpr ULONG POLYNOMIAL = 0x1021;
+
+/**
+ * Runs bits through the CRC register one at a time
+ * @param crc the register value
+ * @param bits the number of zero bits to shift in
+ * @returns the register value afterwards
+ */
+static constexpr USHORT shiftBits(_In_ USHORT crc, _In_ int bits) noexcept
+{
+    return bits == 0 ? crc : shiftBits(static_cast<USHORT>((crc & 1) ? (crc >> 1) ^ REFLECTED_POLYNOMIAL : crc >> 1), bits - 1);
+}
+
+/**
+ * Computes one entry of the slice-by-8 tables. Table 0 holds the register value produced by each byte value
+ * from a zero register; table n holds the same followed by n zero bytes.
+ * @param slice the table
+ * @param index the byte value
+ * @returns the entry
+ */
+static constexpr USHORT tableEntry(_In_ int slice, _In_ int index) noexcept
+{
+    return slice == 0 ? shiftBits(static_cast<USHORT>(index), 8)
+                      : static_cast<USHORT>((tableEntry(slice - 1, index) >> 8) ^ shiftBits(tableEntry(slice - 1, index) & 0xFF, 8));
+}
+
+#define CRC16_ROW(slice, row) \
+    tableEntry(slice, row + 0x0), tableEntry(slice, row + 0x1), tableEntry(slice, row + 0x2), tableEntry(slice, row + 0x3), \
+    tableEntry(slice, row + 0x4), tableEntry(slice, row + 0x5), tableEntry(slice, row + 0x6), tableEntry(slice, row + 0x7), \
+    tableEntry(slice, row + 0x8), tableEntry(slice, row + 0x9), tableEntry(slice, row + 0xA), tableEntry(slice, row + 0xB), \
+    tableEntry(slice, row + 0xC), tableEntry(slice, row + 0xD), tableEntry(slice, row + 0xE), tableEntry(slice, row + 0xF)
+
+#define CRC16_SLICE(slice) { \
+    CRC16_ROW(slice, 0x00), CRC16_ROW(slice, 0x10), CRC16_ROW(slice, 0x20), CRC16_ROW(slice, 0x30), \
+    CRC16_ROW(slice, 0x40), CRC16_ROW(slice, 0x50), CRC16_ROW(slice, 0x60), CRC16_ROW(slice, 0x70), \
+    CRC16_ROW(slice, 0x80), CRC16_ROW(slice, 0x90), CRC16_ROW(slice, 0xA0), CRC16_ROW(slice, 0xB0), \
+    CRC16_ROW(slice, 0xC0), CRC16_ROW(slice, 0xD0), CRC16_ROW(slice, 0xE0), CRC16_ROW(slice, 0xF0) }
+
+/** The slice-by-8 tables, generated at compile time */
+static constexpr USHORT TABLES[8][256] =
+{
+    CRC16_SLICE(0), CRC16_SLICE(1), CRC16_SLICE(2), CRC16_SLICE(3),
+    CRC16_SLICE(4), CRC16_SLICE(5), CRC16_SLICE(6), CRC16_SLICE(7),
+};
+
+#undef CRC16_SLICE
+#undef CRC16_ROW
+
+static_assert(TABLES[0][0x01] == 0x1189 && TABLES[0][0x80] == 0x8408 && TABLES[0][0xFF] == 0x0F78,
+              "the first table must match the published CRC-16-CCITT (reflected) table");
+
+/**
+ * Runs bytes through the CRC register eight at a time using the slice-by-8 tables
+ * @param crc the register value before data
+ * @param data the bytes to add
+ * @param length the number of bytes in data
+ * @returns the register value after data
+ */
+NON_PAGEABLE_FUNCTION
+static USHORT updateWithTables(_In_ USHORT crc, _In_reads_bytes_(length) const BYTE* data, _In_ ULONG length)
+{
+    ULONG offset = 0;
+    for (; length - offset >= sizeof(ULONG64); offset += sizeof(ULONG64))
+    {
+        // The register overlaps the first two bytes, and each byte then needs the tables for the bytes after it
+        ULONG64 block;
+        RtlCopyMemory(&block, data + offset, sizeof(block));
+        block ^= crc;
+        crc = TABLES[7][block & 0xFF] ^ TABLES[6][(block >> 8) & 0xFF] ^
+              TABLES[5][(block >> 16) & 0xFF] ^ TABLES[4][(block >> 24) & 0xFF] ^
+              TABLES[3][(block >> 32) & 0xFF] ^ TABLES[2][(block >> 40) & 0xFF] ^
+              TABLES[1][(block >> 48) & 0xFF] ^ TABLES[0][block >> 56];
+    }
+
+    for (; offset < length; offset++)
+    {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ data[offset]) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CRC16_CARRYLESS_MULTIPLY
+/**
+ * Multiplies a polynomial by x, modulo the generator polynomial
+ * @param value a polynomial of degree less than 16, most significant bit first
+ * @returns value * x mod P
+ */
+static constexpr ULONG multiplyByX(_In_ ULONG value) noexcept
+{
+    return ((value << 1) ^ ((value & 0x8000) ? POLYNOMIAL : 0)) & 0xFFFF;
+}
+
+/**
+ * Multiplies two polynomials modulo the generator polynomial
+ * @param a a polynomial of degree less than 16, most significant bit first
+ * @param b a polynomial of degree less than 16, most significant bit first
+ * @returns a * b mod P
+ */
+static constexpr ULONG multiplyModulo(_In_ ULONG a, _In_ ULONG b) noexcept
+{
+    return b == 0 ? 0 : (multiplyModulo(multiplyByX(a), b >> 1) ^ ((b & 1) ? a : 0));
+}
+
+/**
+ * Computes a power of x modulo the generator polynomial, by repeated squaring
+ * @param exponent the power
+ * @returns x^exponent mod P, most significant bit first
+ */
+static constexpr ULONG powerOfX(_In_ ULONG exponent) noexcept
+{
+    return exponent == 0 ? 1
+         : (exponent & 1) ? multiplyByX(powerOfX(exponent - 1))
+         : multiplyModulo(powerOfX(exponent / 2), powerOfX(exponent / 2));
+}
+
+/**
+ * Bit-reverses a polynomial of degree less than 16 into a 64-bit lane, where bit 0 holds x^63
+ * @param value the polynomial, most significant bit first
+ * @param degree the first coefficient to move
+ * @returns the reversed polynomial
+ */
+static constexpr ULONG64 reflectIntoLane(_In_ ULONG value, _In_ int degree = 0) noexcept
+{
+    return degree == 16 ? 0 : ((((value >> degree) & 1) != 0 ? (1ULL << (63 - degree)) : 0) | reflectIntoLane(value, degree + 1));
+}
+
+/**
+ * Computes the constant which moves one 64-bit lane forward through a fold. A carry-less product of two
+ * bit-reversed lanes comes out one bit short of a full 128-bit lane, which is the same as an extra factor of
+ * x, so every constant is one power of x less than the distance it covers.
+ * @param distance the number of bits the lane moves
+ * @returns the bit-reversed x^(distance - 1) mod P
+ */
+static constexpr ULONG64 foldConstant(_In_ ULONG distance) noexcept
+{
+    return reflectIntoLane(powerOfX(distance - 1));
+}
+
+/**
+ * Folds a 128-bit accumulator forward and adds the data it now lines up with. The first half of the
+ * accumulator moves by 64 more bits than the second, hence the pair of constants.
+ * @param accumulator the accumulator to move
+ * @param constants the fold constants for the first (low) and second (high) halves
+ * @param data the 16 bytes the accumulator lines up with after moving
+ * @returns the new accumulator
+ */
+NON_PAGEABLE_FUNCTION
+static inline __m128i fold(_In_ __m128i accumulator, _In_ __m128i constants, _In_ __m128i data)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(accumulator, constants, 0x00),
+                                       _mm_clmulepi64_si128(accumulator, constants, 0x11)),
+                         data);
+}
+
+/**
+ * Runs bytes through the CRC register by folding 16 byte blocks together with carry-less multiplication,
+ * four independent blocks at a time while enough data remains. What is left is 16 bytes which leave the
+ * same remainder as everything folded into them; those and any bytes after the last whole block go
+ * through the tables.
+ * @param crc the register value before data
+ * @param data the bytes to add
+ * @param length the number of bytes in data
+ * @returns the register value after data
+ */
+NON_PAGEABLE_FUNCTION
+static USHORT updateWithCarrylessMultiply(_In_ USHORT crc, _In_reads_bytes_(length) const BYTE* data, _In_ ULONG length)
+{
+    constexpr ULONG blockSize = sizeof(__m128i);
+    if (length < 2 * blockSize)
+    {
+        return updateWithTables(crc, data, length);
+    }
+
+    // The register value is the same as if it had been added to the first two bytes
+    const __m128i fold128 = _mm_set_epi64x(static_cast<LONG64>(foldConstant(128)), static_cast<LONG64>(foldConstant(192)));
+    __m128i accumulator = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), _mm_cvtsi32_si128(crc));
+    ULONG offset = blockSize;
+    if (length >= 8 * blockSize)
+    {
+        const __m128i fold512 = _mm_set_epi64x(static_cast<LONG64>(foldConstant(512)), static_cast<LONG64>(foldConstant(576)));
+        __m128i accumulator1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + blockSize));
+        __m128i accumulator2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 2 * blockSize));
+        __m128i accumulator3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 3 * blockSize));
+        for (offset = 4 * blockSize; length - offset >= 4 * blockSize; offset += 4 * blockSize)
+        {
+            accumulator = fold(accumulator, fold512, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset)));
+            accumulator1 = fold(accumulator1, fold512, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset + blockSize)));
+            accumulator2 = fold(accumulator2, fold512, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset + 2 * blockSize)));
+            accumulator3 = fold(accumulator3, fold512, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset + 3 * blockSize)));
+        }
+
+        accumulator = fold(accumulator, fold128, accumulator1);
+        accumulator = fold(accumulator, fold128, accumulator2);
+        accumulator = fold(accumulator, fold128, accumulator3);
+    }
+
+    for (; length - offset >= blockSize; offset += blockSize)
+    {
+        accumulator = fold(accumulator, fold128, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset)));
+    }
+
+    // Running the accumulator through a zero register reduces it to the register value for everything so far
+    BYTE folded[blockSize];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(folded), accumulator);
+    crc = updateWithTables(0, folded, blockSize);
+    return updateWithTables(crc, data + offset, length - offset);
+}
+#endif
+
+Crc16::UpdateFunction* Crc16::update = updateWithTables;
+Crc16::Implementation Crc16::implementation = Crc16::Table;
+
+/**
+ * Selects the routine used for every CRC computed from now on. This should be called once, before any
+ * frames are handled; until then the tables are used.
+ * @param maximum the fastest implementation which may be selected
+ * @returns the fastest implementation, no faster than maximum, which this processor supports
+ */
+PAGEABLE_FUNCTION
+Crc16::Implementation Crc16::SelectImplementation(_In_ Implementation maximum) noexcept
+{
+    Implementation supported = Table;
+#ifdef CRC16_CARRYLESS_MULTIPLY
+    int registers[4]; // EAX, EBX, ECX, EDX
+    __cpuid(registers, 1);
+    if ((registers[2] & (1 << 1)) != 0 && (registers[3] & (1 << 26)) != 0)
+    {
+        supported = CarrylessMultiply;
+    }
+#endif
+
+    implementation = (supported < maximum) ? supported : maximum;
+#ifdef CRC16_CARRYLESS_MULTIPLY
+    update = (implementation == CarrylessMultiply) ? updateWithCarrylessMultiply : updateWithTables;
+#endif
+    return implementation;
+}
+
+/** @returns the implementation selected by the last call to SelectImplementation() */
+NON_PAGEABLE_FUNCTION
+Crc16::Implementation Crc16::GetImplementation() noexcept
+{
+    return implementation;
+}
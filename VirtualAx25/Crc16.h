@@ -0,0 +1,138 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Crc16.h
+ * Definition of the Crc16 class, which computes and checks the AX.25 frame check sequence using the
+ * fastest method the processor supports.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "FrameGatherList.h"
+
+/**
+ * The AX.25 frame check sequence: CRC-16-CCITT (polynomial x^16 + x^12 + x^5 + 1) computed least significant
+ * bit first, starting from 0xFFFF and complemented at the end, as in HDLC and X.25. The FCS follows the frame
+ * least significant byte first.
+ *
+ * The portable implementation consumes eight bytes per step using eight 256-entry tables ("slice-by-8"), which
+ * are generated at compile time. On x86 and x64 processors with PCLMULQDQ, frames of more than a few dozen
+ * bytes are instead folded 64 bytes at a time with carry-less multiplication, and only the final 16 bytes go
+ * through the tables. Both give identical results, so a CRC may be started with one and finished with the
+ * other.
+ */
+class Crc16
+{
+public:
+    /**
+     * The available implementations, from slowest to fastest
+     */
+    enum Implementation
+    {
+        Table,              //<! Slice-by-8 tables; available on every processor
+        CarrylessMultiply   //<! PCLMULQDQ folding; x86 and x64 only, and not in 32-bit kernel mode
+    };
+
+    static constexpr USHORT INITIAL_VALUE = 0xFFFF;     //<! Value of the CRC register before the first byte
+    static constexpr USHORT GOOD_RESIDUE = 0xF0B8;      //<! Value of the CRC register after a frame and its correct FCS
+    static constexpr ULONG FCS_LENGTH = 2;              //<! Number of bytes of FCS at the end of a frame
+
+    PAGEABLE_FUNCTION
+    static Implementation SelectImplementation(_In_ Implementation maximum) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    static Implementation GetImplementation() noexcept;
+
+    /**
+     * Runs bytes through the CRC register. A frame in several pieces can be checked by passing each piece in
+     * turn, starting from INITIAL_VALUE.
+     * @param crc the register value before data, either INITIAL_VALUE or the result of a previous call
+     * @param data the bytes to add
+     * @param length the number of bytes in data
+     * @returns the register value after data
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    static inline USHORT Update(_In_ USHORT crc, _In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+    {
+        return update(crc, data, length);
+    }
+
+    /**
+     * Computes the FCS of a frame
+     * @param data the frame, without FCS
+     * @param length the number of bytes in data
+     * @returns the FCS to send after the frame
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    static inline USHORT Compute(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+    {
+        return static_cast<USHORT>(~update(INITIAL_VALUE, data, length));
+    }
+
+    /**
+     * Computes the FCS of a frame described by a gather list
+     * @param frame the fragments of the frame, without FCS
+     * @returns the FCS to send after the frame
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    static inline USHORT Compute(_In_ const FrameGatherList& frame) noexcept
+    {
+        USHORT crc = INITIAL_VALUE;
+        for (ULONG i = 0; i < frame.GetFragmentCount(); i++)
+        {
+            crc = update(crc, frame[i].Data, frame[i].Length);
+        }
+        return static_cast<USHORT>(~crc);
+    }
+
+    /**
+     * Checks the FCS of a received frame
+     * @param data the frame, followed by its FCS
+     * @param length the number of bytes in data, including the FCS
+     * @returns true if the frame is long enough to have an FCS and the FCS is correct
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    static inline bool IsValid(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+    {
+        return length >= FCS_LENGTH && update(INITIAL_VALUE, data, length) == GOOD_RESIDUE;
+    }
+
+    /**
+     * Writes an FCS in the order it is sent
+     * @param fcs the FCS returned by Compute()
+     * @param output receives the FCS, least significant byte first
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline void Write(_In_ USHORT fcs, _Out_writes_bytes_(FCS_LENGTH) BYTE* output) noexcept
+    {
+        output[0] = static_cast<BYTE>(fcs);
+        output[1] = static_cast<BYTE>(fcs >> 8);
+    }
+
+private:
+    /** Signature shared by the table and carry-less multiplication implementations of Update */
+    typedef USHORT UpdateFunction(USHORT crc, const BYTE* data, ULONG length);
+
+    static UpdateFunction* update;          //<! Routine chosen by SelectImplementation()
+    static Implementation implementation;   //<! Implementation chosen by SelectImplementation()
+};
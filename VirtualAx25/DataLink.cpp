@@ -0,0 +1,1396 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file DataLink.cpp
+ * Implementation of the DataLink and DataLinkTable classes.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "DataLink.h"
+
+/** Control field bits which tell I, S and U frames apart */
+static constexpr BYTE FRAME_TYPE_MASK = 0x03;
+
+/** Control field of an S frame with the poll/final bit and N(R) removed */
+static constexpr BYTE SUPERVISORY_MASK = 0x0F;
+
+/** Offset of the SSID byte of the destination address in the address field */
+static constexpr ULONG DESTINATION_SSID = AX25Address::WIRE_LENGTH - 1;
+
+/** Offset of the SSID byte of the source address in the address field */
+static constexpr ULONG SOURCE_SSID = 2 * AX25Address::WIRE_LENGTH - 1;
+
+/** No timer expires at this time */
+static constexpr ULONG64 STOPPED = MAXULONG64;
+
+// XID information field: a format and group identifier, the length of the group, then each parameter as an
+// identifier, a length and a big-endian value, as in AX.25 2.2 section 4.3.3.7 and ISO 8885
+static constexpr BYTE XID_FORMAT_IDENTIFIER = 0x82;         //<! General purpose XID information
+static constexpr BYTE XID_GROUP_IDENTIFIER = 0x80;          //<! Parameter negotiation group
+static constexpr ULONG XID_HEADER_LENGTH = 4;               //<! Identifiers and group length
+static constexpr BYTE XID_CLASSES_OF_PROCEDURES = 2;        //<! Balanced mode, half or full duplex
+static constexpr BYTE XID_OPTIONAL_FUNCTIONS = 3;           //<! REJ, SREJ and modulus
+static constexpr BYTE XID_RECEIVE_INFORMATION_LENGTH = 6;   //<! Largest I field taken, in bits
+static constexpr BYTE XID_RECEIVE_WINDOW_SIZE = 8;          //<! Most I frames taken before acknowledging
+static constexpr BYTE XID_ACKNOWLEDGE_TIMER = 9;            //<! T1, in milliseconds
+static constexpr BYTE XID_RETRIES = 10;                     //<! N2
+
+static constexpr ULONG CLASS_BALANCED_HALF_DUPLEX = 0x2100; //<! Balanced asynchronous mode, half duplex
+static constexpr ULONG FUNCTION_REJ = 0x020000;             //<! Implicit reject
+static constexpr ULONG FUNCTION_SREJ = 0x040000;            //<! Selective reject
+static constexpr ULONG FUNCTION_MODULO_8 = 0x000400;        //<! Modulo-8 sequence numbers
+static constexpr ULONG FUNCTION_MODULO_128 = 0x000800;      //<! Modulo-128 sequence numbers
+static constexpr ULONG FUNCTION_FCS_16 = 0x008000;          //<! 16-bit frame check sequence
+
+static_assert(DataLink::MAX_INFORMATION_LENGTH * 8 <= MAXUSHORT, "N1 in bits does not fit the XID parameter");
+static_assert(DataLink::MAX_NEGOTIATION_LENGTH >= XID_HEADER_LENGTH + 4 + 5 + 4 + 3 + 6 + 3, "XID information field does not fit");
+
+/**
+ * Appends a parameter to an XID information field
+ * @param field the information field
+ * @param offset the number of bytes already in field, which is advanced past the parameter
+ * @param identifier the parameter identifier
+ * @param value the value of the parameter
+ * @param valueLength the number of bytes in which to send the value, from 1 to 4
+ */
+NON_PAGEABLE_FUNCTION
+static void appendNegotiationParameter(
+    _Inout_updates_(DataLink::MAX_NEGOTIATION_LENGTH) BYTE* field,
+    _Inout_ ULONG& offset,
+    _In_ BYTE identifier,
+    _In_ ULONG value,
+    _In_ ULONG valueLength) noexcept
+{
+    ASSERT(offset + 2 + valueLength <= DataLink::MAX_NEGOTIATION_LENGTH);
+    field[offset++] = identifier;
+    field[offset++] = static_cast<BYTE>(valueLength);
+    for (ULONG i = valueLength; i > 0; i--)
+    {
+        field[offset++] = static_cast<BYTE>(value >> (8 * (i - 1)));
+    }
+}
+
+const DataLinkParameters DataLink::DEFAULT_PARAMETERS = {
+    MAX_INFORMATION_LENGTH,     // N1
+    4,                          // k
+    3000,                       // T1
+    300000,                     // T3
+    10,                         // N2
+    MODULUS,                    // Modulo-8 sequence numbers
+    false,                      // REJ
+    false                       // No XID
+};
+
+/**
+ * What is assumed of a peer until it says otherwise in XID, and of one which does not answer XID: an AX.25 2.0
+ * station, whose T1 and N2 place no limit on ours
+ */
+static const DataLinkParameters LEGACY_PARAMETERS = {
+    DataLink::LEGACY_INFORMATION_LENGTH,    // N1
+    DataLink::MAX_WINDOW_SIZE,              // k
+    0,                                      // T1
+    0,                                      // T3
+    0,                                      // N2
+    DataLink::MODULUS,                      // Modulo-8 sequence numbers
+    false,                                  // REJ
+    false                                   // No XID
+};
+
+/**
+ * Initializes a disconnected link with no peer. Open() must be called before the link is used.
+ */
+NON_PAGEABLE_FUNCTION
+DataLink::DataLink() noexcept
+{
+    Open(AX25AddressField());
+}
+
+/**
+ * Sets up a disconnected link to a new peer, with the default parameters and empty counts. This fully
+ * initializes the link, so it may also be used on zeroed memory.
+ * @param path the address field of frames to the peer: the peer as destination, this station as source, and
+ * the repeaters to go through. C and H bits are ignored.
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::Open(_In_ const AX25AddressField& path) noexcept
+{
+    AX25AddressField field;
+    field.Destination = path.Destination.WithControlBit(false);
+    field.Source = path.Source.WithControlBit(false);
+    field.RepeaterCount = path.RepeaterCount;
+    for (ULONG i = 0; i < path.RepeaterCount; i++)
+    {
+        field.Repeaters[i] = path.Repeaters[i].WithControlBit(false);
+    }
+
+    peer = field.Destination;
+    local = field.Source;
+    addressLength = field.Write(header, sizeof(header));
+    ASSERT(addressLength != 0);
+
+    parameters = DEFAULT_PARAMETERS;
+    peerParameters = LEGACY_PARAMETERS;
+    peerParametersKnown = false;
+    negotiationFinal = false;
+    updateNegotiatedParameters();
+    RtlZeroMemory(&counters, sizeof(counters));
+    state = Disconnected;
+    pending = 0;
+    queued = 0;
+    enterDisconnected();
+}
+
+/**
+ * Changes the parameters of the link, as narrowed by what is known of the peer. They take effect for the next
+ * frame sent or timer started, except for the modulus, which takes effect when the link is next set up.
+ * @param newParameters the parameters, with N1 from 1 to MAX_INFORMATION_LENGTH, a modulus of MODULUS or
+ * EXTENDED_MODULUS, k from 1 to MAX_WINDOW_SIZE, or to MAX_EXTENDED_WINDOW_SIZE with EXTENDED_MODULUS, T1 from 1
+ * to MAX_ACKNOWLEDGE_MILLISECONDS, T3 not 0 and N2 from 1 to MAX_RETRIES
+ * @returns true if the parameters were set, or false if any is out of range
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::SetParameters(_In_ const DataLinkParameters& newParameters) noexcept
+{
+    const ULONG maxWindowSize = (newParameters.Modulus == EXTENDED_MODULUS) ? MAX_EXTENDED_WINDOW_SIZE : MAX_WINDOW_SIZE;
+    if (newParameters.MaxInformationLength == 0 || newParameters.MaxInformationLength > MAX_INFORMATION_LENGTH ||
+        (newParameters.Modulus != MODULUS && newParameters.Modulus != EXTENDED_MODULUS) ||
+        newParameters.WindowSize == 0 || newParameters.WindowSize > maxWindowSize ||
+        newParameters.AcknowledgeMilliseconds == 0 || newParameters.AcknowledgeMilliseconds > MAX_ACKNOWLEDGE_MILLISECONDS ||
+        newParameters.IdleMilliseconds == 0 || newParameters.MaxRetries == 0 || newParameters.MaxRetries > MAX_RETRIES)
+    {
+        return false;
+    }
+
+    parameters = newParameters;
+    updateNegotiatedParameters();
+    return true;
+}
+
+/**
+ * Starts connecting to the peer, unless a connection is already up or being set up. Queued I frames are
+ * kept and sent once the peer accepts. If Negotiate is set and the peer's parameters are not yet known,
+ * XID goes first.
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::Connect() noexcept
+{
+    if (state == Disconnected || state == AwaitingRelease)
+    {
+        if (parameters.Negotiate && !peerParametersKnown)
+        {
+            negotiate();
+        }
+        else
+        {
+            reestablish();
+        }
+    }
+}
+
+/**
+ * Starts disconnecting from the peer. Queued I frames are discarded.
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::Disconnect() noexcept
+{
+    if (state == Disconnected || state == Negotiating)
+    {
+        enterDisconnected();
+        return;
+    }
+
+    clearQueue();
+    state = AwaitingRelease;
+    pending = (pending & PendingResponses) | PendingRelease;
+    retries = 0;
+    acknowledgeDeadline = STOPPED;
+    idleDeadline = STOPPED;
+}
+
+/**
+ * Queues information to be sent to the peer in an I frame, connecting first if the link is down
+ * @param pid the protocol identifier of the frame
+ * @param information the information field, which is copied
+ * @param length the number of bytes in information
+ * @param prefix bytes to place before information in the information field, such as a segment header, or
+ * nullptr if prefixLength is 0
+ * @param prefixLength the number of bytes in prefix. With length, this must not be more than
+ * GetMaxInformationLength().
+ * @returns true if the information was queued, or false if it is too long, the queue is full or the link
+ * is being disconnected
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::Send(
+    _In_ BYTE pid,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length,
+    _In_reads_bytes_opt_(prefixLength) const BYTE* prefix,
+    _In_ ULONG prefixLength) noexcept
+{
+    if (prefixLength > GetMaxInformationLength() || length > GetMaxInformationLength() - prefixLength ||
+        queued - acknowledged == QUEUE_LENGTH || state == AwaitingRelease)
+    {
+        return false;
+    }
+
+    if (state == Disconnected)
+    {
+        Connect();
+    }
+
+    Slot& slot = slots[queued % QUEUE_LENGTH];
+    slot.pid = pid;
+    slot.length = prefixLength + length;
+    if (prefixLength != 0)
+    {
+        RtlCopyMemory(slot.information, prefix, prefixLength);
+    }
+    RtlCopyMemory(slot.information + prefixLength, information, length);
+    queued++;
+    return true;
+}
+
+/**
+ * Handles a frame received from the peer. Any frames owed in reply are sent by the next call to Transmit().
+ * @param addresses the address field of the frame, which was sent by the peer to this station
+ * @param frame the rest of the frame, starting with the control field, without FCS
+ * @param length the number of bytes in frame
+ * @param now the current time, in milliseconds
+ * @param client receives the information of I frames
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void DataLink::ReceiveFrame(
+    _In_ const AX25AddressField& addresses,
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length,
+    _In_ ULONG64 now,
+    _Inout_ DataLinkClient& client) noexcept
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    // Commands have the C bit set in the destination and clear in the source, and responses the opposite.
+    // Stations older than version 2 set both bits the same, and everything they send is taken as a command.
+    const bool command = addresses.Destination.GetControlBit() || !addresses.Source.GetControlBit();
+    const BYTE control = frame[0];
+    if ((control & FRAME_TYPE_MASK) == FRAME_TYPE_MASK)
+    {
+        receiveUnnumbered(control, command, frame + 1, length - 1, now);
+        return;
+    }
+
+    // I and S frames of an extended connection carry N(R) and the poll/final bit in a second byte
+    ULONG receiveSequence = control >> 5;
+    bool pollFinal = (control & CONTROL_POLL_FINAL) != 0;
+    ULONG controlLength = 1;
+    if (modulus == EXTENDED_MODULUS)
+    {
+        if (length < 2)
+        {
+            return;
+        }
+        receiveSequence = frame[1] >> 1;
+        pollFinal = (frame[1] & EXTENDED_POLL_FINAL) != 0;
+        controlLength = 2;
+    }
+
+    if ((control & 0x01) == 0)
+    {
+        if (command)
+        {
+            const ULONG sendSequence = (control >> 1) % modulus;
+            receiveInformation(sendSequence, receiveSequence, pollFinal, frame + controlLength, length - controlLength, now, client);
+        }
+    }
+    else
+    {
+        receiveSupervisory(control & SUPERVISORY_MASK, receiveSequence, pollFinal, command, now);
+    }
+}
+
+/**
+ * Handles the expiry of T1 and T3. Frames owed as a result are sent by the next call to Transmit().
+ * @param now the current time, in milliseconds
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::OnTimer(_In_ ULONG64 now) noexcept
+{
+    if (acknowledgeDeadline <= now)
+    {
+        acknowledgeDeadline = STOPPED;
+        counters.timeouts++;
+        switch (state)
+        {
+        case Negotiating:
+            // A station which does not know XID may just ignore it
+            learnPeerParameters(nullptr, 0);
+            reestablish();
+            break;
+
+        case AwaitingConnection:
+        case AwaitingRelease:
+            if (retries == negotiated.MaxRetries)
+            {
+                enterDisconnected();
+            }
+            else
+            {
+                retries++;
+                pending |= (state == AwaitingConnection) ? PendingConnect : PendingRelease;
+            }
+            break;
+
+        case Connected:
+            // The acknowledgement of the window, or the last frames of it, went missing: ask for it
+            retries = 1;
+            state = TimerRecovery;
+            pending |= PendingEnquiry;
+            break;
+
+        case TimerRecovery:
+            if (retries == negotiated.MaxRetries)
+            {
+                enterDisconnected();
+            }
+            else
+            {
+                retries++;
+                pending |= PendingEnquiry;
+            }
+            break;
+
+        case Disconnected:
+            break;
+        }
+    }
+
+    if (idleDeadline <= now)
+    {
+        idleDeadline = STOPPED;
+        if (state == Connected)
+        {
+            retries = 0;
+            state = TimerRecovery;
+            pending |= PendingEnquiry;
+        }
+    }
+}
+
+/**
+ * Sends every frame which is due: responses owed to the peer, then a connect, disconnect or poll, then the
+ * I frames asked for by SREJ and as many queued I frames as the window allows, and finally an acknowledgement
+ * if no I frame carried one.
+ * Stops early, keeping the rest for the next call, if the client does not accept a frame.
+ * @param client sends the frames
+ * @param now the current time, in milliseconds
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void DataLink::Transmit(_Inout_ DataLinkClient& client, _In_ ULONG64 now) noexcept
+{
+    if ((pending & PendingUnnumbered) != 0)
+    {
+        if (!transmitFrame(client, unnumberedResponse, false, nullptr))
+        {
+            return;
+        }
+        pending &= ~PendingUnnumbered;
+    }
+
+    if ((pending & PendingNegotiation) != 0)
+    {
+        if (!transmitNegotiation(client, false, negotiationFinal))
+        {
+            return;
+        }
+        pending &= ~PendingNegotiation;
+    }
+
+    if ((pending & PendingNegotiate) != 0)
+    {
+        if (!transmitNegotiation(client, true, true))
+        {
+            return;
+        }
+        pending &= ~PendingNegotiate;
+        acknowledgeDeadline = now + negotiated.AcknowledgeMilliseconds;
+    }
+
+    if ((pending & (PendingConnect | PendingRelease)) != 0)
+    {
+        const BYTE control = ((pending & PendingConnect) == 0) ? CONTROL_DISC :
+                             (negotiated.Modulus == EXTENDED_MODULUS) ? CONTROL_SABME : CONTROL_SABM;
+        if (!transmitFrame(client, control | CONTROL_POLL_FINAL, true, nullptr))
+        {
+            return;
+        }
+        pending &= ~(PendingConnect | PendingRelease);
+        acknowledgeDeadline = now + negotiated.AcknowledgeMilliseconds;
+    }
+
+    if (state != Connected && state != TimerRecovery)
+    {
+        return;
+    }
+
+    // A REJ carries N(R) as well, so it also answers a poll and stands in for a plain acknowledgement
+    if ((pending & PendingReject) != 0)
+    {
+        const bool final = (rejectFinal | acknowledgeFinal) != 0;
+        if (!transmitFrame(client, sequencedControl(CONTROL_REJ, received, final), false, nullptr))
+        {
+            return;
+        }
+        pending &= ~(PendingReject | PendingAcknowledge);
+        acknowledgeFinal = 0;
+        counters.rejectsSent++;
+    }
+
+    // Each missing frame is asked for by its own SREJ, whose N(R) names the frame rather than acknowledging
+    while ((pending & PendingSelectiveReject) != 0)
+    {
+        ULONG offset;
+        if (!_BitScanForward(&offset, owedRejects))
+        {
+            pending &= ~PendingSelectiveReject;
+            break;
+        }
+
+        if (!transmitFrame(client, sequencedControl(CONTROL_SREJ, (received + offset) % modulus, false), false, nullptr))
+        {
+            return;
+        }
+        owedRejects &= ~(1UL << offset);
+        counters.selectiveRejectsSent++;
+    }
+
+    // The answer to a poll must go out with its final bit, so it cannot be folded into an I frame
+    if ((pending & PendingAcknowledge) != 0 && acknowledgeFinal != 0)
+    {
+        if (!transmitFrame(client, sequencedControl(CONTROL_RR, received, true), false, nullptr))
+        {
+            return;
+        }
+        pending &= ~PendingAcknowledge;
+        acknowledgeFinal = 0;
+    }
+
+    if (state == TimerRecovery)
+    {
+        if ((pending & PendingEnquiry) != 0)
+        {
+            if (!transmitFrame(client, sequencedControl(CONTROL_RR, received, true), true, nullptr))
+            {
+                return;
+            }
+            pending &= ~(PendingEnquiry | PendingAcknowledge);
+            acknowledgeDeadline = now + negotiated.AcknowledgeMilliseconds;
+            idleDeadline = STOPPED;
+        }
+    }
+    else if (!peerBusy)
+    {
+        ULONG offset;
+        while (_BitScanForward(&offset, resendFrames))
+        {
+            if (!transmitInformation(client, acknowledged + offset, now))
+            {
+                return;
+            }
+            resendFrames &= ~(1UL << offset);
+            counters.informationFramesResent++;
+        }
+
+        while (sent != queued && sent - acknowledged < windowSize())
+        {
+            if (!transmitInformation(client, sent, now))
+            {
+                return;
+            }
+
+            if (sent - acknowledged < highestSent - acknowledged)
+            {
+                counters.informationFramesResent++;
+            }
+            else
+            {
+                counters.informationFramesSent++;
+                highestSent = sent + 1;
+            }
+            sent++;
+        }
+    }
+
+    if ((pending & PendingAcknowledge) != 0)
+    {
+        if (!transmitFrame(client, sequencedControl(CONTROL_RR, received, false), false, nullptr))
+        {
+            return;
+        }
+        pending &= ~PendingAcknowledge;
+    }
+}
+
+/**
+ * Discards every queued I frame
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::clearQueue() noexcept
+{
+    acknowledged = queued;
+    sent = queued;
+    highestSent = queued;
+}
+
+/**
+ * Moves to the Disconnected state, discarding queued I frames, frames held for reordering and everything owed
+ * to the peer except an unnumbered response
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::enterDisconnected() noexcept
+{
+    clearQueue();
+    state = Disconnected;
+    pending &= PendingResponses;
+    retries = 0;
+    modulus = MODULUS;
+    received = 0;
+    sequenceBase = acknowledged;
+    resendFrames = 0;
+    heldFrames = 0;
+    requestedFrames = 0;
+    owedRejects = 0;
+    unnumberedResponse = (pending != 0) ? unnumberedResponse : 0;
+    rejectFinal = 0;
+    acknowledgeFinal = 0;
+    peerBusy = false;
+    rejectSent = false;
+    acknowledgeDeadline = STOPPED;
+    idleDeadline = STOPPED;
+}
+
+/**
+ * Moves to the Connected state with all sequence numbers reset. I frames still queued, sent or not, are
+ * renumbered from 0 and sent again.
+ * @param now the current time, in milliseconds
+ * @param newModulus MODULUS, or EXTENDED_MODULUS for a connection set up with SABME
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::enterConnected(_In_ ULONG64 now, _In_ ULONG newModulus) noexcept
+{
+    state = Connected;
+    pending &= PendingResponses;
+    modulus = newModulus;
+    sent = acknowledged;
+    highestSent = acknowledged;
+    sequenceBase = acknowledged;
+    received = 0;
+    resendFrames = 0;
+    heldFrames = 0;
+    requestedFrames = 0;
+    owedRejects = 0;
+    retries = 0;
+    peerBusy = false;
+    rejectSent = false;
+    acknowledgeFinal = 0;
+    acknowledgeDeadline = STOPPED;
+    idleDeadline = now + negotiated.IdleMilliseconds;
+}
+
+/**
+ * Sends SABM, or SABME, to set the link up again, keeping the queued I frames
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::reestablish() noexcept
+{
+    state = AwaitingConnection;
+    pending = (pending & PendingResponses) | PendingConnect;
+    sent = acknowledged;
+    resendFrames = 0;
+    retries = 0;
+    acknowledgeDeadline = STOPPED;
+    idleDeadline = STOPPED;
+}
+
+/**
+ * Sends XID to learn the peer's parameters before connecting to it
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::negotiate() noexcept
+{
+    state = Negotiating;
+    pending = (pending & PendingResponses) | PendingNegotiate;
+    sent = acknowledged;
+    retries = 0;
+    acknowledgeDeadline = STOPPED;
+    idleDeadline = STOPPED;
+}
+
+/**
+ * Records the parameters of the peer and settles those of the link
+ * @param information the information field of the peer's XID, or nullptr if the peer does not know XID, in
+ * which case it is taken to be an AX.25 2.0 station
+ * @param length the number of bytes in information
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::learnPeerParameters(_In_reads_bytes_opt_(length) const BYTE* information, _In_ ULONG length) noexcept
+{
+    // Parameters the peer leaves out keep their AX.25 2.0 values
+    peerParameters = LEGACY_PARAMETERS;
+    peerParametersKnown = true;
+    if (information == nullptr || length < XID_HEADER_LENGTH ||
+        information[0] != XID_FORMAT_IDENTIFIER || information[1] != XID_GROUP_IDENTIFIER)
+    {
+        updateNegotiatedParameters();
+        return;
+    }
+
+    const ULONG groupLength = (static_cast<ULONG>(information[2]) << 8) | information[3];
+    const ULONG end = (groupLength < length - XID_HEADER_LENGTH) ? XID_HEADER_LENGTH + groupLength : length;
+    for (ULONG offset = XID_HEADER_LENGTH; offset + 2 <= end; )
+    {
+        const BYTE identifier = information[offset];
+        const ULONG valueLength = information[offset + 1];
+        offset += 2;
+        if (valueLength > end - offset)
+        {
+            break;
+        }
+
+        // Values too long to be meant for us are skipped
+        if (valueLength == 0 || valueLength > 4)
+        {
+            offset += valueLength;
+            continue;
+        }
+
+        ULONG value = 0;
+        for (ULONG i = 0; i < valueLength; i++)
+        {
+            value = (value << 8) | information[offset + i];
+        }
+        offset += valueLength;
+
+        switch (identifier)
+        {
+        case XID_OPTIONAL_FUNCTIONS:
+            peerParameters.Modulus = ((value & FUNCTION_MODULO_128) != 0) ? EXTENDED_MODULUS : MODULUS;
+            peerParameters.SelectiveReject = (value & FUNCTION_SREJ) != 0;
+            break;
+
+        case XID_RECEIVE_INFORMATION_LENGTH:
+            peerParameters.MaxInformationLength = (value >= 8) ? value / 8 : peerParameters.MaxInformationLength;
+            break;
+
+        case XID_RECEIVE_WINDOW_SIZE:
+            peerParameters.WindowSize = (value != 0) ? value : peerParameters.WindowSize;
+            break;
+
+        // The longer T1 and N2 of the two ends win, so a peer could otherwise keep a dead link open for days
+        case XID_ACKNOWLEDGE_TIMER:
+            peerParameters.AcknowledgeMilliseconds = (value < MAX_ACKNOWLEDGE_MILLISECONDS) ? value : MAX_ACKNOWLEDGE_MILLISECONDS;
+            break;
+
+        case XID_RETRIES:
+            peerParameters.MaxRetries = (value < MAX_RETRIES) ? value : MAX_RETRIES;
+            break;
+
+        default:
+            break;
+        }
+    }
+    updateNegotiatedParameters();
+}
+
+/**
+ * Settles the parameters the link runs with: its own, with the smaller N1, k and modulus and the longer T1 and
+ * N2 of the two ends once the peer's are known. Both ends come to the same result, as long as neither asks for
+ * more than MAX_ACKNOWLEDGE_MILLISECONDS or MAX_RETRIES.
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::updateNegotiatedParameters() noexcept
+{
+    negotiated = parameters;
+    if (!peerParametersKnown)
+    {
+        return;
+    }
+
+    if (peerParameters.MaxInformationLength < negotiated.MaxInformationLength)
+    {
+        negotiated.MaxInformationLength = peerParameters.MaxInformationLength;
+    }
+    if (peerParameters.WindowSize < negotiated.WindowSize)
+    {
+        negotiated.WindowSize = peerParameters.WindowSize;
+    }
+    if (peerParameters.AcknowledgeMilliseconds > negotiated.AcknowledgeMilliseconds)
+    {
+        negotiated.AcknowledgeMilliseconds = peerParameters.AcknowledgeMilliseconds;
+    }
+    if (peerParameters.MaxRetries > negotiated.MaxRetries)
+    {
+        negotiated.MaxRetries = peerParameters.MaxRetries;
+    }
+    if (peerParameters.Modulus != EXTENDED_MODULUS)
+    {
+        negotiated.Modulus = MODULUS;
+        negotiated.WindowSize = (negotiated.WindowSize < MAX_WINDOW_SIZE) ? negotiated.WindowSize : MAX_WINDOW_SIZE;
+    }
+    negotiated.SelectiveReject = negotiated.SelectiveReject && peerParameters.SelectiveReject &&
+                                 negotiated.Modulus == EXTENDED_MODULUS;
+}
+
+/**
+ * Owes the peer an unnumbered response
+ * @param control the control field of the response, without the final bit
+ * @param final the final bit, which is the poll bit of the command answered
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::respond(_In_ BYTE control, _In_ bool final) noexcept
+{
+    unnumberedResponse = control | (final ? CONTROL_POLL_FINAL : 0);
+    pending |= PendingUnnumbered;
+}
+
+/**
+ * Owes the peer an acknowledgement of the I frames received
+ * @param final true if this answers a poll
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::acknowledge(_In_ bool final) noexcept
+{
+    pending |= PendingAcknowledge;
+    if (final)
+    {
+        acknowledgeFinal = CONTROL_POLL_FINAL;
+    }
+}
+
+/**
+ * Releases the I frames the peer has acknowledged
+ * @param sequence the N(R) received: the sequence number of the next I frame the peer expects
+ * @returns true if N(R) acknowledges only frames which have been sent, or false if it is invalid
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::acknowledgeUpTo(_In_ ULONG sequence) noexcept
+{
+    // Frames sent before going back N may be acknowledged even though sent has moved back past them
+    const ULONG advance = (sequence - sequenceOf(acknowledged)) % modulus;
+    if (advance > highestSent - acknowledged)
+    {
+        return false;
+    }
+
+    acknowledged += advance;
+    resendFrames = (advance < 32) ? resendFrames >> advance : 0;
+    if (sent - acknowledged > highestSent - acknowledged)
+    {
+        sent = acknowledged;
+    }
+    return true;
+}
+
+/**
+ * Restarts T1 and T3 after an acknowledgement in the Connected state: T1 runs while I frames are awaiting
+ * acknowledgement, and T3 while none are
+ * @param now the current time, in milliseconds
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::updateTimers(_In_ ULONG64 now) noexcept
+{
+    if (acknowledged == highestSent)
+    {
+        acknowledgeDeadline = STOPPED;
+        idleDeadline = now + negotiated.IdleMilliseconds;
+    }
+    else
+    {
+        acknowledgeDeadline = now + negotiated.AcknowledgeMilliseconds;
+    }
+}
+
+/**
+ * Counts the I frame numbered V(R) as received, moving the masks of missing and held frames along with it
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::advanceReceived() noexcept
+{
+    received = (received + 1) % modulus;
+    heldFrames >>= 1;
+    requestedFrames >>= 1;
+    owedRejects >>= 1;
+    rejectSent = false;
+    counters.informationFramesReceived++;
+}
+
+/**
+ * Passes on the frames held for reordering which now follow on from those received
+ * @param client receives the information
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::deliverHeldFrames(_Inout_ DataLinkClient& client) noexcept
+{
+    while ((heldFrames & 1) != 0)
+    {
+        const Slot& slot = reorder[received % REORDER_LENGTH];
+        if (!client.DataLinkReceive(*this, slot.pid, slot.information, slot.length))
+        {
+            // Dropped, so it is missing again; the peer sends it once a poll finds it unacknowledged
+            heldFrames &= ~1UL;
+            return;
+        }
+        advanceReceived();
+    }
+}
+
+/**
+ * Holds an I frame which arrived after a gap, and asks for the frames missing before it with SREJ
+ * @param offset how far past V(R) the frame's N(S) is, from 1 to REORDER_LENGTH - 1
+ * @param information the PID and information field of the frame
+ * @param length the number of bytes in information
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::holdFrame(
+    _In_ ULONG offset,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length) noexcept
+{
+    const ULONG bit = 1UL << offset;
+    if ((heldFrames & bit) == 0 && length - 1 <= MAX_INFORMATION_LENGTH)
+    {
+        Slot& slot = reorder[(received + offset) % REORDER_LENGTH];
+        slot.pid = information[0];
+        slot.length = length - 1;
+        RtlCopyMemory(slot.information, information + 1, length - 1);
+        heldFrames |= bit;
+    }
+
+    // Each missing frame is asked for once; if the SREJ or the frame sent again is lost too, T1 recovers it
+    const ULONG missing = (bit - 1) & ~heldFrames & ~requestedFrames;
+    if (missing != 0)
+    {
+        requestedFrames |= missing;
+        owedRejects |= missing;
+        pending |= PendingSelectiveReject;
+    }
+}
+
+/**
+ * Handles a received I frame
+ * @param sendSequence the N(S) of the frame
+ * @param receiveSequence the N(R) of the frame
+ * @param poll the poll bit of the frame
+ * @param information the PID and information field of the frame
+ * @param length the number of bytes in information
+ * @param now the current time, in milliseconds
+ * @param client receives the information
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::receiveInformation(
+    _In_ ULONG sendSequence,
+    _In_ ULONG receiveSequence,
+    _In_ bool poll,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length,
+    _In_ ULONG64 now,
+    _Inout_ DataLinkClient& client) noexcept
+{
+    if (state != Connected && state != TimerRecovery)
+    {
+        if (state == Disconnected && poll)
+        {
+            respond(CONTROL_DM, true);
+        }
+        return;
+    }
+
+    if (length < 1)
+    {
+        return;
+    }
+
+    const ULONG previouslyAcknowledged = acknowledged;
+    if (!acknowledgeUpTo(receiveSequence))
+    {
+        reestablish();
+        return;
+    }
+
+    if (state == Connected && acknowledged != previouslyAcknowledged)
+    {
+        updateTimers(now);
+    }
+
+    const ULONG offset = (sendSequence - received) % modulus;
+    if (offset != 0)
+    {
+        counters.outOfSequenceFrames++;
+        if (modulus == EXTENDED_MODULUS && negotiated.SelectiveReject && offset < REORDER_LENGTH)
+        {
+            holdFrame(offset, information, length);
+            if (poll)
+            {
+                acknowledge(true);
+            }
+        }
+        else if (!rejectSent)
+        {
+            // Only the first frame out of sequence is rejected; the rest of the window follows it anyway
+            rejectSent = true;
+            rejectFinal = poll ? CONTROL_POLL_FINAL : 0;
+            pending |= PendingReject;
+        }
+        else if (poll)
+        {
+            acknowledge(true);
+        }
+        return;
+    }
+
+    // Information which cannot be taken is not acknowledged, so the peer sends it again
+    if (client.DataLinkReceive(*this, information[0], information + 1, length - 1))
+    {
+        advanceReceived();
+        deliverHeldFrames(client);
+        acknowledge(poll);
+    }
+    else if (poll)
+    {
+        acknowledge(true);
+    }
+}
+
+/**
+ * Handles a received RR, RNR, REJ or SREJ
+ * @param type the control field of the frame, without N(R) and the poll/final bit
+ * @param receiveSequence the N(R) of the frame
+ * @param pollFinal the poll/final bit of the frame
+ * @param command true if the frame is a command, or false if it is a response
+ * @param now the current time, in milliseconds
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::receiveSupervisory(
+    _In_ BYTE type,
+    _In_ ULONG receiveSequence,
+    _In_ bool pollFinal,
+    _In_ bool command,
+    _In_ ULONG64 now) noexcept
+{
+    if (state != Connected && state != TimerRecovery)
+    {
+        if (state == Disconnected && command && pollFinal)
+        {
+            respond(CONTROL_DM, true);
+        }
+        return;
+    }
+
+    peerBusy = (type == CONTROL_RNR);
+    if (command && pollFinal)
+    {
+        acknowledge(true);
+    }
+
+    if (type == CONTROL_SREJ)
+    {
+        // N(R) names the one frame to send again. Only with the final bit does it acknowledge those before it.
+        if (pollFinal && !acknowledgeUpTo(receiveSequence))
+        {
+            reestablish();
+            return;
+        }
+
+        const ULONG offset = (receiveSequence - sequenceOf(acknowledged)) % modulus;
+        if (offset < highestSent - acknowledged && offset < sent - acknowledged)
+        {
+            resendFrames |= 1UL << offset;
+        }
+        return;
+    }
+
+    const ULONG previouslyAcknowledged = acknowledged;
+    if (!acknowledgeUpTo(receiveSequence))
+    {
+        reestablish();
+        return;
+    }
+
+    if (state == TimerRecovery)
+    {
+        if (!command && pollFinal)
+        {
+            // The answer to our poll says exactly which frames arrived: send the rest again
+            state = Connected;
+            pending &= ~PendingEnquiry;
+            retries = 0;
+            sent = acknowledged;
+            resendFrames = 0;
+            acknowledgeDeadline = STOPPED;
+            idleDeadline = (acknowledged == highestSent) ? now + negotiated.IdleMilliseconds : STOPPED;
+        }
+        return;
+    }
+
+    if (type == CONTROL_REJ)
+    {
+        // Go back N: everything from N(R) on is sent again, and T1 restarts when it is
+        sent = acknowledged;
+        resendFrames = 0;
+        acknowledgeDeadline = STOPPED;
+        idleDeadline = STOPPED;
+    }
+    else if (acknowledged != previouslyAcknowledged || acknowledged == highestSent)
+    {
+        updateTimers(now);
+    }
+}
+
+/**
+ * Handles a received U frame
+ * @param control the control field of the frame
+ * @param command true if the frame is a command, or false if it is a response
+ * @param information the information field of the frame
+ * @param length the number of bytes in information
+ * @param now the current time, in milliseconds
+ */
+NON_PAGEABLE_FUNCTION
+void DataLink::receiveUnnumbered(
+    _In_ BYTE control,
+    _In_ bool command,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length,
+    _In_ ULONG64 now) noexcept
+{
+    const bool pollFinal = (control & CONTROL_POLL_FINAL) != 0;
+    switch (control & ~CONTROL_POLL_FINAL)
+    {
+    case CONTROL_SABM:
+    case CONTROL_SABME:
+        if (state == AwaitingRelease)
+        {
+            respond(CONTROL_DM, pollFinal);
+        }
+        else
+        {
+            // If both ends connect at once, each answers the other's SABM and waits for its own UA
+            respond(CONTROL_UA, pollFinal);
+            if (state != AwaitingConnection)
+            {
+                enterConnected(now, ((control & ~CONTROL_POLL_FINAL) == CONTROL_SABME) ? EXTENDED_MODULUS : MODULUS);
+            }
+        }
+        break;
+
+    case CONTROL_XID:
+        if (command)
+        {
+            // Parameters are only settled between connections; once connected, those in use are reported
+            if (state == Disconnected || state == Negotiating)
+            {
+                learnPeerParameters(information, length);
+            }
+            negotiationFinal = pollFinal;
+            pending |= PendingNegotiation;
+        }
+        else if (state == Negotiating)
+        {
+            learnPeerParameters(information, length);
+        }
+
+        // Our own XID may have crossed the peer's, which tells us its parameters just as well
+        if (state == Negotiating)
+        {
+            reestablish();
+        }
+        break;
+
+    case CONTROL_DISC:
+        if (state == Disconnected || state == Negotiating || state == AwaitingConnection)
+        {
+            respond(CONTROL_DM, pollFinal);
+        }
+        else
+        {
+            respond(CONTROL_UA, pollFinal);
+            enterDisconnected();
+        }
+        break;
+
+    case CONTROL_UA:
+        if (state == AwaitingConnection)
+        {
+            enterConnected(now, negotiated.Modulus);
+        }
+        else if (state == AwaitingRelease)
+        {
+            enterDisconnected();
+        }
+        break;
+
+    case CONTROL_DM:
+    case CONTROL_FRMR:
+        if (state == Negotiating)
+        {
+            // A station which does not know XID refuses it
+            learnPeerParameters(nullptr, 0);
+            reestablish();
+        }
+        else if ((control & ~CONTROL_POLL_FINAL) == CONTROL_FRMR)
+        {
+            if (state == Connected || state == TimerRecovery)
+            {
+                reestablish();
+            }
+        }
+        else if (state != Disconnected)
+        {
+            enterDisconnected();
+        }
+        break;
+
+    default:
+        // Anything else polled while disconnected is refused. Unknown frames on a connection are ignored.
+        if (state == Disconnected && command && pollFinal)
+        {
+            respond(CONTROL_DM, true);
+        }
+        break;
+    }
+}
+
+/**
+ * Builds a frame to the peer and hands it to the client
+ * @param client sends the frame
+ * @param control the control field, with its second byte, if it has one, in bits 8 to 15
+ * @param command true to send the frame as a command, or false to send it as a response
+ * @param slot the I frame whose PID and information to send, or nullptr for a frame without a PID
+ * @param information the information field of a frame without a PID, if it has one
+ * @param informationLength the number of bytes in information
+ * @returns true if the client accepted the frame
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::transmitFrame(
+    _Inout_ DataLinkClient& client,
+    _In_ USHORT control,
+    _In_ bool command,
+    _In_opt_ const Slot* slot,
+    _In_reads_bytes_opt_(informationLength) const BYTE* information,
+    _In_ ULONG informationLength) noexcept
+{
+    header[DESTINATION_SSID] = command ? (header[DESTINATION_SSID] | AX25Address::CONTROL_BIT)
+                                       : (header[DESTINATION_SSID] & ~AX25Address::CONTROL_BIT);
+    header[SOURCE_SSID] = command ? (header[SOURCE_SSID] & ~AX25Address::CONTROL_BIT)
+                                  : (header[SOURCE_SSID] | AX25Address::CONTROL_BIT);
+    header[addressLength] = static_cast<BYTE>(control);
+
+    ULONG length = addressLength + 1;
+    if (modulus == EXTENDED_MODULUS && (control & FRAME_TYPE_MASK) != FRAME_TYPE_MASK)
+    {
+        header[length++] = static_cast<BYTE>(control >> 8);
+    }
+
+    FrameGatherList frame;
+    if (slot != nullptr)
+    {
+        header[length++] = slot->pid;
+    }
+
+    if (!frame.Append(header, length) || (slot != nullptr && !frame.Append(slot->information, slot->length)) ||
+        (information != nullptr && !frame.Append(information, informationLength)))
+    {
+        return false;
+    }
+
+    return client.DataLinkTransmit(frame);
+}
+
+/**
+ * Sends XID with the parameters of the link: those it would like as a command, or those settled as a response
+ * @param client sends the frame
+ * @param command true to send the frame as a command, or false to send it as a response
+ * @param pollFinal the poll/final bit
+ * @returns true if the client accepted the frame
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::transmitNegotiation(_Inout_ DataLinkClient& client, _In_ bool command, _In_ bool pollFinal) noexcept
+{
+    const DataLinkParameters& values = negotiated;
+    ULONG functions = FUNCTION_REJ | FUNCTION_MODULO_8 | FUNCTION_FCS_16;
+    functions |= (values.Modulus == EXTENDED_MODULUS) ? FUNCTION_MODULO_128 : 0;
+    functions |= values.SelectiveReject ? FUNCTION_SREJ : 0;
+
+    ULONG length = XID_HEADER_LENGTH;
+    appendNegotiationParameter(negotiation, length, XID_CLASSES_OF_PROCEDURES, CLASS_BALANCED_HALF_DUPLEX, 2);
+    appendNegotiationParameter(negotiation, length, XID_OPTIONAL_FUNCTIONS, functions, 3);
+    appendNegotiationParameter(negotiation, length, XID_RECEIVE_INFORMATION_LENGTH, values.MaxInformationLength * 8, 2);
+    appendNegotiationParameter(negotiation, length, XID_RECEIVE_WINDOW_SIZE, values.WindowSize, 1);
+    appendNegotiationParameter(negotiation, length, XID_ACKNOWLEDGE_TIMER, values.AcknowledgeMilliseconds,
+                               (values.AcknowledgeMilliseconds > MAXUSHORT) ? 4 : 2);
+    appendNegotiationParameter(negotiation, length, XID_RETRIES, (values.MaxRetries > MAXUCHAR) ? MAXUCHAR : values.MaxRetries, 1);
+    negotiation[0] = XID_FORMAT_IDENTIFIER;
+    negotiation[1] = XID_GROUP_IDENTIFIER;
+    negotiation[2] = static_cast<BYTE>((length - XID_HEADER_LENGTH) >> 8);
+    negotiation[3] = static_cast<BYTE>(length - XID_HEADER_LENGTH);
+
+    const BYTE control = CONTROL_XID | (pollFinal ? CONTROL_POLL_FINAL : 0);
+    return transmitFrame(client, control, command, nullptr, negotiation, length);
+}
+
+/**
+ * Sends a queued I frame, carrying the acknowledgement of the frames received, and starts T1 if it is not
+ * already running
+ * @param client sends the frame
+ * @param count the count of the I frame
+ * @param now the current time, in milliseconds
+ * @returns true if the client accepted the frame
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool DataLink::transmitInformation(_Inout_ DataLinkClient& client, _In_ ULONG count, _In_ ULONG64 now) noexcept
+{
+    const BYTE first = static_cast<BYTE>(sequenceOf(count) << 1);
+    if (!transmitFrame(client, sequencedControl(first, received, false), true, &slots[count % QUEUE_LENGTH]))
+    {
+        return false;
+    }
+
+    pending &= ~PendingAcknowledge;
+    if (acknowledgeDeadline == STOPPED)
+    {
+        acknowledgeDeadline = now + negotiated.AcknowledgeMilliseconds;
+    }
+    idleDeadline = STOPPED;
+    return true;
+}
+
+/**
+ * Allocates the links. This must be called once, before any link is opened.
+ * @param handle the NDIS handle with which to allocate the links
+ * @param linkCount the most links that can be open at once
+ * @returns NDIS_STATUS_SUCCESS if the links were allocated, or NDIS_STATUS_RESOURCES otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS DataLinkTable::Allocate(_In_ NDIS_HANDLE handle, _In_ ULONG linkCount) noexcept
+{
+    ASSERT(links == nullptr);
+    const ULONG64 size = static_cast<ULONG64>(linkCount) * sizeof(DataLink);
+    if (linkCount == 0 || size > MAXUINT)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    void* allocation = NdisAllocateMemoryWithTagPriority(handle, static_cast<UINT>(size), DATA_LINK_TAG, NormalPoolPriority);
+    if (allocation == nullptr)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    // Links are set up by DataLink::Open() as they are used
+    RtlZeroMemory(allocation, static_cast<size_t>(size));
+    ndisHandle = handle;
+    links = static_cast<DataLink*>(allocation);
+    capacity = linkCount;
+    count = 0;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Releases the links. Nothing may be opened afterwards.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void DataLinkTable::Free() noexcept
+{
+    if (links != nullptr)
+    {
+        NdisFreeMemoryWithTagPriority(ndisHandle, links, DATA_LINK_TAG);
+        links = nullptr;
+        capacity = 0;
+        count = 0;
+    }
+}
+
+/**
+ * Finds the link to a peer
+ * @param peer the address of the peer
+ * @returns the link, or nullptr if there is none
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+DataLink* DataLinkTable::Find(_In_ AX25Address peer) noexcept
+{
+    for (ULONG i = 0; i < count; i++)
+    {
+        if (links[i].GetPeer() == peer)
+        {
+            return &links[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Finds the link to a peer, or opens a new one with the parameters set by SetLinkParameters() if there is none
+ * @param path the address field of frames to the peer, as for DataLink::Open(); an existing link keeps its own
+ * @returns the link, or nullptr if every link is in use
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+DataLink* DataLinkTable::Open(_In_ const AX25AddressField& path) noexcept
+{
+    DataLink* link = Find(path.Destination);
+    if (link != nullptr)
+    {
+        return link;
+    }
+
+    for (ULONG i = 0; i < count && link == nullptr; i++)
+    {
+        if (links[i].GetState() == DataLink::Disconnected && !links[i].HasFramesToTransmit())
+        {
+            link = &links[i];
+        }
+    }
+
+    if (link == nullptr)
+    {
+        if (count == capacity)
+        {
+            return nullptr;
+        }
+        link = &links[count++];
+    }
+
+    link->Open(path);
+    const bool valid = link->SetParameters(linkParameters);
+    ASSERT(valid);
+    UNREFERENCED_PARAMETER(valid);
+    return link;
+}
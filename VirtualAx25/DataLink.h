@@ -0,0 +1,540 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file DataLink.h
+ * Definition of the DataLink class, which runs AX.25 connected mode with one peer station, and of the
+ * DataLinkTable which holds the links of an adapter.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "AX25Address.h"
+#include "FrameGatherList.h"
+
+class DataLink;
+
+/**
+ * The owner of a DataLink: sends the frames the link produces and accepts the information it receives
+ */
+class DataLinkClient
+{
+public:
+    /**
+     * Sends a frame produced by a link. The fragments are only valid for the duration of the call.
+     * @param frame the frame, starting with the address field and without FCS
+     * @returns true if the frame was accepted for transmission, or false to have the link keep it for later
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    virtual bool DataLinkTransmit(_In_ const FrameGatherList& frame) noexcept = 0;
+
+    /**
+     * Accepts the information field of an I frame received in sequence
+     * @param link the link which received it
+     * @param pid the protocol identifier of the frame
+     * @param information the information field
+     * @param length the number of bytes in information
+     * @returns true if the information was taken, or false if there was no room for it, in which case the
+     * frame is not acknowledged and the peer sends it again later
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    virtual bool DataLinkReceive(
+        _In_ const DataLink& link,
+        _In_ BYTE pid,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length) noexcept = 0;
+
+protected:
+    // Clients are never destroyed through this interface
+    ~DataLinkClient() = default;
+};
+
+/**
+ * The parameters of a link, named as in the AX.25 specification
+ */
+struct DataLinkParameters
+{
+    ULONG MaxInformationLength;     //<! N1: largest information field sent, in bytes
+    ULONG WindowSize;               //<! k: most I frames sent but not yet acknowledged
+    ULONG AcknowledgeMilliseconds;  //<! T1: time to wait for an acknowledgement before asking for one
+    ULONG IdleMilliseconds;         //<! T3: time without traffic after which the peer is polled
+    ULONG MaxRetries;               //<! N2: times T1 may expire in a row before the link is given up
+    ULONG Modulus;                  //<! DataLink::MODULUS, or DataLink::EXTENDED_MODULUS to connect with SABME
+    bool SelectiveReject;           //<! Ask for each lost I frame with SREJ, rather than REJ, on extended connections
+    bool Negotiate;                 //<! Exchange XID with the peer before connecting to it for the first time
+};
+
+/**
+ * One AX.25 connected-mode (LAPB) link with a peer station, using modulo-8 sequence numbers, or modulo-128
+ * ones on an extended connection set up with SABME.
+ *
+ * Up to WindowSize I frames are sent before waiting for an acknowledgement, so a window of frames goes out
+ * in one transmission and is acknowledged in one reply, rather than turning the channel around for every
+ * frame. Frames lost on the way are recovered go-back-N: the receiver rejects the first frame out of
+ * sequence and the sender resends from there, or, if the acknowledgement itself was lost, T1 expires and
+ * the sender polls the receiver for its state.
+ *
+ * Going back N resends the whole rest of the window for each lost frame, which wastes the larger windows of
+ * extended connections. With SelectiveReject, the receiver of an extended connection instead holds frames
+ * which arrive after a gap in a reorder buffer and asks for each missing frame with its own SREJ, so only
+ * the missing frames are sent again. Windows are limited to QUEUE_LENGTH, well under half the sequence space,
+ * so a frame sent again after a poll can never be mistaken for a new one.
+ *
+ * Before connecting to a peer for the first time, a link with Negotiate set sends XID with its parameters. The
+ * peer answers with its own, and both ends settle on the smaller N1, k and modulus and the longer T1 and N2.
+ * A peer which refuses XID, or does not answer it within T1, is taken to be an AX.25 2.0 station: modulo 8,
+ * REJ and an N1 of LEGACY_INFORMATION_LENGTH. The link keeps what it learned about the peer until it is opened
+ * for another one.
+ *
+ * The link never transmits by itself. Received frames, timer expiry and new information only decide which
+ * frames are due, and Transmit() sends them, so the owner can keep every frame to the radio in its own
+ * transmit context. Responses go first, then I frames, and an acknowledgement only goes on its own when no
+ * I frame could carry it. Time is given to every call in milliseconds from any fixed origin, which keeps
+ * the link deterministic under test. A link is not thread safe.
+ */
+class DataLink
+{
+public:
+    static constexpr ULONG MODULUS = 8;                     //<! Sequence numbers run from 0 to MODULUS - 1
+    static constexpr ULONG EXTENDED_MODULUS = 128;          //<! Sequence numbers of an extended connection
+    static constexpr ULONG MAX_WINDOW_SIZE = MODULUS - 1;   //<! Largest window the sequence numbers can tell apart
+    static constexpr ULONG QUEUE_LENGTH = 32;               //<! I frames held, sent or not, until acknowledged
+    static constexpr ULONG MAX_EXTENDED_WINDOW_SIZE = QUEUE_LENGTH; //<! Largest window of an extended connection
+    static constexpr ULONG REORDER_LENGTH = MAX_EXTENDED_WINDOW_SIZE; //<! I frames held after a gap for SREJ
+    static constexpr ULONG MAX_INFORMATION_LENGTH = 512;    //<! Largest N1 accepted; longer datagrams go through Segmenter
+    static constexpr ULONG LEGACY_INFORMATION_LENGTH = 256; //<! N1 of a peer which did not negotiate one
+    static constexpr ULONG MAX_NEGOTIATION_LENGTH = 32;     //<! Largest XID information field sent
+    static constexpr ULONG MAX_ACKNOWLEDGE_MILLISECONDS = 120000;   //<! Longest T1 accepted, from SetParameters() or a peer
+    static constexpr ULONG MAX_RETRIES = 31;                //<! Largest N2 accepted, from SetParameters() or a peer
+
+    static constexpr BYTE CONTROL_SABM = 0x2F;              //<! Set asynchronous balanced mode (connect)
+    static constexpr BYTE CONTROL_SABME = 0x6F;             //<! Set asynchronous balanced mode extended (connect modulo 128)
+    static constexpr BYTE CONTROL_DISC = 0x43;              //<! Disconnect
+    static constexpr BYTE CONTROL_DM = 0x0F;                //<! Disconnected mode
+    static constexpr BYTE CONTROL_UA = 0x63;                //<! Unnumbered acknowledgement
+    static constexpr BYTE CONTROL_XID = 0xAF;               //<! Exchange identification (parameter negotiation)
+    static constexpr BYTE CONTROL_FRMR = 0x87;              //<! Frame reject
+    static constexpr BYTE CONTROL_RR = 0x01;                //<! Receive ready
+    static constexpr BYTE CONTROL_RNR = 0x05;               //<! Receive not ready
+    static constexpr BYTE CONTROL_REJ = 0x09;               //<! Reject
+    static constexpr BYTE CONTROL_SREJ = 0x0D;              //<! Selective reject
+    static constexpr BYTE CONTROL_POLL_FINAL = 0x10;        //<! Poll bit of a command, final bit of a response
+    static constexpr BYTE EXTENDED_POLL_FINAL = 0x01;       //<! Poll/final bit, in the second control byte of extended I and S frames
+
+    /** Parameters used until SetParameters() is called: the AX.25 defaults, with N1 raised to MAX_INFORMATION_LENGTH */
+    static const DataLinkParameters DEFAULT_PARAMETERS;
+
+    /**
+     * The state of a link
+     */
+    enum State
+    {
+        Disconnected,           //<! No connection; only a SABM is accepted
+        Negotiating,            //<! XID sent, waiting for the peer's parameters before sending SABM
+        AwaitingConnection,     //<! SABM sent, waiting for UA
+        AwaitingRelease,        //<! DISC sent, waiting for UA
+        Connected,              //<! Information transfer
+        TimerRecovery           //<! Information transfer, waiting for the peer to answer a poll
+    };
+
+    /** Frame counts of a link */
+    struct Counters
+    {
+        ULONG64 informationFramesSent;      //<! I frames transmitted for the first time
+        ULONG64 informationFramesResent;    //<! I frames transmitted again
+        ULONG64 informationFramesReceived;  //<! I frames received in sequence and delivered
+        ULONG64 outOfSequenceFrames;        //<! I frames received out of sequence, and discarded or held
+        ULONG64 rejectsSent;                //<! REJ frames sent
+        ULONG64 selectiveRejectsSent;       //<! SREJ frames sent
+        ULONG64 timeouts;                   //<! Expiries of T1
+    };
+
+    NON_PAGEABLE_FUNCTION
+    DataLink() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Open(_In_ const AX25AddressField& path) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool SetParameters(_In_ const DataLinkParameters& newParameters) noexcept;
+
+    /** @returns the station at the other end of the link */
+    NON_PAGEABLE_FUNCTION
+    inline AX25Address GetPeer() const noexcept { return peer; }
+
+    /** @returns this station's address on the link */
+    NON_PAGEABLE_FUNCTION
+    inline AX25Address GetLocal() const noexcept { return local; }
+
+    /** @returns the current state of the link */
+    NON_PAGEABLE_FUNCTION
+    inline State GetState() const noexcept { return state; }
+
+    /** @returns MODULUS, or EXTENDED_MODULUS if the link is connected with modulo-128 sequence numbers */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetModulus() const noexcept { return modulus; }
+
+    /** @returns the parameters of the link, as set by SetParameters() */
+    NON_PAGEABLE_FUNCTION
+    inline const DataLinkParameters& GetParameters() const noexcept { return parameters; }
+
+    /** @returns the parameters the link runs with: its own, narrowed to what the peer supports once that is known */
+    NON_PAGEABLE_FUNCTION
+    inline const DataLinkParameters& GetNegotiatedParameters() const noexcept { return negotiated; }
+
+    /** @returns true if the peer's parameters are known, from XID or because it did not answer XID */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsNegotiated() const noexcept { return peerParametersKnown; }
+
+    /** @returns the frame counts of the link */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    /** @returns the number of I frames held, whether or not they have been sent */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetQueuedCount() const noexcept { return queued - acknowledged; }
+
+    /** @returns the number of I frames Send() can still queue */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetQueueSpace() const noexcept { return (state == AwaitingRelease) ? 0 : QUEUE_LENGTH - (queued - acknowledged); }
+
+    /**
+     * @returns the longest information field Send() accepts: N1, or no more than an AX.25 2.0 station takes
+     * while the link is still to learn the peer's parameters, so that nothing queued turns out too long for it
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetMaxInformationLength() const noexcept
+    {
+        return (parameters.Negotiate && !peerParametersKnown && negotiated.MaxInformationLength > LEGACY_INFORMATION_LENGTH) ?
+               LEGACY_INFORMATION_LENGTH : negotiated.MaxInformationLength;
+    }
+
+    /** @returns true if Transmit() has something to send */
+    NON_PAGEABLE_FUNCTION
+    inline bool HasFramesToTransmit() const noexcept
+    {
+        return pending != 0 ||
+               (state == Connected && !peerBusy && (resendFrames != 0 || (sent != queued && sent - acknowledged < windowSize())));
+    }
+
+    /** @returns the time at which OnTimer() should next be called, or MAXULONG64 if no timer is running */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetNextTimeout() const noexcept
+    {
+        return (acknowledgeDeadline < idleDeadline) ? acknowledgeDeadline : idleDeadline;
+    }
+
+    NON_PAGEABLE_FUNCTION
+    void Connect() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Disconnect() noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool Send(
+        _In_ BYTE pid,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length,
+        _In_reads_bytes_opt_(prefixLength) const BYTE* prefix = nullptr,
+        _In_ ULONG prefixLength = 0) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void ReceiveFrame(
+        _In_ const AX25AddressField& addresses,
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length,
+        _In_ ULONG64 now,
+        _Inout_ DataLinkClient& client) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void OnTimer(_In_ ULONG64 now) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Transmit(_Inout_ DataLinkClient& client, _In_ ULONG64 now) noexcept;
+
+private:
+    /** Frames Transmit() owes the peer, other than I frames */
+    enum PendingFrame : ULONG
+    {
+        PendingConnect = 0x01,      //<! SABM with the poll bit
+        PendingRelease = 0x02,      //<! DISC with the poll bit
+        PendingUnnumbered = 0x04,   //<! unnumberedResponse
+        PendingReject = 0x08,       //<! REJ response
+        PendingEnquiry = 0x10,      //<! RR or RNR command with the poll bit
+        PendingAcknowledge = 0x20,  //<! RR response, unless an I frame carries the acknowledgement first
+        PendingSelectiveReject = 0x40,  //<! SREJ responses for the frames in owedRejects
+        PendingNegotiate = 0x80,        //<! XID command with the poll bit
+        PendingNegotiation = 0x100,     //<! XID response, with negotiationFinal
+        PendingResponses = PendingUnnumbered | PendingNegotiation   //<! Answers owed whatever the state
+    };
+
+    /** An I frame held until acknowledged */
+    struct Slot
+    {
+        BYTE pid;                                   //<! Protocol identifier
+        ULONG length;                               //<! Bytes of information
+        BYTE information[MAX_INFORMATION_LENGTH];   //<! The information field
+    };
+
+    State state;                    //<! Current state
+    DataLinkParameters parameters;  //<! N1, k, T1, T3, N2, the modulus and REJ or SREJ
+    DataLinkParameters peerParameters;  //<! What the peer supports, if peerParametersKnown
+    DataLinkParameters negotiated;  //<! parameters, narrowed to peerParameters
+    bool peerParametersKnown;       //<! Whether peerParameters has been learned
+    bool negotiationFinal;          //<! Final bit of the pending XID response
+    ULONG modulus;                  //<! MODULUS, or EXTENDED_MODULUS on an extended connection
+    AX25Address peer;               //<! The station at the other end of the link
+    AX25Address local;              //<! This station
+    ULONG addressLength;            //<! Bytes of address field at the start of header
+
+    // I frames are counted from the start of the link rather than modulo 8: queued frames are counted
+    // acknowledged..queued-1, and those below sent have been transmitted. Going back N moves sent back, but
+    // the peer may still acknowledge anything below highestSent. sequenceBase is the count which was
+    // numbered 0, so a frame's N(S) is its count less sequenceBase, modulo 8.
+    ULONG acknowledged;             //<! Count of the oldest unacknowledged I frame: V(A)
+    ULONG sent;                     //<! Count of the next I frame to transmit: V(S)
+    ULONG highestSent;              //<! Count after the last I frame ever transmitted
+    ULONG queued;                   //<! Count of the next I frame to be queued
+    ULONG sequenceBase;             //<! Count which was numbered 0 when the link was last reset
+    ULONG received;                 //<! Sequence number of the next I frame expected: V(R)
+
+    // Selective reject keeps sets of frames as bit masks. Bit i of resendFrames is the frame counted
+    // acknowledged + i; bit i of the others is the frame numbered received + i.
+    ULONG resendFrames;             //<! Sent frames the peer asked for with SREJ
+    ULONG heldFrames;               //<! Frames received after a gap and held in reorder
+    ULONG requestedFrames;          //<! Missing frames already asked for with SREJ
+    ULONG owedRejects;              //<! Missing frames to ask for with SREJ
+
+    ULONG retries;                  //<! Expiries of T1 since the last progress
+    ULONG pending;                  //<! PendingFrame flags
+    BYTE unnumberedResponse;        //<! UA or DM owed to the peer, with its final bit
+    BYTE rejectFinal;               //<! Final bit of the pending REJ
+    BYTE acknowledgeFinal;          //<! Final bit of the pending RR response
+    bool peerBusy;                  //<! The peer last sent RNR
+    bool rejectSent;                //<! A REJ was sent and the frame it asked for has not yet arrived
+    ULONG64 acknowledgeDeadline;    //<! Expiry of T1, or MAXULONG64 if it is stopped
+    ULONG64 idleDeadline;           //<! Expiry of T3, or MAXULONG64 if it is stopped
+    Counters counters;              //<! Frame counts
+
+    /** Address and control fields of the frame being transmitted, and its PID */
+    BYTE header[AX25AddressField::MAX_LENGTH + 3];
+
+    /** Information field of the XID frame being transmitted */
+    BYTE negotiation[MAX_NEGOTIATION_LENGTH];
+
+    Slot slots[QUEUE_LENGTH];       //<! I frames, indexed by count modulo QUEUE_LENGTH
+    Slot reorder[REORDER_LENGTH];   //<! I frames in heldFrames, indexed by sequence number modulo REORDER_LENGTH
+
+    NON_PAGEABLE_FUNCTION
+    void clearQueue() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void enterDisconnected() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void enterConnected(_In_ ULONG64 now, _In_ ULONG newModulus) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void reestablish() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void negotiate() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void learnPeerParameters(_In_reads_bytes_opt_(length) const BYTE* information, _In_ ULONG length) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void updateNegotiatedParameters() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void respond(_In_ BYTE control, _In_ bool final) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void acknowledge(_In_ bool final) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool acknowledgeUpTo(_In_ ULONG sequence) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void updateTimers(_In_ ULONG64 now) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void advanceReceived() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void deliverHeldFrames(_Inout_ DataLinkClient& client) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void holdFrame(
+        _In_ ULONG offset,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void receiveInformation(
+        _In_ ULONG sendSequence,
+        _In_ ULONG receiveSequence,
+        _In_ bool poll,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length,
+        _In_ ULONG64 now,
+        _Inout_ DataLinkClient& client) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void receiveSupervisory(
+        _In_ BYTE type,
+        _In_ ULONG receiveSequence,
+        _In_ bool pollFinal,
+        _In_ bool command,
+        _In_ ULONG64 now) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void receiveUnnumbered(
+        _In_ BYTE control,
+        _In_ bool command,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length,
+        _In_ ULONG64 now) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool transmitFrame(
+        _Inout_ DataLinkClient& client,
+        _In_ USHORT control,
+        _In_ bool command,
+        _In_opt_ const Slot* slot,
+        _In_reads_bytes_opt_(informationLength) const BYTE* information = nullptr,
+        _In_ ULONG informationLength = 0) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool transmitNegotiation(_Inout_ DataLinkClient& client, _In_ bool command, _In_ bool pollFinal) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool transmitInformation(_Inout_ DataLinkClient& client, _In_ ULONG count, _In_ ULONG64 now) noexcept;
+
+    /**
+     * Builds the control field of an I or S frame, which carries N(R) and the poll/final bit. On an extended
+     * connection these go in a second byte, which is returned in bits 8 to 15.
+     * @param first the frame type, and N(S) for an I frame, as they appear in the first byte
+     * @param receiveSequence the N(R) to send
+     * @param pollFinal the poll/final bit
+     * @returns the control field
+     */
+    NON_PAGEABLE_FUNCTION
+    inline USHORT sequencedControl(_In_ BYTE first, _In_ ULONG receiveSequence, _In_ bool pollFinal) const noexcept
+    {
+        return (modulus == MODULUS) ?
+            static_cast<USHORT>(first | (pollFinal ? CONTROL_POLL_FINAL : 0) | (receiveSequence << 5)) :
+            static_cast<USHORT>(first | (((receiveSequence << 1) | (pollFinal ? EXTENDED_POLL_FINAL : 0)) << 8));
+    }
+
+    /** @returns the N(S) of the I frame with the specified count */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG sequenceOf(_In_ ULONG count) const noexcept { return (count - sequenceBase) % modulus; }
+
+    /** @returns the window in use: k, limited to what the sequence numbers of the connection allow */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG windowSize() const noexcept
+    {
+        const ULONG limit = (modulus == MODULUS) ? MAX_WINDOW_SIZE : MAX_EXTENDED_WINDOW_SIZE;
+        return (negotiated.WindowSize < limit) ? negotiated.WindowSize : limit;
+    }
+};
+
+/**
+ * The links of an adapter, one per peer station, in a block of non-paged memory allocated once. Links are
+ * found by a linear search, which is quick for the handful of stations on a channel. A link which is
+ * disconnected and holds no frames may be reused for another peer. Callers serialize access.
+ */
+class DataLinkTable
+{
+public:
+    /**
+     * Initializes an empty table. Nothing can be opened until Allocate() is called.
+     */
+    NON_PAGEABLE_FUNCTION
+    inline DataLinkTable() noexcept
+        :ndisHandle(nullptr)
+        ,links(nullptr)
+        ,capacity(0)
+        ,count(0)
+        ,linkParameters(DataLink::DEFAULT_PARAMETERS)
+    {
+    }
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS Allocate(_In_ NDIS_HANDLE handle, _In_ ULONG linkCount) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Free() noexcept;
+
+    /** @returns the number of links in use */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetCount() const noexcept { return count; }
+
+    /**
+     * Sets the parameters each link is given as it is opened for a peer. Links already open keep theirs.
+     * @param parameters the parameters, which must be accepted by DataLink::SetParameters()
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void SetLinkParameters(_In_ const DataLinkParameters& parameters) noexcept { linkParameters = parameters; }
+
+    /**
+     * Gets the specified link
+     * @param index the index of the link, which must be less than GetCount()
+     * @returns the link
+     */
+    NON_PAGEABLE_FUNCTION
+    inline DataLink& operator[](_In_ ULONG index) noexcept
+    {
+        ASSERT(index < count);
+        return links[index];
+    }
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    DataLink* Find(_In_ AX25Address peer) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    DataLink* Open(_In_ const AX25AddressField& path) noexcept;
+
+private:
+    /**
+     * The tag to use when allocating the links. In memory this should appear as "dlAX", little-endian.
+     */
+    static constexpr ULONG DATA_LINK_TAG = AX25_CREATE_TAG("dlAX");
+
+    NDIS_HANDLE ndisHandle;     //<! Handle the links were allocated with
+    DataLink* links;            //<! The links, or nullptr before Allocate()
+    ULONG capacity;             //<! Number of links allocated
+    ULONG count;                //<! Number of links in use
+    DataLinkParameters linkParameters;  //<! Parameters of newly opened links
+};
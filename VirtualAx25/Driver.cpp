@@ -25,6 +25,8 @@
 #include "driver.h"
 #include "driver.tmh"
 #include "Miniport.h"
+#include "KissCodec.h"
+#include "Crc16.h"
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
@@ -58,6 +60,12 @@ NDIS_STATUS DriverEntry(
     WPP_INIT_TRACING( driverObject, registryPath );
     TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "%!FUNC! Entry");
 
+    // Pick the widest KISS scan routine this processor supports before any adapter starts moving data
+    KissCodec::Implementation kissImplementation = KissCodec::SelectImplementation(KissCodec::Avx2);
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "Using KISS scan implementation %d", kissImplementation);
+    Crc16::Implementation crcImplementation = Crc16::SelectImplementation(Crc16::CarrylessMultiply);
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_DRIVER, "Using FCS implementation %d", crcImplementation);
+
     // Create the NDIS driver context object, which also will provide the various NDIS handlers
     Miniport* miniport = new Miniport();
     if (miniport == NULL)
@@ -0,0 +1,148 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file FrameEncoder.h
+ * Definition of the FrameEncoder class, which describes an outbound NET_BUFFER as a FrameGatherList
+ * without copying its payload.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "FrameGatherList.h"
+#include "Crc16.h"
+
+/**
+ * Builds outbound frames as gather lists. The header and trailer are supplied by the caller (they are
+ * typically small, prebuilt buffers owned by the adapter) and the payload is described by walking the
+ * MDL chain of the NET_BUFFER directly. The payload is never copied; each MDL which contributes to the
+ * payload becomes one fragment of the frame.
+ */
+class FrameEncoder
+{
+public:
+    /**
+     * Describes a frame made up of the specified header, the data of the specified NET_BUFFER, and the
+     * specified trailer.
+     * @param netBuffer the NET_BUFFER containing the payload. The NET_BUFFER must remain owned by the
+     * caller until the frame has been transmitted, as the gather list refers to its memory.
+     * @param payloadOffset the number of bytes at the start of the NET_BUFFER's data to leave out of the
+     * frame (for example, a header which is being replaced)
+     * @param header the bytes to place before the payload, or nullptr if headerLength is 0
+     * @param headerLength the number of bytes in header
+     * @param trailer the bytes to place after the payload, or nullptr if trailerLength is 0
+     * @param trailerLength the number of bytes in trailer
+     * @param frame receives the description of the frame
+     * @returns NDIS_STATUS_SUCCESS if the frame was described successfully
+     * @returns NDIS_STATUS_BUFFER_OVERFLOW if the frame has more fragments than a FrameGatherList can hold.
+     * The caller should fall back to copying the payload into a contiguous buffer.
+     * @returns NDIS_STATUS_INVALID_LENGTH if the NET_BUFFER does not contain payloadOffset bytes, or its MDL
+     * chain is shorter than its data length
+     * @returns NDIS_STATUS_RESOURCES if an MDL could not be mapped into system address space
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static inline NDIS_STATUS Encode(
+        _In_ NET_BUFFER& netBuffer,
+        _In_ ULONG payloadOffset,
+        _In_reads_bytes_opt_(headerLength) const BYTE* header,
+        _In_ ULONG headerLength,
+        _In_reads_bytes_opt_(trailerLength) const BYTE* trailer,
+        _In_ ULONG trailerLength,
+        _Out_ FrameGatherList& frame) noexcept
+    {
+        frame.Reset();
+        if (!frame.Append(header, headerLength))
+        {
+            return NDIS_STATUS_BUFFER_OVERFLOW;
+        }
+
+        ULONG remaining = NET_BUFFER_DATA_LENGTH(&netBuffer);
+        if (payloadOffset > remaining)
+        {
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+        remaining -= payloadOffset;
+
+        // Walk the MDL chain, skipping anything before the payload. Only MDLs that actually contribute
+        // bytes to the frame are mapped.
+        ULONG skip = NET_BUFFER_CURRENT_MDL_OFFSET(&netBuffer) + payloadOffset;
+        for (PMDL mdl = NET_BUFFER_CURRENT_MDL(&netBuffer); mdl != nullptr && remaining != 0; mdl = NDIS_MDL_LINKAGE(mdl))
+        {
+            ULONG mdlLength = MmGetMdlByteCount(mdl);
+            if (skip >= mdlLength)
+            {
+                skip -= mdlLength;
+                continue;
+            }
+
+            const BYTE* data = static_cast<const BYTE*>(MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute));
+            if (data == nullptr)
+            {
+                return NDIS_STATUS_RESOURCES;
+            }
+
+            ULONG length = mdlLength - skip;
+            if (length > remaining)
+            {
+                length = remaining;
+            }
+
+            if (!frame.Append(data + skip, length))
+            {
+                return NDIS_STATUS_BUFFER_OVERFLOW;
+            }
+
+            skip = 0;
+            remaining -= length;
+        }
+
+        if (remaining != 0)
+        {
+            // The MDL chain ran out before the data length did - this NET_BUFFER is malformed
+            return NDIS_STATUS_INVALID_LENGTH;
+        }
+
+        if (!frame.Append(trailer, trailerLength))
+        {
+            return NDIS_STATUS_BUFFER_OVERFLOW;
+        }
+
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    /**
+     * Appends the frame check sequence to a frame described by Encode(). The FCS is computed over the
+     * fragments in place, so the payload is still not copied.
+     * @param frame the frame, which on success gains the FCS as its last fragment
+     * @param storage receives the FCS, and must remain valid until the frame has been transmitted
+     * @returns true if the FCS was appended, or false if the frame already has as many fragments as a
+     * FrameGatherList can hold
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static inline bool AppendFrameCheckSequence(
+        _Inout_ FrameGatherList& frame,
+        _Out_ BYTE (&storage)[Crc16::FCS_LENGTH]) noexcept
+    {
+        Crc16::Write(Crc16::Compute(frame), storage);
+        return frame.Append(storage, Crc16::FCS_LENGTH);
+    }
+};
@@ -0,0 +1,143 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file FrameGatherList.h
+ * Definition of the FrameGatherList class, which describes an outbound frame as a list of
+ * discontiguous memory fragments.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * A single contiguous piece of an outbound frame
+ */
+struct FrameFragment
+{
+    const BYTE* Data;   //<! Start of the fragment
+    ULONG Length;       //<! Number of bytes in the fragment
+};
+
+/**
+ * Describes an outbound frame as an ordered list of fragments, so that the frame can be handed to a
+ * connector without first being copied into a single buffer. The list does not own the memory it
+ * refers to; each fragment must remain valid until the frame has been transmitted.
+ */
+class FrameGatherList
+{
+public:
+    /** The maximum number of fragments a single frame may be split into */
+    static constexpr ULONG MAX_FRAGMENTS = 16;
+
+    /**
+     * Initializes a new, empty gather list
+     */
+    NON_PAGEABLE_FUNCTION
+    inline FrameGatherList() noexcept
+        :fragmentCount(0)
+        ,totalLength(0)
+    {
+    }
+
+    /**
+     * Removes all fragments from this list
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void Reset() noexcept
+    {
+        fragmentCount = 0;
+        totalLength = 0;
+    }
+
+    /**
+     * Appends a fragment to the end of the frame. Empty fragments are ignored.
+     * @param data the start of the fragment
+     * @param length the number of bytes in the fragment
+     * @returns true if the fragment was added, or false if the list is already full
+     */
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    inline bool Append(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+    {
+        if (length == 0)
+        {
+            return true;
+        }
+
+        if (fragmentCount == MAX_FRAGMENTS)
+        {
+            return false;
+        }
+
+        fragments[fragmentCount].Data = data;
+        fragments[fragmentCount].Length = length;
+        fragmentCount++;
+        totalLength += length;
+        return true;
+    }
+
+    /** @returns the number of fragments in this frame */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetFragmentCount() const noexcept { return fragmentCount; }
+
+    /** @returns the total length of this frame, in bytes */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetTotalLength() const noexcept { return totalLength; }
+
+    /**
+     * Gets the specified fragment
+     * @param index the index of the fragment, which must be less than GetFragmentCount()
+     * @returns the fragment at the specified index
+     */
+    NON_PAGEABLE_FUNCTION
+    inline const FrameFragment& operator[](_In_ ULONG index) const noexcept
+    {
+        ASSERT(index < fragmentCount);
+        return fragments[index];
+    }
+
+    /**
+     * Copies the entire frame into a single contiguous buffer
+     * @param buffer the buffer to receive the frame
+     * @param bufferSize the size of the buffer, in bytes
+     * @returns the number of bytes copied, which is GetTotalLength(), or 0 if the buffer is too small
+     */
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    inline ULONG CopyTo(_Out_writes_bytes_(bufferSize) BYTE* buffer, _In_ ULONG bufferSize) const noexcept
+    {
+        if (totalLength > bufferSize)
+        {
+            return 0;
+        }
+
+        ULONG offset = 0;
+        for (ULONG i = 0; i < fragmentCount; i++)
+        {
+            RtlCopyMemory(buffer + offset, fragments[i].Data, fragments[i].Length);
+            offset += fragments[i].Length;
+        }
+        return offset;
+    }
+
+private:
+    FrameFragment fragments[MAX_FRAGMENTS];   //<! Fragments of the frame, in transmission order
+    ULONG fragmentCount;                      //<! Number of entries of fragments in use
+    ULONG totalLength;                        //<! Sum of the lengths of all fragments in use
+};
@@ -0,0 +1,257 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file G3ruhModem.cpp
+ * Implementation of the G3ruhScrambler, G3ruhDescrambler and G3ruhDemodulator classes.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "G3ruhModem.h"
+
+/** Mask of the bits held by the scrambler's shift register */
+static constexpr ULONG REGISTER_MASK = (1UL << G3ruhScrambler::REGISTER_LENGTH) - 1;
+
+/** Distance between the two feedback taps, which is where the nearer tap sits in the register */
+static constexpr ULONG TAP_OFFSET = G3ruhScrambler::REGISTER_LENGTH - G3ruhScrambler::TAP;
+
+/** The slicer threshold moves 1/THRESHOLD_DIVISOR of the way to the filter output at each bit */
+static constexpr LONG THRESHOLD_DIVISOR = 128;
+
+/** Each zero crossing corrects 1/PHASE_DIVISOR of the clock's phase error */
+static constexpr LONG PHASE_DIVISOR = 16;
+
+/**
+ * Assembles four bytes of a bit stream into a word
+ * @param data the bytes, the first of which holds the earliest bits
+ * @returns the bits, earliest in bit 0
+ */
+NON_PAGEABLE_FUNCTION
+static inline ULONG loadWord(_In_reads_(4) const BYTE* data) noexcept
+{
+    return data[0] | (static_cast<ULONG>(data[1]) << 8) | (static_cast<ULONG>(data[2]) << 16) | (static_cast<ULONG>(data[3]) << 24);
+}
+
+/**
+ * Splits a word of a bit stream into four bytes
+ * @param word the bits, earliest in bit 0
+ * @param data receives the bytes
+ */
+NON_PAGEABLE_FUNCTION
+static inline void storeWord(_In_ ULONG word, _Out_writes_(4) BYTE* data) noexcept
+{
+    data[0] = static_cast<BYTE>(word);
+    data[1] = static_cast<BYTE>(word >> 8);
+    data[2] = static_cast<BYTE>(word >> 16);
+    data[3] = static_cast<BYTE>(word >> 24);
+}
+
+/**
+ * Scrambles up to 32 bits. With the register holding the last 17 bits sent, the nearer tap of the next 12
+ * bits is the register shifted down by 5 and the farther tap is the register itself, so each 12-bit chunk is
+ * one step.
+ * @param bits the bits to send, earliest in bit 0
+ * @param count the number of bits, from 1 to 32
+ * @returns the scrambled bits
+ */
+NON_PAGEABLE_FUNCTION
+ULONG G3ruhScrambler::Scramble(_In_ ULONG bits, _In_ ULONG count) noexcept
+{
+    ASSERT(count >= 1 && count <= 32);
+    ULONG result = 0;
+    for (ULONG done = 0; done < count; done += TAP)
+    {
+        const ULONG chunk = (count - done < TAP) ? count - done : TAP;
+        const ULONG scrambled = ((bits >> done) ^ (state >> TAP_OFFSET) ^ state) & ((1UL << chunk) - 1);
+        result |= scrambled << done;
+        state = (state >> chunk) | (scrambled << (REGISTER_LENGTH - chunk));
+    }
+    return result;
+}
+
+/**
+ * Scrambles a buffer of line levels in place, a word at a time
+ * @param data the line levels, least significant bit first
+ * @param length the number of bytes in data
+ */
+NON_PAGEABLE_FUNCTION
+void G3ruhScrambler::Scramble(_Inout_updates_(length) BYTE* data, _In_ ULONG length) noexcept
+{
+    for (; length >= 4; data += 4, length -= 4)
+    {
+        storeWord(Scramble(loadWord(data), 32), data);
+    }
+
+    for (; length > 0; data++, length--)
+    {
+        *data = static_cast<BYTE>(Scramble(*data, 8));
+    }
+}
+
+/**
+ * Descrambles up to 32 bits. Placing the received bits above the register lines both taps of every bit up
+ * with it, so the whole word is done at once.
+ * @param bits the bits received, earliest in bit 0
+ * @param count the number of bits, from 1 to 32
+ * @returns the descrambled bits
+ */
+NON_PAGEABLE_FUNCTION
+ULONG G3ruhDescrambler::Descramble(_In_ ULONG bits, _In_ ULONG count) noexcept
+{
+    ASSERT(count >= 1 && count <= 32);
+    const ULONG64 mask = (1ULL << count) - 1;
+    const ULONG64 line = ((bits & mask) << G3ruhScrambler::REGISTER_LENGTH) | state;
+    state = static_cast<ULONG>(line >> count) & REGISTER_MASK;
+    return static_cast<ULONG>((bits ^ (line >> TAP_OFFSET) ^ line) & mask);
+}
+
+/**
+ * Descrambles a buffer of received bits in place, a word at a time
+ * @param data the received bits, least significant bit first
+ * @param length the number of bytes in data
+ */
+NON_PAGEABLE_FUNCTION
+void G3ruhDescrambler::Descramble(_Inout_updates_(length) BYTE* data, _In_ ULONG length) noexcept
+{
+    for (; length >= 4; data += 4, length -= 4)
+    {
+        storeWord(Descramble(loadWord(data), 32), data);
+    }
+
+    for (; length > 0; data++, length--)
+    {
+        *data = static_cast<BYTE>(Descramble(*data, 8));
+    }
+}
+
+/**
+ * Initializes a new demodulator for 48 kHz audio, the usual soundcard rate
+ */
+NON_PAGEABLE_FUNCTION
+G3ruhDemodulator::G3ruhDemodulator() noexcept
+    :sampleRate(0)
+{
+    const bool valid = SetSampleRate(48000);
+    ASSERT(valid);
+    UNREFERENCED_PARAMETER(valid);
+}
+
+/**
+ * Sets the sample rate of the audio to be demodulated, and resets the demodulator
+ * @param newSampleRate the number of samples per second, from MIN_SAMPLE_RATE to MAX_SAMPLE_RATE
+ * @returns true if the sample rate was set, or false if it is out of range
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool G3ruhDemodulator::SetSampleRate(_In_ ULONG newSampleRate) noexcept
+{
+    if (newSampleRate < MIN_SAMPLE_RATE || newSampleRate > MAX_SAMPLE_RATE)
+    {
+        return false;
+    }
+
+    sampleRate = newSampleRate;
+    window = (sampleRate + BAUD_RATE / 2) / BAUD_RATE;
+    phaseStep = static_cast<ULONG>((1ULL << 32) * BAUD_RATE / sampleRate);
+    Reset();
+    return true;
+}
+
+/**
+ * Forgets all received audio and the recovered clock, as if the channel had just been opened
+ */
+NON_PAGEABLE_FUNCTION
+void G3ruhDemodulator::Reset() noexcept
+{
+    RtlZeroMemory(history, sizeof(history));
+    position = 0;
+    sum = 0;
+    threshold = 0;
+    previousValue = 0;
+    phase = 0;
+    pendingBits = 0;
+    pendingCount = 0;
+    descrambler.Reset();
+}
+
+/**
+ * Demodulates a block of audio. Bits are held over until a whole word has been recovered and descrambled,
+ * so the output of successive calls forms one continuous bit stream.
+ * @param samples the audio, as signed 16-bit mono samples at the sample rate set by SetSampleRate()
+ * @param sampleCount the number of samples
+ * @param output receives the line level of each recovered bit, least significant bit first
+ * @param outputLength the number of bytes available in output, which should be at least
+ * GetMaximumOutputLength(sampleCount); any bits beyond that are lost
+ * @returns the number of bytes written to output
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+ULONG G3ruhDemodulator::Demodulate(
+    _In_reads_(sampleCount) const SHORT* samples,
+    _In_ ULONG sampleCount,
+    _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+    _In_ ULONG outputLength) noexcept
+{
+    ULONG written = 0;
+    for (ULONG i = 0; i < sampleCount; i++)
+    {
+        // Matched filter and slicer
+        sum += samples[i] - history[position];
+        history[position] = samples[i];
+        position = (position + 1 == window) ? 0 : position + 1;
+        const LONG value = sum - threshold;
+
+        const LONG previousPhase = phase;
+        phase = static_cast<LONG>(static_cast<ULONG>(phase) + phaseStep);
+
+        // Sample the line once per bit, when the clock phase wraps, interpolating back to the moment it did
+        if (previousPhase >= 0 && phase < 0)
+        {
+            const ULONG64 overshoot = static_cast<ULONG>(phase) - 0x80000000UL;
+            const LONG64 sampled = value - static_cast<LONG64>(value - previousValue) * static_cast<LONG64>(overshoot) / phaseStep;
+            pendingBits |= (sampled > 0 ? 1UL : 0UL) << pendingCount;
+
+            // Scrambled data has as many 1s as 0s, so the bits pull the threshold to the receiver's DC offset
+            threshold += static_cast<LONG>(sampled / THRESHOLD_DIVISOR);
+            if (++pendingCount == 32)
+            {
+                if (written + 4 <= outputLength)
+                {
+                    storeWord(descrambler.Descramble(pendingBits, 32), output + written);
+                    written += 4;
+                }
+                pendingBits = 0;
+                pendingCount = 0;
+            }
+        }
+
+        // Zero crossings belong halfway between bits, where the phase is 0. The crossing happened
+        // value / (value - previousValue) of a sample ago, possibly before the latest bit was sampled, so
+        // the correction stops at the wrap rather than sampling a bit twice or skipping one.
+        if ((value > 0) != (previousValue > 0))
+        {
+            const LONG crossingPhase = static_cast<LONG>(static_cast<ULONG>(phase) -
+                static_cast<ULONG>(static_cast<LONG64>(phaseStep) * value / (value - previousValue)));
+            const LONG64 corrected = static_cast<LONG64>(phase) - crossingPhase / PHASE_DIVISOR;
+            phase = static_cast<LONG>(corrected < MINLONG ? MINLONG : (corrected > MAXLONG ? MAXLONG : corrected));
+        }
+        previousValue = value;
+    }
+
+    return written;
+}
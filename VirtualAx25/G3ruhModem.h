@@ -0,0 +1,156 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file G3ruhModem.h
+ * Definition of the G3ruhScrambler, G3ruhDescrambler and G3ruhDemodulator classes, which make up a software
+ * 9600 baud modem compatible with the G3RUH design.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * The G3RUH scrambler, which whitens the NRZI-coded line levels before they are sent so that the FM
+ * transmitter sees no DC and the receiver always has transitions to lock onto. Each bit sent is the input
+ * bit XORed with the bits sent 12 and 17 bits earlier (the polynomial 1 + x^12 + x^17).
+ *
+ * Because every bit depends only on bits at least 12 places back, a 12-bit chunk can be scrambled at once
+ * with two shifts and two XORs, and a 32-bit word takes three chunks instead of 32 steps. Bit streams are
+ * packed least significant bit first, as HdlcEncoder produces them.
+ */
+class G3ruhScrambler
+{
+public:
+    static constexpr ULONG REGISTER_LENGTH = 17;        //<! Bits of history kept by the shift register
+    static constexpr ULONG TAP = 12;                    //<! The shorter of the two feedback taps
+
+    NON_PAGEABLE_FUNCTION
+    G3ruhScrambler() noexcept : state(0) {}
+
+    /** Clears the shift register, as at the start of a transmission */
+    NON_PAGEABLE_FUNCTION
+    inline void Reset() noexcept { state = 0; }
+
+    NON_PAGEABLE_FUNCTION
+    ULONG Scramble(_In_ ULONG bits, _In_ ULONG count) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Scramble(_Inout_updates_(length) BYTE* data, _In_ ULONG length) noexcept;
+
+private:
+    ULONG state;                //<! The last REGISTER_LENGTH bits sent, oldest in bit 0
+};
+
+/**
+ * The G3RUH descrambler, which undoes G3ruhScrambler. Each bit received is XORed with the bits received 12
+ * and 17 bits earlier. Since it only looks at received bits, it needs no synchronization: it produces the
+ * right output 17 bits after it starts, whatever it held before. With no feedback, a whole 32-bit word
+ * is descrambled in one step.
+ */
+class G3ruhDescrambler
+{
+public:
+    NON_PAGEABLE_FUNCTION
+    G3ruhDescrambler() noexcept : state(0) {}
+
+    /** Clears the shift register */
+    NON_PAGEABLE_FUNCTION
+    inline void Reset() noexcept { state = 0; }
+
+    NON_PAGEABLE_FUNCTION
+    ULONG Descramble(_In_ ULONG bits, _In_ ULONG count) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Descramble(_Inout_updates_(length) BYTE* data, _In_ ULONG length) noexcept;
+
+private:
+    ULONG state;                //<! The last G3ruhScrambler::REGISTER_LENGTH bits received, oldest in bit 0
+};
+
+/**
+ * Demodulates G3RUH 9600 baud FSK from the discriminator output of an FM receiver, so that the adapter can
+ * run a 9600 baud port from a soundcard instead of a TNC.
+ *
+ * The audio is a baseband signal whose level gives the bit. Each sample goes through a moving sum over one
+ * bit period, which is the matched filter for the square pulses sent, and then a slicer whose threshold
+ * follows the slowly varying DC offset of the receiver. A phase-locked loop runs at the baud rate and samples
+ * the sliced signal once per bit; the time of each zero crossing is interpolated between samples and pulls
+ * the loop's phase towards the middle between two bits. The recovered bits are descrambled 32 at a time.
+ *
+ * The output is one line level per bit, packed least significant bit first, which is the NRZI-coded input
+ * HdlcDecoder expects. A demodulator holds the state of one channel and is not thread safe.
+ */
+class G3ruhDemodulator
+{
+public:
+    static constexpr ULONG BAUD_RATE = 9600;            //<! Bits per second
+    static constexpr ULONG MIN_SAMPLE_RATE = 38400;     //<! Lowest sample rate accepted, four samples per bit
+    static constexpr ULONG MAX_SAMPLE_RATE = 192000;    //<! Highest sample rate accepted
+
+    NON_PAGEABLE_FUNCTION
+    G3ruhDemodulator() noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool SetSampleRate(_In_ ULONG newSampleRate) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    /** @returns the sample rate set by SetSampleRate() */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetSampleRate() const noexcept { return sampleRate; }
+
+    /**
+     * Computes the output space needed by Demodulate(). No more than two bits come out per bit period of
+     * input, and up to 31 bits may be held over from the previous call.
+     * @param sampleCount the number of samples to be demodulated
+     * @returns the most bytes Demodulate() can write for that many samples
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetMaximumOutputLength(_In_ ULONG sampleCount) const noexcept
+    {
+        return static_cast<ULONG>((2ULL * sampleCount * BAUD_RATE / sampleRate + 1 + 31 + 31) / 32 * 4);
+    }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    ULONG Demodulate(
+        _In_reads_(sampleCount) const SHORT* samples,
+        _In_ ULONG sampleCount,
+        _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+        _In_ ULONG outputLength) noexcept;
+
+private:
+    /** Longest matched filter, in samples */
+    static constexpr ULONG MAX_WINDOW = MAX_SAMPLE_RATE / BAUD_RATE;
+
+    ULONG sampleRate;           //<! Samples per second
+    ULONG window;               //<! Matched filter length, in samples
+    ULONG position;             //<! Where the next sample goes in history
+    LONG sum;                   //<! Sum of the samples in history
+    LONG threshold;             //<! Slicer threshold, following the average of sum
+    LONG previousValue;         //<! Filter output of the previous sample, less the threshold
+    ULONG phaseStep;            //<! Clock phase advance per sample; 2^32 is one bit period
+    LONG phase;                 //<! Clock phase; a bit is sampled when this wraps from positive to negative
+    ULONG pendingBits;          //<! Sampled bits not yet descrambled, least significant first
+    ULONG pendingCount;         //<! Number of bits in pendingBits
+    G3ruhDescrambler descrambler; //<! Descrambler for the sampled bits
+    SHORT history[MAX_WINDOW];  //<! The most recent window samples, as a ring
+};
@@ -0,0 +1,445 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HdlcCodec.cpp
+ * Implementation of the HdlcEncoder and HdlcDecoder classes, including the compile-time bit stuffing and
+ * unstuffing tables.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "HdlcCodec.h"
+
+/** Layout of the stuffing and unstuffing table entries */
+static constexpr ULONG ENTRY_BITS_MASK = 0xFFFF;        //<! Output bits, least significant first
+static constexpr ULONG ENTRY_COUNT_SHIFT = 16;          //<! Number of output bits
+static constexpr ULONG ENTRY_ONES_SHIFT = 24;           //<! Run of 1s carried into the next byte
+static constexpr ULONG ENTRY_SPECIAL = 0x80000000;      //<! The byte holds a flag or abort, and must be decoded a bit at a time
+
+/** Number of 1s after which the sender inserts a 0 */
+static constexpr ULONG STUFFING_RUN = 5;
+
+/**
+ * Computes one entry of the stuffing table by stuffing the remaining bits of a byte
+ * @param ones the run of 1s before the next bit
+ * @param data the byte
+ * @param bit the next bit of data to stuff
+ * @param output the stuffed bits so far
+ * @param count the number of stuffed bits so far
+ * @returns the entry
+ */
+static constexpr ULONG stuffEntry(_In_ ULONG ones, _In_ ULONG data, _In_ ULONG bit = 0, _In_ ULONG output = 0, _In_ ULONG count = 0) noexcept
+{
+    return bit == 8 ? (output | (count << ENTRY_COUNT_SHIFT) | (ones << ENTRY_ONES_SHIFT))
+         : ((data >> bit) & 1) == 0 ? stuffEntry(0, data, bit + 1, output, count + 1)
+         : ones == STUFFING_RUN - 1 ? stuffEntry(0, data, bit + 1, output | (1u << count), count + 2)
+         : stuffEntry(ones + 1, data, bit + 1, output | (1u << count), count + 1);
+}
+
+/**
+ * Computes one entry of the unstuffing table by unstuffing the remaining bits of a byte
+ * @param ones the run of 1s before the next bit
+ * @param data the byte
+ * @param bit the next bit of data to unstuff
+ * @param output the unstuffed bits so far
+ * @param count the number of unstuffed bits so far
+ * @returns the entry, or ENTRY_SPECIAL if a sixth 1 is reached
+ */
+static constexpr ULONG unstuffEntry(_In_ ULONG ones, _In_ ULONG data, _In_ ULONG bit = 0, _In_ ULONG output = 0, _In_ ULONG count = 0) noexcept
+{
+    return bit == 8 ? (output | (count << ENTRY_COUNT_SHIFT) | (ones << ENTRY_ONES_SHIFT))
+         : ((data >> bit) & 1) != 0 ? (ones == STUFFING_RUN ? ENTRY_SPECIAL : unstuffEntry(ones + 1, data, bit + 1, output | (1u << count), count + 1))
+         : ones == STUFFING_RUN ? unstuffEntry(0, data, bit + 1, output, count)
+         : unstuffEntry(0, data, bit + 1, output, count + 1);
+}
+
+static_assert(stuffEntry(0, 0xFF) == (0x1DF | (9 << ENTRY_COUNT_SHIFT) | (3 << ENTRY_ONES_SHIFT)) &&
+              stuffEntry(4, 0x01) == (0x01 | (9 << ENTRY_COUNT_SHIFT)) &&
+              unstuffEntry(0, 0xDF) == (0x7F | (7 << ENTRY_COUNT_SHIFT) | (2 << ENTRY_ONES_SHIFT)) &&
+              unstuffEntry(0, HdlcCodec::FLAG) == ENTRY_SPECIAL,
+              "stuffing must insert a 0 after five 1s, and unstuffing must remove it");
+
+#define HDLC_ROW(entry, ones, row) \
+    entry(ones, row + 0x0), entry(ones, row + 0x1), entry(ones, row + 0x2), entry(ones, row + 0x3), \
+    entry(ones, row + 0x4), entry(ones, row + 0x5), entry(ones, row + 0x6), entry(ones, row + 0x7), \
+    entry(ones, row + 0x8), entry(ones, row + 0x9), entry(ones, row + 0xA), entry(ones, row + 0xB), \
+    entry(ones, row + 0xC), entry(ones, row + 0xD), entry(ones, row + 0xE), entry(ones, row + 0xF)
+
+#define HDLC_TABLE(entry, ones) { \
+    HDLC_ROW(entry, ones, 0x00), HDLC_ROW(entry, ones, 0x10), HDLC_ROW(entry, ones, 0x20), HDLC_ROW(entry, ones, 0x30), \
+    HDLC_ROW(entry, ones, 0x40), HDLC_ROW(entry, ones, 0x50), HDLC_ROW(entry, ones, 0x60), HDLC_ROW(entry, ones, 0x70), \
+    HDLC_ROW(entry, ones, 0x80), HDLC_ROW(entry, ones, 0x90), HDLC_ROW(entry, ones, 0xA0), HDLC_ROW(entry, ones, 0xB0), \
+    HDLC_ROW(entry, ones, 0xC0), HDLC_ROW(entry, ones, 0xD0), HDLC_ROW(entry, ones, 0xE0), HDLC_ROW(entry, ones, 0xF0) }
+
+/** Stuffing table, indexed by the run of 1s already sent and the next data byte */
+static constexpr ULONG STUFF[STUFFING_RUN][256] =
+{
+    HDLC_TABLE(stuffEntry, 0), HDLC_TABLE(stuffEntry, 1), HDLC_TABLE(stuffEntry, 2),
+    HDLC_TABLE(stuffEntry, 3), HDLC_TABLE(stuffEntry, 4),
+};
+
+/** Unstuffing table, indexed by the run of 1s already received and the next byte of bits */
+static constexpr ULONG UNSTUFF[STUFFING_RUN + 1][256] =
+{
+    HDLC_TABLE(unstuffEntry, 0), HDLC_TABLE(unstuffEntry, 1), HDLC_TABLE(unstuffEntry, 2),
+    HDLC_TABLE(unstuffEntry, 3), HDLC_TABLE(unstuffEntry, 4), HDLC_TABLE(unstuffEntry, 5),
+};
+
+#undef HDLC_TABLE
+#undef HDLC_ROW
+
+/**
+ * Initializes a new encoder with the line at level 0 and no bits held over
+ */
+NON_PAGEABLE_FUNCTION
+HdlcEncoder::HdlcEncoder() noexcept
+    :pendingBits(0)
+    ,pendingCount(0)
+    ,level(0)
+{
+}
+
+/**
+ * Drops any held over bits, as if the transmitter had just been keyed
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcEncoder::Reset() noexcept
+{
+    pendingBits = 0;
+    pendingCount = 0;
+}
+
+/**
+ * Encodes a frame, with its FCS, between flags
+ * @param frame the fragments of the frame, without FCS
+ * @param leadingFlags the number of flags to send before the frame. A frame which directly follows another
+ * may use 0, in which case the previous frame's closing flag also opens this one.
+ * @param output receives the line levels, least significant bit first
+ * @param outputLength the number of bytes available in output, which must be at least
+ * GetMaximumEncodedLength()
+ * @returns the number of bytes written to output, or 0 if output is too small
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG HdlcEncoder::EncodeFrame(
+    _In_ const FrameGatherList& frame,
+    _In_ ULONG leadingFlags,
+    _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+    _In_ ULONG outputLength) noexcept
+{
+    if (outputLength < GetMaximumEncodedLength(frame.GetTotalLength(), leadingFlags))
+    {
+        return 0;
+    }
+
+    BYTE* position = output;
+    for (ULONG i = 0; i < leadingFlags; i++)
+    {
+        appendFlag(position);
+    }
+
+    ULONG ones = 0;
+    for (ULONG i = 0; i < frame.GetFragmentCount(); i++)
+    {
+        stuff(frame[i].Data, frame[i].Length, position, ones);
+    }
+
+    BYTE fcs[Crc16::FCS_LENGTH];
+    Crc16::Write(Crc16::Compute(frame), fcs);
+    stuff(fcs, sizeof(fcs), position, ones);
+
+    appendFlag(position);
+    return static_cast<ULONG>(position - output);
+}
+
+/**
+ * Writes out any held over bits, padded to a whole byte with 0s. This should be called at the end of a
+ * transmission; the padding is ignored by receivers as noise between frames.
+ * @param output receives the line levels
+ * @param outputLength the number of bytes available in output
+ * @returns the number of bytes written to output, which is 0 or 1
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+ULONG HdlcEncoder::Flush(_Out_writes_bytes_to_(outputLength, return) BYTE* output, _In_ ULONG outputLength) noexcept
+{
+    if (pendingCount == 0 || outputLength == 0)
+    {
+        return 0;
+    }
+
+    pendingCount = 8;
+    writeFullBytes(output);
+    return 1;
+}
+
+/**
+ * Stuffs data bytes and writes out every whole byte of the result
+ * @param data the bytes to stuff
+ * @param length the number of bytes in data
+ * @param output the next byte of output, which is advanced past the bytes written
+ * @param ones the run of 1s sent so far in this frame, which is updated
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcEncoder::stuff(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Inout_ BYTE*& output, _Inout_ ULONG& ones) noexcept
+{
+    for (ULONG i = 0; i < length; i++)
+    {
+        const ULONG entry = STUFF[ones][data[i]];
+        pendingBits |= static_cast<ULONG64>(entry & ENTRY_BITS_MASK) << pendingCount;
+        pendingCount += (entry >> ENTRY_COUNT_SHIFT) & 0xFF;
+        ones = entry >> ENTRY_ONES_SHIFT;
+        writeFullBytes(output);
+    }
+}
+
+/**
+ * Appends a flag, which is never stuffed
+ * @param output the next byte of output, which is advanced past the bytes written
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcEncoder::appendFlag(_Inout_ BYTE*& output) noexcept
+{
+    pendingBits |= static_cast<ULONG64>(HdlcCodec::FLAG) << pendingCount;
+    pendingCount += 8;
+    writeFullBytes(output);
+}
+
+/**
+ * NRZI codes and writes out every whole byte of pending bits
+ * @param output the next byte of output, which is advanced past the bytes written
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcEncoder::writeFullBytes(_Inout_ BYTE*& output) noexcept
+{
+    while (pendingCount >= 8)
+    {
+        *output++ = HdlcCodec::EncodeNrzi(static_cast<BYTE>(pendingBits), level);
+        pendingBits >>= 8;
+        pendingCount -= 8;
+    }
+}
+
+/**
+ * Initializes a new decoder which is waiting for the first flag
+ */
+NON_PAGEABLE_FUNCTION
+HdlcDecoder::HdlcDecoder() noexcept
+    :hunting(true)
+    ,level(0)
+    ,ones(0)
+    ,pendingBits(0)
+    ,pendingCount(0)
+    ,bufferedLength(0)
+    ,frames(0)
+    ,fcsErrors(0)
+    ,discardedFrames(0)
+{
+}
+
+/**
+ * Discards any partially-received frame and waits for the next flag, as if the channel had just been
+ * opened. This should be called whenever the demodulator loses the signal.
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::Reset() noexcept
+{
+    hunting = true;
+    ones = 0;
+    pendingBits = 0;
+    pendingCount = 0;
+    bufferedLength = 0;
+}
+
+/**
+ * Decodes the next piece of the channel, calling the handler for every good frame completed by it
+ * @param levels the line levels from the demodulator, least significant bit first
+ * @param length the number of bytes in levels
+ * @param handler the handler to receive each good frame
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::Decode(
+    _In_reads_bytes_(length) const BYTE* levels,
+    _In_ ULONG length,
+    _Inout_ HdlcFrameHandler& handler) noexcept
+{
+    for (ULONG i = 0; i < length; i++)
+    {
+        const BYTE bits = HdlcCodec::DecodeNrzi(levels[i], level);
+        const ULONG entry = ones <= STUFFING_RUN ? UNSTUFF[ones][bits] : ENTRY_SPECIAL;
+        if ((entry & ENTRY_SPECIAL) != 0)
+        {
+            decodeBits(bits, handler);
+            continue;
+        }
+
+        ones = entry >> ENTRY_ONES_SHIFT;
+        if (!hunting)
+        {
+            pendingBits |= static_cast<ULONG64>(entry & ENTRY_BITS_MASK) << pendingCount;
+            pendingCount += (entry >> ENTRY_COUNT_SHIFT) & 0xFF;
+            storeFullBytes();
+        }
+    }
+}
+
+/**
+ * Decodes a byte of bits one at a time, for a byte which holds all or part of a flag or abort
+ * @param bits the data bits, least significant bit first
+ * @param handler the handler to receive a frame closed by a flag
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::decodeBits(_In_ ULONG bits, _Inout_ HdlcFrameHandler& handler) noexcept
+{
+    for (ULONG i = 0; i < 8; i++, bits >>= 1)
+    {
+        if ((bits & 1) != 0)
+        {
+            if (ones == STUFFING_RUN + 2)
+            {
+                continue;
+            }
+
+            ones++;
+            if (ones == STUFFING_RUN + 2)
+            {
+                // Seven 1s abort the frame
+                if (!hunting)
+                {
+                    discard();
+                }
+                continue;
+            }
+
+            if (ones == STUFFING_RUN + 1)
+            {
+                // Either a flag or an abort; the next bit says which
+                continue;
+            }
+        }
+        else
+        {
+            const ULONG run = ones;
+            ones = 0;
+            if (run == STUFFING_RUN + 1)
+            {
+                if (!hunting)
+                {
+                    endFrame(handler);
+                }
+                startFrame();
+                continue;
+            }
+
+            if (run == STUFFING_RUN)
+            {
+                // Stuffed by the sender
+                continue;
+            }
+        }
+
+        if (!hunting)
+        {
+            pendingBits |= static_cast<ULONG64>(bits & 1) << pendingCount;
+            pendingCount++;
+            storeFullBytes();
+        }
+    }
+}
+
+/**
+ * Moves every whole byte of pending bits into the frame buffer, discarding the frame if it is too long
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::storeFullBytes() noexcept
+{
+    while (pendingCount >= 8)
+    {
+        if (bufferedLength == sizeof(buffer))
+        {
+            discard();
+            return;
+        }
+
+        buffer[bufferedLength++] = static_cast<BYTE>(pendingBits);
+        pendingBits >>= 8;
+        pendingCount -= 8;
+    }
+}
+
+/**
+ * Checks the frame closed by a flag and hands it to the handler if its FCS is correct
+ * @param handler the handler to receive the frame
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::endFrame(_Inout_ HdlcFrameHandler& handler) noexcept
+{
+    // The 0 and five 1s which open the flag were collected as data before the flag was recognized. If the
+    // 0 was shared with the flag before, the frame is empty.
+    constexpr ULONG FLAG_BITS_COLLECTED = STUFFING_RUN + 1;
+    const ULONG totalBits = bufferedLength * 8 + pendingCount;
+    if (totalBits <= FLAG_BITS_COLLECTED)
+    {
+        // Back to back flags, which are idle time rather than a frame
+        return;
+    }
+
+    const ULONG frameBits = totalBits - FLAG_BITS_COLLECTED;
+    const ULONG frameLength = frameBits / 8;
+    if (frameBits % 8 != 0 || frameLength <= Crc16::FCS_LENGTH)
+    {
+        discardedFrames++;
+        return;
+    }
+
+    if (!Crc16::IsValid(buffer, frameLength))
+    {
+        fcsErrors++;
+        return;
+    }
+
+    frames++;
+    handler.HdlcFrameDecoded(buffer, frameLength - Crc16::FCS_LENGTH);
+}
+
+/**
+ * Begins collecting a new frame after a flag
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::startFrame() noexcept
+{
+    hunting = false;
+    pendingBits = 0;
+    pendingCount = 0;
+    bufferedLength = 0;
+}
+
+/**
+ * Drops the current frame and waits for the next flag
+ */
+NON_PAGEABLE_FUNCTION
+void HdlcDecoder::discard() noexcept
+{
+    discardedFrames++;
+    hunting = true;
+    pendingBits = 0;
+    pendingCount = 0;
+    bufferedLength = 0;
+}
@@ -0,0 +1,231 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HdlcCodec.h
+ * Definition of the HdlcEncoder and HdlcDecoder classes, which convert between AX.25 frames and the
+ * NRZI-coded, bit-stuffed HDLC bit stream sent by a soundcard modem.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "FrameGatherList.h"
+#include "Crc16.h"
+
+/**
+ * HDLC framing as used by AX.25 on the air. Each frame is followed by its FCS and sits between flags
+ * (01111110). Inside a frame, a 0 is inserted after every run of five 1s so that a flag can never appear
+ * in the data; seven or more 1s in a row abort the frame. The bits are then NRZI coded: a 0 is sent as a
+ * change of level and a 1 as no change.
+ *
+ * Bit streams are packed into bytes least significant bit first, which is the order the bits are sent in.
+ * Both directions work a byte of input at a time. Stuffing and unstuffing go through 256-entry tables, one
+ * for each possible number of 1s carried over from the previous byte, which give the output bits, how many
+ * there are, and the number of 1s to carry into the next byte. NRZI coding of a whole byte is a handful of
+ * shifts and XORs. Only a byte which contains part of a flag or abort is examined a bit at a time.
+ */
+class HdlcCodec
+{
+public:
+    static constexpr BYTE FLAG = 0x7E;                  //<! The flag pattern, which is the same in either bit order
+
+    /**
+     * Decodes one byte of NRZI-coded line levels into data bits
+     * @param levels the line level of each bit, least significant bit first
+     * @param previousLevel the level of the last bit before this byte, 0 or 1; receives the level of the
+     * last bit of this byte
+     * @returns the data bits, where 1 means the level did not change
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline BYTE DecodeNrzi(_In_ BYTE levels, _Inout_ ULONG& previousLevel) noexcept
+    {
+        const ULONG shifted = (static_cast<ULONG>(levels) << 1) | previousLevel;
+        previousLevel = levels >> 7;
+        return static_cast<BYTE>(~(levels ^ shifted));
+    }
+
+    /**
+     * Encodes one byte of data bits as NRZI line levels
+     * @param bits the data bits, least significant bit first
+     * @param previousLevel the level of the last bit before this byte, 0 or 1; receives the level of the
+     * last bit of this byte
+     * @returns the line level of each bit
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline BYTE EncodeNrzi(_In_ BYTE bits, _Inout_ ULONG& previousLevel) noexcept
+    {
+        // Each level is the previous level flipped once for every 0 up to and including this bit, which is a
+        // running XOR of the inverted bits
+        ULONG levels = static_cast<BYTE>(~bits);
+        levels ^= levels << 1;
+        levels ^= levels << 2;
+        levels ^= levels << 4;
+        levels = (levels ^ (0 - previousLevel)) & 0xFF;
+        previousLevel = levels >> 7;
+        return static_cast<BYTE>(levels);
+    }
+};
+
+/**
+ * Receives the frames produced by an HdlcDecoder
+ */
+class HdlcFrameHandler
+{
+public:
+    /**
+     * Called for each complete frame whose FCS is correct
+     * @param frame the frame contents, without the FCS. This memory is only valid for the duration of
+     * the call.
+     * @param length the number of bytes in frame
+     */
+    NON_PAGEABLE_FUNCTION
+    virtual void HdlcFrameDecoded(_In_reads_bytes_(length) const BYTE* frame, _In_ ULONG length) noexcept = 0;
+
+protected:
+    // Handlers are never destroyed through this interface
+    ~HdlcFrameHandler() = default;
+};
+
+/**
+ * Turns frames into a continuous HDLC bit stream. The FCS is computed and appended as the frame is encoded.
+ * Frames end on a flag, which does not generally end on a byte boundary, so up to seven bits are held over
+ * to the start of the next frame, or until Flush() pads them out.
+ *
+ * An encoder holds the state of one transmitter (the line level and the held over bits). It is not thread
+ * safe.
+ */
+class HdlcEncoder
+{
+public:
+    /**
+     * Computes the largest number of bytes EncodeFrame() can produce
+     * @param frameLength the number of bytes in the frame, without FCS
+     * @param leadingFlags the number of flags to send before the frame
+     * @returns the worst case encoded length, which is reached when every byte needs stuffing
+     */
+    NON_PAGEABLE_FUNCTION
+    static constexpr ULONG GetMaximumEncodedLength(_In_ ULONG frameLength, _In_ ULONG leadingFlags) noexcept
+    {
+        // One stuffed bit for every five data bits, the closing flag, and up to seven held over bits
+        return ((frameLength + Crc16::FCS_LENGTH) * 8 * 6 / 5 + (leadingFlags + 1) * 8 + 7 + 7) / 8;
+    }
+
+    NON_PAGEABLE_FUNCTION
+    HdlcEncoder() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG EncodeFrame(
+        _In_ const FrameGatherList& frame,
+        _In_ ULONG leadingFlags,
+        _Out_writes_bytes_to_(outputLength, return) BYTE* output,
+        _In_ ULONG outputLength) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    ULONG Flush(_Out_writes_bytes_to_(outputLength, return) BYTE* output, _In_ ULONG outputLength) noexcept;
+
+private:
+    ULONG64 pendingBits;    //<! Encoded bits not yet written out, least significant first
+    ULONG pendingCount;     //<! Number of bits in pendingBits
+    ULONG level;            //<! Line level of the last bit written out
+
+    NON_PAGEABLE_FUNCTION
+    void stuff(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Inout_ BYTE*& output, _Inout_ ULONG& ones) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void appendFlag(_Inout_ BYTE*& output) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void writeFullBytes(_Inout_ BYTE*& output) noexcept;
+};
+
+/**
+ * Incremental HDLC decoder. Line levels are fed in whatever pieces the modem produces them in, and each
+ * frame with a correct FCS is handed to an HdlcFrameHandler as soon as its closing flag arrives.
+ *
+ * A decoder holds the state of one channel. It is not thread safe; each channel should have its own
+ * decoder, which is small enough to keep one per demodulator.
+ */
+class HdlcDecoder
+{
+public:
+    /** The largest frame, excluding the FCS, that the decoder will assemble */
+    static constexpr ULONG MAX_FRAME_LENGTH = 1024;
+
+    NON_PAGEABLE_FUNCTION
+    HdlcDecoder() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Decode(
+        _In_reads_bytes_(length) const BYTE* levels,
+        _In_ ULONG length,
+        _Inout_ HdlcFrameHandler& handler) noexcept;
+
+    /** @returns the number of frames passed to the handler */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetFrameCount() const noexcept { return frames; }
+
+    /** @returns the number of frames discarded because their FCS was wrong */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetFcsErrorCount() const noexcept { return fcsErrors; }
+
+    /**
+     * @returns the number of frames discarded for being aborted, too long, too short to hold an FCS, or not
+     * a whole number of bytes
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetDiscardedFrameCount() const noexcept { return discardedFrames; }
+
+private:
+    bool hunting;                   //<! True until the next flag; bits are not being collected
+    ULONG level;                    //<! Line level of the last bit received
+    ULONG ones;                     //<! Run of 1s received so far, up to 7
+    ULONG64 pendingBits;            //<! Unstuffed bits not yet stored in buffer, least significant first
+    ULONG pendingCount;             //<! Number of bits in pendingBits
+    ULONG bufferedLength;           //<! Number of bytes of the current frame held in buffer
+    ULONG64 frames;                 //<! Frames delivered
+    ULONG64 fcsErrors;              //<! Frames discarded for a bad FCS
+    ULONG64 discardedFrames;        //<! Frames discarded for any other reason
+
+    /** Storage for the frame being received, with its FCS */
+    BYTE buffer[MAX_FRAME_LENGTH + Crc16::FCS_LENGTH];
+
+    NON_PAGEABLE_FUNCTION
+    void decodeBits(_In_ ULONG bits, _Inout_ HdlcFrameHandler& handler) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void storeFullBytes() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void endFrame(_Inout_ HdlcFrameHandler& handler) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void startFrame() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void discard() noexcept;
+};
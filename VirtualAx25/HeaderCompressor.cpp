@@ -0,0 +1,814 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderCompressor.cpp
+ * Implementation of the HeaderCompressor, HeaderDecompressor and HeaderCompressionTable classes.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "HeaderCompressor.h"
+
+/** Bits of the change mask at the start of a compressed datagram (RFC 1144 section 3.2.2) */
+static constexpr BYTE TYPE_COMPRESSED_TCP = 0x80;   //<! Set in every compressed datagram, as on SLIP
+static constexpr BYTE NEW_C = 0x40;                 //<! The slot number follows the change mask
+static constexpr BYTE NEW_I = 0x20;                 //<! The IP identification did not go up by 1
+static constexpr BYTE TCP_PUSH_BIT = 0x10;          //<! PSH is set
+static constexpr BYTE NEW_S = 0x08;                 //<! The sequence number changed
+static constexpr BYTE NEW_A = 0x04;                 //<! The acknowledgement number changed
+static constexpr BYTE NEW_W = 0x02;                 //<! The window changed
+static constexpr BYTE NEW_U = 0x01;                 //<! URG is set, and the urgent pointer follows
+static constexpr BYTE SPECIALS_MASK = NEW_S | NEW_A | NEW_W | NEW_U;
+static constexpr BYTE SPECIAL_I = NEW_S | NEW_W | NEW_U;            //<! Echoed interactive traffic
+static constexpr BYTE SPECIAL_D = NEW_S | NEW_A | NEW_W | NEW_U;    //<! Unidirectional data
+
+/** Offsets and values in the IP and TCP headers */
+static constexpr ULONG IP_MIN_HEADER_LENGTH = 20;
+static constexpr ULONG IP_TOTAL_LENGTH = 2;
+static constexpr ULONG IP_IDENTIFICATION = 4;
+static constexpr ULONG IP_FRAGMENT = 6;
+static constexpr ULONG IP_PROTOCOL = 9;
+static constexpr ULONG IP_CHECKSUM = 10;
+static constexpr ULONG IP_ADDRESSES = 12;
+static constexpr ULONG IP_ADDRESSES_LENGTH = 8;
+static constexpr USHORT IP_FRAGMENT_MASK = 0x3FFF;
+static constexpr BYTE IPPROTO_TCP_VALUE = 6;
+static constexpr ULONG TCP_MIN_HEADER_LENGTH = 20;
+static constexpr ULONG TCP_SEQUENCE = 4;
+static constexpr ULONG TCP_ACKNOWLEDGEMENT = 8;
+static constexpr ULONG TCP_OFFSET = 12;
+static constexpr ULONG TCP_FLAGS = 13;
+static constexpr ULONG TCP_WINDOW = 14;
+static constexpr ULONG TCP_CHECKSUM = 16;
+static constexpr ULONG TCP_URGENT = 18;
+static constexpr BYTE TCP_FIN = 0x01;
+static constexpr BYTE TCP_SYN = 0x02;
+static constexpr BYTE TCP_RST = 0x04;
+static constexpr BYTE TCP_PSH = 0x08;
+static constexpr BYTE TCP_ACK = 0x10;
+static constexpr BYTE TCP_URG = 0x20;
+
+/** Longest run of differences: the urgent pointer, window, acknowledgement, sequence and identification */
+static constexpr ULONG MAX_DELTA_LENGTH = 5 * 3;
+
+/** PID of a datagram sent unchanged */
+static constexpr BYTE PID_IPV4 = 0xCC;
+
+/** Marks lastSent and lastReceived before any slot has been named */
+static constexpr ULONG NO_SLOT = HeaderCompressor::SLOT_COUNT;
+
+/** Reads a 16-bit field in network byte order */
+NON_PAGEABLE_FUNCTION
+static inline USHORT readShort(_In_reads_bytes_(2) const BYTE* field) noexcept
+{
+    return static_cast<USHORT>((field[0] << 8) | field[1]);
+}
+
+/** Reads a 32-bit field in network byte order */
+NON_PAGEABLE_FUNCTION
+static inline ULONG readLong(_In_reads_bytes_(4) const BYTE* field) noexcept
+{
+    return (static_cast<ULONG>(field[0]) << 24) | (static_cast<ULONG>(field[1]) << 16) |
+           (static_cast<ULONG>(field[2]) << 8) | field[3];
+}
+
+/** Writes the low 16 bits of a value to a field in network byte order */
+NON_PAGEABLE_FUNCTION
+static inline void writeShort(_Out_writes_bytes_(2) BYTE* field, _In_ ULONG value) noexcept
+{
+    field[0] = static_cast<BYTE>(value >> 8);
+    field[1] = static_cast<BYTE>(value);
+}
+
+/** Writes a 32-bit field in network byte order */
+NON_PAGEABLE_FUNCTION
+static inline void writeLong(_Out_writes_bytes_(4) BYTE* field, _In_ ULONG value) noexcept
+{
+    field[0] = static_cast<BYTE>(value >> 24);
+    field[1] = static_cast<BYTE>(value >> 16);
+    field[2] = static_cast<BYTE>(value >> 8);
+    field[3] = static_cast<BYTE>(value);
+}
+
+/**
+ * Appends a difference to a compressed header: 1 byte if it is from 1 to 255, or a 0 followed by 2 bytes
+ * otherwise
+ * @param delta the difference, which must fit in 16 bits
+ * @param output the compressed header
+ * @param length the number of bytes in output, which is advanced
+ */
+NON_PAGEABLE_FUNCTION
+static inline void encodeDelta(_In_ ULONG delta, _Inout_updates_bytes_(MAX_DELTA_LENGTH) BYTE* output, _Inout_ ULONG& length) noexcept
+{
+    ASSERT(delta <= MAXUSHORT);
+    if (delta == 0 || delta > MAXUCHAR)
+    {
+        output[length] = 0;
+        writeShort(output + length + 1, delta);
+        length += 3;
+    }
+    else
+    {
+        output[length++] = static_cast<BYTE>(delta);
+    }
+}
+
+/**
+ * Reads a difference written by encodeDelta()
+ * @param packet the compressed header
+ * @param length the number of bytes in packet
+ * @param cursor the offset of the difference, which is advanced past it
+ * @param delta receives the difference
+ * @returns false if packet ends before the difference does
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+static inline bool decodeDelta(
+    _In_reads_bytes_(length) const BYTE* packet,
+    _In_ ULONG length,
+    _Inout_ ULONG& cursor,
+    _Out_ ULONG& delta) noexcept
+{
+    delta = 0;
+    if (cursor >= length)
+    {
+        return false;
+    }
+
+    if (packet[cursor] != 0)
+    {
+        delta = packet[cursor++];
+        return true;
+    }
+
+    if (length - cursor < 3)
+    {
+        return false;
+    }
+    delta = readShort(packet + cursor + 1);
+    cursor += 3;
+    return true;
+}
+
+/**
+ * Computes the checksum of an IP header
+ * @param header the header, whose checksum field is taken to be zero
+ * @param length the number of bytes in header, which is even
+ * @returns the checksum
+ */
+NON_PAGEABLE_FUNCTION
+static USHORT ipChecksum(_In_reads_bytes_(length) const BYTE* header, _In_ ULONG length) noexcept
+{
+    ULONG sum = 0;
+    for (ULONG i = 0; i < length; i += 2)
+    {
+        sum += (i == IP_CHECKSUM) ? 0 : readShort(header + i);
+    }
+    while ((sum >> 16) != 0)
+    {
+        sum = (sum & MAXUSHORT) + (sum >> 16);
+    }
+    return static_cast<USHORT>(~sum);
+}
+
+/**
+ * Finds the length of the IP and TCP header at the start of a datagram
+ * @param datagram the datagram
+ * @param length the number of bytes in datagram
+ * @returns the length of the header, or 0 if datagram does not start with a whole IPv4 and TCP header no
+ * longer than MAX_HEADER_LENGTH
+ */
+NON_PAGEABLE_FUNCTION
+static ULONG getHeaderLength(_In_reads_bytes_(length) const BYTE* datagram, _In_ ULONG length) noexcept
+{
+    if (length < IP_MIN_HEADER_LENGTH + TCP_MIN_HEADER_LENGTH || (datagram[0] >> 4) != 4)
+    {
+        return 0;
+    }
+
+    const ULONG ipLength = (datagram[0] & 0x0F) * 4U;
+    if (ipLength < IP_MIN_HEADER_LENGTH || ipLength + TCP_MIN_HEADER_LENGTH > length)
+    {
+        return 0;
+    }
+
+    const ULONG headerLength = ipLength + (datagram[ipLength + TCP_OFFSET] >> 4) * 4U;
+    if (headerLength < ipLength + TCP_MIN_HEADER_LENGTH || headerLength > length ||
+        headerLength > HeaderCompressor::MAX_HEADER_LENGTH)
+    {
+        return 0;
+    }
+    return headerLength;
+}
+
+/**
+ * Initializes a new compressor with no connections
+ */
+NON_PAGEABLE_FUNCTION
+HeaderCompressor::HeaderCompressor() noexcept
+{
+    Reset();
+    RtlZeroMemory(&counters, sizeof(counters));
+}
+
+/**
+ * Forgets every connection, so that the next datagram of each is sent whole. Counters are kept.
+ */
+NON_PAGEABLE_FUNCTION
+void HeaderCompressor::Reset() noexcept
+{
+    for (ULONG i = 0; i < SLOT_COUNT; i++)
+    {
+        slots[i].lastUsed = 0;
+        slots[i].headerLength = 0;
+    }
+    clock = 0;
+    lastSent = NO_SLOT;
+}
+
+/**
+ * Compresses the header of a datagram in place, if it is a TCP/IP datagram which can be compressed
+ * @param datagram the IPv4 datagram, which is rewritten if it is TCP
+ * @param length the number of bytes in datagram
+ * @param offset receives the offset in datagram of what is to be sent, which ends where datagram does
+ * @returns the PID to send datagram + offset with: PID_COMPRESSED_TCP, PID_UNCOMPRESSED_TCP, or the PID of
+ * IPv4 if the datagram is sent unchanged
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+BYTE HeaderCompressor::Compress(_Inout_updates_bytes_(length) BYTE* datagram, _In_ ULONG length, _Out_ ULONG& offset) noexcept
+{
+    offset = 0;
+
+    // Only whole TCP segments which carry nothing but data and acknowledgements are compressed
+    const ULONG headerLength = getHeaderLength(datagram, length);
+    if (headerLength == 0 ||
+        datagram[IP_PROTOCOL] != IPPROTO_TCP_VALUE ||
+        (readShort(datagram + IP_FRAGMENT) & IP_FRAGMENT_MASK) != 0 ||
+        readShort(datagram + IP_TOTAL_LENGTH) != length)
+    {
+        return PID_IPV4;
+    }
+
+    const ULONG ipLength = (datagram[0] & 0x0F) * 4U;
+    const BYTE* tcp = datagram + ipLength;
+    if ((tcp[TCP_FLAGS] & (TCP_SYN | TCP_FIN | TCP_RST | TCP_ACK)) != TCP_ACK)
+    {
+        return PID_IPV4;
+    }
+
+    // Find the connection's slot, or take over the least recently used one
+    Slot* slot = nullptr;
+    Slot* oldest = &slots[0];
+    for (ULONG i = 0; i < SLOT_COUNT && slot == nullptr; i++)
+    {
+        const Slot& candidate = slots[i];
+        const ULONG candidateIpLength = (candidate.header[0] & 0x0F) * 4U;
+        if (candidate.headerLength != 0 &&
+            RtlCompareMemory(candidate.header + IP_ADDRESSES, datagram + IP_ADDRESSES, IP_ADDRESSES_LENGTH) == IP_ADDRESSES_LENGTH &&
+            readLong(candidate.header + candidateIpLength) == readLong(tcp))
+        {
+            slot = &slots[i];
+        }
+        oldest = (slots[i].lastUsed < oldest->lastUsed) ? &slots[i] : oldest;
+    }
+
+    const bool found = slot != nullptr;
+    slot = found ? slot : oldest;
+    slot->lastUsed = ++clock;
+    const ULONG slotNumber = static_cast<ULONG>(slot - slots);
+
+    BYTE changes = 0;
+    BYTE deltas[MAX_DELTA_LENGTH];
+    ULONG deltaLength = 0;
+    bool sendWhole = !found;
+    const BYTE* old = slot->header;
+    const BYTE* oldTcp = old + ipLength;
+
+    // Anything which the decompressor takes from its copy of the header must not have changed: the version,
+    // header length and type of service, fragment field, TTL and protocol, options, and TCP flags other than
+    // PSH and URG
+    if (!sendWhole &&
+        (slot->headerLength != headerLength ||
+         readShort(old) != readShort(datagram) ||
+         readLong(old + IP_FRAGMENT) != readLong(datagram + IP_FRAGMENT) ||
+         old[ipLength + TCP_OFFSET] != tcp[TCP_OFFSET] ||
+         (old[ipLength + TCP_FLAGS] & ~(TCP_PSH | TCP_URG)) != (tcp[TCP_FLAGS] & ~(TCP_PSH | TCP_URG)) ||
+         RtlCompareMemory(old + IP_MIN_HEADER_LENGTH, datagram + IP_MIN_HEADER_LENGTH, ipLength - IP_MIN_HEADER_LENGTH) != ipLength - IP_MIN_HEADER_LENGTH ||
+         RtlCompareMemory(oldTcp + TCP_MIN_HEADER_LENGTH, tcp + TCP_MIN_HEADER_LENGTH, headerLength - ipLength - TCP_MIN_HEADER_LENGTH) !=
+             headerLength - ipLength - TCP_MIN_HEADER_LENGTH))
+    {
+        sendWhole = true;
+    }
+
+    if (!sendWhole)
+    {
+        if ((tcp[TCP_FLAGS] & TCP_URG) != 0)
+        {
+            encodeDelta(readShort(tcp + TCP_URGENT), deltas, deltaLength);
+            changes |= NEW_U;
+        }
+        else if (readShort(tcp + TCP_URGENT) != readShort(oldTcp + TCP_URGENT))
+        {
+            sendWhole = true;
+        }
+
+        const ULONG window = static_cast<USHORT>(readShort(tcp + TCP_WINDOW) - readShort(oldTcp + TCP_WINDOW));
+        if (window != 0)
+        {
+            encodeDelta(window, deltas, deltaLength);
+            changes |= NEW_W;
+        }
+
+        const ULONG acknowledgement = readLong(tcp + TCP_ACKNOWLEDGEMENT) - readLong(oldTcp + TCP_ACKNOWLEDGEMENT);
+        if (acknowledgement > MAXUSHORT)
+        {
+            sendWhole = true;
+        }
+        else if (acknowledgement != 0)
+        {
+            encodeDelta(acknowledgement, deltas, deltaLength);
+            changes |= NEW_A;
+        }
+
+        const ULONG sequence = readLong(tcp + TCP_SEQUENCE) - readLong(oldTcp + TCP_SEQUENCE);
+        if (sequence > MAXUSHORT)
+        {
+            sendWhole = true;
+        }
+        else if (sequence != 0)
+        {
+            encodeDelta(sequence, deltas, deltaLength);
+            changes |= NEW_S;
+        }
+
+        const ULONG lastDataLength = readShort(old + IP_TOTAL_LENGTH) - slot->headerLength;
+        switch (changes)
+        {
+        case 0:
+            // Only new data after a bare acknowledgement can leave every field alone; anything else is a
+            // retransmission, which is sent whole in case the last datagram never arrived
+            sendWhole = sendWhole || readShort(old + IP_TOTAL_LENGTH) == length || lastDataLength != 0;
+            break;
+
+        case SPECIAL_I:
+        case SPECIAL_D:
+            // These changes would be mistaken for the special cases below
+            sendWhole = true;
+            break;
+
+        case NEW_S | NEW_A:
+            if (sequence == acknowledgement && sequence == lastDataLength)
+            {
+                changes = SPECIAL_I;
+                deltaLength = 0;
+            }
+            break;
+
+        case NEW_S:
+            if (sequence == lastDataLength)
+            {
+                changes = SPECIAL_D;
+                deltaLength = 0;
+            }
+            break;
+        }
+    }
+
+    if (sendWhole)
+    {
+        RtlCopyMemory(slot->header, datagram, headerLength);
+        slot->headerLength = headerLength;
+        datagram[IP_PROTOCOL] = static_cast<BYTE>(slotNumber);
+        lastSent = slotNumber;
+        counters.Uncompressed++;
+        return PID_UNCOMPRESSED_TCP;
+    }
+
+    const ULONG identification = static_cast<USHORT>(readShort(datagram + IP_IDENTIFICATION) - readShort(old + IP_IDENTIFICATION));
+    if (identification != 1)
+    {
+        encodeDelta(identification, deltas, deltaLength);
+        changes |= NEW_I;
+    }
+    if ((tcp[TCP_FLAGS] & TCP_PSH) != 0)
+    {
+        changes |= TCP_PUSH_BIT;
+    }
+
+    // The checksum is sent as it is, so that the receiving TCP can tell if the header was rebuilt wrongly
+    const USHORT checksum = readShort(tcp + TCP_CHECKSUM);
+    RtlCopyMemory(slot->header, datagram, headerLength);
+
+    const bool nameSlot = lastSent != slotNumber;
+    const ULONG compressedLength = 1 + (nameSlot ? 1 : 0) + 2 + deltaLength;
+    offset = headerLength - compressedLength;
+    BYTE* output = datagram + offset;
+    *output++ = static_cast<BYTE>(TYPE_COMPRESSED_TCP | changes | (nameSlot ? NEW_C : 0));
+    if (nameSlot)
+    {
+        *output++ = static_cast<BYTE>(slotNumber);
+    }
+    writeShort(output, checksum);
+    RtlCopyMemory(output + 2, deltas, deltaLength);
+
+    lastSent = slotNumber;
+    counters.Compressed++;
+    counters.BytesSaved += offset;
+    return PID_COMPRESSED_TCP;
+}
+
+/**
+ * Initializes a new decompressor with no connections
+ */
+NON_PAGEABLE_FUNCTION
+HeaderDecompressor::HeaderDecompressor() noexcept
+{
+    Reset();
+    RtlZeroMemory(&counters, sizeof(counters));
+}
+
+/**
+ * Forgets every connection, so that compressed datagrams are dropped until each is received whole again.
+ * Counters are kept.
+ */
+NON_PAGEABLE_FUNCTION
+void HeaderDecompressor::Reset() noexcept
+{
+    for (ULONG i = 0; i < HeaderCompressor::SLOT_COUNT; i++)
+    {
+        slots[i].headerLength = 0;
+    }
+    lastReceived = NO_SLOT;
+    tossing = false;
+}
+
+/**
+ * Restores the header of a datagram received with PID_COMPRESSED_TCP or PID_UNCOMPRESSED_TCP, in place
+ * @param pid the PID the datagram was received with
+ * @param packet the datagram as received, which is replaced by the IPv4 datagram
+ * @param length the number of bytes received at packet
+ * @param capacity the number of bytes the IPv4 datagram may take up at packet
+ * @returns the length of the IPv4 datagram, or 0 if it could not be restored and should be dropped
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG HeaderDecompressor::Decompress(
+    _In_ BYTE pid,
+    _Inout_updates_bytes_(capacity) BYTE* packet,
+    _In_ ULONG length,
+    _In_ ULONG capacity) noexcept
+{
+    ASSERT(length <= capacity);
+    if (pid == HeaderCompressor::PID_UNCOMPRESSED_TCP)
+    {
+        // The datagram is whole but for its protocol, which names the slot to refresh
+        const ULONG headerLength = getHeaderLength(packet, length);
+        const ULONG slotNumber = packet[IP_PROTOCOL];
+        if (headerLength == 0 || slotNumber >= HeaderCompressor::SLOT_COUNT)
+        {
+            tossing = true;
+            counters.Dropped++;
+            return 0;
+        }
+
+        packet[IP_PROTOCOL] = IPPROTO_TCP_VALUE;
+        RtlCopyMemory(slots[slotNumber].header, packet, headerLength);
+        slots[slotNumber].headerLength = headerLength;
+        lastReceived = slotNumber;
+        tossing = false;
+        counters.Uncompressed++;
+        return length;
+    }
+
+    if (pid != HeaderCompressor::PID_COMPRESSED_TCP || length == 0)
+    {
+        tossing = true;
+        counters.Dropped++;
+        return 0;
+    }
+
+    ULONG cursor = 0;
+    const BYTE changes = packet[cursor++];
+
+    if ((changes & NEW_C) != 0)
+    {
+        if (cursor >= length || packet[cursor] >= HeaderCompressor::SLOT_COUNT)
+        {
+            tossing = true;
+            counters.Dropped++;
+            return 0;
+        }
+        lastReceived = packet[cursor++];
+        tossing = false;
+    }
+
+    if (tossing || lastReceived == NO_SLOT || slots[lastReceived].headerLength == 0 || length - cursor < 2)
+    {
+        tossing = true;
+        counters.Dropped++;
+        return 0;
+    }
+
+    // The header is rebuilt in a copy, so that the slot is left alone if the datagram turns out to be malformed
+    Slot& slot = slots[lastReceived];
+    const ULONG headerLength = slot.headerLength;
+    const ULONG ipLength = (slot.header[0] & 0x0F) * 4U;
+    const ULONG lastDataLength = readShort(slot.header + IP_TOTAL_LENGTH) - headerLength;
+    BYTE header[HeaderCompressor::MAX_HEADER_LENGTH];
+    RtlCopyMemory(header, slot.header, headerLength);
+    BYTE* tcp = header + ipLength;
+
+    RtlCopyMemory(tcp + TCP_CHECKSUM, packet + cursor, 2);
+    cursor += 2;
+    tcp[TCP_FLAGS] = static_cast<BYTE>(((changes & TCP_PUSH_BIT) != 0) ? (tcp[TCP_FLAGS] | TCP_PSH) : (tcp[TCP_FLAGS] & ~TCP_PSH));
+
+    bool valid = true;
+    ULONG delta = 0;
+    switch (changes & SPECIALS_MASK)
+    {
+    case SPECIAL_I:
+        writeLong(tcp + TCP_ACKNOWLEDGEMENT, readLong(tcp + TCP_ACKNOWLEDGEMENT) + lastDataLength);
+        writeLong(tcp + TCP_SEQUENCE, readLong(tcp + TCP_SEQUENCE) + lastDataLength);
+        break;
+
+    case SPECIAL_D:
+        writeLong(tcp + TCP_SEQUENCE, readLong(tcp + TCP_SEQUENCE) + lastDataLength);
+        break;
+
+    default:
+        if ((changes & NEW_U) != 0)
+        {
+            tcp[TCP_FLAGS] |= TCP_URG;
+            valid = decodeDelta(packet, length, cursor, delta);
+            writeShort(tcp + TCP_URGENT, delta);
+        }
+        else
+        {
+            tcp[TCP_FLAGS] &= ~TCP_URG;
+        }
+        if (valid && (changes & NEW_W) != 0)
+        {
+            valid = decodeDelta(packet, length, cursor, delta);
+            writeShort(tcp + TCP_WINDOW, readShort(tcp + TCP_WINDOW) + delta);
+        }
+        if (valid && (changes & NEW_A) != 0)
+        {
+            valid = decodeDelta(packet, length, cursor, delta);
+            writeLong(tcp + TCP_ACKNOWLEDGEMENT, readLong(tcp + TCP_ACKNOWLEDGEMENT) + delta);
+        }
+        if (valid && (changes & NEW_S) != 0)
+        {
+            valid = decodeDelta(packet, length, cursor, delta);
+            writeLong(tcp + TCP_SEQUENCE, readLong(tcp + TCP_SEQUENCE) + delta);
+        }
+        break;
+    }
+
+    delta = 1;
+    if (valid && (changes & NEW_I) != 0)
+    {
+        valid = decodeDelta(packet, length, cursor, delta);
+    }
+    writeShort(header + IP_IDENTIFICATION, readShort(header + IP_IDENTIFICATION) + delta);
+
+    const ULONG dataLength = length - cursor;
+    const ULONG datagramLength = headerLength + dataLength;
+    if (!valid || datagramLength > capacity || datagramLength > MAXUSHORT)
+    {
+        tossing = true;
+        counters.Dropped++;
+        return 0;
+    }
+
+    writeShort(header + IP_TOTAL_LENGTH, datagramLength);
+    writeShort(header + IP_CHECKSUM, ipChecksum(header, ipLength));
+    RtlCopyMemory(slot.header, header, headerLength);
+
+    RtlMoveMemory(packet + headerLength, packet + cursor, dataLength);
+    RtlCopyMemory(packet, header, headerLength);
+    counters.Decompressed++;
+    return datagramLength;
+}
+
+/**
+ * Allocates the table. This must be called once, before anything is compressed.
+ * @param handle the NDIS handle with which to allocate the table
+ * @param peerCount the most peers whose state is kept at once
+ * @param compressionMode when datagrams are compressed, which must not be Disabled
+ * @returns NDIS_STATUS_SUCCESS if the table was allocated, or NDIS_STATUS_RESOURCES otherwise
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+_Must_inspect_result_
+PAGEABLE_FUNCTION
+NDIS_STATUS HeaderCompressionTable::Allocate(_In_ NDIS_HANDLE handle, _In_ ULONG peerCount, _In_ Mode compressionMode) noexcept
+{
+    ASSERT(peers == nullptr);
+    ASSERT(compressionMode != Disabled);
+    const ULONG64 size = static_cast<ULONG64>(peerCount) * sizeof(Peer);
+    if (peerCount == 0 || size > MAXUINT)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    void* allocation = NdisAllocateMemoryWithTagPriority(handle, static_cast<UINT>(size), HEADER_COMPRESSION_TAG, NormalPoolPriority);
+    if (allocation == nullptr)
+    {
+        return NDIS_STATUS_RESOURCES;
+    }
+
+    // Entries are set up by open() as they are used
+    RtlZeroMemory(allocation, static_cast<size_t>(size));
+    ndisHandle = handle;
+    peers = static_cast<Peer*>(allocation);
+    capacity = peerCount;
+    mode = compressionMode;
+    return NDIS_STATUS_SUCCESS;
+}
+
+/**
+ * Releases the table. Nothing may be compressed afterwards.
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void HeaderCompressionTable::Free() noexcept
+{
+    if (peers != nullptr)
+    {
+        NdisFreeMemoryWithTagPriority(ndisHandle, peers, HEADER_COMPRESSION_TAG);
+        peers = nullptr;
+        capacity = 0;
+    }
+}
+
+/**
+ * Compresses the header of a datagram to a peer in place, if the mode calls for it
+ * @param local this station
+ * @param peer the station the datagram is sent to
+ * @param datagram the IPv4 datagram, which is rewritten if it is compressed
+ * @param length the number of bytes in datagram
+ * @param offset receives the offset in datagram of what is to be sent, which ends where datagram does
+ * @returns the PID to send datagram + offset with
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+BYTE HeaderCompressionTable::Compress(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _Inout_updates_bytes_(length) BYTE* datagram,
+    _In_ ULONG length,
+    _Out_ ULONG& offset) noexcept
+{
+    ASSERT(peers != nullptr);
+    Peer* entry = find(local, peer);
+    if (mode == Automatic && (entry == nullptr || !entry->compresses))
+    {
+        offset = 0;
+        return PID_IPV4;
+    }
+
+    entry = (entry != nullptr) ? entry : &open(local, peer);
+    return entry->compressor.Compress(datagram, length, offset);
+}
+
+/**
+ * Restores the header of a datagram received from a peer with HeaderCompressor::PID_COMPRESSED_TCP or
+ * HeaderCompressor::PID_UNCOMPRESSED_TCP, in place
+ * @param local this station
+ * @param peer the station the datagram came from
+ * @param pid the PID the datagram was received with
+ * @param packet the datagram as received, which is replaced by the IPv4 datagram
+ * @param length the number of bytes received at packet
+ * @param capacity the number of bytes the IPv4 datagram may take up at packet
+ * @returns the length of the IPv4 datagram, or 0 if it could not be restored and should be dropped
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG HeaderCompressionTable::Decompress(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _In_ BYTE pid,
+    _Inout_updates_bytes_(capacity) BYTE* packet,
+    _In_ ULONG length,
+    _In_ ULONG capacity) noexcept
+{
+    ASSERT(peers != nullptr);
+    Peer* entry = find(local, peer);
+    entry = (entry != nullptr) ? entry : &open(local, peer);
+    const ULONG datagramLength = entry->decompressor.Decompress(pid, packet, length, capacity);
+    entry->compresses = entry->compresses || datagramLength != 0;
+    return datagramLength;
+}
+
+/**
+ * Fills in statistics about the table, for OID_AX25_HEADER_COMPRESSION_STATISTICS
+ * @param statistics receives the statistics
+ */
+NON_PAGEABLE_FUNCTION
+void HeaderCompressionTable::GetStatistics(_Out_ AX25_HEADER_COMPRESSION_STATISTICS& statistics) const noexcept
+{
+    statistics.Mode = mode;
+    statistics.Peers = 0;
+    statistics.PacketsCompressed = retired.compressor.Compressed;
+    statistics.PacketsUncompressed = retired.compressor.Uncompressed;
+    statistics.BytesSaved = retired.compressor.BytesSaved;
+    statistics.PacketsDecompressed = retired.decompressor.Decompressed;
+    statistics.PacketsRefreshed = retired.decompressor.Uncompressed;
+    statistics.PacketsDropped = retired.decompressor.Dropped;
+    for (ULONG i = 0; i < capacity; i++)
+    {
+        if (peers[i].inUse)
+        {
+            const HeaderCompressor::Counters& sent = peers[i].compressor.GetCounters();
+            const HeaderDecompressor::Counters& received = peers[i].decompressor.GetCounters();
+            statistics.Peers++;
+            statistics.PacketsCompressed += sent.Compressed;
+            statistics.PacketsUncompressed += sent.Uncompressed;
+            statistics.BytesSaved += sent.BytesSaved;
+            statistics.PacketsDecompressed += received.Decompressed;
+            statistics.PacketsRefreshed += received.Uncompressed;
+            statistics.PacketsDropped += received.Dropped;
+        }
+    }
+}
+
+/**
+ * Finds the entry for a callsign pair
+ * @param local this station
+ * @param peer the peer
+ * @returns the entry, or nullptr if there is none
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+HeaderCompressionTable::Peer* HeaderCompressionTable::find(_In_ const AX25Address& local, _In_ const AX25Address& peer) noexcept
+{
+    for (ULONG i = 0; i < capacity; i++)
+    {
+        if (peers[i].inUse && peers[i].local == local && peers[i].peer == peer)
+        {
+            peers[i].lastUsed = ++clock;
+            return &peers[i];
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Sets up an entry for a callsign pair which has none, replacing the least recently used entry if every one
+ * is in use
+ * @param local this station
+ * @param peer the peer
+ * @returns the entry
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+HeaderCompressionTable::Peer& HeaderCompressionTable::open(_In_ const AX25Address& local, _In_ const AX25Address& peer) noexcept
+{
+    Peer* entry = &peers[0];
+    for (ULONG i = 0; i < capacity; i++)
+    {
+        if (!peers[i].inUse)
+        {
+            entry = &peers[i];
+            break;
+        }
+        entry = (peers[i].lastUsed < entry->lastUsed) ? &peers[i] : entry;
+    }
+
+    if (entry->inUse)
+    {
+        const HeaderCompressor::Counters& sent = entry->compressor.GetCounters();
+        const HeaderDecompressor::Counters& received = entry->decompressor.GetCounters();
+        retired.compressor.Compressed += sent.Compressed;
+        retired.compressor.Uncompressed += sent.Uncompressed;
+        retired.compressor.BytesSaved += sent.BytesSaved;
+        retired.decompressor.Decompressed += received.Decompressed;
+        retired.decompressor.Uncompressed += received.Uncompressed;
+        retired.decompressor.Dropped += received.Dropped;
+    }
+
+    // Entries are zeroed memory until first used, so they are built here rather than merely reset
+    new (&entry->compressor) HeaderCompressor();
+    new (&entry->decompressor) HeaderDecompressor();
+    entry->inUse = true;
+    entry->compresses = false;
+    entry->local = local;
+    entry->peer = peer;
+    entry->lastUsed = ++clock;
+    return *entry;
+}
@@ -0,0 +1,246 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderCompressor.h
+ * Definition of the HeaderCompressor and HeaderDecompressor classes, which compress the headers of TCP/IP
+ * datagrams as described in RFC 1144 (Van Jacobson), and of the HeaderCompressionTable which keeps them for
+ * each peer.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Public.h"
+#include "AX25Address.h"
+
+/**
+ * Compresses the headers of the TCP/IP datagrams sent to one peer, as in RFC 1144. The 40 or more bytes of
+ * IP and TCP header of a segment are replaced by the differences from the previous segment of the same
+ * connection, which for bulk data and acknowledgements is usually 3 or 4 bytes.
+ *
+ * Each connection (the addresses and ports of a segment) is given one of SLOT_COUNT slots, the least recently
+ * used being taken over by a new one. The first segment of a connection, and any segment whose header changed
+ * in a way that cannot be expressed as differences, is sent whole with PID_UNCOMPRESSED_TCP and the slot
+ * number in place of the IP protocol, so that the decompressor can refresh its copy of the header. A
+ * compressed segment is sent with PID_COMPRESSED_TCP, and starts with the change mask as on SLIP.
+ *
+ * Nothing is ever acknowledged: if a compressed segment is lost, the decompressor rebuilds the next one from
+ * stale state, the TCP checksum (which is sent unchanged) fails and the segment is dropped. The compressor
+ * sends a retransmission, which repeats the sequence and acknowledgement numbers of the last segment, whole,
+ * and that resynchronizes the two sides.
+ */
+class HeaderCompressor
+{
+public:
+    static constexpr BYTE PID_COMPRESSED_TCP = 0x06;    //<! PID of a TCP/IP datagram with a compressed header
+    static constexpr BYTE PID_UNCOMPRESSED_TCP = 0x07;  //<! PID of a TCP/IP datagram sent whole to set up a slot
+    static constexpr ULONG SLOT_COUNT = 16;             //<! Connections whose headers are kept, at each end
+    static constexpr ULONG MAX_HEADER_LENGTH = 128;     //<! Longest IP and TCP header, with options, which is kept
+
+    /** Counts of what happened to the datagrams sent */
+    struct Counters
+    {
+        ULONG64 Compressed;     //<! Datagrams sent with PID_COMPRESSED_TCP
+        ULONG64 Uncompressed;   //<! Datagrams sent with PID_UNCOMPRESSED_TCP
+        ULONG64 BytesSaved;     //<! Header bytes left out of the compressed datagrams
+    };
+
+    NON_PAGEABLE_FUNCTION
+    HeaderCompressor() noexcept;
+
+    /** @returns the counts of what happened to the datagrams sent */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    BYTE Compress(_Inout_updates_bytes_(length) BYTE* datagram, _In_ ULONG length, _Out_ ULONG& offset) noexcept;
+
+private:
+    /** The last header sent on a connection */
+    struct Slot
+    {
+        ULONG64 lastUsed;                   //<! When the slot was last used, for replacing the least recently used
+        ULONG headerLength;                 //<! The number of bytes in header, or 0 if the slot is free
+        BYTE header[MAX_HEADER_LENGTH];     //<! The IP and TCP header
+    };
+
+    Slot slots[SLOT_COUNT];     //<! The connections whose headers are kept
+    ULONG64 clock;              //<! Advanced each time a slot is used
+    ULONG lastSent;             //<! The slot of the last compressed datagram, or SLOT_COUNT if there was none
+    Counters counters;          //<! Counts of what happened to the datagrams sent
+};
+
+/**
+ * Restores the headers of the TCP/IP datagrams received from one peer's HeaderCompressor. A datagram which
+ * cannot be restored (malformed, or for a slot which has not been set up) is dropped, and so is every
+ * compressed datagram after it until one names its slot again or a datagram is received whole, since those
+ * would otherwise be built on a header the compressor never sent.
+ */
+class HeaderDecompressor
+{
+public:
+    /** Counts of what happened to the datagrams received */
+    struct Counters
+    {
+        ULONG64 Decompressed;   //<! Datagrams received with PID_COMPRESSED_TCP and restored
+        ULONG64 Uncompressed;   //<! Datagrams received with PID_UNCOMPRESSED_TCP
+        ULONG64 Dropped;        //<! Datagrams dropped because they could not be restored
+    };
+
+    NON_PAGEABLE_FUNCTION
+    HeaderDecompressor() noexcept;
+
+    /** @returns the counts of what happened to the datagrams received */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG Decompress(
+        _In_ BYTE pid,
+        _Inout_updates_bytes_(capacity) BYTE* packet,
+        _In_ ULONG length,
+        _In_ ULONG capacity) noexcept;
+
+private:
+    /** The last header received on a connection */
+    struct Slot
+    {
+        ULONG headerLength;                                 //<! The number of bytes in header, or 0 if the slot is unknown
+        BYTE header[HeaderCompressor::MAX_HEADER_LENGTH];   //<! The IP and TCP header
+    };
+
+    Slot slots[HeaderCompressor::SLOT_COUNT];   //<! The connections whose headers are kept
+    ULONG lastReceived;                         //<! The slot of the last datagram, or SLOT_COUNT if there was none
+    bool tossing;                               //<! True from an error until a datagram names its slot again
+    Counters counters;                          //<! Counts of what happened to the datagrams received
+};
+
+/**
+ * Keeps a HeaderCompressor and HeaderDecompressor for each of up to a fixed number of callsign pairs, the
+ * least recently used pair giving way to a new one. Whether datagrams to a peer are compressed depends on the
+ * mode: always, or (like adaptive CSLIP) only once the peer has been heard sending compressed datagrams
+ * itself. Compressed datagrams are always accepted. A table is not thread safe.
+ */
+class HeaderCompressionTable
+{
+public:
+    /** When datagrams are compressed, as set by the HeaderCompression keyword */
+    enum Mode : ULONG
+    {
+        Disabled = 0,   //<! Never; the table is not allocated
+        Automatic = 1,  //<! To peers which have sent compressed datagrams
+        Enabled = 2,    //<! To every peer
+    };
+
+    /**
+     * Initializes an empty table. Nothing can be compressed until Allocate() is called.
+     */
+    NON_PAGEABLE_FUNCTION
+    inline HeaderCompressionTable() noexcept
+        :ndisHandle(nullptr)
+        ,peers(nullptr)
+        ,capacity(0)
+        ,clock(0)
+        ,mode(Disabled)
+    {
+        RtlZeroMemory(&retired, sizeof(retired));
+    }
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    NDIS_STATUS Allocate(_In_ NDIS_HANDLE handle, _In_ ULONG peerCount, _In_ Mode compressionMode) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Free() noexcept;
+
+    /** @returns true once Allocate() has succeeded */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsAllocated() const noexcept { return peers != nullptr; }
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    BYTE Compress(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _Inout_updates_bytes_(length) BYTE* datagram,
+        _In_ ULONG length,
+        _Out_ ULONG& offset) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG Decompress(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_ BYTE pid,
+        _Inout_updates_bytes_(capacity) BYTE* packet,
+        _In_ ULONG length,
+        _In_ ULONG capacity) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void GetStatistics(_Out_ AX25_HEADER_COMPRESSION_STATISTICS& statistics) const noexcept;
+
+private:
+    /**
+     * The tag to use when allocating the table. In memory this should appear as "vjAX", little-endian.
+     */
+    static constexpr ULONG HEADER_COMPRESSION_TAG = AX25_CREATE_TAG("vjAX");
+
+    /** The compression state shared with one peer */
+    struct Peer
+    {
+        bool inUse;                         //<! True if the entry holds a callsign pair
+        bool compresses;                    //<! True once the peer has sent a compressed datagram
+        AX25Address local;                  //<! This station
+        AX25Address peer;                   //<! The peer
+        ULONG64 lastUsed;                   //<! When the entry was last used, for replacing the least recently used
+        HeaderCompressor compressor;        //<! Compresses the datagrams sent to the peer
+        HeaderDecompressor decompressor;    //<! Restores the datagrams received from the peer
+    };
+
+    /** Counts carried over from entries which have been replaced */
+    struct Retired
+    {
+        HeaderCompressor::Counters compressor;      //<! Counts of the compressors replaced
+        HeaderDecompressor::Counters decompressor;  //<! Counts of the decompressors replaced
+    };
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    Peer* find(_In_ const AX25Address& local, _In_ const AX25Address& peer) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    Peer& open(_In_ const AX25Address& local, _In_ const AX25Address& peer) noexcept;
+
+    NDIS_HANDLE ndisHandle;     //<! The handle the table was allocated with
+    Peer* peers;                //<! The entries, or nullptr until Allocate() is called
+    ULONG capacity;             //<! The number of entries at peers
+    ULONG64 clock;              //<! Advanced each time an entry is used
+    Mode mode;                  //<! When datagrams are compressed
+    Retired retired;            //<! Counts carried over from entries which have been replaced
+};
@@ -0,0 +1,425 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderTranslator.cpp
+ * Implementation of the HeaderTranslator class, which converts between the Ethernet headers seen by the
+ * network stack and the AX.25 headers used on the air.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "HeaderTranslator.h"
+
+// BROADCAST_ADDRESS is compared by reference, so it needs a definition
+constexpr AX25Address HeaderTranslator::BROADCAST_ADDRESS;
+
+/** Code of a character which cannot appear in a synthetic Ethernet address */
+static constexpr BYTE INVALID_CHARACTER = 0x3F;
+
+/**
+ * Converts a callsign character to its 6-bit code in a synthetic Ethernet address
+ * @param character the character, which should be a space, an upper case letter or a digit
+ * @returns 0 for a space, 1-26 for A-Z, 27-36 for 0-9, or INVALID_CHARACTER
+ */
+NON_PAGEABLE_FUNCTION
+static inline BYTE encodeCharacter(_In_ char character) noexcept
+{
+    return (character == ' ') ? 0 :
+           (character >= 'A' && character <= 'Z') ? static_cast<BYTE>(character - 'A' + 1) :
+           (character >= '0' && character <= '9') ? static_cast<BYTE>(character - '0' + 27) :
+           INVALID_CHARACTER;
+}
+
+/**
+ * Converts a 6-bit code from a synthetic Ethernet address back to a callsign character
+ * @param code the code produced by encodeCharacter
+ * @returns the character, or '\0' if the code does not correspond to one
+ */
+NON_PAGEABLE_FUNCTION
+static inline char decodeCharacter(_In_ BYTE code) noexcept
+{
+    return (code == 0) ? ' ' :
+           (code <= 26) ? static_cast<char>('A' + code - 1) :
+           (code <= 36) ? static_cast<char>('0' + code - 27) :
+           '\0';
+}
+
+/**
+ * Initializes a new translator with an empty cache. SetLocalAddress must be called before any frame
+ * is translated.
+ */
+NON_PAGEABLE_FUNCTION
+HeaderTranslator::HeaderTranslator() noexcept
+    :hits(0)
+    ,misses(0)
+    ,pathsLearned(0)
+    ,evictions(0)
+    ,entries(0)
+    ,untranslatableFrames(0)
+{
+    RtlZeroMemory(cache, sizeof(cache));
+}
+
+/**
+ * Sets the address which frames are sent from. The cache is emptied, as every prebuilt header contains the
+ * old address; this must not be called while frames are being translated.
+ * @param address the local station's callsign and SSID
+ */
+_IRQL_requires_(PASSIVE_LEVEL)
+NON_PAGEABLE_FUNCTION
+void HeaderTranslator::SetLocalAddress(_In_ AX25Address address) noexcept
+{
+    localAddress = address.WithControlBit(false).WithLast(false);
+    RtlZeroMemory(cache, sizeof(cache));
+    entries = 0;
+}
+
+/**
+ * Gets the synthetic Ethernet address of a station
+ * @param address the station's AX.25 address
+ * @param ethernetAddress receives the Ethernet address
+ * @returns true if the address was converted, or false if the callsign contains a character other than
+ * an upper case letter or a digit (in which case ethernetAddress is meaningless)
+ */
+NON_PAGEABLE_FUNCTION
+bool HeaderTranslator::AddressToEthernet(
+    _In_ AX25Address address,
+    _Out_writes_bytes_(ETHERNET_ADDRESS_LENGTH) BYTE* ethernetAddress) noexcept
+{
+    // Six 6-bit characters followed by the 4-bit SSID make up the last 40 bits
+    ULONG64 value = 0;
+    BYTE invalid = 0;
+    for (ULONG i = 0; i < AX25Address::CALLSIGN_LENGTH; i++)
+    {
+        BYTE code = encodeCharacter(address.GetCharacter(i));
+        invalid |= static_cast<BYTE>(code == INVALID_CHARACTER);
+        value = (value << 6) | code;
+    }
+    value = (value << 4) | address.GetSsid();
+
+    ethernetAddress[0] = SYNTHETIC_ADDRESS_PREFIX;
+    for (ULONG i = 1; i < ETHERNET_ADDRESS_LENGTH; i++)
+    {
+        ethernetAddress[i] = static_cast<BYTE>(value >> (8 * (ETHERNET_ADDRESS_LENGTH - 1 - i)));
+    }
+    return invalid == 0 && address.IsWellFormed();
+}
+
+/**
+ * Gets the station which a synthetic Ethernet address belongs to
+ * @param ethernetAddress the Ethernet address
+ * @param address receives the station's AX.25 address
+ * @returns true if the address was converted, or false if it is not a synthetic address
+ */
+NON_PAGEABLE_FUNCTION
+bool HeaderTranslator::EthernetToAddress(
+    _In_reads_bytes_(ETHERNET_ADDRESS_LENGTH) const BYTE* ethernetAddress,
+    _Out_ AX25Address* address) noexcept
+{
+    ULONG64 value = 0;
+    for (ULONG i = 1; i < ETHERNET_ADDRESS_LENGTH; i++)
+    {
+        value = (value << 8) | ethernetAddress[i];
+    }
+
+    char callsign[AX25Address::CALLSIGN_LENGTH + 1];
+    bool valid = ethernetAddress[0] == SYNTHETIC_ADDRESS_PREFIX;
+    for (ULONG i = 0; i < AX25Address::CALLSIGN_LENGTH; i++)
+    {
+        callsign[i] = decodeCharacter(static_cast<BYTE>((value >> (4 + 6 * (AX25Address::CALLSIGN_LENGTH - 1 - i))) & 0x3F));
+        valid &= callsign[i] != '\0';
+    }
+    callsign[AX25Address::CALLSIGN_LENGTH] = '\0';
+
+    *address = valid ? AX25Address(callsign, static_cast<BYTE>(value & 0x0F)) : AX25Address();
+    return valid;
+}
+
+/**
+ * Builds the AX.25 header of an outbound frame from its Ethernet header
+ * @param ethernetHeader the Ethernet header of the frame
+ * @param ax25Header receives the AX.25 header: address field, control field and PID
+ * @returns the length of the AX.25 header, or 0 if the frame cannot be sent over AX.25
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG HeaderTranslator::ToAX25(
+    _In_reads_bytes_(ETHERNET_HEADER_LENGTH) const BYTE* ethernetHeader,
+    _Out_writes_bytes_(MAX_AX25_HEADER_LENGTH) BYTE* ax25Header) noexcept
+{
+    const USHORT etherType = static_cast<USHORT>((ethernetHeader[12] << 8) | ethernetHeader[13]);
+    const BYTE pid = (etherType == ETHERTYPE_IPV4) ? PID_IPV4 :
+                     (etherType == ETHERTYPE_ARP) ? PID_ARP :
+                     0;
+    if (pid == 0)
+    {
+        InterlockedIncrement64(&untranslatableFrames);
+        return 0;
+    }
+
+    const ULONG64 key = makeKey(ethernetHeader);
+    ULONG length = lookup(key, ax25Header);
+    if (length != 0)
+    {
+        hits++;
+    }
+    else
+    {
+        misses++;
+
+        // Multicast has no equivalent in AX.25; every group address is sent to QST like a broadcast
+        AX25AddressField field;
+        if ((ethernetHeader[0] & 0x01) != 0)
+        {
+            field.Destination = BROADCAST_ADDRESS;
+        }
+        else if (!EthernetToAddress(ethernetHeader, &field.Destination))
+        {
+            InterlockedIncrement64(&untranslatableFrames);
+            return 0;
+        }
+
+        // Frames are sent as commands: C bit set in the destination and clear in the source
+        field.Destination = field.Destination.WithControlBit(true);
+        field.Source = localAddress;
+        length = field.Write(ax25Header, ENTRY_HEADER_LENGTH);
+        store(key, ax25Header, length);
+    }
+
+    ax25Header[length++] = CONTROL_UI;
+    ax25Header[length++] = pid;
+    return length;
+}
+
+/**
+ * Builds the Ethernet header of an inbound frame from its AX.25 header, and learns the path back to the
+ * station which sent it
+ * @param frame the received AX.25 frame, without FCS
+ * @param length the number of bytes in frame
+ * @param ethernetHeader receives the Ethernet header
+ * @returns the length of the AX.25 header, which is the offset of the payload in frame, or 0 if the frame
+ * is not a UI frame carrying IPv4 or ARP from and to translatable addresses
+ * @remarks an IPv4 datagram sent to QST-0 for a multicast group is given the Ethernet address of the group
+ * rather than the broadcast address
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG HeaderTranslator::ToEthernet(
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length,
+    _Out_writes_bytes_(ETHERNET_HEADER_LENGTH) BYTE* ethernetHeader) noexcept
+{
+    AX25AddressField field;
+    const ULONG fieldLength = field.Parse(frame, length);
+    if (fieldLength == 0 || length - fieldLength < 2 ||
+        (frame[fieldLength] & ~CONTROL_POLL_FINAL) != CONTROL_UI)
+    {
+        InterlockedIncrement64(&untranslatableFrames);
+        return 0;
+    }
+
+    const BYTE pid = frame[fieldLength + 1];
+    const USHORT etherType = (pid == PID_IPV4) ? ETHERTYPE_IPV4 :
+                             (pid == PID_ARP) ? ETHERTYPE_ARP :
+                             0;
+
+    bool translated = etherType != 0 && AddressToEthernet(field.Source, ethernetHeader + ETHERNET_ADDRESS_LENGTH);
+    const BYTE* payload = frame + fieldLength + 2;
+    const ULONG payloadLength = length - fieldLength - 2;
+    if (field.Destination == BROADCAST_ADDRESS && pid == PID_IPV4 && payloadLength >= IPV4_DESTINATION_OFFSET + 4 &&
+        (payload[IPV4_DESTINATION_OFFSET] & 0xF0) == 0xE0)
+    {
+        // 224.0.0.0/4 maps onto 01-00-5E-00-00-00 to 01-00-5E-7F-FF-FF
+        const BYTE* group = payload + IPV4_DESTINATION_OFFSET;
+        ethernetHeader[0] = 0x01;
+        ethernetHeader[1] = 0x00;
+        ethernetHeader[2] = 0x5E;
+        ethernetHeader[3] = group[1] & 0x7F;
+        ethernetHeader[4] = group[2];
+        ethernetHeader[5] = group[3];
+    }
+    else if (field.Destination == BROADCAST_ADDRESS)
+    {
+        RtlFillMemory(ethernetHeader, ETHERNET_ADDRESS_LENGTH, 0xFF);
+    }
+    else
+    {
+        translated &= AddressToEthernet(field.Destination, ethernetHeader);
+    }
+
+    if (!translated)
+    {
+        InterlockedIncrement64(&untranslatableFrames);
+        return 0;
+    }
+    ethernetHeader[12] = static_cast<BYTE>(etherType >> 8);
+    ethernetHeader[13] = static_cast<BYTE>(etherType);
+
+    // Replies go back over the same repeaters in reverse order. Frames of our own heard through a
+    // repeater teach nothing.
+    if (field.Source != localAddress)
+    {
+        AX25AddressField reply;
+        reply.Destination = field.Source.WithControlBit(true);
+        reply.Source = localAddress;
+        reply.RepeaterCount = field.RepeaterCount;
+        for (ULONG i = 0; i < field.RepeaterCount; i++)
+        {
+            reply.Repeaters[i] = field.Repeaters[field.RepeaterCount - 1 - i].WithControlBit(false);
+        }
+
+        BYTE header[ENTRY_HEADER_LENGTH];
+        BYTE cached[ENTRY_HEADER_LENGTH];
+        const ULONG headerLength = reply.Write(header, sizeof(header));
+        const ULONG64 key = makeKey(ethernetHeader + ETHERNET_ADDRESS_LENGTH);
+        if (lookup(key, cached) != headerLength || RtlCompareMemory(cached, header, headerLength) != headerLength)
+        {
+            store(key, header, headerLength);
+            pathsLearned++;
+        }
+    }
+
+    return fieldLength + 2;
+}
+
+/**
+ * Takes a snapshot of the cache statistics
+ * @param statistics receives the statistics
+ */
+NON_PAGEABLE_FUNCTION
+void HeaderTranslator::GetStatistics(_Out_ AX25_HEADER_CACHE_STATISTICS& statistics) const noexcept
+{
+    statistics.Capacity = CACHE_SIZE;
+    statistics.Entries = static_cast<ULONG>(entries);
+    statistics.Hits = hits;
+    statistics.Misses = misses;
+    statistics.PathsLearned = pathsLearned;
+    statistics.Evictions = static_cast<ULONG64>(evictions);
+    statistics.UntranslatableFrames = static_cast<ULONG64>(untranslatableFrames);
+}
+
+/**
+ * Packs an Ethernet address into an integer
+ * @param ethernetAddress the Ethernet address
+ * @returns the address in the low 48 bits
+ */
+NON_PAGEABLE_FUNCTION
+ULONG64 HeaderTranslator::makeKey(_In_reads_bytes_(ETHERNET_ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+{
+    ULONG64 key = 0;
+    RtlCopyMemory(&key, ethernetAddress, ETHERNET_ADDRESS_LENGTH);
+    return key;
+}
+
+/**
+ * Chooses the first entry examined for a key (Fibonacci hashing)
+ * @param key the packed Ethernet address
+ * @returns the index of the entry
+ */
+NON_PAGEABLE_FUNCTION
+ULONG HeaderTranslator::hashKey(_In_ ULONG64 key) noexcept
+{
+    return static_cast<ULONG>((key * 0x9E3779B97F4A7C15ULL) >> (64 - CACHE_INDEX_BITS));
+}
+
+/**
+ * Copies the cached header for a key
+ * @param key the packed Ethernet address
+ * @param header receives the cached address field
+ * @returns the length of the cached address field, or 0 if there is none or it was being written
+ */
+NON_PAGEABLE_FUNCTION
+ULONG HeaderTranslator::lookup(_In_ ULONG64 key, _Out_writes_bytes_(ENTRY_HEADER_LENGTH) BYTE* header) const noexcept
+{
+    const ULONG home = hashKey(key);
+    for (ULONG probe = 0; probe < MAX_PROBES; probe++)
+    {
+        const CacheEntry& entry = cache[(home + probe) & (CACHE_SIZE - 1)];
+        const LONG sequence = entry.sequence;
+        KeMemoryBarrier();
+        if (entry.key == 0)
+        {
+            return 0;
+        }
+
+        if (entry.key == key)
+        {
+            const ULONG length = entry.headerLength;
+            if ((sequence & 1) != 0 || length > ENTRY_HEADER_LENGTH)
+            {
+                return 0;
+            }
+
+            RtlCopyMemory(header, entry.header, length);
+            KeMemoryBarrier();
+            return (entry.sequence == sequence) ? length : 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Caches the header for a key, replacing any header already cached for it. If every entry the key may
+ * occupy is taken by another key, the first is evicted. If another processor is writing the chosen entry,
+ * the header is simply not cached.
+ * @param key the packed Ethernet address
+ * @param header the address field to cache
+ * @param headerLength the length of header
+ */
+NON_PAGEABLE_FUNCTION
+void HeaderTranslator::store(
+    _In_ ULONG64 key,
+    _In_reads_bytes_(headerLength) const BYTE* header,
+    _In_ ULONG headerLength) noexcept
+{
+    const ULONG home = hashKey(key);
+    CacheEntry* target = &cache[home];
+    for (ULONG probe = 0; probe < MAX_PROBES; probe++)
+    {
+        CacheEntry& entry = cache[(home + probe) & (CACHE_SIZE - 1)];
+        if (entry.key == key || entry.key == 0)
+        {
+            target = &entry;
+            break;
+        }
+    }
+
+    const LONG sequence = target->sequence;
+    if ((sequence & 1) != 0 || InterlockedCompareExchange(&target->sequence, sequence + 1, sequence) != sequence)
+    {
+        return;
+    }
+
+    const ULONG64 previous = target->key;
+    target->key = key;
+    target->headerLength = headerLength;
+    RtlCopyMemory(target->header, header, headerLength);
+    InterlockedExchange(&target->sequence, sequence + 2);
+
+    if (previous == 0)
+    {
+        InterlockedIncrement(&entries);
+    }
+    else if (previous != key)
+    {
+        InterlockedIncrement64(&evictions);
+    }
+}
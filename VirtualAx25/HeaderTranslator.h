@@ -0,0 +1,161 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderTranslator.h
+ * Definition of the HeaderTranslator class, which converts between the Ethernet headers seen by the
+ * network stack and the AX.25 headers used on the air.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Public.h"
+#include "AX25Address.h"
+
+/**
+ * Translates frame headers between Ethernet (what the adapter presents to NDIS) and AX.25 UI frames (what is
+ * sent to the radio).
+ *
+ * Every station is given a synthetic, locally administered Ethernet address which holds its callsign and SSID
+ * (02-xx-xx-xx-xx-xx, with six 6-bit characters and a 4-bit SSID in the last 40 bits), so addresses convert
+ * in both directions without any table. The broadcast address corresponds to QST-0.
+ *
+ * AX.25 has no group addresses, so frames to any Ethernet group address are sent to QST-0 as well. An IPv4
+ * datagram received through QST-0 for a multicast group is given the Ethernet address of that group
+ * (01-00-5E followed by the low 23 bits of the group, as in RFC 1112), so that the packet filter can tell
+ * joined groups apart from others.
+ *
+ * What cannot be derived from an Ethernet address is the digipeater path to the station. Paths are learned
+ * from received frames (by reversing the path the frame arrived over) and kept in a hashed cache keyed by
+ * Ethernet address. Each entry holds the complete, prebuilt AX.25 address field to transmit, so translating
+ * an outbound header is one lookup and one copy. Addresses seen for the first time on transmit are built
+ * without a path and cached the same way.
+ *
+ * The cache is open addressed with a short linear probe, and each entry is protected by a sequence count:
+ * writers claim an entry by making its count odd, and readers retry nothing - a reader which sees a count
+ * change treats the lookup as a miss and builds the header itself. ToAX25 must only be called by one
+ * processor at a time (the transmit path), and ToEthernet must only be called by one processor at a time
+ * (the receive path), but the two may run concurrently.
+ */
+class HeaderTranslator
+{
+public:
+    static constexpr ULONG ETHERNET_ADDRESS_LENGTH = 6;         //<! Bytes in an Ethernet address
+    static constexpr ULONG ETHERNET_HEADER_LENGTH = 14;         //<! Bytes in an untagged Ethernet header
+    static constexpr USHORT ETHERTYPE_IPV4 = 0x0800;            //<! EtherType of IPv4 datagrams
+    static constexpr USHORT ETHERTYPE_ARP = 0x0806;             //<! EtherType of ARP packets
+
+    static constexpr BYTE CONTROL_UI = 0x03;                    //<! Control field of an unnumbered information frame
+    static constexpr BYTE CONTROL_POLL_FINAL = 0x10;            //<! Poll/final bit of the control field
+    static constexpr BYTE PID_IPV4 = 0xCC;                      //<! Protocol identifier of IPv4 datagrams
+    static constexpr BYTE PID_ARP = 0xCD;                       //<! Protocol identifier of ARP packets
+
+    /** Longest AX.25 header produced: the longest address field, the control field and the PID */
+    static constexpr ULONG MAX_AX25_HEADER_LENGTH = AX25AddressField::MAX_LENGTH + 2;
+
+    static constexpr ULONG CACHE_INDEX_BITS = 8;                //<! Bits of the hash used to index the cache
+    static constexpr ULONG CACHE_SIZE = 1 << CACHE_INDEX_BITS;  //<! Entries in the cache
+    static constexpr ULONG MAX_PROBES = 8;                      //<! Entries examined for each address
+
+    /** The AX.25 address corresponding to the Ethernet broadcast address */
+    static constexpr AX25Address BROADCAST_ADDRESS = AX25Address("QST", 0);
+
+    /** First byte of every synthetic Ethernet address: unicast and locally administered */
+    static constexpr BYTE SYNTHETIC_ADDRESS_PREFIX = 0x02;
+
+    static constexpr ULONG IPV4_DESTINATION_OFFSET = 16;        //<! Offset of the destination in an IPv4 header
+
+    NON_PAGEABLE_FUNCTION
+    HeaderTranslator() noexcept;
+
+    _IRQL_requires_(PASSIVE_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void SetLocalAddress(_In_ AX25Address address) noexcept;
+
+    /** @returns the address frames are sent from */
+    NON_PAGEABLE_FUNCTION
+    inline AX25Address GetLocalAddress() const noexcept { return localAddress; }
+
+    NON_PAGEABLE_FUNCTION
+    static bool AddressToEthernet(
+        _In_ AX25Address address,
+        _Out_writes_bytes_(ETHERNET_ADDRESS_LENGTH) BYTE* ethernetAddress) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    static bool EthernetToAddress(
+        _In_reads_bytes_(ETHERNET_ADDRESS_LENGTH) const BYTE* ethernetAddress,
+        _Out_ AX25Address* address) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG ToAX25(
+        _In_reads_bytes_(ETHERNET_HEADER_LENGTH) const BYTE* ethernetHeader,
+        _Out_writes_bytes_(MAX_AX25_HEADER_LENGTH) BYTE* ax25Header) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG ToEthernet(
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length,
+        _Out_writes_bytes_(ETHERNET_HEADER_LENGTH) BYTE* ethernetHeader) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void GetStatistics(_Out_ AX25_HEADER_CACHE_STATISTICS& statistics) const noexcept;
+
+private:
+    /** Address field bytes of an entry: the longest address field */
+    static constexpr ULONG ENTRY_HEADER_LENGTH = AX25AddressField::MAX_LENGTH;
+
+    /**
+     * One cached translation. key is 0 for an unused entry; no address which can be translated has
+     * a key of 0.
+     */
+    struct CacheEntry
+    {
+        volatile LONG sequence;             //<! Odd while the entry is being written
+        ULONG headerLength;                 //<! Bytes of header in use
+        ULONG64 key;                        //<! Ethernet address of the station, packed into the low 48 bits
+        BYTE header[ENTRY_HEADER_LENGTH];   //<! Prebuilt address field for frames sent to the station
+    };
+
+    AX25Address localAddress;               //<! Source address of transmitted frames
+    CacheEntry cache[CACHE_SIZE];           //<! Translations, indexed by hash of the key
+
+    // Statistics. Hits and misses are only written by the transmit path and learned paths only by the
+    // receive path; entries, evictions and dropped frames are written by both.
+    ULONG64 hits;                           //<! Transmitted frames whose header came from the cache
+    ULONG64 misses;                         //<! Transmitted frames whose header had to be built
+    ULONG64 pathsLearned;                   //<! Entries written by the receive path
+    volatile LONG64 evictions;              //<! Entries overwritten with a different key
+    volatile LONG entries;                  //<! Entries in use
+    volatile LONG64 untranslatableFrames;   //<! Frames which could not be translated
+
+    NON_PAGEABLE_FUNCTION
+    static ULONG64 makeKey(_In_reads_bytes_(ETHERNET_ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    static ULONG hashKey(_In_ ULONG64 key) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    ULONG lookup(_In_ ULONG64 key, _Out_writes_bytes_(ENTRY_HEADER_LENGTH) BYTE* header) const noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void store(_In_ ULONG64 key, _In_reads_bytes_(headerLength) const BYTE* header, _In_ ULONG headerLength) noexcept;
+};
@@ -0,0 +1,155 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file InterlockedChainQueue.h
+ * Definition of the InterlockedChainQueue template, a lock-free multi-producer/single-consumer
+ * queue of intrusively-linked chains of objects.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * A lock-free multi-producer, single-consumer queue of chains of objects. Each element enqueued
+ * is the head of a chain (for example, a linked list of NET_BUFFER_LIST objects as passed to
+ * MiniportSendNetBufferLists). The chain itself is never walked by the queue; chains are linked
+ * to each other through a separate pointer-sized field of the head element, which is chosen by
+ * the LinkTraits parameter. This allows a whole chain to be enqueued in constant time regardless
+ * of its length.
+ *
+ * Producers push onto an interlocked stack with a single compare-exchange. The consumer detaches
+ * the entire stack with a single exchange and reverses it to restore arrival order. Because
+ * the consumer never removes individual elements, the stack is not subject to the ABA problem and
+ * no sequence number is needed.
+ *
+ * Only one consumer may call DequeueAll() at a time. Any number of producers may call Enqueue()
+ * concurrently, at any IRQL up to and including DISPATCH_LEVEL. No memory is allocated by the
+ * queue, so it may reside in non-pageable memory as part of its owning object.
+ *
+ * @tparam Node the type of the elements being queued
+ * @tparam LinkTraits a type providing a static function Node*& Link(Node&) which returns a reference
+ * to the pointer-sized field of a chain head which the queue may use for its own linkage. The
+ * field is owned by the queue from the time the chain is enqueued until it is dequeued.
+ */
+template <class Node, class LinkTraits>
+class InterlockedChainQueue
+{
+public:
+    /**
+     * Initializes a new, empty queue
+     */
+    NON_PAGEABLE_FUNCTION
+    inline InterlockedChainQueue() noexcept
+        :head(nullptr)
+        ,contentionCount(0)
+    {
+    }
+
+    /**
+     * Adds the chain starting at the specified element to the tail of the queue. The chain is
+     * enqueued as a single unit and will be returned by DequeueAll() as a single unit.
+     * @param chain the head of the chain to enqueue
+     * @returns true if the queue was empty before this chain was enqueued, or false otherwise.
+     * Producers can use this to avoid redundantly signaling the consumer.
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline bool Enqueue(_Inout_ Node& chain) noexcept
+    {
+        Node* observed = head;
+        for (;;)
+        {
+            LinkTraits::Link(chain) = observed;
+            Node* previous = static_cast<Node*>(InterlockedCompareExchangePointer(
+                reinterpret_cast<PVOID volatile*>(&head), &chain, observed));
+            if (previous == observed)
+            {
+                return previous == nullptr;
+            }
+
+            // Another producer got in first. This is only counted when it happens, so the uncontended
+            // path never touches the shared counter.
+            observed = previous;
+            InterlockedIncrement(&contentionCount);
+        }
+    }
+
+    /**
+     * Removes every chain currently in the queue. Only one consumer may call this function at a time.
+     * @returns the head of the first chain enqueued, with the remaining chains linked in arrival order
+     * through LinkTraits::Link, or nullptr if the queue was empty. The link field of the last chain
+     * is set to nullptr.
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Ret_maybenull_
+    NON_PAGEABLE_FUNCTION
+    inline Node* DequeueAll() noexcept
+    {
+        Node* stack = static_cast<Node*>(InterlockedExchangePointer(
+            reinterpret_cast<PVOID volatile*>(&head), nullptr));
+
+        // The stack is in LIFO order - reverse it so that chains come out in the order they went in
+        Node* ordered = nullptr;
+        while (stack != nullptr)
+        {
+            Node* next = LinkTraits::Link(*stack);
+            LinkTraits::Link(*stack) = ordered;
+            ordered = stack;
+            stack = next;
+        }
+
+        return ordered;
+    }
+
+    /**
+     * Determines whether the queue is currently empty. The result may be stale by the time it is
+     * examined if producers are active.
+     * @returns true if no chains were queued at the time of the call
+     */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsEmpty() const noexcept
+    {
+        return head == nullptr;
+    }
+
+    /**
+     * Gets the number of times a producer had to retry its enqueue operation because another
+     * producer modified the queue concurrently. This is a measure of contention on the queue.
+     * @returns the number of retried enqueue attempts since this queue was created
+     */
+    NON_PAGEABLE_FUNCTION
+    inline LONG GetContentionCount() const noexcept
+    {
+        return contentionCount;
+    }
+
+private:
+    /**
+     * The most recently enqueued chain, which links to the chain enqueued before it. Chains are
+     * stored in LIFO order and reversed upon removal.
+     */
+    Node* volatile head;
+
+    /** Number of compare-exchange retries performed by producers */
+    volatile LONG contentionCount;
+
+    // Not copyable - copying would duplicate ownership of the queued chains
+    InterlockedChainQueue(const InterlockedChainQueue&) = delete;
+    InterlockedChainQueue& operator=(const InterlockedChainQueue&) = delete;
+};
@@ -0,0 +1,78 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Kiss.h
+ * Constants and helpers shared by the KISS (Keep It Simple, Stupid) TNC protocol encoder and decoder.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * Definitions from the KISS protocol. Each KISS frame is delimited by FEND bytes, and any FEND or
+ * FESC byte inside the frame is sent as FESC followed by TFEND or TFESC respectively. The first byte
+ * of each frame is a type byte: the high nibble is the TNC port and the low nibble is the command.
+ */
+class Kiss
+{
+public:
+    static constexpr BYTE FEND = 0xC0;      //<! Frame end
+    static constexpr BYTE FESC = 0xDB;      //<! Frame escape
+    static constexpr BYTE TFEND = 0xDC;     //<! Transposed frame end, sent after FESC in place of FEND
+    static constexpr BYTE TFESC = 0xDD;     //<! Transposed frame escape, sent after FESC in place of FESC
+
+    static constexpr BYTE COMMAND_DATA_FRAME = 0x00;    //<! Command nibble of a frame carrying AX.25 data
+    static constexpr ULONG MAX_PORTS = 16;              //<! Number of ports addressable by the type byte
+
+    /** @returns the port number encoded in a KISS type byte */
+    NON_PAGEABLE_FUNCTION
+    static constexpr BYTE GetPort(_In_ BYTE typeByte) noexcept { return static_cast<BYTE>(typeByte >> 4); }
+
+    /** @returns the command encoded in a KISS type byte */
+    NON_PAGEABLE_FUNCTION
+    static constexpr BYTE GetCommand(_In_ BYTE typeByte) noexcept { return static_cast<BYTE>(typeByte & 0x0F); }
+
+    /** @returns the KISS type byte for the specified port and command */
+    NON_PAGEABLE_FUNCTION
+    static constexpr BYTE MakeTypeByte(_In_ BYTE port, _In_ BYTE command) noexcept
+    {
+        return static_cast<BYTE>((port << 4) | (command & 0x0F));
+    }
+
+    /**
+     * Finds the first byte which needs special handling (FEND or FESC). This is the portable version;
+     * bulk operations should use a KissScanner, which picks a vectorized one where available.
+     * @param data the bytes to search
+     * @param length the number of bytes in data
+     * @returns the index of the first FEND or FESC byte, or length if there is none
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG FindSpecialByte(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+    {
+        for (ULONG i = 0; i < length; i++)
+        {
+            if (data[i] == FEND || data[i] == FESC)
+            {
+                return i;
+            }
+        }
+
+        return length;
+    }
+};
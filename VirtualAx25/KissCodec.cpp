@@ -0,0 +1,377 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissCodec.cpp
+ * Implementation of the KissCodec and KissScanner classes, including the scalar, SSE2 and AVX2
+ * versions of the KISS special byte scan.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "KissCodec.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#define KISS_VECTOR_SCAN
+#endif
+
+#if defined(_KERNEL_MODE) && defined(_M_IX86)
+// 32-bit kernel code must save even the SSE registers before using them
+static constexpr ULONG64 SSE2_STATE_MASK = XSTATE_MASK_LEGACY;
+static constexpr ULONG64 AVX2_STATE_MASK = XSTATE_MASK_LEGACY | XSTATE_MASK_AVX;
+#elif defined(_KERNEL_MODE)
+// The 64-bit kernel preserves the XMM registers for drivers, but not the upper halves of the YMM registers
+static constexpr ULONG64 SSE2_STATE_MASK = 0;
+static constexpr ULONG64 AVX2_STATE_MASK = XSTATE_MASK_AVX;
+#else
+// User mode threads always have their full register state saved by the operating system
+static constexpr ULONG64 SSE2_STATE_MASK = 0;
+static constexpr ULONG64 AVX2_STATE_MASK = 0;
+#endif
+
+KissCodec::Implementation KissCodec::implementation = KissCodec::Scalar;
+
+/**
+ * Finds the first FEND or FESC one byte at a time
+ * @param data the bytes to search
+ * @param length the number of bytes in data
+ * @returns the index of the first FEND or FESC byte, or length if there is none
+ */
+NON_PAGEABLE_FUNCTION
+static ULONG findSpecialByteScalar(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length)
+{
+    return Kiss::FindSpecialByte(data, length);
+}
+
+#ifdef KISS_VECTOR_SCAN
+/**
+ * Finds the first FEND or FESC 16 bytes at a time. Inputs which are not a multiple of 16 bytes long
+ * finish with one more 16 byte block which overlaps the bytes already searched.
+ * @param data the bytes to search
+ * @param length the number of bytes in data
+ * @returns the index of the first FEND or FESC byte, or length if there is none
+ */
+NON_PAGEABLE_FUNCTION
+static ULONG findSpecialByteSse2(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length)
+{
+    constexpr ULONG blockSize = sizeof(__m128i);
+    if (length < blockSize)
+    {
+        return Kiss::FindSpecialByte(data, length);
+    }
+
+    const __m128i fend = _mm_set1_epi8(static_cast<char>(Kiss::FEND));
+    const __m128i fesc = _mm_set1_epi8(static_cast<char>(Kiss::FESC));
+    ULONG offset = 0;
+    for (;;)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(block, fend), _mm_cmpeq_epi8(block, fesc));
+        unsigned long mask = static_cast<unsigned long>(_mm_movemask_epi8(special));
+        if (mask != 0)
+        {
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return offset + index;
+        }
+
+        if (offset + blockSize == length)
+        {
+            return length;
+        }
+
+        offset += blockSize;
+        if (length - offset < blockSize)
+        {
+            // The bytes before the final block's new ones were already found to be clean
+            offset = length - blockSize;
+        }
+    }
+}
+
+/**
+ * Finds the first FEND or FESC 32 bytes at a time. Anything left over after the last whole 32 byte
+ * block is passed to the SSE2 routine.
+ * @param data the bytes to search
+ * @param length the number of bytes in data
+ * @returns the index of the first FEND or FESC byte, or length if there is none
+ */
+NON_PAGEABLE_FUNCTION
+static ULONG findSpecialByteAvx2(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length)
+{
+    constexpr ULONG blockSize = sizeof(__m256i);
+    const __m256i fend = _mm256_set1_epi8(static_cast<char>(Kiss::FEND));
+    const __m256i fesc = _mm256_set1_epi8(static_cast<char>(Kiss::FESC));
+    ULONG offset = 0;
+    for (; length - offset >= blockSize; offset += blockSize)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+        __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(block, fend), _mm256_cmpeq_epi8(block, fesc));
+        unsigned long mask = static_cast<unsigned long>(static_cast<unsigned int>(_mm256_movemask_epi8(special)));
+        if (mask != 0)
+        {
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            _mm256_zeroupper();
+            return offset + index;
+        }
+    }
+
+    // Avoid the penalty for mixing VEX and legacy SSE instructions in the caller
+    _mm256_zeroupper();
+    return offset + findSpecialByteSse2(data + offset, length - offset);
+}
+#endif
+
+/**
+ * Selects the scan routine to be used by every KissScanner created from now on. This should be called
+ * once, before any KISS data is handled; until then the scalar routine is used.
+ * @param maximum the widest implementation which may be selected
+ * @returns the widest implementation, no wider than maximum, which this processor and operating
+ * system support
+ */
+PAGEABLE_FUNCTION
+KissCodec::Implementation KissCodec::SelectImplementation(_In_ Implementation maximum) noexcept
+{
+    Implementation supported = Scalar;
+#ifdef KISS_VECTOR_SCAN
+    int registers[4]; // EAX, EBX, ECX, EDX
+    __cpuid(registers, 0);
+    const int highestLeaf = registers[0];
+
+    __cpuid(registers, 1);
+    if ((registers[3] & (1 << 26)) != 0)
+    {
+        supported = Sse2;
+    }
+
+    // AVX2 also requires the operating system to save the YMM registers (OSXSAVE, AVX and XCR0 bits 1-2)
+    const bool avxEnabled = (registers[2] & (1 << 27)) != 0 &&
+                            (registers[2] & (1 << 28)) != 0 &&
+                            (_xgetbv(0) & 0x6) == 0x6;
+    if (avxEnabled && highestLeaf >= 7)
+    {
+        __cpuidex(registers, 7, 0);
+        if ((registers[1] & (1 << 5)) != 0)
+        {
+            supported = Avx2;
+        }
+    }
+#endif
+
+    implementation = (supported < maximum) ? supported : maximum;
+    return implementation;
+}
+
+/** @returns the implementation selected by the last call to SelectImplementation() */
+NON_PAGEABLE_FUNCTION
+KissCodec::Implementation KissCodec::GetImplementation() noexcept
+{
+    return implementation;
+}
+
+/**
+ * KISS-escapes a block of data, without adding FENDs or a type byte
+ * @param data the bytes to escape
+ * @param length the number of bytes in data
+ * @param output the buffer to receive the escaped bytes
+ * @param outputSize the size of output, in bytes. 2 * length is always enough.
+ * @param written receives the number of bytes written to output, or 0 on failure
+ * @returns true if the data was escaped, or false if output is too small
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool KissCodec::Escape(
+    _In_reads_bytes_(length) const BYTE* data,
+    _In_ ULONG length,
+    _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+    _In_ ULONG outputSize,
+    _Out_ ULONG* written) noexcept
+{
+    KissScanner scanner(length);
+    return escapeWith(scanner, data, length, output, outputSize, written);
+}
+
+/**
+ * Builds a complete KISS frame (FEND, type byte, escaped frame, FEND) out of an AX.25 frame
+ * @param port the TNC port to send the frame to
+ * @param command the KISS command, normally Kiss::COMMAND_DATA_FRAME
+ * @param frame the fragments of the frame
+ * @param output the buffer to receive the KISS frame
+ * @param outputSize the size of output, in bytes. GetMaximumEncodedLength(frame.GetTotalLength()) is
+ * always enough.
+ * @param written receives the number of bytes written to output, or 0 on failure
+ * @returns true if the frame was encoded, or false if output is too small
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool KissCodec::EncodeFrame(
+    _In_ BYTE port,
+    _In_ BYTE command,
+    _In_ const FrameGatherList& frame,
+    _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+    _In_ ULONG outputSize,
+    _Out_ ULONG* written) noexcept
+{
+    *written = 0;
+    if (outputSize < 3)
+    {
+        return false;
+    }
+
+    // Leave room for the closing FEND throughout
+    const ULONG limit = outputSize - 1;
+    ULONG position = 0;
+    output[position++] = Kiss::FEND;
+    output[position++] = Kiss::MakeTypeByte(port, command);
+
+    KissScanner scanner(frame.GetTotalLength());
+    for (ULONG i = 0; i < frame.GetFragmentCount(); i++)
+    {
+        ULONG fragmentLength;
+        if (!escapeWith(scanner, frame[i].Data, frame[i].Length, output + position, limit - position, &fragmentLength))
+        {
+            return false;
+        }
+        position += fragmentLength;
+    }
+
+    output[position++] = Kiss::FEND;
+    *written = position;
+    return true;
+}
+
+/**
+ * Escapes a block of data using an existing scanner. See Escape().
+ */
+NON_PAGEABLE_FUNCTION
+bool KissCodec::escapeWith(
+    _In_ const KissScanner& scanner,
+    _In_reads_bytes_(length) const BYTE* data,
+    _In_ ULONG length,
+    _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+    _In_ ULONG outputSize,
+    _Out_ ULONG* written) noexcept
+{
+    *written = 0;
+    ULONG consumed = 0;
+    ULONG produced = 0;
+    for (;;)
+    {
+        // Copy everything up to the next special byte in one go
+        ULONG runLength = scanner.FindSpecialByte(data + consumed, length - consumed);
+        if (runLength > outputSize - produced)
+        {
+            return false;
+        }
+        RtlCopyMemory(output + produced, data + consumed, runLength);
+        consumed += runLength;
+        produced += runLength;
+
+        if (consumed == length)
+        {
+            break;
+        }
+
+        if (outputSize - produced < 2)
+        {
+            return false;
+        }
+        output[produced++] = Kiss::FESC;
+        output[produced++] = (data[consumed++] == Kiss::FEND) ? Kiss::TFEND : Kiss::TFESC;
+    }
+
+    *written = produced;
+    return true;
+}
+
+/**
+ * Prepares to scan the specified amount of data, using the implementation selected by
+ * KissCodec::SelectImplementation() if it is worthwhile for the amount of data
+ * @param workLength the total number of bytes the scanner is expected to search
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+KissScanner::KissScanner(_In_ ULONG workLength) noexcept
+    :scan(findSpecialByteScalar)
+    ,extendedStateMask(0)
+{
+#ifdef KISS_VECTOR_SCAN
+    const KissCodec::Implementation implementation = KissCodec::GetImplementation();
+    if (implementation >= KissCodec::Avx2 && trySaveExtendedState(AVX2_STATE_MASK, workLength))
+    {
+        scan = findSpecialByteAvx2;
+    }
+    else if (implementation >= KissCodec::Sse2 && trySaveExtendedState(SSE2_STATE_MASK, workLength))
+    {
+        scan = findSpecialByteSse2;
+    }
+#else
+    UNREFERENCED_PARAMETER(workLength);
+#endif
+}
+
+/**
+ * Restores any processor state saved when this scanner was created
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+KissScanner::~KissScanner() noexcept
+{
+#ifdef _KERNEL_MODE
+    if (extendedStateMask != 0)
+    {
+        KeRestoreExtendedProcessorState(reinterpret_cast<XSTATE_SAVE*>(extendedState));
+    }
+#endif
+}
+
+/**
+ * Saves the processor state needed to use an implementation, if the work is long enough to be worth it
+ * @param mask the XSTATE_MASK_ flags of the state to save, or 0 if nothing needs to be saved
+ * @param workLength the total number of bytes the scanner is expected to search
+ * @returns true if the implementation can be used
+ */
+NON_PAGEABLE_FUNCTION
+bool KissScanner::trySaveExtendedState(_In_ ULONG64 mask, _In_ ULONG workLength) noexcept
+{
+    if (mask == 0)
+    {
+        return true;
+    }
+
+    if (workLength < KissCodec::MINIMUM_SAVED_STATE_WORK_LENGTH)
+    {
+        return false;
+    }
+
+#ifdef _KERNEL_MODE
+    static_assert(sizeof(XSTATE_SAVE) <= sizeof(extendedState), "extendedState is too small to hold an XSTATE_SAVE");
+    if (!NT_SUCCESS(KeSaveExtendedProcessorState(mask, reinterpret_cast<XSTATE_SAVE*>(extendedState))))
+    {
+        return false;
+    }
+    extendedStateMask = mask;
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,161 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissCodec.h
+ * Definition of the KissCodec and KissScanner classes, which locate and escape the KISS special bytes
+ * using the widest vector instructions the processor supports.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Kiss.h"
+#include "FrameGatherList.h"
+
+/**
+ * Finds FEND and FESC bytes for the duration of one bulk operation (escaping a frame, or decoding one
+ * read from a stream). The scan routine is the one chosen by KissCodec::SelectImplementation().
+ *
+ * In kernel mode, vector registers beyond what the kernel preserves for drivers have to be saved
+ * before they are used. A scanner saves them when it is created and restores them when it is
+ * destroyed, so the cost is paid once per operation rather than once per run. Operations too short
+ * to repay that cost use the widest routine which needs no saving instead. Scanners are meant to live
+ * on the stack and must be destroyed at the same IRQL and on the same thread that created them.
+ */
+class KissScanner
+{
+public:
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    explicit KissScanner(_In_ ULONG workLength) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    ~KissScanner() noexcept;
+
+    KissScanner(const KissScanner&) = delete;
+    KissScanner& operator=(const KissScanner&) = delete;
+
+    /**
+     * Finds the first byte which needs special handling (FEND or FESC)
+     * @param data the bytes to search
+     * @param length the number of bytes in data
+     * @returns the index of the first FEND or FESC byte, or length if there is none
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG FindSpecialByte(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) const noexcept
+    {
+        return scan(data, length);
+    }
+
+private:
+    /** Signature shared by the scalar and vector implementations of FindSpecialByte */
+    typedef ULONG ScanFunction(const BYTE* data, ULONG length);
+
+    /** Space for an XSTATE_SAVE. It is kept opaque so that the layout is the same in every build. */
+    static constexpr ULONG EXTENDED_STATE_SIZE = 16;
+
+    ScanFunction* scan;                             //<! Routine used by this scanner
+    ULONG64 extendedStateMask;                      //<! Processor state saved by this scanner, or 0
+    ULONG64 extendedState[EXTENDED_STATE_SIZE];     //<! Processor state to restore on destruction
+
+    NON_PAGEABLE_FUNCTION
+    bool trySaveExtendedState(_In_ ULONG64 mask, _In_ ULONG workLength) noexcept;
+};
+
+/**
+ * Encoding side of the KISS protocol, and selection of the scan routine shared by the encoder and
+ * KissDecoder.
+ *
+ * Payload bytes other than FEND and FESC pass through unchanged, and those two are rare in real traffic,
+ * so both directions spend nearly all of their time looking for the next special byte. The scan is done
+ * 16 bytes at a time with SSE2 or 32 bytes at a time with AVX2, and everything between two special bytes
+ * is moved with a single block copy.
+ */
+class KissCodec
+{
+public:
+    /**
+     * The available implementations of the special byte scan, from narrowest to widest
+     */
+    enum Implementation
+    {
+        Scalar,     //<! One byte at a time; available on every processor
+        Sse2,       //<! 16 bytes at a time; x86 and x64 only
+        Avx2        //<! 32 bytes at a time; x86 and x64 processors and operating systems supporting AVX2
+    };
+
+    /**
+     * Operations shorter than this do not use instructions whose registers have to be saved first (AVX2 in
+     * kernel mode, and also SSE2 in 32-bit kernel mode), as the save would cost more than the scan saves.
+     */
+    static constexpr ULONG MINIMUM_SAVED_STATE_WORK_LENGTH = 512;
+
+    /**
+     * Gets the largest possible size of a KISS frame
+     * @param payloadLength the number of bytes in the frame before escaping
+     * @returns the number of bytes needed to hold the frame if every byte must be escaped, including
+     * both FENDs and the type byte
+     */
+    NON_PAGEABLE_FUNCTION
+    static constexpr ULONG GetMaximumEncodedLength(_In_ ULONG payloadLength) noexcept
+    {
+        return 2 * payloadLength + 3;
+    }
+
+    PAGEABLE_FUNCTION
+    static Implementation SelectImplementation(_In_ Implementation maximum) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    static Implementation GetImplementation() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static bool Escape(
+        _In_reads_bytes_(length) const BYTE* data,
+        _In_ ULONG length,
+        _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+        _In_ ULONG outputSize,
+        _Out_ ULONG* written) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static bool EncodeFrame(
+        _In_ BYTE port,
+        _In_ BYTE command,
+        _In_ const FrameGatherList& frame,
+        _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+        _In_ ULONG outputSize,
+        _Out_ ULONG* written) noexcept;
+
+private:
+    NON_PAGEABLE_FUNCTION
+    static bool escapeWith(
+        _In_ const KissScanner& scanner,
+        _In_reads_bytes_(length) const BYTE* data,
+        _In_ ULONG length,
+        _Out_writes_bytes_to_(outputSize, *written) BYTE* output,
+        _In_ ULONG outputSize,
+        _Out_ ULONG* written) noexcept;
+
+    static Implementation implementation;   //<! Implementation chosen by SelectImplementation()
+
+    friend class KissScanner;
+};
@@ -0,0 +1,195 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissDecoder.cpp
+ * Implementation of the KissDecoder class, which reassembles KISS frames from a byte stream that
+ * arrives in arbitrary pieces.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "KissDecoder.h"
+#include "KissCodec.h"
+
+/**
+ * Initializes a new decoder which is waiting for the start of the first frame
+ */
+NON_PAGEABLE_FUNCTION
+KissDecoder::KissDecoder() noexcept
+    :state(Hunting)
+    ,bufferedLength(0)
+    ,directFrames(0)
+    ,bufferedFrames(0)
+    ,discardedFrames(0)
+{
+}
+
+/**
+ * Discards any partially-received frame and waits for the next FEND, as if the stream had just been opened.
+ * This should be called whenever the underlying stream is reconnected.
+ */
+NON_PAGEABLE_FUNCTION
+void KissDecoder::Reset() noexcept
+{
+    state = Hunting;
+    bufferedLength = 0;
+}
+
+/**
+ * Decodes the next piece of the KISS stream, calling the handler for every frame completed by it
+ * @param data the bytes read from the stream
+ * @param length the number of bytes in data
+ * @param handler the handler to receive each completed frame
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void KissDecoder::Decode(
+    _In_reads_bytes_(length) const BYTE* data,
+    _In_ ULONG length,
+    _Inout_ KissFrameHandler& handler) noexcept
+{
+    KissScanner scanner(length);
+    ULONG position = 0;
+    while (position < length)
+    {
+        if (state == Escaped)
+        {
+            BYTE escaped = data[position++];
+            if (escaped == Kiss::TFEND || escaped == Kiss::TFESC)
+            {
+                BYTE literal = (escaped == Kiss::TFEND) ? Kiss::FEND : Kiss::FESC;
+                state = appendToBuffer(&literal, 1) ? InFrame : Discarding;
+            }
+            else if (escaped == Kiss::FEND)
+            {
+                // A FEND always ends the frame, even straight after an escape
+                discard();
+                state = InFrame;
+            }
+            else
+            {
+                discard();
+            }
+            continue;
+        }
+
+        // Everything up to the next FEND or FESC can be handled as a single run
+        ULONG runLength = scanner.FindSpecialByte(data + position, length - position);
+        const BYTE* run = data + position;
+        position += runLength;
+        bool endOfInput = position == length;
+
+        switch (state)
+        {
+        case InFrame:
+            if (!endOfInput && bufferedLength == 0 && data[position] == Kiss::FEND)
+            {
+                // The whole frame is in the input and has no escapes - hand it over without copying
+                if (runLength != 0)
+                {
+                    directFrames++;
+                    deliver(run, runLength, handler);
+                }
+            }
+            else if (!appendToBuffer(run, runLength))
+            {
+                state = Discarding;
+            }
+            else if (!endOfInput && data[position] == Kiss::FEND && bufferedLength != 0)
+            {
+                bufferedFrames++;
+                deliver(buffer, bufferedLength, handler);
+                bufferedLength = 0;
+            }
+            break;
+
+        case Hunting:
+        case Discarding:
+        default:
+            break;
+        }
+
+        if (endOfInput)
+        {
+            break;
+        }
+
+        // Handle the FEND or FESC which ended the run
+        if (data[position++] == Kiss::FEND)
+        {
+            bufferedLength = 0;
+            state = InFrame;
+        }
+        else if (state == InFrame)
+        {
+            state = Escaped;
+        }
+    }
+}
+
+/**
+ * Appends bytes to the frame being assembled in buffer
+ * @param data the bytes to append
+ * @param length the number of bytes to append
+ * @returns true if the bytes were appended, or false if the frame has become too long and was discarded
+ */
+NON_PAGEABLE_FUNCTION
+bool KissDecoder::appendToBuffer(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept
+{
+    if (length > sizeof(buffer) - bufferedLength)
+    {
+        discard();
+        return false;
+    }
+
+    RtlCopyMemory(buffer + bufferedLength, data, length);
+    bufferedLength += length;
+    return true;
+}
+
+/**
+ * Splits the type byte off a completed frame and passes the frame to the handler
+ * @param frame the complete, unescaped frame including its type byte
+ * @param length the number of bytes in frame, which must be at least 1
+ * @param handler the handler to receive the frame
+ */
+NON_PAGEABLE_FUNCTION
+void KissDecoder::deliver(
+    _In_reads_bytes_(length) const BYTE* frame,
+    _In_ ULONG length,
+    _Inout_ KissFrameHandler& handler) noexcept
+{
+    if (length > MAX_FRAME_LENGTH + 1)
+    {
+        discardedFrames++;
+        return;
+    }
+
+    handler.KissFrameDecoded(Kiss::GetPort(frame[0]), Kiss::GetCommand(frame[0]), frame + 1, length - 1);
+}
+
+/**
+ * Abandons the frame currently being assembled. The rest of the frame, up to the next FEND, is ignored.
+ */
+NON_PAGEABLE_FUNCTION
+void KissDecoder::discard() noexcept
+{
+    discardedFrames++;
+    bufferedLength = 0;
+    state = Discarding;
+}
@@ -0,0 +1,129 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissDecoder.h
+ * Definition of the KissDecoder class, which reassembles KISS frames from a byte stream that arrives
+ * in arbitrary pieces.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Kiss.h"
+
+/**
+ * Receives the frames produced by a KissDecoder
+ */
+class KissFrameHandler
+{
+public:
+    /**
+     * Called for each complete, unescaped frame
+     * @param port the TNC port the frame was received on
+     * @param command the KISS command of the frame (Kiss::COMMAND_DATA_FRAME for AX.25 data)
+     * @param frame the frame contents, without the type byte. This memory is only valid for the
+     * duration of the call.
+     * @param length the number of bytes in frame
+     */
+    NON_PAGEABLE_FUNCTION
+    virtual void KissFrameDecoded(
+        _In_ BYTE port,
+        _In_ BYTE command,
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length) noexcept = 0;
+
+protected:
+    // Handlers are never destroyed through this interface
+    ~KissFrameHandler() = default;
+};
+
+/**
+ * Incremental KISS decoder. Bytes are fed in whatever pieces the connector happens to read them in, and
+ * each complete frame is handed to a KissFrameHandler as soon as its closing FEND arrives.
+ *
+ * When a frame lies entirely within one piece of input and contains no escapes (the common case), it is
+ * passed to the handler directly out of the input with no copy. Otherwise the frame is assembled in the
+ * decoder's own buffer, one run of unescaped bytes at a time.
+ *
+ * A decoder holds the state of one KISS stream. It is not thread safe; each stream (serial port, TCP
+ * connection, etc.) should have its own decoder. Frames on different KISS ports of the same stream are
+ * told apart by the port passed to the handler.
+ */
+class KissDecoder
+{
+public:
+    /** The largest frame, excluding the type byte, that the decoder will reassemble */
+    static constexpr ULONG MAX_FRAME_LENGTH = 1024;
+
+    NON_PAGEABLE_FUNCTION
+    KissDecoder() noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void Reset() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Decode(
+        _In_reads_bytes_(length) const BYTE* data,
+        _In_ ULONG length,
+        _Inout_ KissFrameHandler& handler) noexcept;
+
+    /** @returns the number of frames passed to the handler straight out of the input */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetDirectFrameCount() const noexcept { return directFrames; }
+
+    /** @returns the number of frames which had to be assembled in the decoder's buffer */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetBufferedFrameCount() const noexcept { return bufferedFrames; }
+
+    /** @returns the number of frames discarded for being too long or containing an invalid escape */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG64 GetDiscardedFrameCount() const noexcept { return discardedFrames; }
+
+private:
+    /**
+     * Position of the decoder within the byte stream
+     */
+    enum State
+    {
+        Hunting,    //<! Waiting for the first FEND; anything before it is noise
+        InFrame,    //<! Inside a frame (possibly an empty one)
+        Escaped,    //<! Inside a frame, immediately after a FESC
+        Discarding  //<! Inside a frame which has been found to be invalid; waiting for the next FEND
+    } state;
+
+    ULONG bufferedLength;               //<! Number of bytes of the current frame held in buffer
+    ULONG64 directFrames;               //<! Frames delivered without a copy
+    ULONG64 bufferedFrames;             //<! Frames delivered from buffer
+    ULONG64 discardedFrames;            //<! Frames discarded as invalid
+
+    /** Storage for a frame that spans more than one call to Decode() or contains escapes */
+    BYTE buffer[MAX_FRAME_LENGTH + 1];
+
+    NON_PAGEABLE_FUNCTION
+    bool appendToBuffer(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void deliver(
+        _In_reads_bytes_(length) const BYTE* frame,
+        _In_ ULONG length,
+        _Inout_ KissFrameHandler& handler) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void discard() noexcept;
+};
@@ -272,7 +272,38 @@ NDIS_STATUS Miniport::miniportInitializeEx(_In_ PNDIS_MINIPORT_INIT_PARAMETERS i
         return NDIS_STATUS_RESOURCES;
     }
 
-    return thisAdapter->adapter->SetMiniportAttributes();
+    NDIS_STATUS status = thisAdapter->adapter->SetMiniportAttributes();
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    // Missing configuration is not fatal - the adapter keeps its defaults
+    if (thisAdapter->adapter->ReadConfiguration() != NDIS_STATUS_SUCCESS)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, TRACE_DRIVER, "Adapter configuration could not be read; using defaults");
+    }
+
+    // The MTU depends on the configuration, so the general attributes can only be set once it has been read
+    status = thisAdapter->adapter->SetGeneralAttributes();
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    status = thisAdapter->adapter->AllocateStatistics();
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    status = thisAdapter->adapter->AllocateDataLinks();
+    if (status != NDIS_STATUS_SUCCESS)
+    {
+        return status;
+    }
+
+    return thisAdapter->adapter->AllocateReceiveBuffers();
 }
 
 /**
@@ -0,0 +1,183 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file MulticastFilter.cpp
+ * Implementation of the MulticastFilter class, which holds the multicast groups joined on an adapter
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "MulticastFilter.h"
+
+/**
+ * Initializes a new filter with no groups joined
+ */
+NON_PAGEABLE_FUNCTION
+MulticastFilter::MulticastFilter() noexcept
+    :generation(0)
+{
+    RtlZeroMemory(tables, sizeof(tables));
+}
+
+/**
+ * Replaces the joined groups with a new list. Frames being checked on other processors see either the
+ * old list or the new one.
+ * @param addresses the Ethernet addresses of the groups, packed one after another as in
+ * OID_802_3_MULTICAST_LIST
+ * @param count the number of addresses
+ * @returns true if the list was replaced, or false if it has more than MAX_ADDRESSES entries or holds an
+ * address which is not a group address (in which case the current list is kept)
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+bool MulticastFilter::SetAddresses(_In_reads_bytes_(count * ADDRESS_LENGTH) const BYTE* addresses, _In_ ULONG count) noexcept
+{
+    if (count > MAX_ADDRESSES)
+    {
+        return false;
+    }
+
+    for (ULONG i = 0; i < count; i++)
+    {
+        if (!IsGroupAddress(addresses + i * ADDRESS_LENGTH))
+        {
+            return false;
+        }
+    }
+
+    const LONG current = generation;
+    Table& table = tables[(current + 1) & 1];
+    RtlZeroMemory(&table, sizeof(table));
+    for (ULONG i = 0; i < count; i++)
+    {
+        const ULONG64 key = makeKey(addresses + i * ADDRESS_LENGTH);
+        const ULONG64 hash = hashKey(key);
+        const ULONG summaryBit = static_cast<ULONG>(hash >> (64 - SUMMARY_INDEX_BITS));
+        table.summary[summaryBit / 64] |= 1ULL << (summaryBit % 64);
+
+        ULONG slot = static_cast<ULONG>(hash) & (SLOT_COUNT - 1);
+        while (table.slots[slot] != 0 && table.slots[slot] != key)
+        {
+            slot = (slot + 1) & (SLOT_COUNT - 1);
+        }
+
+        // NDIS may pass the same group twice; the list answers queries, so it only holds it once
+        if (table.slots[slot] == 0)
+        {
+            table.slots[slot] = key;
+            table.list[table.count++] = key;
+        }
+    }
+
+    // Publish the table: readers of the previous generation are unaffected, and readers of the one before
+    // (whose table was just overwritten) see the generation change and try again
+    InterlockedExchange(&generation, current + 1);
+    return true;
+}
+
+/**
+ * Copies the current list of groups in the format of OID_802_3_MULTICAST_LIST
+ * @param buffer receives the addresses, packed one after another
+ * @param bufferLength the size of buffer in bytes
+ * @returns the number of bytes written, or the number of bytes required if buffer is too small (in which
+ * case nothing is written)
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+ULONG MulticastFilter::GetAddresses(_Out_writes_bytes_(bufferLength) BYTE* buffer, _In_ ULONG bufferLength) const noexcept
+{
+    const Table& table = tables[generation & 1];
+    const ULONG length = table.count * ADDRESS_LENGTH;
+    if (bufferLength >= length)
+    {
+        for (ULONG i = 0; i < table.count; i++)
+        {
+            RtlCopyMemory(buffer + i * ADDRESS_LENGTH, &table.list[i], ADDRESS_LENGTH);
+        }
+    }
+
+    return length;
+}
+
+/**
+ * Checks whether a group has been joined
+ * @param ethernetAddress the destination address of a received frame
+ * @returns true if the address is in the current list
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+bool MulticastFilter::Contains(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) const noexcept
+{
+    const ULONG64 key = makeKey(ethernetAddress);
+    const ULONG64 hash = hashKey(key);
+    const ULONG summaryBit = static_cast<ULONG>(hash >> (64 - SUMMARY_INDEX_BITS));
+
+    for (;;)
+    {
+        const LONG observed = generation;
+        KeMemoryBarrier();
+        const Table& table = tables[observed & 1];
+
+        // Most frames to groups which were not joined stop here
+        bool found = (table.summary[summaryBit / 64] >> (summaryBit % 64)) & 1;
+        if (found)
+        {
+            // The probe is bounded even if the table is being rewritten underneath us
+            ULONG slot = static_cast<ULONG>(hash) & (SLOT_COUNT - 1);
+            ULONG64 occupant = table.slots[slot];
+            for (ULONG probe = 1; occupant != key && occupant != 0 && probe < SLOT_COUNT; probe++)
+            {
+                slot = (slot + 1) & (SLOT_COUNT - 1);
+                occupant = table.slots[slot];
+            }
+            found = occupant == key;
+        }
+
+        KeMemoryBarrier();
+        if (generation == observed)
+        {
+            return found;
+        }
+    }
+}
+
+/**
+ * Packs an Ethernet address into an integer
+ * @param ethernetAddress the Ethernet address
+ * @returns the address in the low 48 bits
+ */
+NON_PAGEABLE_FUNCTION
+ULONG64 MulticastFilter::makeKey(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+{
+    ULONG64 key = 0;
+    RtlCopyMemory(&key, ethernetAddress, ADDRESS_LENGTH);
+    return key;
+}
+
+/**
+ * Mixes a key so that both its high bits (the summary bit) and its low bits (the home slot) depend on
+ * every byte of the address. Group addresses differ mostly in their last bytes.
+ * @param key the packed Ethernet address
+ * @returns the hash of the key
+ */
+NON_PAGEABLE_FUNCTION
+ULONG64 MulticastFilter::hashKey(_In_ ULONG64 key) noexcept
+{
+    ULONG64 hash = key * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 32);
+}
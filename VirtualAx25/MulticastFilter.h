@@ -0,0 +1,111 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file MulticastFilter.h
+ * Definition of the MulticastFilter class, which holds the multicast groups joined on an adapter
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * The set of multicast Ethernet addresses joined on an adapter (OID_802_3_MULTICAST_LIST), arranged so that
+ * a received frame is checked against it in constant time, however many groups are joined.
+ *
+ * Each list is built into a table holding two structures. The first is a summary bitmap with one bit set
+ * for the hash of each address; most frames to groups which were not joined stop after testing one bit. The
+ * second is an open addressed hash table of the addresses themselves, kept at most half full, which confirms
+ * a match exactly.
+ *
+ * There are two tables. SetAddresses builds the new list into the table not in use and then publishes it by
+ * incrementing a generation count. Contains reads the table for the generation it saw, and tries again if
+ * the generation changed while it was reading, so a lookup never takes a lock and never sees half a list.
+ * SetAddresses must only be called by one thread at a time, which NDIS guarantees for OID requests.
+ */
+class MulticastFilter
+{
+public:
+    static constexpr ULONG ADDRESS_LENGTH = 6;                      //<! Bytes in an Ethernet address
+    static constexpr ULONG MAX_ADDRESSES = 256;                     //<! Largest number of groups joined at once
+
+    NON_PAGEABLE_FUNCTION
+    MulticastFilter() noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    bool SetAddresses(_In_reads_bytes_(count * ADDRESS_LENGTH) const BYTE* addresses, _In_ ULONG count) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    ULONG GetAddresses(_Out_writes_bytes_(bufferLength) BYTE* buffer, _In_ ULONG bufferLength) const noexcept;
+
+    /**
+     * @param ethernetAddress an Ethernet address
+     * @returns true if the address is a group address (multicast or broadcast)
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline bool IsGroupAddress(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+    {
+        return (ethernetAddress[0] & 0x01) != 0;
+    }
+
+    /**
+     * @param ethernetAddress an Ethernet address
+     * @returns true if the address is the broadcast address, ff-ff-ff-ff-ff-ff
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline bool IsBroadcastAddress(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+    {
+        return (ethernetAddress[0] & ethernetAddress[1] & ethernetAddress[2] &
+                ethernetAddress[3] & ethernetAddress[4] & ethernetAddress[5]) == 0xFF;
+    }
+
+    /** @returns the number of addresses in the current list */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetCount() const noexcept { return tables[generation & 1].count; }
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    bool Contains(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) const noexcept;
+
+private:
+    static constexpr ULONG SLOT_INDEX_BITS = 9;                     //<! Bits of the hash used to choose a slot
+    static constexpr ULONG SLOT_COUNT = 1 << SLOT_INDEX_BITS;       //<! Slots in each hash table
+    static constexpr ULONG SUMMARY_INDEX_BITS = 12;                 //<! Bits of the hash used to choose a summary bit
+    static constexpr ULONG SUMMARY_WORDS = (1 << SUMMARY_INDEX_BITS) / 64;  //<! 64-bit words in each summary
+    static_assert(2 * MAX_ADDRESSES <= SLOT_COUNT, "hash tables must stay at most half full");
+
+    /** One complete list. A slot holding 0 is empty; no multicast address packs to 0. */
+    struct Table
+    {
+        ULONG64 summary[SUMMARY_WORDS];     //<! One bit set for the hash of each address
+        ULONG64 slots[SLOT_COUNT];          //<! Addresses, indexed by hash with linear probing
+        ULONG64 list[MAX_ADDRESSES];        //<! Addresses in the order they were set, for queries
+        ULONG count;                        //<! Entries in use in list
+    };
+
+    Table tables[2];                        //<! The current list, and the one being built
+    volatile LONG generation;               //<! Incremented as each list is published; its low bit selects the table
+
+    NON_PAGEABLE_FUNCTION
+    static ULONG64 makeKey(_In_reads_bytes_(ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    static ULONG64 hashKey(_In_ ULONG64 key) noexcept;
+};
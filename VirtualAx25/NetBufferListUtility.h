@@ -0,0 +1,87 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file NetBufferListUtility.h
+ * Helpers for working with chains of NET_BUFFER_LIST objects that are shared between the
+ * Miniport and the AX25Adapter.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * Link traits for an InterlockedChainQueue of NET_BUFFER_LIST chains. The first miniport-reserved
+ * field of the head of each chain is used to link chains to each other, which leaves the
+ * NET_BUFFER_LIST_NEXT_NBL linkage within each chain untouched.
+ */
+struct NetBufferListChainLink
+{
+    NON_PAGEABLE_FUNCTION
+    static inline NET_BUFFER_LIST*& Link(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        return reinterpret_cast<NET_BUFFER_LIST*&>(NET_BUFFER_LIST_MINIPORT_RESERVED(&netBufferList)[0]);
+    }
+};
+
+/**
+ * Traits for a TransmitScheduler of NET_BUFFER_LIST objects. Each NET_BUFFER_LIST is taken out of the chain
+ * it was sent in before it is scheduled, so NET_BUFFER_LIST_NEXT_NBL links it to the one behind it, and the
+ * second miniport-reserved field holds the time it was enqueued.
+ */
+struct NetBufferListTransmitLink
+{
+    NON_PAGEABLE_FUNCTION
+    static inline NET_BUFFER_LIST*& Next(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        return NET_BUFFER_LIST_NEXT_NBL(&netBufferList);
+    }
+
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG_PTR& EnqueueTime(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        return reinterpret_cast<ULONG_PTR&>(NET_BUFFER_LIST_MINIPORT_RESERVED(&netBufferList)[1]);
+    }
+
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG Length(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        ULONG length = 0;
+        for (NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(&netBufferList); netBuffer != nullptr; netBuffer = NET_BUFFER_NEXT_NB(netBuffer))
+        {
+            length += NET_BUFFER_DATA_LENGTH(netBuffer);
+        }
+        return length;
+    }
+};
+
+/**
+ * Sets the completion status of every NET_BUFFER_LIST in the specified chain
+ * @param netBufferList the head of a linked list of NET_BUFFER_LIST objects, or nullptr
+ * @param status the status to assign to each NET_BUFFER_LIST in the chain
+ */
+NON_PAGEABLE_FUNCTION
+inline void markNetBufferListWithFailure(
+    _Inout_opt_ NET_BUFFER_LIST* netBufferList,
+    _In_ NDIS_STATUS status) noexcept
+{
+    for (NET_BUFFER_LIST* current = netBufferList; current != nullptr; current = NET_BUFFER_LIST_NEXT_NBL(current))
+    {
+        NET_BUFFER_LIST_STATUS(current) = status;
+    }
+}
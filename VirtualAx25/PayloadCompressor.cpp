@@ -0,0 +1,240 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file PayloadCompressor.cpp
+ * Implementation of the PayloadCompressor class.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "PayloadCompressor.h"
+
+/** Control bytes below this start a run of literals */
+static constexpr BYTE MAX_LITERAL_RUN = 32;
+
+/** The length field of a control byte which is continued in the next byte */
+static constexpr ULONG LONG_MATCH = 7;
+
+/** Most bytes one step of Compress() can add to the output: a long copy, and the control byte after it */
+static constexpr ULONG MAX_STEP_LENGTH = 4;
+
+/**
+ * Initializes a new compressor
+ */
+NON_PAGEABLE_FUNCTION
+PayloadCompressor::PayloadCompressor() noexcept
+{
+    RtlZeroMemory(hashTable, sizeof(hashTable));
+    RtlZeroMemory(&counters, sizeof(counters));
+}
+
+/**
+ * Compresses a datagram, if that makes it shorter
+ * @param pid the PID of the datagram, which is sent as the first byte of the compressed information field
+ * @param datagram the datagram
+ * @param length the number of bytes in datagram
+ * @param output receives the information field to send with PID_COMPRESSED
+ * @param capacity the number of bytes at output
+ * @returns the number of bytes written to output, which is less than length; or 0 if the datagram should be
+ * sent as it is, because it is too short, incompressible, or does not fit in output compressed
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG PayloadCompressor::Compress(
+    _In_ BYTE pid,
+    _In_reads_bytes_(length) const BYTE* datagram,
+    _In_ ULONG length,
+    _Out_writes_bytes_to_(capacity, return) BYTE* output,
+    _In_ ULONG capacity) noexcept
+{
+    // Positions are kept plus one in 16 bits
+    if (length < MIN_LENGTH || length >= MAXUSHORT)
+    {
+        counters.Skipped++;
+        return 0;
+    }
+
+    const ULONG limit = (capacity < length - 1) ? capacity : length - 1;
+    RtlZeroMemory(hashTable, sizeof(hashTable));
+    ULONG in = 0;
+    ULONG out = 0;
+    output[out++] = pid;
+    ULONG control = out++;
+    ULONG literals = 0;
+    bool sampled = false;
+    while (in < length)
+    {
+        if (out + MAX_STEP_LENGTH > limit || (!sampled && in >= SAMPLE_LENGTH && out >= in))
+        {
+            counters.Skipped++;
+            return 0;
+        }
+        sampled = sampled || in >= SAMPLE_LENGTH;
+
+        ULONG match = 0;
+        ULONG reference = 0;
+        if (length - in >= MIN_MATCH)
+        {
+            USHORT& slot = hashTable[hash(datagram + in)];
+            reference = slot;
+            slot = static_cast<USHORT>(in + 1);
+            if (reference != 0 && in - (reference - 1) <= MAX_OFFSET)
+            {
+                reference--;
+                const ULONG longest = (length - in < MAX_MATCH) ? length - in : MAX_MATCH;
+                while (match < longest && datagram[reference + match] == datagram[in + match])
+                {
+                    match++;
+                }
+            }
+        }
+
+        if (match < MIN_MATCH)
+        {
+            output[out++] = datagram[in++];
+            if (++literals == MAX_LITERAL_RUN)
+            {
+                output[control] = MAX_LITERAL_RUN - 1;
+                control = out++;
+                literals = 0;
+            }
+            continue;
+        }
+
+        // Close the run of literals before the copy, or drop its control byte if it is empty
+        if (literals == 0)
+        {
+            out--;
+        }
+        else
+        {
+            output[control] = static_cast<BYTE>(literals - 1);
+        }
+
+        const ULONG offset = in - reference - 1;
+        const ULONG lengthField = match - MIN_MATCH + 1;
+        if (lengthField < LONG_MATCH)
+        {
+            output[out++] = static_cast<BYTE>((lengthField << 5) | (offset >> 8));
+        }
+        else
+        {
+            output[out++] = static_cast<BYTE>((LONG_MATCH << 5) | (offset >> 8));
+            output[out++] = static_cast<BYTE>(lengthField - LONG_MATCH);
+        }
+        output[out++] = static_cast<BYTE>(offset);
+
+        // The positions inside the copy are hashed too, so that later repeats of them are found
+        for (ULONG position = in + 1; position < in + match && length - position >= MIN_MATCH; position++)
+        {
+            hashTable[hash(datagram + position)] = static_cast<USHORT>(position + 1);
+        }
+        in += match;
+        control = out++;
+        literals = 0;
+    }
+
+    if (literals == 0)
+    {
+        out--;
+    }
+    else
+    {
+        output[control] = static_cast<BYTE>(literals - 1);
+    }
+
+    counters.Compressed++;
+    counters.BytesIn += length + 1;
+    counters.BytesOut += out;
+    return out;
+}
+
+/**
+ * Restores a datagram received with PID_COMPRESSED
+ * @param information the information field
+ * @param length the number of bytes in information
+ * @param pid receives the PID of the datagram
+ * @param datagram receives the datagram
+ * @param capacity the number of bytes at datagram
+ * @returns the number of bytes in the datagram, or 0 if the information field is malformed or the datagram is
+ * longer than capacity
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+ULONG PayloadCompressor::Decompress(
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length,
+    _Out_ BYTE& pid,
+    _Out_writes_bytes_to_(capacity, return) BYTE* datagram,
+    _In_ ULONG capacity) noexcept
+{
+    pid = 0;
+    if (length < 2)
+    {
+        return 0;
+    }
+
+    ULONG in = 1;
+    ULONG out = 0;
+    while (in < length)
+    {
+        const ULONG control = information[in++];
+        if (control < MAX_LITERAL_RUN)
+        {
+            const ULONG run = control + 1;
+            if (run > length - in || run > capacity - out)
+            {
+                return 0;
+            }
+            RtlCopyMemory(datagram + out, information + in, run);
+            in += run;
+            out += run;
+            continue;
+        }
+
+        ULONG match = control >> 5;
+        if (match == LONG_MATCH)
+        {
+            if (in >= length)
+            {
+                return 0;
+            }
+            match += information[in++];
+        }
+        if (in >= length)
+        {
+            return 0;
+        }
+
+        const ULONG offset = ((control & 0x1F) << 8) + information[in++] + 1;
+        match += MIN_MATCH - 1;
+        if (offset > out || match > capacity - out)
+        {
+            return 0;
+        }
+
+        // The copy may overlap what it is copying, so it goes a byte at a time
+        for (ULONG i = 0; i < match; i++, out++)
+        {
+            datagram[out] = datagram[out - offset];
+        }
+    }
+
+    pid = information[0];
+    return out;
+}
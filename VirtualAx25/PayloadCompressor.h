@@ -0,0 +1,113 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file PayloadCompressor.h
+ * Definition of the PayloadCompressor class, which compresses the datagrams sent over connected-mode links
+ * with a small LZ77 codec.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+
+/**
+ * Compresses datagrams one at a time in the format of LZF: a control byte below 32 is followed by that many
+ * literal bytes plus one, and any other holds the length and high bits of the offset of a copy of at least
+ * MIN_MATCH earlier bytes, with the rest of the offset (and of a long length) in the bytes after it. A
+ * compressed datagram is sent with PID_COMPRESSED, its own PID being the first byte of the information field.
+ *
+ * Each datagram is compressed on its own, with no history carried over from the last, so that one which is
+ * dropped (by a link reset, or by the segment reassembler) costs nothing but itself. The only memory is the
+ * hash table of recent positions, which is cleared for each datagram: a compressor needs no allocation and can
+ * run at DISPATCH_LEVEL, and one compressor serves every link. Decompression needs no state at all.
+ *
+ * Incompressible datagrams (encrypted or already compressed) are given up on cheaply: shorter than
+ * MIN_LENGTH they are not tried, and a datagram whose first SAMPLE_LENGTH bytes saved nothing is given up on
+ * there. Anything which would not come out at least a byte shorter is sent as it is.
+ *
+ * Only another station running this driver understands PID_COMPRESSED, so in Automatic mode the owner only
+ * compresses datagrams to a peer once it has received a compressed datagram from that peer.
+ */
+class PayloadCompressor
+{
+public:
+    /** When datagrams are compressed, as set by the PayloadCompression keyword */
+    enum Mode : ULONG
+    {
+        Disabled = 0,   //<! Never
+        Automatic = 1,  //<! To peers which have sent compressed datagrams
+        Enabled = 2,    //<! To every peer
+    };
+
+    /** PID of a compressed datagram. AX.25 2.2 leaves it unassigned, so both ends must run this driver. */
+    static constexpr BYTE PID_COMPRESSED = 0x0C;
+    static constexpr ULONG MIN_LENGTH = 32;         //<! Shortest datagram which is worth trying to compress
+    static constexpr ULONG SAMPLE_LENGTH = 256;     //<! Bytes in which a datagram must show some saving
+    static constexpr ULONG MIN_MATCH = 3;           //<! Shortest copy of earlier bytes
+    static constexpr ULONG MAX_MATCH = MIN_MATCH - 1 + 7 + MAXUCHAR;    //<! Longest copy of earlier bytes
+    static constexpr ULONG MAX_OFFSET = 1 << 13;    //<! Furthest back a copy can come from
+
+    /** Counts of what happened to the datagrams offered to Compress() */
+    struct Counters
+    {
+        ULONG64 Compressed;     //<! Datagrams compressed
+        ULONG64 Skipped;        //<! Datagrams sent as they are because they were too short or incompressible
+        ULONG64 BytesIn;        //<! Bytes in the datagrams compressed, with their PIDs
+        ULONG64 BytesOut;       //<! Bytes the compressed datagrams came to, with their PIDs
+    };
+
+    NON_PAGEABLE_FUNCTION
+    PayloadCompressor() noexcept;
+
+    /** @returns the counts of what happened to the datagrams offered to Compress() */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    ULONG Compress(
+        _In_ BYTE pid,
+        _In_reads_bytes_(length) const BYTE* datagram,
+        _In_ ULONG length,
+        _Out_writes_bytes_to_(capacity, return) BYTE* output,
+        _In_ ULONG capacity) noexcept;
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static ULONG Decompress(
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length,
+        _Out_ BYTE& pid,
+        _Out_writes_bytes_to_(capacity, return) BYTE* datagram,
+        _In_ ULONG capacity) noexcept;
+
+private:
+    static constexpr ULONG HASH_BITS = 10;                  //<! Bits in the index of hashTable
+    static constexpr ULONG HASH_SIZE = 1 << HASH_BITS;      //<! Entries in hashTable
+
+    /** @returns the entry of hashTable for the MIN_MATCH bytes at data (Fibonacci hashing) */
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG hash(_In_reads_bytes_(MIN_MATCH) const BYTE* data) noexcept
+    {
+        const ULONG value = (static_cast<ULONG>(data[0]) << 16) | (static_cast<ULONG>(data[1]) << 8) | data[2];
+        return (value * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    USHORT hashTable[HASH_SIZE];    //<! The last position plus one at which each hash was seen, or 0
+    Counters counters;              //<! Counts of what happened to the datagrams offered to Compress()
+};
@@ -22,6 +22,8 @@
  * @author Matthew P. Del Buono (KG7UDH)
  */
 
+#pragma once
+
 //
 // Define an Interface Guid so that app can find the device and talk to it.
 //
@@ -29,3 +31,117 @@
 DEFINE_GUID (GUID_DEVINTERFACE_VirtualAx25,
     0xcb87cb36,0x8c86,0x4932,0x84,0x11,0xca,0x6a,0x08,0x62,0xe1,0x06);
 // {cb87cb36-8c86-4932-8411-ca6a0862e106}
+
+//
+// Vendor-specific OIDs. These report driver internals that are useful when tuning an adapter, and
+// some of them can also be set to do the tuning; they are not needed for normal operation.
+//
+
+/** Queries an AX25_RECEIVE_BATCH_HISTOGRAM describing how received frames have been batched */
+#define OID_AX25_RECEIVE_BATCH_HISTOGRAM 0xFFA25001
+
+/** Number of buckets in AX25_RECEIVE_BATCH_HISTOGRAM */
+#define AX25_RECEIVE_BATCH_HISTOGRAM_BUCKETS 8
+
+/**
+ * Histogram of the number of frames handed to NDIS per receive indication. Bucket i counts the
+ * indications of between 2^i and 2^(i+1)-1 frames; the last bucket also counts anything larger.
+ */
+typedef struct _AX25_RECEIVE_BATCH_HISTOGRAM
+{
+    ULONG BatchLimit;           // Largest number of frames indicated at once (the ReceiveBatchSize keyword)
+    ULONG64 DeferredBatches;    // Number of times frames were left for the next DPC because the limit was reached
+    ULONG64 Batches[AX25_RECEIVE_BATCH_HISTOGRAM_BUCKETS];
+} AX25_RECEIVE_BATCH_HISTOGRAM;
+
+/** Queries an AX25_HEADER_CACHE_STATISTICS describing the Ethernet to AX.25 header translation cache */
+#define OID_AX25_HEADER_CACHE_STATISTICS 0xFFA25002
+
+/**
+ * Statistics of the cache which maps the Ethernet addresses seen by the network stack to prebuilt
+ * AX.25 headers (callsign and digipeater path)
+ */
+typedef struct _AX25_HEADER_CACHE_STATISTICS
+{
+    ULONG Capacity;                 // Number of entries the cache can hold
+    ULONG Entries;                  // Number of entries currently in use
+    ULONG64 Hits;                   // Transmitted frames whose header came from the cache
+    ULONG64 Misses;                 // Transmitted frames whose header had to be built
+    ULONG64 PathsLearned;           // Digipeater paths learned from, or changed by, received frames
+    ULONG64 Evictions;              // Entries replaced to make room for another address
+    ULONG64 UntranslatableFrames;   // Frames dropped because their addresses or protocol have no translation
+} AX25_HEADER_CACHE_STATISTICS;
+
+/**
+ * Queries an AX25_RECEIVE_MODERATION describing how received frames are coalesced, or sets its
+ * FrameThreshold and TimeoutMicroseconds (the other members are ignored when setting). Coalescing is
+ * turned on and off through OID_GEN_INTERRUPT_MODERATION.
+ */
+#define OID_AX25_RECEIVE_MODERATION 0xFFA25003
+
+/**
+ * Parameters and effect of receive coalescing. While it is enabled, received frames wait until either
+ * FrameThreshold of them have arrived or the first has waited TimeoutMicroseconds, and are then
+ * indicated together.
+ */
+typedef struct _AX25_RECEIVE_MODERATION
+{
+    ULONG Enabled;                  // Nonzero while frames are being coalesced
+    ULONG FrameThreshold;           // Waiting frames which are indicated without waiting for the timeout (1 to 64)
+    ULONG TimeoutMicroseconds;      // Longest time the first waiting frame waits (50 to 100000)
+    ULONG64 FramesIndicated;        // Frames indicated by the receive DPC
+    ULONG64 DpcRuns;                // Times the receive DPC has run
+    ULONG64 FramesPerHundredDpcs;   // Coalescing ratio: FramesIndicated per 100 DpcRuns
+} AX25_RECEIVE_MODERATION;
+
+/**
+ * Queries an AX25_HEADER_COMPRESSION_STATISTICS describing the compression of TCP/IP headers (RFC 1144) on
+ * connected-mode links
+ */
+#define OID_AX25_HEADER_COMPRESSION_STATISTICS 0xFFA25004
+
+/**
+ * Statistics of TCP/IP header compression. Datagrams are counted over every peer the adapter has exchanged
+ * compressed datagrams with since it was started.
+ */
+typedef struct _AX25_HEADER_COMPRESSION_STATISTICS
+{
+    ULONG Mode;                     // 0 if disabled, 1 toward peers which compress, 2 toward every peer (the HeaderCompression keyword)
+    ULONG Peers;                    // Peers whose compression state is currently kept
+    ULONG64 PacketsCompressed;      // TCP/IP datagrams sent with a compressed header
+    ULONG64 PacketsUncompressed;    // TCP/IP datagrams sent whole, to start or resynchronize a connection
+    ULONG64 BytesSaved;             // Header bytes left out of the datagrams sent
+    ULONG64 PacketsDecompressed;    // Compressed datagrams received and restored
+    ULONG64 PacketsRefreshed;       // TCP/IP datagrams received whole
+    ULONG64 PacketsDropped;         // Received datagrams dropped because their header could not be restored
+} AX25_HEADER_COMPRESSION_STATISTICS;
+
+/** Queries an AX25_TRANSMIT_CLASS_STATISTICS describing the transmit queue of each traffic class */
+#define OID_AX25_TRANSMIT_CLASS_STATISTICS 0xFFA25005
+
+/** Number of transmit classes, and of entries in AX25_TRANSMIT_CLASS_STATISTICS */
+#define AX25_TRANSMIT_CLASS_COUNT 4
+
+/**
+ * The transmit queue of one traffic class. Sojourn time is the time a frame waited in the driver, from
+ * its classification to its hand-over to the radio.
+ */
+typedef struct _AX25_TRANSMIT_CLASS
+{
+    ULONG Depth;                        // Frames waiting now
+    ULONG MaxDepth;                     // Most frames that have waited at once
+    ULONG64 Frames;                     // Frames which have left the queue
+    ULONG64 Bytes;                      // Bytes in the frames which have left the queue
+    ULONG64 TotalSojournMilliseconds;   // Sojourn time of those frames, added up: divide by Frames for the mean
+    ULONG64 MaxSojournMilliseconds;     // Longest sojourn time of any of them
+} AX25_TRANSMIT_CLASS;
+
+/**
+ * Statistics of the transmit classes, which the 802.1p priority of each frame chooses between: Classes[0] is
+ * network control (priority 6 and 7, and ARP), served first; then interactive (4 and 5), normal (0 and 3) and
+ * bulk (1 and 2), which share what is left in the ratio 4:2:1.
+ */
+typedef struct _AX25_TRANSMIT_CLASS_STATISTICS
+{
+    AX25_TRANSMIT_CLASS Classes[AX25_TRANSMIT_CLASS_COUNT];
+} AX25_TRANSMIT_CLASS_STATISTICS;
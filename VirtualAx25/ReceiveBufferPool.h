@@ -0,0 +1,331 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveBufferPool.h
+ * Definition of the ReceiveBufferPool class, a fixed set of preallocated NET_BUFFER_LIST objects
+ * used to indicate received frames to NDIS.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "InterlockedChainQueue.h"
+#include "NetBufferListUtility.h"
+
+/**
+ * A pool of preallocated receive buffers. Each buffer is a NET_BUFFER_LIST with a single NET_BUFFER,
+ * described by a single MDL over a fixed-size block of non-pageable memory. Everything is allocated
+ * up front by Allocate(), so the receive path never calls into the allocator.
+ *
+ * Buffers are taken by a single consumer (the adapter's receive path) and returned by any number of
+ * producers (NDIS calls MiniportReturnNetBufferLists on whatever processor the protocol finished on).
+ * Returned chains go onto an InterlockedChainQueue; the consumer keeps a private free list and only
+ * touches the shared queue when that list runs out. Neither side ever takes a lock.
+ *
+ * When the pool runs dry, Take() returns nullptr and the frame must be dropped; the number of times
+ * this happens is reported as OID_GEN_RCV_NO_BUFFER. Before that point, IsLow() tells the receive path
+ * to indicate with NDIS_RECEIVE_FLAGS_RESOURCES so that buffers come straight back to the pool.
+ */
+class ReceiveBufferPool
+{
+public:
+    /**
+     * Initializes an empty pool. No buffers are available until Allocate() is called.
+     */
+    NON_PAGEABLE_FUNCTION
+    inline ReceiveBufferPool() noexcept
+        :ndisHandle(nullptr)
+        ,poolHandle(nullptr)
+        ,dataBlock(nullptr)
+        ,bufferSize(0)
+        ,capacity(0)
+        ,freeChain(nullptr)
+        ,pendingChains(nullptr)
+        ,available(0)
+        ,lowWaterMark(0)
+        ,exhaustedCount(0)
+    {
+    }
+
+    /**
+     * Allocates the buffers for this pool. If any allocation fails, everything allocated so far is
+     * released again.
+     * @param handle the NDIS handle with which to allocate the buffers
+     * @param bufferCount the number of buffers in the pool
+     * @param size the size of each buffer in bytes, which must be large enough for the largest frame
+     * the adapter will indicate
+     * @returns NDIS_STATUS_SUCCESS if all of the buffers were allocated, or NDIS_STATUS_RESOURCES otherwise
+     */
+    _IRQL_requires_(PASSIVE_LEVEL)
+    _Must_inspect_result_
+    PAGEABLE_FUNCTION
+    inline NDIS_STATUS Allocate(
+        _In_ NDIS_HANDLE handle,
+        _In_ ULONG bufferCount,
+        _In_ ULONG size) noexcept
+    {
+        ASSERT(poolHandle == nullptr);
+        ndisHandle = handle;
+        bufferSize = size;
+
+        NET_BUFFER_LIST_POOL_PARAMETERS poolParameters;
+        RtlZeroMemory(&poolParameters, sizeof(poolParameters));
+        poolParameters.Header.Type = NDIS_OBJECT_TYPE_DEFAULT;
+        poolParameters.Header.Revision = NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1;
+        poolParameters.Header.Size = NDIS_SIZEOF_NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1;
+        poolParameters.ProtocolId = NDIS_PROTOCOL_ID_DEFAULT;
+        poolParameters.fAllocateNetBuffer = TRUE;
+        poolParameters.PoolTag = RECEIVE_POOL_TAG;
+        poolHandle = NdisAllocateNetBufferListPool(handle, &poolParameters);
+        if (poolHandle == nullptr)
+        {
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        // All of the data lives in one block so that the pool costs a single allocation
+        ULONG64 blockSize = static_cast<ULONG64>(bufferCount) * size;
+        if (blockSize > MAXUINT)
+        {
+            Free();
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        dataBlock = static_cast<BYTE*>(NdisAllocateMemoryWithTagPriority(handle, static_cast<UINT>(blockSize), RECEIVE_POOL_TAG, NormalPoolPriority));
+        if (dataBlock == nullptr)
+        {
+            Free();
+            return NDIS_STATUS_RESOURCES;
+        }
+
+        for (ULONG i = 0; i < bufferCount; i++)
+        {
+            BYTE* data = dataBlock + static_cast<size_t>(i) * size;
+            PMDL mdl = NdisAllocateMdl(handle, data, size);
+            if (mdl == nullptr)
+            {
+                Free();
+                return NDIS_STATUS_RESOURCES;
+            }
+
+            NET_BUFFER_LIST* netBufferList = NdisAllocateNetBufferAndNetBufferList(poolHandle, 0, 0, mdl, 0, size);
+            if (netBufferList == nullptr)
+            {
+                NdisFreeMdl(mdl);
+                Free();
+                return NDIS_STATUS_RESOURCES;
+            }
+
+            netBufferList->SourceHandle = handle;
+            dataLink(*netBufferList) = data;
+
+            // Buffers only count towards the capacity once they are fully built, so that Free() can
+            // tell whether it has recovered everything
+            capacity++;
+            NET_BUFFER_LIST_NEXT_NBL(netBufferList) = freeChain;
+            freeChain = netBufferList;
+            available++;
+        }
+
+        lowWaterMark = available;
+        return NDIS_STATUS_SUCCESS;
+    }
+
+    /**
+     * Releases every buffer in this pool. All buffers must have been returned to the pool.
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void Free() noexcept
+    {
+        ASSERT(available == static_cast<LONG>(capacity));
+        for (NET_BUFFER_LIST* netBufferList = Take(); netBufferList != nullptr; netBufferList = Take())
+        {
+            NdisFreeMdl(NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(netBufferList)));
+            NdisFreeNetBufferList(netBufferList);
+        }
+        capacity = 0;
+
+        if (dataBlock != nullptr)
+        {
+            NdisFreeMemoryWithTagPriority(ndisHandle, dataBlock, RECEIVE_POOL_TAG);
+            dataBlock = nullptr;
+        }
+
+        if (poolHandle != nullptr)
+        {
+            NdisFreeNetBufferListPool(poolHandle);
+            poolHandle = nullptr;
+        }
+    }
+
+    /**
+     * Takes a buffer from the pool. Only one caller may take buffers at a time.
+     * @returns a NET_BUFFER_LIST whose data starts at the beginning of its GetBufferSize() byte data buffer and
+     * fills it, or nullptr if the pool is empty
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    _Ret_maybenull_
+    NON_PAGEABLE_FUNCTION
+    inline NET_BUFFER_LIST* Take() noexcept
+    {
+        if (freeChain == nullptr)
+        {
+            // Pick up anything returned since the last refill. Returned chains are used one at a time
+            // rather than being joined together, so that a refill never walks a chain.
+            if (pendingChains == nullptr)
+            {
+                pendingChains = returnedChains.DequeueAll();
+                if (pendingChains == nullptr)
+                {
+                    InterlockedIncrement(&exhaustedCount);
+                    return nullptr;
+                }
+            }
+
+            freeChain = pendingChains;
+            pendingChains = NetBufferListChainLink::Link(*freeChain);
+        }
+
+        NET_BUFFER_LIST* result = freeChain;
+        freeChain = NET_BUFFER_LIST_NEXT_NBL(result);
+        NET_BUFFER_LIST_NEXT_NBL(result) = nullptr;
+
+        // Whoever held the buffer last may have moved the start or end of its data, so it starts afresh
+        NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(result);
+        NET_BUFFER_CURRENT_MDL(netBuffer) = NET_BUFFER_FIRST_MDL(netBuffer);
+        NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer) = 0;
+        NET_BUFFER_DATA_OFFSET(netBuffer) = 0;
+        NET_BUFFER_DATA_LENGTH(netBuffer) = bufferSize;
+
+        LONG remaining = InterlockedDecrement(&available);
+        if (remaining < lowWaterMark)
+        {
+            lowWaterMark = remaining;
+        }
+
+        return result;
+    }
+
+    /**
+     * Returns a chain of buffers to the pool. Any number of callers may return buffers concurrently.
+     * @param chain the head of a chain of NET_BUFFER_LIST objects, linked by NET_BUFFER_LIST_NEXT_NBL,
+     * which were taken from this pool
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void Return(_In_ NET_BUFFER_LIST& chain) noexcept
+    {
+        LONG count = 0;
+        for (NET_BUFFER_LIST* current = &chain; current != nullptr; current = NET_BUFFER_LIST_NEXT_NBL(current))
+        {
+            count++;
+        }
+
+        // Only counted once the chain is back in the queue, so a full count means every buffer is reachable
+        returnedChains.Enqueue(chain);
+        InterlockedExchangeAdd(&available, count);
+    }
+
+    /**
+     * Gets the data buffer of a NET_BUFFER_LIST taken from this pool
+     * @param netBufferList a NET_BUFFER_LIST taken from this pool
+     * @returns the start of the GetBufferSize() byte data buffer described by its MDL
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline BYTE* GetData(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        return dataLink(netBufferList);
+    }
+
+    /** @returns the size of each buffer in bytes */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetBufferSize() const noexcept { return bufferSize; }
+
+    /** @returns the total number of buffers owned by this pool */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetCapacity() const noexcept { return capacity; }
+
+    /** @returns the number of buffers currently in the pool */
+    NON_PAGEABLE_FUNCTION
+    inline LONG GetAvailableCount() const noexcept { return available; }
+
+    /** @returns true if every buffer has been returned to the pool */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsFull() const noexcept { return available == static_cast<LONG>(capacity); }
+
+    /**
+     * Indicates whether the pool is running low. Once it is, received frames should be indicated with
+     * NDIS_RECEIVE_FLAGS_RESOURCES so that NDIS copies them and hands the buffers straight back.
+     * @returns true if no more than 1/LOW_WATER_DIVISOR of the buffers remain in the pool
+     */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsLow() const noexcept { return available <= static_cast<LONG>(capacity / LOW_WATER_DIVISOR); }
+
+    /** @returns the fewest buffers that have ever been left in the pool (the low-water mark) */
+    NON_PAGEABLE_FUNCTION
+    inline LONG GetLowWaterMark() const noexcept { return lowWaterMark; }
+
+    /** @returns the most buffers that have ever been out of the pool at once (the high-water mark) */
+    NON_PAGEABLE_FUNCTION
+    inline LONG GetHighWaterMark() const noexcept { return static_cast<LONG>(capacity) - lowWaterMark; }
+
+    /** @returns the number of times a buffer was requested while the pool was empty */
+    NON_PAGEABLE_FUNCTION
+    inline LONG GetExhaustedCount() const noexcept { return exhaustedCount; }
+
+    /** The pool is considered low once this fraction of its buffers or fewer remain */
+    static constexpr ULONG LOW_WATER_DIVISOR = 8;
+
+private:
+    /** Tag for the pool's allocations. In memory this should appear as "axRX", little-endian. */
+    static constexpr ULONG RECEIVE_POOL_TAG = AX25_CREATE_TAG("axRX");
+
+    /**
+     * The second miniport-reserved field of each NET_BUFFER_LIST holds the address of its data buffer,
+     * so that the receive path never needs to map the MDL. The first field is used by returnedChains.
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline BYTE*& dataLink(_In_ NET_BUFFER_LIST& netBufferList) noexcept
+    {
+        return reinterpret_cast<BYTE*&>(NET_BUFFER_LIST_MINIPORT_RESERVED(&netBufferList)[1]);
+    }
+
+    NDIS_HANDLE ndisHandle;     //<! Handle with which the pool was allocated
+    NDIS_HANDLE poolHandle;     //<! NET_BUFFER_LIST pool from which the buffers were allocated
+    BYTE* dataBlock;            //<! Memory backing every buffer in the pool
+    ULONG bufferSize;           //<! Size of each buffer in bytes
+    ULONG capacity;             //<! Number of buffers owned by the pool
+
+    /** Buffers ready to be taken, linked by NET_BUFFER_LIST_NEXT_NBL. Owned by the consumer. */
+    NET_BUFFER_LIST* freeChain;
+
+    /** Returned chains not yet moved to freeChain, linked by NetBufferListChainLink. Owned by the consumer. */
+    NET_BUFFER_LIST* pendingChains;
+
+    /** Chains handed back through Return(), waiting to be picked up by the consumer */
+    InterlockedChainQueue<NET_BUFFER_LIST, NetBufferListChainLink> returnedChains;
+
+    volatile LONG available;        //<! Number of buffers in the pool
+    LONG lowWaterMark;              //<! Fewest buffers ever left in the pool; only written by the consumer
+    volatile LONG exhaustedCount;   //<! Number of Take() calls which found the pool empty
+
+    // Not copyable - the pool owns its buffers
+    ReceiveBufferPool(const ReceiveBufferPool&) = delete;
+    ReceiveBufferPool& operator=(const ReceiveBufferPool&) = delete;
+};
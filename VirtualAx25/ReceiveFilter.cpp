@@ -0,0 +1,150 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveFilter.cpp
+ * Implementation of the ReceiveFilter class, which decides which received frames are indicated to NDIS
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "ReceiveFilter.h"
+
+/** Packed form of the broadcast address, ff-ff-ff-ff-ff-ff */
+static constexpr ULONG64 BROADCAST_ADDRESS = 0x0000FFFFFFFFFFFFULL;
+
+/**
+ * Packs an Ethernet address into an integer
+ * @param ethernetAddress the Ethernet address
+ * @returns the address in the low 48 bits
+ */
+NON_PAGEABLE_FUNCTION
+static inline ULONG64 packAddress(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+{
+    ULONG64 packed = 0;
+    RtlCopyMemory(&packed, ethernetAddress, MulticastFilter::ADDRESS_LENGTH);
+    return packed;
+}
+
+/**
+ * Filters a frame for one combination of modes. Every test of mode is resolved at compile time.
+ * @tparam mode the MODE_* bits of the packet filter
+ * @param filter the filter, which holds the local address and the joined groups
+ * @param destination the destination address of the frame
+ * @returns true if the frame passes the filter
+ */
+template<ULONG mode>
+NON_PAGEABLE_FUNCTION
+bool ReceiveFilter::acceptMode(
+    _In_ const ReceiveFilter& filter,
+    _In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination) noexcept
+{
+    constexpr bool promiscuous = (mode & MODE_PROMISCUOUS) != 0;
+    constexpr bool directed = (mode & MODE_DIRECTED) != 0;
+    constexpr bool broadcast = (mode & MODE_BROADCAST) != 0;
+    constexpr bool allMulticast = (mode & MODE_ALL_MULTICAST) != 0;
+    constexpr bool multicast = (mode & MODE_MULTICAST) != 0 && !allMulticast;
+    constexpr bool anyGroup = broadcast || allMulticast || multicast;
+
+    if (promiscuous)
+    {
+        return true;
+    }
+
+    if (!directed && !anyGroup)
+    {
+        return false;
+    }
+
+    const ULONG64 address = packAddress(destination);
+    if (!MulticastFilter::IsGroupAddress(destination))
+    {
+        return directed && address == filter.localAddress;
+    }
+
+    // The broadcast address is also a group address, so ALL_MULTICAST and MULTICAST must exclude it
+    if (address == BROADCAST_ADDRESS)
+    {
+        return broadcast;
+    }
+
+    return allMulticast || (multicast && filter.multicastGroups.Contains(destination));
+}
+
+ReceiveFilter::AcceptFunction* const ReceiveFilter::acceptFunctions[MODE_COUNT] =
+{
+    &acceptMode<0x00>, &acceptMode<0x01>, &acceptMode<0x02>, &acceptMode<0x03>,
+    &acceptMode<0x04>, &acceptMode<0x05>, &acceptMode<0x06>, &acceptMode<0x07>,
+    &acceptMode<0x08>, &acceptMode<0x09>, &acceptMode<0x0A>, &acceptMode<0x0B>,
+    &acceptMode<0x0C>, &acceptMode<0x0D>, &acceptMode<0x0E>, &acceptMode<0x0F>,
+    &acceptMode<0x10>, &acceptMode<0x11>, &acceptMode<0x12>, &acceptMode<0x13>,
+    &acceptMode<0x14>, &acceptMode<0x15>, &acceptMode<0x16>, &acceptMode<0x17>,
+    &acceptMode<0x18>, &acceptMode<0x19>, &acceptMode<0x1A>, &acceptMode<0x1B>,
+    &acceptMode<0x1C>, &acceptMode<0x1D>, &acceptMode<0x1E>, &acceptMode<0x1F>,
+};
+
+/**
+ * Initializes a new filter which rejects every frame, as NDIS expects of an adapter until it sets a
+ * packet filter
+ * @param multicastGroups the groups joined on the adapter
+ */
+NON_PAGEABLE_FUNCTION
+ReceiveFilter::ReceiveFilter(_In_ const MulticastFilter& multicastGroups) noexcept
+    :accept(acceptFunctions[0])
+    ,packetFilter(0)
+    ,localAddress(0)
+    ,multicastGroups(multicastGroups)
+{
+}
+
+/**
+ * Sets the address which directed frames must be sent to. This must not be called while frames are
+ * being filtered.
+ * @param ethernetAddress the adapter's Ethernet address
+ */
+NON_PAGEABLE_FUNCTION
+void ReceiveFilter::SetLocalAddress(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept
+{
+    localAddress = packAddress(ethernetAddress);
+}
+
+/**
+ * Changes the packet filter. Frames being filtered on other processors use either the old filter or the
+ * new one.
+ * @param newPacketFilter the NDIS_PACKET_TYPE_* bits from OID_GEN_CURRENT_PACKET_FILTER
+ * @returns true if the filter was changed, or false if it includes a bit outside SUPPORTED_PACKET_FILTERS
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+bool ReceiveFilter::SetPacketFilter(_In_ ULONG newPacketFilter) noexcept
+{
+    if ((newPacketFilter & ~SUPPORTED_PACKET_FILTERS) != 0)
+    {
+        return false;
+    }
+
+    const ULONG mode =
+        ((newPacketFilter & NDIS_PACKET_TYPE_DIRECTED) ? MODE_DIRECTED : 0) |
+        ((newPacketFilter & NDIS_PACKET_TYPE_MULTICAST) ? MODE_MULTICAST : 0) |
+        ((newPacketFilter & NDIS_PACKET_TYPE_ALL_MULTICAST) ? MODE_ALL_MULTICAST : 0) |
+        ((newPacketFilter & NDIS_PACKET_TYPE_BROADCAST) ? MODE_BROADCAST : 0) |
+        ((newPacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS) ? MODE_PROMISCUOUS : 0);
+
+    packetFilter = newPacketFilter;
+    InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&accept), reinterpret_cast<PVOID>(acceptFunctions[mode]));
+    return true;
+}
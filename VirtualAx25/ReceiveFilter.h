@@ -0,0 +1,96 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveFilter.h
+ * Definition of the ReceiveFilter class, which decides which received frames are indicated to NDIS
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "MulticastFilter.h"
+
+/**
+ * Applies the packet filter set through OID_GEN_CURRENT_PACKET_FILTER to the destination address of each
+ * received frame.
+ *
+ * Rather than testing the NDIS_PACKET_TYPE_* bits of the filter for every frame, each combination of bits
+ * has its own instantiation of a filter function in which the tests are compile-time constants, so only the
+ * address comparisons the combination needs are left. SetPacketFilter chooses the function and publishes it
+ * with a single pointer exchange; Accept is one indirect call.
+ */
+class ReceiveFilter
+{
+public:
+    /** Packet filter bits this adapter supports */
+    static constexpr ULONG SUPPORTED_PACKET_FILTERS =
+        NDIS_PACKET_TYPE_DIRECTED |
+        NDIS_PACKET_TYPE_MULTICAST |
+        NDIS_PACKET_TYPE_ALL_MULTICAST |
+        NDIS_PACKET_TYPE_BROADCAST |
+        NDIS_PACKET_TYPE_PROMISCUOUS;
+
+    NON_PAGEABLE_FUNCTION
+    explicit ReceiveFilter(_In_ const MulticastFilter& multicastGroups) noexcept;
+
+    NON_PAGEABLE_FUNCTION
+    void SetLocalAddress(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* ethernetAddress) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    bool SetPacketFilter(_In_ ULONG packetFilter) noexcept;
+
+    /** @returns the NDIS_PACKET_TYPE_* bits of the current filter */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetPacketFilter() const noexcept { return packetFilter; }
+
+    /**
+     * Applies the current filter to a received frame
+     * @param destination the destination address from the frame's Ethernet header
+     * @returns true if the frame should be indicated to NDIS
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline bool Accept(_In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination) const noexcept
+    {
+        return accept(*this, destination);
+    }
+
+private:
+    typedef bool AcceptFunction(const ReceiveFilter& filter, const BYTE* destination);
+
+    // Filter bits are renumbered into a dense index of the filter functions
+    static constexpr ULONG MODE_DIRECTED = 0x01;        //<! NDIS_PACKET_TYPE_DIRECTED
+    static constexpr ULONG MODE_MULTICAST = 0x02;       //<! NDIS_PACKET_TYPE_MULTICAST
+    static constexpr ULONG MODE_ALL_MULTICAST = 0x04;   //<! NDIS_PACKET_TYPE_ALL_MULTICAST
+    static constexpr ULONG MODE_BROADCAST = 0x08;       //<! NDIS_PACKET_TYPE_BROADCAST
+    static constexpr ULONG MODE_PROMISCUOUS = 0x10;     //<! NDIS_PACKET_TYPE_PROMISCUOUS
+    static constexpr ULONG MODE_COUNT = 0x20;           //<! Number of filter functions
+
+    /** One filter function per combination of modes, indexed by mode */
+    static AcceptFunction* const acceptFunctions[MODE_COUNT];
+
+    AcceptFunction* volatile accept;                    //<! Filter function for the current packet filter
+    ULONG packetFilter;                                 //<! Current packet filter, for queries
+    ULONG64 localAddress;                               //<! Adapter's Ethernet address, packed into the low 48 bits
+    const MulticastFilter& multicastGroups;             //<! Groups which pass NDIS_PACKET_TYPE_MULTICAST
+
+    template<ULONG mode>
+    NON_PAGEABLE_FUNCTION
+    static bool acceptMode(_In_ const ReceiveFilter& filter, _In_reads_bytes_(MulticastFilter::ADDRESS_LENGTH) const BYTE* destination) noexcept;
+};
@@ -0,0 +1,182 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveModeration.h
+ * Definition of the ReceiveModeration class, which decides when a received frame should schedule the
+ * receive DPC
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Public.h"
+
+/**
+ * Receive coalescing, the virtual equivalent of interrupt moderation. Without it, every frame that arrives
+ * while the receive queue is empty schedules the receive DPC, so a busy channel costs one DPC and one
+ * indication per frame. With it, the DPC is held back until either a threshold number of frames is waiting
+ * or a timer started by the first of them expires, whichever comes first. The latency this adds is bounded
+ * by the timeout.
+ *
+ * The frame which starts a run arms the timer, and the frame which reaches the threshold schedules the DPC
+ * straight away. The receive DPC calls DpcStarted before it takes the queue, so that every frame either is
+ * picked up by that run or counts towards the next one. FrameQueued must only be called by one processor at
+ * a time, as for AX25Adapter::ReceiveFrame.
+ */
+class ReceiveModeration
+{
+public:
+    static constexpr ULONG MIN_FRAME_THRESHOLD = 1;             //<! Smallest number of frames worth coalescing
+    static constexpr ULONG MIN_TIMEOUT_MICROSECONDS = 50;       //<! Shortest coalescing timeout
+    static constexpr ULONG MAX_TIMEOUT_MICROSECONDS = 100000;   //<! Longest coalescing timeout
+
+    /** What the receive path must do after queueing a frame */
+    enum Action
+    {
+        Wait,           //<! Nothing; the frame is covered by a timer or DPC that is already pending
+        ArmTimer,       //<! Start the coalescing timer for GetTimeoutMicroseconds()
+        IndicateNow     //<! Cancel the timer, if any, and queue the receive DPC
+    };
+
+    /**
+     * Initializes moderation in the disabled state
+     * @param maximumThreshold the largest frame threshold that may be set, which must not be more frames
+     * than the receive path can hold
+     */
+    NON_PAGEABLE_FUNCTION
+    explicit inline ReceiveModeration(_In_ ULONG maximumThreshold) noexcept
+        :maximumThreshold(maximumThreshold)
+        ,enabled(0)
+        ,frameThreshold(maximumThreshold)
+        ,timeoutMicroseconds(MIN_TIMEOUT_MICROSECONDS)
+        ,pendingFrames(0)
+        ,framesIndicated(0)
+        ,dpcRuns(0)
+    {
+    }
+
+    /**
+     * Sets the point at which waiting frames are indicated
+     * @param frames the number of waiting frames which schedules the DPC immediately
+     * @param microseconds the longest time the first waiting frame may wait
+     * @returns true if the parameters were changed, or false if either is out of range
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline bool SetParameters(_In_ ULONG frames, _In_ ULONG microseconds) noexcept
+    {
+        if (frames < MIN_FRAME_THRESHOLD || frames > maximumThreshold ||
+            microseconds < MIN_TIMEOUT_MICROSECONDS || microseconds > MAX_TIMEOUT_MICROSECONDS)
+        {
+            return false;
+        }
+
+        frameThreshold = frames;
+        timeoutMicroseconds = microseconds;
+        return true;
+    }
+
+    /**
+     * Turns coalescing on or off. Frames already waiting for the timer are still indicated when it expires.
+     * @param enable true to coalesce received frames
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void SetEnabled(_In_ bool enable) noexcept { InterlockedExchange(&enabled, enable ? 1 : 0); }
+
+    /** @returns true if received frames are being coalesced */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsEnabled() const noexcept { return enabled != 0; }
+
+    /** @returns the number of waiting frames which schedules the DPC immediately */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetFrameThreshold() const noexcept { return frameThreshold; }
+
+    /** @returns the longest time, in microseconds, that a frame waits for others to join it */
+    NON_PAGEABLE_FUNCTION
+    inline ULONG GetTimeoutMicroseconds() const noexcept { return timeoutMicroseconds; }
+
+    /**
+     * Records a frame added to the receive queue and decides how the DPC should be scheduled
+     * @param queueWasEmpty true if the frame was the first in the receive queue
+     * @returns what the caller must do to make sure the frame is indicated
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    inline Action FrameQueued(_In_ bool queueWasEmpty) noexcept
+    {
+        if (enabled == 0)
+        {
+            return queueWasEmpty ? IndicateNow : Wait;
+        }
+
+        const LONG waiting = InterlockedIncrement(&pendingFrames);
+        if (static_cast<ULONG>(waiting) >= frameThreshold)
+        {
+            // Only the frame which reaches the threshold needs to schedule the DPC
+            return static_cast<ULONG>(waiting) == frameThreshold ? IndicateNow : Wait;
+        }
+
+        return waiting == 1 ? ArmTimer : Wait;
+    }
+
+    /**
+     * Records the start of a receive DPC run, before it takes frames from the receive queue. Frames queued
+     * from this point on count towards the next run.
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void DpcStarted() noexcept
+    {
+        InterlockedExchange(&pendingFrames, 0);
+        dpcRuns++;
+    }
+
+    /**
+     * Records frames handed to NDIS by the receive DPC
+     * @param frames the number of frames indicated
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    inline void FramesIndicated(_In_ ULONG frames) noexcept { framesIndicated += frames; }
+
+    /**
+     * Reports the parameters and the coalescing achieved so far
+     * @param statistics receives the parameters and counters
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void GetStatistics(_Out_ AX25_RECEIVE_MODERATION& statistics) const noexcept
+    {
+        statistics.Enabled = IsEnabled() ? 1 : 0;
+        statistics.FrameThreshold = frameThreshold;
+        statistics.TimeoutMicroseconds = timeoutMicroseconds;
+        statistics.FramesIndicated = framesIndicated;
+        statistics.DpcRuns = dpcRuns;
+        statistics.FramesPerHundredDpcs = dpcRuns == 0 ? 0 : (framesIndicated * 100) / dpcRuns;
+    }
+
+private:
+    const ULONG maximumThreshold;   //<! Largest frame threshold allowed
+    volatile LONG enabled;          //<! Nonzero while frames are being coalesced
+    ULONG frameThreshold;           //<! Waiting frames which schedule the DPC immediately
+    ULONG timeoutMicroseconds;      //<! Longest time the first waiting frame waits
+    volatile LONG pendingFrames;    //<! Frames queued since the receive DPC last started
+    ULONG64 framesIndicated;        //<! Frames indicated; only written by the receive DPC
+    ULONG64 dpcRuns;                //<! Receive DPC runs; only written by the receive DPC
+};
@@ -0,0 +1,297 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Segmenter.cpp
+ * Implementation of the Segmenter and SegmentReassembler classes.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#include "pch.h"
+#include "Segmenter.h"
+
+/** Deadline of a free context, which never expires */
+static constexpr ULONG64 STOPPED = MAXULONG64;
+
+/**
+ * Queues a datagram on a link, split into segments if it is longer than the link's N1. The segments are
+ * either all queued or none are.
+ * @param link the link to send the datagram on
+ * @param pid the protocol identifier of the datagram
+ * @param datagram the datagram, which is copied
+ * @param length the number of bytes in datagram
+ * @returns true if the datagram was queued, or false if it would take more than MAX_SEGMENTS or the link has
+ * no room for all of its segments
+ */
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool Segmenter::Send(
+    _Inout_ DataLink& link,
+    _In_ BYTE pid,
+    _In_reads_bytes_(length) const BYTE* datagram,
+    _In_ ULONG length) noexcept
+{
+    const ULONG maxInformationLength = link.GetMaxInformationLength();
+    const ULONG count = GetFrameCount(length, maxInformationLength);
+    if (count == 1)
+    {
+        return link.Send(pid, datagram, length);
+    }
+
+    if (count == 0 || count > link.GetQueueSpace())
+    {
+        return false;
+    }
+
+    // The first segment gives up a byte of its data to the PID of the datagram
+    const ULONG segmentLength = maxInformationLength - HEADER_LENGTH;
+    BYTE header[HEADER_LENGTH + 1] = { static_cast<BYTE>(FIRST_SEGMENT | (count - 1)), pid };
+    ULONG offset = segmentLength - 1;
+    bool queued = link.Send(PID_SEGMENT, datagram, offset, header, sizeof(header));
+    for (ULONG remaining = count - 1; queued && remaining > 0; remaining--)
+    {
+        const ULONG dataLength = (length - offset < segmentLength) ? length - offset : segmentLength;
+        header[0] = static_cast<BYTE>(remaining - 1);
+        queued = link.Send(PID_SEGMENT, datagram + offset, dataLength, header, HEADER_LENGTH);
+        offset += dataLength;
+    }
+
+    // The link had room for every segment, so none can have been refused
+    ASSERT(queued && offset == length);
+    return queued;
+}
+
+/**
+ * Initializes a new reassembler with no datagrams under way
+ */
+NON_PAGEABLE_FUNCTION
+SegmentReassembler::SegmentReassembler() noexcept
+{
+    for (ULONG i = 0; i < CONTEXT_COUNT; i++)
+    {
+        contexts[i].buffer = nullptr;
+        contexts[i].deadline = STOPPED;
+    }
+    RtlZeroMemory(&counters, sizeof(counters));
+}
+
+/**
+ * @returns the time at which Expire() should next be called, or MAXULONG64 if no datagram is under way
+ */
+NON_PAGEABLE_FUNCTION
+ULONG64 SegmentReassembler::GetNextTimeout() const noexcept
+{
+    ULONG64 deadline = STOPPED;
+    for (ULONG i = 0; i < CONTEXT_COUNT; i++)
+    {
+        deadline = (contexts[i].deadline < deadline) ? contexts[i].deadline : deadline;
+    }
+    return deadline;
+}
+
+/**
+ * Handles the information field of an I frame received with PID_SEGMENT
+ * @param local the station the frame was sent to
+ * @param peer the station which sent the frame
+ * @param information the information field
+ * @param length the number of bytes in information
+ * @param now the current time, in milliseconds
+ * @param client lends the buffers, and receives each datagram once it is whole
+ * @returns false if the segment starts a datagram for which there is no context or buffer free, so that the
+ * link leaves it unacknowledged and the peer sends it again later; true otherwise, including when it is dropped
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+_Must_inspect_result_
+NON_PAGEABLE_FUNCTION
+bool SegmentReassembler::Receive(
+    _In_ const AX25Address& local,
+    _In_ const AX25Address& peer,
+    _In_reads_bytes_(length) const BYTE* information,
+    _In_ ULONG length,
+    _In_ ULONG64 now,
+    _Inout_ SegmentReassemblerClient& client) noexcept
+{
+    Expire(now, client);
+
+    Context* context = nullptr;
+    Context* freeContext = nullptr;
+    for (ULONG i = 0; i < CONTEXT_COUNT; i++)
+    {
+        if (contexts[i].buffer == nullptr)
+        {
+            freeContext = (freeContext == nullptr) ? &contexts[i] : freeContext;
+        }
+        else if (contexts[i].peer == peer)
+        {
+            context = &contexts[i];
+        }
+    }
+
+    if (length < Segmenter::HEADER_LENGTH)
+    {
+        counters.Dropped++;
+        return true;
+    }
+
+    const BYTE header = information[0];
+    if ((header & Segmenter::FIRST_SEGMENT) == 0)
+    {
+        if (context == nullptr || header != context->remaining - 1)
+        {
+            // A segment of a datagram which was dropped already, or one which has lost a segment
+            if (context != nullptr)
+            {
+                release(*context, client);
+            }
+            counters.Dropped++;
+            return true;
+        }
+
+        context->remaining = header;
+        append(*context, information + Segmenter::HEADER_LENGTH, length - Segmenter::HEADER_LENGTH, now, client);
+        return true;
+    }
+
+    // A first segment replaces whatever the peer had not finished
+    if (context != nullptr)
+    {
+        release(*context, client);
+        counters.Dropped++;
+        freeContext = context;
+    }
+
+    if (length < Segmenter::HEADER_LENGTH + 1)
+    {
+        counters.Dropped++;
+        return true;
+    }
+
+    if (freeContext == nullptr)
+    {
+        return false;
+    }
+
+    BYTE* data = nullptr;
+    ULONG capacity = 0;
+    NET_BUFFER_LIST* buffer = client.TakeSegmentBuffer(&data, &capacity);
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+
+    freeContext->buffer = buffer;
+    freeContext->data = data;
+    freeContext->capacity = capacity;
+    freeContext->length = 0;
+    freeContext->remaining = header & Segmenter::REMAINING_MASK;
+    freeContext->local = local;
+    freeContext->peer = peer;
+    freeContext->pid = information[Segmenter::HEADER_LENGTH];
+    append(*freeContext, information + Segmenter::HEADER_LENGTH + 1, length - Segmenter::HEADER_LENGTH - 1, now, client);
+    return true;
+}
+
+/**
+ * Drops every datagram whose next segment is overdue
+ * @param now the current time, in milliseconds
+ * @param client takes back the buffers of the datagrams dropped
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void SegmentReassembler::Expire(_In_ ULONG64 now, _Inout_ SegmentReassemblerClient& client) noexcept
+{
+    for (ULONG i = 0; i < CONTEXT_COUNT; i++)
+    {
+        if (contexts[i].deadline <= now)
+        {
+            release(contexts[i], client);
+            counters.Expired++;
+        }
+    }
+}
+
+/**
+ * Drops every datagram under way, giving its buffer back to the client
+ * @param client takes back the buffers
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void SegmentReassembler::Discard(_Inout_ SegmentReassemblerClient& client) noexcept
+{
+    for (ULONG i = 0; i < CONTEXT_COUNT; i++)
+    {
+        if (contexts[i].buffer != nullptr)
+        {
+            release(contexts[i], client);
+            counters.Dropped++;
+        }
+    }
+}
+
+/**
+ * Gives the buffer of a datagram back to the client and frees its context
+ * @param context the context of the datagram, which must be in use
+ * @param client takes back the buffer
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void SegmentReassembler::release(_Inout_ Context& context, _Inout_ SegmentReassemblerClient& client) noexcept
+{
+    ASSERT(context.buffer != nullptr);
+    client.ReturnSegmentBuffer(*context.buffer);
+    context.buffer = nullptr;
+    context.deadline = STOPPED;
+}
+
+/**
+ * Adds the data of a segment to its datagram, and hands the datagram to the client if it was the last one
+ * @param context the context of the datagram
+ * @param data the data of the segment, after its header
+ * @param length the number of bytes in data
+ * @param now the current time, in milliseconds
+ * @param client receives the datagram if it is whole, or takes back its buffer if it is too long
+ */
+_IRQL_requires_(DISPATCH_LEVEL)
+NON_PAGEABLE_FUNCTION
+void SegmentReassembler::append(
+    _Inout_ Context& context,
+    _In_reads_bytes_(length) const BYTE* data,
+    _In_ ULONG length,
+    _In_ ULONG64 now,
+    _Inout_ SegmentReassemblerClient& client) noexcept
+{
+    if (length > context.capacity - context.length)
+    {
+        release(context, client);
+        counters.Dropped++;
+        return;
+    }
+
+    RtlCopyMemory(context.data + context.length, data, length);
+    context.length += length;
+    if (context.remaining != 0)
+    {
+        context.deadline = now + TIMEOUT_MILLISECONDS;
+        return;
+    }
+
+    NET_BUFFER_LIST* buffer = context.buffer;
+    context.buffer = nullptr;
+    context.deadline = STOPPED;
+    counters.Reassembled++;
+    client.SegmentsReassembled(context.local, context.peer, context.pid, *buffer, context.length);
+}
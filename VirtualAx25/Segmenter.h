@@ -0,0 +1,216 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Segmenter.h
+ * Definition of the Segmenter class, which splits datagrams too long for one I frame using the AX.25 2.2
+ * segmentation protocol, and of the SegmentReassembler which joins the segments up again.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "AX25Address.h"
+#include "DataLink.h"
+
+/**
+ * Splits datagrams longer than the N1 of a link into segments, as in the AX.25 2.2 segmenter. Every segment
+ * is an I frame with PID_SEGMENT, whose information field starts with a byte holding the number of segments
+ * still to come, with FIRST_SEGMENT set on the first one. The PID of the datagram follows that byte in the
+ * first segment, so a datagram of length bytes takes (length + 1) / (N1 - 1) segments, rounded up, and no
+ * more than MAX_SEGMENTS.
+ *
+ * Segments rely on the link to arrive whole and in order, so segmentation is only used in connected mode.
+ */
+class Segmenter
+{
+public:
+    static constexpr BYTE PID_SEGMENT = 0x08;           //<! PID of a segment
+    static constexpr BYTE FIRST_SEGMENT = 0x80;         //<! Set in the header of the first segment of a datagram
+    static constexpr BYTE REMAINING_MASK = 0x7F;        //<! Bits of the header holding the number of segments to come
+    static constexpr ULONG HEADER_LENGTH = 1;           //<! Bytes before the data of every segment
+    static constexpr ULONG MAX_SEGMENTS = REMAINING_MASK + 1;   //<! Most segments one datagram can be split into
+
+    /**
+     * Gets the number of I frames a datagram is sent in
+     * @param length the number of bytes in the datagram
+     * @param maxInformationLength the N1 of the link
+     * @returns 1 if the datagram fits in one I frame, the number of segments if it has to be split, or 0 if it
+     * would take more than MAX_SEGMENTS
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG GetFrameCount(_In_ ULONG length, _In_ ULONG maxInformationLength) noexcept
+    {
+        if (length <= maxInformationLength)
+        {
+            return 1;
+        }
+
+        if (maxInformationLength <= HEADER_LENGTH + 1)
+        {
+            return 0;
+        }
+
+        const ULONG segmentLength = maxInformationLength - HEADER_LENGTH;
+        const ULONG64 count = (static_cast<ULONG64>(length) + 1 + segmentLength - 1) / segmentLength;
+        return (count <= MAX_SEGMENTS) ? static_cast<ULONG>(count) : 0;
+    }
+
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    static bool Send(
+        _Inout_ DataLink& link,
+        _In_ BYTE pid,
+        _In_reads_bytes_(length) const BYTE* datagram,
+        _In_ ULONG length) noexcept;
+
+private:
+    Segmenter() = delete;
+};
+
+/**
+ * The owner of a SegmentReassembler: lends it the buffers datagrams are joined up in, and takes them back
+ * whole or not
+ */
+class SegmentReassemblerClient
+{
+public:
+    /**
+     * Takes a buffer to join a datagram up in
+     * @param data receives the space in the buffer for the datagram
+     * @param capacity receives the number of bytes at data, which is the longest datagram taken
+     * @returns the buffer, or nullptr if none is free
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    virtual NET_BUFFER_LIST* TakeSegmentBuffer(_Outptr_ BYTE** data, _Out_ ULONG* capacity) noexcept = 0;
+
+    /**
+     * Gives back a buffer whose datagram was dropped
+     * @param buffer a buffer from TakeSegmentBuffer()
+     */
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    virtual void ReturnSegmentBuffer(_In_ NET_BUFFER_LIST& buffer) noexcept = 0;
+
+    /**
+     * Accepts a datagram which has been joined up. The buffer belongs to the client from then on.
+     * @param local the station the segments were sent to
+     * @param peer the station which sent them
+     * @param pid the protocol identifier of the datagram
+     * @param buffer the buffer from TakeSegmentBuffer() holding the datagram
+     * @param length the number of bytes in the datagram
+     */
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    virtual void SegmentsReassembled(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_ BYTE pid,
+        _In_ NET_BUFFER_LIST& buffer,
+        _In_ ULONG length) noexcept = 0;
+
+protected:
+    // Clients are never destroyed through this interface
+    ~SegmentReassemblerClient() = default;
+};
+
+/**
+ * Joins the segments of datagrams received from up to CONTEXT_COUNT peers at once. Each datagram is copied
+ * straight into a buffer borrowed from the client as its segments arrive, so memory is bounded by
+ * CONTEXT_COUNT buffers and no segment is held anywhere else.
+ *
+ * A segment out of sequence drops the datagram it belongs to, and a new first segment replaces whatever the
+ * peer had not finished. A datagram is also dropped if its next segment does not come within
+ * TIMEOUT_MILLISECONDS, so a peer which goes away cannot keep a buffer for ever. Expiry is lazy: it happens
+ * when the next segment arrives or when the owner calls Expire() at GetNextTimeout(). A reassembler is not
+ * thread safe.
+ */
+class SegmentReassembler
+{
+public:
+    static constexpr ULONG CONTEXT_COUNT = 8;               //<! Most datagrams joined up at once
+    static constexpr ULONG TIMEOUT_MILLISECONDS = 60000;    //<! Longest wait for the next segment of a datagram
+
+    /** Counts of what happened to the datagrams received */
+    struct Counters
+    {
+        ULONG Reassembled;  //<! Datagrams joined up and handed to the client
+        ULONG Dropped;      //<! Datagrams dropped for a segment out of sequence, malformed or too long
+        ULONG Expired;      //<! Datagrams dropped for want of their next segment
+    };
+
+    NON_PAGEABLE_FUNCTION
+    SegmentReassembler() noexcept;
+
+    /** @returns the counts of what happened to the datagrams received */
+    NON_PAGEABLE_FUNCTION
+    inline const Counters& GetCounters() const noexcept { return counters; }
+
+    NON_PAGEABLE_FUNCTION
+    ULONG64 GetNextTimeout() const noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    _Must_inspect_result_
+    NON_PAGEABLE_FUNCTION
+    bool Receive(
+        _In_ const AX25Address& local,
+        _In_ const AX25Address& peer,
+        _In_reads_bytes_(length) const BYTE* information,
+        _In_ ULONG length,
+        _In_ ULONG64 now,
+        _Inout_ SegmentReassemblerClient& client) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Expire(_In_ ULONG64 now, _Inout_ SegmentReassemblerClient& client) noexcept;
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void Discard(_Inout_ SegmentReassemblerClient& client) noexcept;
+
+private:
+    /** A datagram being joined up */
+    struct Context
+    {
+        NET_BUFFER_LIST* buffer;    //<! The buffer the datagram is joined up in, or nullptr if the context is free
+        BYTE* data;                 //<! The space for the datagram in buffer
+        ULONG capacity;             //<! The number of bytes at data
+        ULONG length;               //<! The number of bytes joined up so far
+        ULONG remaining;            //<! The number of segments still to come
+        ULONG64 deadline;           //<! The time by which the next segment must arrive
+        AX25Address local;          //<! The station the segments are sent to
+        AX25Address peer;           //<! The station sending the segments
+        BYTE pid;                   //<! The protocol identifier of the datagram
+    };
+
+    _IRQL_requires_max_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void release(_Inout_ Context& context, _Inout_ SegmentReassemblerClient& client) noexcept;
+
+    _IRQL_requires_(DISPATCH_LEVEL)
+    NON_PAGEABLE_FUNCTION
+    void append(
+        _Inout_ Context& context,
+        _In_reads_bytes_(length) const BYTE* data,
+        _In_ ULONG length,
+        _In_ ULONG64 now,
+        _Inout_ SegmentReassemblerClient& client) noexcept;
+
+    Context contexts[CONTEXT_COUNT];    //<! The datagrams being joined up
+    Counters counters;                  //<! Counts of what happened to the datagrams received
+};
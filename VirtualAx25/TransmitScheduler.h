@@ -0,0 +1,293 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file TransmitScheduler.h
+ * Definition of the TransmitScheduler template, which decides the order in which frames waiting to be
+ * transmitted go out, according to their 802.1p priority
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+
+#pragma once
+#include "Utility.h"
+#include "Public.h"
+
+/** The transmit classes, in the order AX25_TRANSMIT_CLASS_STATISTICS reports them */
+enum TransmitClass : ULONG
+{
+    TransmitClassControl = 0,       //<! Network control, which goes out before anything else
+    TransmitClassInteractive = 1,   //<! Interactive sessions, which should not wait behind transfers
+    TransmitClassNormal = 2,        //<! Best effort, which includes every frame sent without a priority
+    TransmitClassBulk = 3           //<! Background transfers
+};
+
+/**
+ * Chooses the transmit class of a frame, grouping the eight 802.1p priorities as IEEE 802.1Q does for a port
+ * with four queues. Note that priorities 1 and 2 rank below the default priority, 0.
+ * @param priority the 802.1p user priority of the frame, from 0 to 7
+ * @returns the transmit class of the frame
+ */
+NON_PAGEABLE_FUNCTION
+inline TransmitClass transmitClassOfPriority(_In_ ULONG priority) noexcept
+{
+    switch (priority)
+    {
+    case 1:
+    case 2:
+        return TransmitClassBulk;
+    case 4:
+    case 5:
+        return TransmitClassInteractive;
+    case 6:
+    case 7:
+        return TransmitClassControl;
+    default:
+        return TransmitClassNormal;
+    }
+}
+
+/**
+ * A queue of waiting frames for each transmit class. Control frames are strictly first: whenever one is
+ * waiting, it is the next frame out. The other classes share the channel by deficit round robin. Each
+ * class in turn is given its weight times QUANTUM_BYTES of credit, and sends frames from its head for as
+ * long as the credit covers them; whatever is left is kept for its next turn, unless the class has run
+ * empty. While all of them are busy the classes therefore get bytes in the ratio of their weights, however
+ * long their frames are, and a class with a frame waiting never waits for more than one turn of each of the
+ * others. On a slow channel this keeps an interactive session responsive while a bulk transfer is queued,
+ * without shutting the transfer out.
+ *
+ * Waiting frames are linked to each other through a field of their own, and the time each was enqueued is
+ * kept in another, so no memory is allocated. A TransmitScheduler is not thread safe, although IsEmpty()
+ * may be called from anywhere for a hint.
+ *
+ * @tparam Node the type of the frames being scheduled
+ * @tparam Traits a type providing the static functions Node*& Next(Node&), which returns a pointer-sized field
+ * the scheduler may use to link a frame to the one behind it; ULONG_PTR& EnqueueTime(Node&), which returns
+ * another it may use to keep the time the frame was enqueued; and ULONG Length(Node&), which returns the number
+ * of bytes in the frame. Both fields are owned by the scheduler from the time the frame is enqueued until it is
+ * dequeued.
+ */
+template <class Node, class Traits>
+class TransmitScheduler
+{
+public:
+    static constexpr ULONG CLASS_COUNT = AX25_TRANSMIT_CLASS_COUNT;     //<! Number of transmit classes
+    static constexpr ULONG QUANTUM_BYTES = 256;                         //<! Credit per turn of a class of weight 1
+
+    /**
+     * Initializes a new scheduler with nothing waiting
+     */
+    NON_PAGEABLE_FUNCTION
+    inline TransmitScheduler() noexcept
+        :waiting(0)
+        ,current(TransmitClassInteractive)
+        ,turnStarted(false)
+    {
+        RtlZeroMemory(queues, sizeof(queues));
+    }
+
+    /**
+     * Gets the share of a class in the bytes which control frames leave over
+     * @param transmitClass the class
+     * @returns the weight of the class, or 0 for TransmitClassControl, which is not weighted
+     */
+    NON_PAGEABLE_FUNCTION
+    static inline ULONG GetWeight(_In_ TransmitClass transmitClass) noexcept
+    {
+        switch (transmitClass)
+        {
+        case TransmitClassInteractive:
+            return 4;
+        case TransmitClassNormal:
+            return 2;
+        case TransmitClassBulk:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * Adds a frame to the tail of the queue of its class
+     * @param node the frame
+     * @param transmitClass the class of the frame
+     * @param now the current time, in milliseconds
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void Enqueue(_Inout_ Node& node, _In_ TransmitClass transmitClass, _In_ ULONG64 now) noexcept
+    {
+        Queue& queue = queues[transmitClass];
+        Traits::Next(node) = nullptr;
+        Traits::EnqueueTime(node) = static_cast<ULONG_PTR>(now);
+        if (queue.tail == nullptr)
+        {
+            queue.head = &node;
+        }
+        else
+        {
+            Traits::Next(*queue.tail) = &node;
+        }
+        queue.tail = &node;
+
+        queue.statistics.Depth++;
+        if (queue.statistics.Depth > queue.statistics.MaxDepth)
+        {
+            queue.statistics.MaxDepth = queue.statistics.Depth;
+        }
+        waiting++;
+    }
+
+    /**
+     * Removes the frame which should be transmitted next
+     * @param now the current time, in milliseconds, from which the time the frame waited is measured
+     * @returns the frame, or nullptr if nothing is waiting
+     */
+    _Ret_maybenull_
+    NON_PAGEABLE_FUNCTION
+    inline Node* Dequeue(_In_ ULONG64 now) noexcept
+    {
+        if (waiting == 0)
+        {
+            return nullptr;
+        }
+
+        if (queues[TransmitClassControl].head != nullptr)
+        {
+            return remove(TransmitClassControl, now);
+        }
+
+        // Something is waiting in a weighted class, and each visit adds to its credit, so this ends
+        for (;;)
+        {
+            Queue& queue = queues[current];
+            if (queue.head == nullptr)
+            {
+                queue.deficit = 0;
+                nextTurn();
+                continue;
+            }
+
+            if (!turnStarted)
+            {
+                queue.deficit += GetWeight(current) * QUANTUM_BYTES;
+                turnStarted = true;
+            }
+
+            const ULONG length = Traits::Length(*queue.head);
+            if (length > queue.deficit)
+            {
+                nextTurn();
+                continue;
+            }
+
+            queue.deficit -= length;
+            Node* node = remove(current, now);
+            if (queue.head == nullptr)
+            {
+                // Credit is not saved up while there is nothing to spend it on
+                queue.deficit = 0;
+                nextTurn();
+            }
+            return node;
+        }
+    }
+
+    /**
+     * Determines whether any frame is waiting. The result may be stale if it is called by anything other than
+     * the owner of the scheduler.
+     * @returns true if no frame is waiting
+     */
+    NON_PAGEABLE_FUNCTION
+    inline bool IsEmpty() const noexcept
+    {
+        return waiting == 0;
+    }
+
+    /**
+     * Reports the queue of each class
+     * @param statistics receives the depth of each queue and the time frames have waited in it
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void GetStatistics(_Out_ AX25_TRANSMIT_CLASS_STATISTICS& statistics) const noexcept
+    {
+        for (ULONG i = 0; i < CLASS_COUNT; i++)
+        {
+            statistics.Classes[i] = queues[i].statistics;
+        }
+    }
+
+private:
+    /** The frames waiting in one class */
+    struct Queue
+    {
+        Node* head;                         //<! The frame which has waited longest, or nullptr
+        Node* tail;                         //<! The frame enqueued last, or nullptr
+        ULONG deficit;                      //<! Bytes the class may still send before its turn ends
+        AX25_TRANSMIT_CLASS statistics;     //<! Depth of the queue and time frames have waited in it
+    };
+
+    /**
+     * Removes the frame at the head of a class and counts the time it waited
+     * @param transmitClass the class, which must have a frame waiting
+     * @param now the current time, in milliseconds
+     * @returns the frame
+     */
+    NON_PAGEABLE_FUNCTION
+    inline Node* remove(_In_ TransmitClass transmitClass, _In_ ULONG64 now) noexcept
+    {
+        Queue& queue = queues[transmitClass];
+        Node* node = queue.head;
+        queue.head = Traits::Next(*node);
+        if (queue.head == nullptr)
+        {
+            queue.tail = nullptr;
+        }
+        Traits::Next(*node) = nullptr;
+
+        // The times are kept modulo the size of a pointer, which is plenty for a wait
+        const ULONG64 sojourn = static_cast<ULONG_PTR>(static_cast<ULONG_PTR>(now) - Traits::EnqueueTime(*node));
+        queue.statistics.Depth--;
+        queue.statistics.Frames++;
+        queue.statistics.Bytes += Traits::Length(*node);
+        queue.statistics.TotalSojournMilliseconds += sojourn;
+        if (sojourn > queue.statistics.MaxSojournMilliseconds)
+        {
+            queue.statistics.MaxSojournMilliseconds = sojourn;
+        }
+        waiting--;
+        return node;
+    }
+
+    /**
+     * Ends the turn of the current weighted class and starts that of the next
+     */
+    NON_PAGEABLE_FUNCTION
+    inline void nextTurn() noexcept
+    {
+        current = (current == TransmitClassBulk) ? TransmitClassInteractive : static_cast<TransmitClass>(current + 1);
+        turnStarted = false;
+    }
+
+    Queue queues[CLASS_COUNT];      //<! The frames waiting in each class, indexed by TransmitClass
+    volatile ULONG waiting;         //<! Number of frames waiting in all classes
+    TransmitClass current;          //<! The weighted class whose turn it is
+    bool turnStarted;               //<! True once the current class has been given its credit for this turn
+
+    // Not copyable - copying would duplicate ownership of the waiting frames
+    TransmitScheduler(const TransmitScheduler&) = delete;
+    TransmitScheduler& operator=(const TransmitScheduler&) = delete;
+};
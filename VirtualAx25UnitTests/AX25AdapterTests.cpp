@@ -24,6 +24,106 @@
 #include "KernelMocks.h"
 #include "AX25Adapter.h"
 
+#include <vector>
+
+namespace
+{
+    /** Builds a query for an OID, whose result goes to the specified buffer */
+    NDIS_OID_REQUEST oidQuery(NDIS_OID oid, void* buffer, UINT length)
+    {
+        NDIS_OID_REQUEST request = {};
+        request.RequestType = NdisRequestQueryInformation;
+        request.DATA.QUERY_INFORMATION.Oid = oid;
+        request.DATA.QUERY_INFORMATION.InformationBuffer = buffer;
+        request.DATA.QUERY_INFORMATION.InformationBufferLength = length;
+        return request;
+    }
+
+    /** Builds a set of an OID to the contents of the specified buffer */
+    NDIS_OID_REQUEST oidSet(NDIS_OID oid, void* buffer, UINT length)
+    {
+        NDIS_OID_REQUEST request = {};
+        request.RequestType = NdisRequestSetInformation;
+        request.DATA.SET_INFORMATION.Oid = oid;
+        request.DATA.SET_INFORMATION.InformationBuffer = buffer;
+        request.DATA.SET_INFORMATION.InformationBufferLength = length;
+        return request;
+    }
+
+    /** A connector which keeps a copy of every frame it is given */
+    class RecordingConnector : public Connector
+    {
+    public:
+        NDIS_STATUS TransmitFrame(const FrameGatherList& frame) noexcept override
+        {
+            std::vector<BYTE> bytes(frame.GetTotalLength());
+            (void)frame.CopyTo(bytes.data(), static_cast<ULONG>(bytes.size()));
+            frames.push_back(bytes);
+            return NDIS_STATUS_SUCCESS;
+        }
+
+        bool RequiresContiguousFrames() const noexcept override { return false; }
+        bool UsesFrameCheckSequence() const noexcept override { return false; }
+
+        std::vector<std::vector<BYTE>> frames;
+    };
+
+    /** Builds a command frame from the specified peer to the specified station, with no information */
+    std::vector<BYTE> commandFrame(AX25Address peer, AX25Address station, BYTE control)
+    {
+        AX25AddressField field;
+        field.Destination = station.WithControlBit(true);
+        field.Source = peer;
+        std::vector<BYTE> frame(AX25AddressField::MIN_LENGTH + 1);
+        const ULONG fieldLength = field.Write(frame.data(), static_cast<ULONG>(frame.size()));
+        frame.resize(fieldLength + 1);
+        frame[fieldLength] = control;
+        return frame;
+    }
+
+    /** @returns the control field of the specified frame, or 0 if it has none */
+    BYTE controlOf(const std::vector<BYTE>& frame)
+    {
+        AX25AddressField field;
+        const ULONG fieldLength = field.Parse(frame.data(), static_cast<ULONG>(frame.size()));
+        return (fieldLength != 0 && fieldLength < frame.size()) ? frame[fieldLength] : 0;
+    }
+
+    /** A broadcast IPv4 frame in a NET_BUFFER_LIST of its own, tagged with an 802.1p priority */
+    struct TaggedFrame
+    {
+        static constexpr ULONG PAYLOAD_LENGTH = 20;
+
+        /** Builds the frame, filling its payload with the specified marker */
+        TaggedFrame(ULONG priority, BYTE marker)
+            :data(HeaderTranslator::ETHERNET_HEADER_LENGTH + PAYLOAD_LENGTH, marker)
+            ,mdl{ nullptr, data.data(), static_cast<ULONG>(data.size()) }
+            ,netBuffer()
+            ,netBufferList()
+        {
+            std::fill(data.begin(), data.begin() + 6, static_cast<BYTE>(0xFF));
+            data[12] = 0x08;
+            data[13] = 0x00;
+            netBuffer.CurrentMdl = &mdl;
+            netBuffer.MdlChain = &mdl;
+            NET_BUFFER_DATA_LENGTH(&netBuffer) = static_cast<ULONG>(data.size());
+            netBufferList.FirstNetBuffer = &netBuffer;
+
+            NDIS_NET_BUFFER_LIST_8021Q_INFO priorityInfo = {};
+            priorityInfo.TagHeader.UserPriority = priority;
+            NET_BUFFER_LIST_INFO(&netBufferList, Ieee8021QNetBufferListInfo) = priorityInfo.Value;
+        }
+
+        TaggedFrame(const TaggedFrame&) = delete;
+        TaggedFrame& operator=(const TaggedFrame&) = delete;
+
+        std::vector<BYTE> data;
+        MDL mdl;
+        NET_BUFFER netBuffer;
+        NET_BUFFER_LIST netBufferList;
+    };
+}
+
 class AX25AdapterFixture : public testing::Test
 {
 protected:
@@ -40,7 +140,76 @@ protected:
         free(memory);
     }
 
+    /**
+     * Constructs an adapter in memory, with statistics and receive buffers allocated, and starts it running
+     * @returns the adapter, which the test must destroy
+     */
+    AX25Adapter* createRunningAdapter()
+    {
+        KernelMockData::NdisAllocateMemoryWithTagPriority_Result = memory;
+        AX25Adapter* adapter = new(DRIVER_HANDLE) AX25Adapter(DRIVER_HANDLE);
+
+        statisticsMemory.resize(2 * AdapterStatistics::CACHE_LINE_SIZE + sizeof(AdapterStatistics::Counters));
+        KernelMockData::NdisAllocateMemoryWithTagPriority_Result = statisticsMemory.data();
+        KernelMockData::KeQueryMaximumProcessorCountEx_Result = 1;
+        KernelMockData::KeGetCurrentProcessorNumberEx_Result = 0;
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->AllocateStatistics());
+
+        receiveMemory.resize(AX25Adapter::RECEIVE_BUFFER_COUNT * AX25Adapter::RECEIVE_BUFFER_SIZE);
+        KernelMockData::NdisAllocateMemoryWithTagPriority_Result = receiveMemory.data();
+        KernelMockData::NdisAllocateNetBufferListPool_Result = DRIVER_HANDLE;
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->AllocateReceiveBuffers());
+
+        adapter->state = AX25Adapter::Running;
+        return adapter;
+    }
+
+    /**
+     * Puts a running adapter in connected mode, with its links allocated and its frames going to the specified
+     * connector
+     */
+    void startDataLinks(AX25Adapter* adapter, Connector& connector)
+    {
+        attachConnector(adapter, connector);
+        adapter->connectedMode = true;
+        adapter->mtuSize = AX25Adapter::SEGMENTED_MTU_SIZE_BYTES;
+
+        dataLinkMemory.resize(AX25Adapter::DATA_LINK_COUNT * sizeof(DataLink));
+        KernelMockData::NdisAllocateMemoryWithTagPriority_Result = dataLinkMemory.data();
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->AllocateDataLinks());
+    }
+
+    /**
+     * Attaches the specified connector to a running adapter, leaving it in datagram mode
+     */
+    void attachConnector(AX25Adapter* adapter, Connector& connector)
+    {
+        adapter->state = AX25Adapter::Paused;
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->AttachConnector(&connector));
+        adapter->state = AX25Adapter::Running;
+    }
+
+    /**
+     * Writes the AX.25 header of a datagram to the specified peer to transmitHeader, as ToAX25() leaves it for
+     * sendOnDataLink()
+     * @returns the length of the header
+     */
+    ULONG writeTransmitHeader(AX25Adapter* adapter, AX25Address peer)
+    {
+        AX25AddressField path;
+        path.Destination = peer.WithControlBit(true);
+        path.Source = adapter->headerTranslator.GetLocalAddress();
+        ULONG headerLength = path.Write(adapter->transmitHeader, sizeof(adapter->transmitHeader));
+        EXPECT_NE(0UL, headerLength);
+        adapter->transmitHeader[headerLength++] = HeaderTranslator::CONTROL_UI;
+        adapter->transmitHeader[headerLength++] = HeaderTranslator::PID_IPV4;
+        return headerLength;
+    }
+
     void* memory;
+    std::vector<BYTE> statisticsMemory;
+    std::vector<BYTE> receiveMemory;
+    std::vector<BYTE> dataLinkMemory;
     static constexpr void* DRIVER_HANDLE = reinterpret_cast<void*>(0x10203040A0B0C0D0ULL);
 
 
@@ -75,4 +244,618 @@ TEST_F(AX25AdapterFixture, ValidDeallocation)
     EXPECT_EQ(1, KernelMockData::NdisFreeMemoryWithTagPriority_CallCount);
     EXPECT_EQ(DRIVER_HANDLE, KernelMockData::NdisFreeMemoryWithTagPriority_Arguments.NdisHandle);
     EXPECT_EQ(ptr, KernelMockData::NdisFreeMemoryWithTagPriority_Arguments.VirtualAddress);
-}
\ No newline at end of file
+}
+TEST_F(AX25AdapterFixture, ReceiveIndicationsAreBatched)
+{
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = memory;
+    AX25Adapter* adapter = new(DRIVER_HANDLE) AX25Adapter(DRIVER_HANDLE);
+
+    std::vector<BYTE> statisticsMemory(2 * AdapterStatistics::CACHE_LINE_SIZE + sizeof(AdapterStatistics::Counters));
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = statisticsMemory.data();
+    KernelMockData::KeQueryMaximumProcessorCountEx_Result = 1;
+    KernelMockData::KeGetCurrentProcessorNumberEx_Result = 0;
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->AllocateStatistics());
+
+    std::vector<BYTE> receiveMemory(AX25Adapter::RECEIVE_BUFFER_COUNT * AX25Adapter::RECEIVE_BUFFER_SIZE);
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = receiveMemory.data();
+    KernelMockData::NdisAllocateNetBufferListPool_Result = DRIVER_HANDLE;
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->AllocateReceiveBuffers());
+    adapter->receiveBatchStatistics.BatchLimit = 4;
+    adapter->receiveFilter.SetPacketFilter(NDIS_PACKET_TYPE_DIRECTED);
+    adapter->state = AX25Adapter::Running;
+
+    // A UI frame carrying a 20 byte IPv4 datagram
+    AX25AddressField field;
+    field.Destination = AX25Address("KG7UDH", 0).WithControlBit(true);
+    field.Source = AX25Address("N0CALL", 1);
+    BYTE frame[AX25AddressField::MIN_LENGTH + 2 + 20] = {};
+    ULONG fieldLength = field.Write(frame, sizeof(frame));
+    frame[fieldLength] = HeaderTranslator::CONTROL_UI;
+    frame[fieldLength + 1] = HeaderTranslator::PID_IPV4;
+    for (int i = 0; i < 10; i++)
+    {
+        ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame, sizeof(frame)));
+    }
+
+    // Ten frames with a limit of four go up in three indications, with the DPC requeueing itself in between
+    std::vector<NET_BUFFER_LIST*> indicated;
+    const ULONG expectedBatches[] = { 4, 4, 2 };
+    for (ULONG expected : expectedBatches)
+    {
+        KernelMockData::NdisMIndicateReceiveNetBufferLists_CallCount = 0;
+        KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+        AX25Adapter::receiveDpcCallback(&adapter->receiveDpc, adapter, nullptr, nullptr);
+
+        EXPECT_EQ(1, KernelMockData::NdisMIndicateReceiveNetBufferLists_CallCount);
+        EXPECT_EQ(expected, KernelMockData::NdisMIndicateReceiveNetBufferLists_Arguments.NumberOfNetBufferLists);
+        EXPECT_EQ(expected == 4 ? 1 : 0, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+        indicated.push_back(KernelMockData::NdisMIndicateReceiveNetBufferLists_Arguments.NetBufferList);
+    }
+
+    EXPECT_EQ(1u, adapter->receiveBatchStatistics.Batches[1]);
+    EXPECT_EQ(2u, adapter->receiveBatchStatistics.Batches[2]);
+    EXPECT_EQ(2u, adapter->receiveBatchStatistics.DeferredBatches);
+
+    AdapterStatistics::Counters totals;
+    adapter->statistics.GetTotals(totals);
+    EXPECT_EQ(10u, totals.received.directedFrames);
+    EXPECT_EQ(10u * (AX25Adapter::ETHERNET_HEADER_LENGTH + 20), totals.received.directedBytes);
+    EXPECT_EQ(10u, totals.received.GetFrames());
+
+    for (NET_BUFFER_LIST* batch : indicated)
+    {
+        adapter->ReturnNetBufferLists(*batch, 0);
+    }
+    EXPECT_TRUE(adapter->receivePool.IsFull());
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, SendsAreRejectedUnlessRunning)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    adapter->state = AX25Adapter::Pausing;
+
+    NET_BUFFER_LIST netBufferList = {};
+    KernelMockData::NdisMSendNetBufferListsComplete_CallCount = 0;
+    KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+    KernelMockData::__imp_KeSetEvent_CallCount = 0;
+    adapter->SendNetBufferLists(netBufferList, 0);
+    EXPECT_EQ(1, KernelMockData::NdisMSendNetBufferListsComplete_CallCount);
+    EXPECT_EQ(NDIS_STATUS_PAUSED, NET_BUFFER_LIST_STATUS(&netBufferList));
+    EXPECT_EQ(0, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(0, adapter->activeCalls);
+
+    // The last call to leave while pausing wakes a pause waiting for it
+    EXPECT_EQ(1, KernelMockData::__imp_KeSetEvent_CallCount);
+    EXPECT_EQ(&adapter->callsDrained, KernelMockData::__imp_KeSetEvent_Arguments.Event);
+
+    // Once running, the chain is queued for the transmit DPC instead, and the call is no longer counted as
+    // active, so a pause would not wait for it
+    adapter->state = AX25Adapter::Running;
+    KernelMockData::NdisMSendNetBufferListsComplete_CallCount = 0;
+    KernelMockData::__imp_KeSetEvent_CallCount = 0;
+    adapter->SendNetBufferLists(netBufferList, 0);
+    EXPECT_EQ(0, KernelMockData::NdisMSendNetBufferListsComplete_CallCount);
+    EXPECT_EQ(1, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(&netBufferList, adapter->transmitQueue.DequeueAll());
+    EXPECT_EQ(0, adapter->activeCalls);
+    EXPECT_EQ(0, KernelMockData::__imp_KeSetEvent_CallCount);
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, ReceivesAreRejectedUnlessRunning)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    adapter->receiveFilter.SetPacketFilter(NDIS_PACKET_TYPE_DIRECTED);
+    adapter->state = AX25Adapter::Pausing;
+
+    AX25AddressField field;
+    field.Destination = AX25Address("KG7UDH", 0).WithControlBit(true);
+    field.Source = AX25Address("N0CALL", 1);
+    BYTE frame[AX25AddressField::MIN_LENGTH + 2 + 20] = {};
+    ULONG fieldLength = field.Write(frame, sizeof(frame));
+    frame[fieldLength] = HeaderTranslator::CONTROL_UI;
+    frame[fieldLength + 1] = HeaderTranslator::PID_IPV4;
+
+    EXPECT_EQ(NDIS_STATUS_PAUSED, adapter->ReceiveFrame(frame, sizeof(frame)));
+    EXPECT_TRUE(adapter->receiveQueue.IsEmpty());
+    EXPECT_EQ(0, adapter->activeCalls);
+
+    adapter->state = AX25Adapter::Running;
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame, sizeof(frame)));
+    EXPECT_FALSE(adapter->receiveQueue.IsEmpty());
+    EXPECT_EQ(0, adapter->activeCalls);
+
+    NET_BUFFER_LIST* received = adapter->receiveQueue.DequeueAll();
+    ASSERT_NE(nullptr, received);
+    EXPECT_EQ(AX25Adapter::ETHERNET_HEADER_LENGTH + 20, NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(received)));
+    adapter->receivePool.Return(*received);
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, OnlyJoinedMulticastGroupsAreReceived)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    const BYTE joined[] = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB };
+    ASSERT_TRUE(adapter->joinedMulticastGroups.SetAddresses(joined, 1));
+    ASSERT_TRUE(adapter->receiveFilter.SetPacketFilter(NDIS_PACKET_TYPE_MULTICAST));
+
+    AX25AddressField field;
+    field.Destination = HeaderTranslator::BROADCAST_ADDRESS.WithControlBit(true);
+    field.Source = AX25Address("N0CALL", 1);
+    BYTE frame[AX25AddressField::MIN_LENGTH + 2 + 20] = {};
+    ULONG fieldLength = field.Write(frame, sizeof(frame));
+    frame[fieldLength] = HeaderTranslator::CONTROL_UI;
+    frame[fieldLength + 1] = HeaderTranslator::PID_IPV4;
+    BYTE* group = frame + fieldLength + 2 + HeaderTranslator::IPV4_DESTINATION_OFFSET;
+
+    // 224.0.0.251 was joined; 224.0.0.252 was not
+    group[0] = 224;
+    group[3] = 252;
+    EXPECT_EQ(NDIS_STATUS_NOT_ACCEPTED, adapter->ReceiveFrame(frame, sizeof(frame)));
+    EXPECT_TRUE(adapter->receiveQueue.IsEmpty());
+
+    group[3] = 251;
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame, sizeof(frame)));
+    NET_BUFFER_LIST* received = adapter->receiveQueue.DequeueAll();
+    ASSERT_NE(nullptr, received);
+    adapter->receivePool.Return(*received);
+
+    // Broadcasts are not multicasts
+    group[0] = 255;
+    group[1] = 255;
+    group[2] = 255;
+    group[3] = 255;
+    EXPECT_EQ(NDIS_STATUS_NOT_ACCEPTED, adapter->ReceiveFrame(frame, sizeof(frame)));
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, LongMulticastListsAreJoined)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    std::vector<BYTE> groups;
+    for (ULONG i = 0; i <= AX25Adapter::MAX_MULTICAST_GROUPS; i++)
+    {
+        groups.insert(groups.end(), { 0x01, 0x00, 0x5E, 0x00, static_cast<BYTE>(i >> 8), static_cast<BYTE>(i) });
+    }
+
+    // Every group the adapter reports it can hold is joined, well past the 16 it used to allow
+    ASSERT_GT(AX25Adapter::MAX_MULTICAST_GROUPS, 16U);
+    const ULONG length = static_cast<ULONG>(AX25Adapter::MAX_MULTICAST_GROUPS * MulticastFilter::ADDRESS_LENGTH);
+    NDIS_OID_REQUEST request = oidSet(OID_802_3_MULTICAST_LIST, groups.data(), length);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(length, request.DATA.SET_INFORMATION.BytesRead);
+    EXPECT_EQ(AX25Adapter::MAX_MULTICAST_GROUPS, adapter->joinedMulticastGroups.GetCount());
+    for (ULONG i = 0; i < AX25Adapter::MAX_MULTICAST_GROUPS; i++)
+    {
+        EXPECT_TRUE(adapter->joinedMulticastGroups.Contains(&groups[i * MulticastFilter::ADDRESS_LENGTH])) << "Group " << i;
+    }
+    EXPECT_FALSE(adapter->joinedMulticastGroups.Contains(&groups[length]));
+
+    // One more is too many, and leaves the list as it was
+    request = oidSet(OID_802_3_MULTICAST_LIST, groups.data(), static_cast<UINT>(groups.size()));
+    EXPECT_EQ(NDIS_STATUS_MULTICAST_FULL, adapter->HandleOidRequest(request));
+    EXPECT_EQ(AX25Adapter::MAX_MULTICAST_GROUPS, adapter->joinedMulticastGroups.GetCount());
+    adapter->Destroy();
+}
+
+// findOidHandlers relies on SUPPORTED_OIDS being sorted, and on OID_DISPATCH_TABLE having the same order
+TEST_F(AX25AdapterFixture, OidTablesAreSortedAndMatch)
+{
+    for (size_t i = 0; i < AX25Adapter::OID_LIST_LENGTH; i++)
+    {
+        const NDIS_OID oid = AX25Adapter::SUPPORTED_OIDS[i];
+        EXPECT_EQ(oid, AX25Adapter::OID_DISPATCH_TABLE[i].oid);
+        if (i > 0)
+        {
+            EXPECT_LT(AX25Adapter::SUPPORTED_OIDS[i - 1], oid);
+        }
+        EXPECT_EQ(&AX25Adapter::OID_DISPATCH_TABLE[i], AX25Adapter::findOidHandlers(oid));
+
+        // The OID just above each supported one is only found if it is the next entry
+        const AX25Adapter::OidDispatchEntry* above = AX25Adapter::findOidHandlers(oid + 1);
+        if (i + 1 < AX25Adapter::OID_LIST_LENGTH && AX25Adapter::SUPPORTED_OIDS[i + 1] == oid + 1)
+        {
+            EXPECT_EQ(&AX25Adapter::OID_DISPATCH_TABLE[i + 1], above);
+        }
+        else
+        {
+            EXPECT_EQ(nullptr, above);
+        }
+    }
+
+    EXPECT_EQ(nullptr, AX25Adapter::findOidHandlers(0));
+    EXPECT_EQ(nullptr, AX25Adapter::findOidHandlers(0xFFFFFFFF));
+}
+
+TEST_F(AX25AdapterFixture, OidRequestsAreDispatched)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+
+    // A supported set, and a supported query which sees it
+    ULONG packetFilter = NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_BROADCAST;
+    NDIS_OID_REQUEST request = oidSet(OID_GEN_CURRENT_PACKET_FILTER, &packetFilter, sizeof(packetFilter));
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(sizeof(packetFilter), request.DATA.SET_INFORMATION.BytesRead);
+
+    ULONG result = 0;
+    request = oidQuery(OID_GEN_CURRENT_PACKET_FILTER, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(sizeof(result), request.DATA.QUERY_INFORMATION.BytesWritten);
+    EXPECT_EQ(packetFilter, result);
+
+    // Query-only OIDs cannot be set
+    request = oidQuery(OID_802_3_MAXIMUM_LIST_SIZE, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(AX25Adapter::MAX_MULTICAST_GROUPS, result);
+    request = oidSet(OID_802_3_MAXIMUM_LIST_SIZE, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_NOT_SUPPORTED, adapter->HandleOidRequest(request));
+
+    // Listed OIDs without a handler are not supported; OIDs which are not listed are not recognized
+    request = oidQuery(OID_PNP_CAPABILITIES, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_NOT_SUPPORTED, adapter->HandleOidRequest(request));
+    request = oidQuery(0x0001FFFF, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_INVALID_OID, adapter->HandleOidRequest(request));
+    request = oidSet(0x0001FFFF, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_INVALID_OID, adapter->HandleOidRequest(request));
+
+    // A query which does not fit says how much room it needs
+    std::vector<char> description(1);
+    request = oidQuery(OID_GEN_VENDOR_DESCRIPTION, description.data(), static_cast<UINT>(description.size()));
+    EXPECT_EQ(NDIS_STATUS_BUFFER_TOO_SHORT, adapter->HandleOidRequest(request));
+    EXPECT_EQ(0u, request.DATA.QUERY_INFORMATION.BytesWritten);
+    ASSERT_LT(description.size(), request.DATA.QUERY_INFORMATION.BytesNeeded);
+
+    description.resize(request.DATA.QUERY_INFORMATION.BytesNeeded);
+    request = oidQuery(OID_GEN_VENDOR_DESCRIPTION, description.data(), static_cast<UINT>(description.size()));
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(description.size(), request.DATA.QUERY_INFORMATION.BytesWritten);
+    EXPECT_STREQ("KG7UDH Virtual AX.25 Adapter", description.data());
+
+    // Method requests are not supported at all, and nothing is accepted once halted
+    request = oidQuery(OID_GEN_CURRENT_PACKET_FILTER, &result, sizeof(result));
+    request.RequestType = NdisRequestMethod;
+    EXPECT_EQ(NDIS_STATUS_NOT_SUPPORTED, adapter->HandleOidRequest(request));
+    adapter->state = AX25Adapter::Halted;
+    request = oidQuery(OID_GEN_CURRENT_PACKET_FILTER, &result, sizeof(result));
+    EXPECT_EQ(NDIS_STATUS_NOT_ACCEPTED, adapter->HandleOidRequest(request));
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, DataLinkFramesAreAnswered)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    startDataLinks(adapter, connector);
+    const AX25Address station = adapter->headerTranslator.GetLocalAddress();
+    const AX25Address peer = AX25Address("N0CALL", 1);
+
+    // A SABM opens a link for its sender, whose answer is left for the transmit drain, and the idle timer starts
+    KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+    KernelMockData::__imp_KeSetTimer_CallCount = 0;
+    std::vector<BYTE> frame = commandFrame(peer, station, DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL);
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    ASSERT_EQ(1UL, adapter->dataLinks.GetCount());
+    EXPECT_EQ(peer, adapter->dataLinks[0].GetPeer());
+    EXPECT_EQ(DataLink::Connected, adapter->dataLinks[0].GetState());
+    EXPECT_EQ(1, adapter->dataLinkTransmitPending);
+    EXPECT_EQ(1, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(&adapter->transmitDpc, KernelMockData::__imp_KeInsertQueueDpc_Arguments.Dpc);
+    EXPECT_EQ(1, KernelMockData::__imp_KeSetTimer_CallCount);
+    EXPECT_EQ(&adapter->dataLinkTimer, KernelMockData::__imp_KeSetTimer_Arguments.Timer);
+    EXPECT_EQ(&adapter->dataLinkTimerDpc, KernelMockData::__imp_KeSetTimer_Arguments.Dpc);
+    EXPECT_TRUE(adapter->receiveQueue.IsEmpty());
+
+    adapter->transmitDataLinks();
+    ASSERT_FALSE(connector.frames.empty());
+    EXPECT_EQ(DataLink::CONTROL_UA | DataLink::CONTROL_POLL_FINAL, controlOf(connector.frames[0]));
+    AX25AddressField answer;
+    ASSERT_NE(0UL, answer.Parse(connector.frames[0].data(), static_cast<ULONG>(connector.frames[0].size())));
+    EXPECT_EQ(peer, answer.Destination);
+    EXPECT_EQ(station, answer.Source);
+
+    // Once every link is taken, a frame from yet another peer is counted as discarded
+    for (BYTE ssid = 2; adapter->dataLinks.GetCount() < AX25Adapter::DATA_LINK_COUNT; ssid++)
+    {
+        frame = commandFrame(AX25Address("N0CALL", ssid), station, DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL);
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    }
+    frame = commandFrame(AX25Address("N1CALL", 1), station, DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL);
+    EXPECT_EQ(NDIS_STATUS_RESOURCES, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, DatagramsAreSentOnDataLinks)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    startDataLinks(adapter, connector);
+    const AX25Address station = adapter->headerTranslator.GetLocalAddress();
+    const AX25Address peer = AX25Address("N0CALL", 1);
+    KernelMockData::KeQueryUnbiasedInterruptTime_Result = 0;
+
+    std::vector<BYTE> frame = commandFrame(peer, station, DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    adapter->transmitDataLinks();
+    connector.frames.clear();
+
+    const ULONG headerLength = writeTransmitHeader(adapter, peer);
+
+    std::vector<BYTE> ethernetFrame(AX25Adapter::ETHERNET_HEADER_LENGTH + 40);
+    for (size_t i = AX25Adapter::ETHERNET_HEADER_LENGTH; i < ethernetFrame.size(); i++)
+    {
+        ethernetFrame[i] = static_cast<BYTE>(i);
+    }
+    NET_BUFFER netBuffer = {};
+    NET_BUFFER_DATA_LENGTH(&netBuffer) = static_cast<ULONG>(ethernetFrame.size());
+    KernelMockData::NdisGetDataBuffer_Result = ethernetFrame.data();
+
+    // The datagram is queued on the link, and sent as an I frame when the transmit drain gets to it
+    InterlockedExchange(&adapter->dataLinkTransmitPending, 0);
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->sendOnDataLink(netBuffer, headerLength));
+    EXPECT_EQ(1, adapter->dataLinkTransmitPending);
+    EXPECT_TRUE(adapter->dataLinks[0].HasFramesToTransmit());
+
+    KernelMockData::__imp_KeSetTimer_CallCount = 0;
+    adapter->transmitDataLinks();
+    ASSERT_EQ(1U, connector.frames.size());
+    AX25AddressField addresses;
+    const ULONG fieldLength = addresses.Parse(connector.frames[0].data(), static_cast<ULONG>(connector.frames[0].size()));
+    ASSERT_NE(0UL, fieldLength);
+    EXPECT_EQ(peer, addresses.Destination);
+    EXPECT_EQ(0, connector.frames[0][fieldLength] & 0x01);
+    const std::vector<BYTE> information(connector.frames[0].begin() + fieldLength + 2, connector.frames[0].end());
+    EXPECT_EQ(HeaderTranslator::PID_IPV4, connector.frames[0][fieldLength + 1]);
+    EXPECT_EQ(std::vector<BYTE>(ethernetFrame.begin() + AX25Adapter::ETHERNET_HEADER_LENGTH, ethernetFrame.end()), information);
+
+    // T1 now runs for the I frame, which is earlier than the idle timer set before
+    EXPECT_EQ(1, KernelMockData::__imp_KeSetTimer_CallCount);
+    EXPECT_EQ(&adapter->dataLinkTimer, KernelMockData::__imp_KeSetTimer_Arguments.Timer);
+    EXPECT_GT(0, KernelMockData::__imp_KeSetTimer_Arguments.DueTime.QuadPart);
+
+    // A datagram longer than the MTU is refused
+    NET_BUFFER_DATA_LENGTH(&netBuffer) = AX25Adapter::ETHERNET_HEADER_LENGTH + AX25Adapter::SEGMENTED_MTU_SIZE_BYTES + 1;
+    EXPECT_EQ(NDIS_STATUS_INVALID_LENGTH, adapter->sendOnDataLink(netBuffer, headerLength));
+
+    // Once T1 expires, the timer DPC has the transmit drain ask the peer for an acknowledgement
+    connector.frames.clear();
+    KernelMockData::KeQueryUnbiasedInterruptTime_Result = 60000ULL * 10000;
+    KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+    adapter->runDataLinkTimers();
+    EXPECT_EQ(1, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(&adapter->transmitDpc, KernelMockData::__imp_KeInsertQueueDpc_Arguments.Dpc);
+    adapter->transmitDataLinks();
+    ASSERT_EQ(1U, connector.frames.size());
+    EXPECT_NE(0, controlOf(connector.frames[0]) & DataLink::CONTROL_POLL_FINAL);
+
+    // While pausing, the DPC leaves the links alone and sets no timer
+    adapter->state = AX25Adapter::Pausing;
+    KernelMockData::KeQueryUnbiasedInterruptTime_Result = 120000ULL * 10000;
+    KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+    KernelMockData::__imp_KeSetTimer_CallCount = 0;
+    adapter->runDataLinkTimers();
+    EXPECT_EQ(0, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(0, KernelMockData::__imp_KeSetTimer_CallCount);
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, RestartRunsDataLinkTimers)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    NDIS_MINIPORT_RESTART_PARAMETERS restartParameters = {};
+
+    adapter->state = AX25Adapter::Paused;
+    KernelMockData::__imp_KeInsertQueueDpc_CallCount = 0;
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->Restart(restartParameters));
+    EXPECT_EQ(AX25Adapter::Running, adapter->state);
+    EXPECT_EQ(0, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+
+    // In connected mode, the timer DPC catches up on whatever expired while the adapter was paused
+    adapter->state = AX25Adapter::Paused;
+    adapter->connectedMode = true;
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->Restart(restartParameters));
+    EXPECT_EQ(AX25Adapter::Running, adapter->state);
+    EXPECT_EQ(1, KernelMockData::__imp_KeInsertQueueDpc_CallCount);
+    EXPECT_EQ(&adapter->dataLinkTimerDpc, KernelMockData::__imp_KeInsertQueueDpc_Arguments.Dpc);
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, UnsegmentedFramesKeepTheDefaultMtu)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    startDataLinks(adapter, connector);
+
+    // A broadcast goes out in a UI frame rather than on a link, however large connected mode's MTU is
+    std::vector<BYTE> ethernetFrame(AX25Adapter::ETHERNET_HEADER_LENGTH + AX25Adapter::SEGMENTED_MTU_SIZE_BYTES, 0x5A);
+    std::fill(ethernetFrame.begin(), ethernetFrame.begin() + 6, static_cast<BYTE>(0xFF));
+    ethernetFrame[12] = 0x08;
+    ethernetFrame[13] = 0x00;
+    MDL mdl = { nullptr, ethernetFrame.data(), static_cast<ULONG>(ethernetFrame.size()) };
+    NET_BUFFER netBuffer = {};
+    netBuffer.CurrentMdl = &mdl;
+    netBuffer.MdlChain = &mdl;
+    NET_BUFFER_LIST netBufferList = {};
+    netBufferList.FirstNetBuffer = &netBuffer;
+    KernelMockData::NdisGetDataBuffer_Result = ethernetFrame.data();
+
+    for (ULONG length : { AX25Adapter::SEGMENTED_MTU_SIZE_BYTES, AX25Adapter::DEFAULT_MTU_SIZE_BYTES + 1 })
+    {
+        NET_BUFFER_DATA_LENGTH(&netBuffer) = AX25Adapter::ETHERNET_HEADER_LENGTH + length;
+        EXPECT_EQ(NDIS_STATUS_INVALID_LENGTH, adapter->transmitNetBufferList(netBufferList)) << "Length " << length;
+    }
+    EXPECT_TRUE(connector.frames.empty());
+
+    NET_BUFFER_DATA_LENGTH(&netBuffer) = AX25Adapter::ETHERNET_HEADER_LENGTH + AX25Adapter::DEFAULT_MTU_SIZE_BYTES;
+    EXPECT_EQ(NDIS_STATUS_SUCCESS, adapter->transmitNetBufferList(netBufferList));
+    ASSERT_EQ(1U, connector.frames.size());
+    EXPECT_EQ(HeaderTranslator::CONTROL_UI, controlOf(connector.frames[0]));
+    EXPECT_EQ(0U, adapter->dataLinks.GetCount());
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, PayloadIsCompressedOnceThePeerCompresses)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    startDataLinks(adapter, connector);
+    adapter->payloadCompressionMode = PayloadCompressor::Automatic;
+    adapter->receiveFilter.SetPacketFilter(NDIS_PACKET_TYPE_DIRECTED);
+    const AX25Address station = adapter->headerTranslator.GetLocalAddress();
+    const AX25Address peer = AX25Address("N0CALL", 1);
+
+    std::vector<BYTE> frame = commandFrame(peer, station, DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    adapter->transmitDataLinks();
+
+    const ULONG headerLength = writeTransmitHeader(adapter, peer);
+    std::vector<BYTE> ethernetFrame(AX25Adapter::ETHERNET_HEADER_LENGTH);
+    for (ULONG i = 0; i < 6; i++)
+    {
+        const char line[] = "temperature=21.5 humidity=40 ";
+        ethernetFrame.insert(ethernetFrame.end(), line, line + sizeof(line) - 1);
+    }
+    NET_BUFFER netBuffer = {};
+    NET_BUFFER_DATA_LENGTH(&netBuffer) = static_cast<ULONG>(ethernetFrame.size());
+    KernelMockData::NdisGetDataBuffer_Result = ethernetFrame.data();
+
+    // Until the peer is known to understand PID_COMPRESSED, datagrams go to it as they are
+    connector.frames.clear();
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->sendOnDataLink(netBuffer, headerLength));
+    adapter->transmitDataLinks();
+    ASSERT_EQ(1U, connector.frames.size());
+    EXPECT_EQ(ethernetFrame.size() - AX25Adapter::ETHERNET_HEADER_LENGTH + 2 + AX25AddressField::MIN_LENGTH, connector.frames[0].size());
+    EXPECT_EQ(HeaderTranslator::PID_IPV4, connector.frames[0][AX25AddressField::MIN_LENGTH + 1]);
+
+    // The peer sends a compressed datagram, acknowledging ours
+    PayloadCompressor compressor;
+    std::vector<BYTE> information(AX25Adapter::SEGMENTED_MTU_SIZE_BYTES);
+    const ULONG compressedLength = compressor.Compress(HeaderTranslator::PID_IPV4, ethernetFrame.data() + AX25Adapter::ETHERNET_HEADER_LENGTH,
+        static_cast<ULONG>(ethernetFrame.size()) - AX25Adapter::ETHERNET_HEADER_LENGTH, information.data(), static_cast<ULONG>(information.size()));
+    ASSERT_NE(0UL, compressedLength);
+    frame = commandFrame(peer, station, 1 << 5);
+    frame.push_back(PayloadCompressor::PID_COMPRESSED);
+    frame.insert(frame.end(), information.begin(), information.begin() + compressedLength);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->ReceiveFrame(frame.data(), static_cast<ULONG>(frame.size())));
+    NET_BUFFER_LIST* received = adapter->receiveQueue.DequeueAll();
+    ASSERT_NE(nullptr, received);
+    EXPECT_EQ(ethernetFrame.size(), NET_BUFFER_DATA_LENGTH(NET_BUFFER_LIST_FIRST_NB(received)));
+    adapter->receivePool.Return(*received);
+
+    // From then on, datagrams to it are compressed
+    connector.frames.clear();
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->sendOnDataLink(netBuffer, headerLength));
+    adapter->transmitDataLinks();
+    ASSERT_FALSE(connector.frames.empty());
+    const std::vector<BYTE>& sent = connector.frames.back();
+    EXPECT_EQ(compressedLength + 2 + AX25AddressField::MIN_LENGTH, sent.size());
+    EXPECT_EQ(PayloadCompressor::PID_COMPRESSED, sent[AX25AddressField::MIN_LENGTH + 1]);
+
+    // But only to that peer
+    EXPECT_TRUE(adapter->compressesPayloadTo(peer));
+    EXPECT_FALSE(adapter->compressesPayloadTo(AX25Address("N0CALL", 2)));
+    adapter->payloadCompressionMode = PayloadCompressor::Enabled;
+    EXPECT_TRUE(adapter->compressesPayloadTo(AX25Address("N0CALL", 2)));
+    adapter->payloadCompressionMode = PayloadCompressor::Disabled;
+    EXPECT_FALSE(adapter->compressesPayloadTo(peer));
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, TransmitClassesFollowPriority)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    attachConnector(adapter, connector);
+
+    // Each priority is read from the 802.1Q information of the NET_BUFFER_LIST
+    const TransmitClass expectedClasses[] = { TransmitClassNormal, TransmitClassBulk, TransmitClassBulk, TransmitClassNormal,
+        TransmitClassInteractive, TransmitClassInteractive, TransmitClassControl, TransmitClassControl };
+    TaggedFrame ipv4(0, 0);
+    KernelMockData::NdisGetDataBuffer_Result = ipv4.data.data();
+    for (ULONG priority = 0; priority < 8; priority++)
+    {
+        TaggedFrame tagged(priority, 0);
+        EXPECT_EQ(expectedClasses[priority], adapter->classifyNetBufferList(tagged.netBufferList)) << "Priority " << priority;
+    }
+
+    // ARP is network control, whatever priority it was given
+    TaggedFrame arp(1, 0);
+    arp.data[12] = 0x08;
+    arp.data[13] = 0x06;
+    KernelMockData::NdisGetDataBuffer_Result = arp.data.data();
+    EXPECT_EQ(TransmitClassControl, adapter->classifyNetBufferList(arp.netBufferList));
+    KernelMockData::NdisGetDataBuffer_Result = ipv4.data.data();
+
+    // A chain sent lowest priority first goes out control first, then by weight
+    TaggedFrame bulk(1, 'B');
+    TaggedFrame normal(0, 'N');
+    TaggedFrame interactive(5, 'I');
+    TaggedFrame control(7, 'C');
+    NET_BUFFER_LIST_NEXT_NBL(&bulk.netBufferList) = &normal.netBufferList;
+    NET_BUFFER_LIST_NEXT_NBL(&normal.netBufferList) = &interactive.netBufferList;
+    NET_BUFFER_LIST_NEXT_NBL(&interactive.netBufferList) = &control.netBufferList;
+    adapter->SendNetBufferLists(bulk.netBufferList, NDIS_SEND_FLAGS_DISPATCH_LEVEL);
+    KernelMockData::NdisMSendNetBufferListsComplete_CallCount = 0;
+    adapter->drainTransmitQueue();
+
+    const BYTE expectedMarkers[] = { 'C', 'I', 'N', 'B' };
+    ASSERT_EQ(sizeof(expectedMarkers), connector.frames.size());
+    for (size_t i = 0; i < connector.frames.size(); i++)
+    {
+        EXPECT_EQ(expectedMarkers[i], connector.frames[i].back()) << "Frame " << i;
+    }
+
+    // They are completed together, in the order they went out
+    EXPECT_EQ(1, KernelMockData::NdisMSendNetBufferListsComplete_CallCount);
+    NET_BUFFER_LIST* completed = KernelMockData::NdisMSendNetBufferListsComplete_Arguments.NetBufferList;
+    for (TaggedFrame* expected : { &control, &interactive, &normal, &bulk })
+    {
+        ASSERT_EQ(&expected->netBufferList, completed);
+        EXPECT_EQ(NDIS_STATUS_SUCCESS, NET_BUFFER_LIST_STATUS(completed));
+        completed = NET_BUFFER_LIST_NEXT_NBL(completed);
+    }
+    EXPECT_EQ(nullptr, completed);
+    EXPECT_TRUE(adapter->transmitScheduler.IsEmpty());
+    adapter->Destroy();
+}
+
+TEST_F(AX25AdapterFixture, TransmitClassStatisticsAreReported)
+{
+    AX25Adapter* adapter = createRunningAdapter();
+    RecordingConnector connector;
+    attachConnector(adapter, connector);
+
+    TaggedFrame normal1(0, 'N');
+    TaggedFrame normal2(3, 'N');
+    TaggedFrame normal3(0, 'N');
+    TaggedFrame interactive(4, 'I');
+    NET_BUFFER_LIST_NEXT_NBL(&normal1.netBufferList) = &normal2.netBufferList;
+    NET_BUFFER_LIST_NEXT_NBL(&normal2.netBufferList) = &normal3.netBufferList;
+    NET_BUFFER_LIST_NEXT_NBL(&normal3.netBufferList) = &interactive.netBufferList;
+    KernelMockData::NdisGetDataBuffer_Result = normal1.data.data();
+    adapter->SendNetBufferLists(normal1.netBufferList, NDIS_SEND_FLAGS_DISPATCH_LEVEL);
+    adapter->drainTransmitQueue();
+    ASSERT_EQ(4U, connector.frames.size());
+    EXPECT_EQ('I', connector.frames[0].back());
+
+    AX25_TRANSMIT_CLASS_STATISTICS result;
+    NDIS_OID_REQUEST request = oidQuery(OID_AX25_TRANSMIT_CLASS_STATISTICS, &result, sizeof(result) - 1);
+    EXPECT_EQ(NDIS_STATUS_BUFFER_TOO_SHORT, adapter->HandleOidRequest(request));
+    EXPECT_EQ(sizeof(result), request.DATA.QUERY_INFORMATION.BytesNeeded);
+
+    request = oidQuery(OID_AX25_TRANSMIT_CLASS_STATISTICS, &result, sizeof(result));
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, adapter->HandleOidRequest(request));
+    EXPECT_EQ(sizeof(result), request.DATA.QUERY_INFORMATION.BytesWritten);
+
+    const ULONG frameLength = AX25Adapter::ETHERNET_HEADER_LENGTH + TaggedFrame::PAYLOAD_LENGTH;
+    const ULONG expectedFrames[AX25_TRANSMIT_CLASS_COUNT] = { 0, 1, 3, 0 };
+    for (ULONG i = 0; i < AX25_TRANSMIT_CLASS_COUNT; i++)
+    {
+        const AX25_TRANSMIT_CLASS& transmitClass = result.Classes[i];
+        EXPECT_EQ(0UL, transmitClass.Depth) << "Class " << i;
+        EXPECT_EQ(expectedFrames[i], transmitClass.MaxDepth) << "Class " << i;
+        EXPECT_EQ(expectedFrames[i], transmitClass.Frames) << "Class " << i;
+        EXPECT_EQ(expectedFrames[i] * frameLength, transmitClass.Bytes) << "Class " << i;
+    }
+    adapter->Destroy();
+}
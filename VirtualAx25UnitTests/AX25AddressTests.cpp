@@ -0,0 +1,165 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AX25AddressTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver AX25Address and AX25AddressField classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "AX25Address.h"
+
+#include <string>
+#include <vector>
+
+// Encoding happens entirely at compile time: 'K' (0x4B) becomes 0x96, and the SSID byte is 0RR0000E
+static_assert(AX25Address("KG7UDH", 0).GetPacked() == 0x00609088AA6E8E96ULL, "KG7UDH-0 is not encoded in wire form");
+static_assert(AX25Address("N0CALL", 15).GetSsid() == 15, "SSID does not round trip");
+static_assert(AX25Address("AB1", 7) == AX25Address("AB1", 7).WithControlBit(true).WithLast(true),
+              "Control and extension bits must not take part in comparison");
+static_assert(AX25Address("AB1", 7) != AX25Address("AB1", 8), "SSIDs must take part in comparison");
+static_assert(AX25Address("AB1", 0).IsWellFormed(), "Encoded callsigns are always well formed");
+
+namespace
+{
+    /** Appends the wire form of an address to a frame */
+    void append(std::vector<BYTE>& frame, AX25Address address)
+    {
+        BYTE wire[AX25Address::WIRE_LENGTH];
+        address.ToWire(wire);
+        frame.insert(frame.end(), wire, wire + sizeof(wire));
+    }
+
+    std::string format(AX25Address address)
+    {
+        char text[AX25Address::MAX_TEXT_LENGTH];
+        address.FormatCallsign(text);
+        return text;
+    }
+}
+
+TEST(AX25Address, ShortCallsignsArePaddedWithSpaces)
+{
+    BYTE wire[AX25Address::WIRE_LENGTH];
+    AX25Address("AB1", 3).WithControlBit(true).ToWire(wire);
+    const BYTE expected[] = { 'A' << 1, 'B' << 1, '1' << 1, ' ' << 1, ' ' << 1, ' ' << 1, 0x80 | 0x60 | (3 << 1) };
+    ASSERT_EQ(0, memcmp(expected, wire, sizeof(wire)));
+}
+
+TEST(AX25Address, WireRoundTrip)
+{
+    BYTE wire[AX25Address::WIRE_LENGTH];
+    const AX25Address original = AX25Address("KG7UDH", 11).WithLast(true);
+    original.ToWire(wire);
+
+    AX25Address decoded = AX25Address::FromWire(wire);
+    ASSERT_EQ(original.GetPacked(), decoded.GetPacked());
+    ASSERT_EQ(11, decoded.GetSsid());
+    ASSERT_TRUE(decoded.IsLast());
+    ASSERT_FALSE(decoded.GetControlBit());
+}
+
+TEST(AX25Address, MalformedCallsignIsDetected)
+{
+    BYTE wire[AX25Address::WIRE_LENGTH];
+    AX25Address("KG7UDH", 0).ToWire(wire);
+    wire[4] |= 0x01;
+    ASSERT_FALSE(AX25Address::FromWire(wire).IsWellFormed());
+}
+
+TEST(AX25Address, FormatCallsign)
+{
+    ASSERT_EQ("KG7UDH", format(AX25Address("KG7UDH", 0)));
+    ASSERT_EQ("AB1-7", format(AX25Address("AB1", 7)));
+    ASSERT_EQ("WIDE2-15", format(AX25Address("WIDE2", 15)));
+}
+
+TEST(AX25AddressField, ParseDigipeaterPath)
+{
+    std::vector<BYTE> frame;
+    append(frame, AX25Address("APRS", 0).WithControlBit(true));
+    append(frame, AX25Address("KG7UDH", 9));
+    append(frame, AX25Address("RELAY", 0).WithControlBit(true));
+    append(frame, AX25Address("WIDE2", 1).WithLast(true));
+    frame.push_back(0x03);  // UI frame control field
+    frame.push_back(0xF0);  // No layer 3 PID
+
+    AX25AddressField field;
+    ASSERT_EQ(4 * AX25Address::WIRE_LENGTH, field.Parse(frame.data(), static_cast<ULONG>(frame.size())));
+    ASSERT_EQ(AX25Address("APRS", 0), field.Destination);
+    ASSERT_TRUE(field.Destination.GetControlBit());
+    ASSERT_EQ(AX25Address("KG7UDH", 9), field.Source);
+    ASSERT_EQ(2u, field.RepeaterCount);
+    ASSERT_EQ(AX25Address("RELAY", 0), field.Repeaters[0]);
+    ASSERT_EQ(AX25Address("WIDE2", 1), field.Repeaters[1]);
+    ASSERT_EQ(1u, field.GetNextRepeater());
+
+    // Writing the field back must reproduce it exactly
+    std::vector<BYTE> rewritten(AX25AddressField::MAX_LENGTH);
+    ASSERT_EQ(field.GetLength(), field.Write(rewritten.data(), static_cast<ULONG>(rewritten.size())));
+    ASSERT_EQ(0, memcmp(frame.data(), rewritten.data(), field.GetLength()));
+}
+
+TEST(AX25AddressField, ParseWithoutRepeaters)
+{
+    std::vector<BYTE> frame;
+    append(frame, AX25Address("CQ", 0));
+    append(frame, AX25Address("KG7UDH", 0).WithLast(true));
+
+    AX25AddressField field;
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH, field.Parse(frame.data(), static_cast<ULONG>(frame.size())));
+    ASSERT_EQ(0u, field.RepeaterCount);
+    ASSERT_EQ(0u, field.GetNextRepeater());
+}
+
+TEST(AX25AddressField, RejectsInvalidFields)
+{
+    AX25AddressField field;
+    std::vector<BYTE> frame;
+
+    // Destination marked as the last address
+    append(frame, AX25Address("CQ", 0).WithLast(true));
+    append(frame, AX25Address("KG7UDH", 0).WithLast(true));
+    ASSERT_EQ(0u, field.Parse(frame.data(), static_cast<ULONG>(frame.size())));
+
+    // Truncated before the last address is complete
+    frame.clear();
+    append(frame, AX25Address("CQ", 0));
+    append(frame, AX25Address("KG7UDH", 0).WithLast(true));
+    ASSERT_EQ(0u, field.Parse(frame.data(), static_cast<ULONG>(frame.size()) - 1));
+
+    // More than eight repeaters
+    frame.clear();
+    for (ULONG i = 0; i < 2 + AX25AddressField::MAX_REPEATERS; i++)
+    {
+        append(frame, AX25Address("RELAY", static_cast<BYTE>(i)));
+    }
+    append(frame, AX25Address("RELAY", 10).WithLast(true));
+    ASSERT_EQ(0u, field.Parse(frame.data(), static_cast<ULONG>(frame.size())));
+}
+
+TEST(AX25AddressField, WriteFailsWhenBufferIsTooSmall)
+{
+    AX25AddressField field;
+    field.Destination = AX25Address("CQ", 0);
+    field.Source = AX25Address("KG7UDH", 0);
+    BYTE buffer[AX25AddressField::MIN_LENGTH];
+    ASSERT_EQ(0u, field.Write(buffer, sizeof(buffer) - 1));
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH, field.Write(buffer, sizeof(buffer)));
+    ASSERT_TRUE(AX25Address::FromWire(buffer + AX25Address::WIRE_LENGTH).IsLast());
+}
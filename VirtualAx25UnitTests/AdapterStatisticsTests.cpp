@@ -0,0 +1,165 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AdapterStatisticsTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver AdapterStatistics class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "AdapterStatistics.h"
+
+#include <memory>
+#include <vector>
+
+namespace
+{
+    const BYTE STATION[] = { 0x02, 0x4D, 0x1E, 0x54, 0x42, 0x00 };
+    const BYTE GROUP[] = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB };
+    const BYTE BROADCAST[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+    class AdapterStatisticsFixture : public ::testing::Test
+    {
+    protected:
+        static constexpr ULONG PROCESSOR_COUNT = 4;
+
+        void SetUp() override
+        {
+            // Deliberately misaligned, to check that the blocks are aligned by hand
+            memory.resize(PROCESSOR_COUNT * 2 * AdapterStatistics::CACHE_LINE_SIZE + 2 * AdapterStatistics::CACHE_LINE_SIZE);
+            KernelMockData::NdisAllocateMemoryWithTagPriority_Result = memory.data() + 8;
+            KernelMockData::KeQueryMaximumProcessorCountEx_Result = PROCESSOR_COUNT;
+            KernelMockData::KeGetCurrentProcessorNumberEx_Result = 0;
+            statistics.reset(new AdapterStatistics());
+            ASSERT_EQ(NDIS_STATUS_SUCCESS, statistics->Allocate(STATISTICS_HANDLE));
+        }
+
+        void TearDown() override
+        {
+            KernelMockData::NdisFreeMemoryWithTagPriority_CallCount = 0;
+            statistics->Free();
+            EXPECT_EQ(1, KernelMockData::NdisFreeMemoryWithTagPriority_CallCount);
+            EXPECT_EQ(memory.data() + 8, KernelMockData::NdisFreeMemoryWithTagPriority_Arguments.VirtualAddress);
+        }
+
+        /** Makes the following counts on the given processor */
+        void runOn(ULONG processor)
+        {
+            KernelMockData::KeGetCurrentProcessorNumberEx_Result = processor;
+        }
+
+        static constexpr void* STATISTICS_HANDLE = reinterpret_cast<void*>(0x1020304050607080ULL);
+        std::vector<BYTE> memory;
+        std::unique_ptr<AdapterStatistics> statistics;
+    };
+}
+
+TEST_F(AdapterStatisticsFixture, AllocatesOneCacheLineBlockPerProcessor)
+{
+    // The counters fill two whole cache lines, so only the alignment slack is added
+    EXPECT_EQ(PROCESSOR_COUNT * sizeof(AdapterStatistics::Counters) + AdapterStatistics::CACHE_LINE_SIZE - 1,
+              KernelMockData::NdisAllocateMemoryWithTagPriority_Arguments.Length);
+    EXPECT_EQ(STATISTICS_HANDLE, KernelMockData::NdisAllocateMemoryWithTagPriority_Arguments.NdisHandle);
+
+    // Each processor's first counter must start a cache line of its own
+    for (ULONG processor = 0; processor < PROCESSOR_COUNT; processor++)
+    {
+        runOn(processor);
+        statistics->CountReceived(STATION, 100);
+    }
+
+    std::vector<size_t> lines;
+    for (size_t offset = 0; offset + sizeof(ULONG64) <= memory.size(); offset += sizeof(ULONG64))
+    {
+        if (*reinterpret_cast<const ULONG64*>(memory.data() + offset) == 1)
+        {
+            EXPECT_EQ(0u, reinterpret_cast<ULONG_PTR>(memory.data() + offset) % AdapterStatistics::CACHE_LINE_SIZE);
+            lines.push_back(offset / AdapterStatistics::CACHE_LINE_SIZE);
+        }
+    }
+    ASSERT_EQ(PROCESSOR_COUNT, lines.size());
+    for (size_t i = 1; i < lines.size(); i++)
+    {
+        EXPECT_LT(lines[i - 1], lines[i]);
+    }
+}
+
+TEST_F(AdapterStatisticsFixture, FramesAreClassifiedByDestination)
+{
+    statistics->CountReceived(STATION, 100);
+    statistics->CountReceived(GROUP, 60);
+    statistics->CountReceived(GROUP, 70);
+    statistics->CountReceived(BROADCAST, 42);
+    statistics->CountTransmitted(BROADCAST, 28);
+
+    AdapterStatistics::Counters totals;
+    statistics->GetTotals(totals);
+    EXPECT_EQ(1u, totals.received.directedFrames);
+    EXPECT_EQ(100u, totals.received.directedBytes);
+    EXPECT_EQ(2u, totals.received.multicastFrames);
+    EXPECT_EQ(130u, totals.received.multicastBytes);
+    EXPECT_EQ(1u, totals.received.broadcastFrames);
+    EXPECT_EQ(42u, totals.received.broadcastBytes);
+    EXPECT_EQ(4u, totals.received.GetFrames());
+
+    EXPECT_EQ(1u, totals.transmitted.broadcastFrames);
+    EXPECT_EQ(28u, totals.transmitted.broadcastBytes);
+    EXPECT_EQ(1u, totals.transmitted.GetFrames());
+}
+
+TEST_F(AdapterStatisticsFixture, TotalsSumEveryProcessor)
+{
+    for (ULONG processor = 0; processor < PROCESSOR_COUNT; processor++)
+    {
+        runOn(processor);
+        for (ULONG i = 0; i <= processor; i++)
+        {
+            statistics->CountTransmitted(STATION, 10);
+        }
+        statistics->CountTransmitError();
+        statistics->CountReceiveError();
+        statistics->CountReceiveDiscards(2);
+        statistics->CountTransmitDiscards(3);
+    }
+
+    // Discards from outside DISPATCH_LEVEL are kept apart from the processor blocks
+    statistics->CountTransmitDiscardsAtAnyIrql(5);
+
+    AdapterStatistics::Counters totals;
+    statistics->GetTotals(totals);
+    EXPECT_EQ(10u, totals.transmitted.directedFrames);
+    EXPECT_EQ(100u, totals.transmitted.directedBytes);
+    EXPECT_EQ(PROCESSOR_COUNT, totals.transmitted.errors);
+    EXPECT_EQ(PROCESSOR_COUNT * 3 + 5, totals.transmitted.discards);
+    EXPECT_EQ(PROCESSOR_COUNT, totals.received.errors);
+    EXPECT_EQ(PROCESSOR_COUNT * 2, totals.received.discards);
+    EXPECT_EQ(0u, totals.received.GetFrames());
+}
+
+TEST(AdapterStatistics, FailedAllocation)
+{
+    KernelMockData::KeQueryMaximumProcessorCountEx_Result = 2;
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = nullptr;
+    AdapterStatistics statistics;
+    EXPECT_EQ(NDIS_STATUS_RESOURCES, statistics.Allocate(nullptr));
+
+    // Nothing was allocated, so there is nothing to free
+    KernelMockData::NdisFreeMemoryWithTagPriority_CallCount = 0;
+    statistics.Free();
+    EXPECT_EQ(0, KernelMockData::NdisFreeMemoryWithTagPriority_CallCount);
+}
@@ -0,0 +1,350 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file AfskDemodulatorTests.cpp
+ * Unit tests and benchmark for the Virtual AX.25 NDIS Driver AfskDemodulator class. The audio is built in
+ * memory as a WAV file; set AX25_AFSK_WAV to the path of a 16-bit mono recording to decode that as well.
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "AfskDemodulator.h"
+#include "HdlcCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    class CollectingHandler : public HdlcFrameHandler
+    {
+    public:
+        void HdlcFrameDecoded(const BYTE* frame, ULONG length) noexcept override
+        {
+            frames.push_back(std::vector<BYTE>(frame, frame + length));
+        }
+
+        std::vector<std::vector<BYTE>> frames;
+    };
+
+    /** A 16-bit mono PCM recording */
+    struct Recording
+    {
+        ULONG sampleRate;
+        std::vector<SHORT> samples;
+    };
+
+    void appendLittleEndian(std::vector<BYTE>& output, ULONG value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            output.push_back(static_cast<BYTE>(value >> (8 * i)));
+        }
+    }
+
+    ULONG readLittleEndian(const BYTE* data, int bytes)
+    {
+        ULONG value = 0;
+        for (int i = 0; i < bytes; i++)
+        {
+            value |= static_cast<ULONG>(data[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    std::vector<BYTE> writeWav(Recording const& recording)
+    {
+        const ULONG dataLength = static_cast<ULONG>(recording.samples.size() * sizeof(SHORT));
+        std::vector<BYTE> file{ 'R', 'I', 'F', 'F' };
+        appendLittleEndian(file, 36 + dataLength, 4);
+        file.insert(file.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+        appendLittleEndian(file, 16, 4);
+        appendLittleEndian(file, 1, 2);                             // PCM
+        appendLittleEndian(file, 1, 2);                             // Mono
+        appendLittleEndian(file, recording.sampleRate, 4);
+        appendLittleEndian(file, recording.sampleRate * 2, 4);      // Bytes per second
+        appendLittleEndian(file, 2, 2);                             // Bytes per sample
+        appendLittleEndian(file, 16, 2);                            // Bits per sample
+        file.insert(file.end(), { 'd', 'a', 't', 'a' });
+        appendLittleEndian(file, dataLength, 4);
+        for (SHORT sample : recording.samples)
+        {
+            appendLittleEndian(file, static_cast<USHORT>(sample), 2);
+        }
+        return file;
+    }
+
+    /** Reads a 16-bit PCM WAV file, keeping only the first channel */
+    bool readWav(std::vector<BYTE> const& file, Recording& recording)
+    {
+        if (file.size() < 12 || memcmp(file.data(), "RIFF", 4) != 0 || memcmp(file.data() + 8, "WAVE", 4) != 0)
+        {
+            return false;
+        }
+
+        ULONG channels = 0;
+        for (size_t offset = 12; offset + 8 <= file.size();)
+        {
+            const BYTE* chunk = file.data() + offset;
+            const ULONG length = readLittleEndian(chunk + 4, 4);
+            if (offset + 8 + length > file.size())
+            {
+                return false;
+            }
+
+            if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16)
+            {
+                if (readLittleEndian(chunk + 8, 2) != 1 || readLittleEndian(chunk + 22, 2) != 16)
+                {
+                    return false;
+                }
+                channels = readLittleEndian(chunk + 10, 2);
+                recording.sampleRate = readLittleEndian(chunk + 12, 4);
+            }
+            else if (memcmp(chunk, "data", 4) == 0 && channels != 0)
+            {
+                recording.samples.clear();
+                for (ULONG i = 0; i + 2 * channels <= length; i += 2 * channels)
+                {
+                    recording.samples.push_back(static_cast<SHORT>(readLittleEndian(chunk + 8 + i, 2)));
+                }
+                return true;
+            }
+            offset += 8 + length + (length & 1);
+        }
+        return false;
+    }
+
+    /**
+     * Bell 202 modulator, with continuous phase between tones
+     * @param levels the line levels to send, least significant bit first
+     * @param sampleRate samples per second
+     * @param baudRate the sender's bit rate, which can be a little off 1200 as a real modem's would be
+     * @param noise the standard deviation of added white noise, relative to the tone's amplitude
+     * @param random the noise source
+     */
+    std::vector<SHORT> modulate(std::vector<BYTE> const& levels, ULONG sampleRate, double baudRate, double noise, std::mt19937& random)
+    {
+        constexpr double amplitude = 8000.0;
+        const double pi = 3.14159265358979323846;
+        std::normal_distribution<double> distribution(0.0, noise * amplitude);
+        std::vector<SHORT> samples;
+        double tonePhase = 0;
+        double time = 0;
+        const double bitTime = 1.0 / baudRate;
+        for (size_t bit = 0; bit < levels.size() * 8; bit++)
+        {
+            const bool mark = ((levels[bit / 8] >> (bit % 8)) & 1) != 0;
+            const double frequency = mark ? AfskDemodulator::MARK_FREQUENCY : AfskDemodulator::SPACE_FREQUENCY;
+            for (; time < bitTime; time += 1.0 / sampleRate)
+            {
+                const double value = amplitude * std::sin(tonePhase) + distribution(random);
+                samples.push_back(static_cast<SHORT>(std::max(-32768.0, std::min(32767.0, value))));
+                tonePhase = std::fmod(tonePhase + 2 * pi * frequency / sampleRate, 2 * pi);
+            }
+            time -= bitTime;
+        }
+        return samples;
+    }
+
+    std::vector<std::vector<BYTE>> randomFrames(int count, std::mt19937& random)
+    {
+        std::vector<std::vector<BYTE>> frames;
+        for (int i = 0; i < count; i++)
+        {
+            std::vector<BYTE> frame(20 + random() % 200);
+            for (BYTE& value : frame)
+            {
+                value = static_cast<BYTE>(random());
+            }
+            frames.push_back(frame);
+        }
+        return frames;
+    }
+
+    /**
+     * Encodes frames as a transmitter would, each after a TXDELAY of flags. The carrier is held for a few
+     * bits afterwards (TXTAIL), since the receiver is a bit period behind.
+     */
+    std::vector<BYTE> encodeTransmission(std::vector<std::vector<BYTE>> const& frames)
+    {
+        constexpr ULONG TXDELAY_FLAGS = 24;
+        HdlcEncoder encoder;
+        std::vector<BYTE> levels;
+        for (auto const& frame : frames)
+        {
+            FrameGatherList list;
+            EXPECT_TRUE(list.Append(frame.data(), static_cast<ULONG>(frame.size())));
+            std::vector<BYTE> output(HdlcEncoder::GetMaximumEncodedLength(static_cast<ULONG>(frame.size()), TXDELAY_FLAGS));
+            const ULONG length = encoder.EncodeFrame(list, TXDELAY_FLAGS, output.data(), static_cast<ULONG>(output.size()));
+            levels.insert(levels.end(), output.begin(), output.begin() + length);
+        }
+
+        BYTE last;
+        if (encoder.Flush(&last, 1) != 0)
+        {
+            levels.push_back(last);
+        }
+        levels.insert(levels.end(), 2, (levels.back() & 0x80) != 0 ? 0xFF : 0x00);
+        return levels;
+    }
+
+    /** Runs a recording through a demodulator and an HDLC decoder in blocks, as a sound driver delivers them */
+    void decode(Recording const& recording, ULONG blockSamples, AfskDemodulator& demodulator, HdlcDecoder& decoder, CollectingHandler& handler)
+    {
+        std::vector<BYTE> levels(demodulator.GetMaximumOutputLength(blockSamples));
+        for (size_t offset = 0; offset < recording.samples.size(); offset += blockSamples)
+        {
+            const ULONG count = static_cast<ULONG>(std::min<size_t>(blockSamples, recording.samples.size() - offset));
+            const ULONG length = demodulator.Demodulate(recording.samples.data() + offset, count, levels.data(), static_cast<ULONG>(levels.size()));
+            decoder.Decode(levels.data(), length, handler);
+        }
+    }
+}
+
+TEST(AfskDemodulator, SampleRateIsRangeChecked)
+{
+    AfskDemodulator demodulator;
+    EXPECT_EQ(AfskDemodulator::MAX_SAMPLE_RATE, demodulator.GetSampleRate());
+    EXPECT_FALSE(demodulator.SetSampleRate(AfskDemodulator::MIN_SAMPLE_RATE - 1));
+    EXPECT_FALSE(demodulator.SetSampleRate(AfskDemodulator::MAX_SAMPLE_RATE + 1));
+    EXPECT_TRUE(demodulator.SetSampleRate(22050));
+    EXPECT_EQ(22050u, demodulator.GetSampleRate());
+}
+
+// Pure tones must come out as steady line levels once the first bit period has filled the window
+TEST(AfskDemodulator, ToneSetsLineLevel)
+{
+    std::mt19937 random(21);
+    AfskDemodulator demodulator;
+    for (BYTE tone : { 0xFF, 0x00 })
+    {
+        demodulator.Reset();
+        std::vector<SHORT> samples = modulate(std::vector<BYTE>(8, tone), AfskDemodulator::MAX_SAMPLE_RATE, 1200, 0, random);
+        std::vector<BYTE> levels(demodulator.GetMaximumOutputLength(static_cast<ULONG>(samples.size())));
+        const ULONG length = demodulator.Demodulate(samples.data(), static_cast<ULONG>(samples.size()), levels.data(), static_cast<ULONG>(levels.size()));
+        ASSERT_GE(length, 6u);
+        for (ULONG i = 1; i < length; i++)
+        {
+            EXPECT_EQ(tone, levels[i]) << "byte " << i;
+        }
+    }
+}
+
+// Every frame must survive the round trip through audio at the common soundcard rates, down to
+// MIN_SAMPLE_RATE, with noise and a sender whose clock is 0.5% fast. The noise is scaled with the sample
+// rate so that every rate sees the same noise per bit.
+TEST(AfskDemodulator, DecodesFramesFromWav)
+{
+    std::mt19937 random(22);
+    const std::vector<std::vector<BYTE>> frames = randomFrames(20, random);
+    const std::vector<BYTE> levels = encodeTransmission(frames);
+    for (ULONG sampleRate : { 8000u, 9600u, 11025u, 22050u, 44100u, 48000u })
+    {
+        Recording recording;
+        recording.sampleRate = sampleRate;
+        recording.samples = modulate(levels, sampleRate, 1206, 0.25 * std::sqrt(sampleRate / 48000.0), random);
+
+        Recording loaded;
+        ASSERT_TRUE(readWav(writeWav(recording), loaded));
+        ASSERT_EQ(sampleRate, loaded.sampleRate);
+
+        AfskDemodulator demodulator;
+        ASSERT_TRUE(demodulator.SetSampleRate(loaded.sampleRate));
+        HdlcDecoder decoder;
+        CollectingHandler handler;
+        decode(loaded, 256, demodulator, decoder, handler);
+        EXPECT_EQ(frames.size(), handler.frames.size()) << sampleRate << " samples per second";
+        EXPECT_TRUE(frames == handler.frames) << sampleRate << " samples per second";
+    }
+}
+
+// Decodes a recording from disk, such as one of the standard APRS test tracks, if one is given
+TEST(AfskDemodulator, DecodesRecordingFromEnvironment)
+{
+    const char* path = std::getenv("AX25_AFSK_WAV");
+    if (path == nullptr)
+    {
+        return;
+    }
+
+    std::ifstream stream(path, std::ios::binary);
+    ASSERT_TRUE(stream.good()) << path;
+    std::vector<BYTE> file((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    Recording recording;
+    ASSERT_TRUE(readWav(file, recording)) << path << " is not a 16-bit PCM WAV file";
+
+    AfskDemodulator demodulator;
+    ASSERT_TRUE(demodulator.SetSampleRate(recording.sampleRate));
+    HdlcDecoder decoder;
+    CollectingHandler handler;
+    auto start = std::chrono::high_resolution_clock::now();
+    decode(recording, 1024, demodulator, decoder, handler);
+    const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    RecordProperty("Frames", static_cast<int>(decoder.GetFrameCount()));
+    RecordProperty("FcsErrors", static_cast<int>(decoder.GetFcsErrorCount()));
+    RecordProperty("TimesFasterThanRealTime", static_cast<int>(recording.samples.size() / (recording.sampleRate * seconds)));
+}
+
+/**
+ * Measures how much audio one processor can demodulate, from sample to decoded frame, and reports it as
+ * the number of channels that processor could keep up with and the processor time per second of audio.
+ */
+TEST(AfskDemodulator, DecodeRateBenchmark)
+{
+    std::mt19937 random(23);
+    const std::vector<std::vector<BYTE>> frames = randomFrames(40, random);
+    const std::vector<BYTE> levels = encodeTransmission(frames);
+    for (ULONG sampleRate : { 11025u, 48000u })
+    {
+        Recording recording;
+        recording.sampleRate = sampleRate;
+        recording.samples = modulate(levels, sampleRate, 1200, 0.1, random);
+
+        constexpr int passes = 5;
+        AfskDemodulator demodulator;
+        ASSERT_TRUE(demodulator.SetSampleRate(sampleRate));
+        HdlcDecoder decoder;
+        CollectingHandler handler;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            handler.frames.clear();
+            demodulator.Reset();
+            decoder.Reset();
+            decode(recording, 512, demodulator, decoder, handler);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        ASSERT_EQ(frames, handler.frames);
+
+        const double audioSeconds = static_cast<double>(recording.samples.size()) * passes / sampleRate;
+        const std::string name = std::to_string(sampleRate) + "Hz";
+        RecordProperty("ChannelsPerProcessorAt" + name, static_cast<int>(audioSeconds / seconds));
+        RecordProperty("MicrosecondsPerAudioSecondAt" + name, static_cast<int>(seconds / audioSeconds * 1e6));
+        RecordProperty("MegasamplesPerSecondAt" + name, static_cast<int>(recording.samples.size() * passes / seconds / 1e6));
+    }
+}
@@ -0,0 +1,278 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ChannelAccessTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver ChannelAccess class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "ChannelAccess.h"
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /** @returns DEFAULT_PARAMETERS with the specified persistence */
+    ChannelAccessParameters withPersistence(ULONG persistence)
+    {
+        ChannelAccessParameters parameters = ChannelAccess::DEFAULT_PARAMETERS;
+        parameters.Persistence = persistence;
+        return parameters;
+    }
+
+    /** @returns the time, in milliseconds, a frame of the specified length takes on the air at the default rate */
+    ULONG64 airtime(ULONG length)
+    {
+        const ULONG64 bits = (length + ChannelAccess::FRAME_OVERHEAD_BYTES) * 8ULL;
+        return (bits * 1000 + ChannelAccess::DEFAULT_PARAMETERS.BitsPerSecond - 1) / ChannelAccess::DEFAULT_PARAMETERS.BitsPerSecond;
+    }
+}
+
+/**
+ * Verifies that parameters KISS cannot express, or a rate of 0, are rejected and leave the parameters as they were
+ */
+TEST(ChannelAccess, RejectsParametersOutOfRange)
+{
+    ChannelAccess access(1);
+    ChannelAccessParameters parameters = ChannelAccess::DEFAULT_PARAMETERS;
+    parameters.Persistence = ChannelAccess::MAX_PERSISTENCE + 1;
+    EXPECT_FALSE(access.SetParameters(parameters));
+    parameters = ChannelAccess::DEFAULT_PARAMETERS;
+    parameters.TxDelayMilliseconds = ChannelAccess::MAX_MILLISECONDS + 1;
+    EXPECT_FALSE(access.SetParameters(parameters));
+    parameters = ChannelAccess::DEFAULT_PARAMETERS;
+    parameters.BitsPerSecond = 0;
+    EXPECT_FALSE(access.SetParameters(parameters));
+    EXPECT_EQ(ChannelAccess::DEFAULT_PARAMETERS.Persistence, access.GetParameters().Persistence);
+
+    parameters = ChannelAccess::DEFAULT_PARAMETERS;
+    parameters.SlotMilliseconds = ChannelAccess::MAX_MILLISECONDS;
+    EXPECT_TRUE(access.SetParameters(parameters));
+    EXPECT_EQ(ChannelAccess::MAX_MILLISECONDS, access.GetParameters().SlotMilliseconds);
+}
+
+/**
+ * Verifies that a burst holds the transmitter keyed for TXDELAY, each frame's airtime and TXTAIL, and that frames
+ * sent until then join it without another draw
+ */
+TEST(ChannelAccess, BurstLastsForItsFrames)
+{
+    ChannelAccess access(1);
+    ASSERT_TRUE(access.SetParameters(withPersistence(ChannelAccess::MAX_PERSISTENCE)));
+    const ChannelAccessParameters& parameters = access.GetParameters();
+
+    ASSERT_TRUE(access.TryStartBurst(1000, false));
+    EXPECT_EQ(1000 + parameters.TxDelayMilliseconds + parameters.TxTailMilliseconds, access.GetKeyedUntil());
+    access.FrameSent(1000, 100);
+    access.FrameSent(1000, 50);
+    ULONG64 dataEnd = 1000 + parameters.TxDelayMilliseconds + airtime(100) + airtime(50);
+    EXPECT_EQ(dataEnd + parameters.TxTailMilliseconds, access.GetKeyedUntil());
+
+    // A frame sent in TXTAIL goes straight out, and the carrier is not heard while keyed
+    const ULONG64 inTail = dataEnd + parameters.TxTailMilliseconds / 2;
+    EXPECT_TRUE(access.TryStartBurst(inTail, true));
+    access.FrameSent(inTail, 10);
+    EXPECT_EQ(inTail + airtime(10) + parameters.TxTailMilliseconds, access.GetKeyedUntil());
+
+    // Once unkeyed, the next burst needs a draw of its own
+    EXPECT_TRUE(access.TryStartBurst(access.GetKeyedUntil(), false));
+
+    const ChannelAccess::Counters& counters = access.GetCounters();
+    EXPECT_EQ(2U, counters.Bursts);
+    EXPECT_EQ(3U, counters.Frames);
+    EXPECT_EQ(0U, counters.Deferrals);
+    EXPECT_EQ(0U, counters.Backoffs);
+}
+
+/**
+ * Verifies that nothing is sent, or drawn, while a carrier is detected, and that the draw is made as soon as it drops
+ */
+TEST(ChannelAccess, WaitsForCarrierToDrop)
+{
+    ChannelAccess access(1);
+    ASSERT_TRUE(access.SetParameters(withPersistence(ChannelAccess::MAX_PERSISTENCE)));
+
+    EXPECT_FALSE(access.TryStartBurst(0, true));
+    EXPECT_EQ(MAXULONG64, access.GetNextAttempt());
+    EXPECT_FALSE(access.TryStartBurst(50, true));
+    EXPECT_FALSE(access.TryStartBurst(100, true));
+    EXPECT_TRUE(access.TryStartBurst(101, false));
+
+    const ChannelAccess::Counters& counters = access.GetCounters();
+    EXPECT_EQ(1U, counters.Deferrals);
+    EXPECT_EQ(0U, counters.Backoffs);
+    EXPECT_EQ(1U, counters.Bursts);
+}
+
+/**
+ * Verifies that a lost draw holds the next attempt back for a slot, and that the chance of winning a draw is
+ * (P + 1) / 256
+ */
+TEST(ChannelAccess, PersistenceDecidesEachSlot)
+{
+    const ULONG persistences[] = { 0, 63, 127, 255 };
+    for (ULONG persistence : persistences)
+    {
+        ChannelAccess access(12345);
+        ASSERT_TRUE(access.SetParameters(withPersistence(persistence)));
+        const ULONG64 slot = access.GetParameters().SlotMilliseconds;
+
+        ULONG64 now = 0;
+        ULONG wins = 0;
+        constexpr ULONG draws = 25600;
+        for (ULONG draw = 0; draw < draws; draw++)
+        {
+            if (access.TryStartBurst(now, false))
+            {
+                wins++;
+                now = access.GetKeyedUntil();
+                continue;
+            }
+
+            // Nothing more is drawn until the slot has passed
+            EXPECT_EQ(now + slot, access.GetNextAttempt());
+            EXPECT_FALSE(access.TryStartBurst(now + slot - 1, false));
+            now += slot;
+        }
+
+        const double expected = draws * (persistence + 1) / 256.0;
+        EXPECT_NEAR(expected, wins, 5 * std::sqrt(expected) + 1) << "P = " << persistence;
+        EXPECT_EQ(wins, access.GetCounters().Bursts);
+        EXPECT_EQ(draws - wins, access.GetCounters().Backoffs);
+    }
+}
+
+/**
+ * Simulates stations sharing one channel, each offered frames at random, and measures how many bursts collide and
+ * how much of the channel carries frames which got through. A station hears another's carrier DCD_LATENCY after it
+ * keys up, and any overlap of two bursts loses both.
+ */
+TEST(ChannelAccess, SimulatedChannel)
+{
+    constexpr ULONG STATION_COUNT = 6;
+    constexpr ULONG FRAME_LENGTH = 128;
+    constexpr ULONG64 DCD_LATENCY = 20;
+    constexpr ULONG64 DURATION = 3600 * 1000;
+    struct Burst
+    {
+        ULONG station;
+        ULONG64 start;
+        ULONG64 end;
+        ULONG frames;
+    };
+    struct Scenario
+    {
+        const char* name;
+        ULONG persistence;
+        double offeredLoad;     // Frames offered, as a fraction of what the channel could carry back to back
+    };
+    const Scenario scenarios[] = {
+        { "Persistence255Load30", 255, 0.3 }, { "Persistence63Load30", 63, 0.3 },
+        { "Persistence255Load80", 255, 0.8 }, { "Persistence63Load80", 63, 0.8 },
+        { "Persistence31Load80", 31, 0.8 },
+    };
+
+    for (const Scenario& scenario : scenarios)
+    {
+        std::vector<ChannelAccess> stations;
+        for (ULONG i = 0; i < STATION_COUNT; i++)
+        {
+            stations.emplace_back(0x9E3779B9U * (i + 1));
+            ASSERT_TRUE(stations.back().SetParameters(withPersistence(scenario.persistence)));
+        }
+
+        std::mt19937 random(42);
+        const double framesPerMillisecond = scenario.offeredLoad / airtime(FRAME_LENGTH) / STATION_COUNT;
+        std::bernoulli_distribution arrival(framesPerMillisecond);
+        std::vector<ULONG> queued(STATION_COUNT, 0);
+        std::vector<Burst> bursts;
+        std::vector<size_t> current(STATION_COUNT, SIZE_MAX);   // Each station's latest burst in bursts
+        ULONG64 framesOffered = 0;
+        for (ULONG64 now = 0; now < DURATION; now++)
+        {
+            for (ULONG i = 0; i < STATION_COUNT; i++)
+            {
+                if (arrival(random))
+                {
+                    queued[i]++;
+                    framesOffered++;
+                }
+                if (queued[i] == 0)
+                {
+                    continue;
+                }
+
+                bool carrier = false;
+                for (ULONG j = 0; j < STATION_COUNT; j++)
+                {
+                    carrier |= j != i && current[j] != SIZE_MAX && bursts[current[j]].start + DCD_LATENCY <= now &&
+                               now < bursts[current[j]].end;
+                }
+
+                const bool keyed = current[i] != SIZE_MAX && now < bursts[current[i]].end;
+                if (!stations[i].TryStartBurst(now, carrier))
+                {
+                    continue;
+                }
+                if (!keyed)
+                {
+                    current[i] = bursts.size();
+                    bursts.push_back({ i, now, 0, 0 });
+                }
+                for (; queued[i] != 0; queued[i]--)
+                {
+                    stations[i].FrameSent(now, FRAME_LENGTH);
+                    bursts[current[i]].frames++;
+                }
+                bursts[current[i]].end = stations[i].GetKeyedUntil();
+            }
+        }
+
+        // Bursts are in order of their start, so only the ones which started before a burst ended can overlap it
+        std::vector<bool> collided(bursts.size(), false);
+        for (size_t a = 0; a < bursts.size(); a++)
+        {
+            for (size_t b = a + 1; b < bursts.size() && bursts[b].start < bursts[a].end; b++)
+            {
+                if (bursts[b].station != bursts[a].station)
+                {
+                    collided[a] = true;
+                    collided[b] = true;
+                }
+            }
+        }
+
+        ULONG64 collisions = 0;
+        ULONG64 framesDelivered = 0;
+        for (size_t a = 0; a < bursts.size(); a++)
+        {
+            collisions += collided[a] ? 1 : 0;
+            framesDelivered += collided[a] ? 0 : bursts[a].frames;
+        }
+
+        ASSERT_FALSE(bursts.empty());
+        const std::string name = scenario.name;
+        RecordProperty(name + "CollisionPercent", static_cast<int>(100 * collisions / bursts.size()));
+        RecordProperty(name + "ThroughputPercent", static_cast<int>(100 * framesDelivered * airtime(FRAME_LENGTH) / DURATION));
+        RecordProperty(name + "FramesPerBurstTimes10", static_cast<int>(10 * framesOffered / bursts.size()));
+    }
+}
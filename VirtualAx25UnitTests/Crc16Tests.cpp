@@ -0,0 +1,194 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file Crc16Tests.cpp
+ * Unit tests and microbenchmark for the Virtual AX.25 NDIS Driver Crc16 class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "Crc16.h"
+
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char* const implementationNames[] = { "Table", "CarrylessMultiply" };
+
+    /**
+     * Runs a test once with each implementation this machine supports, then goes back to the fastest
+     */
+    void forEachImplementation(std::function<void(Crc16::Implementation)> test)
+    {
+        for (int i = Crc16::Table; i <= Crc16::CarrylessMultiply; i++)
+        {
+            Crc16::Implementation implementation = static_cast<Crc16::Implementation>(i);
+            if (Crc16::SelectImplementation(implementation) == implementation)
+            {
+                SCOPED_TRACE(implementationNames[i]);
+                test(implementation);
+            }
+        }
+        Crc16::SelectImplementation(Crc16::CarrylessMultiply);
+    }
+
+    /** Updates the CRC register one bit at a time, as the reference for both implementations */
+    USHORT referenceUpdate(USHORT crc, const BYTE* data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+            }
+        }
+        return crc;
+    }
+
+    std::vector<BYTE> randomData(size_t length, std::mt19937& random)
+    {
+        std::vector<BYTE> data(length);
+        for (BYTE& value : data)
+        {
+            value = static_cast<BYTE>(random());
+        }
+        return data;
+    }
+}
+
+// The standard check value for CRC-16/X-25, which is the AX.25 FCS
+TEST(Crc16, ComputesCheckValue)
+{
+    const char check[] = "123456789";
+    forEachImplementation([&](Crc16::Implementation)
+    {
+        ASSERT_EQ(0x906E, Crc16::Compute(reinterpret_cast<const BYTE*>(check), 9));
+    });
+}
+
+// Every length around the block boundaries of both implementations, from every starting register value
+// class and every alignment, must match the bit at a time reference
+TEST(Crc16, EveryImplementationMatchesReference)
+{
+    std::mt19937 random(11);
+    std::vector<BYTE> data = randomData(1024 + 16, random);
+    forEachImplementation([&](Crc16::Implementation)
+    {
+        for (ULONG length = 0; length <= 300; length++)
+        {
+            for (ULONG alignment : { 0u, 1u, 7u })
+            {
+                for (USHORT crc : { static_cast<USHORT>(0), Crc16::INITIAL_VALUE, static_cast<USHORT>(random()) })
+                {
+                    const BYTE* start = data.data() + alignment;
+                    ASSERT_EQ(referenceUpdate(crc, start, length), Crc16::Update(crc, start, length))
+                        << "length " << length << ", alignment " << alignment << ", crc " << crc;
+                }
+            }
+        }
+
+        ASSERT_EQ(referenceUpdate(Crc16::INITIAL_VALUE, data.data(), 1024), Crc16::Update(Crc16::INITIAL_VALUE, data.data(), 1024));
+    });
+}
+
+TEST(Crc16, FrameWithFcsIsValid)
+{
+    std::mt19937 random(12);
+    forEachImplementation([&](Crc16::Implementation)
+    {
+        for (ULONG length : { 0u, 1u, 17u, 64u, 200u, 600u })
+        {
+            std::vector<BYTE> frame = randomData(length + Crc16::FCS_LENGTH, random);
+            Crc16::Write(Crc16::Compute(frame.data(), length), frame.data() + length);
+            ASSERT_TRUE(Crc16::IsValid(frame.data(), length + Crc16::FCS_LENGTH)) << "length " << length;
+
+            // Any single bit error must be caught
+            for (ULONG bit = 0; bit < (length + Crc16::FCS_LENGTH) * 8; bit += 13)
+            {
+                frame[bit / 8] ^= static_cast<BYTE>(1 << (bit % 8));
+                ASSERT_FALSE(Crc16::IsValid(frame.data(), length + Crc16::FCS_LENGTH)) << "length " << length << ", bit " << bit;
+                frame[bit / 8] ^= static_cast<BYTE>(1 << (bit % 8));
+            }
+        }
+    });
+
+    const BYTE tooShort[] = { 0xB8 };
+    ASSERT_FALSE(Crc16::IsValid(tooShort, sizeof(tooShort)));
+}
+
+TEST(Crc16, GatherListMatchesContiguousFrame)
+{
+    std::mt19937 random(13);
+    std::vector<BYTE> data = randomData(400, random);
+    FrameGatherList frame;
+    ASSERT_TRUE(frame.Append(data.data(), 17));
+    ASSERT_TRUE(frame.Append(data.data() + 17, 3));
+    ASSERT_TRUE(frame.Append(data.data() + 20, 380));
+    ASSERT_EQ(Crc16::Compute(data.data(), 400), Crc16::Compute(frame));
+}
+
+// Measures both implementations over frame sizes from a bare S frame to a 1500 byte MTU
+TEST(Crc16, ImplementationBenchmark)
+{
+    std::mt19937 random(14);
+    std::vector<BYTE> data = randomData(1 << 16, random);
+
+    forEachImplementation([&](Crc16::Implementation implementation)
+    {
+        for (ULONG frameLength : { 16u, 64u, 256u, 512u, 1024u, 1500u })
+        {
+            const ULONG frameCount = static_cast<ULONG>(data.size()) / frameLength;
+            constexpr int passes = 200;
+            USHORT combined = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int pass = 0; pass < passes; pass++)
+            {
+                for (ULONG frame = 0; frame < frameCount; frame++)
+                {
+                    combined ^= Crc16::Compute(data.data() + frame * frameLength, frameLength);
+                }
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            // Keeps the work from being optimized away, and checks it against the tables
+            USHORT expected = 0;
+            if (implementation != Crc16::Table)
+            {
+                Crc16::SelectImplementation(Crc16::Table);
+                for (int pass = 0; pass < passes; pass++)
+                {
+                    for (ULONG frame = 0; frame < frameCount; frame++)
+                    {
+                        expected ^= Crc16::Compute(data.data() + frame * frameLength, frameLength);
+                    }
+                }
+                Crc16::SelectImplementation(implementation);
+                ASSERT_EQ(expected, combined) << frameLength;
+            }
+
+            const double bytes = static_cast<double>(frameLength) * frameCount * passes;
+            RecordProperty(std::string(implementationNames[implementation]) + std::to_string(frameLength) + "ByteMegabytesPerSecond",
+                           static_cast<int>(bytes / seconds / 1e6));
+        }
+    });
+}
@@ -0,0 +1,904 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file DataLinkTests.cpp
+ * Unit tests and goodput measurements for the Virtual AX.25 NDIS Driver DataLink and DataLinkTable classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "DataLink.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr AX25Address ALPHA = AX25Address("KG7UDH", 1);
+    constexpr AX25Address BRAVO = AX25Address("N0CALL", 2);
+    constexpr BYTE PID_IPV4 = 0xCC;
+
+    /** One end of a link, which collects what it sends and receives */
+    class Station : public DataLinkClient
+    {
+    public:
+        Station(AX25Address self, AX25Address other)
+            :refuseInformation(false)
+        {
+            AX25AddressField path;
+            path.Destination = other;
+            path.Source = self;
+            link.Open(path);
+        }
+
+        bool DataLinkTransmit(const FrameGatherList& frame) noexcept override
+        {
+            std::vector<BYTE> bytes(frame.GetTotalLength());
+            (void)frame.CopyTo(bytes.data(), static_cast<ULONG>(bytes.size()));
+            outbox.push_back(bytes);
+            return true;
+        }
+
+        bool DataLinkReceive(const DataLink& source, BYTE pid, const BYTE* information, ULONG length) noexcept override
+        {
+            EXPECT_EQ(&link, &source);
+            EXPECT_EQ(PID_IPV4, pid);
+            if (refuseInformation)
+            {
+                return false;
+            }
+            delivered.insert(delivered.end(), information, information + length);
+            return true;
+        }
+
+        /** Hands a frame to the link, as if it had come from the radio */
+        void receive(const std::vector<BYTE>& frame, ULONG64 now)
+        {
+            AX25AddressField addresses;
+            const ULONG addressLength = addresses.Parse(frame.data(), static_cast<ULONG>(frame.size()));
+            ASSERT_NE(0UL, addressLength);
+            link.ReceiveFrame(addresses, frame.data() + addressLength, static_cast<ULONG>(frame.size()) - addressLength, now, *this);
+        }
+
+        /** Takes the frames sent since the last call */
+        std::vector<std::vector<BYTE>> transmit(ULONG64 now)
+        {
+            link.Transmit(*this, now);
+            std::vector<std::vector<BYTE>> frames;
+            frames.swap(outbox);
+            return frames;
+        }
+
+        DataLink link;
+        bool refuseInformation;
+        std::vector<std::vector<BYTE>> outbox;
+        std::vector<BYTE> delivered;
+    };
+
+    /** @returns the control field of a frame with no repeaters */
+    BYTE controlOf(const std::vector<BYTE>& frame)
+    {
+        return frame[AX25AddressField::MIN_LENGTH];
+    }
+
+    /** @returns true if the frame has the C bits of a command */
+    bool isCommand(const std::vector<BYTE>& frame)
+    {
+        return (frame[6] & AX25Address::CONTROL_BIT) != 0 && (frame[13] & AX25Address::CONTROL_BIT) == 0;
+    }
+
+    /** Builds a frame from BRAVO to ALPHA */
+    std::vector<BYTE> frameToAlpha(BYTE control, bool command, std::initializer_list<BYTE> rest = {})
+    {
+        AX25AddressField addresses;
+        addresses.Destination = ALPHA.WithControlBit(command);
+        addresses.Source = BRAVO.WithControlBit(!command);
+        std::vector<BYTE> frame(AX25AddressField::MIN_LENGTH);
+        EXPECT_EQ(AX25AddressField::MIN_LENGTH, addresses.Write(frame.data(), static_cast<ULONG>(frame.size())));
+        frame.push_back(control);
+        frame.insert(frame.end(), rest.begin(), rest.end());
+        return frame;
+    }
+
+    /**
+     * A half-duplex radio channel shared by two stations. Each station in turn sends everything it has in one
+     * transmission, which keeps the channel for a transmitter keying delay and then for the airtime of its
+     * frames; the other station receives the frames at the end. Frames are lost at random, from a fixed seed,
+     * so every run is the same.
+     */
+    class SimulatedChannel
+    {
+    public:
+        static constexpr ULONG BITS_PER_SECOND = 1200;          //<! Bell 202 AFSK
+        static constexpr ULONG KEYING_MILLISECONDS = 300;       //<! Transmitter keying delay (TXDELAY)
+        static constexpr ULONG FRAMING_BYTES = 4;               //<! Flag and FCS around each frame
+
+        SimulatedChannel(ULONG lossPerThousand, ULONG seed)
+            :lossPerThousand(lossPerThousand)
+            ,random(seed)
+            ,now(0)
+        {
+        }
+
+        /** @returns the airtime of a transmission, in milliseconds */
+        static ULONG64 airtime(const std::vector<std::vector<BYTE>>& frames)
+        {
+            ULONG64 bits = 0;
+            for (const std::vector<BYTE>& frame : frames)
+            {
+                bits += 8 * (frame.size() + FRAMING_BYTES);
+            }
+            return KEYING_MILLISECONDS + bits * 1000 / BITS_PER_SECOND;
+        }
+
+        /**
+         * Sends data from one station to the other, keeping the sender's queue full
+         * @returns the time taken, in milliseconds, or 0 if the data did not all arrive by the time limit
+         */
+        ULONG64 transfer(Station& sender, Station& receiver, const std::vector<BYTE>& data, ULONG64 limit)
+        {
+            const ULONG chunk = sender.link.GetParameters().MaxInformationLength;
+            size_t offered = 0;
+            while (receiver.delivered.size() < data.size() && now < limit)
+            {
+                while (offered < data.size())
+                {
+                    const ULONG length = static_cast<ULONG>(std::min<size_t>(chunk, data.size() - offered));
+                    if (!sender.link.Send(PID_IPV4, data.data() + offered, length))
+                    {
+                        break;
+                    }
+                    offered += length;
+                }
+
+                if (!turn(sender, receiver) && !turn(receiver, sender))
+                {
+                    // Nobody has anything to say until a timer expires
+                    const ULONG64 next = std::min(sender.link.GetNextTimeout(), receiver.link.GetNextTimeout());
+                    if (next == MAXULONG64)
+                    {
+                        break;
+                    }
+                    now = std::max(now, next);
+                }
+            }
+            return (receiver.delivered.size() == data.size()) ? now : 0;
+        }
+
+        /** Lets one station transmit, if it has anything to send */
+        bool turn(Station& from, Station& to)
+        {
+            from.link.OnTimer(now);
+            const std::vector<std::vector<BYTE>> frames = from.transmit(now);
+            if (frames.empty())
+            {
+                return false;
+            }
+
+            now += airtime(frames);
+            for (const std::vector<BYTE>& frame : frames)
+            {
+                random = random * 6364136223846793005ULL + 1442695040888963407ULL;
+                if ((random >> 33) % 1000 >= lossPerThousand)
+                {
+                    to.receive(frame, now);
+                }
+            }
+            return true;
+        }
+
+        ULONG lossPerThousand;
+        ULONG64 random;
+        ULONG64 now;
+    };
+
+    std::vector<BYTE> testData(size_t length)
+    {
+        std::vector<BYTE> data(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            data[i] = static_cast<BYTE>(i * 7 + i / 251);
+        }
+        return data;
+    }
+
+    DataLinkParameters parameters(ULONG windowSize, ULONG informationLength = 256)
+    {
+        // T1 has to cover a whole window and its acknowledgement
+        DataLinkParameters result = DataLink::DEFAULT_PARAMETERS;
+        result.MaxInformationLength = informationLength;
+        result.WindowSize = windowSize;
+        result.AcknowledgeMilliseconds = static_cast<ULONG>(2 * SimulatedChannel::KEYING_MILLISECONDS +
+            (windowSize * (informationLength + 40) + 40) * 8 * 1000 / SimulatedChannel::BITS_PER_SECOND);
+        return result;
+    }
+
+    DataLinkParameters extendedParameters(ULONG windowSize, bool selectiveReject)
+    {
+        DataLinkParameters result = parameters(windowSize);
+        result.Modulus = DataLink::EXTENDED_MODULUS;
+        result.SelectiveReject = selectiveReject;
+        return result;
+    }
+
+    /** @returns the second byte of the control field of an extended I or S frame with no repeaters */
+    BYTE extendedControlOf(const std::vector<BYTE>& frame)
+    {
+        return frame[AX25AddressField::MIN_LENGTH + 1];
+    }
+
+    /** Connects two stations with the specified parameters, and returns them through alpha and bravo */
+    void connect(std::unique_ptr<Station>& alpha, std::unique_ptr<Station>& bravo, const DataLinkParameters& values)
+    {
+        alpha.reset(new Station(ALPHA, BRAVO));
+        bravo.reset(new Station(BRAVO, ALPHA));
+        ASSERT_TRUE(alpha->link.SetParameters(values));
+        ASSERT_TRUE(bravo->link.SetParameters(values));
+        alpha->link.Connect();
+        for (const std::vector<BYTE>& frame : alpha->transmit(0))
+        {
+            bravo->receive(frame, 0);
+        }
+        for (const std::vector<BYTE>& frame : bravo->transmit(0))
+        {
+            alpha->receive(frame, 0);
+        }
+        ASSERT_EQ(DataLink::Connected, alpha->link.GetState());
+        ASSERT_EQ(DataLink::Connected, bravo->link.GetState());
+    }
+
+    /** Two stations with a connected link between them */
+    class DataLinkFixture : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            alpha.reset(new Station(ALPHA, BRAVO));
+            bravo.reset(new Station(BRAVO, ALPHA));
+            ASSERT_TRUE(alpha->link.SetParameters(parameters(4)));
+            ASSERT_TRUE(bravo->link.SetParameters(parameters(4)));
+            alpha->link.Connect();
+            deliver(*alpha, *bravo);
+            deliver(*bravo, *alpha);
+            ASSERT_EQ(DataLink::Connected, alpha->link.GetState());
+            ASSERT_EQ(DataLink::Connected, bravo->link.GetState());
+        }
+
+        /** Delivers everything one station sends to the other */
+        std::vector<std::vector<BYTE>> deliver(Station& from, Station& to, ULONG64 now = 0)
+        {
+            std::vector<std::vector<BYTE>> frames = from.transmit(now);
+            for (const std::vector<BYTE>& frame : frames)
+            {
+                to.receive(frame, now);
+            }
+            return frames;
+        }
+
+        void queue(ULONG count)
+        {
+            const std::vector<BYTE> data = testData(100);
+            for (ULONG i = 0; i < count; i++)
+            {
+                ASSERT_TRUE(alpha->link.Send(PID_IPV4, data.data(), 10));
+            }
+        }
+
+        std::unique_ptr<Station> alpha;
+        std::unique_ptr<Station> bravo;
+    };
+}
+
+TEST_F(DataLinkFixture, ConnectsAndDisconnects)
+{
+    std::unique_ptr<Station> station(new Station(ALPHA, BRAVO));
+    station->link.Connect();
+    std::vector<std::vector<BYTE>> frames = station->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_TRUE(isCommand(frames[0]));
+    EXPECT_EQ(DataLink::AwaitingConnection, station->link.GetState());
+
+    alpha->link.Disconnect();
+    frames = deliver(*alpha, *bravo);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_DISC | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_EQ(DataLink::Disconnected, bravo->link.GetState());
+
+    frames = deliver(*bravo, *alpha);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_UA | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_FALSE(isCommand(frames[0]));
+    EXPECT_EQ(DataLink::Disconnected, alpha->link.GetState());
+}
+
+TEST_F(DataLinkFixture, SendsUpToTheWindowBeforeWaiting)
+{
+    queue(10);
+    std::vector<std::vector<BYTE>> frames = deliver(*alpha, *bravo);
+    ASSERT_EQ(4U, frames.size());
+    for (ULONG i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(static_cast<BYTE>(i << 1), controlOf(frames[i]));
+        EXPECT_TRUE(isCommand(frames[i]));
+        EXPECT_EQ(PID_IPV4, frames[i][AX25AddressField::MIN_LENGTH + 1]);
+    }
+    EXPECT_TRUE(alpha->transmit(0).empty());
+    EXPECT_EQ(40U, bravo->delivered.size());
+
+    // One RR acknowledges the whole window, and the next window follows it
+    frames = deliver(*bravo, *alpha);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_RR | (4 << 5), controlOf(frames[0]));
+    EXPECT_EQ(6U, alpha->link.GetQueuedCount());
+    frames = deliver(*alpha, *bravo);
+    ASSERT_EQ(4U, frames.size());
+    EXPECT_EQ(static_cast<BYTE>(4 << 1), controlOf(frames[0]));
+}
+
+TEST_F(DataLinkFixture, PiggybacksAcknowledgementsOnInformation)
+{
+    queue(2);
+    deliver(*alpha, *bravo);
+    ASSERT_TRUE(bravo->link.Send(PID_IPV4, testData(5).data(), 5));
+    const std::vector<std::vector<BYTE>> frames = deliver(*bravo, *alpha);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(static_cast<BYTE>(2 << 5), controlOf(frames[0]));
+    EXPECT_EQ(0U, alpha->link.GetQueuedCount());
+}
+
+TEST_F(DataLinkFixture, RejectsALostFrameAndGoesBackN)
+{
+    queue(4);
+    const std::vector<std::vector<BYTE>> window = alpha->transmit(0);
+    ASSERT_EQ(4U, window.size());
+    bravo->receive(window[0], 0);
+    bravo->receive(window[2], 0);
+    bravo->receive(window[3], 0);
+    EXPECT_EQ(2U, bravo->link.GetCounters().outOfSequenceFrames);
+
+    std::vector<std::vector<BYTE>> frames = deliver(*bravo, *alpha);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_REJ | (1 << 5), controlOf(frames[0]));
+
+    frames = deliver(*alpha, *bravo);
+    ASSERT_EQ(3U, frames.size());
+    EXPECT_EQ(static_cast<BYTE>((1 << 1) | 0), controlOf(frames[0]));
+    EXPECT_EQ(3U, alpha->link.GetCounters().informationFramesResent);
+    EXPECT_EQ(40U, bravo->delivered.size());
+}
+
+TEST_F(DataLinkFixture, PollsWhenTheAcknowledgementIsLost)
+{
+    queue(2);
+    deliver(*alpha, *bravo);
+    EXPECT_EQ(1U, bravo->transmit(0).size());   // The RR is lost
+
+    const ULONG64 timeout = alpha->link.GetNextTimeout();
+    ASSERT_EQ(static_cast<ULONG64>(alpha->link.GetParameters().AcknowledgeMilliseconds), timeout);
+    alpha->link.OnTimer(timeout);
+    EXPECT_EQ(DataLink::TimerRecovery, alpha->link.GetState());
+
+    std::vector<std::vector<BYTE>> frames = deliver(*alpha, *bravo, timeout);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_RR | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_TRUE(isCommand(frames[0]));
+
+    frames = deliver(*bravo, *alpha, timeout);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_RR | DataLink::CONTROL_POLL_FINAL | (2 << 5), controlOf(frames[0]));
+    EXPECT_FALSE(isCommand(frames[0]));
+    EXPECT_EQ(DataLink::Connected, alpha->link.GetState());
+    EXPECT_EQ(0U, alpha->link.GetQueuedCount());
+    EXPECT_TRUE(alpha->transmit(timeout).empty());
+}
+
+TEST_F(DataLinkFixture, WithholdsAcknowledgementOfRefusedInformation)
+{
+    queue(1);
+    bravo->refuseInformation = true;
+    deliver(*alpha, *bravo);
+    EXPECT_TRUE(bravo->transmit(0).empty());
+
+    // The frame is sent again after the poll, and taken this time
+    bravo->refuseInformation = false;
+    alpha->link.OnTimer(alpha->link.GetNextTimeout());
+    deliver(*alpha, *bravo);
+    deliver(*bravo, *alpha);
+    deliver(*alpha, *bravo);
+    EXPECT_EQ(10U, bravo->delivered.size());
+}
+
+TEST_F(DataLinkFixture, GivesUpAfterN2Retries)
+{
+    std::unique_ptr<Station> station(new Station(ALPHA, BRAVO));
+    ASSERT_TRUE(station->link.Send(PID_IPV4, testData(10).data(), 10));
+    ULONG64 now = 0;
+    ULONG attempts = 0;
+    while (station->link.GetState() != DataLink::Disconnected)
+    {
+        attempts += static_cast<ULONG>(station->transmit(now).size());
+        now = station->link.GetNextTimeout();
+        station->link.OnTimer(now);
+    }
+    EXPECT_EQ(DataLink::DEFAULT_PARAMETERS.MaxRetries + 1, attempts);
+    EXPECT_EQ(0U, station->link.GetQueuedCount());
+}
+
+TEST_F(DataLinkFixture, AnswersFramesWhileDisconnectedWithDM)
+{
+    std::unique_ptr<Station> station(new Station(ALPHA, BRAVO));
+    station->receive(frameToAlpha(0x00 | DataLink::CONTROL_POLL_FINAL, true, { PID_IPV4, 1, 2 }), 0);
+    const std::vector<std::vector<BYTE>> frames = station->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_DM | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_TRUE(station->delivered.empty());
+    EXPECT_EQ(DataLink::Disconnected, station->link.GetState());
+}
+
+TEST_F(DataLinkFixture, ReestablishesOnAnInvalidAcknowledgement)
+{
+    queue(1);
+    deliver(*alpha, *bravo);
+    alpha->receive(frameToAlpha(DataLink::CONTROL_RR | (3 << 5), false), 0);
+    EXPECT_EQ(DataLink::AwaitingConnection, alpha->link.GetState());
+
+    // The unacknowledged frame is renumbered and sent again once the link is back up
+    deliver(*alpha, *bravo);
+    deliver(*bravo, *alpha);
+    const std::vector<std::vector<BYTE>> frames = deliver(*alpha, *bravo);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(0, controlOf(frames[0]));
+    EXPECT_EQ(20U, bravo->delivered.size());
+}
+
+TEST_F(DataLinkFixture, ParametersAreRangeChecked)
+{
+    DataLinkParameters values = parameters(DataLink::MAX_WINDOW_SIZE, DataLink::MAX_INFORMATION_LENGTH);
+    EXPECT_TRUE(alpha->link.SetParameters(values));
+    values.WindowSize = DataLink::MAX_WINDOW_SIZE + 1;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    values = parameters(1, DataLink::MAX_INFORMATION_LENGTH + 1);
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    values = parameters(1);
+    values.MaxRetries = 0;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    values.MaxRetries = DataLink::MAX_RETRIES + 1;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    values = parameters(1);
+    values.AcknowledgeMilliseconds = DataLink::MAX_ACKNOWLEDGE_MILLISECONDS + 1;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    EXPECT_EQ(DataLink::MAX_WINDOW_SIZE, alpha->link.GetParameters().WindowSize);
+
+    values = extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, true);
+    EXPECT_TRUE(alpha->link.SetParameters(values));
+    values.WindowSize = DataLink::MAX_EXTENDED_WINDOW_SIZE + 1;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    values = parameters(1);
+    values.Modulus = 16;
+    EXPECT_FALSE(alpha->link.SetParameters(values));
+    EXPECT_EQ(DataLink::EXTENDED_MODULUS, alpha->link.GetParameters().Modulus);
+
+    EXPECT_FALSE(alpha->link.Send(PID_IPV4, testData(DataLink::MAX_INFORMATION_LENGTH + 1).data(), DataLink::MAX_INFORMATION_LENGTH + 1));
+}
+
+TEST(DataLinkTests, ConnectsWithExtendedSequenceNumbers)
+{
+    std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+    std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+    ASSERT_TRUE(alpha->link.SetParameters(extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, false)));
+    alpha->link.Connect();
+    std::vector<std::vector<BYTE>> frames = alpha->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_SABME | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+
+    // The peer takes the modulus from SABME, whatever its own parameters say
+    bravo->receive(frames[0], 0);
+    EXPECT_EQ(DataLink::EXTENDED_MODULUS, bravo->link.GetModulus());
+    frames = bravo->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_UA | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    alpha->receive(frames[0], 0);
+    EXPECT_EQ(DataLink::EXTENDED_MODULUS, alpha->link.GetModulus());
+
+    // Far more than 7 frames go out before waiting, each with N(S) and N(R) in a two-byte control field
+    const std::vector<BYTE> data = testData(10 * DataLink::QUEUE_LENGTH);
+    for (ULONG i = 0; i < DataLink::QUEUE_LENGTH; i++)
+    {
+        ASSERT_TRUE(alpha->link.Send(PID_IPV4, data.data() + 10 * i, 10));
+    }
+    frames = alpha->transmit(0);
+    ASSERT_EQ(DataLink::MAX_EXTENDED_WINDOW_SIZE, frames.size());
+    for (ULONG i = 0; i < frames.size(); i++)
+    {
+        EXPECT_EQ(static_cast<BYTE>(i << 1), controlOf(frames[i]));
+        EXPECT_EQ(0, extendedControlOf(frames[i]));
+        EXPECT_EQ(PID_IPV4, frames[i][AX25AddressField::MIN_LENGTH + 2]);
+        bravo->receive(frames[i], 0);
+    }
+
+    frames = bravo->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_RR, controlOf(frames[0]));
+    EXPECT_EQ(static_cast<BYTE>(DataLink::MAX_EXTENDED_WINDOW_SIZE << 1), extendedControlOf(frames[0]));
+    alpha->receive(frames[0], 0);
+    EXPECT_EQ(0U, alpha->link.GetQueuedCount());
+    EXPECT_TRUE(data == bravo->delivered);
+}
+
+TEST(DataLinkTests, SelectivelyRejectsOnlyTheLostFrames)
+{
+    std::unique_ptr<Station> alpha;
+    std::unique_ptr<Station> bravo;
+    connect(alpha, bravo, extendedParameters(16, true));
+
+    const std::vector<BYTE> data = testData(100);
+    for (ULONG i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(alpha->link.Send(PID_IPV4, data.data() + 10 * i, 10));
+    }
+    const std::vector<std::vector<BYTE>> window = alpha->transmit(0);
+    ASSERT_EQ(10U, window.size());
+    for (ULONG i = 0; i < window.size(); i++)
+    {
+        if (i != 2 && i != 5)
+        {
+            bravo->receive(window[i], 0);
+        }
+    }
+    EXPECT_EQ(20U, bravo->delivered.size());
+
+    // One SREJ for each gap, then the acknowledgement of what arrived in order
+    std::vector<std::vector<BYTE>> frames = bravo->transmit(0);
+    ASSERT_EQ(3U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_SREJ, controlOf(frames[0]));
+    EXPECT_EQ(2 << 1, extendedControlOf(frames[0]));
+    EXPECT_FALSE(isCommand(frames[0]));
+    EXPECT_EQ(DataLink::CONTROL_SREJ, controlOf(frames[1]));
+    EXPECT_EQ(5 << 1, extendedControlOf(frames[1]));
+    EXPECT_EQ(DataLink::CONTROL_RR, controlOf(frames[2]));
+    EXPECT_EQ(2 << 1, extendedControlOf(frames[2]));
+    EXPECT_EQ(2U, bravo->link.GetCounters().selectiveRejectsSent);
+    for (const std::vector<BYTE>& frame : frames)
+    {
+        alpha->receive(frame, 0);
+    }
+
+    frames = alpha->transmit(0);
+    ASSERT_EQ(2U, frames.size());
+    EXPECT_EQ(2 << 1, controlOf(frames[0]));
+    EXPECT_EQ(5 << 1, controlOf(frames[1]));
+    EXPECT_EQ(2U, alpha->link.GetCounters().informationFramesResent);
+
+    // The held frames are passed on in order as the gaps fill
+    bravo->receive(frames[0], 0);
+    EXPECT_EQ(50U, bravo->delivered.size());
+    bravo->receive(frames[1], 0);
+    EXPECT_TRUE(data == bravo->delivered);
+
+    frames = bravo->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(10 << 1, extendedControlOf(frames[0]));
+    alpha->receive(frames[0], 0);
+    EXPECT_EQ(0U, alpha->link.GetQueuedCount());
+}
+
+TEST(DataLinkTests, NegotiatesParametersWithXid)
+{
+    // Alpha would like more than Bravo can take
+    std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+    std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+    DataLinkParameters values = extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, true);
+    values.MaxInformationLength = DataLink::MAX_INFORMATION_LENGTH;
+    values.Negotiate = true;
+    ASSERT_TRUE(alpha->link.SetParameters(values));
+    values = parameters(4, 128);
+    values.AcknowledgeMilliseconds = 90000;
+    ASSERT_TRUE(bravo->link.SetParameters(values));
+
+    alpha->link.Connect();
+    EXPECT_EQ(DataLink::Negotiating, alpha->link.GetState());
+    std::vector<std::vector<BYTE>> frames = alpha->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_XID | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_TRUE(isCommand(frames[0]));
+    EXPECT_EQ(0x82, frames[0][AX25AddressField::MIN_LENGTH + 1]);
+
+    // Bravo answers with what both can do, and stays disconnected until Alpha connects
+    bravo->receive(frames[0], 0);
+    frames = bravo->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_XID | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    EXPECT_FALSE(isCommand(frames[0]));
+    EXPECT_EQ(DataLink::Disconnected, bravo->link.GetState());
+    EXPECT_TRUE(bravo->link.IsNegotiated());
+
+    alpha->receive(frames[0], 0);
+    EXPECT_EQ(DataLink::AwaitingConnection, alpha->link.GetState());
+    for (const std::unique_ptr<Station>* station : { &alpha, &bravo })
+    {
+        const DataLinkParameters& negotiated = (*station)->link.GetNegotiatedParameters();
+        EXPECT_EQ(128U, negotiated.MaxInformationLength);
+        EXPECT_EQ(4U, negotiated.WindowSize);
+        EXPECT_EQ(90000U, negotiated.AcknowledgeMilliseconds);
+        EXPECT_EQ(DataLink::MODULUS, negotiated.Modulus);
+        EXPECT_FALSE(negotiated.SelectiveReject);
+    }
+
+    frames = alpha->transmit(0);
+    ASSERT_EQ(1U, frames.size());
+    EXPECT_EQ(DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+    bravo->receive(frames[0], 0);
+    alpha->receive(bravo->transmit(0)[0], 0);
+    EXPECT_EQ(DataLink::Connected, alpha->link.GetState());
+    EXPECT_FALSE(alpha->link.Send(PID_IPV4, testData(129).data(), 129));
+    EXPECT_TRUE(alpha->link.Send(PID_IPV4, testData(128).data(), 128));
+
+    // What was learned is kept, so connecting again skips XID
+    alpha->link.Disconnect();
+    bravo->receive(alpha->transmit(0)[0], 0);
+    alpha->receive(bravo->transmit(0)[0], 0);
+    ASSERT_EQ(DataLink::Disconnected, alpha->link.GetState());
+    alpha->link.Connect();
+    EXPECT_EQ(DataLink::AwaitingConnection, alpha->link.GetState());
+}
+
+TEST(DataLinkTests, BoundsThePeersTimerAndRetries)
+{
+    // A peer asking for a T1 of 49 days and 255 retries gets no more than this end would be allowed
+    std::unique_ptr<Station> station(new Station(ALPHA, BRAVO));
+    station->receive(frameToAlpha(DataLink::CONTROL_XID | DataLink::CONTROL_POLL_FINAL, true,
+                                  { 0x82, 0x80, 0x00, 0x09, 0x09, 0x04, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0x01, 0xFF }), 0);
+    ASSERT_EQ(1U, station->transmit(0).size());
+    ASSERT_TRUE(station->link.IsNegotiated());
+    EXPECT_EQ(DataLink::MAX_ACKNOWLEDGE_MILLISECONDS, station->link.GetNegotiatedParameters().AcknowledgeMilliseconds);
+    EXPECT_EQ(DataLink::MAX_RETRIES, station->link.GetNegotiatedParameters().MaxRetries);
+
+    // Values within the bounds are taken as they are, when they are longer than this end's
+    station.reset(new Station(ALPHA, BRAVO));
+    station->receive(frameToAlpha(DataLink::CONTROL_XID | DataLink::CONTROL_POLL_FINAL, true,
+                                  { 0x82, 0x80, 0x00, 0x07, 0x09, 0x02, 0x4E, 0x20, 0x0A, 0x01, 0x14 }), 0);
+    ASSERT_EQ(1U, station->transmit(0).size());
+    EXPECT_EQ(20000U, station->link.GetNegotiatedParameters().AcknowledgeMilliseconds);
+    EXPECT_EQ(20U, station->link.GetNegotiatedParameters().MaxRetries);
+}
+
+TEST(DataLinkTests, NegotiatesExtendedOperationWithACapablePeer)
+{
+    DataLinkParameters values = extendedParameters(16, true);
+    values.Negotiate = true;
+    std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+    std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+    ASSERT_TRUE(alpha->link.SetParameters(values));
+    ASSERT_TRUE(bravo->link.SetParameters(values));
+    // XID and its answer, then SABME and UA
+    alpha->link.Connect();
+    for (ULONG turn = 0; turn < 2; turn++)
+    {
+        for (const std::vector<BYTE>& frame : alpha->transmit(0))
+        {
+            bravo->receive(frame, 0);
+        }
+        for (const std::vector<BYTE>& frame : bravo->transmit(0))
+        {
+            alpha->receive(frame, 0);
+        }
+    }
+    EXPECT_EQ(DataLink::Connected, alpha->link.GetState());
+    EXPECT_EQ(DataLink::EXTENDED_MODULUS, alpha->link.GetModulus());
+    EXPECT_EQ(DataLink::EXTENDED_MODULUS, bravo->link.GetModulus());
+    EXPECT_TRUE(alpha->link.GetNegotiatedParameters().SelectiveReject);
+    EXPECT_EQ(16U, alpha->link.GetNegotiatedParameters().WindowSize);
+}
+
+TEST(DataLinkTests, FallsBackToLegacyParametersWithoutXid)
+{
+    DataLinkParameters values = extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, true);
+    values.MaxInformationLength = DataLink::MAX_INFORMATION_LENGTH;
+    values.Negotiate = true;
+
+    // A peer which refuses XID with FRMR or DM, and one which ignores it until T1 expires
+    for (ULONG answer = 0; answer < 3; answer++)
+    {
+        std::unique_ptr<Station> station(new Station(ALPHA, BRAVO));
+        ASSERT_TRUE(station->link.SetParameters(values));
+        station->link.Connect();
+        ASSERT_EQ(1U, station->transmit(0).size());
+        if (answer == 0)
+        {
+            station->receive(frameToAlpha(DataLink::CONTROL_FRMR | DataLink::CONTROL_POLL_FINAL, false, { 0xAF, 0, 0 }), 0);
+        }
+        else if (answer == 1)
+        {
+            station->receive(frameToAlpha(DataLink::CONTROL_DM | DataLink::CONTROL_POLL_FINAL, false), 0);
+        }
+        else
+        {
+            station->link.OnTimer(station->link.GetNextTimeout());
+        }
+
+        const std::vector<std::vector<BYTE>> frames = station->transmit(0);
+        ASSERT_EQ(1U, frames.size());
+        EXPECT_EQ(DataLink::CONTROL_SABM | DataLink::CONTROL_POLL_FINAL, controlOf(frames[0]));
+        const DataLinkParameters& negotiated = station->link.GetNegotiatedParameters();
+        EXPECT_EQ(DataLink::LEGACY_INFORMATION_LENGTH, negotiated.MaxInformationLength);
+        EXPECT_EQ(DataLink::MAX_WINDOW_SIZE, negotiated.WindowSize);
+        EXPECT_EQ(DataLink::MODULUS, negotiated.Modulus);
+        EXPECT_FALSE(negotiated.SelectiveReject);
+        EXPECT_EQ(values.AcknowledgeMilliseconds, negotiated.AcknowledgeMilliseconds);
+    }
+}
+
+TEST(DataLinkTests, DeliversEverythingInOrderOverALossyChannel)
+{
+    const DataLinkParameters configurations[] = {
+        parameters(DataLink::MAX_WINDOW_SIZE),
+        extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, false),
+        extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, true)
+    };
+
+    for (const DataLinkParameters& values : configurations)
+    {
+        for (ULONG lossPerThousand : { 0UL, 50UL, 200UL })
+        {
+            std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+            std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+            ASSERT_TRUE(alpha->link.SetParameters(values));
+            ASSERT_TRUE(bravo->link.SetParameters(values));
+
+            const std::vector<BYTE> data = testData(20000);
+            SimulatedChannel channel(lossPerThousand, 12345);
+            EXPECT_NE(0U, channel.transfer(*alpha, *bravo, data, 24ULL * 3600 * 1000));
+            EXPECT_EQ(data.size(), bravo->delivered.size());
+            EXPECT_TRUE(data == bravo->delivered);
+            EXPECT_EQ(DataLink::Connected, alpha->link.GetState());
+            EXPECT_EQ(values.Modulus, alpha->link.GetModulus());
+        }
+    }
+}
+
+TEST(DataLinkTests, Goodput)
+{
+    // A window of 1 is stop-and-wait: the channel turns around for every frame
+    for (ULONG lossPerThousand : { 0UL, 50UL })
+    {
+        const ULONG windowSizes[] = { 1, 4, DataLink::MAX_WINDOW_SIZE };
+        double goodput[DataLink::MAX_WINDOW_SIZE + 1] = {};
+        for (ULONG windowSize : windowSizes)
+        {
+            std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+            std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+            ASSERT_TRUE(alpha->link.SetParameters(parameters(windowSize)));
+            ASSERT_TRUE(bravo->link.SetParameters(parameters(windowSize)));
+
+            const std::vector<BYTE> data = testData(64 * 1024);
+            SimulatedChannel channel(lossPerThousand, 777);
+            const ULONG64 milliseconds = channel.transfer(*alpha, *bravo, data, 24ULL * 3600 * 1000);
+            ASSERT_NE(0U, milliseconds);
+            ASSERT_TRUE(data == bravo->delivered);
+
+            goodput[windowSize] = 8000.0 * data.size() / milliseconds;
+            RecordProperty("BitsPerSecondWindow" + std::to_string(windowSize) + "Loss" + std::to_string(lossPerThousand / 10) + "Percent",
+                           static_cast<int>(goodput[windowSize]));
+        }
+
+        // Under loss, go-back-N throws away the rest of a window behind every lost frame, so a larger window
+        // only has to beat stop-and-wait
+        EXPECT_GT(goodput[4], goodput[1]);
+        EXPECT_GT(goodput[DataLink::MAX_WINDOW_SIZE], goodput[1]);
+        if (lossPerThousand == 0)
+        {
+            EXPECT_GT(goodput[DataLink::MAX_WINDOW_SIZE], goodput[4]);
+        }
+    }
+}
+
+TEST(DataLinkTests, SelectiveRejectGoodput)
+{
+    // With a window of 32 frames, going back N resends most of a window behind every lost frame. T1 has to
+    // cover the whole window, though, so a lost frame at the end of one still costs a long wait, and under
+    // loss the modulo-8 window is only there for reference.
+    struct
+    {
+        const char* name;
+        DataLinkParameters values;
+    } const configurations[] = {
+        { "Modulo8Reject", parameters(DataLink::MAX_WINDOW_SIZE) },
+        { "Modulo128Reject", extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, false) },
+        { "Modulo128SelectiveReject", extendedParameters(DataLink::MAX_EXTENDED_WINDOW_SIZE, true) }
+    };
+
+    for (ULONG lossPerThousand : { 0UL, 50UL, 100UL })
+    {
+        double goodput[3] = {};
+        ULONG64 resent[3] = {};
+        for (ULONG i = 0; i < 3; i++)
+        {
+            std::unique_ptr<Station> alpha(new Station(ALPHA, BRAVO));
+            std::unique_ptr<Station> bravo(new Station(BRAVO, ALPHA));
+            ASSERT_TRUE(alpha->link.SetParameters(configurations[i].values));
+            ASSERT_TRUE(bravo->link.SetParameters(configurations[i].values));
+
+            const std::vector<BYTE> data = testData(64 * 1024);
+            SimulatedChannel channel(lossPerThousand, 777);
+            const ULONG64 milliseconds = channel.transfer(*alpha, *bravo, data, 24ULL * 3600 * 1000);
+            ASSERT_NE(0U, milliseconds);
+            ASSERT_TRUE(data == bravo->delivered);
+
+            goodput[i] = 8000.0 * data.size() / milliseconds;
+            resent[i] = alpha->link.GetCounters().informationFramesResent;
+            const std::string suffix = std::string(configurations[i].name) + "Loss" + std::to_string(lossPerThousand / 10) + "Percent";
+            RecordProperty("BitsPerSecond" + suffix, static_cast<int>(goodput[i]));
+            RecordProperty("FramesResent" + suffix, static_cast<int>(resent[i]));
+        }
+
+        if (lossPerThousand == 0)
+        {
+            EXPECT_GT(goodput[1], goodput[0]);
+            EXPECT_EQ(0U, resent[2]);
+        }
+        else
+        {
+            EXPECT_GT(goodput[2], goodput[1]);
+            EXPECT_LT(resent[2], resent[1]);
+        }
+    }
+}
+
+TEST(DataLinkTableTests, OpensOneLinkPerPeer)
+{
+    std::vector<BYTE> memory(2 * sizeof(DataLink) + 16);
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = memory.data();
+    DataLinkTable table;
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, table.Allocate(reinterpret_cast<NDIS_HANDLE>(1), 2));
+    EXPECT_EQ(2 * sizeof(DataLink), KernelMockData::NdisAllocateMemoryWithTagPriority_Arguments.Length);
+
+    AX25AddressField path;
+    path.Source = ALPHA;
+    path.Destination = BRAVO;
+    DataLink* bravo = table.Open(path);
+    ASSERT_NE(nullptr, bravo);
+    EXPECT_EQ(bravo, table.Open(path));
+    EXPECT_EQ(bravo, table.Find(BRAVO));
+    EXPECT_EQ(nullptr, table.Find(AX25Address("N0CALL", 3)));
+
+    // Both links are busy, so a third peer has to wait
+    ASSERT_TRUE(bravo->Send(PID_IPV4, testData(4).data(), 4));
+    path.Destination = AX25Address("N0CALL", 3);
+    DataLink* charlie = table.Open(path);
+    ASSERT_NE(nullptr, charlie);
+    charlie->Connect();
+    path.Destination = AX25Address("N0CALL", 4);
+    EXPECT_EQ(nullptr, table.Open(path));
+    EXPECT_EQ(2U, table.GetCount());
+
+    // Once a link is down and idle, it is reused
+    AX25AddressField charliePath = path;
+    charliePath.Destination = AX25Address("N0CALL", 3);
+    charlie->Open(charliePath);
+    DataLink* delta = table.Open(path);
+    EXPECT_EQ(charlie, delta);
+    EXPECT_EQ(AX25Address("N0CALL", 4), table[1].GetPeer());
+
+    KernelMockData::NdisFreeMemoryWithTagPriority_CallCount = 0;
+    table.Free();
+    EXPECT_EQ(1, KernelMockData::NdisFreeMemoryWithTagPriority_CallCount);
+}
@@ -0,0 +1,212 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file FrameEncoderTests.cpp
+ * Unit tests and benchmark for the Virtual AX.25 NDIS Driver FrameEncoder class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "FrameEncoder.h"
+
+#include <chrono>
+#include <vector>
+
+class FrameEncoderFixture : public testing::Test
+{
+protected:
+    FrameEncoderFixture() :
+        netBuffer{}
+    {
+        for (size_t i = 0; i < sizeof(data); i++)
+        {
+            data[i] = static_cast<BYTE>(i);
+        }
+    }
+
+    /**
+     * Sets up netBuffer to describe the data array split into MDLs of the specified sizes
+     */
+    void buildChain(std::vector<ULONG> const& mdlSizes, ULONG mdlOffset, ULONG dataLength)
+    {
+        mdls.assign(mdlSizes.size(), MDL{});
+        ULONG offset = 0;
+        for (size_t i = 0; i < mdlSizes.size(); i++)
+        {
+            mdls[i].MappedSystemVa = data + offset;
+            mdls[i].ByteCount = mdlSizes[i];
+            mdls[i].Next = (i + 1 < mdlSizes.size()) ? &mdls[i + 1] : nullptr;
+            offset += mdlSizes[i];
+        }
+
+        netBuffer.CurrentMdl = &mdls[0];
+        netBuffer.CurrentMdlOffset = mdlOffset;
+        netBuffer.DataLength = dataLength;
+    }
+
+    BYTE data[2048];
+    std::vector<MDL> mdls;
+    NET_BUFFER netBuffer;
+    FrameGatherList frame;
+};
+
+TEST_F(FrameEncoderFixture, SingleMdlIsNotCopied)
+{
+    buildChain({ 100 }, 0, 100);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+    ASSERT_EQ(1u, frame.GetFragmentCount());
+    EXPECT_EQ(data, frame[0].Data);
+    EXPECT_EQ(100u, frame[0].Length);
+    EXPECT_EQ(100u, frame.GetTotalLength());
+}
+
+TEST_F(FrameEncoderFixture, HeaderPayloadAndTrailer)
+{
+    const BYTE header[] = { 0xA0, 0xA1, 0xA2 };
+    const BYTE trailer[] = { 0xB0, 0xB1 };
+
+    // MDL offset of 10, then skip a 14-byte header which straddles the first MDL boundary
+    buildChain({ 20, 30, 50 }, 10, 80);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 14, header, sizeof(header), trailer, sizeof(trailer), frame));
+    ASSERT_EQ(4u, frame.GetFragmentCount());
+    EXPECT_EQ(header, frame[0].Data);
+    EXPECT_EQ(data + 24, frame[1].Data);    // 10 + 14 bytes in, which is inside the second MDL
+    EXPECT_EQ(26u, frame[1].Length);
+    EXPECT_EQ(data + 50, frame[2].Data);
+    EXPECT_EQ(40u, frame[2].Length);        // Data length ends before the end of the last MDL
+    EXPECT_EQ(trailer, frame[3].Data);
+    EXPECT_EQ(sizeof(header) + 66 + sizeof(trailer), frame.GetTotalLength());
+
+    // Flattening produces the same bytes in order
+    BYTE flat[128];
+    ASSERT_EQ(frame.GetTotalLength(), frame.CopyTo(flat, sizeof(flat)));
+    EXPECT_EQ(0, memcmp(flat, header, sizeof(header)));
+    EXPECT_EQ(0, memcmp(flat + sizeof(header), data + 24, 66));
+    EXPECT_EQ(0, memcmp(flat + sizeof(header) + 66, trailer, sizeof(trailer)));
+}
+
+TEST_F(FrameEncoderFixture, CopyToRejectsSmallBuffer)
+{
+    buildChain({ 100 }, 0, 100);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+    BYTE flat[99];
+    EXPECT_EQ(0u, frame.CopyTo(flat, sizeof(flat)));
+}
+
+TEST_F(FrameEncoderFixture, TooManyFragments)
+{
+    buildChain(std::vector<ULONG>(FrameGatherList::MAX_FRAGMENTS + 1, 8), 0, 8 * (FrameGatherList::MAX_FRAGMENTS + 1));
+    EXPECT_EQ(NDIS_STATUS_BUFFER_OVERFLOW, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+}
+
+TEST_F(FrameEncoderFixture, MalformedNetBuffer)
+{
+    buildChain({ 20, 20 }, 0, 50);
+    EXPECT_EQ(NDIS_STATUS_INVALID_LENGTH, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+
+    buildChain({ 20 }, 0, 20);
+    EXPECT_EQ(NDIS_STATUS_INVALID_LENGTH, FrameEncoder::Encode(netBuffer, 21, nullptr, 0, nullptr, 0, frame));
+}
+
+TEST_F(FrameEncoderFixture, UnmappableMdl)
+{
+    buildChain({ 20, 20 }, 0, 40);
+    mdls[1].MappedSystemVa = nullptr;
+    EXPECT_EQ(NDIS_STATUS_RESOURCES, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+}
+
+TEST_F(FrameEncoderFixture, AppendFrameCheckSequence)
+{
+    const BYTE header[] = { 0xA0, 0xA1, 0xA2 };
+    BYTE fcs[Crc16::FCS_LENGTH];
+    buildChain({ 20, 30, 50 }, 0, 100);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 14, header, sizeof(header), nullptr, 0, frame));
+    ASSERT_TRUE(FrameEncoder::AppendFrameCheckSequence(frame, fcs));
+    ASSERT_EQ(5u, frame.GetFragmentCount());
+    EXPECT_EQ(fcs, frame[4].Data);
+
+    // The flattened frame, FCS included, passes the receive check
+    BYTE flat[128];
+    const ULONG length = frame.CopyTo(flat, sizeof(flat));
+    ASSERT_EQ(sizeof(header) + 86 + Crc16::FCS_LENGTH, length);
+    EXPECT_TRUE(Crc16::IsValid(flat, length));
+
+    // A frame with no room left for the FCS is reported so the caller can flatten it
+    buildChain(std::vector<ULONG>(FrameGatherList::MAX_FRAGMENTS, 8), 0, 8 * FrameGatherList::MAX_FRAGMENTS);
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 0, nullptr, 0, nullptr, 0, frame));
+    EXPECT_FALSE(FrameEncoder::AppendFrameCheckSequence(frame, fcs));
+}
+
+/**
+ * Compares the gather path against flattening every frame into a contiguous buffer, as the adapter
+ * did before it had a gather list. Frames are 512 bytes spread over four MDLs, as the TCP/IP stack
+ * typically produces with separate header and payload buffers.
+ */
+TEST_F(FrameEncoderFixture, GatherVersusFlattenBenchmark)
+{
+    constexpr int iterations = 200000;
+    const BYTE header[16] = {};
+    BYTE outboundBuffer[600];
+    buildChain({ 14, 40, 200, 258 }, 0, 512);
+
+    ULONG64 checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 14, header, sizeof(header), nullptr, 0, frame));
+        checksum += frame.GetTotalLength();
+    }
+    auto gatherTime = std::chrono::high_resolution_clock::now() - start;
+
+    // Every frame is encoded the same way, so the last one shows how much each frame copied: any fragment
+    // which refers to neither the caller's header nor the MDLs in place must have been copied somewhere
+    ULONG64 gatherBytesCopied = 0;
+    for (ULONG i = 0; i < frame.GetFragmentCount(); i++)
+    {
+        const BYTE* fragment = frame[i].Data;
+        const bool inPlace = (fragment >= data && fragment < data + sizeof(data)) ||
+                             (fragment >= header && fragment < header + sizeof(header));
+        if (!inPlace)
+        {
+            gatherBytesCopied += frame[i].Length;
+        }
+    }
+
+    ULONG64 bytesCopied = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        ASSERT_EQ(NDIS_STATUS_SUCCESS, FrameEncoder::Encode(netBuffer, 14, header, sizeof(header), nullptr, 0, frame));
+        ULONG copied = frame.CopyTo(outboundBuffer, sizeof(outboundBuffer));
+        ASSERT_NE(0u, copied);
+        bytesCopied += copied;
+        checksum += outboundBuffer[i % copied];
+    }
+    auto flattenTime = std::chrono::high_resolution_clock::now() - start;
+
+    const double frameBytes = static_cast<double>(frame.GetTotalLength());
+    const double gatherSeconds = std::chrono::duration<double>(gatherTime).count();
+    const double flattenSeconds = std::chrono::duration<double>(flattenTime).count();
+    RecordProperty("FrameBytes", static_cast<int>(frameBytes));
+    RecordProperty("GatherMegabytesPerSecond", static_cast<int>(frameBytes * iterations / gatherSeconds / 1e6));
+    RecordProperty("FlattenMegabytesPerSecond", static_cast<int>(frameBytes * iterations / flattenSeconds / 1e6));
+    RecordProperty("GatherCopiesPerFrame", static_cast<int>(gatherBytesCopied / frameBytes));
+    RecordProperty("FlattenCopiesPerFrame", static_cast<int>(bytesCopied / (frameBytes * iterations)));
+    EXPECT_EQ(0u, gatherBytesCopied);
+    EXPECT_NE(0u, checksum);
+}
@@ -0,0 +1,303 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file G3ruhModemTests.cpp
+ * Unit tests and benchmarks for the Virtual AX.25 NDIS Driver G3ruhScrambler, G3ruhDescrambler and
+ * G3ruhDemodulator classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "G3ruhModem.h"
+#include "HdlcCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    class CollectingHandler : public HdlcFrameHandler
+    {
+    public:
+        void HdlcFrameDecoded(const BYTE* frame, ULONG length) noexcept override
+        {
+            frames.push_back(std::vector<BYTE>(frame, frame + length));
+        }
+
+        std::vector<std::vector<BYTE>> frames;
+    };
+
+    /** The scrambler as the G3RUH design describes it, one bit at a time through a shift register */
+    std::vector<BYTE> referenceScramble(std::vector<BYTE> const& data, bool descramble)
+    {
+        std::vector<BYTE> output(data.size());
+        ULONG shiftRegister = 0;        // Bit 0 is the most recent bit on the line
+        for (size_t bit = 0; bit < data.size() * 8; bit++)
+        {
+            const ULONG in = (data[bit / 8] >> (bit % 8)) & 1;
+            const ULONG out = in ^ ((shiftRegister >> 11) & 1) ^ ((shiftRegister >> 16) & 1);
+            shiftRegister = (shiftRegister << 1) | (descramble ? in : out);
+            output[bit / 8] |= static_cast<BYTE>(out << (bit % 8));
+        }
+        return output;
+    }
+
+    std::vector<BYTE> randomBytes(size_t count, std::mt19937& random)
+    {
+        std::vector<BYTE> data(count);
+        for (BYTE& value : data)
+        {
+            value = static_cast<BYTE>(random());
+        }
+        return data;
+    }
+
+    /**
+     * Baseband FSK modulator, standing in for a G3RUH transmitter and an FM receiver's discriminator. The
+     * square pulses are rounded by a low-pass filter, and the receiver adds a DC offset and white noise.
+     * @param levels the scrambled line levels to send, least significant bit first
+     * @param sampleRate samples per second
+     * @param baudRate the sender's bit rate, which can be a little off 9600
+     * @param noise the standard deviation of the noise, relative to the signal's amplitude
+     * @param random the noise source
+     */
+    std::vector<SHORT> modulate(std::vector<BYTE> const& levels, ULONG sampleRate, double baudRate, double noise, std::mt19937& random)
+    {
+        constexpr double amplitude = 8000.0;
+        constexpr double offset = 1500.0;
+        const double pi = 3.14159265358979323846;
+        const double smoothing = 1 - std::exp(-2 * pi * 6000 / sampleRate);
+        std::normal_distribution<double> distribution(0.0, noise * amplitude);
+        std::vector<SHORT> samples;
+        double filtered = 0;
+        double time = 0;
+        const double bitTime = 1.0 / baudRate;
+        for (size_t bit = 0; bit < levels.size() * 8; bit++)
+        {
+            const double target = ((levels[bit / 8] >> (bit % 8)) & 1) != 0 ? amplitude : -amplitude;
+            for (; time < bitTime; time += 1.0 / sampleRate)
+            {
+                filtered += (target - filtered) * smoothing;
+                const double value = filtered + offset + distribution(random);
+                samples.push_back(static_cast<SHORT>(std::max(-32768.0, std::min(32767.0, value))));
+            }
+            time -= bitTime;
+        }
+        return samples;
+    }
+
+    std::vector<std::vector<BYTE>> randomFrames(int count, std::mt19937& random)
+    {
+        std::vector<std::vector<BYTE>> frames;
+        for (int i = 0; i < count; i++)
+        {
+            frames.push_back(randomBytes(20 + random() % 300, random));
+        }
+        return frames;
+    }
+
+    /**
+     * Encodes and scrambles frames as a transmitter would, each after a TXDELAY of flags. The carrier is held
+     * afterwards (TXTAIL) for long enough that the receiver's last word of bits is complete.
+     */
+    std::vector<BYTE> encodeTransmission(std::vector<std::vector<BYTE>> const& frames)
+    {
+        constexpr ULONG TXDELAY_FLAGS = 32;
+        HdlcEncoder encoder;
+        std::vector<BYTE> levels;
+        for (auto const& frame : frames)
+        {
+            FrameGatherList list;
+            EXPECT_TRUE(list.Append(frame.data(), static_cast<ULONG>(frame.size())));
+            std::vector<BYTE> output(HdlcEncoder::GetMaximumEncodedLength(static_cast<ULONG>(frame.size()), TXDELAY_FLAGS));
+            const ULONG length = encoder.EncodeFrame(list, TXDELAY_FLAGS, output.data(), static_cast<ULONG>(output.size()));
+            levels.insert(levels.end(), output.begin(), output.begin() + length);
+        }
+
+        BYTE last;
+        if (encoder.Flush(&last, 1) != 0)
+        {
+            levels.push_back(last);
+        }
+        levels.insert(levels.end(), 8, (levels.back() & 0x80) != 0 ? 0xFF : 0x00);
+
+        G3ruhScrambler scrambler;
+        scrambler.Scramble(levels.data(), static_cast<ULONG>(levels.size()));
+        return levels;
+    }
+
+    /** Runs audio through a demodulator and an HDLC decoder in blocks, as a sound driver delivers them */
+    void decode(std::vector<SHORT> const& samples, ULONG blockSamples, G3ruhDemodulator& demodulator, HdlcDecoder& decoder, CollectingHandler& handler)
+    {
+        std::vector<BYTE> levels(demodulator.GetMaximumOutputLength(blockSamples));
+        for (size_t offset = 0; offset < samples.size(); offset += blockSamples)
+        {
+            const ULONG count = static_cast<ULONG>(std::min<size_t>(blockSamples, samples.size() - offset));
+            const ULONG length = demodulator.Demodulate(samples.data() + offset, count, levels.data(), static_cast<ULONG>(levels.size()));
+            decoder.Decode(levels.data(), length, handler);
+        }
+    }
+}
+
+// The word at a time scrambler and descrambler must match the bit at a time shift register, whatever the
+// buffers are split into
+TEST(G3ruhModem, ScramblerMatchesReference)
+{
+    std::mt19937 random(31);
+    const std::vector<BYTE> data = randomBytes(1001, random);
+    const std::vector<BYTE> expected = referenceScramble(data, false);
+
+    for (ULONG split : { 1u, 3u, 4u, 7u, 64u, 1001u })
+    {
+        std::vector<BYTE> scrambled = data;
+        G3ruhScrambler scrambler;
+        for (ULONG offset = 0; offset < scrambled.size(); offset += split)
+        {
+            scrambler.Scramble(scrambled.data() + offset, std::min<ULONG>(split, static_cast<ULONG>(scrambled.size()) - offset));
+        }
+        EXPECT_EQ(expected, scrambled) << "split every " << split << " bytes";
+        EXPECT_EQ(referenceScramble(expected, true), data);
+
+        G3ruhDescrambler descrambler;
+        for (ULONG offset = 0; offset < scrambled.size(); offset += split)
+        {
+            descrambler.Descramble(scrambled.data() + offset, std::min<ULONG>(split, static_cast<ULONG>(scrambled.size()) - offset));
+        }
+        EXPECT_EQ(data, scrambled) << "split every " << split << " bytes";
+    }
+
+    // Odd bit counts go through the same chunks
+    G3ruhScrambler scrambler;
+    G3ruhDescrambler descrambler;
+    ULONG bits = 0x1234567;
+    for (ULONG count = 1; count <= 32; count++)
+    {
+        const ULONG mask = count == 32 ? 0xFFFFFFFF : (1UL << count) - 1;
+        EXPECT_EQ(bits & mask, descrambler.Descramble(scrambler.Scramble(bits, count), count)) << count << " bits";
+        bits = bits * 1103515245 + 12345;
+    }
+}
+
+// The descrambler must lock onto a stream it joins part way through within one register length
+TEST(G3ruhModem, DescramblerSynchronizesItself)
+{
+    std::mt19937 random(32);
+    const std::vector<BYTE> data = randomBytes(64, random);
+    std::vector<BYTE> scrambled = data;
+    G3ruhScrambler scrambler;
+    scrambler.Scramble(scrambled.data(), 16);           // Warm up the register so it is not empty
+    scrambled = data;
+    scrambler.Scramble(scrambled.data(), static_cast<ULONG>(scrambled.size()));
+
+    G3ruhDescrambler descrambler;
+    descrambler.Descramble(scrambled.data(), static_cast<ULONG>(scrambled.size()));
+    EXPECT_TRUE(std::equal(data.begin() + 3, data.end(), scrambled.begin() + 3));
+}
+
+TEST(G3ruhModem, SampleRateIsRangeChecked)
+{
+    G3ruhDemodulator demodulator;
+    EXPECT_EQ(48000u, demodulator.GetSampleRate());
+    EXPECT_FALSE(demodulator.SetSampleRate(G3ruhDemodulator::MIN_SAMPLE_RATE - 1));
+    EXPECT_FALSE(demodulator.SetSampleRate(G3ruhDemodulator::MAX_SAMPLE_RATE + 1));
+    EXPECT_TRUE(demodulator.SetSampleRate(96000));
+    EXPECT_EQ(96000u, demodulator.GetSampleRate());
+}
+
+// Every frame must survive the round trip through audio with noise, a DC offset and a sender whose clock is
+// 0.1% fast
+TEST(G3ruhModem, DecodesFramesFromAudio)
+{
+    std::mt19937 random(33);
+    const std::vector<std::vector<BYTE>> frames = randomFrames(20, random);
+    const std::vector<BYTE> levels = encodeTransmission(frames);
+    for (ULONG sampleRate : { 44100u, 48000u, 96000u, 192000u })
+    {
+        const std::vector<SHORT> samples = modulate(levels, sampleRate, 9610, 0.15 * std::sqrt(sampleRate / 48000.0), random);
+        G3ruhDemodulator demodulator;
+        ASSERT_TRUE(demodulator.SetSampleRate(sampleRate));
+        HdlcDecoder decoder;
+        CollectingHandler handler;
+        decode(samples, 480, demodulator, decoder, handler);
+        EXPECT_EQ(frames.size(), handler.frames.size()) << sampleRate << " samples per second";
+        EXPECT_TRUE(frames == handler.frames) << sampleRate << " samples per second";
+    }
+}
+
+/**
+ * Measures the scrambler against the bit at a time shift register, and how many times faster than real
+ * time one processor demodulates 9600 baud audio, from sample to decoded frame
+ */
+TEST(G3ruhModem, Benchmark)
+{
+    std::mt19937 random(34);
+    constexpr int passes = 20;
+    std::vector<BYTE> data = randomBytes(1 << 20, random);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        data = referenceScramble(data, pass % 2 != 0);
+    }
+    const double bitwiseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    const std::vector<BYTE> original = data;
+    G3ruhScrambler scrambler;
+    G3ruhDescrambler descrambler;
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes / 2; pass++)
+    {
+        scrambler.Scramble(data.data(), static_cast<ULONG>(data.size()));
+        descrambler.Descramble(data.data(), static_cast<ULONG>(data.size()));
+    }
+    const double wordSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(original, data);
+
+    const double megabits = 8.0 * data.size() * passes / 1e6;
+    RecordProperty("BitwiseScramblerMegabitsPerSecond", static_cast<int>(megabits / bitwiseSeconds));
+    RecordProperty("WordScramblerMegabitsPerSecond", static_cast<int>(megabits / wordSeconds));
+
+    const std::vector<std::vector<BYTE>> frames = randomFrames(100, random);
+    const std::vector<BYTE> levels = encodeTransmission(frames);
+    for (ULONG sampleRate : { 48000u, 96000u })
+    {
+        const std::vector<SHORT> samples = modulate(levels, sampleRate, 9600, 0.1, random);
+        constexpr int demodulatorPasses = 5;
+        G3ruhDemodulator demodulator;
+        ASSERT_TRUE(demodulator.SetSampleRate(sampleRate));
+        HdlcDecoder decoder;
+        CollectingHandler handler;
+        start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < demodulatorPasses; pass++)
+        {
+            handler.frames.clear();
+            demodulator.Reset();
+            decoder.Reset();
+            decode(samples, 960, demodulator, decoder, handler);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        ASSERT_TRUE(frames == handler.frames);
+
+        const double audioSeconds = static_cast<double>(samples.size()) * demodulatorPasses / sampleRate;
+        RecordProperty("TimesRealTimeAt" + std::to_string(sampleRate) + "Hz", static_cast<int>(audioSeconds / seconds));
+    }
+}
@@ -0,0 +1,409 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HdlcCodecTests.cpp
+ * Unit tests and benchmark for the Virtual AX.25 NDIS Driver HdlcEncoder and HdlcDecoder classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "HdlcCodec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+    class CollectingHandler : public HdlcFrameHandler
+    {
+    public:
+        void HdlcFrameDecoded(const BYTE* frame, ULONG length) noexcept override
+        {
+            frames.push_back(std::vector<BYTE>(frame, frame + length));
+        }
+
+        std::vector<std::vector<BYTE>> frames;
+    };
+
+    std::vector<BYTE> randomFrame(size_t length, std::mt19937& random)
+    {
+        std::vector<BYTE> frame(length);
+        for (BYTE& value : frame)
+        {
+            // Plenty of 0xFF so that stuffing happens often
+            value = (random() % 4 == 0) ? 0xFF : static_cast<BYTE>(random());
+        }
+        return frame;
+    }
+
+    /** Straightforward bit at a time encoder, as the reference for HdlcEncoder */
+    class ReferenceEncoder
+    {
+    public:
+        void Flag()
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                bits.push_back((HdlcCodec::FLAG >> i) & 1);
+            }
+        }
+
+        void Frame(std::vector<BYTE> frame)
+        {
+            const USHORT fcs = Crc16::Compute(frame.data(), static_cast<ULONG>(frame.size()));
+            frame.push_back(static_cast<BYTE>(fcs));
+            frame.push_back(static_cast<BYTE>(fcs >> 8));
+            int ones = 0;
+            for (BYTE value : frame)
+            {
+                for (int i = 0; i < 8; i++)
+                {
+                    const int bit = (value >> i) & 1;
+                    bits.push_back(bit);
+                    ones = bit ? ones + 1 : 0;
+                    if (ones == 5)
+                    {
+                        bits.push_back(0);
+                        ones = 0;
+                    }
+                }
+            }
+        }
+
+        /** Raw bits, which the tests can corrupt before NRZI coding */
+        std::vector<int> bits;
+
+        std::vector<BYTE> Levels() const
+        {
+            std::vector<BYTE> levels((bits.size() + 7) / 8);
+            int level = 0;
+            for (size_t i = 0; i < bits.size(); i++)
+            {
+                level ^= bits[i] ? 0 : 1;
+                levels[i / 8] |= static_cast<BYTE>(level << (i % 8));
+            }
+
+            // Padding, as Flush() would send
+            for (size_t i = bits.size(); i < levels.size() * 8; i++)
+            {
+                level ^= 1;
+                levels[i / 8] |= static_cast<BYTE>(level << (i % 8));
+            }
+            return levels;
+        }
+    };
+
+    /** Straightforward bit at a time decoder, as the baseline for the benchmark */
+    class ReferenceDecoder
+    {
+    public:
+        ReferenceDecoder() : level(0), ones(0), inFrame(false), bitCount(0) {}
+
+        void Decode(const BYTE* levels, size_t length, CollectingHandler& handler)
+        {
+            for (size_t i = 0; i < length * 8; i++)
+            {
+                const int newLevel = (levels[i / 8] >> (i % 8)) & 1;
+                const int bit = newLevel == level ? 1 : 0;
+                level = newLevel;
+                if (bit)
+                {
+                    if (++ones > 6)
+                    {
+                        inFrame = false;
+                    }
+                    else if (ones < 6)
+                    {
+                        append(1);
+                    }
+                    continue;
+                }
+
+                if (ones == 6)
+                {
+                    if (inFrame && bitCount > 6 && (bitCount - 6) % 8 == 0 &&
+                        Crc16::IsValid(frame.data(), static_cast<ULONG>((bitCount - 6) / 8)))
+                    {
+                        handler.HdlcFrameDecoded(frame.data(), static_cast<ULONG>((bitCount - 6) / 8 - Crc16::FCS_LENGTH));
+                    }
+                    inFrame = true;
+                    frame.clear();
+                    bitCount = 0;
+                }
+                else if (ones != 5)
+                {
+                    append(0);
+                }
+                ones = 0;
+            }
+        }
+
+    private:
+        void append(int bit)
+        {
+            if (!inFrame)
+            {
+                return;
+            }
+            if (bitCount % 8 == 0)
+            {
+                frame.push_back(0);
+            }
+            frame.back() |= static_cast<BYTE>(bit << (bitCount % 8));
+            bitCount++;
+        }
+
+        int level;
+        int ones;
+        bool inFrame;
+        size_t bitCount;
+        std::vector<BYTE> frame;
+    };
+
+    /** Encodes frames back to back with HdlcEncoder, a few flags apart, and flushes the last bits */
+    std::vector<BYTE> encodeAll(std::vector<std::vector<BYTE>> const& frames, ULONG leadingFlags)
+    {
+        HdlcEncoder encoder;
+        std::vector<BYTE> stream;
+        for (auto const& frame : frames)
+        {
+            FrameGatherList list;
+            EXPECT_TRUE(list.Append(frame.data(), static_cast<ULONG>(frame.size())));
+            std::vector<BYTE> output(HdlcEncoder::GetMaximumEncodedLength(static_cast<ULONG>(frame.size()), leadingFlags));
+            const ULONG length = encoder.EncodeFrame(list, leadingFlags, output.data(), static_cast<ULONG>(output.size()));
+            EXPECT_NE(0u, length);
+            stream.insert(stream.end(), output.begin(), output.begin() + length);
+        }
+
+        BYTE last;
+        if (encoder.Flush(&last, 1) != 0)
+        {
+            stream.push_back(last);
+        }
+        return stream;
+    }
+}
+
+TEST(HdlcCodec, NrziRoundTrip)
+{
+    // All 1s hold the line level; all 0s toggle it on every bit
+    ULONG level = 0;
+    EXPECT_EQ(0x00, HdlcCodec::EncodeNrzi(0xFF, level));
+    EXPECT_EQ(0u, level);
+    EXPECT_EQ(0x55, HdlcCodec::EncodeNrzi(0x00, level));
+    EXPECT_EQ(0u, level);
+    level = 1;
+    EXPECT_EQ(0xAA, HdlcCodec::EncodeNrzi(0x00, level));
+
+    ULONG encodeLevel = 0;
+    ULONG decodeLevel = 0;
+    for (int value = 0; value < 512; value++)
+    {
+        const BYTE bits = static_cast<BYTE>(value * 37);
+        ASSERT_EQ(bits, HdlcCodec::DecodeNrzi(HdlcCodec::EncodeNrzi(bits, encodeLevel), decodeLevel));
+    }
+}
+
+TEST(HdlcCodec, EncoderMatchesReference)
+{
+    std::mt19937 random(15);
+    std::vector<std::vector<BYTE>> frames;
+    ReferenceEncoder reference;
+    for (int i = 0; i < 50; i++)
+    {
+        frames.push_back(randomFrame(random() % 300, random));
+        for (int flag = 0; flag < 2; flag++)
+        {
+            reference.Flag();
+        }
+        reference.Frame(frames.back());
+        reference.Flag();
+    }
+
+    ASSERT_EQ(reference.Levels(), encodeAll(frames, 2));
+}
+
+// Frames must come out the same however the line levels are split between calls, including with the
+// closing flag of one frame shared as the opening flag of the next
+TEST(HdlcCodec, RoundTripEveryChunkSize)
+{
+    std::mt19937 random(16);
+    std::vector<std::vector<BYTE>> frames;
+    for (int i = 0; i < 20; i++)
+    {
+        frames.push_back(randomFrame(1 + random() % 200, random));
+    }
+
+    for (ULONG leadingFlags : { 1u, 3u })
+    {
+        std::vector<BYTE> stream = encodeAll(frames, leadingFlags);
+        for (size_t chunk = 1; chunk <= 17; chunk++)
+        {
+            HdlcDecoder decoder;
+            CollectingHandler handler;
+            for (size_t offset = 0; offset < stream.size(); offset += chunk)
+            {
+                decoder.Decode(stream.data() + offset, static_cast<ULONG>(std::min(chunk, stream.size() - offset)), handler);
+            }
+            ASSERT_EQ(frames, handler.frames) << "chunk " << chunk << ", flags " << leadingFlags;
+            EXPECT_EQ(0u, decoder.GetFcsErrorCount());
+            EXPECT_EQ(0u, decoder.GetDiscardedFrameCount());
+        }
+    }
+}
+
+TEST(HdlcCodec, CorruptedFrameFailsFcs)
+{
+    std::mt19937 random(17);
+    std::vector<BYTE> frame = randomFrame(100, random);
+    ReferenceEncoder reference;
+    reference.Flag();
+    reference.Frame(frame);
+    reference.Flag();
+    reference.Frame(frame);
+    reference.Flag();
+
+    // Swap two data bits of the first frame which differ, so that its length and stuffing stay the same
+    size_t first = 20;
+    size_t second = first + 1;
+    while (reference.bits[first] == reference.bits[second])
+    {
+        second++;
+    }
+    std::swap(reference.bits[first], reference.bits[second]);
+
+    HdlcDecoder decoder;
+    CollectingHandler handler;
+    std::vector<BYTE> levels = reference.Levels();
+    decoder.Decode(levels.data(), static_cast<ULONG>(levels.size()), handler);
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(frame, handler.frames[0]);
+    EXPECT_EQ(1u, decoder.GetFcsErrorCount());
+    EXPECT_EQ(1u, decoder.GetFrameCount());
+}
+
+TEST(HdlcCodec, AbortDiscardsFrame)
+{
+    std::mt19937 random(18);
+    std::vector<BYTE> frame = randomFrame(40, random);
+    ReferenceEncoder reference;
+    reference.Flag();
+    reference.Frame(frame);
+    for (int i = 0; i < 7; i++)
+    {
+        reference.bits.push_back(1);
+    }
+
+    // Anything up to the next flag is ignored
+    reference.Frame(frame);
+    reference.Flag();
+    reference.Frame(frame);
+    reference.Flag();
+
+    HdlcDecoder decoder;
+    CollectingHandler handler;
+    std::vector<BYTE> levels = reference.Levels();
+    decoder.Decode(levels.data(), static_cast<ULONG>(levels.size()), handler);
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(1u, decoder.GetDiscardedFrameCount());
+    EXPECT_EQ(0u, decoder.GetFcsErrorCount());
+}
+
+TEST(HdlcCodec, OversizedFrameIsDiscarded)
+{
+    std::mt19937 random(19);
+    std::vector<std::vector<BYTE>> frames{
+        randomFrame(HdlcDecoder::MAX_FRAME_LENGTH + 1, random),
+        randomFrame(HdlcDecoder::MAX_FRAME_LENGTH, random) };
+    std::vector<BYTE> stream = encodeAll(frames, 1);
+
+    HdlcDecoder decoder;
+    CollectingHandler handler;
+    decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(frames[1], handler.frames[0]);
+    EXPECT_EQ(1u, decoder.GetDiscardedFrameCount());
+}
+
+TEST(HdlcCodec, EncoderRejectsSmallBuffer)
+{
+    BYTE data[16] = {};
+    FrameGatherList frame;
+    ASSERT_TRUE(frame.Append(data, sizeof(data)));
+    HdlcEncoder encoder;
+    std::vector<BYTE> output(HdlcEncoder::GetMaximumEncodedLength(sizeof(data), 1) - 1);
+    EXPECT_EQ(0u, encoder.EncodeFrame(frame, 1, output.data(), static_cast<ULONG>(output.size())));
+}
+
+/**
+ * Encodes and decodes random 256-byte frames, a quarter of whose bytes are 0xFF so that stuffing is far more
+ * common than in real traffic, and compares decoding against a bit at a time decoder. The line rate each
+ * direction could sustain on one processor is reported against a 9600 baud channel.
+ */
+TEST(HdlcCodec, ThroughputBenchmark)
+{
+    std::mt19937 random(20);
+    constexpr int frameCount = 2000;
+    std::vector<std::vector<BYTE>> frames;
+    for (int i = 0; i < frameCount; i++)
+    {
+        frames.push_back(randomFrame(256, random));
+    }
+
+    constexpr int passes = 10;
+    std::vector<BYTE> stream;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        stream = encodeAll(frames, 1);
+    }
+    const double encodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    HdlcDecoder decoder;
+    CollectingHandler handler;
+    handler.frames.reserve(frameCount);
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        handler.frames.clear();
+        decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+    }
+    const double decodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(frames, handler.frames);
+
+    ReferenceDecoder reference;
+    CollectingHandler referenceHandler;
+    referenceHandler.frames.reserve(frameCount);
+    start = std::chrono::high_resolution_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        referenceHandler.frames.clear();
+        reference.Decode(stream.data(), stream.size(), referenceHandler);
+    }
+    const double referenceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(frames, referenceHandler.frames);
+
+    const double lineBits = 8.0 * stream.size() * passes;
+    RecordProperty("EncodeMegabitsPerSecond", static_cast<int>(lineBits / encodeSeconds / 1e6));
+    RecordProperty("DecodeMegabitsPerSecond", static_cast<int>(lineBits / decodeSeconds / 1e6));
+    RecordProperty("BitAtATimeDecodeMegabitsPerSecond", static_cast<int>(lineBits / referenceSeconds / 1e6));
+    RecordProperty("Decode9600BaudChannelsPerProcessor", static_cast<int>(lineBits / decodeSeconds / 9600));
+    EXPECT_LT(decodeSeconds, referenceSeconds);
+}
@@ -0,0 +1,463 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderCompressorTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver HeaderCompressor, HeaderDecompressor and HeaderCompressionTable
+ * classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "HeaderCompressor.h"
+
+#include <vector>
+
+namespace
+{
+    constexpr AX25Address ALPHA = AX25Address("KG7UDH", 1);
+    constexpr AX25Address BRAVO = AX25Address("N0CALL", 2);
+    constexpr AX25Address CHARLIE = AX25Address("N0CALL", 3);
+    constexpr BYTE PID_IPV4 = 0xCC;
+    constexpr ULONG MTU = 1500;
+    constexpr BYTE ACK = 0x10;
+    constexpr BYTE PSH = 0x08;
+    constexpr BYTE SYN = 0x02;
+    constexpr BYTE URG = 0x20;
+
+    /** The fields of a TCP segment which change over a connection */
+    struct Segment
+    {
+        ULONG sequence;
+        ULONG acknowledgement;
+        USHORT window;
+        USHORT identification;
+        BYTE flags;
+        ULONG dataLength;
+        USHORT sourcePort;
+        USHORT urgent;
+    };
+
+    void put16(std::vector<BYTE>& datagram, size_t offset, ULONG value)
+    {
+        datagram[offset] = static_cast<BYTE>(value >> 8);
+        datagram[offset + 1] = static_cast<BYTE>(value);
+    }
+
+    void put32(std::vector<BYTE>& datagram, size_t offset, ULONG value)
+    {
+        put16(datagram, offset, value >> 16);
+        put16(datagram, offset + 2, value);
+    }
+
+    /** @returns a TCP/IP datagram from 44.0.0.1 to 44.0.0.2 with a valid IP checksum */
+    std::vector<BYTE> makeDatagram(const Segment& segment, BYTE protocol = 6)
+    {
+        std::vector<BYTE> datagram(40 + segment.dataLength);
+        datagram[0] = 0x45;
+        put16(datagram, 2, static_cast<ULONG>(datagram.size()));
+        put16(datagram, 4, segment.identification);
+        datagram[6] = 0x40;     // Don't fragment
+        datagram[8] = 64;
+        datagram[9] = protocol;
+        put32(datagram, 12, 0x2C000001);
+        put32(datagram, 16, 0x2C000002);
+        ULONG sum = 0;
+        for (size_t i = 0; i < 20; i += 2)
+        {
+            sum += (datagram[i] << 8) | datagram[i + 1];
+        }
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        put16(datagram, 10, ~sum & 0xFFFF);
+
+        put16(datagram, 20, segment.sourcePort);
+        put16(datagram, 22, 23);
+        put32(datagram, 24, segment.sequence);
+        put32(datagram, 28, segment.acknowledgement);
+        datagram[32] = 0x50;
+        datagram[33] = segment.flags;
+        put16(datagram, 34, segment.window);
+        put16(datagram, 36, 0xBEEF ^ segment.sequence ^ segment.acknowledgement);  // Passed through unchecked
+        put16(datagram, 38, segment.urgent);
+        for (ULONG i = 0; i < segment.dataLength; i++)
+        {
+            datagram[40 + i] = static_cast<BYTE>(segment.sequence + i);
+        }
+        return datagram;
+    }
+
+    /** Compresses a datagram, returning what is sent */
+    std::vector<BYTE> compress(HeaderCompressor& compressor, std::vector<BYTE> datagram, BYTE& pid)
+    {
+        ULONG offset = 0;
+        pid = compressor.Compress(datagram.data(), static_cast<ULONG>(datagram.size()), offset);
+        EXPECT_LE(offset, datagram.size());
+        return std::vector<BYTE>(datagram.begin() + offset, datagram.end());
+    }
+
+    /** Restores a datagram sent by compress(), returning an empty datagram if it is dropped */
+    std::vector<BYTE> decompress(HeaderDecompressor& decompressor, BYTE pid, const std::vector<BYTE>& packet)
+    {
+        std::vector<BYTE> buffer(packet);
+        buffer.resize(MTU);
+        const ULONG length = decompressor.Decompress(pid, buffer.data(), static_cast<ULONG>(packet.size()), MTU);
+        buffer.resize(length);
+        return buffer;
+    }
+
+    /** Sends a datagram through a compressor and decompressor, and checks that it comes out unchanged */
+    ULONG roundTrip(HeaderCompressor& compressor, HeaderDecompressor& decompressor, const Segment& segment, BYTE expectedPid)
+    {
+        const std::vector<BYTE> datagram = makeDatagram(segment);
+        BYTE pid = 0;
+        const std::vector<BYTE> sent = compress(compressor, datagram, pid);
+        EXPECT_EQ(expectedPid, pid);
+        EXPECT_TRUE(datagram == decompress(decompressor, pid, sent));
+        return static_cast<ULONG>(sent.size() - segment.dataLength);
+    }
+}
+
+TEST(HeaderCompressor, BulkDataIsCompressedToThreeBytes)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment segment = { 1000, 5000, 4096, 1, ACK, 216, 1024, 0 };
+    EXPECT_EQ(40U, roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP));
+
+    // Every later segment follows on from the last, so only the change mask and checksum are sent
+    for (int i = 0; i < 10; i++)
+    {
+        segment.sequence += segment.dataLength;
+        segment.identification++;
+        EXPECT_EQ(3U, roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP));
+    }
+
+    EXPECT_EQ(10U, compressor.GetCounters().Compressed);
+    EXPECT_EQ(1U, compressor.GetCounters().Uncompressed);
+    EXPECT_EQ(370U, compressor.GetCounters().BytesSaved);
+    EXPECT_EQ(10U, decompressor.GetCounters().Decompressed);
+    EXPECT_EQ(1U, decompressor.GetCounters().Uncompressed);
+}
+
+TEST(HeaderCompressor, ChangesRoundTrip)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment segment = { 1000, 5000, 4096, 1, ACK, 0, 1024, 0 };
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+
+    // Bare acknowledgements, window changes large and small, PSH, jumps in the identification, and urgent data
+    segment.acknowledgement += 200;
+    segment.identification++;
+    EXPECT_EQ(4U, roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP));
+    segment.acknowledgement += 40000;
+    segment.window = 512;
+    segment.identification += 300;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP);
+    segment.flags = ACK | PSH;
+    segment.dataLength = 10;
+    segment.identification++;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP);
+    segment.flags = ACK | URG;
+    segment.sequence += 10;
+    segment.urgent = 5;
+    segment.identification++;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP);
+    segment.flags = ACK;
+    segment.sequence += 10;
+    segment.window = 0xFFFF;
+    segment.identification = 0;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP);
+
+    // A jump of more than 16 bits, or an urgent pointer changed without URG, can only be sent whole
+    segment.sequence += 0x10000;
+    segment.identification++;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    segment.urgent = 0;
+    segment.identification++;
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    EXPECT_EQ(0U, decompressor.GetCounters().Dropped);
+}
+
+TEST(HeaderCompressor, EchoedTrafficUsesSpecialCase)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment segment = { 1000, 5000, 4096, 1, ACK | PSH, 1, 1024, 0 };
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+
+    // A character typed, echoed and acknowledged at once moves both numbers along by the length of the last
+    for (int i = 0; i < 5; i++)
+    {
+        segment.sequence += 1;
+        segment.acknowledgement += 1;
+        segment.identification++;
+        EXPECT_EQ(3U, roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_COMPRESSED_TCP));
+    }
+}
+
+TEST(HeaderCompressor, OtherDatagramsAreSentUnchanged)
+{
+    HeaderCompressor compressor;
+    Segment segment = { 1000, 5000, 4096, 1, ACK, 20, 1024, 0 };
+    std::vector<std::vector<BYTE>> datagrams;
+    datagrams.push_back(makeDatagram(segment, 17));
+    segment.flags = SYN;
+    datagrams.push_back(makeDatagram(segment));
+    segment.flags = ACK;
+    datagrams.push_back(makeDatagram(segment));
+    datagrams.back()[6] = 0x20;     // More fragments
+    datagrams.push_back(makeDatagram(segment));
+    datagrams.back().resize(39);
+    datagrams.push_back(makeDatagram(segment));
+    datagrams.back().push_back(0);  // Longer than its total length says
+
+    for (const std::vector<BYTE>& datagram : datagrams)
+    {
+        BYTE pid = 0;
+        EXPECT_TRUE(datagram == compress(compressor, datagram, pid));
+        EXPECT_EQ(PID_IPV4, pid);
+    }
+    EXPECT_EQ(0U, compressor.GetCounters().Compressed + compressor.GetCounters().Uncompressed);
+}
+
+TEST(HeaderCompressor, ConnectionsHaveTheirOwnSlots)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment segments[HeaderCompressor::SLOT_COUNT + 1];
+    for (USHORT i = 0; i < HeaderCompressor::SLOT_COUNT + 1; i++)
+    {
+        segments[i] = { 1000U * i, 5000, 4096, i, ACK, 100, static_cast<USHORT>(1024 + i), 0 };
+    }
+
+    for (ULONG i = 0; i < HeaderCompressor::SLOT_COUNT; i++)
+    {
+        roundTrip(compressor, decompressor, segments[i], HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    }
+
+    // Switching connections names the slot, which costs a byte
+    for (ULONG i = 0; i < HeaderCompressor::SLOT_COUNT; i++)
+    {
+        segments[i].sequence += 100;
+        segments[i].identification++;
+        EXPECT_EQ(4U, roundTrip(compressor, decompressor, segments[i], HeaderCompressor::PID_COMPRESSED_TCP));
+    }
+
+    // The least recently used connection gives way to a new one, and takes over the next when it comes back
+    roundTrip(compressor, decompressor, segments[HeaderCompressor::SLOT_COUNT], HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    segments[0].sequence += 100;
+    segments[0].identification++;
+    roundTrip(compressor, decompressor, segments[0], HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    segments[2].sequence += 100;
+    segments[2].identification++;
+    EXPECT_EQ(4U, roundTrip(compressor, decompressor, segments[2], HeaderCompressor::PID_COMPRESSED_TCP));
+    segments[1].sequence += 100;
+    segments[1].identification++;
+    roundTrip(compressor, decompressor, segments[1], HeaderCompressor::PID_UNCOMPRESSED_TCP);
+}
+
+TEST(HeaderCompressor, RetransmissionResynchronizes)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment segment = { 1000, 5000, 4096, 1, ACK, 100, 1024, 0 };
+    roundTrip(compressor, decompressor, segment, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+
+    // A compressed datagram is lost, so the next is rebuilt from the wrong header and TCP would drop it
+    Segment lost = segment;
+    lost.sequence += 100;
+    lost.identification++;
+    BYTE pid = 0;
+    (void)compress(compressor, makeDatagram(lost), pid);
+    EXPECT_EQ(HeaderCompressor::PID_COMPRESSED_TCP, pid);
+    Segment next = lost;
+    next.sequence += 100;
+    next.identification++;
+    const std::vector<BYTE> datagram = makeDatagram(next);
+    const std::vector<BYTE> restored = decompress(decompressor, HeaderCompressor::PID_COMPRESSED_TCP, compress(compressor, datagram, pid));
+    EXPECT_FALSE(restored.empty());
+    EXPECT_FALSE(datagram == restored);
+
+    // The sender times out and sends the lost segment again, which goes whole and puts things right
+    lost.identification = next.identification + 1;
+    roundTrip(compressor, decompressor, lost, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    next.identification = lost.identification + 1;
+    EXPECT_EQ(3U, roundTrip(compressor, decompressor, next, HeaderCompressor::PID_COMPRESSED_TCP));
+
+    // A bare acknowledgement repeated is a retransmission too
+    next.sequence += 100;
+    next.dataLength = 0;
+    next.identification++;
+    roundTrip(compressor, decompressor, next, HeaderCompressor::PID_COMPRESSED_TCP);
+    next.identification++;
+    roundTrip(compressor, decompressor, next, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+}
+
+TEST(HeaderDecompressor, ErrorsTossUntilSlotIsNamed)
+{
+    HeaderCompressor compressor;
+    HeaderDecompressor decompressor;
+    Segment first = { 1000, 5000, 4096, 1, ACK, 100, 1024, 0 };
+    Segment second = { 9000, 5000, 4096, 1, ACK, 100, 1025, 0 };
+    roundTrip(compressor, decompressor, first, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+    roundTrip(compressor, decompressor, second, HeaderCompressor::PID_UNCOMPRESSED_TCP);
+
+    // Malformed datagrams are dropped: no slot, an unknown slot, a slot out of range, and truncated
+    HeaderDecompressor fresh;
+    EXPECT_TRUE(decompress(fresh, HeaderCompressor::PID_COMPRESSED_TCP, { 0x80, 0x12, 0x34 }).empty());
+    EXPECT_TRUE(decompress(fresh, HeaderCompressor::PID_COMPRESSED_TCP, { 0xC0, 0x00, 0x12, 0x34 }).empty());
+    EXPECT_TRUE(decompress(decompressor, HeaderCompressor::PID_COMPRESSED_TCP, { 0xC0, 0x10, 0x12, 0x34 }).empty());
+    EXPECT_TRUE(decompress(decompressor, HeaderCompressor::PID_COMPRESSED_TCP, { 0xC8, 0x00, 0x12, 0x34, 0x00, 0x01 }).empty());
+    EXPECT_TRUE(decompress(decompressor, HeaderCompressor::PID_COMPRESSED_TCP, {}).empty());
+    std::vector<BYTE> whole = makeDatagram(first);
+    whole[9] = HeaderCompressor::SLOT_COUNT;
+    EXPECT_TRUE(decompress(decompressor, HeaderCompressor::PID_UNCOMPRESSED_TCP, whole).empty());
+
+    // Datagrams which rely on the last slot named are dropped after an error, until one names its slot
+    second.sequence += 100;
+    second.identification++;
+    BYTE pid = 0;
+    const std::vector<BYTE> unnamed = compress(compressor, makeDatagram(second), pid);
+    EXPECT_EQ(3U, unnamed.size() - second.dataLength);
+    EXPECT_TRUE(decompress(decompressor, pid, unnamed).empty());
+    first.sequence += 100;
+    first.identification++;
+    EXPECT_EQ(4U, roundTrip(compressor, decompressor, first, HeaderCompressor::PID_COMPRESSED_TCP));
+    EXPECT_EQ(5U, decompressor.GetCounters().Dropped);
+    EXPECT_EQ(2U, fresh.GetCounters().Dropped);
+
+    // The restored datagram must fit
+    first.sequence += 100;
+    first.identification++;
+    const std::vector<BYTE> packet = compress(compressor, makeDatagram(first), pid);
+    std::vector<BYTE> buffer(packet);
+    EXPECT_EQ(0U, decompressor.Decompress(pid, buffer.data(), static_cast<ULONG>(buffer.size()), static_cast<ULONG>(buffer.size())));
+}
+
+TEST(HeaderCompressionTable, CompressesPerPeerAsModeSays)
+{
+    std::vector<BYTE> memory(1 << 16);
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = memory.data();
+    HeaderCompressionTable automatic;
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, automatic.Allocate(reinterpret_cast<NDIS_HANDLE>(1), 2, HeaderCompressionTable::Automatic));
+    std::vector<BYTE> otherMemory(1 << 16);
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = otherMemory.data();
+    HeaderCompressionTable enabled;
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, enabled.Allocate(reinterpret_cast<NDIS_HANDLE>(1), 2, HeaderCompressionTable::Enabled));
+
+    // An automatic station leaves datagrams alone until the peer is heard compressing
+    Segment segment = { 1000, 5000, 4096, 1, ACK, 100, 1024, 0 };
+    std::vector<BYTE> datagram = makeDatagram(segment);
+    ULONG offset = 0;
+    EXPECT_EQ(PID_IPV4, automatic.Compress(ALPHA, BRAVO, datagram.data(), static_cast<ULONG>(datagram.size()), offset));
+    EXPECT_EQ(0U, offset);
+    EXPECT_TRUE(makeDatagram(segment) == datagram);
+
+    // An enabled one compresses straight away, and the automatic peer follows suit toward it only
+    std::vector<BYTE> buffer(MTU);
+    ULONG length = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        datagram = makeDatagram(segment);
+        const BYTE pid = enabled.Compress(BRAVO, ALPHA, datagram.data(), static_cast<ULONG>(datagram.size()), offset);
+        EXPECT_EQ((i == 0) ? HeaderCompressor::PID_UNCOMPRESSED_TCP : HeaderCompressor::PID_COMPRESSED_TCP, pid);
+        std::copy(datagram.begin() + offset, datagram.end(), buffer.begin());
+        length = automatic.Decompress(ALPHA, BRAVO, pid, buffer.data(), static_cast<ULONG>(datagram.size() - offset), MTU);
+        EXPECT_EQ(datagram.size(), length);
+        segment.sequence += segment.dataLength;
+        segment.identification++;
+    }
+
+    datagram = makeDatagram(segment);
+    EXPECT_EQ(HeaderCompressor::PID_UNCOMPRESSED_TCP, automatic.Compress(ALPHA, BRAVO, datagram.data(), static_cast<ULONG>(datagram.size()), offset));
+    datagram = makeDatagram(segment);
+    EXPECT_EQ(PID_IPV4, automatic.Compress(ALPHA, CHARLIE, datagram.data(), static_cast<ULONG>(datagram.size()), offset));
+
+    // A third peer takes over the least recently used entry, whose counts are kept
+    datagram = makeDatagram(segment);
+    (void)enabled.Compress(BRAVO, CHARLIE, datagram.data(), static_cast<ULONG>(datagram.size()), offset);
+    datagram = makeDatagram(segment);
+    (void)enabled.Compress(BRAVO, AX25Address("N0CALL", 4), datagram.data(), static_cast<ULONG>(datagram.size()), offset);
+
+    AX25_HEADER_COMPRESSION_STATISTICS statistics;
+    enabled.GetStatistics(statistics);
+    EXPECT_EQ(HeaderCompressionTable::Enabled, statistics.Mode);
+    EXPECT_EQ(2U, statistics.Peers);
+    EXPECT_EQ(1U, statistics.PacketsCompressed);
+    EXPECT_EQ(3U, statistics.PacketsUncompressed);
+    EXPECT_EQ(37U, statistics.BytesSaved);
+    automatic.GetStatistics(statistics);
+    EXPECT_EQ(HeaderCompressionTable::Automatic, statistics.Mode);
+    EXPECT_EQ(1U, statistics.PacketsDecompressed);
+    EXPECT_EQ(1U, statistics.PacketsRefreshed);
+    EXPECT_EQ(1U, statistics.PacketsUncompressed);
+}
+
+/**
+ * Measures the airtime a telnet-like session and a bulk transfer take with and without compression, counting
+ * the AX.25 header and flags of each I frame as well
+ */
+TEST(HeaderCompressor, Benchmark)
+{
+    constexpr ULONG FRAME_OVERHEAD = 2 * 7 + 2 + 2 + 2;     // Addresses, control and PID, FCS and flags
+    struct Workload
+    {
+        const char* name;
+        ULONG dataLength;
+        bool echoed;
+    };
+    const Workload workloads[] = { { "Interactive", 1, true }, { "Bulk", 216, false } };
+
+    for (const Workload& workload : workloads)
+    {
+        // Each direction has its own compressor
+        HeaderCompressor compressors[2];
+        HeaderDecompressor decompressors[2];
+        Segment data = { 1000, 5000, 4096, 1, ACK | PSH, workload.dataLength, 1024, 0 };
+        Segment acknowledgement = { 5000, 1000, 4096, 1, ACK, 0, 23, 0 };
+        ULONG64 plainBytes = 0;
+        ULONG64 compressedBytes = 0;
+        for (int i = 0; i < 200; i++)
+        {
+            const Segment& segment = (i % 2 == 0) ? data : acknowledgement;
+            const std::vector<BYTE> datagram = makeDatagram(segment);
+            BYTE pid = 0;
+            const std::vector<BYTE> sent = compress(compressors[i % 2], datagram, pid);
+            ASSERT_TRUE(datagram == decompress(decompressors[i % 2], pid, sent));
+            plainBytes += datagram.size() + FRAME_OVERHEAD;
+            compressedBytes += sent.size() + FRAME_OVERHEAD;
+
+            if (i % 2 == 0)
+            {
+                data.sequence += workload.dataLength;
+                data.acknowledgement += workload.echoed ? 1 : 0;
+                data.identification++;
+            }
+            else
+            {
+                acknowledgement.acknowledgement += workload.dataLength;
+                acknowledgement.identification++;
+            }
+        }
+
+        EXPECT_LT(compressedBytes, plainBytes);
+        RecordProperty(std::string("AirtimePercent") + workload.name, static_cast<int>(100 * compressedBytes / plainBytes));
+        RecordProperty(std::string("HeaderBytesPerDatagram") + workload.name,
+                       static_cast<int>((compressedBytes - (200 / 2) * workload.dataLength) / 200 - FRAME_OVERHEAD));
+    }
+}
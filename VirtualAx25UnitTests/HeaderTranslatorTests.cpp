@@ -0,0 +1,271 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file HeaderTranslatorTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver HeaderTranslator class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "HeaderTranslator.h"
+
+#include <vector>
+
+namespace
+{
+    const AX25Address LOCAL("KG7UDH", 0);
+
+    /** Builds an Ethernet header addressed to a station */
+    std::vector<BYTE> ethernetHeader(AX25Address destination, USHORT etherType)
+    {
+        std::vector<BYTE> header(HeaderTranslator::ETHERNET_HEADER_LENGTH);
+        EXPECT_TRUE(HeaderTranslator::AddressToEthernet(destination, header.data()));
+        HeaderTranslator::AddressToEthernet(LOCAL, header.data() + HeaderTranslator::ETHERNET_ADDRESS_LENGTH);
+        header[12] = static_cast<BYTE>(etherType >> 8);
+        header[13] = static_cast<BYTE>(etherType);
+        return header;
+    }
+
+    /** Builds a received UI frame with a four byte payload */
+    std::vector<BYTE> receivedFrame(AX25AddressField const& field, BYTE pid)
+    {
+        std::vector<BYTE> frame(AX25AddressField::MAX_LENGTH);
+        frame.resize(field.Write(frame.data(), static_cast<ULONG>(frame.size())));
+        frame.push_back(HeaderTranslator::CONTROL_UI);
+        frame.push_back(pid);
+        frame.insert(frame.end(), { 0x45, 0, 0, 4 });
+        return frame;
+    }
+
+    AX25_HEADER_CACHE_STATISTICS statistics(HeaderTranslator const& translator)
+    {
+        AX25_HEADER_CACHE_STATISTICS result;
+        translator.GetStatistics(result);
+        return result;
+    }
+}
+
+TEST(HeaderTranslator, EthernetAddressRoundTrip)
+{
+    for (AX25Address address : { AX25Address("KG7UDH", 0), AX25Address("N0CALL", 15), AX25Address("A1", 3) })
+    {
+        BYTE ethernet[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+        ASSERT_TRUE(HeaderTranslator::AddressToEthernet(address, ethernet));
+        ASSERT_EQ(HeaderTranslator::SYNTHETIC_ADDRESS_PREFIX, ethernet[0]);
+
+        AX25Address decoded;
+        ASSERT_TRUE(HeaderTranslator::EthernetToAddress(ethernet, &decoded));
+        ASSERT_EQ(address, decoded);
+        ASSERT_EQ(address.GetSsid(), decoded.GetSsid());
+    }
+
+    // Addresses from real Ethernet hardware are not stations
+    const BYTE hardware[] = { 0x00, 0x15, 0x5D, 0x01, 0x02, 0x03 };
+    AX25Address decoded;
+    ASSERT_FALSE(HeaderTranslator::EthernetToAddress(hardware, &decoded));
+
+    // Callsigns with characters other than letters and digits have no Ethernet address
+    BYTE ethernet[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+    ASSERT_FALSE(HeaderTranslator::AddressToEthernet(AX25Address("AB-1", 0), ethernet));
+}
+
+TEST(HeaderTranslator, SecondFrameToStationIsCached)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+    std::vector<BYTE> ethernet = ethernetHeader(AX25Address("N0CALL", 2), HeaderTranslator::ETHERTYPE_IPV4);
+
+    BYTE first[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+    BYTE second[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+    const ULONG length = translator.ToAX25(ethernet.data(), first);
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH + 2, length);
+    ASSERT_EQ(length, translator.ToAX25(ethernet.data(), second));
+    ASSERT_EQ(0, memcmp(first, second, length));
+
+    AX25AddressField field;
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH, field.Parse(first, length));
+    ASSERT_EQ(AX25Address("N0CALL", 2), field.Destination);
+    ASSERT_TRUE(field.Destination.GetControlBit());
+    ASSERT_EQ(LOCAL, field.Source);
+    ASSERT_EQ(HeaderTranslator::CONTROL_UI, first[length - 2]);
+    ASSERT_EQ(HeaderTranslator::PID_IPV4, first[length - 1]);
+
+    AX25_HEADER_CACHE_STATISTICS stats = statistics(translator);
+    ASSERT_EQ(HeaderTranslator::CACHE_SIZE, stats.Capacity);
+    ASSERT_EQ(1u, stats.Entries);
+    ASSERT_EQ(1u, stats.Hits);
+    ASSERT_EQ(1u, stats.Misses);
+}
+
+TEST(HeaderTranslator, BroadcastIsSentToQst)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+    std::vector<BYTE> ethernet = ethernetHeader(LOCAL, HeaderTranslator::ETHERTYPE_ARP);
+    memset(ethernet.data(), 0xFF, HeaderTranslator::ETHERNET_ADDRESS_LENGTH);
+
+    BYTE header[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+    const ULONG length = translator.ToAX25(ethernet.data(), header);
+    AX25AddressField field;
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH, field.Parse(header, length));
+    ASSERT_EQ(HeaderTranslator::BROADCAST_ADDRESS, field.Destination);
+    ASSERT_EQ(HeaderTranslator::PID_ARP, header[length - 1]);
+
+    // ...and QST is received as a broadcast
+    field.Source = AX25Address("N0CALL", 0);
+    std::vector<BYTE> frame = receivedFrame(field, HeaderTranslator::PID_ARP);
+    BYTE received[HeaderTranslator::ETHERNET_HEADER_LENGTH];
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH + 2, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), received));
+    const BYTE broadcast[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x08, 0x06 };
+    ASSERT_EQ(0, memcmp(broadcast, received, HeaderTranslator::ETHERNET_ADDRESS_LENGTH));
+    ASSERT_EQ(0, memcmp(broadcast + 6, received + 12, 2));
+}
+
+// Frames for every group go out to QST, but an IPv4 multicast datagram comes back in addressed to its group
+TEST(HeaderTranslator, MulticastDatagramIsReceivedForItsGroup)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+    AX25AddressField field;
+    field.Destination = HeaderTranslator::BROADCAST_ADDRESS;
+    field.Source = AX25Address("N0CALL", 0);
+
+    struct Case
+    {
+        BYTE group[4];
+        BYTE expected[HeaderTranslator::ETHERNET_ADDRESS_LENGTH];
+    };
+    const Case cases[] =
+    {
+        { { 224, 0, 0, 251 },       { 0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB } },
+        { { 239, 255, 128, 1 },     { 0x01, 0x00, 0x5E, 0x7F, 0x80, 0x01 } },
+        { { 255, 255, 255, 255 },   { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } },
+        { { 44, 24, 0, 1 },         { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } },
+    };
+    for (const Case& c : cases)
+    {
+        std::vector<BYTE> frame = receivedFrame(field, HeaderTranslator::PID_IPV4);
+        frame.resize(frame.size() + 16);
+        memcpy(frame.data() + AX25AddressField::MIN_LENGTH + 2 + HeaderTranslator::IPV4_DESTINATION_OFFSET, c.group, sizeof(c.group));
+
+        BYTE received[HeaderTranslator::ETHERNET_HEADER_LENGTH];
+        ASSERT_EQ(AX25AddressField::MIN_LENGTH + 2, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), received));
+        ASSERT_EQ(0, memcmp(c.expected, received, HeaderTranslator::ETHERNET_ADDRESS_LENGTH));
+    }
+
+    // A datagram too short to hold a destination is taken as a broadcast
+    std::vector<BYTE> frame = receivedFrame(field, HeaderTranslator::PID_IPV4);
+    BYTE received[HeaderTranslator::ETHERNET_HEADER_LENGTH];
+    ASSERT_EQ(AX25AddressField::MIN_LENGTH + 2, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), received));
+    ASSERT_EQ(0xFF, received[0]);
+}
+
+// A frame heard over repeaters teaches the path back: replies go over the same repeaters, in reverse
+TEST(HeaderTranslator, LearnedPathIsUsedForReplies)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+
+    AX25AddressField field;
+    field.Destination = LOCAL.WithControlBit(true);
+    field.Source = AX25Address("N0CALL", 5);
+    field.Repeaters[0] = AX25Address("RELAY", 0).WithControlBit(true);
+    field.Repeaters[1] = AX25Address("WIDE2", 1).WithControlBit(true);
+    field.RepeaterCount = 2;
+    std::vector<BYTE> frame = receivedFrame(field, HeaderTranslator::PID_IPV4);
+
+    BYTE ethernet[HeaderTranslator::ETHERNET_HEADER_LENGTH];
+    ASSERT_EQ(field.GetLength() + 2, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), ethernet));
+    std::vector<BYTE> expected = ethernetHeader(LOCAL, HeaderTranslator::ETHERTYPE_IPV4);
+    HeaderTranslator::AddressToEthernet(AX25Address("N0CALL", 5), expected.data() + HeaderTranslator::ETHERNET_ADDRESS_LENGTH);
+    ASSERT_EQ(0, memcmp(expected.data(), ethernet, sizeof(ethernet)));
+
+    // Hearing the same path again changes nothing
+    ASSERT_NE(0u, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), ethernet));
+    ASSERT_EQ(1u, statistics(translator).PathsLearned);
+
+    std::vector<BYTE> reply = ethernetHeader(AX25Address("N0CALL", 5), HeaderTranslator::ETHERTYPE_IPV4);
+    BYTE header[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+    const ULONG length = translator.ToAX25(reply.data(), header);
+    AX25AddressField replyField;
+    ASSERT_EQ(length - 2, replyField.Parse(header, length));
+    ASSERT_EQ(AX25Address("N0CALL", 5), replyField.Destination);
+    ASSERT_EQ(LOCAL, replyField.Source);
+    ASSERT_EQ(2u, replyField.RepeaterCount);
+    ASSERT_EQ(AX25Address("WIDE2", 1), replyField.Repeaters[0]);
+    ASSERT_EQ(AX25Address("RELAY", 0), replyField.Repeaters[1]);
+    ASSERT_FALSE(replyField.Repeaters[0].GetControlBit());
+    ASSERT_EQ(1u, statistics(translator).Hits);
+}
+
+TEST(HeaderTranslator, UntranslatableFramesAreCounted)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+    BYTE header[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+
+    // IPv6 has no PID
+    std::vector<BYTE> ethernet = ethernetHeader(AX25Address("N0CALL", 0), 0x86DD);
+    ASSERT_EQ(0u, translator.ToAX25(ethernet.data(), header));
+
+    // Hardware addresses have no callsign
+    ethernet = ethernetHeader(AX25Address("N0CALL", 0), HeaderTranslator::ETHERTYPE_IPV4);
+    ethernet[0] = 0x00;
+    ASSERT_EQ(0u, translator.ToAX25(ethernet.data(), header));
+
+    // No layer 3 (PID 0xF0), and I frames
+    AX25AddressField field;
+    field.Destination = LOCAL;
+    field.Source = AX25Address("N0CALL", 0);
+    std::vector<BYTE> frame = receivedFrame(field, 0xF0);
+    BYTE received[HeaderTranslator::ETHERNET_HEADER_LENGTH];
+    ASSERT_EQ(0u, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), received));
+    frame = receivedFrame(field, HeaderTranslator::PID_IPV4);
+    frame[AX25AddressField::MIN_LENGTH] = 0x00;
+    ASSERT_EQ(0u, translator.ToEthernet(frame.data(), static_cast<ULONG>(frame.size()), received));
+
+    // Truncated after the address field
+    ASSERT_EQ(0u, translator.ToEthernet(frame.data(), AX25AddressField::MIN_LENGTH + 1, received));
+
+    AX25_HEADER_CACHE_STATISTICS stats = statistics(translator);
+    ASSERT_EQ(5u, stats.UntranslatableFrames);
+    ASSERT_EQ(0u, stats.Entries);
+    ASSERT_EQ(0u, stats.PathsLearned);
+}
+
+// More stations than the cache holds: every lookup still succeeds, and the displaced entries are counted
+TEST(HeaderTranslator, FullCacheEvicts)
+{
+    HeaderTranslator translator;
+    translator.SetLocalAddress(LOCAL);
+    BYTE header[HeaderTranslator::MAX_AX25_HEADER_LENGTH];
+    const ULONG stations = 2 * HeaderTranslator::CACHE_SIZE;
+    for (ULONG i = 0; i < stations; i++)
+    {
+        char callsign[] = "N0AAA";
+        callsign[2] = static_cast<char>('A' + i % 26);
+        callsign[3] = static_cast<char>('A' + i / 26 % 26);
+        std::vector<BYTE> ethernet = ethernetHeader(AX25Address(callsign, static_cast<BYTE>(i % 16)), HeaderTranslator::ETHERTYPE_IPV4);
+        ASSERT_EQ(AX25AddressField::MIN_LENGTH + 2, translator.ToAX25(ethernet.data(), header));
+    }
+
+    AX25_HEADER_CACHE_STATISTICS stats = statistics(translator);
+    ASSERT_EQ(stations, stats.Misses);
+    ASSERT_LE(stats.Entries, HeaderTranslator::CACHE_SIZE);
+    ASSERT_EQ(stations, stats.Entries + stats.Evictions);
+}
@@ -0,0 +1,158 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file InterlockedChainQueueTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver InterlockedChainQueue template
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "InterlockedChainQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    /** Stand-in for a NET_BUFFER_LIST: a chain of nodes with a separate link between chains */
+    struct Node
+    {
+        Node* next;         //<! Next node within the same chain
+        Node* chainLink;    //<! Link field owned by the queue
+        int producer;       //<! Index of the thread which enqueued this chain
+        int sequence;       //<! Order in which this chain was enqueued by its producer
+    };
+
+    struct NodeLink
+    {
+        static Node*& Link(Node& node) { return node.chainLink; }
+    };
+
+    typedef InterlockedChainQueue<Node, NodeLink> Queue;
+}
+
+TEST(InterlockedChainQueue, EmptyQueue)
+{
+    Queue queue;
+    EXPECT_TRUE(queue.IsEmpty());
+    EXPECT_EQ(nullptr, queue.DequeueAll());
+}
+
+TEST(InterlockedChainQueue, PreservesOrder)
+{
+    Queue queue;
+    Node nodes[4] = {};
+
+    EXPECT_TRUE(queue.Enqueue(nodes[0]));
+    EXPECT_FALSE(queue.Enqueue(nodes[1]));
+    EXPECT_FALSE(queue.Enqueue(nodes[2]));
+    EXPECT_FALSE(queue.IsEmpty());
+
+    Node* chain = queue.DequeueAll();
+    EXPECT_EQ(&nodes[0], chain);
+    EXPECT_EQ(&nodes[1], nodes[0].chainLink);
+    EXPECT_EQ(&nodes[2], nodes[1].chainLink);
+    EXPECT_EQ(nullptr, nodes[2].chainLink);
+    EXPECT_TRUE(queue.IsEmpty());
+
+    // Queue reports empty again once drained
+    EXPECT_TRUE(queue.Enqueue(nodes[3]));
+    EXPECT_EQ(&nodes[3], queue.DequeueAll());
+}
+
+TEST(InterlockedChainQueue, ChainsAreNotWalked)
+{
+    Queue queue;
+    Node chain[3] = {};
+    chain[0].next = &chain[1];
+    chain[1].next = &chain[2];
+
+    queue.Enqueue(chain[0]);
+    Node* result = queue.DequeueAll();
+    ASSERT_EQ(&chain[0], result);
+    EXPECT_EQ(&chain[1], result->next);
+    EXPECT_EQ(&chain[2], result->next->next);
+    EXPECT_EQ(nullptr, result->chainLink);
+}
+
+TEST(InterlockedChainQueue, ConcurrentProducers)
+{
+    const int producerCount = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    constexpr int chainsPerProducer = 50000;
+
+    Queue queue;
+    std::vector<std::vector<Node>> nodes(producerCount, std::vector<Node>(chainsPerProducer));
+    std::vector<int> nextExpected(producerCount, 0);
+    std::atomic<int> producersRunning(0);
+    std::atomic<bool> start(false);
+    int received = 0;
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < producerCount; producer++)
+    {
+        producers.emplace_back([&, producer]()
+        {
+            producersRunning++;
+            while (!start) {}
+            for (int sequence = 0; sequence < chainsPerProducer; sequence++)
+            {
+                Node& node = nodes[producer][sequence];
+                node.producer = producer;
+                node.sequence = sequence;
+                queue.Enqueue(node);
+            }
+            producersRunning--;
+        });
+    }
+
+    while (producersRunning != producerCount) {}
+    auto startTime = std::chrono::high_resolution_clock::now();
+    start = true;
+
+    // Single consumer: each producer's chains must come out in the order that producer enqueued them
+    bool draining = true;
+    while (draining)
+    {
+        draining = producersRunning != 0;
+        for (Node* node = queue.DequeueAll(); node != nullptr; node = node->chainLink)
+        {
+            EXPECT_EQ(nextExpected[node->producer], node->sequence);
+            nextExpected[node->producer]++;
+            received++;
+        }
+    }
+    auto elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+    for (std::thread& producer : producers)
+    {
+        producer.join();
+    }
+
+    EXPECT_EQ(producerCount * chainsPerProducer, received);
+    EXPECT_TRUE(queue.IsEmpty());
+
+    // Report contention so that changes to the queue can be compared between runs
+    long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    RecordProperty("Producers", producerCount);
+    RecordProperty("ChainsEnqueued", received);
+    RecordProperty("ContentionRetries", queue.GetContentionCount());
+    RecordProperty("NanosecondsPerChain", static_cast<int>(nanoseconds / received));
+}
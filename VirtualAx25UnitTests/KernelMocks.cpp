@@ -71,6 +71,256 @@ extern "C"
 
     }
     
+    KERNEL_MOCK_DEF(BOOLEAN, __imp_KeInsertQueueDpc,
+                    KDPC*, Dpc,
+                    void*, SystemArgument1,
+                    void*, SystemArgument2)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeInitializeTimer,
+                    KTIMER*, Timer)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(BOOLEAN, __imp_KeSetTimer,
+                    KTIMER*, Timer,
+                    LARGE_INTEGER, DueTime,
+                    KDPC*, Dpc)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(BOOLEAN, __imp_KeCancelTimer,
+                    KTIMER*, Timer)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, NdisMSendNetBufferListsComplete,
+                    NDIS_HANDLE, MiniportAdapterHandle,
+                    NET_BUFFER_LIST*, NetBufferList,
+                    ULONG, SendCompleteFlags)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void*, NdisGetDataBuffer,
+                    NET_BUFFER*, NetBuffer,
+                    ULONG, BytesNeeded,
+                    void*, Storage,
+                    UINT, AlignMultiple,
+                    UINT, AlignOffset)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(NDIS_HANDLE, NdisAllocateNetBufferListPool,
+                    NDIS_HANDLE, NdisHandle,
+                    NET_BUFFER_LIST_POOL_PARAMETERS*, Parameters)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, NdisFreeNetBufferListPool,
+                    NDIS_HANDLE, PoolHandle)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(MDL*, NdisAllocateMdl,
+                    NDIS_HANDLE, NdisHandle,
+                    void*, VirtualAddress,
+                    UINT, Length)
+    {
+        KernelMockData::NdisAllocateMdl_Result = new MDL{ nullptr, args.VirtualAddress, args.Length };
+    }
+
+    KERNEL_MOCK_DEF(void, NdisFreeMdl,
+                    MDL*, Mdl)
+    {
+        delete args.Mdl;
+    }
+
+    /** Backing storage for a NET_BUFFER_LIST allocated by the NdisAllocateNetBufferAndNetBufferList mock */
+    struct MockNetBufferList
+    {
+        NET_BUFFER_LIST netBufferList;
+        NET_BUFFER netBuffer;
+    };
+
+    KERNEL_MOCK_DEF(NET_BUFFER_LIST*, NdisAllocateNetBufferAndNetBufferList,
+                    NDIS_HANDLE, PoolHandle,
+                    USHORT, ContextSize,
+                    USHORT, ContextBackFill,
+                    MDL*, MdlChain,
+                    ULONG, DataOffset,
+                    SIZE_T, DataLength)
+    {
+        MockNetBufferList* result = new MockNetBufferList{};
+        result->netBufferList.FirstNetBuffer = &result->netBuffer;
+        result->netBuffer.CurrentMdl = args.MdlChain;
+        result->netBuffer.CurrentMdlOffset = args.DataOffset;
+        result->netBuffer.DataLength = static_cast<ULONG>(args.DataLength);
+        result->netBuffer.MdlChain = args.MdlChain;
+        result->netBuffer.DataOffset = args.DataOffset;
+        KernelMockData::NdisAllocateNetBufferAndNetBufferList_Result = &result->netBufferList;
+    }
+
+    KERNEL_MOCK_DEF(void, NdisFreeNetBufferList,
+                    NET_BUFFER_LIST*, NetBufferList)
+    {
+        delete reinterpret_cast<MockNetBufferList*>(args.NetBufferList);
+    }
+
+    KERNEL_MOCK_DEF(void, NdisMIndicateReceiveNetBufferLists,
+                    NDIS_HANDLE, MiniportAdapterHandle,
+                    NET_BUFFER_LIST*, NetBufferList,
+                    ULONG, PortNumber,
+                    ULONG, NumberOfNetBufferLists,
+                    ULONG, ReceiveFlags)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, NdisMPauseComplete,
+                    NDIS_HANDLE, MiniportAdapterHandle)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(NDIS_STATUS, NdisOpenConfigurationEx,
+                    void*, ConfigObject,
+                    NDIS_HANDLE*, ConfigurationHandle)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, NdisReadConfiguration,
+                    NDIS_STATUS*, Status,
+                    void**, ParameterValue,
+                    NDIS_HANDLE, ConfigurationHandle,
+                    void*, Keyword,
+                    int, ParameterType)
+    {
+        *args.Status = NDIS_STATUS_FAILURE;
+        *args.ParameterValue = nullptr;
+    }
+
+    KERNEL_MOCK_DEF(void, NdisCloseConfiguration,
+                    NDIS_HANDLE, ConfigurationHandle)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(NTSTATUS, __imp_KeSaveExtendedProcessorState,
+                    ULONG64, Mask,
+                    void*, XStateSave)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeRestoreExtendedProcessorState,
+                    void*, XStateSave)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(ULONG, KeQueryMaximumProcessorCountEx,
+                    USHORT, GroupNumber)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(ULONG, KeGetCurrentProcessorNumberEx,
+                    PROCESSOR_NUMBER*, ProcNumber)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeAcquireSpinLockAtDpcLevel,
+                    void*, SpinLock)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeReleaseSpinLockFromDpcLevel,
+                    void*, SpinLock)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(UCHAR, __imp_KeAcquireSpinLockRaiseToDpc,
+                    void*, SpinLock)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeReleaseSpinLock,
+                    void*, SpinLock,
+                    UCHAR, NewIrql)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeInitializeEvent,
+                    KEVENT*, Event,
+                    EVENT_TYPE, Type,
+                    BOOLEAN, State)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(LONG, __imp_KeSetEvent,
+                    KEVENT*, Event,
+                    LONG, Increment,
+                    BOOLEAN, Wait)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(void, __imp_KeClearEvent,
+                    KEVENT*, Event)
+    {
+
+    }
+
+    KERNEL_MOCK_DEF(NTSTATUS, __imp_KeWaitForSingleObject,
+                    void*, Object,
+                    KWAIT_REASON, WaitReason,
+                    KPROCESSOR_MODE, WaitMode,
+                    BOOLEAN, Alertable,
+                    LARGE_INTEGER*, Timeout)
+    {
+
+    }
+
+    // The driver calls these through its import table, but tests set up the results of the mocks above
+    ULONG __imp_KeQueryMaximumProcessorCountEx(USHORT groupNumber)
+    {
+        return KeQueryMaximumProcessorCountEx(groupNumber);
+    }
+
+    ULONG __imp_KeGetCurrentProcessorNumberEx(PROCESSOR_NUMBER* procNumber)
+    {
+        return KeGetCurrentProcessorNumberEx(procNumber);
+    }
+
+    // Takes no arguments, so it cannot be declared through KERNEL_MOCK_DEF. Nothing is ever queued in
+    // the unit tests, so there is nothing to flush.
+    void __imp_KeFlushQueuedDpcs()
+    {
+    }
+
+    // Also takes no arguments; the time stands still unless a test moves it
+    ULONG64 KernelMockData::KeQueryUnbiasedInterruptTime_Result;
+    ULONG64 __imp_KeQueryUnbiasedInterruptTime()
+    {
+        return KernelMockData::KeQueryUnbiasedInterruptTime_Result;
+    }
+
     // This is an actual kernel API, so it's a little weird. We do this raw.
     // Goal is to implement __stdcall for the __imp_ExRaiseStatus function, but
     // __stdcall doesn't follow that naming convention. Fortunately, the calling convention
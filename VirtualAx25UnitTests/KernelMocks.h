@@ -33,6 +33,9 @@ typedef unsigned long NDIS_STATUS;
 typedef unsigned long NDIS_OID;
 typedef void* PDRIVER_OBJECT;
 
+#include <cassert>
+#define ASSERT(expression) assert(expression)
+
 #pragma region Framework Code
 /**
  * Forces macro expansion in cases of complex macros
@@ -259,6 +262,11 @@ struct NDIS_MINIPORT_REGISTRATION_ATTRIBUTES
     NDIS_INTERFACE_TYPE InterfaceType;
 };
 
+struct NDIS_MINIPORT_RESTART_PARAMETERS
+{
+    NDIS_OBJECT_HEADER Header;
+};
+
 // Only include the enumeration values we care about - any other should be a compile error (failed test)
 enum NDIS_MEDIUM { NdisMedium802_3 };
 enum NDIS_PHYSICAL_MEDIUM { NdisPhysicalMediumWirelessWan = 8 };
@@ -371,10 +379,163 @@ struct KDPC {
 };
 typedef void KDEFERRED_ROUTINE(KDPC*, void*, void*, void*);
 
+// The timer is opaque to the driver; only its size has to match
+struct KTIMER {
+    ULONG64 Opaque[8];
+};
+
+// So is the event
+struct KEVENT {
+    ULONG64 Opaque[3];
+};
+enum EVENT_TYPE { NotificationEvent, SynchronizationEvent };
+enum KWAIT_REASON { Executive = 0 };
+typedef CHAR KPROCESSOR_MODE;
+static constexpr KPROCESSOR_MODE KernelMode = 0;
+static constexpr LONG IO_NO_INCREMENT = 0;
+
+// Only the fields of the NET_BUFFER structures that the driver touches are modeled
+struct MDL
+{
+    MDL* Next;
+    PVOID MappedSystemVa;
+    ULONG ByteCount;
+};
+typedef MDL* PMDL;
+
+enum MM_PAGE_PRIORITY { NormalPagePriority = 16 };
+static constexpr ULONG MdlMappingNoExecute = 0x40000000;
+
+#define NDIS_MDL_LINKAGE(_Mdl)                        ((_Mdl)->Next)
+#define MmGetMdlByteCount(_Mdl)                       ((_Mdl)->ByteCount)
+#define MmGetSystemAddressForMdlSafe(_Mdl, _Priority) ((_Mdl)->MappedSystemVa)
+
+struct NET_BUFFER
+{
+    NET_BUFFER* Next;
+    MDL* CurrentMdl;
+    ULONG CurrentMdlOffset;
+    ULONG DataLength;
+    MDL* MdlChain;
+    ULONG DataOffset;
+};
+
+// Only the out-of-band information the driver reads is modeled
+enum NDIS_NET_BUFFER_LIST_INFO
+{
+    Ieee8021QNetBufferListInfo,
+    MaxNetBufferListInfo
+};
+
+union NDIS_NET_BUFFER_LIST_8021Q_INFO
+{
+    struct
+    {
+        UINT32 UserPriority : 3;
+        UINT32 CanonicalFormatId : 1;
+        UINT32 VlanId : 12;
+        UINT32 Reserved : 16;
+    } TagHeader;
+    PVOID Value;
+};
+
+struct NET_BUFFER_LIST
+{
+    NET_BUFFER_LIST* Next;
+    NET_BUFFER* FirstNetBuffer;
+    NDIS_HANDLE SourceHandle;
+    PVOID MiniportReserved[2];
+    NDIS_STATUS Status;
+    PVOID NetBufferListInfo[MaxNetBufferListInfo];
+};
+
+struct NET_BUFFER_LIST_POOL_PARAMETERS
+{
+    NDIS_OBJECT_HEADER Header;
+    UCHAR ProtocolId;
+    BOOLEAN fAllocateNetBuffer;
+    USHORT ContextSize;
+    ULONG PoolTag;
+    ULONG DataSize;
+};
+
+static constexpr UCHAR NDIS_OBJECT_TYPE_DEFAULT = 0x80;
+static constexpr UCHAR NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1 = 1;
+static constexpr USHORT NDIS_SIZEOF_NET_BUFFER_LIST_POOL_PARAMETERS_REVISION_1 = sizeof(NET_BUFFER_LIST_POOL_PARAMETERS);
+static constexpr UCHAR NDIS_PROTOCOL_ID_DEFAULT = 0x00;
+
+#define NET_BUFFER_LIST_NEXT_NBL(_NBL)          ((_NBL)->Next)
+#define NET_BUFFER_LIST_FIRST_NB(_NBL)          ((_NBL)->FirstNetBuffer)
+#define NET_BUFFER_LIST_STATUS(_NBL)            ((_NBL)->Status)
+#define NET_BUFFER_LIST_MINIPORT_RESERVED(_NBL) ((_NBL)->MiniportReserved)
+#define NET_BUFFER_LIST_INFO(_NBL, _Id)         ((_NBL)->NetBufferListInfo[(_Id)])
+#define NET_BUFFER_NEXT_NB(_NB)                 ((_NB)->Next)
+#define NET_BUFFER_DATA_LENGTH(_NB)             ((_NB)->DataLength)
+#define NET_BUFFER_CURRENT_MDL(_NB)             ((_NB)->CurrentMdl)
+#define NET_BUFFER_CURRENT_MDL_OFFSET(_NB)      ((_NB)->CurrentMdlOffset)
+#define NET_BUFFER_FIRST_MDL(_NB)               ((_NB)->MdlChain)
+#define NET_BUFFER_DATA_OFFSET(_NB)             ((_NB)->DataOffset)
+
 // NTSTATUS codes
 typedef DWORD NTSTATUS;
 static constexpr NTSTATUS STATUS_NOT_IMPLEMENTED = 0xC0000002;
 
+// NDIS_STATUS codes
+static constexpr NDIS_STATUS NDIS_STATUS_SUCCESS = 0x00000000;
+static constexpr NDIS_STATUS NDIS_STATUS_BUFFER_OVERFLOW = 0x80000005;
+static constexpr NDIS_STATUS NDIS_STATUS_FAILURE = 0xC0000001;
+static constexpr NDIS_STATUS NDIS_STATUS_RESOURCES = 0xC000009A;
+static constexpr NDIS_STATUS NDIS_STATUS_INVALID_LENGTH = 0xC0010014;
+static constexpr NDIS_STATUS NDIS_STATUS_INVALID_PACKET = 0xC001000F;
+static constexpr NDIS_STATUS NDIS_STATUS_PAUSED = 0xC023002A;
+static constexpr NDIS_STATUS NDIS_STATUS_NOT_ACCEPTED = 0x00010003;
+static constexpr NDIS_STATUS NDIS_STATUS_BUFFER_TOO_SHORT = 0xC0010016;
+static constexpr NDIS_STATUS NDIS_STATUS_INVALID_OID = 0xC0010017;
+static constexpr NDIS_STATUS NDIS_STATUS_NOT_SUPPORTED = 0xC00000BB;
+
+// Only the request types and fields of an OID request that the driver touches are modeled
+enum NDIS_REQUEST_TYPE
+{
+    NdisRequestQueryInformation = 0,
+    NdisRequestSetInformation = 1,
+    NdisRequestQueryStatistics = 2,
+    NdisRequestMethod = 12
+};
+
+struct NDIS_OID_REQUEST
+{
+    NDIS_OBJECT_HEADER Header;
+    NDIS_REQUEST_TYPE RequestType;
+    union
+    {
+        struct
+        {
+            NDIS_OID Oid;
+            PVOID InformationBuffer;
+            UINT InformationBufferLength;
+            UINT BytesWritten;
+            UINT BytesNeeded;
+        } QUERY_INFORMATION;
+
+        struct
+        {
+            NDIS_OID Oid;
+            PVOID InformationBuffer;
+            UINT InformationBufferLength;
+            UINT BytesRead;
+            UINT BytesNeeded;
+        } SET_INFORMATION;
+    } DATA;
+};
+
+// OIDs used by the tests
+static constexpr NDIS_OID OID_GEN_VENDOR_DESCRIPTION = 0x0001010D;
+static constexpr NDIS_OID OID_GEN_CURRENT_PACKET_FILTER = 0x0001010E;
+static constexpr NDIS_OID OID_802_3_MAXIMUM_LIST_SIZE = 0x01010104;
+static constexpr NDIS_OID OID_PNP_CAPABILITIES = 0xFD010100;
+
+static constexpr USHORT ALL_PROCESSOR_GROUPS = 0xFFFF;
+
 
 // Kernel function implementations
 KERNEL_MOCK_DECL(void*, NdisAllocateMemoryWithTagPriority,
@@ -398,4 +559,142 @@ KERNEL_MOCK_DECL(NDIS_STATUS, NdisMSetMiniportAttributes,
 KERNEL_MOCK_DECL(void, __imp_KeInitializeDpc,
                  KDPC*, Dpc,
                  void*, DeferredRoutine,
-                 void*, DeferredContext);
\ No newline at end of file
+                 void*, DeferredContext);
+
+KERNEL_MOCK_DECL(BOOLEAN, __imp_KeInsertQueueDpc,
+                 KDPC*, Dpc,
+                 void*, SystemArgument1,
+                 void*, SystemArgument2);
+
+KERNEL_MOCK_DECL(void, __imp_KeInitializeTimer,
+                 KTIMER*, Timer);
+
+KERNEL_MOCK_DECL(BOOLEAN, __imp_KeSetTimer,
+                 KTIMER*, Timer,
+                 LARGE_INTEGER, DueTime,
+                 KDPC*, Dpc);
+
+KERNEL_MOCK_DECL(BOOLEAN, __imp_KeCancelTimer,
+                 KTIMER*, Timer);
+
+KERNEL_MOCK_DECL(void, NdisMSendNetBufferListsComplete,
+                 NDIS_HANDLE, MiniportAdapterHandle,
+                 NET_BUFFER_LIST*, NetBufferList,
+                 ULONG, SendCompleteFlags);
+
+KERNEL_MOCK_DECL(void*, NdisGetDataBuffer,
+                 NET_BUFFER*, NetBuffer,
+                 ULONG, BytesNeeded,
+                 void*, Storage,
+                 UINT, AlignMultiple,
+                 UINT, AlignOffset);
+
+KERNEL_MOCK_DECL(NDIS_HANDLE, NdisAllocateNetBufferListPool,
+                 NDIS_HANDLE, NdisHandle,
+                 NET_BUFFER_LIST_POOL_PARAMETERS*, Parameters);
+
+KERNEL_MOCK_DECL(void, NdisFreeNetBufferListPool,
+                 NDIS_HANDLE, PoolHandle);
+
+// Allocates a real MDL describing the supplied memory; freed again by NdisFreeMdl
+KERNEL_MOCK_DECL(MDL*, NdisAllocateMdl,
+                 NDIS_HANDLE, NdisHandle,
+                 void*, VirtualAddress,
+                 UINT, Length);
+
+KERNEL_MOCK_DECL(void, NdisFreeMdl,
+                 MDL*, Mdl);
+
+// Allocates a real NET_BUFFER_LIST and NET_BUFFER over the supplied MDL; freed again by NdisFreeNetBufferList
+KERNEL_MOCK_DECL(NET_BUFFER_LIST*, NdisAllocateNetBufferAndNetBufferList,
+                 NDIS_HANDLE, PoolHandle,
+                 USHORT, ContextSize,
+                 USHORT, ContextBackFill,
+                 MDL*, MdlChain,
+                 ULONG, DataOffset,
+                 SIZE_T, DataLength);
+
+KERNEL_MOCK_DECL(void, NdisFreeNetBufferList,
+                 NET_BUFFER_LIST*, NetBufferList);
+
+KERNEL_MOCK_DECL(void, NdisMIndicateReceiveNetBufferLists,
+                 NDIS_HANDLE, MiniportAdapterHandle,
+                 NET_BUFFER_LIST*, NetBufferList,
+                 ULONG, PortNumber,
+                 ULONG, NumberOfNetBufferLists,
+                 ULONG, ReceiveFlags);
+
+KERNEL_MOCK_DECL(void, NdisMPauseComplete,
+                 NDIS_HANDLE, MiniportAdapterHandle);
+
+// The configuration structures are not modeled; no configuration is ever found by the unit tests
+KERNEL_MOCK_DECL(NDIS_STATUS, NdisOpenConfigurationEx,
+                 void*, ConfigObject,
+                 NDIS_HANDLE*, ConfigurationHandle);
+
+KERNEL_MOCK_DECL(void, NdisReadConfiguration,
+                 NDIS_STATUS*, Status,
+                 void**, ParameterValue,
+                 NDIS_HANDLE, ConfigurationHandle,
+                 void*, Keyword,
+                 int, ParameterType);
+
+KERNEL_MOCK_DECL(void, NdisCloseConfiguration,
+                 NDIS_HANDLE, ConfigurationHandle);
+
+// The processor state is not modeled; the unit tests run in user mode where nothing needs saving
+KERNEL_MOCK_DECL(NTSTATUS, __imp_KeSaveExtendedProcessorState,
+                 ULONG64, Mask,
+                 void*, XStateSave);
+
+KERNEL_MOCK_DECL(void, __imp_KeRestoreExtendedProcessorState,
+                 void*, XStateSave);
+
+// Processors are not modeled; tests choose the processor count and the current processor through the results
+KERNEL_MOCK_DECL(ULONG, KeQueryMaximumProcessorCountEx,
+                 USHORT, GroupNumber);
+
+KERNEL_MOCK_DECL(ULONG, KeGetCurrentProcessorNumberEx,
+                 PROCESSOR_NUMBER*, ProcNumber);
+
+// Only one thread runs in the unit tests, so the lock is never contended
+KERNEL_MOCK_DECL(void, __imp_KeAcquireSpinLockAtDpcLevel,
+                 void*, SpinLock);
+
+KERNEL_MOCK_DECL(void, __imp_KeReleaseSpinLockFromDpcLevel,
+                 void*, SpinLock);
+
+// KeAcquireSpinLock and KeReleaseSpinLock, which also raise and lower the IRQL, are imported under these names
+KERNEL_MOCK_DECL(UCHAR, __imp_KeAcquireSpinLockRaiseToDpc,
+                 void*, SpinLock);
+
+KERNEL_MOCK_DECL(void, __imp_KeReleaseSpinLock,
+                 void*, SpinLock,
+                 UCHAR, NewIrql);
+
+KERNEL_MOCK_DECL(void, __imp_KeInitializeEvent,
+                 KEVENT*, Event,
+                 EVENT_TYPE, Type,
+                 BOOLEAN, State);
+
+KERNEL_MOCK_DECL(LONG, __imp_KeSetEvent,
+                 KEVENT*, Event,
+                 LONG, Increment,
+                 BOOLEAN, Wait);
+
+KERNEL_MOCK_DECL(void, __imp_KeClearEvent,
+                 KEVENT*, Event);
+
+// Nothing else runs in the unit tests, so a wait always returns at once
+KERNEL_MOCK_DECL(NTSTATUS, __imp_KeWaitForSingleObject,
+                 void*, Object,
+                 KWAIT_REASON, WaitReason,
+                 KPROCESSOR_MODE, WaitMode,
+                 BOOLEAN, Alertable,
+                 LARGE_INTEGER*, Timeout);
+
+// Takes no arguments, so it is mocked by hand. Tests set the time, in units of 100ns, through the result.
+namespace KernelMockData {
+    extern ULONG64 KeQueryUnbiasedInterruptTime_Result;
+}
+extern "C" ULONG64 __imp_KeQueryUnbiasedInterruptTime();
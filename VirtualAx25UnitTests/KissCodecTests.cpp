@@ -0,0 +1,294 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissCodecTests.cpp
+ * Unit tests and microbenchmark for the Virtual AX.25 NDIS Driver KissCodec and KissScanner classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "KissCodec.h"
+#include "KissDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char* const implementationNames[] = { "Scalar", "Sse2", "Avx2" };
+
+    /**
+     * Runs a test once with each implementation this machine supports, then goes back to the widest
+     */
+    void forEachImplementation(std::function<void(KissCodec::Implementation)> test)
+    {
+        for (int i = KissCodec::Scalar; i <= KissCodec::Avx2; i++)
+        {
+            KissCodec::Implementation implementation = static_cast<KissCodec::Implementation>(i);
+            if (KissCodec::SelectImplementation(implementation) == implementation)
+            {
+                SCOPED_TRACE(implementationNames[i]);
+                test(implementation);
+            }
+        }
+        KissCodec::SelectImplementation(KissCodec::Avx2);
+    }
+
+    /** Escapes data one byte at a time, as the reference for the codec */
+    std::vector<BYTE> escape(std::vector<BYTE> const& data)
+    {
+        std::vector<BYTE> result;
+        for (BYTE value : data)
+        {
+            if (value == Kiss::FEND || value == Kiss::FESC)
+            {
+                result.push_back(Kiss::FESC);
+                result.push_back(value == Kiss::FEND ? Kiss::TFEND : Kiss::TFESC);
+            }
+            else
+            {
+                result.push_back(value);
+            }
+        }
+        return result;
+    }
+
+    /** Creates data whose bytes are never FEND or FESC, except where placed by the test */
+    std::vector<BYTE> cleanData(size_t length, std::mt19937& random)
+    {
+        std::vector<BYTE> data(length);
+        for (BYTE& value : data)
+        {
+            do
+            {
+                value = static_cast<BYTE>(random());
+            } while (value == Kiss::FEND || value == Kiss::FESC);
+        }
+        return data;
+    }
+
+    class CountingHandler : public KissFrameHandler
+    {
+    public:
+        void KissFrameDecoded(BYTE, BYTE, const BYTE*, ULONG length) noexcept override
+        {
+            frames++;
+            bytes += length;
+        }
+
+        ULONG frames = 0;
+        ULONG64 bytes = 0;
+    };
+}
+
+// Every implementation must find a special byte at every position of every length, including the
+// positions covered only by the overlapping final block of the vector routines
+TEST(KissCodec, EveryImplementationFindsEverySpecialByte)
+{
+    std::mt19937 random(6);
+    forEachImplementation([&](KissCodec::Implementation)
+    {
+        KissScanner scanner(KissCodec::MINIMUM_SAVED_STATE_WORK_LENGTH);
+        for (ULONG length = 0; length <= 100; length++)
+        {
+            std::vector<BYTE> data = cleanData(length, random);
+            ASSERT_EQ(length, scanner.FindSpecialByte(data.data(), length));
+
+            for (ULONG position = 0; position < length; position++)
+            {
+                BYTE original = data[position];
+                data[position] = (position % 2 == 0) ? Kiss::FEND : Kiss::FESC;
+                ASSERT_EQ(position, scanner.FindSpecialByte(data.data(), length)) << "length " << length;
+
+                // A later special byte must not hide the first one
+                data[length - 1] = Kiss::FEND;
+                ASSERT_EQ(position, scanner.FindSpecialByte(data.data(), length)) << "length " << length;
+                data[length - 1] = original;
+                data[position] = original;
+            }
+        }
+    });
+}
+
+// Scans must not read outside the bounds they were given, even when the memory either side is special
+TEST(KissCodec, ScanStaysWithinBounds)
+{
+    std::mt19937 random(7);
+    forEachImplementation([&](KissCodec::Implementation)
+    {
+        KissScanner scanner(KissCodec::MINIMUM_SAVED_STATE_WORK_LENGTH);
+        for (ULONG length = 0; length <= 70; length++)
+        {
+            std::vector<BYTE> data = cleanData(length + 64, random);
+            std::fill(data.begin(), data.begin() + 32, Kiss::FEND);
+            std::fill(data.begin() + 32 + length, data.end(), Kiss::FESC);
+            ASSERT_EQ(length, scanner.FindSpecialByte(data.data() + 32, length));
+        }
+    });
+}
+
+TEST(KissCodec, EscapeMatchesReference)
+{
+    std::mt19937 random(8);
+    forEachImplementation([&](KissCodec::Implementation)
+    {
+        for (ULONG length : { 0u, 1u, 15u, 16u, 17u, 31u, 32u, 33u, 256u, 1000u })
+        {
+            for (int density : { 0, 2, 64, 256 })
+            {
+                // density is the chance in 256 that any byte is special
+                std::vector<BYTE> data = cleanData(length, random);
+                for (BYTE& value : data)
+                {
+                    if (static_cast<int>(random() % 256) < density)
+                    {
+                        value = (random() % 2) ? Kiss::FEND : Kiss::FESC;
+                    }
+                }
+
+                std::vector<BYTE> expected = escape(data);
+                std::vector<BYTE> output(2 * length);
+                ULONG written;
+                ASSERT_TRUE(KissCodec::Escape(data.data(), length, output.data(), static_cast<ULONG>(output.size()), &written));
+                output.resize(written);
+                ASSERT_EQ(expected, output) << "length " << length << ", density " << density;
+            }
+        }
+    });
+}
+
+TEST(KissCodec, EscapeFailsWhenOutputIsTooSmall)
+{
+    std::vector<BYTE> data{ 1, 2, Kiss::FEND, 3 };
+    std::vector<BYTE> output(5);
+    ULONG written = 99;
+    ASSERT_FALSE(KissCodec::Escape(data.data(), static_cast<ULONG>(data.size()), output.data(), 4, &written));
+    ASSERT_EQ(0u, written);
+
+    // No room for the escape sequence itself
+    ASSERT_FALSE(KissCodec::Escape(data.data(), 3, output.data(), 3, &written));
+    ASSERT_TRUE(KissCodec::Escape(data.data(), static_cast<ULONG>(data.size()), output.data(), 5, &written));
+    ASSERT_EQ(5u, written);
+}
+
+// Encoding a fragmented frame must give the same bytes as escaping the whole frame, and decode back to it
+TEST(KissCodec, EncodedFrameDecodes)
+{
+    std::mt19937 random(9);
+    forEachImplementation([&](KissCodec::Implementation)
+    {
+        std::vector<BYTE> payload(600);
+        for (BYTE& value : payload)
+        {
+            value = static_cast<BYTE>(random());
+        }
+
+        FrameGatherList frame;
+        ASSERT_TRUE(frame.Append(payload.data(), 16));
+        ASSERT_TRUE(frame.Append(payload.data() + 16, 1));
+        ASSERT_TRUE(frame.Append(payload.data() + 17, 583));
+
+        std::vector<BYTE> output(KissCodec::GetMaximumEncodedLength(frame.GetTotalLength()));
+        ULONG written;
+        ASSERT_TRUE(KissCodec::EncodeFrame(3, Kiss::COMMAND_DATA_FRAME, frame, output.data(), static_cast<ULONG>(output.size()), &written));
+        output.resize(written);
+
+        std::vector<BYTE> expected{ Kiss::FEND, Kiss::MakeTypeByte(3, Kiss::COMMAND_DATA_FRAME) };
+        std::vector<BYTE> escaped = escape(payload);
+        expected.insert(expected.end(), escaped.begin(), escaped.end());
+        expected.push_back(Kiss::FEND);
+        ASSERT_EQ(expected, output);
+
+        // Too small by one: the closing FEND does not fit
+        ULONG shortWritten;
+        ASSERT_FALSE(KissCodec::EncodeFrame(3, Kiss::COMMAND_DATA_FRAME, frame, output.data(), written - 1, &shortWritten));
+
+        KissDecoder decoder;
+        CountingHandler handler;
+        decoder.Decode(output.data(), written, handler);
+        ASSERT_EQ(1u, handler.frames);
+        ASSERT_EQ(payload.size(), handler.bytes);
+    });
+}
+
+// Measures escaping and decoding with each implementation. Payloads are mostly clean, as real traffic is,
+// with one special byte in every 1024 on average.
+TEST(KissCodec, ScanImplementationBenchmark)
+{
+    std::mt19937 random(10);
+    constexpr ULONG frameLength = KissDecoder::MAX_FRAME_LENGTH;
+    constexpr int frameCount = 512;
+    std::vector<std::vector<BYTE>> payloads;
+    for (int i = 0; i < frameCount; i++)
+    {
+        std::vector<BYTE> payload = cleanData(frameLength, random);
+        for (BYTE& value : payload)
+        {
+            if (random() % 1024 == 0)
+            {
+                value = Kiss::FEND;
+            }
+        }
+        payloads.push_back(payload);
+    }
+
+    constexpr int passes = 20;
+    std::vector<BYTE> stream(frameCount * KissCodec::GetMaximumEncodedLength(frameLength));
+    forEachImplementation([&](KissCodec::Implementation implementation)
+    {
+        ULONG streamLength = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            streamLength = 0;
+            for (std::vector<BYTE> const& payload : payloads)
+            {
+                FrameGatherList frame;
+                ASSERT_TRUE(frame.Append(payload.data(), frameLength));
+                ULONG written;
+                ASSERT_TRUE(KissCodec::EncodeFrame(0, Kiss::COMMAND_DATA_FRAME, frame,
+                    stream.data() + streamLength, static_cast<ULONG>(stream.size()) - streamLength, &written));
+                streamLength += written;
+            }
+        }
+        const double encodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        KissDecoder decoder;
+        CountingHandler handler;
+        constexpr ULONG readSize = 4096;
+        start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (ULONG offset = 0; offset < streamLength; offset += readSize)
+            {
+                decoder.Decode(stream.data() + offset, std::min(readSize, streamLength - offset), handler);
+            }
+        }
+        const double decodeSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        ASSERT_EQ(static_cast<ULONG>(frameCount * passes), handler.frames);
+
+        const double bytes = static_cast<double>(frameLength) * frameCount * passes;
+        const std::string name = implementationNames[implementation];
+        RecordProperty(name + "EncodeMegabytesPerSecond", static_cast<int>(bytes / encodeSeconds / 1e6));
+        RecordProperty(name + "DecodeMegabytesPerSecond", static_cast<int>(bytes / decodeSeconds / 1e6));
+    });
+}
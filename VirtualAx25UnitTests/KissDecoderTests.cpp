@@ -0,0 +1,251 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file KissDecoderTests.cpp
+ * Unit tests and benchmark for the Virtual AX.25 NDIS Driver KissDecoder class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "KissDecoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace
+{
+    /** A frame as seen by the handler */
+    struct DecodedFrame
+    {
+        BYTE port;
+        BYTE command;
+        std::vector<BYTE> data;
+        const BYTE* address;    //<! Where the handler saw the frame, to tell copied frames from direct ones
+    };
+
+    class CollectingHandler : public KissFrameHandler
+    {
+    public:
+        void KissFrameDecoded(BYTE port, BYTE command, const BYTE* frame, ULONG length) noexcept override
+        {
+            frames.push_back(DecodedFrame{ port, command, std::vector<BYTE>(frame, frame + length), frame });
+        }
+
+        std::vector<DecodedFrame> frames;
+    };
+
+    /** Builds the KISS encoding of a single data frame */
+    std::vector<BYTE> encode(BYTE port, std::vector<BYTE> const& payload)
+    {
+        std::vector<BYTE> result{ Kiss::FEND, Kiss::MakeTypeByte(port, Kiss::COMMAND_DATA_FRAME) };
+        for (BYTE value : payload)
+        {
+            if (value == Kiss::FEND)
+            {
+                result.push_back(Kiss::FESC);
+                result.push_back(Kiss::TFEND);
+            }
+            else if (value == Kiss::FESC)
+            {
+                result.push_back(Kiss::FESC);
+                result.push_back(Kiss::TFESC);
+            }
+            else
+            {
+                result.push_back(value);
+            }
+        }
+        result.push_back(Kiss::FEND);
+        return result;
+    }
+}
+
+TEST(KissDecoder, ContiguousFrameIsNotCopied)
+{
+    std::vector<BYTE> stream = encode(3, { 1, 2, 3, 4 });
+    KissDecoder decoder;
+    CollectingHandler handler;
+    decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(3, handler.frames[0].port);
+    EXPECT_EQ(Kiss::COMMAND_DATA_FRAME, handler.frames[0].command);
+    EXPECT_EQ(std::vector<BYTE>({ 1, 2, 3, 4 }), handler.frames[0].data);
+    EXPECT_EQ(stream.data() + 2, handler.frames[0].address);
+    EXPECT_EQ(1u, decoder.GetDirectFrameCount());
+    EXPECT_EQ(0u, decoder.GetBufferedFrameCount());
+}
+
+TEST(KissDecoder, EscapedBytes)
+{
+    std::vector<BYTE> payload = { Kiss::FEND, 0x55, Kiss::FESC, Kiss::TFEND, Kiss::TFESC, Kiss::FESC };
+    std::vector<BYTE> stream = encode(0, payload);
+    KissDecoder decoder;
+    CollectingHandler handler;
+    decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(payload, handler.frames[0].data);
+    EXPECT_EQ(1u, decoder.GetBufferedFrameCount());
+}
+
+TEST(KissDecoder, NoiseBeforeFirstFendAndEmptyFrames)
+{
+    std::vector<BYTE> stream = { 0x11, 0x22, Kiss::FESC, 0x33 };
+    for (BYTE value : encode(1, { 9, 8, 7 }))
+    {
+        stream.push_back(value);
+    }
+    stream.push_back(Kiss::FEND);
+    stream.push_back(Kiss::FEND);
+
+    KissDecoder decoder;
+    CollectingHandler handler;
+    decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(std::vector<BYTE>({ 9, 8, 7 }), handler.frames[0].data);
+}
+
+TEST(KissDecoder, EveryChunkBoundary)
+{
+    // A few frames back to back sharing FENDs, with escapes at the start, middle and end
+    std::vector<std::vector<BYTE>> payloads = {
+        { Kiss::FEND, 1, 2, 3 },
+        { 4, 5, Kiss::FESC, 6 },
+        { 7, 8, 9, Kiss::FEND },
+        { },
+        { 10 },
+    };
+    std::vector<BYTE> stream;
+    for (size_t i = 0; i < payloads.size(); i++)
+    {
+        std::vector<BYTE> encoded = encode(static_cast<BYTE>(i), payloads[i]);
+        stream.insert(stream.end(), encoded.begin() + (i == 0 ? 0 : 1), encoded.end());
+    }
+
+    // Split the stream into two and three pieces at every possible position
+    for (size_t first = 0; first <= stream.size(); first++)
+    {
+        for (size_t second = first; second <= stream.size(); second++)
+        {
+            KissDecoder decoder;
+            CollectingHandler handler;
+            decoder.Decode(stream.data(), static_cast<ULONG>(first), handler);
+            decoder.Decode(stream.data() + first, static_cast<ULONG>(second - first), handler);
+            decoder.Decode(stream.data() + second, static_cast<ULONG>(stream.size() - second), handler);
+
+            ASSERT_EQ(payloads.size(), handler.frames.size()) << "split at " << first << ", " << second;
+            for (size_t i = 0; i < payloads.size(); i++)
+            {
+                EXPECT_EQ(i, handler.frames[i].port);
+                EXPECT_EQ(payloads[i], handler.frames[i].data) << "split at " << first << ", " << second;
+            }
+        }
+    }
+}
+
+TEST(KissDecoder, InvalidEscapeDiscardsFrame)
+{
+    std::vector<BYTE> stream = { Kiss::FEND, 0x00, 1, Kiss::FESC, 0x42, 2, Kiss::FEND };
+    std::vector<BYTE> next = encode(0, { 3 });
+    stream.insert(stream.end(), next.begin() + 1, next.end());
+
+    KissDecoder decoder;
+    CollectingHandler handler;
+    decoder.Decode(stream.data(), static_cast<ULONG>(stream.size()), handler);
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(std::vector<BYTE>({ 3 }), handler.frames[0].data);
+    EXPECT_EQ(1u, decoder.GetDiscardedFrameCount());
+}
+
+TEST(KissDecoder, OversizedFrameIsDiscarded)
+{
+    std::vector<BYTE> stream = encode(0, std::vector<BYTE>(KissDecoder::MAX_FRAME_LENGTH + 1, 0x55));
+    std::vector<BYTE> next = encode(0, { 3 });
+    stream.insert(stream.end(), next.begin(), next.end());
+
+    // Byte at a time, so that the oversized frame has to be buffered
+    KissDecoder decoder;
+    CollectingHandler handler;
+    for (BYTE value : stream)
+    {
+        decoder.Decode(&value, 1, handler);
+    }
+    ASSERT_EQ(1u, handler.frames.size());
+    EXPECT_EQ(std::vector<BYTE>({ 3 }), handler.frames[0].data);
+    EXPECT_EQ(1u, decoder.GetDiscardedFrameCount());
+
+    // A maximum-length frame is still accepted
+    stream = encode(0, std::vector<BYTE>(KissDecoder::MAX_FRAME_LENGTH, 0x55));
+    for (BYTE value : stream)
+    {
+        decoder.Decode(&value, 1, handler);
+    }
+    EXPECT_EQ(2u, handler.frames.size());
+}
+
+/**
+ * Decodes a stream of random 256-byte frames (so roughly 1 byte in 128 needs escaping) read in
+ * 64-byte pieces, as a serial port would deliver them, and reports throughput against the
+ * fastest AX.25 link the adapter supports.
+ */
+TEST(KissDecoder, ThroughputBenchmark)
+{
+    std::mt19937 random(1200);
+    std::vector<BYTE> stream;
+    constexpr int frameCount = 4000;
+    for (int i = 0; i < frameCount; i++)
+    {
+        std::vector<BYTE> payload(256);
+        for (BYTE& value : payload)
+        {
+            value = static_cast<BYTE>(random());
+        }
+        std::vector<BYTE> encoded = encode(static_cast<BYTE>(i % Kiss::MAX_PORTS), payload);
+        stream.insert(stream.end(), encoded.begin(), encoded.end());
+    }
+
+    constexpr ULONG readSize = 64;
+    constexpr int passes = 20;
+    KissDecoder decoder;
+    CollectingHandler handler;
+    handler.frames.reserve(frameCount);
+    std::chrono::nanoseconds elapsed(0);
+    for (int pass = 0; pass < passes; pass++)
+    {
+        handler.frames.clear();
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t offset = 0; offset < stream.size(); offset += readSize)
+        {
+            ULONG length = static_cast<ULONG>(std::min<size_t>(readSize, stream.size() - offset));
+            decoder.Decode(stream.data() + offset, length, handler);
+        }
+        elapsed += std::chrono::high_resolution_clock::now() - start;
+        ASSERT_EQ(static_cast<size_t>(frameCount), handler.frames.size());
+    }
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const double bitsPerSecond = 8.0 * stream.size() * passes / seconds;
+    RecordProperty("MegabytesPerSecond", static_cast<int>(bitsPerSecond / 8 / 1e6));
+    RecordProperty("TimesFasterThan9600Baud", static_cast<int>(bitsPerSecond / 9600));
+    RecordProperty("DirectFrames", static_cast<int>(decoder.GetDirectFrameCount()));
+    RecordProperty("BufferedFrames", static_cast<int>(decoder.GetBufferedFrameCount()));
+    EXPECT_GT(bitsPerSecond, 100.0 * 9600);
+}
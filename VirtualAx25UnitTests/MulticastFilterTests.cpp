@@ -0,0 +1,163 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file MulticastFilterTests.cpp
+ * Unit tests and microbenchmark for the Virtual AX.25 NDIS Driver MulticastFilter class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "MulticastFilter.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /** Builds a list of IPv4 multicast group addresses (01-00-5e-xx-xx-xx) */
+    std::vector<BYTE> groups(ULONG first, ULONG count)
+    {
+        std::vector<BYTE> list;
+        for (ULONG i = first; i < first + count; i++)
+        {
+            list.insert(list.end(), { 0x01, 0x00, 0x5E, static_cast<BYTE>(i >> 16), static_cast<BYTE>(i >> 8), static_cast<BYTE>(i) });
+        }
+        return list;
+    }
+}
+
+TEST(MulticastFilter, EmptyFilterContainsNothing)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> group = groups(1, 1);
+    ASSERT_EQ(0u, filter->GetCount());
+    ASSERT_FALSE(filter->Contains(group.data()));
+}
+
+TEST(MulticastFilter, ContainsExactlyTheJoinedGroups)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> joined = groups(0, MulticastFilter::MAX_ADDRESSES);
+    ASSERT_TRUE(filter->SetAddresses(joined.data(), MulticastFilter::MAX_ADDRESSES));
+    ASSERT_EQ(MulticastFilter::MAX_ADDRESSES, filter->GetCount());
+
+    for (ULONG i = 0; i < MulticastFilter::MAX_ADDRESSES; i++)
+    {
+        ASSERT_TRUE(filter->Contains(joined.data() + i * MulticastFilter::ADDRESS_LENGTH)) << "group " << i;
+    }
+
+    // Groups which were not joined must all be rejected, whether or not their summary bit is set
+    std::vector<BYTE> others = groups(MulticastFilter::MAX_ADDRESSES, 4096);
+    for (ULONG i = 0; i < 4096; i++)
+    {
+        ASSERT_FALSE(filter->Contains(others.data() + i * MulticastFilter::ADDRESS_LENGTH)) << "group " << i;
+    }
+}
+
+TEST(MulticastFilter, SettingReplacesTheList)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> first = groups(0, 3);
+    std::vector<BYTE> second = groups(3, 2);
+    ASSERT_TRUE(filter->SetAddresses(first.data(), 3));
+    ASSERT_TRUE(filter->SetAddresses(second.data(), 2));
+    ASSERT_FALSE(filter->Contains(first.data()));
+    ASSERT_TRUE(filter->Contains(second.data()));
+
+    // Setting the same list twice in a row reuses the table which held the first list
+    ASSERT_TRUE(filter->SetAddresses(first.data(), 3));
+    ASSERT_TRUE(filter->Contains(first.data()));
+    ASSERT_FALSE(filter->Contains(second.data()));
+
+    ASSERT_TRUE(filter->SetAddresses(nullptr, 0));
+    ASSERT_FALSE(filter->Contains(first.data()));
+}
+
+TEST(MulticastFilter, QueryReturnsTheList)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> joined = groups(7, 3);
+
+    // A repeated group is only listed once
+    joined.insert(joined.end(), joined.begin(), joined.begin() + MulticastFilter::ADDRESS_LENGTH);
+    ASSERT_TRUE(filter->SetAddresses(joined.data(), 4));
+
+    std::vector<BYTE> buffer(4 * MulticastFilter::ADDRESS_LENGTH, 0xCC);
+    ASSERT_EQ(3 * MulticastFilter::ADDRESS_LENGTH, filter->GetAddresses(buffer.data(), 2 * MulticastFilter::ADDRESS_LENGTH));
+    ASSERT_EQ(0xCC, buffer[0]);
+    ASSERT_EQ(3 * MulticastFilter::ADDRESS_LENGTH, filter->GetAddresses(buffer.data(), static_cast<ULONG>(buffer.size())));
+    ASSERT_EQ(0, memcmp(joined.data(), buffer.data(), 3 * MulticastFilter::ADDRESS_LENGTH));
+}
+
+TEST(MulticastFilter, InvalidListsAreRejected)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> joined = groups(0, MulticastFilter::MAX_ADDRESSES + 1);
+    ASSERT_TRUE(filter->SetAddresses(joined.data(), 1));
+
+    ASSERT_FALSE(filter->SetAddresses(joined.data(), MulticastFilter::MAX_ADDRESSES + 1));
+
+    // Individual (unicast) addresses cannot be joined
+    joined[MulticastFilter::ADDRESS_LENGTH] = 0x02;
+    ASSERT_FALSE(filter->SetAddresses(joined.data(), 2));
+
+    // The previous list stays in place
+    ASSERT_EQ(1u, filter->GetCount());
+    ASSERT_TRUE(filter->Contains(joined.data()));
+}
+
+TEST(MulticastFilter, AddressClassification)
+{
+    const BYTE broadcast[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    const BYTE group[] = { 0x01, 0x00, 0x5E, 0xFF, 0xFF, 0xFF };
+    const BYTE station[] = { 0x02, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    ASSERT_TRUE(MulticastFilter::IsGroupAddress(broadcast));
+    ASSERT_TRUE(MulticastFilter::IsBroadcastAddress(broadcast));
+    ASSERT_TRUE(MulticastFilter::IsGroupAddress(group));
+    ASSERT_FALSE(MulticastFilter::IsBroadcastAddress(group));
+    ASSERT_FALSE(MulticastFilter::IsGroupAddress(station));
+    ASSERT_FALSE(MulticastFilter::IsBroadcastAddress(station));
+}
+
+// The cost of a lookup must not depend on how many groups are joined
+TEST(MulticastFilter, LookupBenchmark)
+{
+    std::unique_ptr<MulticastFilter> filter(new MulticastFilter());
+    std::vector<BYTE> probes = groups(0, 1024);
+    for (ULONG joinedCount : { 16u, MulticastFilter::MAX_ADDRESSES })
+    {
+        ASSERT_TRUE(filter->SetAddresses(probes.data(), joinedCount));
+
+        constexpr int passes = 2000;
+        ULONG found = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (ULONG i = 0; i < 1024; i++)
+            {
+                found += filter->Contains(probes.data() + i * MulticastFilter::ADDRESS_LENGTH) ? 1 : 0;
+            }
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        ASSERT_EQ(joinedCount * passes, found);
+        RecordProperty("NanosecondsPerLookupWith" + std::to_string(joinedCount) + "Groups",
+                       static_cast<int>(seconds * 1e9 / (1024.0 * passes)));
+    }
+}
@@ -0,0 +1,301 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file PayloadCompressorTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver PayloadCompressor class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "PayloadCompressor.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr BYTE PID_IPV4 = 0xCC;
+    constexpr ULONG MTU = 1500;
+
+    const char HTTP_RESPONSE[] =
+        "HTTP/1.1 200 OK\r\nServer: nginx\r\nContent-Type: text/html; charset=utf-8\r\nConnection: keep-alive\r\n"
+        "Cache-Control: no-cache\r\n\r\n<html><head><title>Net schedule</title></head><body><table>"
+        "<tr><td>Monday</td><td>19:00</td><td>146.520 MHz</td></tr>"
+        "<tr><td>Tuesday</td><td>19:00</td><td>146.520 MHz</td></tr>"
+        "<tr><td>Wednesday</td><td>19:30</td><td>145.010 MHz</td></tr>"
+        "<tr><td>Thursday</td><td>19:30</td><td>145.010 MHz</td></tr>"
+        "</table></body></html>\r\n";
+
+    const char TELEMETRY[] =
+        "T#001,199,000,255,073,123,01100001 KG7UDH-1>APRS,WIDE2-1:!4903.50N/07201.75W-Test 001\r\n"
+        "T#002,199,000,255,073,124,01100001 KG7UDH-1>APRS,WIDE2-1:!4903.50N/07201.75W-Test 002\r\n"
+        "T#003,198,000,255,074,124,01100001 KG7UDH-1>APRS,WIDE2-1:!4903.51N/07201.75W-Test 003\r\n";
+
+    const char JSON[] =
+        "{\"stations\":[{\"call\":\"KG7UDH-1\",\"lat\":49.0583,\"lon\":-72.0292,\"heard\":\"2016-05-01T19:00:00Z\"},"
+        "{\"call\":\"N0CALL-2\",\"lat\":49.0611,\"lon\":-72.0301,\"heard\":\"2016-05-01T19:00:05Z\"},"
+        "{\"call\":\"N0CALL-3\",\"lat\":49.0644,\"lon\":-72.0355,\"heard\":\"2016-05-01T19:00:12Z\"}]}";
+
+    std::vector<BYTE> makeDatagram(const char* text, ULONG length)
+    {
+        return std::vector<BYTE>(text, text + length);
+    }
+
+    std::vector<BYTE> makeRandomDatagram(ULONG length, ULONG seed)
+    {
+        std::mt19937 random(seed);
+        std::vector<BYTE> datagram(length);
+        for (BYTE& value : datagram)
+        {
+            value = static_cast<BYTE>(random());
+        }
+        return datagram;
+    }
+
+    /** @returns the information field Compress() produced for datagram, or an empty vector if it gave up */
+    std::vector<BYTE> compress(PayloadCompressor& compressor, const std::vector<BYTE>& datagram)
+    {
+        std::vector<BYTE> information(MTU);
+        const ULONG length = compressor.Compress(PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size()),
+            information.data(), static_cast<ULONG>(information.size()));
+        information.resize(length);
+        return information;
+    }
+
+    /** @returns the datagram restored from information, which must be well formed and carry PID_IPV4 */
+    std::vector<BYTE> decompress(const std::vector<BYTE>& information)
+    {
+        std::vector<BYTE> datagram(MTU);
+        BYTE pid = 0;
+        const ULONG length = PayloadCompressor::Decompress(information.data(), static_cast<ULONG>(information.size()),
+            pid, datagram.data(), static_cast<ULONG>(datagram.size()));
+        EXPECT_NE(0U, length);
+        EXPECT_EQ(PID_IPV4, pid);
+        datagram.resize(length);
+        return datagram;
+    }
+}
+
+/**
+ * Verifies that text comes back from compression as it went in, and shorter, with its PID
+ */
+TEST(PayloadCompressor, TextRoundTrips)
+{
+    PayloadCompressor compressor;
+    const char* texts[] = { HTTP_RESPONSE, TELEMETRY, JSON };
+    const ULONG lengths[] = { sizeof(HTTP_RESPONSE) - 1, sizeof(TELEMETRY) - 1, sizeof(JSON) - 1 };
+    ULONG64 bytesOut = 0;
+    for (size_t i = 0; i < 3; i++)
+    {
+        const std::vector<BYTE> datagram = makeDatagram(texts[i], lengths[i]);
+        const std::vector<BYTE> information = compress(compressor, datagram);
+        ASSERT_FALSE(information.empty());
+        EXPECT_LT(information.size(), datagram.size());
+        EXPECT_EQ(PID_IPV4, information[0]);
+        EXPECT_TRUE(datagram == decompress(information));
+        bytesOut += information.size();
+    }
+
+    const PayloadCompressor::Counters& counters = compressor.GetCounters();
+    EXPECT_EQ(3U, counters.Compressed);
+    EXPECT_EQ(0U, counters.Skipped);
+    EXPECT_EQ(lengths[0] + lengths[1] + lengths[2] + 3, counters.BytesIn);
+    EXPECT_EQ(bytesOut, counters.BytesOut);
+}
+
+/**
+ * Verifies that long runs, which need the long length byte and copies overlapping themselves, round trip
+ */
+TEST(PayloadCompressor, RunsRoundTrip)
+{
+    PayloadCompressor compressor;
+    std::vector<BYTE> datagram(MTU, 0);
+    for (ULONG i = 700; i < 900; i++)
+    {
+        datagram[i] = static_cast<BYTE>(i);
+    }
+
+    const std::vector<BYTE> information = compress(compressor, datagram);
+    ASSERT_FALSE(information.empty());
+    EXPECT_LT(information.size(), 300U);
+    EXPECT_TRUE(datagram == decompress(information));
+}
+
+/**
+ * Verifies that every datagram length from MIN_LENGTH to a few hundred bytes round trips, compressed or not
+ */
+TEST(PayloadCompressor, LengthsRoundTrip)
+{
+    PayloadCompressor compressor;
+    std::vector<BYTE> text = makeDatagram(HTTP_RESPONSE, sizeof(HTTP_RESPONSE) - 1);
+    for (ULONG length = PayloadCompressor::MIN_LENGTH; length <= text.size(); length++)
+    {
+        const std::vector<BYTE> datagram(text.begin(), text.begin() + length);
+        const std::vector<BYTE> information = compress(compressor, datagram);
+        if (!information.empty())
+        {
+            EXPECT_LT(information.size(), datagram.size());
+            EXPECT_TRUE(datagram == decompress(information)) << "Length " << length;
+        }
+    }
+    EXPECT_NE(0U, compressor.GetCounters().Compressed);
+}
+
+/**
+ * Verifies that datagrams too short to be worth it, and random ones, are sent as they are
+ */
+TEST(PayloadCompressor, SkipsShortAndIncompressibleDatagrams)
+{
+    PayloadCompressor compressor;
+    const std::vector<BYTE> zeroes(PayloadCompressor::MIN_LENGTH - 1, 0);
+    EXPECT_TRUE(compress(compressor, zeroes).empty());
+    EXPECT_TRUE(compress(compressor, makeRandomDatagram(MTU, 1)).empty());
+    EXPECT_TRUE(compress(compressor, makeRandomDatagram(100, 2)).empty());
+
+    // Nor is a datagram which would not fit the output compressed
+    const std::vector<BYTE> text = makeDatagram(JSON, sizeof(JSON) - 1);
+    std::vector<BYTE> information(16);
+    EXPECT_EQ(0U, compressor.Compress(PID_IPV4, text.data(), static_cast<ULONG>(text.size()),
+        information.data(), static_cast<ULONG>(information.size())));
+
+    const PayloadCompressor::Counters& counters = compressor.GetCounters();
+    EXPECT_EQ(0U, counters.Compressed);
+    EXPECT_EQ(4U, counters.Skipped);
+    EXPECT_EQ(0U, counters.BytesIn);
+}
+
+/**
+ * Verifies that malformed information fields, and datagrams longer than the capacity, are rejected
+ */
+TEST(PayloadCompressor, RejectsMalformedInformation)
+{
+    PayloadCompressor compressor;
+    const std::vector<BYTE> datagram = makeDatagram(TELEMETRY, sizeof(TELEMETRY) - 1);
+    const std::vector<BYTE> information = compress(compressor, datagram);
+    ASSERT_FALSE(information.empty());
+
+    std::vector<BYTE> output(MTU);
+    BYTE pid = 0xFF;
+    auto decompressInto = [&](const std::vector<BYTE>& input, ULONG capacity)
+    {
+        return PayloadCompressor::Decompress(input.data(), static_cast<ULONG>(input.size()), pid,
+            output.data(), capacity);
+    };
+
+    // Every truncation leaves a literal run or a copy unfinished, or ends in the middle of the PID
+    for (size_t length = 0; length < information.size(); length++)
+    {
+        const std::vector<BYTE> truncated(information.begin(), information.begin() + length);
+        const ULONG restored = decompressInto(truncated, MTU);
+        if (restored != 0)
+        {
+            // A cut between two steps is well formed, and must give a prefix of the datagram
+            EXPECT_TRUE(std::equal(output.begin(), output.begin() + restored, datagram.begin()));
+        }
+    }
+
+    EXPECT_EQ(0U, decompressInto(std::vector<BYTE>(), MTU));
+    EXPECT_EQ(0U, decompressInto(std::vector<BYTE>{ PID_IPV4 }, MTU));
+    EXPECT_EQ(0U, pid);
+
+    // A copy from before the start of the datagram
+    EXPECT_EQ(0U, decompressInto(std::vector<BYTE>{ PID_IPV4, 0x00, 'A', 0x20, 0x01 }, MTU));
+
+    // A literal run longer than what follows it
+    EXPECT_EQ(0U, decompressInto(std::vector<BYTE>{ PID_IPV4, 0x05, 'A', 'B' }, MTU));
+
+    // A long copy missing its length byte
+    EXPECT_EQ(0U, decompressInto(std::vector<BYTE>{ PID_IPV4, 0x00, 'A', 0xE0 }, MTU));
+
+    // The whole datagram, but one byte short of room
+    EXPECT_EQ(0U, decompressInto(information, static_cast<ULONG>(datagram.size()) - 1));
+    EXPECT_EQ(datagram.size(), decompressInto(information, static_cast<ULONG>(datagram.size())));
+    EXPECT_EQ(PID_IPV4, pid);
+}
+
+/**
+ * Measures, for sample traffic, how much faster a 1200 baud link carries it compressed and what the
+ * compression costs in CPU time
+ */
+TEST(PayloadCompressor, Benchmark)
+{
+    struct Workload
+    {
+        const char* name;
+        std::vector<BYTE> datagram;
+    };
+    const Workload workloads[] = {
+        { "Http", makeDatagram(HTTP_RESPONSE, sizeof(HTTP_RESPONSE) - 1) },
+        { "Telemetry", makeDatagram(TELEMETRY, sizeof(TELEMETRY) - 1) },
+        { "Json", makeDatagram(JSON, sizeof(JSON) - 1) },
+        { "Random", makeRandomDatagram(MTU, 3) },
+    };
+
+    constexpr ULONG FRAME_OVERHEAD = 2 * 7 + 2 + 2 + 2;     // Addresses, control and PID, FCS and flags
+    constexpr double AIRTIME_MICROSECONDS_PER_BYTE = 8 * 1e6 / 1200;
+    constexpr int passes = 20000;
+    for (const Workload& workload : workloads)
+    {
+        PayloadCompressor compressor;
+        std::vector<BYTE> information(MTU);
+        const ULONG length = static_cast<ULONG>(workload.datagram.size());
+        ULONG compressedLength = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            compressedLength = compressor.Compress(PID_IPV4, workload.datagram.data(), length,
+                information.data(), MTU);
+        }
+        const double compressSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        std::vector<BYTE> restored(MTU);
+        double decompressSeconds = 0;
+        if (compressedLength != 0)
+        {
+            BYTE pid;
+            start = std::chrono::high_resolution_clock::now();
+            for (int pass = 0; pass < passes; pass++)
+            {
+                ASSERT_EQ(length, PayloadCompressor::Decompress(information.data(), compressedLength, pid,
+                    restored.data(), MTU));
+            }
+            decompressSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            ASSERT_TRUE(std::equal(workload.datagram.begin(), workload.datagram.end(), restored.begin()));
+        }
+
+        // A skipped datagram goes as it is, and costs only the time taken to give up on it
+        const ULONG sentLength = (compressedLength != 0) ? compressedLength : length + 1;
+        const double plainAirtime = (length + 1 + FRAME_OVERHEAD) * AIRTIME_MICROSECONDS_PER_BYTE;
+        const double compressedAirtime = (sentLength + FRAME_OVERHEAD) * AIRTIME_MICROSECONDS_PER_BYTE;
+        const double microsecondsPerKilobyte = compressSeconds * 1e6 / passes / length * 1024;
+        EXPECT_LT(microsecondsPerKilobyte, AIRTIME_MICROSECONDS_PER_BYTE * 1024 / 100);
+
+        const std::string name = workload.name;
+        RecordProperty(name + "CompressedPercent", static_cast<int>(100 * sentLength / (length + 1)));
+        RecordProperty(name + "ThroughputGainPercent", static_cast<int>(100 * plainAirtime / compressedAirtime) - 100);
+        RecordProperty(name + "CompressMicrosecondsPerKilobyte", static_cast<int>(microsecondsPerKilobyte));
+        RecordProperty(name + "CompressMegabytesPerSecond", static_cast<int>(length * passes / compressSeconds / 1e6));
+        if (compressedLength != 0)
+        {
+            RecordProperty(name + "DecompressMegabytesPerSecond",
+                           static_cast<int>(length * passes / decompressSeconds / 1e6));
+        }
+    }
+}
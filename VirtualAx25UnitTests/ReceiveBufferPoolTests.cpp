@@ -0,0 +1,235 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveBufferPoolTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver ReceiveBufferPool class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "ReceiveBufferPool.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
+class ReceiveBufferPoolFixture : public testing::Test
+{
+protected:
+    static constexpr ULONG BUFFER_COUNT = 16;
+    static constexpr ULONG BUFFER_SIZE = 526;
+
+    ReceiveBufferPoolFixture() :
+        dataBlock(BUFFER_COUNT * BUFFER_SIZE)
+    {
+        KernelMockData::NdisAllocateNetBufferListPool_Result = POOL_HANDLE;
+        KernelMockData::NdisAllocateMemoryWithTagPriority_Result = dataBlock.data();
+    }
+
+    ~ReceiveBufferPoolFixture()
+    {
+        if (pool.IsFull())
+        {
+            pool.Free();
+        }
+    }
+
+    static constexpr void* DRIVER_HANDLE = reinterpret_cast<void*>(0x10203040A0B0C0D0ULL);
+    static constexpr void* POOL_HANDLE = reinterpret_cast<void*>(0x5060708090A0B0C0ULL);
+    std::vector<BYTE> dataBlock;
+    ReceiveBufferPool pool;
+};
+
+TEST_F(ReceiveBufferPoolFixture, AllocatesEveryBuffer)
+{
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, pool.Allocate(DRIVER_HANDLE, BUFFER_COUNT, BUFFER_SIZE));
+    EXPECT_EQ(BUFFER_COUNT, pool.GetCapacity());
+    EXPECT_EQ(BUFFER_SIZE, pool.GetBufferSize());
+    EXPECT_EQ(static_cast<LONG>(BUFFER_COUNT), pool.GetAvailableCount());
+    EXPECT_EQ(BUFFER_COUNT * BUFFER_SIZE, KernelMockData::NdisAllocateMemoryWithTagPriority_Arguments.Length);
+    EXPECT_TRUE(KernelMockData::NdisAllocateNetBufferListPool_Arguments.Parameters->fAllocateNetBuffer);
+
+    // Every buffer gets its own slice of the data block, described by its MDL
+    std::set<BYTE*> seen;
+    std::vector<NET_BUFFER_LIST*> taken;
+    for (ULONG i = 0; i < BUFFER_COUNT; i++)
+    {
+        NET_BUFFER_LIST* netBufferList = pool.Take();
+        ASSERT_NE(nullptr, netBufferList);
+        BYTE* data = ReceiveBufferPool::GetData(*netBufferList);
+        EXPECT_GE(data, dataBlock.data());
+        EXPECT_LE(data + BUFFER_SIZE, dataBlock.data() + dataBlock.size());
+        EXPECT_EQ(data, NET_BUFFER_CURRENT_MDL(NET_BUFFER_LIST_FIRST_NB(netBufferList))->MappedSystemVa);
+        EXPECT_EQ(DRIVER_HANDLE, netBufferList->SourceHandle);
+        EXPECT_EQ(nullptr, NET_BUFFER_LIST_NEXT_NBL(netBufferList));
+        EXPECT_TRUE(seen.insert(data).second);
+        taken.push_back(netBufferList);
+    }
+
+    for (NET_BUFFER_LIST* netBufferList : taken)
+    {
+        pool.Return(*netBufferList);
+    }
+}
+
+TEST_F(ReceiveBufferPoolFixture, AllocationFailure)
+{
+    KernelMockData::NdisAllocateMemoryWithTagPriority_Result = nullptr;
+    KernelMockData::NdisFreeNetBufferListPool_CallCount = 0;
+    EXPECT_EQ(NDIS_STATUS_RESOURCES, pool.Allocate(DRIVER_HANDLE, BUFFER_COUNT, BUFFER_SIZE));
+    EXPECT_EQ(0u, pool.GetCapacity());
+    EXPECT_EQ(1, KernelMockData::NdisFreeNetBufferListPool_CallCount);
+    EXPECT_EQ(nullptr, pool.Take());
+}
+
+TEST_F(ReceiveBufferPoolFixture, ExhaustionAndWatermarks)
+{
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, pool.Allocate(DRIVER_HANDLE, BUFFER_COUNT, BUFFER_SIZE));
+
+    std::vector<NET_BUFFER_LIST*> taken;
+    while (!pool.IsLow())
+    {
+        taken.push_back(pool.Take());
+    }
+    EXPECT_EQ(BUFFER_COUNT - BUFFER_COUNT / ReceiveBufferPool::LOW_WATER_DIVISOR, taken.size());
+
+    for (NET_BUFFER_LIST* netBufferList = pool.Take(); netBufferList != nullptr; netBufferList = pool.Take())
+    {
+        taken.push_back(netBufferList);
+    }
+    EXPECT_EQ(BUFFER_COUNT, taken.size());
+    EXPECT_EQ(1, pool.GetExhaustedCount());
+    EXPECT_EQ(nullptr, pool.Take());
+    EXPECT_EQ(2, pool.GetExhaustedCount());
+
+    // Return everything as one NDIS chain, then half of it again individually
+    for (size_t i = 0; i + 1 < BUFFER_COUNT / 2; i++)
+    {
+        NET_BUFFER_LIST_NEXT_NBL(taken[i]) = taken[i + 1];
+    }
+    pool.Return(*taken[0]);
+    for (size_t i = BUFFER_COUNT / 2; i < BUFFER_COUNT; i++)
+    {
+        pool.Return(*taken[i]);
+    }
+
+    EXPECT_TRUE(pool.IsFull());
+    EXPECT_EQ(0, pool.GetLowWaterMark());
+    EXPECT_EQ(static_cast<LONG>(BUFFER_COUNT), pool.GetHighWaterMark());
+
+    // Everything returned can be taken again
+    taken.clear();
+    for (NET_BUFFER_LIST* netBufferList = pool.Take(); netBufferList != nullptr; netBufferList = pool.Take())
+    {
+        EXPECT_EQ(nullptr, NET_BUFFER_LIST_NEXT_NBL(netBufferList));
+        taken.push_back(netBufferList);
+    }
+    EXPECT_EQ(BUFFER_COUNT, taken.size());
+    for (NET_BUFFER_LIST* netBufferList : taken)
+    {
+        pool.Return(*netBufferList);
+    }
+}
+
+TEST_F(ReceiveBufferPoolFixture, ReusedBuffersStartAfresh)
+{
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, pool.Allocate(DRIVER_HANDLE, 1, BUFFER_SIZE));
+
+    // A buffer comes back with its data moved, as if a protocol had retreated into it and trimmed it
+    NET_BUFFER_LIST* netBufferList = pool.Take();
+    ASSERT_NE(nullptr, netBufferList);
+    NET_BUFFER* netBuffer = NET_BUFFER_LIST_FIRST_NB(netBufferList);
+    MDL* firstMdl = NET_BUFFER_FIRST_MDL(netBuffer);
+    MDL otherMdl = {};
+    NET_BUFFER_CURRENT_MDL(netBuffer) = &otherMdl;
+    NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer) = 20;
+    NET_BUFFER_DATA_OFFSET(netBuffer) = 20;
+    NET_BUFFER_DATA_LENGTH(netBuffer) = 60;
+    pool.Return(*netBufferList);
+
+    ASSERT_EQ(netBufferList, pool.Take());
+    EXPECT_EQ(firstMdl, NET_BUFFER_CURRENT_MDL(netBuffer));
+    EXPECT_EQ(0u, NET_BUFFER_CURRENT_MDL_OFFSET(netBuffer));
+    EXPECT_EQ(0u, NET_BUFFER_DATA_OFFSET(netBuffer));
+    EXPECT_EQ(BUFFER_SIZE, NET_BUFFER_DATA_LENGTH(netBuffer));
+    pool.Return(*netBufferList);
+}
+
+TEST_F(ReceiveBufferPoolFixture, ConcurrentReturns)
+{
+    ASSERT_EQ(NDIS_STATUS_SUCCESS, pool.Allocate(DRIVER_HANDLE, BUFFER_COUNT, BUFFER_SIZE));
+    constexpr int rounds = 1000;
+    constexpr int returnerCount = 4;
+
+    // Each round, the buffers held by the consumer are split between several threads which return them
+    // one at a time, while the consumer keeps taking whatever has already come back
+    std::vector<NET_BUFFER_LIST*> held;
+    int taken = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        for (NET_BUFFER_LIST* netBufferList = pool.Take(); netBufferList != nullptr; netBufferList = pool.Take())
+        {
+            held.push_back(netBufferList);
+        }
+
+        std::vector<std::vector<NET_BUFFER_LIST*>> shares(returnerCount);
+        for (size_t i = 0; i < held.size(); i++)
+        {
+            shares[i % returnerCount].push_back(held[i]);
+        }
+        held.clear();
+
+        std::vector<std::thread> returners;
+        for (auto& share : shares)
+        {
+            returners.emplace_back([&share, this]()
+            {
+                for (NET_BUFFER_LIST* netBufferList : share)
+                {
+                    pool.Return(*netBufferList);
+                }
+            });
+        }
+
+        for (int attempt = 0; attempt < 64; attempt++)
+        {
+            NET_BUFFER_LIST* netBufferList = pool.Take();
+            if (netBufferList != nullptr)
+            {
+                held.push_back(netBufferList);
+                taken++;
+            }
+        }
+
+        for (std::thread& returner : returners)
+        {
+            returner.join();
+        }
+    }
+
+    for (NET_BUFFER_LIST* netBufferList : held)
+    {
+        pool.Return(*netBufferList);
+    }
+
+    EXPECT_TRUE(pool.IsFull());
+    EXPECT_EQ(BUFFER_COUNT, pool.GetCapacity());
+    RecordProperty("BuffersTakenDuringReturns", taken);
+    RecordProperty("HighWaterMark", pool.GetHighWaterMark());
+    RecordProperty("TimesExhausted", pool.GetExhaustedCount());
+}
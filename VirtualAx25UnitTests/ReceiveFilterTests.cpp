@@ -0,0 +1,208 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveFilterTests.cpp
+ * Unit tests and microbenchmark for the Virtual AX.25 NDIS Driver ReceiveFilter class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "ReceiveFilter.h"
+
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const BYTE LOCAL[] = { 0x02, 0x4D, 0x1E, 0x54, 0x42, 0x00 };
+    const BYTE OTHER_STATION[] = { 0x02, 0x4D, 0x1E, 0x54, 0x42, 0x10 };
+    const BYTE BROADCAST[] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    const BYTE JOINED_GROUP[] = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB };
+    const BYTE OTHER_GROUP[] = { 0x01, 0x00, 0x5E, 0x00, 0x00, 0x01 };
+
+    ULONG64 pack(const BYTE* address)
+    {
+        ULONG64 packed = 0;
+        memcpy(&packed, address, 6);
+        return packed;
+    }
+
+    /**
+     * The filter as the NDIS documentation describes it: one test per bit, for every frame. This does the same
+     * address comparisons as ReceiveFilter, so only the mode tests differ.
+     */
+    bool reference(ULONG packetFilter, const MulticastFilter& groups, const BYTE* destination)
+    {
+        if (packetFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            return true;
+        }
+
+        const ULONG64 address = pack(destination);
+        if ((destination[0] & 0x01) == 0)
+        {
+            return (packetFilter & NDIS_PACKET_TYPE_DIRECTED) != 0 && address == pack(LOCAL);
+        }
+        if (address == pack(BROADCAST))
+        {
+            return (packetFilter & NDIS_PACKET_TYPE_BROADCAST) != 0;
+        }
+        return (packetFilter & NDIS_PACKET_TYPE_ALL_MULTICAST) != 0 ||
+               ((packetFilter & NDIS_PACKET_TYPE_MULTICAST) != 0 && groups.Contains(destination));
+    }
+
+    /** The reference as the adapter would have to use it: the filter is shared, so it is read for every frame */
+    struct ReferenceFilter
+    {
+        volatile ULONG packetFilter;
+        const MulticastFilter& groups;
+    };
+
+    bool referenceAccept(const ReferenceFilter& filter, const BYTE* destination)
+    {
+        return reference(filter.packetFilter, filter.groups, destination);
+    }
+
+    /** Called through a pointer so that, like ReceiveFilter::Accept, it is not inlined into the loop */
+    bool (* volatile referenceFunction)(const ReferenceFilter&, const BYTE*) = &referenceAccept;
+
+    /** The packet filter made of the bits of index, in the order of ReceiveFilter's modes */
+    ULONG packetFilterFromIndex(ULONG index)
+    {
+        const ULONG bits[] = { NDIS_PACKET_TYPE_DIRECTED, NDIS_PACKET_TYPE_MULTICAST, NDIS_PACKET_TYPE_ALL_MULTICAST,
+                               NDIS_PACKET_TYPE_BROADCAST, NDIS_PACKET_TYPE_PROMISCUOUS };
+        ULONG packetFilter = 0;
+        for (ULONG bit = 0; bit < 5; bit++)
+        {
+            packetFilter |= (index & (1 << bit)) ? bits[bit] : 0;
+        }
+        return packetFilter;
+    }
+
+    class ReceiveFilterFixture : public ::testing::Test
+    {
+    protected:
+        void SetUp() override
+        {
+            groups.reset(new MulticastFilter());
+            ASSERT_TRUE(groups->SetAddresses(JOINED_GROUP, 1));
+            filter.reset(new ReceiveFilter(*groups));
+            filter->SetLocalAddress(LOCAL);
+        }
+
+        std::unique_ptr<MulticastFilter> groups;
+        std::unique_ptr<ReceiveFilter> filter;
+    };
+}
+
+TEST_F(ReceiveFilterFixture, RejectsEverythingUntilFilterIsSet)
+{
+    for (const BYTE* destination : { LOCAL, BROADCAST, JOINED_GROUP })
+    {
+        ASSERT_FALSE(filter->Accept(destination));
+    }
+    ASSERT_EQ(0u, filter->GetPacketFilter());
+}
+
+// Every combination of modes must agree with the bit-by-bit reference for every kind of destination
+TEST_F(ReceiveFilterFixture, EveryModeMatchesReference)
+{
+    const BYTE* destinations[] = { LOCAL, OTHER_STATION, BROADCAST, JOINED_GROUP, OTHER_GROUP };
+    for (ULONG index = 0; index < 32; index++)
+    {
+        const ULONG packetFilter = packetFilterFromIndex(index);
+        ASSERT_TRUE(filter->SetPacketFilter(packetFilter));
+        ASSERT_EQ(packetFilter, filter->GetPacketFilter());
+        for (ULONG i = 0; i < 5; i++)
+        {
+            ASSERT_EQ(reference(packetFilter, *groups, destinations[i]), filter->Accept(destinations[i]))
+                << "filter " << std::hex << packetFilter << ", destination " << i;
+        }
+    }
+}
+
+TEST_F(ReceiveFilterFixture, UnsupportedFiltersAreRejected)
+{
+    ASSERT_TRUE(filter->SetPacketFilter(NDIS_PACKET_TYPE_DIRECTED));
+    ASSERT_FALSE(filter->SetPacketFilter(NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_SOURCE_ROUTING));
+    ASSERT_EQ(static_cast<ULONG>(NDIS_PACKET_TYPE_DIRECTED), filter->GetPacketFilter());
+    ASSERT_TRUE(filter->Accept(LOCAL));
+}
+
+// Compares the specialized filters with the bit-by-bit reference on a realistic mix of traffic: mostly frames
+// for other stations (as heard on a shared channel), some for us, and a few broadcasts and groups
+TEST_F(ReceiveFilterFixture, ModeBenchmark)
+{
+    std::mt19937 random(10);
+    const BYTE* kinds[] = { OTHER_STATION, OTHER_STATION, OTHER_STATION, LOCAL, LOCAL, BROADCAST, JOINED_GROUP, OTHER_GROUP };
+    std::vector<const BYTE*> traffic(4096);
+    for (const BYTE*& destination : traffic)
+    {
+        destination = kinds[random() % 8];
+    }
+
+    const struct
+    {
+        const char* name;
+        ULONG packetFilter;
+    } modes[] = {
+        { "Directed", NDIS_PACKET_TYPE_DIRECTED },
+        { "DirectedBroadcast", NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_BROADCAST },
+        { "DirectedMulticastBroadcast", NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_MULTICAST | NDIS_PACKET_TYPE_BROADCAST },
+        { "AllMulticast", NDIS_PACKET_TYPE_DIRECTED | NDIS_PACKET_TYPE_ALL_MULTICAST | NDIS_PACKET_TYPE_BROADCAST },
+        { "Promiscuous", NDIS_PACKET_TYPE_PROMISCUOUS },
+    };
+
+    constexpr int passes = 500;
+    const double frames = static_cast<double>(traffic.size()) * passes;
+    for (auto const& mode : modes)
+    {
+        ASSERT_TRUE(filter->SetPacketFilter(mode.packetFilter));
+
+        ULONG accepted = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (const BYTE* destination : traffic)
+            {
+                accepted += filter->Accept(destination) ? 1 : 0;
+            }
+        }
+        const double specializedSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        ReferenceFilter referenceFilter{ mode.packetFilter, *groups };
+        auto* const call = referenceFunction;
+        ULONG expected = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (const BYTE* destination : traffic)
+            {
+                expected += call(referenceFilter, destination) ? 1 : 0;
+            }
+        }
+        const double referenceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        ASSERT_EQ(expected, accepted) << mode.name;
+
+        RecordProperty(std::string(mode.name) + "SpecializedMillionFramesPerSecond", static_cast<int>(frames / specializedSeconds / 1e6));
+        RecordProperty(std::string(mode.name) + "ReferenceMillionFramesPerSecond", static_cast<int>(frames / referenceSeconds / 1e6));
+    }
+}
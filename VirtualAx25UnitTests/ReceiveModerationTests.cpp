@@ -0,0 +1,228 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file ReceiveModerationTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver ReceiveModeration class
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "ReceiveModeration.h"
+
+#include <limits>
+
+namespace
+{
+    constexpr ULONG MAXIMUM_THRESHOLD = 64;
+
+    /**
+     * Replays frame arrivals against the moderation policy on a simulated clock, with the receive DPC running a
+     * fixed time after it is queued, as the adapter's ReceiveFrame and receive DPC would
+     */
+    class ReceivePathSimulation
+    {
+    public:
+        explicit ReceivePathSimulation(ReceiveModeration& moderation, double dpcLatencyMicroseconds)
+            :moderation(moderation)
+            ,dpcLatency(dpcLatencyMicroseconds)
+            ,timerDue(NEVER)
+            ,dpcDue(NEVER)
+            ,queued(0)
+        {
+        }
+
+        void FrameArrives(double now)
+        {
+            runUntil(now);
+            const bool queueWasEmpty = queued == 0;
+            queued++;
+            switch (moderation.FrameQueued(queueWasEmpty))
+            {
+            case ReceiveModeration::IndicateNow:
+                timerDue = NEVER;
+                queueDpc(now);
+                break;
+
+            case ReceiveModeration::ArmTimer:
+                timerDue = now + moderation.GetTimeoutMicroseconds();
+                break;
+
+            case ReceiveModeration::Wait:
+                break;
+            }
+        }
+
+        void Finish() { runUntil(std::numeric_limits<double>::max()); }
+
+    private:
+        static constexpr double NEVER = std::numeric_limits<double>::infinity();
+
+        void queueDpc(double now)
+        {
+            if (dpcDue == NEVER)
+            {
+                dpcDue = now + dpcLatency;
+            }
+        }
+
+        void runUntil(double now)
+        {
+            while (timerDue <= now || dpcDue <= now)
+            {
+                if (timerDue <= dpcDue)
+                {
+                    const double expired = timerDue;
+                    timerDue = NEVER;
+                    queueDpc(expired);
+                }
+                else
+                {
+                    dpcDue = NEVER;
+                    moderation.DpcStarted();
+                    moderation.FramesIndicated(queued);
+                    queued = 0;
+                }
+            }
+        }
+
+        ReceiveModeration& moderation;
+        const double dpcLatency;
+        double timerDue;
+        double dpcDue;
+        ULONG queued;
+    };
+}
+
+TEST(ReceiveModeration, DisabledSchedulesDpcForFirstFrameOnly)
+{
+    ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+    ASSERT_FALSE(moderation.IsEnabled());
+    EXPECT_EQ(ReceiveModeration::IndicateNow, moderation.FrameQueued(true));
+    EXPECT_EQ(ReceiveModeration::Wait, moderation.FrameQueued(false));
+}
+
+TEST(ReceiveModeration, FirstFrameArmsTimerAndThresholdIndicates)
+{
+    ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+    ASSERT_TRUE(moderation.SetParameters(4, 500));
+    moderation.SetEnabled(true);
+
+    // Whether the queue was empty no longer matters: the count of waiting frames decides
+    EXPECT_EQ(ReceiveModeration::ArmTimer, moderation.FrameQueued(true));
+    EXPECT_EQ(ReceiveModeration::Wait, moderation.FrameQueued(false));
+    EXPECT_EQ(ReceiveModeration::Wait, moderation.FrameQueued(false));
+    EXPECT_EQ(ReceiveModeration::IndicateNow, moderation.FrameQueued(false));
+
+    // The DPC is already queued for anything beyond the threshold
+    EXPECT_EQ(ReceiveModeration::Wait, moderation.FrameQueued(false));
+
+    // Once the DPC starts, the next frame begins a new run
+    moderation.DpcStarted();
+    EXPECT_EQ(ReceiveModeration::ArmTimer, moderation.FrameQueued(true));
+}
+
+TEST(ReceiveModeration, ThresholdOfOneIndicatesEveryRun)
+{
+    ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+    ASSERT_TRUE(moderation.SetParameters(1, 500));
+    moderation.SetEnabled(true);
+    EXPECT_EQ(ReceiveModeration::IndicateNow, moderation.FrameQueued(true));
+    EXPECT_EQ(ReceiveModeration::Wait, moderation.FrameQueued(false));
+}
+
+TEST(ReceiveModeration, ParametersAreRangeChecked)
+{
+    ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+    ASSERT_TRUE(moderation.SetParameters(8, 1000));
+    EXPECT_FALSE(moderation.SetParameters(0, 1000));
+    EXPECT_FALSE(moderation.SetParameters(MAXIMUM_THRESHOLD + 1, 1000));
+    EXPECT_FALSE(moderation.SetParameters(8, ReceiveModeration::MIN_TIMEOUT_MICROSECONDS - 1));
+    EXPECT_FALSE(moderation.SetParameters(8, ReceiveModeration::MAX_TIMEOUT_MICROSECONDS + 1));
+    EXPECT_EQ(8u, moderation.GetFrameThreshold());
+    EXPECT_EQ(1000u, moderation.GetTimeoutMicroseconds());
+
+    EXPECT_TRUE(moderation.SetParameters(MAXIMUM_THRESHOLD, ReceiveModeration::MAX_TIMEOUT_MICROSECONDS));
+}
+
+TEST(ReceiveModeration, StatisticsReportCoalescingRatio)
+{
+    ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+    ASSERT_TRUE(moderation.SetParameters(4, 200));
+    moderation.SetEnabled(true);
+
+    AX25_RECEIVE_MODERATION statistics;
+    moderation.GetStatistics(statistics);
+    EXPECT_EQ(0u, statistics.FramesPerHundredDpcs);
+
+    const ULONG runs[] = { 4, 4, 2 };
+    for (ULONG frames : runs)
+    {
+        moderation.DpcStarted();
+        moderation.FramesIndicated(frames);
+    }
+
+    moderation.GetStatistics(statistics);
+    EXPECT_EQ(1u, statistics.Enabled);
+    EXPECT_EQ(4u, statistics.FrameThreshold);
+    EXPECT_EQ(200u, statistics.TimeoutMicroseconds);
+    EXPECT_EQ(10u, statistics.FramesIndicated);
+    EXPECT_EQ(3u, statistics.DpcRuns);
+    EXPECT_EQ(333u, statistics.FramesPerHundredDpcs);
+}
+
+// Bursts of frames, as a TNC delivers a window of I frames, cost one DPC per frame without moderation. With it,
+// each burst costs one DPC, and a lone frame still goes up after at most the timeout.
+TEST(ReceiveModeration, CoalescesBurstsInSimulation)
+{
+    constexpr int BURSTS = 100;
+    constexpr int FRAMES_PER_BURST = 8;
+    constexpr double FRAME_SPACING = 100.0;     // microseconds between frames in a burst
+    constexpr double BURST_SPACING = 10000.0;   // microseconds between bursts
+    constexpr double DPC_LATENCY = 10.0;
+
+    ULONG64 framesPerHundredDpcs[2] = {};
+    for (int enabled = 0; enabled < 2; enabled++)
+    {
+        ReceiveModeration moderation(MAXIMUM_THRESHOLD);
+        ASSERT_TRUE(moderation.SetParameters(FRAMES_PER_BURST, 1000));
+        moderation.SetEnabled(enabled != 0);
+
+        ReceivePathSimulation simulation(moderation, DPC_LATENCY);
+        for (int burst = 0; burst < BURSTS; burst++)
+        {
+            for (int frame = 0; frame < FRAMES_PER_BURST; frame++)
+            {
+                simulation.FrameArrives(burst * BURST_SPACING + frame * FRAME_SPACING);
+            }
+        }
+
+        // A final lone frame is picked up by the timer
+        simulation.FrameArrives(BURSTS * BURST_SPACING);
+        simulation.Finish();
+
+        AX25_RECEIVE_MODERATION statistics;
+        moderation.GetStatistics(statistics);
+        ASSERT_EQ(static_cast<ULONG64>(BURSTS * FRAMES_PER_BURST + 1), statistics.FramesIndicated);
+        framesPerHundredDpcs[enabled] = statistics.FramesPerHundredDpcs;
+    }
+
+    EXPECT_EQ(100u, framesPerHundredDpcs[0]);
+    EXPECT_GE(framesPerHundredDpcs[1], 4 * framesPerHundredDpcs[0]);
+    RecordProperty("UnmoderatedFramesPerHundredDpcs", static_cast<int>(framesPerHundredDpcs[0]));
+    RecordProperty("ModeratedFramesPerHundredDpcs", static_cast<int>(framesPerHundredDpcs[1]));
+}
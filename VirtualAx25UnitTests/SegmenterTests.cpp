@@ -0,0 +1,394 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file SegmenterTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver Segmenter and SegmentReassembler classes
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "Segmenter.h"
+
+#include <initializer_list>
+#include <vector>
+
+namespace
+{
+    constexpr AX25Address ALPHA = AX25Address("KG7UDH", 1);
+    constexpr AX25Address BRAVO = AX25Address("N0CALL", 2);
+    constexpr AX25Address CHARLIE = AX25Address("N0CALL", 3);
+    constexpr BYTE PID_IPV4 = 0xCC;
+    constexpr ULONG BUFFER_COUNT = 4;
+    constexpr ULONG BUFFER_SIZE = 1500;
+
+    /** Lends a few buffers to a reassembler, and collects the datagrams it joins up */
+    class Buffers : public SegmentReassemblerClient
+    {
+    public:
+        explicit Buffers(ULONG count = BUFFER_COUNT)
+            :netBufferLists(count)
+            ,data(count, std::vector<BYTE>(BUFFER_SIZE))
+            ,taken(count, false)
+        {
+        }
+
+        NET_BUFFER_LIST* TakeSegmentBuffer(BYTE** buffer, ULONG* capacity) noexcept override
+        {
+            for (size_t i = 0; i < taken.size(); i++)
+            {
+                if (!taken[i])
+                {
+                    taken[i] = true;
+                    *buffer = data[i].data();
+                    *capacity = BUFFER_SIZE;
+                    return &netBufferLists[i];
+                }
+            }
+            return nullptr;
+        }
+
+        void ReturnSegmentBuffer(NET_BUFFER_LIST& buffer) noexcept override
+        {
+            const size_t index = &buffer - netBufferLists.data();
+            EXPECT_TRUE(taken[index]);
+            taken[index] = false;
+        }
+
+        void SegmentsReassembled(const AX25Address& local, const AX25Address& peer, BYTE pid,
+                                 NET_BUFFER_LIST& buffer, ULONG length) noexcept override
+        {
+            const size_t index = &buffer - netBufferLists.data();
+            EXPECT_TRUE(local == ALPHA);
+            EXPECT_FALSE(peer == ALPHA);
+            EXPECT_EQ(PID_IPV4, pid);
+            datagrams.emplace_back(data[index].begin(), data[index].begin() + length);
+            ReturnSegmentBuffer(buffer);
+        }
+
+        /** @returns the number of buffers held by the reassembler */
+        ULONG held() const
+        {
+            ULONG count = 0;
+            for (bool isTaken : taken)
+            {
+                count += isTaken ? 1 : 0;
+            }
+            return count;
+        }
+
+        std::vector<NET_BUFFER_LIST> netBufferLists;
+        std::vector<std::vector<BYTE>> data;
+        std::vector<bool> taken;
+        std::vector<std::vector<BYTE>> datagrams;
+    };
+
+    /** One end of a link, which joins up the segments it receives */
+    class Station : public DataLinkClient
+    {
+    public:
+        Station(AX25Address self, AX25Address other)
+        {
+            AX25AddressField path;
+            path.Destination = other;
+            path.Source = self;
+            link.Open(path);
+        }
+
+        bool DataLinkTransmit(const FrameGatherList& frame) noexcept override
+        {
+            std::vector<BYTE> bytes(frame.GetTotalLength());
+            (void)frame.CopyTo(bytes.data(), static_cast<ULONG>(bytes.size()));
+            outbox.push_back(bytes);
+            return true;
+        }
+
+        bool DataLinkReceive(const DataLink& source, BYTE pid, const BYTE* information, ULONG length) noexcept override
+        {
+            frames.emplace_back(information, information + length);
+            if (pid == Segmenter::PID_SEGMENT)
+            {
+                return reassembler.Receive(source.GetLocal(), source.GetPeer(), information, length, 0, buffers);
+            }
+
+            EXPECT_EQ(PID_IPV4, pid);
+            buffers.datagrams.emplace_back(information, information + length);
+            return true;
+        }
+
+        /** Hands everything each station has to send to the other, until neither has anything left */
+        static void exchange(Station& first, Station& second)
+        {
+            for (bool busy = true; busy; )
+            {
+                busy = first.sendTo(second) | second.sendTo(first);
+            }
+        }
+
+        /** Sends everything due to the other station */
+        bool sendTo(Station& other)
+        {
+            link.Transmit(*this, 0);
+            std::vector<std::vector<BYTE>> frames;
+            frames.swap(outbox);
+            for (const std::vector<BYTE>& frame : frames)
+            {
+                AX25AddressField addresses;
+                const ULONG addressLength = addresses.Parse(frame.data(), static_cast<ULONG>(frame.size()));
+                EXPECT_NE(0UL, addressLength);
+                other.link.ReceiveFrame(addresses, frame.data() + addressLength, static_cast<ULONG>(frame.size()) - addressLength, 0, other);
+            }
+            return !frames.empty();
+        }
+
+        DataLink link;
+        SegmentReassembler reassembler;
+        Buffers buffers;
+        std::vector<std::vector<BYTE>> outbox;
+        std::vector<std::vector<BYTE>> frames;
+    };
+
+    /** @returns a datagram of the specified length, with no two neighbouring bytes alike */
+    std::vector<BYTE> datagramOf(ULONG length)
+    {
+        std::vector<BYTE> datagram(length);
+        for (ULONG i = 0; i < length; i++)
+        {
+            datagram[i] = static_cast<BYTE>(i * 7 + 1);
+        }
+        return datagram;
+    }
+
+    /** @returns a segment with the specified header and data */
+    std::vector<BYTE> segmentOf(BYTE header, std::initializer_list<BYTE> data)
+    {
+        std::vector<BYTE> segment(1, header);
+        segment.insert(segment.end(), data.begin(), data.end());
+        return segment;
+    }
+
+    /** Hands a segment to a reassembler, as if BRAVO had sent it to ALPHA */
+    bool receive(SegmentReassembler& reassembler, const std::vector<BYTE>& segment, ULONG64 now, Buffers& buffers, AX25Address peer = BRAVO)
+    {
+        return reassembler.Receive(ALPHA, peer, segment.data(), static_cast<ULONG>(segment.size()), now, buffers);
+    }
+}
+
+TEST(Segmenter, CountsTheFramesOfADatagram)
+{
+    EXPECT_EQ(1UL, Segmenter::GetFrameCount(256, 256));
+    EXPECT_EQ(2UL, Segmenter::GetFrameCount(257, 256));
+
+    // The PID rides along with the data, 255 bytes to a segment
+    EXPECT_EQ(6UL, Segmenter::GetFrameCount(1500, 256));
+    EXPECT_EQ(3UL, Segmenter::GetFrameCount(1500, 512));
+    EXPECT_EQ(Segmenter::MAX_SEGMENTS, Segmenter::GetFrameCount(Segmenter::MAX_SEGMENTS * 255 - 1, 256));
+    EXPECT_EQ(0UL, Segmenter::GetFrameCount(Segmenter::MAX_SEGMENTS * 255, 256));
+    EXPECT_EQ(0UL, Segmenter::GetFrameCount(3, 2));
+}
+
+TEST(Segmenter, SplitsAndJoinsUpALongDatagram)
+{
+    Station alpha(ALPHA, BRAVO);
+    Station bravo(BRAVO, ALPHA);
+    DataLinkParameters parameters = DataLink::DEFAULT_PARAMETERS;
+    parameters.MaxInformationLength = 256;
+    parameters.WindowSize = 7;
+    ASSERT_TRUE(bravo.link.SetParameters(parameters));
+
+    const std::vector<BYTE> datagram = datagramOf(1500);
+    ASSERT_TRUE(Segmenter::Send(bravo.link, PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size())));
+    EXPECT_EQ(6UL, bravo.link.GetQueuedCount());
+    Station::exchange(bravo, alpha);
+
+    // Every segment is a full I frame but the last, counting down to 0 from the first
+    ASSERT_EQ(6U, alpha.frames.size());
+    EXPECT_EQ(Segmenter::FIRST_SEGMENT | 5, alpha.frames[0][0]);
+    EXPECT_EQ(PID_IPV4, alpha.frames[0][1]);
+    for (size_t i = 0; i < alpha.frames.size(); i++)
+    {
+        EXPECT_EQ(i == 5 ? 1501U - 5 * 255 + 1 : 256U, alpha.frames[i].size());
+        EXPECT_EQ(5 - i, static_cast<size_t>(alpha.frames[i][0] & Segmenter::REMAINING_MASK));
+    }
+
+    ASSERT_EQ(1U, alpha.buffers.datagrams.size());
+    EXPECT_EQ(datagram, alpha.buffers.datagrams[0]);
+    EXPECT_EQ(0UL, alpha.buffers.held());
+    EXPECT_EQ(1UL, alpha.reassembler.GetCounters().Reassembled);
+}
+
+TEST(Segmenter, SendsShortDatagramsWhole)
+{
+    Station alpha(ALPHA, BRAVO);
+    Station bravo(BRAVO, ALPHA);
+    const std::vector<BYTE> datagram = datagramOf(DataLink::MAX_INFORMATION_LENGTH);
+    ASSERT_TRUE(Segmenter::Send(bravo.link, PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size())));
+    Station::exchange(bravo, alpha);
+
+    ASSERT_EQ(1U, alpha.buffers.datagrams.size());
+    EXPECT_EQ(datagram, alpha.buffers.datagrams[0]);
+    EXPECT_EQ(0UL, alpha.reassembler.GetCounters().Reassembled);
+}
+
+TEST(Segmenter, QueuesAllOfTheSegmentsOrNone)
+{
+    Station bravo(BRAVO, ALPHA);
+    const std::vector<BYTE> datagram = datagramOf(1500);
+    for (ULONG i = 0; i < DataLink::QUEUE_LENGTH - 2; i++)
+    {
+        ASSERT_TRUE(bravo.link.Send(PID_IPV4, datagram.data(), 1));
+    }
+
+    EXPECT_FALSE(Segmenter::Send(bravo.link, PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size())));
+    EXPECT_EQ(DataLink::QUEUE_LENGTH - 2, bravo.link.GetQueuedCount());
+
+    // Too long to split at all
+    Station charlie(CHARLIE, ALPHA);
+    const std::vector<BYTE> huge = datagramOf(Segmenter::MAX_SEGMENTS * (DataLink::MAX_INFORMATION_LENGTH - 1));
+    EXPECT_FALSE(Segmenter::Send(charlie.link, PID_IPV4, huge.data(), static_cast<ULONG>(huge.size())));
+    EXPECT_EQ(0UL, charlie.link.GetQueuedCount());
+}
+
+TEST(Segmenter, KeepsSegmentsShortUntilThePeerIsKnown)
+{
+    Station bravo(BRAVO, ALPHA);
+    DataLinkParameters parameters = DataLink::DEFAULT_PARAMETERS;
+    parameters.Negotiate = true;
+    ASSERT_TRUE(bravo.link.SetParameters(parameters));
+    EXPECT_EQ(DataLink::LEGACY_INFORMATION_LENGTH, bravo.link.GetMaxInformationLength());
+
+    const std::vector<BYTE> datagram = datagramOf(DataLink::MAX_INFORMATION_LENGTH);
+    EXPECT_FALSE(bravo.link.Send(PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size())));
+    ASSERT_TRUE(Segmenter::Send(bravo.link, PID_IPV4, datagram.data(), static_cast<ULONG>(datagram.size())));
+    EXPECT_EQ(3UL, bravo.link.GetQueuedCount());
+}
+
+TEST(SegmentReassembler, DropsADatagramMissingASegment)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers;
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 2, { PID_IPV4, 1, 2 }), 0, buffers));
+    EXPECT_EQ(1UL, buffers.held());
+
+    // The segment with 1 to come never arrived
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 3 }), 0, buffers));
+    EXPECT_EQ(0UL, buffers.held());
+    EXPECT_EQ(1UL, reassembler.GetCounters().Dropped);
+
+    // Nor does a new datagram pick up a stray segment of an old one
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 3 }), 0, buffers));
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers));
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 2 }), 0, buffers));
+    ASSERT_EQ(1U, buffers.datagrams.size());
+    EXPECT_EQ(std::vector<BYTE>({ 1, 2 }), buffers.datagrams[0]);
+    EXPECT_EQ(2UL, reassembler.GetCounters().Dropped);
+}
+
+TEST(SegmentReassembler, StartsOverOnANewFirstSegment)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers;
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 2, { PID_IPV4, 1 }), 0, buffers));
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 4 }), 0, buffers));
+    EXPECT_EQ(1UL, buffers.held());
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 5 }), 0, buffers));
+
+    ASSERT_EQ(1U, buffers.datagrams.size());
+    EXPECT_EQ(std::vector<BYTE>({ 4, 5 }), buffers.datagrams[0]);
+    EXPECT_EQ(1UL, reassembler.GetCounters().Dropped);
+}
+
+TEST(SegmentReassembler, DropsDatagramsLongerThanTheBuffer)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers;
+    std::vector<BYTE> first(DataLink::MAX_INFORMATION_LENGTH, 0);
+    first[0] = Segmenter::FIRST_SEGMENT | 3;
+    first[1] = PID_IPV4;
+    std::vector<BYTE> rest(DataLink::MAX_INFORMATION_LENGTH, 0);
+    EXPECT_TRUE(receive(reassembler, first, 0, buffers));
+    rest[0] = 2;
+    EXPECT_TRUE(receive(reassembler, rest, 0, buffers));
+    rest[0] = 1;
+    EXPECT_TRUE(receive(reassembler, rest, 0, buffers));
+    EXPECT_EQ(0UL, buffers.held());
+    EXPECT_EQ(1UL, reassembler.GetCounters().Dropped);
+    EXPECT_TRUE(buffers.datagrams.empty());
+}
+
+TEST(SegmentReassembler, ExpiresStaleSegments)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers;
+    EXPECT_EQ(MAXULONG64, reassembler.GetNextTimeout());
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 2, { PID_IPV4, 1 }), 1000, buffers));
+    EXPECT_EQ(1000 + SegmentReassembler::TIMEOUT_MILLISECONDS, reassembler.GetNextTimeout());
+
+    // Each segment which arrives buys the datagram more time
+    EXPECT_TRUE(receive(reassembler, segmentOf(1, { 2 }), 2000, buffers));
+    EXPECT_EQ(2000 + SegmentReassembler::TIMEOUT_MILLISECONDS, reassembler.GetNextTimeout());
+    reassembler.Expire(2000 + SegmentReassembler::TIMEOUT_MILLISECONDS - 1, buffers);
+    EXPECT_EQ(1UL, buffers.held());
+
+    reassembler.Expire(2000 + SegmentReassembler::TIMEOUT_MILLISECONDS, buffers);
+    EXPECT_EQ(0UL, buffers.held());
+    EXPECT_EQ(1UL, reassembler.GetCounters().Expired);
+    EXPECT_EQ(MAXULONG64, reassembler.GetNextTimeout());
+
+    // A late segment finds nothing to join
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 3 }), 2000 + SegmentReassembler::TIMEOUT_MILLISECONDS, buffers));
+    EXPECT_TRUE(buffers.datagrams.empty());
+}
+
+TEST(SegmentReassembler, PushesBackWhenOutOfBuffers)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers;
+    ASSERT_LT(BUFFER_COUNT, SegmentReassembler::CONTEXT_COUNT);
+    for (ULONG i = 0; i < BUFFER_COUNT; i++)
+    {
+        const AX25Address peer = AX25Address("N1CALL", static_cast<BYTE>(i));
+        EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, peer));
+    }
+
+    // The peer is left to send its first segment again
+    EXPECT_FALSE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, CHARLIE));
+
+    reassembler.Discard(buffers);
+    EXPECT_EQ(0UL, buffers.held());
+    EXPECT_EQ(BUFFER_COUNT, reassembler.GetCounters().Dropped);
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, CHARLIE));
+}
+
+TEST(SegmentReassembler, PushesBackWhenOutOfContexts)
+{
+    SegmentReassembler reassembler;
+    Buffers buffers(SegmentReassembler::CONTEXT_COUNT + 1);
+    for (ULONG i = 0; i < SegmentReassembler::CONTEXT_COUNT; i++)
+    {
+        const AX25Address peer = AX25Address("N1CALL", static_cast<BYTE>(i));
+        EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, peer));
+    }
+
+    EXPECT_FALSE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, CHARLIE));
+    EXPECT_EQ(SegmentReassembler::CONTEXT_COUNT, buffers.held());
+
+    // Finishing one datagram frees its context for the next peer
+    EXPECT_TRUE(receive(reassembler, segmentOf(0, { 2 }), 0, buffers, AX25Address("N1CALL", 0)));
+    EXPECT_TRUE(receive(reassembler, segmentOf(Segmenter::FIRST_SEGMENT | 1, { PID_IPV4, 1 }), 0, buffers, CHARLIE));
+    EXPECT_EQ(1U, buffers.datagrams.size());
+}
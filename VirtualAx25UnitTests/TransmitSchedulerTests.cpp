@@ -0,0 +1,294 @@
+// This file is part of the KG7UDH Virtual AX.25 NDIS Driver.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is free software: 
+// you can redistribute it and / or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// The KG7UDH Virtual AX.25 NDIS Driver is distributed in 
+// the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this software. If not, see <http://www.gnu.org/licenses/>.
+
+/**
+ * @file TransmitSchedulerTests.cpp
+ * Unit tests for the Virtual AX.25 NDIS Driver TransmitScheduler template
+ * @author Matthew P. Del Buono (KG7UDH)
+ */
+#include "pch.h"
+#include "KernelMocks.h"
+#include "TransmitScheduler.h"
+
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /** Stand-in for a NET_BUFFER_LIST */
+    struct Node
+    {
+        Node* next;                 //<! Link field owned by the scheduler
+        ULONG_PTR enqueueTime;      //<! Time field owned by the scheduler
+        ULONG length;               //<! Bytes in the frame
+        TransmitClass transmitClass;
+        ULONG64 arrival;            //<! Time the frame was offered, for the simulation
+    };
+
+    struct NodeTraits
+    {
+        static Node*& Next(Node& node) { return node.next; }
+        static ULONG_PTR& EnqueueTime(Node& node) { return node.enqueueTime; }
+        static ULONG Length(Node& node) { return node.length; }
+    };
+
+    typedef TransmitScheduler<Node, NodeTraits> Scheduler;
+
+    /** @returns a frame of the specified class and length */
+    Node frame(TransmitClass transmitClass, ULONG length)
+    {
+        Node node = {};
+        node.transmitClass = transmitClass;
+        node.length = length;
+        return node;
+    }
+}
+
+/**
+ * Verifies that the eight priorities are grouped as IEEE 802.1Q does for four queues
+ */
+TEST(TransmitScheduler, ClassOfPriority)
+{
+    const TransmitClass expected[8] = {
+        TransmitClassNormal, TransmitClassBulk, TransmitClassBulk, TransmitClassNormal,
+        TransmitClassInteractive, TransmitClassInteractive, TransmitClassControl, TransmitClassControl
+    };
+    for (ULONG priority = 0; priority < 8; priority++)
+    {
+        EXPECT_EQ(expected[priority], transmitClassOfPriority(priority)) << "Priority " << priority;
+    }
+}
+
+/**
+ * Verifies that frames of one class come out in the order they went in, and that the depth of the queue and the
+ * time each frame waited are reported
+ */
+TEST(TransmitScheduler, FirstInFirstOutWithinClass)
+{
+    Scheduler scheduler;
+    EXPECT_TRUE(scheduler.IsEmpty());
+    EXPECT_EQ(nullptr, scheduler.Dequeue(0));
+
+    Node nodes[3] = { frame(TransmitClassNormal, 100), frame(TransmitClassNormal, 100), frame(TransmitClassNormal, 100) };
+    scheduler.Enqueue(nodes[0], TransmitClassNormal, 1000);
+    scheduler.Enqueue(nodes[1], TransmitClassNormal, 1010);
+    scheduler.Enqueue(nodes[2], TransmitClassNormal, 1020);
+    EXPECT_FALSE(scheduler.IsEmpty());
+
+    AX25_TRANSMIT_CLASS_STATISTICS statistics;
+    scheduler.GetStatistics(statistics);
+    EXPECT_EQ(3U, statistics.Classes[TransmitClassNormal].Depth);
+    EXPECT_EQ(3U, statistics.Classes[TransmitClassNormal].MaxDepth);
+
+    EXPECT_EQ(&nodes[0], scheduler.Dequeue(1100));
+    EXPECT_EQ(&nodes[1], scheduler.Dequeue(1100));
+    EXPECT_EQ(&nodes[2], scheduler.Dequeue(1200));
+    EXPECT_EQ(nullptr, scheduler.Dequeue(1200));
+    EXPECT_TRUE(scheduler.IsEmpty());
+
+    scheduler.GetStatistics(statistics);
+    const AX25_TRANSMIT_CLASS& normal = statistics.Classes[TransmitClassNormal];
+    EXPECT_EQ(0U, normal.Depth);
+    EXPECT_EQ(3U, normal.MaxDepth);
+    EXPECT_EQ(3U, normal.Frames);
+    EXPECT_EQ(300U, normal.Bytes);
+    EXPECT_EQ(100U + 90U + 180U, normal.TotalSojournMilliseconds);
+    EXPECT_EQ(180U, normal.MaxSojournMilliseconds);
+    EXPECT_EQ(0U, statistics.Classes[TransmitClassBulk].Frames);
+}
+
+/**
+ * Verifies that a control frame goes out before everything else that is waiting, however long that has waited
+ */
+TEST(TransmitScheduler, ControlIsServedFirst)
+{
+    Scheduler scheduler;
+    Node bulk = frame(TransmitClassBulk, 10);
+    Node interactive = frame(TransmitClassInteractive, 10);
+    Node control[2] = { frame(TransmitClassControl, 1500), frame(TransmitClassControl, 1500) };
+    scheduler.Enqueue(bulk, TransmitClassBulk, 0);
+    scheduler.Enqueue(interactive, TransmitClassInteractive, 0);
+    scheduler.Enqueue(control[0], TransmitClassControl, 5);
+    scheduler.Enqueue(control[1], TransmitClassControl, 5);
+
+    EXPECT_EQ(&control[0], scheduler.Dequeue(10));
+    EXPECT_EQ(&control[1], scheduler.Dequeue(10));
+    EXPECT_EQ(&interactive, scheduler.Dequeue(10));
+    EXPECT_EQ(&bulk, scheduler.Dequeue(10));
+    EXPECT_TRUE(scheduler.IsEmpty());
+}
+
+/**
+ * Verifies that busy weighted classes share the bytes sent in the ratio of their weights, even when their frames
+ * are of very different lengths
+ */
+TEST(TransmitScheduler, WeightedClassesShareBytes)
+{
+    const TransmitClass classes[] = { TransmitClassInteractive, TransmitClassNormal, TransmitClassBulk };
+    const ULONG lengths[] = { 60, 1500, 256 };
+    constexpr ULONG FRAMES_PER_CLASS = 4000;
+
+    std::vector<Node> nodes;
+    nodes.reserve(3 * FRAMES_PER_CLASS);
+    Scheduler scheduler;
+    for (ULONG i = 0; i < FRAMES_PER_CLASS; i++)
+    {
+        for (ULONG c = 0; c < 3; c++)
+        {
+            nodes.push_back(frame(classes[c], lengths[c]));
+            scheduler.Enqueue(nodes.back(), classes[c], 0);
+        }
+    }
+
+    // Only count while every class is still busy
+    ULONG64 bytes[AX25_TRANSMIT_CLASS_COUNT] = {};
+    ULONG64 total = 0;
+    while (total < 400000)
+    {
+        Node* node = scheduler.Dequeue(0);
+        ASSERT_NE(nullptr, node);
+        bytes[node->transmitClass] += node->length;
+        total += node->length;
+    }
+
+    for (TransmitClass transmitClass : classes)
+    {
+        const double expected = total * Scheduler::GetWeight(transmitClass) / 7.0;
+        EXPECT_NEAR(expected, static_cast<double>(bytes[transmitClass]), 1500 + Scheduler::QUANTUM_BYTES * 4)
+            << "Class " << transmitClass;
+    }
+}
+
+/**
+ * Verifies that a class which runs empty does not save up credit, so it cannot later send a burst ahead of the
+ * others, and that a frame which arrives in an idle class waits at most one turn of each of the others
+ */
+TEST(TransmitScheduler, IdleClassDoesNotSaveCredit)
+{
+    Scheduler scheduler;
+    std::vector<Node> bulk(64, frame(TransmitClassBulk, 256));
+    for (Node& node : bulk)
+    {
+        scheduler.Enqueue(node, TransmitClassBulk, 0);
+    }
+
+    // With nothing else waiting, bulk gets every turn
+    for (ULONG i = 0; i < 16; i++)
+    {
+        EXPECT_EQ(&bulk[i], scheduler.Dequeue(0));
+    }
+
+    std::vector<Node> interactive(8, frame(TransmitClassInteractive, 256));
+    for (Node& node : interactive)
+    {
+        scheduler.Enqueue(node, TransmitClassInteractive, 0);
+    }
+
+    // At most one bulk frame (the rest of its turn) goes before interactive's turn, which is then 4 frames
+    ULONG bulkBefore = 0;
+    Node* node = scheduler.Dequeue(0);
+    while (node->transmitClass == TransmitClassBulk)
+    {
+        bulkBefore++;
+        node = scheduler.Dequeue(0);
+    }
+    EXPECT_LE(bulkBefore, 1U);
+    for (ULONG i = 1; i < 4; i++)
+    {
+        EXPECT_EQ(TransmitClassInteractive, scheduler.Dequeue(0)->transmitClass);
+    }
+    EXPECT_EQ(TransmitClassBulk, scheduler.Dequeue(0)->transmitClass);
+}
+
+/**
+ * Simulates a 1200 bps channel carrying a bulk transfer, which always has frames waiting, and an interactive
+ * session which sends a short frame every few seconds. Reports how long the interactive frames wait when every
+ * frame shares one queue, as before frames were classified, and when each is in the queue of its class.
+ */
+TEST(TransmitScheduler, InteractiveLatencyBehindBulk)
+{
+    constexpr ULONG BITS_PER_SECOND = 1200;
+    constexpr ULONG BULK_LENGTH = 256;
+    constexpr ULONG INTERACTIVE_LENGTH = 64;
+    constexpr ULONG BULK_BACKLOG = 16;              // Frames of the transfer waiting at any time, as TCP's window allows
+    constexpr ULONG64 DURATION = 3600 * 1000;
+    struct Scenario
+    {
+        const char* name;
+        bool classified;
+    };
+    const Scenario scenarios[] = { { "SingleQueue", false }, { "Classified", true } };
+
+    for (const Scenario& scenario : scenarios)
+    {
+        std::mt19937 random(7);
+        std::exponential_distribution<double> keystrokeGap(1.0 / 3000);
+        std::deque<Node> nodes;
+        Scheduler scheduler;
+        ULONG bulkWaiting = 0;
+        ULONG64 now = 0;
+        ULONG64 nextKeystroke = static_cast<ULONG64>(keystrokeGap(random));
+        ULONG64 interactiveFrames = 0;
+        ULONG64 interactiveWait = 0;
+        ULONG64 interactiveMaxWait = 0;
+        ULONG64 bulkBytes = 0;
+        while (now < DURATION)
+        {
+            for (; bulkWaiting < BULK_BACKLOG; bulkWaiting++)
+            {
+                nodes.push_back(frame(TransmitClassBulk, BULK_LENGTH));
+                nodes.back().arrival = now;
+                scheduler.Enqueue(nodes.back(), scenario.classified ? TransmitClassBulk : TransmitClassNormal, now);
+            }
+            for (; nextKeystroke <= now; nextKeystroke += 1 + static_cast<ULONG64>(keystrokeGap(random)))
+            {
+                nodes.push_back(frame(TransmitClassInteractive, INTERACTIVE_LENGTH));
+                nodes.back().arrival = nextKeystroke;
+                scheduler.Enqueue(nodes.back(), scenario.classified ? TransmitClassInteractive : TransmitClassNormal, now);
+            }
+
+            Node* node = scheduler.Dequeue(now);
+            ASSERT_NE(nullptr, node);
+            if (node->transmitClass == TransmitClassInteractive)
+            {
+                const ULONG64 wait = now - node->arrival;
+                interactiveFrames++;
+                interactiveWait += wait;
+                interactiveMaxWait = (wait > interactiveMaxWait) ? wait : interactiveMaxWait;
+            }
+            else
+            {
+                bulkWaiting--;
+                bulkBytes += node->length;
+            }
+            now += (node->length + 3) * 8ULL * 1000 / BITS_PER_SECOND;
+        }
+
+        ASSERT_NE(0U, interactiveFrames);
+        const std::string name = scenario.name;
+        RecordProperty(name + "InteractiveMeanWaitMilliseconds", static_cast<int>(interactiveWait / interactiveFrames));
+        RecordProperty(name + "InteractiveMaxWaitMilliseconds", static_cast<int>(interactiveMaxWait));
+        RecordProperty(name + "BulkBytesPerSecond", static_cast<int>(bulkBytes * 1000 / DURATION));
+        if (scenario.classified)
+        {
+            // One bulk frame may be on its way when a keystroke arrives, and at most one more goes ahead of it
+            EXPECT_LE(interactiveMaxWait, 2 * (BULK_LENGTH + 3) * 8ULL * 1000 / BITS_PER_SECOND + 1000);
+        }
+    }
+}